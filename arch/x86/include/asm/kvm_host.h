@@ -899,6 +899,7 @@ struct kvm_vcpu_stat {
 	u64 fpu_reload;
 	u64 insn_emulation;
 	u64 insn_emulation_fail;
+	u64 fast_tracked_writes;
 	u64 hypercalls;
 	u64 irq_injections;
 	u64 nmi_injections;
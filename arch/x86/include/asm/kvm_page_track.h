@@ -13,10 +13,14 @@ enum kvm_page_track_mode {
  *
  * Write access on the head is protected by kvm->mmu_lock, read access
  * is protected by track_srcu.
+ *
+ * @owner_tree maps the gfns claimed with kvm_page_track_set_owner() to
+ * their owner, so that writes to them are dispatched straight to it.
  */
 struct kvm_page_track_notifier_head {
 	struct srcu_struct track_srcu;
 	struct hlist_head track_notifier_list;
+	struct radix_tree_root owner_tree;
 };
 
 struct kvm_page_track_notifier_node {
@@ -34,6 +38,18 @@ struct kvm_page_track_notifier_node {
 	 */
 	void (*track_write)(struct kvm_vcpu *vcpu, gpa_t gpa, const u8 *new,
 			    int bytes, struct kvm_page_track_notifier_node *node);
+	/*
+	 * It is called instead of @track_write when guest is writing a
+	 * page this node has claimed with kvm_page_track_set_owner().
+	 *
+	 * @vcpu: the vcpu where the write access happened.
+	 * @gpa: the physical address written by guest.
+	 * @new: the data was written to the address.
+	 * @bytes: the written length.
+	 * @data: the pointer given when the page was claimed.
+	 */
+	void (*track_write_owned)(struct kvm_vcpu *vcpu, gpa_t gpa,
+				  const u8 *new, int bytes, void *data);
 	/*
 	 * It is called when memory slot is being moved or removed
 	 * users can drop write-protection for the pages in that memory slot
@@ -60,6 +76,14 @@ void kvm_slot_page_track_add_page(struct kvm *kvm,
 void kvm_slot_page_track_remove_page(struct kvm *kvm,
 				     struct kvm_memory_slot *slot, gfn_t gfn,
 				     enum kvm_page_track_mode mode);
+void kvm_slot_page_track_add_range(struct kvm *kvm,
+				   struct kvm_memory_slot *slot, gfn_t gfn,
+				   unsigned long npages,
+				   enum kvm_page_track_mode mode);
+void kvm_slot_page_track_remove_range(struct kvm *kvm,
+				      struct kvm_memory_slot *slot, gfn_t gfn,
+				      unsigned long npages,
+				      enum kvm_page_track_mode mode);
 bool kvm_page_track_is_active(struct kvm_vcpu *vcpu, gfn_t gfn,
 			      enum kvm_page_track_mode mode);
 
@@ -69,6 +93,11 @@ kvm_page_track_register_notifier(struct kvm *kvm,
 void
 kvm_page_track_unregister_notifier(struct kvm *kvm,
 				   struct kvm_page_track_notifier_node *n);
+int kvm_page_track_set_owner(struct kvm *kvm, gfn_t gfn,
+			     struct kvm_page_track_notifier_node *n,
+			     void *data);
+void kvm_page_track_clear_owner(struct kvm *kvm, gfn_t gfn,
+				struct kvm_page_track_notifier_node *n);
 void kvm_page_track_write(struct kvm_vcpu *vcpu, gpa_t gpa, const u8 *new,
 			  int bytes);
 void kvm_page_track_flush_slot(struct kvm *kvm, struct kvm_memory_slot *slot);
@@ -4962,6 +4962,9 @@ int kvm_mmu_page_fault(struct kvm_vcpu *vcpu, gva_t cr2, u64 error_code,
 
 	if (mmio_info_in_cache(vcpu, cr2, direct))
 		emulation_type = 0;
+	else if (direct && kvm_fast_emulate_tracked_write(vcpu, cr2, insn,
+							  insn_len))
+		return 1;
 emulate:
 	/*
 	 * On AMD platforms, under certain conditions insn_len may be zero on #NPF.
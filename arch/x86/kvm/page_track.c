@@ -15,6 +15,8 @@
 
 #include <linux/kvm_host.h>
 #include <linux/rculist.h>
+#include <linux/radix-tree.h>
+#include <linux/slab.h>
 
 #include <asm/kvm_host.h>
 #include <asm/kvm_page_track.h>
@@ -92,23 +94,55 @@ void kvm_slot_page_track_add_page(struct kvm *kvm,
 				  struct kvm_memory_slot *slot, gfn_t gfn,
 				  enum kvm_page_track_mode mode)
 {
+	kvm_slot_page_track_add_range(kvm, slot, gfn, 1, mode);
+}
+EXPORT_SYMBOL_GPL(kvm_slot_page_track_add_page);
+
+/*
+ * add a range of guest pages to the tracking pool, flushing the TLBs once
+ * for the whole range.
+ *
+ * It should be called under the protection both of mmu-lock and kvm->srcu
+ * or kvm->slots_lock.
+ *
+ * @kvm: the guest instance we are interested in.
+ * @slot: the range belongs to.
+ * @gfn: the first guest page.
+ * @npages: number of guest pages.
+ * @mode: tracking mode, currently only write track is supported.
+ */
+void kvm_slot_page_track_add_range(struct kvm *kvm,
+				   struct kvm_memory_slot *slot, gfn_t gfn,
+				   unsigned long npages,
+				   enum kvm_page_track_mode mode)
+{
+	bool flush = false;
+	gfn_t end = gfn + npages;
 
 	if (WARN_ON(!page_track_mode_is_valid(mode)))
 		return;
 
-	update_gfn_track(slot, gfn, mode, 1);
+	if (WARN_ON(gfn < slot->base_gfn ||
+		    end > slot->base_gfn + slot->npages))
+		return;
+
+	for (; gfn < end; gfn++) {
+		update_gfn_track(slot, gfn, mode, 1);
 
-	/*
-	 * new track stops large page mapping for the
-	 * tracked page.
-	 */
-	kvm_mmu_gfn_disallow_lpage(slot, gfn);
+		/*
+		 * new track stops large page mapping for the
+		 * tracked page.
+		 */
+		kvm_mmu_gfn_disallow_lpage(slot, gfn);
+
+		if (mode == KVM_PAGE_TRACK_WRITE)
+			flush |= kvm_mmu_slot_gfn_write_protect(kvm, slot, gfn);
+	}
 
-	if (mode == KVM_PAGE_TRACK_WRITE)
-		if (kvm_mmu_slot_gfn_write_protect(kvm, slot, gfn))
-			kvm_flush_remote_tlbs(kvm);
+	if (flush)
+		kvm_flush_remote_tlbs(kvm);
 }
-EXPORT_SYMBOL_GPL(kvm_slot_page_track_add_page);
+EXPORT_SYMBOL_GPL(kvm_slot_page_track_add_range);
 
 /*
  * remove the guest page from the tracking pool which stops the interception
@@ -127,18 +161,48 @@ void kvm_slot_page_track_remove_page(struct kvm *kvm,
 				     struct kvm_memory_slot *slot, gfn_t gfn,
 				     enum kvm_page_track_mode mode)
 {
+	kvm_slot_page_track_remove_range(kvm, slot, gfn, 1, mode);
+}
+EXPORT_SYMBOL_GPL(kvm_slot_page_track_remove_page);
+
+/*
+ * remove a range of guest pages from the tracking pool. It is the opposed
+ * operation of kvm_slot_page_track_add_range().
+ *
+ * It should be called under the protection both of mmu-lock and kvm->srcu
+ * or kvm->slots_lock.
+ *
+ * @kvm: the guest instance we are interested in.
+ * @slot: the range belongs to.
+ * @gfn: the first guest page.
+ * @npages: number of guest pages.
+ * @mode: tracking mode, currently only write track is supported.
+ */
+void kvm_slot_page_track_remove_range(struct kvm *kvm,
+				      struct kvm_memory_slot *slot, gfn_t gfn,
+				      unsigned long npages,
+				      enum kvm_page_track_mode mode)
+{
+	gfn_t end = gfn + npages;
+
 	if (WARN_ON(!page_track_mode_is_valid(mode)))
 		return;
 
-	update_gfn_track(slot, gfn, mode, -1);
+	if (WARN_ON(gfn < slot->base_gfn ||
+		    end > slot->base_gfn + slot->npages))
+		return;
+
+	for (; gfn < end; gfn++) {
+		update_gfn_track(slot, gfn, mode, -1);
 
-	/*
-	 * allow large page mapping for the tracked page
-	 * after the tracker is gone.
-	 */
-	kvm_mmu_gfn_allow_lpage(slot, gfn);
+		/*
+		 * allow large page mapping for the tracked page
+		 * after the tracker is gone.
+		 */
+		kvm_mmu_gfn_allow_lpage(slot, gfn);
+	}
 }
-EXPORT_SYMBOL_GPL(kvm_slot_page_track_remove_page);
+EXPORT_SYMBOL_GPL(kvm_slot_page_track_remove_range);
 
 /*
  * check if the corresponding access on the specified guest page is tracked.
@@ -160,11 +224,51 @@ bool kvm_page_track_is_active(struct kvm_vcpu *vcpu, gfn_t gfn,
 	return !!READ_ONCE(slot->arch.gfn_track[mode][index]);
 }
 
+struct kvm_page_track_owner {
+	struct kvm_page_track_notifier_node *node;
+	void *data;
+	struct rcu_head rcu;
+};
+
+static void page_track_owner_free(struct rcu_head *rcu)
+{
+	kfree(container_of(rcu, struct kvm_page_track_owner, rcu));
+}
+
+/*
+ * drop the ownership of the pages claimed by @n, or of all the pages if
+ * @n is NULL. It should be called under mmu-lock.
+ */
+static void page_track_drop_owners(struct kvm *kvm,
+				   struct kvm_page_track_notifier_node *n)
+{
+	struct kvm_page_track_notifier_head *head;
+	struct kvm_page_track_owner *o;
+	struct radix_tree_iter iter;
+	void __rcu **slot;
+
+	head = &kvm->arch.track_notifier_head;
+
+	radix_tree_for_each_slot(slot, &head->owner_tree, &iter, 0) {
+		o = radix_tree_deref_slot_protected(slot, &kvm->mmu_lock);
+		if (n && o->node != n)
+			continue;
+		radix_tree_iter_delete(&head->owner_tree, &iter, slot);
+		call_srcu(&head->track_srcu, &o->rcu, page_track_owner_free);
+	}
+}
+
 void kvm_page_track_cleanup(struct kvm *kvm)
 {
 	struct kvm_page_track_notifier_head *head;
 
 	head = &kvm->arch.track_notifier_head;
+
+	spin_lock(&kvm->mmu_lock);
+	page_track_drop_owners(kvm, NULL);
+	spin_unlock(&kvm->mmu_lock);
+
+	srcu_barrier(&head->track_srcu);
 	cleanup_srcu_struct(&head->track_srcu);
 }
 
@@ -175,6 +279,7 @@ void kvm_page_track_init(struct kvm *kvm)
 	head = &kvm->arch.track_notifier_head;
 	init_srcu_struct(&head->track_srcu);
 	INIT_HLIST_HEAD(&head->track_notifier_list);
+	INIT_RADIX_TREE(&head->owner_tree, GFP_ATOMIC);
 }
 
 /*
@@ -209,23 +314,87 @@ kvm_page_track_unregister_notifier(struct kvm *kvm,
 
 	spin_lock(&kvm->mmu_lock);
 	hlist_del_rcu(&n->node);
+	page_track_drop_owners(kvm, n);
 	spin_unlock(&kvm->mmu_lock);
 	synchronize_srcu(&head->track_srcu);
 }
 EXPORT_SYMBOL_GPL(kvm_page_track_unregister_notifier);
 
+/*
+ * claim the tracked guest page for the notifier, so that writes to it are
+ * delivered to @n->track_write_owned() with @data, instead of walking all
+ * the notifiers and letting each of them look the page up.
+ *
+ * It should be called under the protection of mmu-lock.
+ */
+int kvm_page_track_set_owner(struct kvm *kvm, gfn_t gfn,
+			     struct kvm_page_track_notifier_node *n,
+			     void *data)
+{
+	struct kvm_page_track_notifier_head *head;
+	struct kvm_page_track_owner *o;
+	int ret;
+
+	if (WARN_ON(!n->track_write_owned))
+		return -EINVAL;
+
+	head = &kvm->arch.track_notifier_head;
+
+	o = radix_tree_lookup(&head->owner_tree, gfn);
+	if (o)
+		return o->node == n ? 0 : -EBUSY;
+
+	o = kmalloc(sizeof(*o), GFP_ATOMIC);
+	if (!o)
+		return -ENOMEM;
+
+	o->node = n;
+	o->data = data;
+
+	ret = radix_tree_insert(&head->owner_tree, gfn, o);
+	if (ret)
+		kfree(o);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(kvm_page_track_set_owner);
+
+/*
+ * give up the ownership of the guest page. It is the opposed operation of
+ * kvm_page_track_set_owner().
+ *
+ * It should be called under the protection of mmu-lock.
+ */
+void kvm_page_track_clear_owner(struct kvm *kvm, gfn_t gfn,
+				struct kvm_page_track_notifier_node *n)
+{
+	struct kvm_page_track_notifier_head *head;
+	struct kvm_page_track_owner *o;
+
+	head = &kvm->arch.track_notifier_head;
+
+	o = radix_tree_lookup(&head->owner_tree, gfn);
+	if (!o || o->node != n)
+		return;
+
+	radix_tree_delete(&head->owner_tree, gfn);
+	call_srcu(&head->track_srcu, &o->rcu, page_track_owner_free);
+}
+EXPORT_SYMBOL_GPL(kvm_page_track_clear_owner);
+
 /*
  * Notify the node that write access is intercepted and write emulation is
  * finished at this time.
  *
- * The node should figure out if the written page is the one that node is
- * interested in by itself.
+ * The owner of the page, if any, is called directly. Otherwise the node
+ * should figure out if the written page is the one that node is interested
+ * in by itself.
  */
 void kvm_page_track_write(struct kvm_vcpu *vcpu, gpa_t gpa, const u8 *new,
 			  int bytes)
 {
 	struct kvm_page_track_notifier_head *head;
 	struct kvm_page_track_notifier_node *n;
+	struct kvm_page_track_owner *o;
 	int idx;
 
 	head = &vcpu->kvm->arch.track_notifier_head;
@@ -234,6 +403,14 @@ void kvm_page_track_write(struct kvm_vcpu *vcpu, gpa_t gpa, const u8 *new,
 		return;
 
 	idx = srcu_read_lock(&head->track_srcu);
+
+	/* The owner record itself is freed after a track_srcu grace period. */
+	rcu_read_lock();
+	o = radix_tree_lookup(&head->owner_tree, gpa_to_gfn(gpa));
+	rcu_read_unlock();
+	if (o)
+		o->node->track_write_owned(vcpu, gpa, new, bytes, o->data);
+
 	hlist_for_each_entry_rcu(n, &head->track_notifier_list, node)
 		if (n->track_write)
 			n->track_write(vcpu, gpa, new, bytes, n);
@@ -182,6 +182,7 @@ struct kvm_stats_debugfs_item debugfs_entries[] = {
 	{ "fpu_reload", VCPU_STAT(fpu_reload) },
 	{ "insn_emulation", VCPU_STAT(insn_emulation) },
 	{ "insn_emulation_fail", VCPU_STAT(insn_emulation_fail) },
+	{ "fast_tracked_writes", VCPU_STAT(fast_tracked_writes) },
 	{ "irq_injections", VCPU_STAT(irq_injections) },
 	{ "nmi_injections", VCPU_STAT(nmi_injections) },
 	{ "req_event", VCPU_STAT(req_event) },
@@ -5876,6 +5877,92 @@ static bool kvm_vcpu_check_breakpoint(struct kvm_vcpu *vcpu, int *r)
 	return false;
 }
 
+/*
+ * Fast path for the common write to a write tracked page table: an aligned
+ * "mov %reg, mem" quadword store in 64-bit mode, e.g. a guest updating a
+ * PTE of a page table shadowed by GVT-g. It is decoded here and forwarded
+ * to the page track notifiers without going through the full emulator.
+ *
+ * @gpa must be the faulting guest physical address, i.e. only TDP faults
+ * are handled. Returns false if the instruction has to be emulated.
+ */
+bool kvm_fast_emulate_tracked_write(struct kvm_vcpu *vcpu, gpa_t gpa,
+				    void *insn, int insn_len)
+{
+	u32 access = (kvm_x86_ops->get_cpl(vcpu) == 3) ? PFERR_USER_MASK : 0;
+	u8 buf[15], *p = buf, rex, modrm, mod, rm;
+	unsigned long rip, val;
+	struct x86_exception e;
+	unsigned int len;
+	gpa_t rip_gpa;
+
+	if (!IS_ALIGNED(gpa, sizeof(u64)) || !is_64_bit_mode(vcpu) ||
+	    is_guest_mode(vcpu))
+		return false;
+
+	/* Leave anything but plain sequential execution to the emulator. */
+	if (vcpu->arch.emulate_regs_need_sync_to_vcpu ||
+	    (vcpu->guest_debug & KVM_GUESTDBG_SINGLESTEP) ||
+	    (kvm_get_rflags(vcpu) & X86_EFLAGS_TF) ||
+	    kvm_x86_ops->get_interrupt_shadow(vcpu))
+		return false;
+
+	if (!kvm_page_track_is_active(vcpu, gpa_to_gfn(gpa),
+				      KVM_PAGE_TRACK_WRITE))
+		return false;
+
+	rip = kvm_rip_read(vcpu);
+	if (insn && insn_len) {
+		len = min_t(unsigned int, insn_len, sizeof(buf));
+		memcpy(buf, insn, len);
+	} else {
+		len = min_t(unsigned int, sizeof(buf),
+			    PAGE_SIZE - offset_in_page(rip));
+		rip_gpa = vcpu->arch.walk_mmu->gva_to_gpa(vcpu, rip,
+						access | PFERR_FETCH_MASK, &e);
+		if (rip_gpa == UNMAPPED_GVA ||
+		    kvm_vcpu_read_guest_page(vcpu, gpa_to_gfn(rip_gpa), buf,
+					     offset_in_page(rip), len) < 0)
+			return false;
+	}
+
+	/* REX.W + 89 /r, with a memory destination. */
+	if (len < 3)
+		return false;
+	rex = *p++;
+	if ((rex & 0xf8) != 0x48 || *p++ != 0x89)
+		return false;
+	modrm = *p++;
+	mod = modrm >> 6;
+	rm = modrm & 7;
+	if (mod == 3)
+		return false;
+
+	if (rm == 4) {
+		if (p - buf >= len)
+			return false;
+		if (mod == 0 && (*p & 7) == 5)
+			p += 4;
+		p++;
+	} else if (mod == 0 && rm == 5) {
+		p += 4;
+	}
+	if (mod == 1)
+		p += 1;
+	else if (mod == 2)
+		p += 4;
+	if (p - buf > len)
+		return false;
+
+	val = kvm_register_read(vcpu, ((modrm >> 3) & 7) | ((rex & 4) << 1));
+	if (!emulator_write_phys(vcpu, gpa, &val, sizeof(u64)))
+		return false;
+
+	kvm_rip_write(vcpu, rip + (p - buf));
+	++vcpu->stat.fast_tracked_writes;
+	return true;
+}
+
 int x86_emulate_instruction(struct kvm_vcpu *vcpu,
 			    unsigned long cr2,
 			    int emulation_type,
@@ -183,6 +183,9 @@ static inline bool vcpu_match_mmio_gpa(struct kvm_vcpu *vcpu, gpa_t gpa)
 	return false;
 }
 
+bool kvm_fast_emulate_tracked_write(struct kvm_vcpu *vcpu, gpa_t gpa,
+				    void *insn, int insn_len);
+
 static inline unsigned long kvm_register_readl(struct kvm_vcpu *vcpu,
 					       enum kvm_reg reg)
 {
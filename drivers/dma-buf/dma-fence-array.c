@@ -60,6 +60,18 @@ static bool dma_fence_array_enable_signaling(struct dma_fence *fence)
 
 	for (i = 0; i < array->num_fences; ++i) {
 		cb[i].array = array;
+
+		/*
+		 * Large arrays are often mostly complete by the time anyone
+		 * waits upon them, so check each fence before paying for a
+		 * reference and taking its lock to install the callback.
+		 */
+		if (dma_fence_is_signaled(array->fences[i])) {
+			if (atomic_dec_and_test(&array->num_pending))
+				return false;
+			continue;
+		}
+
 		/*
 		 * As we may report that the fence is signaled before all
 		 * callbacks are complete, we need to take an additional
@@ -55,6 +55,55 @@ EXPORT_SYMBOL(reservation_seqcount_class);
 const char reservation_seqcount_string[] = "reservation_seqcount";
 EXPORT_SYMBOL(reservation_seqcount_string);
 
+/*
+ * Compact the shared fence list in place, dropping every fence that has
+ * already signaled. Called with obj->lock held when the list is full, so
+ * that a long lived object with many readers keeps reusing its slots
+ * rather than doubling the list on every new context.
+ */
+static void
+reservation_object_prune_shared(struct reservation_object *obj,
+				struct reservation_object_list *fobj)
+{
+	u32 i, j, count = fobj->shared_count;
+
+	preempt_disable();
+	write_seqcount_begin(&obj->seq);
+
+	for (i = 0, j = 0; i < count; ++i) {
+		struct dma_fence *check;
+
+		check = rcu_dereference_protected(fobj->shared[i],
+						  reservation_object_held(obj));
+		if (dma_fence_is_signaled(check))
+			continue;
+
+		/* keep the live fences at the front, the signaled at the end */
+		if (i != j) {
+			struct dma_fence *signaled;
+
+			signaled = rcu_dereference_protected(fobj->shared[j],
+						reservation_object_held(obj));
+			RCU_INIT_POINTER(fobj->shared[i], signaled);
+			RCU_INIT_POINTER(fobj->shared[j], check);
+		}
+		j++;
+	}
+
+	/*
+	 * memory barrier is added by write_seqcount_begin,
+	 * fobj->shared_count is protected by this lock too
+	 */
+	fobj->shared_count = j;
+
+	write_seqcount_end(&obj->seq);
+	preempt_enable();
+
+	for (i = j; i < count; ++i)
+		dma_fence_put(rcu_dereference_protected(fobj->shared[i],
+						reservation_object_held(obj)));
+}
+
 /**
  * reservation_object_reserve_shared - Reserve space to add a shared
  * fence to a reservation_object.
@@ -74,6 +123,9 @@ int reservation_object_reserve_shared(struct reservation_object *obj)
 	old = reservation_object_get_list(obj);
 
 	if (old && old->shared_max) {
+		if (old->shared_count == old->shared_max)
+			reservation_object_prune_shared(obj, old);
+
 		if (old->shared_count < old->shared_max) {
 			/* perform an in-place update */
 			kfree(obj->staged);
@@ -206,6 +206,13 @@ static void add_fence(struct dma_fence **fences,
 	}
 }
 
+/*
+ * Merging a few fences, which is the common case for a compositor, is done
+ * on the stack. If they collapse to a single fence it is used as is,
+ * otherwise only the array of the result is allocated.
+ */
+#define SYNC_FILE_MERGE_STACK	8
+
 /**
  * sync_file_merge() - merge two sync_files
  * @name:	name of new fence
@@ -220,6 +227,7 @@ static struct sync_file *sync_file_merge(const char *name, struct sync_file *a,
 					 struct sync_file *b)
 {
 	struct sync_file *sync_file;
+	struct dma_fence *stack[SYNC_FILE_MERGE_STACK];
 	struct dma_fence **fences, **nfences, **a_fences, **b_fences;
 	int i, i_a, i_b, num_fences, a_num_fences, b_num_fences;
 
@@ -230,13 +238,17 @@ static struct sync_file *sync_file_merge(const char *name, struct sync_file *a,
 	a_fences = get_fences(a, &a_num_fences);
 	b_fences = get_fences(b, &b_num_fences);
 	if (a_num_fences > INT_MAX - b_num_fences)
-		return NULL;
+		goto err;
 
 	num_fences = a_num_fences + b_num_fences;
 
-	fences = kcalloc(num_fences, sizeof(*fences), GFP_KERNEL);
-	if (!fences)
-		goto err;
+	if (num_fences <= ARRAY_SIZE(stack)) {
+		fences = stack;
+	} else {
+		fences = kcalloc(num_fences, sizeof(*fences), GFP_KERNEL);
+		if (!fences)
+			goto err;
+	}
 
 	/*
 	 * Assume sync_file a and b are both ordered and have no
@@ -277,23 +289,41 @@ static struct sync_file *sync_file_merge(const char *name, struct sync_file *a,
 	if (i == 0)
 		fences[i++] = dma_fence_get(a_fences[0]);
 
-	if (num_fences > i) {
+	/* the contexts collapsed, the new sync_file takes the single fence */
+	if (i == 1) {
+		sync_file->fence = fences[0];
+		if (fences != stack)
+			kfree(fences);
+		goto out;
+	}
+
+	if (fences == stack) {
+		fences = kmemdup(stack, i * sizeof(*fences), GFP_KERNEL);
+		if (!fences) {
+			fences = stack;
+			goto err_put;
+		}
+	} else if (num_fences > i) {
 		nfences = krealloc(fences, i * sizeof(*fences),
 				  GFP_KERNEL);
 		if (!nfences)
-			goto err;
+			goto err_put;
 
 		fences = nfences;
 	}
 
-	if (sync_file_set_fence(sync_file, fences, i) < 0) {
-		kfree(fences);
-		goto err;
-	}
+	if (sync_file_set_fence(sync_file, fences, i) < 0)
+		goto err_put;
 
+out:
 	strlcpy(sync_file->user_name, name, sizeof(sync_file->user_name));
 	return sync_file;
 
+err_put:
+	while (i--)
+		dma_fence_put(fences[i]);
+	if (fences != stack)
+		kfree(fences);
 err:
 	fput(sync_file->file);
 	return NULL;
@@ -239,6 +239,51 @@ static void drm_mm_interval_tree_add_node(struct drm_mm_node *hole_node,
 #define HOLE_SIZE(NODE) ((NODE)->hole_size)
 #define HOLE_ADDR(NODE) (__drm_mm_hole_node_start(NODE))
 
+/*
+ * The address ordered hole tree is augmented with the largest hole of each
+ * subtree, so that searches bottom-up or top-down skip the parts of the
+ * address space which are too fragmented to fit the allocation, instead of
+ * visiting every small hole on the way.
+ */
+static inline u64 rb_subtree_max_hole(struct rb_node *rb)
+{
+	return rb ? rb_entry(rb, struct drm_mm_node,
+			     rb_hole_addr)->subtree_max_hole : 0;
+}
+
+static inline u64 compute_subtree_max_hole(struct drm_mm_node *node)
+{
+	return max3(node->hole_size,
+		    rb_subtree_max_hole(node->rb_hole_addr.rb_left),
+		    rb_subtree_max_hole(node->rb_hole_addr.rb_right));
+}
+
+RB_DECLARE_CALLBACKS(static, hole_addr_augment,
+		     struct drm_mm_node, rb_hole_addr,
+		     u64, subtree_max_hole, compute_subtree_max_hole)
+
+static void insert_hole_addr(struct rb_root *root, struct drm_mm_node *node)
+{
+	struct rb_node **link = &root->rb_node, *rb = NULL;
+	u64 start = HOLE_ADDR(node);
+	struct drm_mm_node *parent;
+
+	node->subtree_max_hole = node->hole_size;
+	while (*link) {
+		rb = *link;
+		parent = rb_entry(rb, struct drm_mm_node, rb_hole_addr);
+		if (parent->subtree_max_hole < node->hole_size)
+			parent->subtree_max_hole = node->hole_size;
+		if (start < HOLE_ADDR(parent))
+			link = &rb->rb_left;
+		else
+			link = &rb->rb_right;
+	}
+
+	rb_link_node(&node->rb_hole_addr, rb, link);
+	rb_insert_augmented(&node->rb_hole_addr, root, &hole_addr_augment);
+}
+
 static void add_hole(struct drm_mm_node *node)
 {
 	struct drm_mm *mm = node->mm;
@@ -248,7 +293,7 @@ static void add_hole(struct drm_mm_node *node)
 	DRM_MM_BUG_ON(!drm_mm_hole_follows(node));
 
 	RB_INSERT(mm->holes_size, rb_hole_size, HOLE_SIZE);
-	RB_INSERT(mm->holes_addr, rb_hole_addr, HOLE_ADDR);
+	insert_hole_addr(&mm->holes_addr, node);
 
 	list_add(&node->hole_stack, &mm->hole_stack);
 }
@@ -259,8 +304,10 @@ static void rm_hole(struct drm_mm_node *node)
 
 	list_del(&node->hole_stack);
 	rb_erase(&node->rb_hole_size, &node->mm->holes_size);
-	rb_erase(&node->rb_hole_addr, &node->mm->holes_addr);
+	rb_erase_augmented(&node->rb_hole_addr, &node->mm->holes_addr,
+			   &hole_addr_augment);
 	node->hole_size = 0;
+	node->subtree_max_hole = 0;
 
 	DRM_MM_BUG_ON(drm_mm_hole_follows(node));
 }
@@ -299,7 +346,12 @@ static struct drm_mm_node *best_hole(struct drm_mm *mm, u64 size)
 	return rb_hole_size_to_node(best);
 }
 
-static struct drm_mm_node *find_hole(struct drm_mm *mm, u64 addr)
+static inline bool usable_hole_addr(struct rb_node *rb, u64 size)
+{
+	return rb_subtree_max_hole(rb) >= size;
+}
+
+static struct drm_mm_node *find_hole(struct drm_mm *mm, u64 addr, u64 size)
 {
 	struct drm_mm_node *node = NULL;
 	struct rb_node **link = &mm->holes_addr.rb_node;
@@ -307,6 +359,10 @@ static struct drm_mm_node *find_hole(struct drm_mm *mm, u64 addr)
 	while (*link) {
 		u64 hole_start;
 
+		/* nothing below is large enough, start from the parent */
+		if (!usable_hole_addr(*link, size))
+			break;
+
 		node = rb_hole_addr_to_node(*link);
 		hole_start = __drm_mm_hole_node_start(node);
 
@@ -335,10 +391,10 @@ first_hole(struct drm_mm *mm,
 		return best_hole(mm, size);
 
 	case DRM_MM_INSERT_LOW:
-		return find_hole(mm, start);
+		return find_hole(mm, start, size);
 
 	case DRM_MM_INSERT_HIGH:
-		return find_hole(mm, end);
+		return find_hole(mm, end, size);
 
 	case DRM_MM_INSERT_EVICT:
 		return list_first_entry_or_null(&mm->hole_stack,
@@ -347,9 +403,36 @@ first_hole(struct drm_mm *mm,
 	}
 }
 
+/*
+ * Step to the next hole in address order, upwards for @first == rb_right or
+ * downwards for @first == rb_left, skipping the subtrees without a hole of
+ * at least @size.
+ */
+#define DECLARE_NEXT_HOLE_ADDR(name, first, last)			\
+static struct drm_mm_node *name(struct drm_mm_node *entry, u64 size)	\
+{									\
+	struct rb_node *parent, *node = &entry->rb_hole_addr;		\
+									\
+	if (usable_hole_addr(node->first, size)) {			\
+		node = node->first;					\
+		while (usable_hole_addr(node->last, size))		\
+			node = node->last;				\
+		return rb_hole_addr_to_node(node);			\
+	}								\
+									\
+	while ((parent = rb_parent(node)) && node == parent->first)	\
+		node = parent;						\
+									\
+	return rb_hole_addr_to_node(parent);				\
+}
+
+DECLARE_NEXT_HOLE_ADDR(next_hole_low_addr, rb_right, rb_left)
+DECLARE_NEXT_HOLE_ADDR(next_hole_high_addr, rb_left, rb_right)
+
 static struct drm_mm_node *
 next_hole(struct drm_mm *mm,
 	  struct drm_mm_node *node,
+	  u64 size,
 	  enum drm_mm_insert_mode mode)
 {
 	switch (mode) {
@@ -358,10 +441,10 @@ next_hole(struct drm_mm *mm,
 		return rb_hole_size_to_node(rb_next(&node->rb_hole_size));
 
 	case DRM_MM_INSERT_LOW:
-		return rb_hole_addr_to_node(rb_next(&node->rb_hole_addr));
+		return next_hole_low_addr(node, size);
 
 	case DRM_MM_INSERT_HIGH:
-		return rb_hole_addr_to_node(rb_prev(&node->rb_hole_addr));
+		return next_hole_high_addr(node, size);
 
 	case DRM_MM_INSERT_EVICT:
 		node = list_next_entry(node, hole_stack);
@@ -395,7 +478,7 @@ int drm_mm_reserve_node(struct drm_mm *mm, struct drm_mm_node *node)
 		return -ENOSPC;
 
 	/* Find the relevant hole to add our node to */
-	hole = find_hole(mm, node->start);
+	hole = find_hole(mm, node->start, 0);
 	if (!hole)
 		return -ENOSPC;
 
@@ -426,6 +509,107 @@ int drm_mm_reserve_node(struct drm_mm *mm, struct drm_mm_node *node)
 }
 EXPORT_SYMBOL(drm_mm_reserve_node);
 
+/*
+ * Check whether @hole can take an allocation of @size within the range,
+ * and where in the hole it would go per @mode.
+ */
+static bool hole_fits(struct drm_mm *mm, struct drm_mm_node *hole,
+		      u64 size, u64 alignment, u64 remainder_mask,
+		      unsigned long color, u64 range_start, u64 range_end,
+		      enum drm_mm_insert_mode mode, u64 *start)
+{
+	u64 hole_start = __drm_mm_hole_node_start(hole);
+	u64 hole_end = hole_start + hole->hole_size;
+	u64 adj_start, adj_end;
+	u64 col_start, col_end;
+
+	col_start = hole_start;
+	col_end = hole_end;
+	if (mm->color_adjust)
+		mm->color_adjust(hole, color, &col_start, &col_end);
+
+	adj_start = max(col_start, range_start);
+	adj_end = min(col_end, range_end);
+
+	if (adj_end <= adj_start || adj_end - adj_start < size)
+		return false;
+
+	if (mode == DRM_MM_INSERT_HIGH)
+		adj_start = adj_end - size;
+
+	if (alignment) {
+		u64 rem;
+
+		if (likely(remainder_mask))
+			rem = adj_start & remainder_mask;
+		else
+			div64_u64_rem(adj_start, alignment, &rem);
+		if (rem) {
+			adj_start -= rem;
+			if (mode != DRM_MM_INSERT_HIGH)
+				adj_start += alignment;
+
+			if (adj_start < max(col_start, range_start) ||
+			    min(col_end, range_end) - adj_start < size)
+				return false;
+
+			if (adj_end <= adj_start ||
+			    adj_end - adj_start < size)
+				return false;
+		}
+	}
+
+	*start = adj_start;
+	return true;
+}
+
+/*
+ * The size ordered tree knows nothing about addresses, so a best fit
+ * restricted to part of the address space would walk all the larger holes
+ * outside of the range first. Instead visit the holes of the range which
+ * are large enough, bottom-up on the address ordered tree, and take the
+ * smallest one which fits.
+ */
+static struct drm_mm_node *
+best_hole_in_range(struct drm_mm *mm,
+		   u64 size, u64 alignment, u64 remainder_mask,
+		   unsigned long color, u64 range_start, u64 range_end,
+		   u64 *start)
+{
+	struct drm_mm_node *hole, *best = NULL;
+	u64 adj_start;
+
+	for (hole = find_hole(mm, range_start, size); hole;
+	     hole = next_hole_low_addr(hole, size)) {
+		if (__drm_mm_hole_node_start(hole) >= range_end)
+			break;
+
+		if (best && hole->hole_size >= best->hole_size)
+			continue;
+
+		if (!hole_fits(mm, hole, size, alignment, remainder_mask,
+			       color, range_start, range_end,
+			       DRM_MM_INSERT_BEST, &adj_start))
+			continue;
+
+		best = hole;
+		*start = adj_start;
+		if (best->hole_size == size)
+			break;
+	}
+
+	return best;
+}
+
+static bool range_is_restricted(const struct drm_mm *mm,
+				u64 range_start, u64 range_end)
+{
+	u64 mm_end = mm->head_node.start;
+	u64 mm_start = mm_end + mm->head_node.size;
+
+	return range_start > mm_start || range_end < mm_end;
+}
+
 /**
  * drm_mm_insert_node_in_range - ranged search for space and insert @node
  * @mm: drm_mm to allocate from
@@ -451,6 +635,8 @@ int drm_mm_insert_node_in_range(struct drm_mm * const mm,
 {
 	struct drm_mm_node *hole;
 	u64 remainder_mask;
+	u64 hole_start, hole_end;
+	u64 adj_start;
 
 	DRM_MM_BUG_ON(range_start >= range_end);
 
@@ -461,12 +647,21 @@ int drm_mm_insert_node_in_range(struct drm_mm * const mm,
 		alignment = 0;
 
 	remainder_mask = is_power_of_2(alignment) ? alignment - 1 : 0;
+
+	if (mode == DRM_MM_INSERT_BEST &&
+	    range_is_restricted(mm, range_start, range_end)) {
+		hole = best_hole_in_range(mm, size, alignment, remainder_mask,
+					  color, range_start, range_end,
+					  &adj_start);
+		if (!hole)
+			return -ENOSPC;
+		goto insert;
+	}
+
 	for (hole = first_hole(mm, range_start, range_end, size, mode); hole;
-	     hole = next_hole(mm, hole, mode)) {
-		u64 hole_start = __drm_mm_hole_node_start(hole);
-		u64 hole_end = hole_start + hole->hole_size;
-		u64 adj_start, adj_end;
-		u64 col_start, col_end;
+	     hole = next_hole(mm, hole, size, mode)) {
+		hole_start = __drm_mm_hole_node_start(hole);
+		hole_end = hole_start + hole->hole_size;
 
 		if (mode == DRM_MM_INSERT_LOW && hole_start >= range_end)
 			break;
@@ -474,63 +669,36 @@ int drm_mm_insert_node_in_range(struct drm_mm * const mm,
 		if (mode == DRM_MM_INSERT_HIGH && hole_end <= range_start)
 			break;
 
-		col_start = hole_start;
-		col_end = hole_end;
-		if (mm->color_adjust)
-			mm->color_adjust(hole, color, &col_start, &col_end);
-
-		adj_start = max(col_start, range_start);
-		adj_end = min(col_end, range_end);
-
-		if (adj_end <= adj_start || adj_end - adj_start < size)
-			continue;
+		if (hole_fits(mm, hole, size, alignment, remainder_mask,
+			      color, range_start, range_end, mode,
+			      &adj_start))
+			goto insert;
+	}
 
-		if (mode == DRM_MM_INSERT_HIGH)
-			adj_start = adj_end - size;
-
-		if (alignment) {
-			u64 rem;
-
-			if (likely(remainder_mask))
-				rem = adj_start & remainder_mask;
-			else
-				div64_u64_rem(adj_start, alignment, &rem);
-			if (rem) {
-				adj_start -= rem;
-				if (mode != DRM_MM_INSERT_HIGH)
-					adj_start += alignment;
-
-				if (adj_start < max(col_start, range_start) ||
-				    min(col_end, range_end) - adj_start < size)
-					continue;
-
-				if (adj_end <= adj_start ||
-				    adj_end - adj_start < size)
-					continue;
-			}
-		}
+	return -ENOSPC;
 
-		node->mm = mm;
-		node->size = size;
-		node->start = adj_start;
-		node->color = color;
-		node->hole_size = 0;
+insert:
+	hole_start = __drm_mm_hole_node_start(hole);
+	hole_end = hole_start + hole->hole_size;
 
-		list_add(&node->node_list, &hole->node_list);
-		drm_mm_interval_tree_add_node(hole, node);
-		node->allocated = true;
+	node->mm = mm;
+	node->size = size;
+	node->start = adj_start;
+	node->color = color;
+	node->hole_size = 0;
 
-		rm_hole(hole);
-		if (adj_start > hole_start)
-			add_hole(hole);
-		if (adj_start + size < hole_end)
-			add_hole(node);
+	list_add(&node->node_list, &hole->node_list);
+	drm_mm_interval_tree_add_node(hole, node);
+	node->allocated = true;
 
-		save_stack(node);
-		return 0;
-	}
+	rm_hole(hole);
+	if (adj_start > hole_start)
+		add_hole(hole);
+	if (adj_start + size < hole_end)
+		add_hole(node);
 
-	return -ENOSPC;
+	save_stack(node);
+	return 0;
 }
 EXPORT_SYMBOL(drm_mm_insert_node_in_range);
 
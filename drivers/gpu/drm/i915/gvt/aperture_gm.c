@@ -61,10 +61,21 @@ static int alloc_gm(struct intel_vgpu *vgpu, bool high_gm)
 	}
 
 	mutex_lock(&dev_priv->drm.struct_mutex);
+	/*
+	 * Take the smallest free hole which fits first, so that the holes
+	 * left by destroyed vGPUs get reused by vGPUs of the same or a
+	 * smaller type instead of splitting up the larger ones. Only evict
+	 * host objects when no hole is large enough.
+	 */
 	ret = i915_gem_gtt_insert(&dev_priv->ggtt.base, node,
 				  size, I915_GTT_PAGE_SIZE,
 				  I915_COLOR_UNEVICTABLE,
-				  start, end, flags);
+				  start, end, PIN_NOEVICT);
+	if (ret == -ENOSPC)
+		ret = i915_gem_gtt_insert(&dev_priv->ggtt.base, node,
+					  size, I915_GTT_PAGE_SIZE,
+					  I915_COLOR_UNEVICTABLE,
+					  start, end, flags);
 	mutex_unlock(&dev_priv->drm.struct_mutex);
 	if (ret)
 		gvt_err("fail to alloc %s gm space from host\n",
@@ -226,7 +237,9 @@ static void free_resource(struct intel_vgpu *vgpu)
 	struct intel_gvt *gvt = vgpu->gvt;
 
 	gvt->gm.vgpu_allocated_low_gm_size -= vgpu_aperture_sz(vgpu);
-	gvt->gm.vgpu_allocated_high_gm_size -= vgpu_hidden_sz(vgpu);
+	/* a pending balloon resize may still hold a larger range */
+	gvt->gm.vgpu_allocated_high_gm_size -=
+		max(vgpu_hidden_sz(vgpu), vgpu->gm.hidden_request);
 	gvt->fence.vgpu_allocated_fence_num -= vgpu_fence_sz(vgpu);
 }
 
@@ -318,6 +331,124 @@ void intel_vgpu_reset_resource(struct intel_vgpu *vgpu)
 	intel_runtime_pm_put(dev_priv);
 }
 
+/**
+ * intel_vgpu_resize_hidden_gm - change the size of the hidden GM of a vGPU
+ * @vgpu: a vGPU
+ * @size: new hidden GM size in bytes
+ *
+ * This function moves the hidden GM of a vGPU to a range of the new size.
+ * On failure the vGPU keeps its current range. The caller must hold
+ * gvt->lock and make sure that the vGPU is not in use by a guest.
+ *
+ * Returns:
+ * zero on success, negative error code if failed.
+ */
+int intel_vgpu_resize_hidden_gm(struct intel_vgpu *vgpu, u64 size)
+{
+	struct intel_gvt *gvt = vgpu->gvt;
+	struct drm_i915_private *dev_priv = gvt->dev_priv;
+	struct drm_mm_node *node = &vgpu->gm.high_gm_node;
+	u64 old_start = node->start;
+	u64 old_size = vgpu_hidden_sz(vgpu);
+	u64 avail;
+	int ret;
+
+	size = ALIGN(size, I915_GTT_PAGE_SIZE);
+	if (!size)
+		return -EINVAL;
+
+	avail = gvt_hidden_sz(gvt) - HOST_HIGH_GM_SIZE -
+		gvt->gm.vgpu_allocated_high_gm_size + old_size;
+	if (size > avail)
+		return -ENOSPC;
+
+	mutex_lock(&dev_priv->drm.struct_mutex);
+	drm_mm_remove_node(node);
+
+	ret = i915_gem_gtt_insert(&dev_priv->ggtt.base, node,
+				  size, I915_GTT_PAGE_SIZE,
+				  I915_COLOR_UNEVICTABLE,
+				  ALIGN(gvt_hidden_gmadr_base(gvt),
+					I915_GTT_PAGE_SIZE),
+				  ALIGN(gvt_hidden_gmadr_end(gvt),
+					I915_GTT_PAGE_SIZE),
+				  PIN_HIGH);
+	if (ret) {
+		/* nothing else could take the range under struct_mutex */
+		WARN_ON(i915_gem_gtt_reserve(&dev_priv->ggtt.base, node,
+					     old_size, old_start,
+					     I915_COLOR_UNEVICTABLE,
+					     PIN_NOEVICT));
+		mutex_unlock(&dev_priv->drm.struct_mutex);
+		gvt_vgpu_err("fail to resize hidden gm to %lluMB\n",
+			     BYTES_TO_MB(size));
+		return ret;
+	}
+	mutex_unlock(&dev_priv->drm.struct_mutex);
+
+	gvt->gm.vgpu_allocated_high_gm_size -= old_size;
+	gvt->gm.vgpu_allocated_high_gm_size += size;
+	vgpu_hidden_sz(vgpu) = size;
+
+	gvt_dbg_core("vgpu%d: resize high GM start %llx size %llx\n",
+		     vgpu->id, vgpu_hidden_offset(vgpu), vgpu_hidden_sz(vgpu));
+	return 0;
+}
+
+/**
+ * intel_vgpu_resize_hidden_gm_in_place - grow or shrink the hidden GM range
+ * @vgpu: a vGPU
+ * @size: new size of the range in bytes
+ *
+ * Unlike intel_vgpu_resize_hidden_gm(), this keeps the start of the range,
+ * so the addresses used by a running guest stay valid. Only the host range
+ * is changed, vgpu_hidden_sz() is left to the caller. The caller must hold
+ * gvt->lock.
+ *
+ * Returns:
+ * zero on success, negative error code if failed.
+ */
+int intel_vgpu_resize_hidden_gm_in_place(struct intel_vgpu *vgpu, u64 size)
+{
+	struct intel_gvt *gvt = vgpu->gvt;
+	struct drm_i915_private *dev_priv = gvt->dev_priv;
+	struct drm_mm_node *node = &vgpu->gm.high_gm_node;
+	u64 start = node->start;
+	u64 old_size = node->size;
+	int ret;
+
+	size = ALIGN(size, I915_GTT_PAGE_SIZE);
+	if (!size)
+		return -EINVAL;
+	if (size == old_size)
+		return 0;
+
+	if (size > old_size &&
+	    size - old_size > gvt_hidden_sz(gvt) - HOST_HIGH_GM_SIZE -
+			      gvt->gm.vgpu_allocated_high_gm_size)
+		return -ENOSPC;
+
+	mutex_lock(&dev_priv->drm.struct_mutex);
+	drm_mm_remove_node(node);
+
+	ret = i915_gem_gtt_reserve(&dev_priv->ggtt.base, node,
+				   size, start, I915_COLOR_UNEVICTABLE,
+				   PIN_NOEVICT);
+	if (ret)
+		/* nothing else could take the range under struct_mutex */
+		WARN_ON(i915_gem_gtt_reserve(&dev_priv->ggtt.base, node,
+					     old_size, start,
+					     I915_COLOR_UNEVICTABLE,
+					     PIN_NOEVICT));
+	mutex_unlock(&dev_priv->drm.struct_mutex);
+	if (ret)
+		return ret;
+
+	gvt->gm.vgpu_allocated_high_gm_size -= old_size;
+	gvt->gm.vgpu_allocated_high_gm_size += size;
+	return 0;
+}
+
 /**
  * intel_alloc_vgpu_resource - allocate HW resource for a vGPU
  * @vgpu: vGPU
@@ -34,7 +34,9 @@
  *
  */
 
+#include <linux/jhash.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include "i915_drv.h"
 #include "gvt.h"
 #include "i915_pvinfo.h"
@@ -364,8 +366,6 @@ struct parser_exec_state;
 
 typedef int (*parser_cmd_handler)(struct parser_exec_state *s);
 
-#define GVT_CMD_HASH_BITS   7
-
 /* which DWords need address fix */
 #define ADDR_FIX_1(x1)			(1 << (x1))
 #define ADDR_FIX_2(x1, x2)		(ADDR_FIX_1(x1) | ADDR_FIX_1(x2))
@@ -422,11 +422,6 @@ struct cmd_info {
 	parser_cmd_handler handler;
 };
 
-struct cmd_entry {
-	struct hlist_node hlist;
-	struct cmd_info *info;
-};
-
 enum {
 	RING_BUFFER_INSTRUCTION,
 	BATCH_BUFFER_INSTRUCTION,
@@ -473,9 +468,25 @@ struct parser_exec_state {
 	int saved_buf_addr_type;
 	bool is_ctx_wa;
 
+	/* the batch buffer being scanned is executed from the guest pages */
+	bool direct;
+	/* direct of the batch buffer to return to from 2nd level */
+	bool ret_bb_direct;
+	/* a command in a direct batch buffer would have to be patched */
+	bool direct_patched;
+
 	struct cmd_info *info;
 
 	struct intel_vgpu_workload *workload;
+
+	/* ring level batch buffer being scanned, a scan cache candidate */
+	struct intel_vgpu_shadow_bb *ring_bb;
+	unsigned long ring_bb_gma;
+	unsigned long ring_bb_size;
+	bool ring_bb_cacheable;
+	/* the scan didn't depend on the vGPU, e.g. on its GM range */
+	bool ring_bb_shareable;
+	DECLARE_BITMAP(ring_bb_events, INTEL_GVT_EVENT_MAX);
 };
 
 #define gmadr_dw_number(s)	\
@@ -556,7 +567,7 @@ static struct decode_info decode_info_vebox = {
 	sub_op_vebox,
 };
 
-static struct decode_info *ring_decode_info[I915_NUM_ENGINES][8] = {
+static struct decode_info *ring_decode_info[I915_NUM_ENGINES][GVT_CMD_TYPE_NUM] = {
 	[RCS] = {
 		&decode_info_mi,
 		NULL,
@@ -624,29 +635,56 @@ static inline u32 get_opcode(u32 cmd, int ring_id)
 	return cmd >> (32 - d_info->op_len);
 }
 
-static inline struct cmd_info *find_cmd_entry(struct intel_gvt *gvt,
+/*
+ * An opcode always carries the 3 bits of its command type on top, so the
+ * remaining (op_len - 3) bits directly index the per ring, per command
+ * type lookup table.
+ */
+static inline unsigned int cmd_table_size(struct decode_info *d_info)
+{
+	return 1U << (d_info->op_len - 3);
+}
+
+static struct cmd_info **cmd_table_slot(struct intel_gvt *gvt,
 		unsigned int opcode, int ring_id)
 {
-	struct cmd_entry *e;
+	struct decode_info *d_info;
+	unsigned int type;
 
-	hash_for_each_possible(gvt->cmd_table, e, hlist, opcode) {
-		if ((opcode == e->info->opcode) &&
-				(e->info->rings & (1 << ring_id)))
-			return e->info;
+	for (type = 0; type < GVT_CMD_TYPE_NUM; type++) {
+		d_info = ring_decode_info[ring_id][type];
+		if (d_info == NULL || !gvt->cmd_table[ring_id][type])
+			continue;
+		if ((opcode >> (d_info->op_len - 3)) != type)
+			continue;
+		return &gvt->cmd_table[ring_id][type][opcode &
+			(cmd_table_size(d_info) - 1)];
 	}
 	return NULL;
 }
 
+static inline struct cmd_info *find_cmd_entry(struct intel_gvt *gvt,
+		unsigned int opcode, int ring_id)
+{
+	struct cmd_info **slot;
+
+	slot = cmd_table_slot(gvt, opcode, ring_id);
+	return slot ? *slot : NULL;
+}
+
 static inline struct cmd_info *get_cmd_info(struct intel_gvt *gvt,
 		u32 cmd, int ring_id)
 {
-	u32 opcode;
+	struct decode_info *d_info;
+	struct cmd_info **table;
 
-	opcode = get_opcode(cmd, ring_id);
-	if (opcode == INVALID_OP)
+	d_info = ring_decode_info[ring_id][CMD_TYPE(cmd)];
+	table = gvt->cmd_table[ring_id][CMD_TYPE(cmd)];
+	if (d_info == NULL || table == NULL)
 		return NULL;
 
-	return find_cmd_entry(gvt, opcode, ring_id);
+	return table[(cmd >> (32 - d_info->op_len)) &
+		(cmd_table_size(d_info) - 1)];
 }
 
 static inline u32 sub_op_val(u32 cmd, u32 hi, u32 low)
@@ -791,7 +829,10 @@ static inline int cmd_length(struct parser_exec_state *s)
 
 /* do not remove this, some platform may need clflush here */
 #define patch_value(s, addr, val) do { \
-	*addr = val; \
+	if ((s)->direct) \
+		(s)->direct_patched = true; \
+	else \
+		*addr = val; \
 } while (0)
 
 static bool is_shadowed_mmio(unsigned int offset)
@@ -838,6 +879,50 @@ static int mocs_cmd_reg_handler(struct parser_exec_state *s,
 	if (!is_mocs_mmio(offset))
 		return -EINVAL;
 	vgpu_vreg(s->vgpu, offset) = cmd_val(s, index + 1);
+	s->ring_bb_cacheable = false;
+	return 0;
+}
+
+/*
+ * How a register operand of LRI/LRR/LRM/SRM is audited. The policy only
+ * depends on the platform, so it's worked out once per register at init
+ * time and each operand is then classified by a single table lookup.
+ */
+enum {
+	CMD_REG_DENY = 0,
+	CMD_REG_ALLOW,
+	CMD_REG_SHADOWED,
+	CMD_REG_MOCS,
+	CMD_REG_FORCE_NONPRIV,
+	CMD_REG_PVINFO,
+};
+
+static u8 cmd_reg_policy(struct intel_gvt *gvt, unsigned int offset)
+{
+	if (!intel_gvt_mmio_is_cmd_access(gvt, offset))
+		return CMD_REG_DENY;
+	if (is_shadowed_mmio(offset))
+		return CMD_REG_SHADOWED;
+	if (is_mocs_mmio(offset))
+		return CMD_REG_MOCS;
+	if (is_force_nonpriv_mmio(offset))
+		return CMD_REG_FORCE_NONPRIV;
+	if (offset == i915_mmio_reg_offset(DERRMR) ||
+	    offset == i915_mmio_reg_offset(FORCEWAKE_MT))
+		return CMD_REG_PVINFO;
+	return CMD_REG_ALLOW;
+}
+
+static int init_cmd_reg_policy(struct intel_gvt *gvt)
+{
+	unsigned int offset;
+
+	gvt->cmd_reg_policy = vzalloc(gvt->device_info.mmio_size >> 2);
+	if (!gvt->cmd_reg_policy)
+		return -ENOMEM;
+
+	for (offset = 0; offset < gvt->device_info.mmio_size; offset += 4)
+		gvt->cmd_reg_policy[offset >> 2] = cmd_reg_policy(gvt, offset);
 	return 0;
 }
 
@@ -853,29 +938,28 @@ static int cmd_reg_handler(struct parser_exec_state *s,
 		return -EFAULT;
 	}
 
-	if (!intel_gvt_mmio_is_cmd_access(gvt, offset)) {
+	switch (gvt->cmd_reg_policy[offset >> 2]) {
+	case CMD_REG_DENY:
 		gvt_vgpu_err("%s access to non-render register (%x)\n",
 				cmd, offset);
 		return 0;
-	}
-
-	if (is_shadowed_mmio(offset)) {
+	case CMD_REG_SHADOWED:
 		gvt_vgpu_err("found access of shadowed MMIO %x\n", offset);
 		return 0;
-	}
-
-	if (is_mocs_mmio(offset) &&
-	    mocs_cmd_reg_handler(s, offset, index))
-		return -EINVAL;
-
-	if (is_force_nonpriv_mmio(offset) &&
-		force_nonpriv_reg_handler(s, offset, index))
-		return -EPERM;
-
-	if (offset == i915_mmio_reg_offset(DERRMR) ||
-		offset == i915_mmio_reg_offset(FORCEWAKE_MT)) {
+	case CMD_REG_MOCS:
+		if (mocs_cmd_reg_handler(s, offset, index))
+			return -EINVAL;
+		break;
+	case CMD_REG_FORCE_NONPRIV:
+		if (force_nonpriv_reg_handler(s, offset, index))
+			return -EPERM;
+		break;
+	case CMD_REG_PVINFO:
 		/* Writing to HW VGT_PVINFO_PAGE offset will be discarded */
 		patch_value(s, cmd_ptr(s, index), VGT_PVINFO_PAGE);
+		break;
+	default:
+		break;
 	}
 
 	/* TODO: Update the global mask if this MMIO is a masked-MMIO */
@@ -1033,6 +1117,12 @@ static struct cmd_interrupt_event cmd_interrupt_events[] = {
 	},
 };
 
+static void add_pending_event(struct parser_exec_state *s, int event)
+{
+	set_bit(event, s->workload->pending_events);
+	set_bit(event, s->ring_bb_events);
+}
+
 static int cmd_handler_pipe_control(struct parser_exec_state *s)
 {
 	int gmadr_bytes = s->vgpu->gvt->device_info.gmadr_bytes_in_cmd;
@@ -1071,15 +1161,15 @@ static int cmd_handler_pipe_control(struct parser_exec_state *s)
 		return ret;
 
 	if (cmd_val(s, 1) & PIPE_CONTROL_NOTIFY)
-		set_bit(cmd_interrupt_events[s->ring_id].pipe_control_notify,
-				s->workload->pending_events);
+		add_pending_event(s,
+			cmd_interrupt_events[s->ring_id].pipe_control_notify);
 	return 0;
 }
 
 static int cmd_handler_mi_user_interrupt(struct parser_exec_state *s)
 {
-	set_bit(cmd_interrupt_events[s->ring_id].mi_user_interrupt,
-			s->workload->pending_events);
+	add_pending_event(s,
+		cmd_interrupt_events[s->ring_id].mi_user_interrupt);
 	return 0;
 }
 
@@ -1088,6 +1178,8 @@ static int cmd_advance_default(struct parser_exec_state *s)
 	return ip_gma_advance(s, cmd_length(s));
 }
 
+static void bb_scan_cache_add(struct parser_exec_state *s);
+
 static int cmd_handler_mi_batch_buffer_end(struct parser_exec_state *s)
 {
 	int ret;
@@ -1096,9 +1188,15 @@ static int cmd_handler_mi_batch_buffer_end(struct parser_exec_state *s)
 		s->buf_type = BATCH_BUFFER_INSTRUCTION;
 		ret = ip_gma_set(s, s->ret_ip_gma_bb);
 		s->buf_addr_type = s->saved_buf_addr_type;
+		s->direct = s->ret_bb_direct;
 	} else {
+		if (s->ring_bb && s->ring_bb_cacheable)
+			bb_scan_cache_add(s);
+		s->ring_bb = NULL;
+
 		s->buf_type = RING_BUFFER_INSTRUCTION;
 		s->buf_addr_type = GTT_BUFFER;
+		s->direct = false;
 		if (s->ret_ip_gma_ring >= s->ring_start + s->ring_size)
 			s->ret_ip_gma_ring -= s->ring_size;
 		ret = ip_gma_set(s, s->ret_ip_gma_ring);
@@ -1279,8 +1377,14 @@ static int gen8_update_plane_mmio_from_mi_display_flip(
 			      info->tile_val << 10);
 	}
 
-	vgpu_vreg_t(vgpu, PIPE_FRMCOUNT_G4X(info->pipe))++;
-	intel_vgpu_trigger_virtual_event(vgpu, info->event);
+	/* an async flip is done at once, its frame still waits for vblank */
+	if (info->async_flip)
+		intel_vgpu_trigger_virtual_event(vgpu, info->event);
+
+	intel_vgpu_queue_flip(vgpu, info->pipe,
+			      info->plane == PRIMARY_PLANE ?
+			      INTEL_VGPU_FLIP_PRIMARY : INTEL_VGPU_FLIP_SPRITE,
+			      info->async_flip ? -1 : info->event);
 	return 0;
 }
 
@@ -1347,6 +1451,7 @@ static int cmd_handler_mi_display_flip(struct parser_exec_state *s)
 		gvt_vgpu_err("fail to update plane mmio\n");
 		return ret;
 	}
+	s->ring_bb_cacheable = false;
 
 	for (i = 0; i < len; i++)
 		patch_value(s, cmd_ptr(s, i), MI_NOOP);
@@ -1418,6 +1523,9 @@ static inline int cmd_address_audit(struct parser_exec_state *s,
 	} else if (!intel_gvt_ggtt_validate_range(vgpu, guest_gma, op_size)) {
 		ret = -EFAULT;
 		goto err;
+	} else {
+		/* valid for this vGPU's GM only */
+		s->ring_bb_shareable = false;
 	}
 
 	return 0;
@@ -1550,8 +1658,8 @@ static int cmd_handler_mi_flush_dw(struct parser_exec_state *s)
 	}
 	/* Check notify bit */
 	if ((cmd_val(s, 0) & (1 << 8)))
-		set_bit(cmd_interrupt_events[s->ring_id].mi_flush_dw,
-				s->workload->pending_events);
+		add_pending_event(s,
+			cmd_interrupt_events[s->ring_id].mi_flush_dw);
 	return ret;
 }
 
@@ -1564,16 +1672,274 @@ static void addr_type_update_snb(struct parser_exec_state *s)
 }
 
 
+/*
+ * Workload capture
+ *
+ * To benchmark the parser on real streams, the guest memory read while
+ * shadowing and scanning the ring buffers of the next workloads of a vGPU
+ * can be recorded. A replay runs the same shadow and scan again, with the
+ * guest memory reads served by the record instead of the guest, so that a
+ * stream captured once can be fed to the parser of any kernel. All of it
+ * is protected by the struct_mutex, like the scan itself.
+ */
+#define GVT_CAPTURE_MAX		64
+#define GVT_CAPTURE_MAGIC	0x43545647	/* "GVTC" */
+
+struct intel_vgpu_capture_chunk {
+	struct list_head list;
+	unsigned long gma;
+	unsigned int len;
+	u8 data[0];
+};
+
+struct intel_vgpu_capture {
+	struct list_head list;
+	int ring_id;
+	unsigned long rb_start, rb_head, rb_tail, rb_ctl;
+	struct list_head chunks;
+	unsigned int nr_chunks;
+	bool failed;
+};
+
+/* layout of a capture in the dump, followed by its chunks */
+struct gvt_capture_header {
+	u32 magic;
+	u32 ring_id;
+	u64 rb_start;
+	u32 rb_head;
+	u32 rb_tail;
+	u32 rb_ctl;
+	u32 nr_chunks;
+};
+
+/* layout of a chunk in the dump, followed by its data */
+struct gvt_capture_chunk_header {
+	u64 gma;
+	u32 len;
+	u32 reserved;
+};
+
+static void capture_free(struct intel_vgpu_capture *capture)
+{
+	struct intel_vgpu_capture_chunk *c, *tmp;
+
+	list_for_each_entry_safe(c, tmp, &capture->chunks, list)
+		kfree(c);
+	kfree(capture);
+}
+
+static struct intel_vgpu_capture_chunk *
+capture_find_chunk(struct intel_vgpu_capture *capture,
+		   unsigned long gma, unsigned long len)
+{
+	struct intel_vgpu_capture_chunk *c;
+
+	list_for_each_entry(c, &capture->chunks, list) {
+		if (gma >= c->gma && gma + len <= c->gma + c->len)
+			return c;
+	}
+	return NULL;
+}
+
+/*
+ * Record the guest memory of [gma, gma + len). The batch buffer size is
+ * found by reading one command at a time before the whole batch buffer is
+ * read, so the chunks covered by a new one are dropped.
+ */
+static void capture_add_chunk(struct intel_vgpu_capture *capture,
+		unsigned long gma, void *va, unsigned long len)
+{
+	struct intel_vgpu_capture_chunk *c, *tmp;
+
+	if (capture->failed || capture_find_chunk(capture, gma, len))
+		return;
+
+	list_for_each_entry_safe(c, tmp, &capture->chunks, list) {
+		if (c->gma >= gma && c->gma + c->len <= gma + len) {
+			list_del(&c->list);
+			kfree(c);
+			capture->nr_chunks--;
+		}
+	}
+
+	c = kmalloc(sizeof(*c) + len, GFP_KERNEL);
+	if (!c) {
+		capture->failed = true;
+		return;
+	}
+	c->gma = gma;
+	c->len = len;
+	memcpy(c->data, va, len);
+	list_add_tail(&c->list, &capture->chunks);
+	capture->nr_chunks++;
+}
+
+static int capture_replay_copy(struct intel_vgpu_capture *capture,
+		unsigned long gma, unsigned long end_gma, void *va)
+{
+	struct intel_vgpu_capture_chunk *c;
+
+	c = capture_find_chunk(capture, gma, end_gma - gma);
+	if (!c)
+		return -EFAULT;
+
+	memcpy(va, c->data + (gma - c->gma), end_gma - gma);
+	return end_gma - gma;
+}
+
+static void capture_begin(struct intel_vgpu_workload *workload)
+{
+	struct intel_vgpu_submission *s = &workload->vgpu->submission;
+	struct intel_vgpu_capture *capture;
+
+	if (!s->capture_remaining || s->replaying)
+		return;
+
+	capture = kzalloc(sizeof(*capture), GFP_KERNEL);
+	if (!capture)
+		return;
+
+	capture->ring_id = workload->ring_id;
+	capture->rb_start = workload->rb_start;
+	capture->rb_head = workload->rb_head;
+	capture->rb_tail = workload->rb_tail;
+	capture->rb_ctl = workload->rb_ctl;
+	INIT_LIST_HEAD(&capture->chunks);
+	s->capture = capture;
+}
+
+static void capture_end(struct intel_vgpu_workload *workload, int ret)
+{
+	struct intel_vgpu_submission *s = &workload->vgpu->submission;
+	struct intel_vgpu_capture *capture = s->capture;
+
+	if (!capture || s->replaying)
+		return;
+
+	s->capture = NULL;
+	if (ret || capture->failed) {
+		capture_free(capture);
+		return;
+	}
+
+	list_add_tail(&capture->list, &s->captures);
+	s->capture_remaining--;
+}
+
+static void clean_captures(struct intel_vgpu *vgpu)
+{
+	struct intel_vgpu_submission *s = &vgpu->submission;
+	struct intel_vgpu_capture *capture, *tmp;
+
+	list_for_each_entry_safe(capture, tmp, &s->captures, list)
+		capture_free(capture);
+	INIT_LIST_HEAD(&s->captures);
+	s->capture_remaining = 0;
+}
+
+/*
+ * GMA TLB
+ *
+ * A scan translates the same guest pages over and over, e.g. when it looks
+ * for the end of a batch buffer or copies a batch buffer chunk by chunk.
+ * The translations are cached in a small direct mapped table of the vGPU,
+ * along with the guest page itself once it is read, so that a hit is a
+ * memcpy() from a kernel mapping. A scan holds the vgpu_lock, under which
+ * the guest GTT writes are emulated as well, so the table can't go stale
+ * while a scan runs. It is flushed when the scan is done.
+ */
+static void gma_tlb_flush_entry(struct intel_vgpu *vgpu,
+		struct intel_vgpu_gma_tlb_entry *t)
+{
+	if (t->page) {
+		kunmap(t->page);
+		intel_gvt_hypervisor_put_guest_page(vgpu, t->page);
+	}
+	memset(t, 0, sizeof(*t));
+}
+
+static void gma_tlb_flush(struct intel_vgpu *vgpu)
+{
+	int i;
+
+	for (i = 0; i < GVT_GMA_TLB_SIZE; i++) {
+		if (vgpu->submission.gma_tlb[i].mm)
+			gma_tlb_flush_entry(vgpu, &vgpu->submission.gma_tlb[i]);
+	}
+}
+
+static struct intel_vgpu_gma_tlb_entry *gma_tlb_lookup(
+		struct intel_vgpu *vgpu, struct intel_vgpu_mm *mm,
+		unsigned long gma)
+{
+	struct intel_vgpu_gma_tlb_entry *t;
+	unsigned long gpa;
+
+	gma &= I915_GTT_PAGE_MASK;
+	t = &vgpu->submission.gma_tlb[(gma >> I915_GTT_PAGE_SHIFT) %
+				      GVT_GMA_TLB_SIZE];
+	if (t->mm == mm && t->gma == gma)
+		return t;
+
+	gpa = intel_vgpu_gma_to_gpa(mm, gma);
+	if (gpa == INTEL_GVT_INVALID_ADDR)
+		return NULL;
+
+	if (t->mm)
+		gma_tlb_flush_entry(vgpu, t);
+	t->mm = mm;
+	t->gma = gma;
+	t->gpa = gpa;
+	return t;
+}
+
+static unsigned long gma_tlb_gma_to_gpa(struct intel_vgpu *vgpu,
+		struct intel_vgpu_mm *mm, unsigned long gma)
+{
+	struct intel_vgpu_gma_tlb_entry *t = gma_tlb_lookup(vgpu, mm, gma);
+
+	if (!t)
+		return INTEL_GVT_INVALID_ADDR;
+	return t->gpa + (gma & ~I915_GTT_PAGE_MASK);
+}
+
+static void gma_tlb_read(struct intel_vgpu *vgpu,
+		struct intel_vgpu_gma_tlb_entry *t, unsigned long offset,
+		void *va, unsigned long len)
+{
+	struct page *page;
+
+	if (!t->mapped) {
+		t->mapped = true;
+		page = intel_gvt_hypervisor_get_guest_page(vgpu,
+				t->gpa >> PAGE_SHIFT);
+		if (!IS_ERR(page)) {
+			t->page = page;
+			t->va = kmap(page);
+		}
+	}
+
+	if (t->va)
+		memcpy(va, t->va + offset, len);
+	else
+		intel_gvt_hypervisor_read_gpa(vgpu, t->gpa + offset, va, len);
+}
+
 static int copy_gma_to_hva(struct intel_vgpu *vgpu, struct intel_vgpu_mm *mm,
 		unsigned long gma, unsigned long end_gma, void *va)
 {
+	struct intel_vgpu_capture *capture = vgpu->submission.capture;
+	struct intel_vgpu_gma_tlb_entry *t;
+	unsigned long start_gma = gma;
 	unsigned long copy_len, offset;
 	unsigned long len = 0;
-	unsigned long gpa;
+
+	if (capture && vgpu->submission.replaying)
+		return capture_replay_copy(capture, gma, end_gma, va);
 
 	while (gma != end_gma) {
-		gpa = intel_vgpu_gma_to_gpa(mm, gma);
-		if (gpa == INTEL_GVT_INVALID_ADDR) {
+		t = gma_tlb_lookup(vgpu, mm, gma);
+		if (!t) {
 			gvt_vgpu_err("invalid gma address: %lx\n", gma);
 			return -EFAULT;
 		}
@@ -1583,11 +1949,14 @@ static int copy_gma_to_hva(struct intel_vgpu *vgpu, struct intel_vgpu_mm *mm,
 		copy_len = (end_gma - gma) >= (I915_GTT_PAGE_SIZE - offset) ?
 			I915_GTT_PAGE_SIZE - offset : end_gma - gma;
 
-		intel_gvt_hypervisor_read_gpa(vgpu, gpa, va + len, copy_len);
+		gma_tlb_read(vgpu, t, offset, va + len, copy_len);
 
 		len += copy_len;
 		gma += copy_len;
 	}
+
+	if (capture)
+		capture_add_chunk(capture, start_gma, va, len);
 	return len;
 }
 
@@ -1658,133 +2027,978 @@ static int find_bb_size(struct parser_exec_state *s, unsigned long *bb_size)
 	return 0;
 }
 
-static int perform_bb_shadow(struct parser_exec_state *s)
+static int shadow_bb_begin_write(struct intel_vgpu_shadow_bb *bb)
 {
-	struct intel_vgpu *vgpu = s->vgpu;
-	struct intel_vgpu_shadow_bb *bb;
-	unsigned long gma = 0;
-	unsigned long bb_size;
-	int ret = 0;
-
-	/* get the start gm address of the batch buffer */
-	gma = get_gma_bb_from_cmd(s, 1);
-	if (gma == INTEL_GVT_INVALID_ADDR)
-		return -EFAULT;
-
-	ret = find_bb_size(s, &bb_size);
-	if (ret)
-		return ret;
-
-	bb = kzalloc(sizeof(*bb), GFP_KERNEL);
-	if (!bb)
-		return -ENOMEM;
-
-	bb->obj = i915_gem_object_create(s->vgpu->gvt->dev_priv,
-					 roundup(bb_size, PAGE_SIZE));
-	if (IS_ERR(bb->obj)) {
-		ret = PTR_ERR(bb->obj);
-		goto err_free_bb;
-	}
+	int ret;
 
 	ret = i915_gem_obj_prepare_shmem_write(bb->obj, &bb->clflush);
 	if (ret)
-		goto err_free_obj;
+		return ret;
+	bb->accessing = true;
 
-	bb->va = i915_gem_object_pin_map(bb->obj, I915_MAP_WB);
-	if (IS_ERR(bb->va)) {
-		ret = PTR_ERR(bb->va);
-		goto err_finish_shmem_access;
+	if (!bb->va) {
+		bb->va = i915_gem_object_pin_map(bb->obj, I915_MAP_WB);
+		if (IS_ERR(bb->va))
+			return PTR_ERR(bb->va);
 	}
 
 	if (bb->clflush & CLFLUSH_BEFORE) {
 		drm_clflush_virt_range(bb->va, bb->obj->base.size);
 		bb->clflush &= ~CLFLUSH_BEFORE;
 	}
-
-	ret = copy_gma_to_hva(s->vgpu, s->vgpu->gtt.ggtt_mm,
-			      gma, gma + bb_size,
-			      bb->va);
-	if (ret < 0) {
-		gvt_vgpu_err("fail to copy guest ring buffer\n");
-		ret = -EFAULT;
-		goto err_unmap;
-	}
-
-	INIT_LIST_HEAD(&bb->list);
-	list_add(&bb->list, &s->workload->shadow_bb);
-
-	bb->accessing = true;
-	bb->bb_start_cmd_va = s->ip_va;
-
-	if ((s->buf_type == BATCH_BUFFER_INSTRUCTION) && (!s->is_ctx_wa))
-		bb->bb_offset = s->ip_va - s->rb_va;
-	else
-		bb->bb_offset = 0;
-
-	/*
-	 * ip_va saves the virtual address of the shadow batch buffer, while
-	 * ip_gma saves the graphics address of the original batch buffer.
-	 * As the shadow batch buffer is just a copy from the originial one,
-	 * it should be right to use shadow batch buffer'va and original batch
-	 * buffer's gma in pair. After all, we don't want to pin the shadow
-	 * buffer here (too early).
-	 */
-	s->ip_va = bb->va;
-	s->ip_gma = gma;
 	return 0;
-err_unmap:
-	i915_gem_object_unpin_map(bb->obj);
-err_finish_shmem_access:
-	i915_gem_obj_finish_shmem_access(bb->obj);
-err_free_obj:
-	i915_gem_object_put(bb->obj);
-err_free_bb:
-	kfree(bb);
-	return ret;
 }
 
-static int cmd_handler_mi_batch_buffer_start(struct parser_exec_state *s)
+/*
+ * Copy the guest batch buffer at gma into the shadow batch buffer up to
+ * end, a guest page at a time. The shadow batch buffer is replaced by one
+ * twice as big when it is full.
+ */
+static int shadow_bb_copy_until(struct parser_exec_state *s,
+		unsigned long gma, struct intel_vgpu_shadow_bb **bb,
+		unsigned long *copied, unsigned long end)
 {
-	bool second_level;
-	int ret = 0;
 	struct intel_vgpu *vgpu = s->vgpu;
+	struct intel_vgpu_shadow_bb *new;
+	unsigned long len;
+	int ret;
 
-	if (s->buf_type == BATCH_BUFFER_2ND_LEVEL) {
-		gvt_vgpu_err("Found MI_BATCH_BUFFER_START in 2nd level BB\n");
-		return -EFAULT;
-	}
+	while (*copied < end) {
+		len = I915_GTT_PAGE_SIZE -
+			((gma + *copied) & (I915_GTT_PAGE_SIZE - 1));
 
-	second_level = BATCH_BUFFER_2ND_LEVEL_BIT(cmd_val(s, 0)) == 1;
-	if (second_level && (s->buf_type != BATCH_BUFFER_INSTRUCTION)) {
-		gvt_vgpu_err("Jumping to 2nd level BB from RB is not allowed\n");
-		return -EFAULT;
-	}
+		while (*copied + len > (*bb)->obj->base.size) {
+			new = intel_vgpu_get_shadow_bb(vgpu,
+					2 * (*bb)->obj->base.size);
+			if (IS_ERR(new))
+				return PTR_ERR(new);
 
-	s->saved_buf_addr_type = s->buf_addr_type;
-	addr_type_update_snb(s);
-	if (s->buf_type == RING_BUFFER_INSTRUCTION) {
-		s->ret_ip_gma_ring = s->ip_gma + cmd_length(s) * sizeof(u32);
-		s->buf_type = BATCH_BUFFER_INSTRUCTION;
-	} else if (second_level) {
-		s->buf_type = BATCH_BUFFER_2ND_LEVEL;
-		s->ret_ip_gma_bb = s->ip_gma + cmd_length(s) * sizeof(u32);
-		s->ret_bb_va = s->ip_va + cmd_length(s) * sizeof(u32);
-	}
+			ret = shadow_bb_begin_write(new);
+			if (ret) {
+				intel_vgpu_put_shadow_bb(vgpu, new);
+				return ret;
+			}
 
-	if (batch_buffer_needs_scan(s)) {
-		ret = perform_bb_shadow(s);
-		if (ret < 0)
-			gvt_vgpu_err("invalid shadow batch buffer\n");
-	} else {
-		/* emulate a batch buffer end to do return right */
-		ret = cmd_handler_mi_batch_buffer_end(s);
+			memcpy(new->va, (*bb)->va, *copied);
+			intel_vgpu_put_shadow_bb(vgpu, *bb);
+			*bb = new;
+		}
+
+		ret = copy_gma_to_hva(vgpu, vgpu->gtt.ggtt_mm,
+				gma + *copied, gma + *copied + len,
+				(*bb)->va + *copied);
 		if (ret < 0)
-			return ret;
+			return -EFAULT;
+		*copied += len;
 	}
-	return ret;
+	return 0;
 }
 
-static struct cmd_info cmd_info[] = {
+/*
+ * Shadow the batch buffer at gma while looking for its end in the copy, so
+ * that the guest pages are only read and translated once.
+ */
+static int shadow_bb_copy(struct parser_exec_state *s, unsigned long gma,
+		struct intel_vgpu_shadow_bb **bb, unsigned long *bb_size)
+{
+	struct intel_vgpu *vgpu = s->vgpu;
+	unsigned long copied = 0, offset = 0;
+	struct cmd_info *info;
+	bool bb_end = false;
+	u32 cmd;
+	int ret;
+
+	do {
+		ret = shadow_bb_copy_until(s, gma, bb, &copied, offset + 4);
+		if (ret)
+			return ret;
+
+		cmd = *(u32 *)((*bb)->va + offset);
+		info = get_cmd_info(vgpu->gvt, cmd, s->ring_id);
+		if (info == NULL) {
+			gvt_vgpu_err("unknown cmd 0x%x, opcode=0x%x\n",
+				cmd, get_opcode(cmd, s->ring_id));
+			return -EBADRQC;
+		}
+
+		if (info->opcode == OP_MI_BATCH_BUFFER_END) {
+			bb_end = true;
+		} else if (info->opcode == OP_MI_BATCH_BUFFER_START) {
+			if (BATCH_BUFFER_2ND_LEVEL_BIT(cmd) == 0)
+				/* chained batch buffer */
+				bb_end = true;
+		}
+		offset += get_cmd_length(info, cmd) << 2;
+	} while (!bb_end);
+
+	/* the last command may end in the next page */
+	ret = shadow_bb_copy_until(s, gma, bb, &copied, offset);
+	if (ret)
+		return ret;
+
+	*bb_size = offset;
+	return 0;
+}
+
+static int perform_bb_shadow(struct parser_exec_state *s)
+{
+	struct intel_vgpu *vgpu = s->vgpu;
+	struct intel_vgpu_shadow_bb *bb;
+	unsigned long gma = 0;
+	unsigned long bb_size;
+	int ret = 0;
+
+	/* get the start gm address of the batch buffer */
+	gma = get_gma_bb_from_cmd(s, 1);
+	if (gma == INTEL_GVT_INVALID_ADDR)
+		return -EFAULT;
+
+	bb = intel_vgpu_get_shadow_bb(vgpu, I915_GTT_PAGE_SIZE);
+	if (IS_ERR(bb))
+		return PTR_ERR(bb);
+
+	ret = shadow_bb_begin_write(bb);
+	if (ret)
+		goto err_put_bb;
+
+	ret = shadow_bb_copy(s, gma, &bb, &bb_size);
+	if (ret) {
+		if (ret == -EFAULT)
+			gvt_vgpu_err("fail to copy guest ring buffer\n");
+		goto err_put_bb;
+	}
+
+	list_add(&bb->list, &s->workload->shadow_bb);
+	intel_vgpu_stat_add(vgpu, INTEL_VGPU_STAT_SHADOW_BYTES, bb_size);
+
+	s->ring_bb_gma = gma;
+	s->ring_bb_size = bb_size;
+
+	bb->bb_start_cmd_va = s->ip_va;
+
+	if ((s->buf_type == BATCH_BUFFER_INSTRUCTION) && (!s->is_ctx_wa))
+		bb->bb_offset = s->ip_va - s->rb_va;
+	else
+		bb->bb_offset = 0;
+
+	/*
+	 * ip_va saves the virtual address of the shadow batch buffer, while
+	 * ip_gma saves the graphics address of the original batch buffer.
+	 * As the shadow batch buffer is just a copy from the originial one,
+	 * it should be right to use shadow batch buffer'va and original batch
+	 * buffer's gma in pair. After all, we don't want to pin the shadow
+	 * buffer here (too early).
+	 */
+	s->ip_va = bb->va;
+	s->ip_gma = gma;
+	return 0;
+err_put_bb:
+	intel_vgpu_put_shadow_bb(vgpu, bb);
+	return ret;
+}
+
+/*
+ * Scan cache
+ *
+ * The shadow copy of a ring level batch buffer is kept once it has been
+ * scanned, if the scan had no side effect besides the interrupt events it
+ * raised, and the guest pages backing it are write-protected. As long as
+ * none of them is written and the GGTT still maps the batch buffer to the
+ * same pages, a new submission of the batch buffer reuses the shadow copy,
+ * skipping both the copy from the guest and the scan. This is turned off
+ * with enable_gvt_bb_scan_cache.
+ */
+#define BB_SCAN_CACHE_MAX	64
+
+struct bb_scan_cache_entry {
+	struct hlist_node node;
+	struct intel_vgpu *vgpu;
+	int ring_id;
+	unsigned long gma;
+	struct drm_i915_gem_object *obj;
+	void *va;
+	DECLARE_BITMAP(events, INTEL_GVT_EVENT_MAX);
+	unsigned int nr_pages;
+	unsigned long gfn[0];
+};
+
+static void bb_scan_cache_free(struct bb_scan_cache_entry *e)
+{
+	struct intel_vgpu *vgpu = e->vgpu;
+	int i;
+
+	lockdep_assert_held(&vgpu->gvt->dev_priv->drm.struct_mutex);
+
+	for (i = 0; i < e->nr_pages; i++)
+		intel_vgpu_unregister_page_track(vgpu, e->gfn[i]);
+
+	hash_del(&e->node);
+	vgpu->submission.bb_scan_cache_count--;
+
+	i915_gem_object_unpin_map(e->obj);
+	__i915_gem_object_release_unless_active(e->obj);
+	kfree(e);
+}
+
+static int bb_scan_cache_page_write(struct intel_vgpu_page_track *page_track,
+		u64 gpa, void *data, int bytes)
+{
+	struct bb_scan_cache_entry *e = page_track->priv_data;
+	struct drm_i915_private *dev_priv = e->vgpu->gvt->dev_priv;
+
+	/* the guest write has been done already, just drop the copy */
+	mutex_lock(&dev_priv->drm.struct_mutex);
+	bb_scan_cache_free(e);
+	mutex_unlock(&dev_priv->drm.struct_mutex);
+	return 0;
+}
+
+static struct bb_scan_cache_entry *bb_scan_cache_lookup(
+		struct parser_exec_state *s, unsigned long gma)
+{
+	struct intel_vgpu *vgpu = s->vgpu;
+	struct bb_scan_cache_entry *e;
+	unsigned long gpa;
+	int i;
+
+	hash_for_each_possible(vgpu->submission.bb_scan_cache, e, node, gma) {
+		if (e->gma != gma || e->ring_id != s->ring_id)
+			continue;
+
+		for (i = 0; i < e->nr_pages; i++) {
+			gpa = gma_tlb_gma_to_gpa(vgpu, vgpu->gtt.ggtt_mm,
+				(gma & I915_GTT_PAGE_MASK) +
+				i * I915_GTT_PAGE_SIZE);
+			if (gpa == INTEL_GVT_INVALID_ADDR ||
+			    (gpa >> PAGE_SHIFT) != e->gfn[i]) {
+				bb_scan_cache_free(e);
+				return NULL;
+			}
+		}
+		return e;
+	}
+	return NULL;
+}
+
+static void bb_dedup_add(struct parser_exec_state *s,
+		struct bb_scan_cache_entry *e);
+
+static void bb_scan_cache_add(struct parser_exec_state *s)
+{
+	struct intel_vgpu *vgpu = s->vgpu;
+	struct intel_vgpu_submission *sub = &vgpu->submission;
+	struct intel_vgpu_shadow_bb *bb = s->ring_bb;
+	unsigned long gma = s->ring_bb_gma;
+	struct bb_scan_cache_entry *e;
+	unsigned int nr_pages;
+	unsigned long gpa;
+	int i, ret;
+
+	if (sub->bb_scan_cache_count >= BB_SCAN_CACHE_MAX)
+		return;
+
+	nr_pages = ((gma + s->ring_bb_size - 1) >> I915_GTT_PAGE_SHIFT) -
+		(gma >> I915_GTT_PAGE_SHIFT) + 1;
+
+	e = kzalloc(sizeof(*e) + nr_pages * sizeof(e->gfn[0]), GFP_KERNEL);
+	if (!e)
+		return;
+
+	e->vgpu = vgpu;
+	e->ring_id = s->ring_id;
+	e->gma = gma;
+	bitmap_copy(e->events, s->ring_bb_events, INTEL_GVT_EVENT_MAX);
+
+	for (i = 0; i < nr_pages; i++) {
+		gpa = gma_tlb_gma_to_gpa(vgpu, vgpu->gtt.ggtt_mm,
+			(gma & I915_GTT_PAGE_MASK) + i * I915_GTT_PAGE_SIZE);
+		if (gpa == INTEL_GVT_INVALID_ADDR)
+			goto err;
+
+		/* pages tracked for other purposes aren't cached */
+		ret = intel_vgpu_register_page_track(vgpu, gpa >> PAGE_SHIFT,
+				bb_scan_cache_page_write, e);
+		if (ret)
+			goto err;
+		e->gfn[e->nr_pages++] = gpa >> PAGE_SHIFT;
+
+		ret = intel_vgpu_enable_page_track(vgpu, gpa >> PAGE_SHIFT);
+		if (ret)
+			goto err;
+	}
+
+	/* The shadow copy is final, move its mapping over to the cache. */
+	if (bb->clflush & CLFLUSH_AFTER) {
+		drm_clflush_virt_range(bb->va, bb->obj->base.size);
+		bb->clflush &= ~CLFLUSH_AFTER;
+	}
+
+	e->obj = bb->obj;
+	e->va = bb->va;
+	i915_gem_object_get(e->obj);
+	bb->va = NULL;
+	bb->cached = true;
+
+	hash_add(sub->bb_scan_cache, &e->node, gma);
+	sub->bb_scan_cache_count++;
+
+	if (s->ring_bb_shareable && i915_modparams.enable_gvt_bb_dedup)
+		bb_dedup_add(s, e);
+	return;
+err:
+	for (i = 0; i < e->nr_pages; i++)
+		intel_vgpu_unregister_page_track(vgpu, e->gfn[i]);
+	kfree(e);
+}
+
+static int bb_scan_cache_shadow(struct parser_exec_state *s,
+		struct drm_i915_gem_object *obj, const unsigned long *events)
+{
+	struct intel_vgpu_workload *workload = s->workload;
+	struct intel_vgpu_shadow_bb *bb;
+
+	bb = kzalloc(sizeof(*bb), GFP_KERNEL_ACCOUNT);
+	if (!bb)
+		return -ENOMEM;
+
+	bb->obj = obj;
+	i915_gem_object_get(bb->obj);
+	bb->cached = true;
+	bb->bb_start_cmd_va = s->ip_va;
+	bb->bb_offset = s->ip_va - s->rb_va;
+	list_add(&bb->list, &workload->shadow_bb);
+
+	bitmap_or(workload->pending_events, workload->pending_events,
+		  events, INTEL_GVT_EVENT_MAX);
+
+	/* the batch buffer has been scanned already, return to the ring */
+	return cmd_handler_mi_batch_buffer_end(s);
+}
+
+/*
+ * Dedup cache
+ *
+ * Guests running the same OS and applications submit byte-identical batch
+ * buffers. Once such a batch buffer has been scanned and put in the scan
+ * cache of a vGPU, its shadow copy is also filed by content, host wide, if
+ * the scan didn't depend on the vGPU: no GGTT address was audited against
+ * the GM range of the vGPU. Another vGPU submitting the same bytes on the
+ * same ring still copies them from its guest, but then shares the read-only
+ * shadow copy and the scan result instead of scanning its own copy.
+ * Cached shadow copies are never written again, so the content stays the
+ * one that was scanned even after the vGPU which scanned it dropped it.
+ */
+#define BB_DEDUP_MAX	256
+
+struct bb_dedup_entry {
+	struct hlist_node node;
+	struct list_head lru;
+	u32 hash;
+	int ring_id;
+	unsigned long size;
+	struct drm_i915_gem_object *obj;
+	void *va;
+	DECLARE_BITMAP(events, INTEL_GVT_EVENT_MAX);
+};
+
+static void bb_dedup_free(struct intel_gvt *gvt, struct bb_dedup_entry *d)
+{
+	lockdep_assert_held(&gvt->dev_priv->drm.struct_mutex);
+
+	hash_del(&d->node);
+	list_del(&d->lru);
+	gvt->bb_dedup_count--;
+
+	i915_gem_object_unpin_map(d->obj);
+	__i915_gem_object_release_unless_active(d->obj);
+	kfree(d);
+}
+
+static struct bb_dedup_entry *bb_dedup_lookup(struct parser_exec_state *s)
+{
+	struct intel_gvt *gvt = s->vgpu->gvt;
+	struct intel_vgpu_shadow_bb *bb = s->ring_bb;
+	struct bb_dedup_entry *d;
+	u32 hash;
+
+	hash = jhash(bb->va, s->ring_bb_size, s->ring_id);
+	hash_for_each_possible(gvt->bb_dedup, d, node, hash) {
+		if (d->hash != hash || d->ring_id != s->ring_id ||
+		    d->size != s->ring_bb_size ||
+		    memcmp(d->va, bb->va, d->size))
+			continue;
+
+		list_move(&d->lru, &gvt->bb_dedup_lru);
+		return d;
+	}
+	return NULL;
+}
+
+static int bb_dedup_shadow(struct parser_exec_state *s,
+		struct bb_dedup_entry *d)
+{
+	struct intel_vgpu_shadow_bb *bb = s->ring_bb;
+
+	/* scan from the ring again, with the copy of the shared one */
+	s->ring_bb = NULL;
+	s->ip_va = bb->bb_start_cmd_va;
+	list_del_init(&bb->list);
+	intel_vgpu_put_shadow_bb(s->vgpu, bb);
+
+	return bb_scan_cache_shadow(s, d->obj, d->events);
+}
+
+/* Called once the scan cache owns the shadow copy of s->ring_bb. */
+static void bb_dedup_add(struct parser_exec_state *s,
+		struct bb_scan_cache_entry *e)
+{
+	struct intel_gvt *gvt = s->vgpu->gvt;
+	struct bb_dedup_entry *d;
+
+	if (gvt->bb_dedup_count >= BB_DEDUP_MAX)
+		bb_dedup_free(gvt, list_last_entry(&gvt->bb_dedup_lru,
+						   struct bb_dedup_entry, lru));
+
+	d = kzalloc(sizeof(*d), GFP_KERNEL);
+	if (!d)
+		return;
+
+	/* the mapping of the scan cache entry, not a new one */
+	d->va = i915_gem_object_pin_map(e->obj, I915_MAP_WB);
+	if (IS_ERR(d->va)) {
+		kfree(d);
+		return;
+	}
+
+	d->obj = e->obj;
+	i915_gem_object_get(d->obj);
+	d->ring_id = s->ring_id;
+	d->size = s->ring_bb_size;
+	d->hash = jhash(d->va, d->size, d->ring_id);
+	bitmap_copy(d->events, e->events, INTEL_GVT_EVENT_MAX);
+
+	hash_add(gvt->bb_dedup, &d->node, d->hash);
+	list_add(&d->lru, &gvt->bb_dedup_lru);
+	gvt->bb_dedup_count++;
+}
+
+static void bb_dedup_init(struct intel_gvt *gvt)
+{
+	hash_init(gvt->bb_dedup);
+	INIT_LIST_HEAD(&gvt->bb_dedup_lru);
+	gvt->bb_dedup_count = 0;
+}
+
+static void bb_dedup_clean(struct intel_gvt *gvt)
+{
+	struct drm_i915_private *dev_priv = gvt->dev_priv;
+	struct bb_dedup_entry *d, *dn;
+
+	mutex_lock(&dev_priv->drm.struct_mutex);
+	list_for_each_entry_safe(d, dn, &gvt->bb_dedup_lru, lru)
+		bb_dedup_free(gvt, d);
+	mutex_unlock(&dev_priv->drm.struct_mutex);
+}
+
+/*
+ * The guest driver sets up the indirect context of an engine once and
+ * points all of its contexts at it, so the scanned copy of an indirect
+ * context is kept the same way as the one of a ring level batch buffer,
+ * and copied into the shadow of the next workload using it. The per
+ * context batch buffer start appended to the copy is scanned every time,
+ * as it is not part of the guest indirect context.
+ */
+#define WA_CTX_CACHE_MAX	4
+
+struct wa_ctx_cache_entry {
+	struct list_head list;
+	struct intel_vgpu *vgpu;
+	unsigned long gma;
+	u32 size;
+	void *va;
+	DECLARE_BITMAP(events, INTEL_GVT_EVENT_MAX);
+	unsigned int nr_pages;
+	unsigned long gfn[0];
+};
+
+static void wa_ctx_cache_free(struct wa_ctx_cache_entry *e)
+{
+	struct intel_vgpu *vgpu = e->vgpu;
+	int i;
+
+	lockdep_assert_held(&vgpu->gvt->dev_priv->drm.struct_mutex);
+
+	for (i = 0; i < e->nr_pages; i++)
+		intel_vgpu_unregister_page_track(vgpu, e->gfn[i]);
+
+	list_del(&e->list);
+	vgpu->submission.wa_ctx_cache_count--;
+
+	kvfree(e->va);
+	kfree(e);
+}
+
+static int wa_ctx_cache_page_write(struct intel_vgpu_page_track *page_track,
+		u64 gpa, void *data, int bytes)
+{
+	struct wa_ctx_cache_entry *e = page_track->priv_data;
+	struct drm_i915_private *dev_priv = e->vgpu->gvt->dev_priv;
+
+	mutex_lock(&dev_priv->drm.struct_mutex);
+	wa_ctx_cache_free(e);
+	mutex_unlock(&dev_priv->drm.struct_mutex);
+	return 0;
+}
+
+static struct wa_ctx_cache_entry *wa_ctx_cache_lookup(struct intel_vgpu *vgpu,
+		unsigned long gma, u32 size)
+{
+	struct wa_ctx_cache_entry *e;
+	unsigned long gpa;
+	int i;
+
+	list_for_each_entry(e, &vgpu->submission.wa_ctx_cache, list) {
+		if (e->gma != gma || e->size != size)
+			continue;
+
+		for (i = 0; i < e->nr_pages; i++) {
+			gpa = gma_tlb_gma_to_gpa(vgpu, vgpu->gtt.ggtt_mm,
+				gma + i * I915_GTT_PAGE_SIZE);
+			if (gpa == INTEL_GVT_INVALID_ADDR ||
+			    (gpa >> PAGE_SHIFT) != e->gfn[i]) {
+				wa_ctx_cache_free(e);
+				return NULL;
+			}
+		}
+		return e;
+	}
+	return NULL;
+}
+
+static void wa_ctx_cache_add(struct intel_vgpu *vgpu,
+		struct intel_shadow_wa_ctx *wa_ctx, unsigned long *events)
+{
+	struct intel_vgpu_submission *sub = &vgpu->submission;
+	unsigned long gma = wa_ctx->indirect_ctx.guest_gma;
+	u32 size = wa_ctx->indirect_ctx.size;
+	struct wa_ctx_cache_entry *e;
+	unsigned int nr_pages;
+	unsigned long gpa;
+	int i, ret;
+
+	if (sub->wa_ctx_cache_count >= WA_CTX_CACHE_MAX)
+		return;
+
+	nr_pages = DIV_ROUND_UP(size, I915_GTT_PAGE_SIZE);
+
+	e = kzalloc(sizeof(*e) + nr_pages * sizeof(e->gfn[0]), GFP_KERNEL);
+	if (!e)
+		return;
+
+	e->va = kvmalloc(size, GFP_KERNEL);
+	if (!e->va) {
+		kfree(e);
+		return;
+	}
+
+	e->vgpu = vgpu;
+	e->gma = gma;
+	e->size = size;
+	memcpy(e->va, wa_ctx->indirect_ctx.shadow_va, size);
+	bitmap_copy(e->events, events, INTEL_GVT_EVENT_MAX);
+
+	for (i = 0; i < nr_pages; i++) {
+		gpa = gma_tlb_gma_to_gpa(vgpu, vgpu->gtt.ggtt_mm,
+					 gma + i * I915_GTT_PAGE_SIZE);
+		if (gpa == INTEL_GVT_INVALID_ADDR)
+			goto err;
+
+		/* pages tracked for other purposes aren't cached */
+		ret = intel_vgpu_register_page_track(vgpu, gpa >> PAGE_SHIFT,
+				wa_ctx_cache_page_write, e);
+		if (ret)
+			goto err;
+		e->gfn[e->nr_pages++] = gpa >> PAGE_SHIFT;
+
+		ret = intel_vgpu_enable_page_track(vgpu, gpa >> PAGE_SHIFT);
+		if (ret)
+			goto err;
+	}
+
+	list_add(&e->list, &sub->wa_ctx_cache);
+	sub->wa_ctx_cache_count++;
+	return;
+err:
+	for (i = 0; i < e->nr_pages; i++)
+		intel_vgpu_unregister_page_track(vgpu, e->gfn[i]);
+	kvfree(e->va);
+	kfree(e);
+}
+
+/**
+ * intel_vgpu_clean_bb_scan_cache - drop the scan cache of a vGPU
+ * @vgpu: a vGPU
+ *
+ */
+void intel_vgpu_clean_bb_scan_cache(struct intel_vgpu *vgpu)
+{
+	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
+	struct bb_scan_cache_entry *e;
+	struct wa_ctx_cache_entry *w, *wn;
+	struct hlist_node *tmp;
+	int i;
+
+	mutex_lock(&dev_priv->drm.struct_mutex);
+	hash_for_each_safe(vgpu->submission.bb_scan_cache, i, tmp, e, node)
+		bb_scan_cache_free(e);
+	list_for_each_entry_safe(w, wn, &vgpu->submission.wa_ctx_cache, list)
+		wa_ctx_cache_free(w);
+	mutex_unlock(&dev_priv->drm.struct_mutex);
+}
+
+/*
+ * Direct batch buffers
+ *
+ * A large ring level batch buffer of a trusted guest may be executed from
+ * the guest pages, at its own GGTT address, instead of from a shadow copy.
+ * This is only done for the vGPUs the host has given the privileged scan
+ * level, as the guest could change the commands once they are scanned.
+ * The pages are write protected from the scan until the workload is
+ * released. As the guest write is only reported once it has been done, a
+ * write to them can't be undone and puts the vGPU into failsafe mode. Any
+ * command of a direct batch buffer the scan would patch makes the whole
+ * workload scanned again with all batch buffers shadowed.
+ */
+#define DIRECT_BB_MIN_SIZE	SZ_64K
+
+struct direct_bb_page {
+	struct hlist_node node;
+	struct intel_vgpu *vgpu;
+	unsigned long gfn;
+	unsigned int count;
+};
+
+struct intel_vgpu_direct_bb {
+	struct list_head list;
+	void *va;
+	struct page **pages;
+	unsigned int nr_pages;
+	unsigned long gfn[0];
+};
+
+static int direct_bb_page_write(struct intel_vgpu_page_track *page_track,
+		u64 gpa, void *data, int bytes)
+{
+	struct direct_bb_page *p = page_track->priv_data;
+	struct intel_vgpu *vgpu = p->vgpu;
+
+	gvt_vgpu_err("direct batch buffer page 0x%llx written by guest\n", gpa);
+	enter_failsafe_mode(vgpu, GVT_FAILSAFE_GUEST_ERR);
+	return 0;
+}
+
+static int direct_bb_get_page(struct intel_vgpu *vgpu, unsigned long gfn)
+{
+	struct intel_vgpu_submission *s = &vgpu->submission;
+	struct direct_bb_page *p;
+	int ret;
+
+	hash_for_each_possible(s->direct_bb_pages, p, node, gfn) {
+		if (p->gfn == gfn) {
+			p->count++;
+			return 0;
+		}
+	}
+
+	p = kzalloc(sizeof(*p), GFP_KERNEL);
+	if (!p)
+		return -ENOMEM;
+
+	p->vgpu = vgpu;
+	p->gfn = gfn;
+	p->count = 1;
+
+	/* pages tracked for other purposes are shadowed as usual */
+	ret = intel_vgpu_register_page_track(vgpu, gfn,
+			direct_bb_page_write, p);
+	if (ret) {
+		kfree(p);
+		return -EOPNOTSUPP;
+	}
+
+	ret = intel_vgpu_enable_page_track(vgpu, gfn);
+	if (ret) {
+		intel_vgpu_unregister_page_track(vgpu, gfn);
+		kfree(p);
+		return ret;
+	}
+
+	hash_add(s->direct_bb_pages, &p->node, gfn);
+	return 0;
+}
+
+static void direct_bb_put_page(struct intel_vgpu *vgpu, unsigned long gfn)
+{
+	struct direct_bb_page *p;
+
+	hash_for_each_possible(vgpu->submission.direct_bb_pages, p, node, gfn) {
+		if (p->gfn != gfn)
+			continue;
+
+		if (--p->count)
+			return;
+
+		hash_del(&p->node);
+		intel_vgpu_unregister_page_track(vgpu, gfn);
+		kfree(p);
+		return;
+	}
+}
+
+static void direct_bb_free(struct intel_vgpu *vgpu,
+		struct intel_vgpu_direct_bb *bb)
+{
+	int i;
+
+	if (bb->va)
+		vunmap(bb->va);
+
+	for (i = 0; i < bb->nr_pages; i++) {
+		if (bb->pages[i])
+			intel_gvt_hypervisor_put_guest_page(vgpu, bb->pages[i]);
+		direct_bb_put_page(vgpu, bb->gfn[i]);
+	}
+	kfree(bb);
+}
+
+/**
+ * intel_vgpu_set_scan_level - set how deeply the workloads of a vGPU are
+ * scanned
+ * @vgpu: a vGPU
+ * @level: one of enum intel_vgpu_scan_level
+ *
+ * Every command is still walked, and the ones reaching privileged state,
+ * register loads and stores, batch buffer starts and GGTT writes, are
+ * still audited at the privileged level. What it drops is the shadow copy
+ * of large ring level batch buffers, which are executed from the write
+ * protected guest pages instead.
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+int intel_vgpu_set_scan_level(struct intel_vgpu *vgpu, int level)
+{
+	if (level != INTEL_VGPU_SCAN_FULL &&
+	    level != INTEL_VGPU_SCAN_PRIVILEGED)
+		return -EINVAL;
+
+	WRITE_ONCE(vgpu->submission.scan_level, level);
+	return 0;
+}
+
+/**
+ * intel_gvt_release_direct_bbs - release the direct batch buffers of a
+ * workload
+ * @workload: a workload
+ *
+ */
+void intel_gvt_release_direct_bbs(struct intel_vgpu_workload *workload)
+{
+	struct intel_vgpu_direct_bb *bb, *pos;
+
+	list_for_each_entry_safe(bb, pos, &workload->direct_bb, list) {
+		list_del(&bb->list);
+		direct_bb_free(workload->vgpu, bb);
+	}
+}
+
+static bool direct_bb_allowed(struct parser_exec_state *s, bool ring_bb)
+{
+	struct intel_vgpu *vgpu = s->vgpu;
+
+	return READ_ONCE(vgpu->submission.scan_level) ==
+		INTEL_VGPU_SCAN_PRIVILEGED && ring_bb &&
+		!s->workload->no_direct_bb && !vgpu->submission.capture &&
+		intel_gvt_host.mpt->get_guest_page;
+}
+
+static int perform_bb_direct(struct parser_exec_state *s, bool check_size)
+{
+	struct intel_vgpu *vgpu = s->vgpu;
+	struct intel_vgpu_direct_bb *bb;
+	unsigned long gma, bb_size, gpa;
+	unsigned int nr_pages;
+	int i, ret;
+
+	if (s->buf_addr_type != GTT_BUFFER)
+		return -EOPNOTSUPP;
+
+	gma = get_gma_bb_from_cmd(s, 1);
+	if (gma == INTEL_GVT_INVALID_ADDR)
+		return -EFAULT;
+
+	ret = find_bb_size(s, &bb_size);
+	if (ret)
+		return ret;
+
+	if (check_size && bb_size < DIRECT_BB_MIN_SIZE)
+		return -EOPNOTSUPP;
+
+	nr_pages = ((gma + bb_size - 1) >> I915_GTT_PAGE_SHIFT) -
+		(gma >> I915_GTT_PAGE_SHIFT) + 1;
+
+	bb = kzalloc(sizeof(*bb) + nr_pages * (sizeof(bb->gfn[0]) +
+		     sizeof(bb->pages[0])), GFP_KERNEL_ACCOUNT);
+	if (!bb)
+		return -ENOMEM;
+	bb->pages = (struct page **)&bb->gfn[nr_pages];
+
+	for (i = 0; i < nr_pages; i++) {
+		struct page *page;
+
+		gpa = gma_tlb_gma_to_gpa(vgpu, vgpu->gtt.ggtt_mm,
+			(gma & I915_GTT_PAGE_MASK) + i * I915_GTT_PAGE_SIZE);
+		if (gpa == INTEL_GVT_INVALID_ADDR) {
+			ret = -EFAULT;
+			goto err;
+		}
+
+		ret = direct_bb_get_page(vgpu, gpa >> PAGE_SHIFT);
+		if (ret)
+			goto err;
+		bb->gfn[bb->nr_pages++] = gpa >> PAGE_SHIFT;
+
+		page = intel_gvt_hypervisor_get_guest_page(vgpu,
+				gpa >> PAGE_SHIFT);
+		if (IS_ERR(page)) {
+			ret = PTR_ERR(page);
+			goto err;
+		}
+		bb->pages[i] = page;
+	}
+
+	bb->va = vmap(bb->pages, nr_pages, VM_MAP, PAGE_KERNEL_RO);
+	if (!bb->va) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	list_add(&bb->list, &s->workload->direct_bb);
+
+	s->ip_va = bb->va + offset_in_page(gma);
+	s->ip_gma = gma;
+	s->direct = true;
+	return 0;
+err:
+	direct_bb_free(vgpu, bb);
+	return ret;
+}
+
+/*
+ * Drop whatever the scan of a workload has set up for its batch buffers,
+ * to scan it again.
+ */
+static void release_workload_bbs(struct intel_vgpu_workload *workload)
+{
+	struct intel_vgpu_shadow_bb *bb, *pos;
+
+	list_for_each_entry_safe(bb, pos, &workload->shadow_bb, list) {
+		list_del_init(&bb->list);
+		intel_vgpu_put_shadow_bb(workload->vgpu, bb);
+	}
+	intel_gvt_release_direct_bbs(workload);
+}
+
+static int cmd_handler_mi_batch_buffer_start(struct parser_exec_state *s)
+{
+	struct bb_scan_cache_entry *e = NULL;
+	bool in_direct = s->direct;
+	bool second_level;
+	bool ring_bb;
+	int ret = 0;
+	struct intel_vgpu *vgpu = s->vgpu;
+
+	if (s->buf_type == BATCH_BUFFER_2ND_LEVEL) {
+		gvt_vgpu_err("Found MI_BATCH_BUFFER_START in 2nd level BB\n");
+		return -EFAULT;
+	}
+
+	second_level = BATCH_BUFFER_2ND_LEVEL_BIT(cmd_val(s, 0)) == 1;
+	if (second_level && (s->buf_type != BATCH_BUFFER_INSTRUCTION)) {
+		gvt_vgpu_err("Jumping to 2nd level BB from RB is not allowed\n");
+		return -EFAULT;
+	}
+
+	ring_bb = s->buf_type == RING_BUFFER_INSTRUCTION && !s->is_ctx_wa;
+	if (!ring_bb)
+		s->ring_bb_cacheable = false;
+
+	s->saved_buf_addr_type = s->buf_addr_type;
+	addr_type_update_snb(s);
+	if (s->buf_type == RING_BUFFER_INSTRUCTION) {
+		s->ret_ip_gma_ring = s->ip_gma + cmd_length(s) * sizeof(u32);
+		s->buf_type = BATCH_BUFFER_INSTRUCTION;
+	} else if (second_level) {
+		s->buf_type = BATCH_BUFFER_2ND_LEVEL;
+		s->ret_ip_gma_bb = s->ip_gma + cmd_length(s) * sizeof(u32);
+		s->ret_bb_va = s->ip_va + cmd_length(s) * sizeof(u32);
+		s->ret_bb_direct = in_direct;
+	}
+	s->direct = false;
+
+	/* a replay has no guest pages to track */
+	if (vgpu->submission.replaying)
+		ring_bb = false;
+
+	if (batch_buffer_needs_scan(s)) {
+		if (ring_bb && i915_modparams.enable_gvt_bb_scan_cache)
+			e = bb_scan_cache_lookup(s, get_gma_bb_from_cmd(s, 1));
+		if (e)
+			return bb_scan_cache_shadow(s, e->obj, e->events);
+
+		/*
+		 * The BB_START of a shadow batch buffer is relocated, which
+		 * a direct batch buffer can't take.
+		 */
+		if (in_direct || direct_bb_allowed(s, ring_bb)) {
+			ret = perform_bb_direct(s, !in_direct);
+			if (ret != -EOPNOTSUPP) {
+				if (ret < 0)
+					gvt_vgpu_err("invalid direct batch buffer\n");
+				return ret;
+			}
+			if (in_direct)
+				return -EAGAIN;
+		}
+
+		ret = perform_bb_shadow(s);
+		if (ret < 0) {
+			gvt_vgpu_err("invalid shadow batch buffer\n");
+		} else if (ring_bb && i915_modparams.enable_gvt_bb_scan_cache) {
+			s->ring_bb = list_first_entry(&s->workload->shadow_bb,
+					struct intel_vgpu_shadow_bb, list);
+
+			if (i915_modparams.enable_gvt_bb_dedup) {
+				struct bb_dedup_entry *d = bb_dedup_lookup(s);
+
+				if (d)
+					return bb_dedup_shadow(s, d);
+			}
+
+			s->ring_bb_cacheable = true;
+			s->ring_bb_shareable = true;
+			bitmap_zero(s->ring_bb_events, INTEL_GVT_EVENT_MAX);
+		}
+	} else {
+		/* emulate a batch buffer end to do return right */
+		ret = cmd_handler_mi_batch_buffer_end(s);
+		if (ret < 0)
+			return ret;
+	}
+	return ret;
+}
+
+static struct cmd_info cmd_info[] = {
 	{"MI_NOOP", OP_MI_NOOP, F_LEN_CONST, R_ALL, D_ALL, 0, 1, NULL},
 
 	{"MI_SET_PREDICATE", OP_MI_SET_PREDICATE, F_LEN_CONST, R_ALL, D_ALL,
@@ -2451,11 +3665,6 @@ static struct cmd_info cmd_info[] = {
 		0, 20, NULL},
 };
 
-static void add_cmd_entry(struct intel_gvt *gvt, struct cmd_entry *e)
-{
-	hash_add(gvt->cmd_table, &e->hlist, e->info->opcode);
-}
-
 /* call the cmd handler, and advance ip */
 static int cmd_parser_exec(struct parser_exec_state *s)
 {
@@ -2480,10 +3689,14 @@ static int cmd_parser_exec(struct parser_exec_state *s)
 
 	if (info->handler) {
 		ret = info->handler(s);
+		if (ret == -EAGAIN)
+			return ret;
 		if (ret < 0) {
 			gvt_vgpu_err("%s handler error\n", info->name);
 			return ret;
 		}
+		if (s->direct_patched)
+			return -EAGAIN;
 	}
 
 	if (!(info->flag & F_IP_ADVANCE_CUSTOM)) {
@@ -2543,6 +3756,8 @@ static int command_scan(struct parser_exec_state *s,
 			}
 		}
 		ret = cmd_parser_exec(s);
+		if (ret == -EAGAIN)
+			break;
 		if (ret) {
 			gvt_vgpu_err("cmd parser error\n");
 			parser_exec_state_dump(s);
@@ -2578,6 +3793,9 @@ static int scan_workload(struct intel_vgpu_workload *workload)
 	s.rb_va = workload->shadow_ring_buffer_va;
 	s.workload = workload;
 	s.is_ctx_wa = false;
+	s.ring_bb = NULL;
+	s.direct = false;
+	s.direct_patched = false;
 
 	if ((bypass_scan_mask & (1 << workload->ring_id)) ||
 		gma_head == gma_tail)
@@ -2599,10 +3817,18 @@ static int scan_workload(struct intel_vgpu_workload *workload)
 	return ret;
 }
 
-static int scan_wa_ctx(struct intel_shadow_wa_ctx *wa_ctx)
+/*
+ * Scan the shadow indirect context, or only the per context batch buffer
+ * start appended to it if the indirect context is a copy from the cache.
+ * A fresh one is scanned on its own first, so that it can be cached if
+ * the scan has no side effect.
+ */
+static int scan_wa_ctx(struct intel_shadow_wa_ctx *wa_ctx,
+		const unsigned long *cached_events, bool cacheable)
 {
 
 	unsigned long gma_head, gma_tail, gma_bottom, ring_size, ring_tail;
+	unsigned long rb_head = 0;
 	struct parser_exec_state s;
 	int ret = 0;
 	struct intel_vgpu_workload *workload = container_of(wa_ctx,
@@ -2632,22 +3858,61 @@ static int scan_wa_ctx(struct intel_shadow_wa_ctx *wa_ctx)
 	s.rb_va = wa_ctx->indirect_ctx.shadow_va;
 	s.workload = workload;
 	s.is_ctx_wa = true;
+	s.ring_bb = NULL;
+	s.ring_bb_cacheable = false;
+	s.direct = false;
+	s.direct_patched = false;
 
 	if (!intel_gvt_ggtt_validate_range(s.vgpu, s.ring_start, s.ring_size)) {
 		ret = -EINVAL;
 		goto out;
 	}
 
-	ret = ip_gma_set(&s, gma_head);
+	if (cached_events) {
+		bitmap_or(workload->pending_events, workload->pending_events,
+			  cached_events, INTEL_GVT_EVENT_MAX);
+		rb_head = wa_ctx->indirect_ctx.size;
+	}
+
+	ret = ip_gma_set(&s, gma_head + rb_head);
 	if (ret)
 		goto out;
 
-	ret = command_scan(&s, 0, ring_tail,
+	if (!cached_events && cacheable) {
+		s.ring_bb_cacheable = true;
+		bitmap_zero(s.ring_bb_events, INTEL_GVT_EVENT_MAX);
+
+		rb_head = wa_ctx->indirect_ctx.size;
+		ret = command_scan(&s, 0, rb_head,
+			wa_ctx->indirect_ctx.guest_gma, ring_size);
+		if (ret)
+			goto out;
+
+		if (s.ring_bb_cacheable && s.ip_gma == gma_head + rb_head)
+			wa_ctx_cache_add(s.vgpu, wa_ctx, s.ring_bb_events);
+	}
+
+	ret = command_scan(&s, rb_head, ring_tail,
 		wa_ctx->indirect_ctx.guest_gma, ring_size);
 out:
 	return ret;
 }
 
+/**
+ * intel_gvt_ring_buffer_len - size of the guest ring contents of a workload
+ * @workload: a workload
+ *
+ * Returns:
+ * The number of bytes between the ring head and tail of the workload.
+ */
+unsigned long intel_gvt_ring_buffer_len(struct intel_vgpu_workload *workload)
+{
+	unsigned long guest_rb_size = _RING_CTL_BUF_SIZE(workload->rb_ctl);
+
+	return (workload->rb_tail + guest_rb_size - workload->rb_head) %
+		guest_rb_size;
+}
+
 static int shadow_workload_ring_buffer(struct intel_vgpu_workload *workload)
 {
 	struct intel_vgpu *vgpu = workload->vgpu;
@@ -2660,8 +3925,7 @@ static int shadow_workload_ring_buffer(struct intel_vgpu_workload *workload)
 	guest_rb_size = _RING_CTL_BUF_SIZE(workload->rb_ctl);
 
 	/* calculate workload ring buffer size */
-	workload->rb_len = (workload->rb_tail + guest_rb_size -
-			workload->rb_head) % guest_rb_size;
+	workload->rb_len = intel_gvt_ring_buffer_len(workload);
 
 	gma_head = workload->rb_start + workload->rb_head;
 	gma_tail = workload->rb_start + workload->rb_tail;
@@ -2705,29 +3969,273 @@ static int shadow_workload_ring_buffer(struct intel_vgpu_workload *workload)
 		gvt_vgpu_err("fail to copy guest ring buffer\n");
 		return ret;
 	}
+	intel_vgpu_stat_add(vgpu, INTEL_VGPU_STAT_SHADOW_BYTES,
+			    workload->rb_len);
 	return 0;
 }
 
+/**
+ * intel_gvt_scan_and_shadow_ringbuffer - copy and audit the ring commands
+ * @workload: a workload
+ *
+ * The commands are copied into the ring scan buffer and scanned, and
+ * patched, there. The buffer is cacheable, unlike the host ring they are
+ * copied to afterwards.
+ *
+ * Returns:
+ * zero on success, negative error code if failed.
+ */
 int intel_gvt_scan_and_shadow_ringbuffer(struct intel_vgpu_workload *workload)
 {
 	int ret;
 	struct intel_vgpu *vgpu = workload->vgpu;
 
+	capture_begin(workload);
+
 	ret = shadow_workload_ring_buffer(workload);
 	if (ret) {
 		gvt_vgpu_err("fail to shadow workload ring_buffer\n");
-		return ret;
+		goto out;
 	}
 
 	ret = scan_workload(workload);
-	if (ret) {
+	if (ret == -EAGAIN && !list_empty(&workload->direct_bb)) {
+		release_workload_bbs(workload);
+		workload->no_direct_bb = true;
+
+		ret = shadow_workload_ring_buffer(workload, va);
+		if (ret) {
+			gvt_vgpu_err("fail to shadow workload ring_buffer\n");
+			goto out;
+		}
+		ret = scan_workload(workload);
+	}
+	if (ret)
 		gvt_vgpu_err("scan workload error\n");
-		return ret;
+out:
+	gma_tlb_flush(vgpu);
+	capture_end(workload, ret);
+	return ret;
+}
+
+/**
+ * intel_vgpu_capture_workloads - record the next workloads of a vGPU
+ * @vgpu: a vGPU
+ * @count: number of workloads to record, up to GVT_CAPTURE_MAX
+ *
+ * The captures recorded so far are dropped. A count of zero just drops
+ * them.
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+int intel_vgpu_capture_workloads(struct intel_vgpu *vgpu, unsigned int count)
+{
+	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
+
+	if (count > GVT_CAPTURE_MAX)
+		return -EINVAL;
+
+	mutex_lock(&dev_priv->drm.struct_mutex);
+	clean_captures(vgpu);
+	vgpu->submission.capture_remaining = count;
+	mutex_unlock(&dev_priv->drm.struct_mutex);
+	return 0;
+}
+
+/**
+ * intel_vgpu_dump_captures - write the captures of a vGPU into a seq_file
+ * @vgpu: a vGPU
+ * @m: the seq_file
+ *
+ * The dump can be loaded back with intel_vgpu_load_captures().
+ */
+void intel_vgpu_dump_captures(struct intel_vgpu *vgpu, struct seq_file *m)
+{
+	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
+	struct intel_vgpu_capture_chunk *c;
+	struct intel_vgpu_capture *capture;
+
+	mutex_lock(&dev_priv->drm.struct_mutex);
+	list_for_each_entry(capture, &vgpu->submission.captures, list) {
+		struct gvt_capture_header h = {
+			.magic = GVT_CAPTURE_MAGIC,
+			.ring_id = capture->ring_id,
+			.rb_start = capture->rb_start,
+			.rb_head = capture->rb_head,
+			.rb_tail = capture->rb_tail,
+			.rb_ctl = capture->rb_ctl,
+			.nr_chunks = capture->nr_chunks,
+		};
+
+		seq_write(m, &h, sizeof(h));
+		list_for_each_entry(c, &capture->chunks, list) {
+			struct gvt_capture_chunk_header ch = {
+				.gma = c->gma,
+				.len = c->len,
+			};
+
+			seq_write(m, &ch, sizeof(ch));
+			seq_write(m, c->data, c->len);
+		}
+	}
+	mutex_unlock(&dev_priv->drm.struct_mutex);
+}
+
+/**
+ * intel_vgpu_load_captures - replace the captures of a vGPU with a dump
+ * @vgpu: a vGPU
+ * @buf: the dump, as written by intel_vgpu_dump_captures()
+ * @size: size of the dump
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+int intel_vgpu_load_captures(struct intel_vgpu *vgpu, const void *buf,
+			     size_t size)
+{
+	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
+	const struct gvt_capture_chunk_header *ch;
+	const struct gvt_capture_header *h;
+	struct intel_vgpu_capture *capture, *tmp;
+	LIST_HEAD(captures);
+	unsigned int i, nr = 0;
+	int ret = -EINVAL;
+
+	while (size) {
+		h = buf;
+		if (size < sizeof(*h) || h->magic != GVT_CAPTURE_MAGIC ||
+		    h->ring_id >= I915_NUM_ENGINES || ++nr > GVT_CAPTURE_MAX)
+			goto err;
+		buf += sizeof(*h);
+		size -= sizeof(*h);
+
+		capture = kzalloc(sizeof(*capture), GFP_KERNEL);
+		if (!capture) {
+			ret = -ENOMEM;
+			goto err;
+		}
+		capture->ring_id = h->ring_id;
+		capture->rb_start = h->rb_start;
+		capture->rb_head = h->rb_head;
+		capture->rb_tail = h->rb_tail;
+		capture->rb_ctl = h->rb_ctl;
+		INIT_LIST_HEAD(&capture->chunks);
+		list_add_tail(&capture->list, &captures);
+
+		for (i = 0; i < h->nr_chunks; i++) {
+			ch = buf;
+			if (size < sizeof(*ch) || ch->len > size - sizeof(*ch))
+				goto err;
+			capture_add_chunk(capture, ch->gma, (void *)(ch + 1),
+					  ch->len);
+			if (capture->failed) {
+				ret = -ENOMEM;
+				goto err;
+			}
+			buf += sizeof(*ch) + ch->len;
+			size -= sizeof(*ch) + ch->len;
+		}
 	}
+
+	mutex_lock(&dev_priv->drm.struct_mutex);
+	clean_captures(vgpu);
+	list_splice(&captures, &vgpu->submission.captures);
+	mutex_unlock(&dev_priv->drm.struct_mutex);
 	return 0;
+err:
+	list_for_each_entry_safe(capture, tmp, &captures, list)
+		capture_free(capture);
+	return ret;
+}
+
+/**
+ * intel_vgpu_replay_captures - feed the captures of a vGPU to the parser
+ * @vgpu: an inactive vGPU
+ * @m: the seq_file receiving the result of each capture
+ *
+ * Each capture is shadowed and scanned again as a workload of @vgpu, and
+ * the time it took is reported. The scan is the real one, so the vGPU
+ * must not be running a guest.
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+int intel_vgpu_replay_captures(struct intel_vgpu *vgpu, struct seq_file *m)
+{
+	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
+	struct intel_vgpu_submission *s = &vgpu->submission;
+	struct intel_vgpu_shadow_bb *bb, *pos;
+	struct intel_vgpu_workload *workload;
+	struct intel_vgpu_capture *capture;
+	unsigned int i = 0, nr_bb;
+	int ret = 0;
+	u64 t;
+
+	workload = kzalloc(sizeof(*workload), GFP_KERNEL);
+	if (!workload)
+		return -ENOMEM;
+
+	mutex_lock(&vgpu->vgpu_lock);
+	if (vgpu->active) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	mutex_lock(&dev_priv->drm.struct_mutex);
+	list_for_each_entry(capture, &s->captures, list) {
+		memset(workload, 0, sizeof(*workload));
+		workload->vgpu = vgpu;
+		workload->ring_id = capture->ring_id;
+		workload->rb_start = capture->rb_start;
+		workload->rb_head = capture->rb_head;
+		workload->rb_tail = capture->rb_tail;
+		workload->rb_ctl = capture->rb_ctl;
+		INIT_LIST_HEAD(&workload->shadow_bb);
+
+		s->capture = capture;
+		s->replaying = true;
+		t = ktime_get_ns();
+		ret = intel_gvt_scan_and_shadow_ringbuffer(workload);
+		t = ktime_get_ns() - t;
+		s->replaying = false;
+		s->capture = NULL;
+
+		nr_bb = 0;
+		list_for_each_entry_safe(bb, pos, &workload->shadow_bb, list) {
+			list_del_init(&bb->list);
+			intel_vgpu_put_shadow_bb(vgpu, bb);
+			nr_bb++;
+		}
+
+		seq_printf(m, "%u: ring %d, %lu ring bytes, %u batch buffers, %s, %llu ns\n",
+			   i++, capture->ring_id, workload->rb_len, nr_bb,
+			   ret ? "failed" : "ok", t);
+	}
+	mutex_unlock(&dev_priv->drm.struct_mutex);
+	ret = 0;
+out:
+	mutex_unlock(&vgpu->vgpu_lock);
+	kfree(workload);
+	return ret;
+}
+
+/**
+ * intel_vgpu_clean_captures - drop the captures of a vGPU
+ * @vgpu: a vGPU
+ *
+ */
+void intel_vgpu_clean_captures(struct intel_vgpu *vgpu)
+{
+	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
+
+	mutex_lock(&dev_priv->drm.struct_mutex);
+	clean_captures(vgpu);
+	mutex_unlock(&dev_priv->drm.struct_mutex);
 }
 
-static int shadow_indirect_ctx(struct intel_shadow_wa_ctx *wa_ctx)
+static int shadow_indirect_ctx(struct intel_shadow_wa_ctx *wa_ctx,
+		const void *cached)
 {
 	int ctx_size = wa_ctx->indirect_ctx.size;
 	unsigned long guest_gma = wa_ctx->indirect_ctx.guest_gma;
@@ -2735,47 +4243,39 @@ static int shadow_indirect_ctx(struct intel_shadow_wa_ctx *wa_ctx)
 					struct intel_vgpu_workload,
 					wa_ctx);
 	struct intel_vgpu *vgpu = workload->vgpu;
-	struct drm_i915_gem_object *obj;
+	struct intel_vgpu_shadow_bb *bb;
 	int ret = 0;
-	void *map;
 
-	obj = i915_gem_object_create(workload->vgpu->gvt->dev_priv,
-				     roundup(ctx_size + CACHELINE_BYTES,
-					     PAGE_SIZE));
-	if (IS_ERR(obj))
-		return PTR_ERR(obj);
-
-	/* get the va of the shadow batch buffer */
-	map = i915_gem_object_pin_map(obj, I915_MAP_WB);
-	if (IS_ERR(map)) {
-		gvt_vgpu_err("failed to vmap shadow indirect ctx\n");
-		ret = PTR_ERR(map);
-		goto put_obj;
-	}
+	/* the shadow comes from the pool, usually mapped and bound already */
+	bb = intel_vgpu_get_shadow_bb(vgpu, ctx_size + CACHELINE_BYTES);
+	if (IS_ERR(bb))
+		return PTR_ERR(bb);
 
-	ret = i915_gem_object_set_to_cpu_domain(obj, false);
+	ret = shadow_bb_begin_write(bb);
 	if (ret) {
-		gvt_vgpu_err("failed to set shadow indirect ctx to CPU\n");
-		goto unmap_src;
+		gvt_vgpu_err("failed to map shadow indirect ctx\n");
+		goto put_bb;
 	}
 
-	ret = copy_gma_to_hva(workload->vgpu,
-				workload->vgpu->gtt.ggtt_mm,
-				guest_gma, guest_gma + ctx_size,
-				map);
-	if (ret < 0) {
-		gvt_vgpu_err("fail to copy guest indirect ctx\n");
-		goto unmap_src;
+	if (cached) {
+		memcpy(bb->va, cached, ctx_size);
+	} else {
+		ret = copy_gma_to_hva(workload->vgpu,
+					workload->vgpu->gtt.ggtt_mm,
+					guest_gma, guest_gma + ctx_size,
+					bb->va);
+		if (ret < 0) {
+			gvt_vgpu_err("fail to copy guest indirect ctx\n");
+			goto put_bb;
+		}
 	}
 
-	wa_ctx->indirect_ctx.obj = obj;
-	wa_ctx->indirect_ctx.shadow_va = map;
+	wa_ctx->indirect_ctx.bb = bb;
+	wa_ctx->indirect_ctx.shadow_va = bb->va;
 	return 0;
 
-unmap_src:
-	i915_gem_object_unpin_map(obj);
-put_obj:
-	i915_gem_object_put(obj);
+put_bb:
+	intel_vgpu_put_shadow_bb(vgpu, bb);
 	return ret;
 }
 
@@ -2805,25 +4305,32 @@ int intel_gvt_scan_and_shadow_wa_ctx(struct intel_shadow_wa_ctx *wa_ctx)
 					struct intel_vgpu_workload,
 					wa_ctx);
 	struct intel_vgpu *vgpu = workload->vgpu;
+	/* a replay has no guest pages to track */
+	bool cacheable = i915_modparams.enable_gvt_bb_scan_cache &&
+			 !vgpu->submission.replaying;
+	struct wa_ctx_cache_entry *e = NULL;
 
 	if (wa_ctx->indirect_ctx.size == 0)
 		return 0;
 
-	ret = shadow_indirect_ctx(wa_ctx);
+	if (cacheable)
+		e = wa_ctx_cache_lookup(vgpu, wa_ctx->indirect_ctx.guest_gma,
+					wa_ctx->indirect_ctx.size);
+
+	ret = shadow_indirect_ctx(wa_ctx, e ? e->va : NULL);
 	if (ret) {
 		gvt_vgpu_err("fail to shadow indirect ctx\n");
-		return ret;
+		goto out;
 	}
 
 	combine_wa_ctx(wa_ctx);
 
-	ret = scan_wa_ctx(wa_ctx);
-	if (ret) {
+	ret = scan_wa_ctx(wa_ctx, e ? e->events : NULL, cacheable);
+	if (ret)
 		gvt_vgpu_err("scan wa ctx error\n");
-		return ret;
-	}
-
-	return 0;
+out:
+	gma_tlb_flush(vgpu);
+	return ret;
 }
 
 static struct cmd_info *find_cmd_entry_any_ring(struct intel_gvt *gvt,
@@ -2840,12 +4347,42 @@ static struct cmd_info *find_cmd_entry_any_ring(struct intel_gvt *gvt,
 	return info;
 }
 
+static int alloc_cmd_table(struct intel_gvt *gvt)
+{
+	struct decode_info *d_info;
+	int ring, type;
+
+	for (ring = 0; ring < I915_NUM_ENGINES; ring++) {
+		if (!HAS_ENGINE(gvt->dev_priv, ring))
+			continue;
+
+		for (type = 0; type < GVT_CMD_TYPE_NUM; type++) {
+			d_info = ring_decode_info[ring][type];
+			if (d_info == NULL)
+				continue;
+
+			gvt->cmd_table[ring][type] = kvmalloc_array(
+					cmd_table_size(d_info),
+					sizeof(struct cmd_info *),
+					GFP_KERNEL | __GFP_ZERO);
+			if (!gvt->cmd_table[ring][type])
+				return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
 static int init_cmd_table(struct intel_gvt *gvt)
 {
-	int i;
-	struct cmd_entry *e;
+	int i, ret;
 	struct cmd_info	*info;
-	unsigned int gen_type;
+	struct cmd_info	**slot;
+	unsigned long rings;
+	unsigned int gen_type, ring;
+
+	ret = alloc_cmd_table(gvt);
+	if (ret)
+		return ret;
 
 	gen_type = intel_gvt_get_device_type(gvt);
 
@@ -2853,53 +4390,64 @@ static int init_cmd_table(struct intel_gvt *gvt)
 		if (!(cmd_info[i].devices & gen_type))
 			continue;
 
-		e = kzalloc(sizeof(*e), GFP_KERNEL);
-		if (!e)
-			return -ENOMEM;
-
-		e->info = &cmd_info[i];
 		info = find_cmd_entry_any_ring(gvt,
-				e->info->opcode, e->info->rings);
+				cmd_info[i].opcode, cmd_info[i].rings);
 		if (info) {
-			gvt_err("%s %s duplicated\n", e->info->name,
+			gvt_err("%s %s duplicated\n", cmd_info[i].name,
 					info->name);
 			return -EEXIST;
 		}
 
-		INIT_HLIST_NODE(&e->hlist);
-		add_cmd_entry(gvt, e);
+		rings = cmd_info[i].rings;
+		for_each_set_bit(ring, &rings, I915_NUM_ENGINES) {
+			slot = cmd_table_slot(gvt, cmd_info[i].opcode, ring);
+			if (slot)
+				*slot = &cmd_info[i];
+		}
 		gvt_dbg_cmd("add %-30s op %04x flag %x devs %02x rings %02x\n",
-				e->info->name, e->info->opcode, e->info->flag,
-				e->info->devices, e->info->rings);
+				cmd_info[i].name, cmd_info[i].opcode,
+				cmd_info[i].flag, cmd_info[i].devices,
+				cmd_info[i].rings);
 	}
 	return 0;
 }
 
 static void clean_cmd_table(struct intel_gvt *gvt)
 {
-	struct hlist_node *tmp;
-	struct cmd_entry *e;
-	int i;
-
-	hash_for_each_safe(gvt->cmd_table, i, tmp, e, hlist)
-		kfree(e);
+	int ring, type;
 
-	hash_init(gvt->cmd_table);
+	for (ring = 0; ring < I915_NUM_ENGINES; ring++) {
+		for (type = 0; type < GVT_CMD_TYPE_NUM; type++) {
+			kvfree(gvt->cmd_table[ring][type]);
+			gvt->cmd_table[ring][type] = NULL;
+		}
+	}
 }
 
 void intel_gvt_clean_cmd_parser(struct intel_gvt *gvt)
 {
+	bb_dedup_clean(gvt);
 	clean_cmd_table(gvt);
+	vfree(gvt->cmd_reg_policy);
+	gvt->cmd_reg_policy = NULL;
 }
 
 int intel_gvt_init_cmd_parser(struct intel_gvt *gvt)
 {
 	int ret;
 
+	bb_dedup_init(gvt);
+
 	ret = init_cmd_table(gvt);
+	if (!ret)
+		ret = init_cmd_reg_policy(gvt);
 	if (ret) {
 		intel_gvt_clean_cmd_parser(gvt);
 		return ret;
 	}
 	return 0;
 }
+
+#if IS_ENABLED(CONFIG_DRM_I915_SELFTEST)
+#include "selftests/intel_gvt.c"
+#endif
@@ -36,14 +36,42 @@
 #ifndef _GVT_CMD_PARSER_H_
 #define _GVT_CMD_PARSER_H_
 
-#define GVT_CMD_HASH_BITS 7
+#define GVT_CMD_TYPE_NUM 8
+
+#define GVT_GMA_TLB_SIZE 16
+
+/* a guest page translation, cached for the duration of a scan */
+struct intel_vgpu_gma_tlb_entry {
+	struct intel_vgpu_mm *mm;
+	unsigned long gma;
+	unsigned long gpa;
+	struct page *page;
+	void *va;
+	bool mapped;
+};
+
+struct seq_file;
 
 void intel_gvt_clean_cmd_parser(struct intel_gvt *gvt);
 
 int intel_gvt_init_cmd_parser(struct intel_gvt *gvt);
 
+unsigned long intel_gvt_ring_buffer_len(struct intel_vgpu_workload *workload);
+
 int intel_gvt_scan_and_shadow_ringbuffer(struct intel_vgpu_workload *workload);
 
 int intel_gvt_scan_and_shadow_wa_ctx(struct intel_shadow_wa_ctx *wa_ctx);
 
+void intel_vgpu_clean_bb_scan_cache(struct intel_vgpu *vgpu);
+
+void intel_gvt_release_direct_bbs(struct intel_vgpu_workload *workload);
+int intel_vgpu_set_scan_level(struct intel_vgpu *vgpu, int level);
+
+int intel_vgpu_capture_workloads(struct intel_vgpu *vgpu, unsigned int count);
+void intel_vgpu_dump_captures(struct intel_vgpu *vgpu, struct seq_file *m);
+int intel_vgpu_load_captures(struct intel_vgpu *vgpu, const void *buf,
+			     size_t size);
+int intel_vgpu_replay_captures(struct intel_vgpu *vgpu, struct seq_file *m);
+void intel_vgpu_clean_captures(struct intel_vgpu *vgpu);
+
 #endif
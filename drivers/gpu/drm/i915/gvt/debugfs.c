@@ -21,64 +21,71 @@
  * SOFTWARE.
  */
 #include <linux/debugfs.h>
-#include <linux/list_sort.h>
+#include <linux/sort.h>
 #include "i915_drv.h"
 #include "gvt.h"
 
-struct mmio_diff_param {
-	struct intel_vgpu *vgpu;
-	int total;
-	int diff;
-	struct list_head diff_mmio_list;
-};
+/*
+ * The diff is taken without holding the guest or the scheduler off for the
+ * whole walk, so that it can be scraped on a busy host: the vregs are copied
+ * a chunk at a time under the vreg seqcount, and the hardware is read a
+ * chunk at a time under the mmio context lock.
+ */
+#define MMIO_DIFF_CHUNK		256
+#define MMIO_DIFF_RETRIES	8
 
-struct diff_mmio {
-	struct list_head node;
-	u32 offset;
-	u32 preg;
-	u32 vreg;
+struct mmio_diff_snapshot {
+	unsigned int total;
+	u32 *offset;
+	u32 *preg;
+	u32 *vreg;
 };
 
-/* Compare two diff_mmio items. */
-static int mmio_offset_compare(void *priv,
-	struct list_head *a, struct list_head *b)
+static int mmio_offset_compare(const void *a, const void *b)
 {
-	struct diff_mmio *ma;
-	struct diff_mmio *mb;
+	u32 oa = *(const u32 *)a, ob = *(const u32 *)b;
 
-	ma = container_of(a, struct diff_mmio, node);
-	mb = container_of(b, struct diff_mmio, node);
-	if (ma->offset < mb->offset)
+	if (oa < ob)
 		return -1;
-	else if (ma->offset > mb->offset)
+	else if (oa > ob)
 		return 1;
 	return 0;
 }
 
-static inline int mmio_diff_handler(struct intel_gvt *gvt,
-				    u32 offset, void *data)
+static int mmio_diff_collect(struct intel_gvt *gvt, u32 offset, void *data)
 {
-	struct drm_i915_private *dev_priv = gvt->dev_priv;
-	struct mmio_diff_param *param = data;
-	struct diff_mmio *node;
-	u32 preg, vreg;
+	struct mmio_diff_snapshot *snap = data;
 
-	preg = I915_READ_NOTRACE(_MMIO(offset));
-	vreg = vgpu_vreg(param->vgpu, offset);
+	if (snap->offset)
+		snap->offset[snap->total] = offset;
+	snap->total++;
+	return 0;
+}
 
-	if (preg != vreg) {
-		node = kmalloc(sizeof(*node), GFP_KERNEL);
-		if (!node)
-			return -ENOMEM;
+static void mmio_diff_read_vregs(struct intel_vgpu *vgpu,
+		struct mmio_diff_snapshot *snap, unsigned int start,
+		unsigned int end)
+{
+	seqcount_t *seq = &vgpu->mmio.vreg_seq;
+	unsigned int i, retry, s;
 
-		node->offset = offset;
-		node->preg = preg;
-		node->vreg = vreg;
-		list_add(&node->node, &param->diff_mmio_list);
-		param->diff++;
+	for (retry = 0; retry < MMIO_DIFF_RETRIES; retry++) {
+		/* don't spin on a writer, it may sleep in its handler */
+		s = raw_read_seqcount(seq);
+		if (!(s & 1)) {
+			for (i = start; i < end; i++)
+				snap->vreg[i] = vgpu_vreg(vgpu, snap->offset[i]);
+			if (!read_seqcount_retry(seq, s))
+				return;
+		}
+		cond_resched();
 	}
-	param->total++;
-	return 0;
+
+	/* the guest keeps writing, wait for it */
+	mutex_lock(&vgpu->vgpu_lock);
+	for (i = start; i < end; i++)
+		snap->vreg[i] = vgpu_vreg(vgpu, snap->offset[i]);
+	mutex_unlock(&vgpu->vgpu_lock);
 }
 
 /* Show the all the different values of tracked mmio. */
@@ -86,40 +93,52 @@ static int vgpu_mmio_diff_show(struct seq_file *s, void *unused)
 {
 	struct intel_vgpu *vgpu = s->private;
 	struct intel_gvt *gvt = vgpu->gvt;
-	struct mmio_diff_param param = {
-		.vgpu = vgpu,
-		.total = 0,
-		.diff = 0,
-	};
-	struct diff_mmio *node, *next;
+	struct drm_i915_private *dev_priv = gvt->dev_priv;
+	struct mmio_diff_snapshot snap = {};
+	unsigned int i, j, end, diff = 0;
 
-	INIT_LIST_HEAD(&param.diff_mmio_list);
+	intel_gvt_for_each_tracked_mmio(gvt, mmio_diff_collect, &snap);
+	snap.offset = kvmalloc_array(snap.total, 3 * sizeof(u32), GFP_KERNEL);
+	if (!snap.offset)
+		return -ENOMEM;
+	snap.preg = snap.offset + snap.total;
+	snap.vreg = snap.preg + snap.total;
 
-	mutex_lock(&gvt->lock);
-	spin_lock_bh(&gvt->scheduler.mmio_context_lock);
+	snap.total = 0;
+	intel_gvt_for_each_tracked_mmio(gvt, mmio_diff_collect, &snap);
+	/* In an ascending order by mmio offset. */
+	sort(snap.offset, snap.total, sizeof(u32), mmio_offset_compare, NULL);
 
-	mmio_hw_access_pre(gvt->dev_priv);
-	/* Recognize all the diff mmios to list. */
-	intel_gvt_for_each_tracked_mmio(gvt, mmio_diff_handler, &param);
-	mmio_hw_access_post(gvt->dev_priv);
+	mmio_hw_access_pre(dev_priv);
+	for (i = 0; i < snap.total; i = end) {
+		end = min(i + MMIO_DIFF_CHUNK, snap.total);
 
-	spin_unlock_bh(&gvt->scheduler.mmio_context_lock);
-	mutex_unlock(&gvt->lock);
+		mmio_diff_read_vregs(vgpu, &snap, i, end);
 
-	/* In an ascending order by mmio offset. */
-	list_sort(NULL, &param.diff_mmio_list, mmio_offset_compare);
+		spin_lock_bh(&gvt->scheduler.mmio_context_lock);
+		for (j = i; j < end; j++)
+			snap.preg[j] = I915_READ_NOTRACE(_MMIO(snap.offset[j]));
+		spin_unlock_bh(&gvt->scheduler.mmio_context_lock);
+
+		cond_resched();
+	}
+	mmio_hw_access_post(dev_priv);
 
 	seq_printf(s, "%-8s %-8s %-8s %-8s\n", "Offset", "HW", "vGPU", "Diff");
-	list_for_each_entry_safe(node, next, &param.diff_mmio_list, node) {
-		u32 diff = node->preg ^ node->vreg;
+	for (i = 0; i < snap.total; i++) {
+		u32 bits = snap.preg[i] ^ snap.vreg[i];
+
+		if (!bits)
+			continue;
 
 		seq_printf(s, "%08x %08x %08x %*pbl\n",
-			   node->offset, node->preg, node->vreg,
-			   32, &diff);
-		list_del(&node->node);
-		kfree(node);
+			   snap.offset[i], snap.preg[i], snap.vreg[i],
+			   32, &bits);
+		diff++;
 	}
-	seq_printf(s, "Total: %d, Diff: %d\n", param.total, param.diff);
+	seq_printf(s, "Total: %u, Diff: %u\n", snap.total, diff);
+
+	kvfree(snap.offset);
 	return 0;
 }
 
@@ -135,6 +154,242 @@ static const struct file_operations vgpu_mmio_diff_fops = {
 	.release	= single_release,
 };
 
+/* Show the out-of-sync page table counters of a vGPU. */
+static int vgpu_oos_stats_show(struct seq_file *s, void *unused)
+{
+	struct intel_vgpu *vgpu = s->private;
+	struct intel_vgpu_gtt *gtt = &vgpu->gtt;
+
+	mutex_lock(&vgpu->vgpu_lock);
+	seq_printf(s, "oos pages: %u\n", gtt->num_oos_pages);
+	seq_printf(s, "write protection faults: %llu\n",
+		   gtt->oos_stats.wp_writes);
+	seq_printf(s, "set out of sync: %llu\n", gtt->oos_stats.to_oos);
+	seq_printf(s, "set write protected: %llu\n", gtt->oos_stats.to_wp);
+	seq_printf(s, "synced: %llu\n", gtt->oos_stats.syncs);
+	mutex_unlock(&vgpu->vgpu_lock);
+	return 0;
+}
+
+static int vgpu_oos_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, vgpu_oos_stats_show, inode->i_private);
+}
+
+static const struct file_operations vgpu_oos_stats_fops = {
+	.open		= vgpu_oos_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static const char * const vgpu_stat_names[INTEL_VGPU_STAT_MAX] = {
+	[INTEL_VGPU_STAT_MMIO_READ] = "mmio_read",
+	[INTEL_VGPU_STAT_MMIO_WRITE] = "mmio_write",
+	[INTEL_VGPU_STAT_WP_FAULT] = "wp_fault",
+	[INTEL_VGPU_STAT_OOS_SYNC] = "oos_sync",
+	[INTEL_VGPU_STAT_WORKLOAD_SCAN] = "workload_scan",
+	[INTEL_VGPU_STAT_SHADOW_BYTES] = "shadow_bytes",
+	[INTEL_VGPU_STAT_SCAN_NS] = "scan_ns",
+	[INTEL_VGPU_STAT_SHADOW_NS] = "shadow_ns",
+	[INTEL_VGPU_STAT_DISPATCH_NS] = "dispatch_ns",
+	[INTEL_VGPU_STAT_COMPLETE_NS] = "complete_ns",
+	[INTEL_VGPU_STAT_BUSY_NS] = "busy_ns",
+	[INTEL_VGPU_STAT_TIMESLICE_NS] = "timeslice_ns",
+	[INTEL_VGPU_STAT_PREEMPT] = "preempt",
+	[INTEL_VGPU_STAT_WAITBOOST] = "waitboost",
+};
+
+/* Sum up the per-CPU counters of a vGPU. */
+static void vgpu_stats_read(struct intel_vgpu *vgpu, u64 *total)
+{
+	int cpu, i;
+
+	memset(total, 0, sizeof(u64) * INTEL_VGPU_STAT_MAX);
+	for_each_possible_cpu(cpu) {
+		struct intel_vgpu_stats *stats = per_cpu_ptr(vgpu->stats, cpu);
+
+		for (i = 0; i < INTEL_VGPU_STAT_MAX; i++)
+			total[i] += stats->counter[i];
+	}
+}
+
+/* Show the host side costs of a vGPU. */
+static int vgpu_stats_show(struct seq_file *s, void *unused)
+{
+	struct intel_vgpu *vgpu = s->private;
+	u64 total[INTEL_VGPU_STAT_MAX];
+	int i;
+
+	vgpu_stats_read(vgpu, total);
+	for (i = 0; i < INTEL_VGPU_STAT_MAX; i++)
+		seq_printf(s, "%s: %llu\n", vgpu_stat_names[i], total[i]);
+	return 0;
+}
+
+static int vgpu_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, vgpu_stats_show, inode->i_private);
+}
+
+static const struct file_operations vgpu_stats_fops = {
+	.open		= vgpu_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static const char * const workload_interval_names[] = {
+	"shadow", "wait", "queue", "exec", "complete",
+};
+
+/*
+ * Show the latency histograms of the completed workloads, one line per
+ * ring and interval. Bucket n counts the intervals of [2^(n-1), 2^n) us.
+ */
+static int vgpu_workload_latency_show(struct seq_file *s, void *unused)
+{
+	struct intel_vgpu *vgpu = s->private;
+	struct intel_vgpu_workload_latency *latency;
+	int ring_id, i, j;
+
+	BUILD_BUG_ON(ARRAY_SIZE(workload_interval_names) !=
+		     WORKLOAD_STAGE_MAX - 1);
+
+	mutex_lock(&vgpu->vgpu_lock);
+	for (ring_id = 0; ring_id < I915_NUM_ENGINES; ring_id++) {
+		latency = &vgpu->submission.latency[ring_id];
+		for (i = 0; i < WORKLOAD_STAGE_MAX - 1; i++) {
+			seq_printf(s, "ring%d %s:", ring_id,
+				   workload_interval_names[i]);
+			for (j = 0; j < GVT_LATENCY_BUCKETS; j++)
+				seq_printf(s, " %u", latency->hist[i][j]);
+			seq_putc(s, '\n');
+		}
+	}
+	mutex_unlock(&vgpu->vgpu_lock);
+	return 0;
+}
+
+static int vgpu_workload_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, vgpu_workload_latency_show, inode->i_private);
+}
+
+static const struct file_operations vgpu_workload_latency_fops = {
+	.open		= vgpu_workload_latency_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* biggest dump accepted by the capture file */
+#define GVT_CAPTURE_LOAD_MAX	SZ_16M
+
+/* Read the recorded workload streams of a vGPU, as a binary dump. */
+static int vgpu_capture_show(struct seq_file *s, void *unused)
+{
+	intel_vgpu_dump_captures(s->private, s);
+	return 0;
+}
+
+static int vgpu_capture_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, vgpu_capture_show, inode->i_private);
+}
+
+/*
+ * Writing a number records that many of the next workloads of the vGPU,
+ * writing a dump in a single write() loads it for a replay.
+ */
+static ssize_t vgpu_capture_write(struct file *file, const char __user *ubuf,
+				  size_t count, loff_t *ppos)
+{
+	struct intel_vgpu *vgpu = ((struct seq_file *)file->private_data)->private;
+	unsigned int nr;
+	void *buf;
+	int ret;
+
+	if (count < 16 && !kstrtouint_from_user(ubuf, count, 0, &nr)) {
+		ret = intel_vgpu_capture_workloads(vgpu, nr);
+		return ret ? ret : count;
+	}
+
+	if (count > GVT_CAPTURE_LOAD_MAX)
+		return -E2BIG;
+
+	buf = vmemdup_user(ubuf, count);
+	if (IS_ERR(buf))
+		return PTR_ERR(buf);
+
+	ret = intel_vgpu_load_captures(vgpu, buf, count);
+	kvfree(buf);
+	return ret ? ret : count;
+}
+
+static const struct file_operations vgpu_capture_fops = {
+	.open		= vgpu_capture_open,
+	.read		= seq_read,
+	.write		= vgpu_capture_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* Feed the recorded workload streams to the parser, one line each. */
+static int vgpu_capture_replay_show(struct seq_file *s, void *unused)
+{
+	return intel_vgpu_replay_captures(s->private, s);
+}
+
+static int vgpu_capture_replay_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, vgpu_capture_replay_show, inode->i_private);
+}
+
+static const struct file_operations vgpu_capture_replay_fops = {
+	.open		= vgpu_capture_replay_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* Show the costs of all the vGPUs, one line per vGPU. */
+static int gvt_vgpu_stats_show(struct seq_file *s, void *unused)
+{
+	struct intel_gvt *gvt = s->private;
+	u64 total[INTEL_VGPU_STAT_MAX];
+	struct intel_vgpu *vgpu;
+	int id, i;
+
+	seq_puts(s, "vgpu");
+	for (i = 0; i < INTEL_VGPU_STAT_MAX; i++)
+		seq_printf(s, " %s", vgpu_stat_names[i]);
+	seq_putc(s, '\n');
+
+	mutex_lock(&gvt->lock);
+	idr_for_each_entry(&gvt->vgpu_idr, vgpu, id) {
+		vgpu_stats_read(vgpu, total);
+		seq_printf(s, "%d", vgpu->id);
+		for (i = 0; i < INTEL_VGPU_STAT_MAX; i++)
+			seq_printf(s, " %llu", total[i]);
+		seq_putc(s, '\n');
+	}
+	mutex_unlock(&gvt->lock);
+	return 0;
+}
+
+static int gvt_vgpu_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, gvt_vgpu_stats_show, inode->i_private);
+}
+
+static const struct file_operations gvt_vgpu_stats_fops = {
+	.open		= gvt_vgpu_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 /**
  * intel_gvt_debugfs_add_vgpu - register debugfs entries for a vGPU
  * @vgpu: a vGPU
@@ -162,6 +417,33 @@ int intel_gvt_debugfs_add_vgpu(struct intel_vgpu *vgpu)
 	if (!ent)
 		return -ENOMEM;
 
+	if (i915_modparams.enable_gvt_oos) {
+		ent = debugfs_create_file("oos_stats", 0444, vgpu->debugfs,
+					  vgpu, &vgpu_oos_stats_fops);
+		if (!ent)
+			return -ENOMEM;
+	}
+
+	ent = debugfs_create_file("stats", 0444, vgpu->debugfs,
+				  vgpu, &vgpu_stats_fops);
+	if (!ent)
+		return -ENOMEM;
+
+	ent = debugfs_create_file("workload_latency", 0444, vgpu->debugfs,
+				  vgpu, &vgpu_workload_latency_fops);
+	if (!ent)
+		return -ENOMEM;
+
+	ent = debugfs_create_file("capture", 0644, vgpu->debugfs,
+				  vgpu, &vgpu_capture_fops);
+	if (!ent)
+		return -ENOMEM;
+
+	ent = debugfs_create_file("capture_replay", 0444, vgpu->debugfs,
+				  vgpu, &vgpu_capture_replay_fops);
+	if (!ent)
+		return -ENOMEM;
+
 	return 0;
 }
 
@@ -198,6 +480,11 @@ int intel_gvt_debugfs_init(struct intel_gvt *gvt)
 	if (!ent)
 		return -ENOMEM;
 
+	ent = debugfs_create_file("vgpu_stats", 0444, gvt->debugfs_root,
+				  gvt, &gvt_vgpu_stats_fops);
+	if (!ent)
+		return -ENOMEM;
+
 	return 0;
 }
 
@@ -32,6 +32,8 @@
  *
  */
 
+#include <linux/vfio.h>
+
 #include "i915_drv.h"
 #include "gvt.h"
 
@@ -313,40 +315,151 @@ static int setup_virtual_dp_monitor(struct intel_vgpu *vgpu, int port_num,
 	return 0;
 }
 
+#define VBLANK_TIMER_PERIOD 16000000
+
+/* Link symbol clock of the virtual DP port in kHz, or 0 if unknown. */
+static u32 vgpu_port_link_clock(struct intel_vgpu *vgpu, enum port port)
+{
+	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
+	u32 ctrl2, dpll, rate;
+
+	if (IS_BROADWELL(dev_priv)) {
+		switch (vgpu_vreg_t(vgpu, PORT_CLK_SEL(port)) &
+			PORT_CLK_SEL_MASK) {
+		case PORT_CLK_SEL_LCPLL_810:
+			return 162000;
+		case PORT_CLK_SEL_LCPLL_1350:
+			return 270000;
+		case PORT_CLK_SEL_LCPLL_2700:
+			return 540000;
+		default:
+			return 0;
+		}
+	}
+
+	ctrl2 = vgpu_vreg_t(vgpu, DPLL_CTRL2);
+	if (!(ctrl2 & DPLL_CTRL2_DDI_SEL_OVERRIDE(port)))
+		return 0;
+
+	dpll = (ctrl2 & DPLL_CTRL2_DDI_CLK_SEL_MASK(port)) >>
+		DPLL_CTRL2_DDI_CLK_SEL_SHIFT(port);
+	rate = (vgpu_vreg_t(vgpu, DPLL_CTRL1) &
+		DPLL_CTRL1_LINK_RATE_MASK(dpll)) >>
+		DPLL_CTRL1_LINK_RATE_SHIFT(dpll);
+
+	switch (rate) {
+	case DPLL_CTRL1_LINK_RATE_810:
+		return 162000;
+	case DPLL_CTRL1_LINK_RATE_1080:
+		return 216000;
+	case DPLL_CTRL1_LINK_RATE_1350:
+		return 270000;
+	case DPLL_CTRL1_LINK_RATE_1620:
+		return 324000;
+	case DPLL_CTRL1_LINK_RATE_2160:
+		return 432000;
+	case DPLL_CTRL1_LINK_RATE_2700:
+		return 540000;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Derive the frame period the guest programmed on a virtual pipe from its
+ * transcoder timings and DP link M/N, falling back to 60Hz-ish when the
+ * guest has not programmed anything sensible.
+ */
+static u64 vgpu_pipe_vblank_period(struct intel_vgpu *vgpu, int pipe)
+{
+	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
+	enum transcoder trans = (enum transcoder)pipe;
+	enum port port;
+	u32 htotal, vtotal, link_m, link_n, link_clock;
+	u64 pixel_clock, period;
+
+	if (edp_pipe_is_enabled(vgpu) && get_edp_pipe(vgpu) == pipe) {
+		trans = TRANSCODER_EDP;
+		port = PORT_A;
+	} else {
+		port = (vgpu_vreg_t(vgpu, TRANS_DDI_FUNC_CTL(trans)) &
+			TRANS_DDI_PORT_MASK) >> TRANS_DDI_PORT_SHIFT;
+	}
+
+	htotal = ((vgpu_vreg_t(vgpu, HTOTAL(trans)) >> 16) & 0x1fff) + 1;
+	vtotal = ((vgpu_vreg_t(vgpu, VTOTAL(trans)) >> 16) & 0x1fff) + 1;
+	link_m = vgpu_vreg_t(vgpu, PIPE_LINK_M1(trans)) & DATA_LINK_M_N_MASK;
+	link_n = vgpu_vreg_t(vgpu, PIPE_LINK_N1(trans)) & DATA_LINK_M_N_MASK;
+	link_clock = vgpu_port_link_clock(vgpu, port);
+
+	if (!link_m || !link_n || !link_clock)
+		return VBLANK_TIMER_PERIOD;
+
+	/* pixel clock in kHz, i.e. pixels per millisecond */
+	pixel_clock = div_u64((u64)link_clock * link_m, link_n);
+	if (!pixel_clock)
+		return VBLANK_TIMER_PERIOD;
+
+	period = div64_u64((u64)htotal * vtotal * NSEC_PER_MSEC, pixel_clock);
+	if (period < NSEC_PER_SEC / 240 || period > NSEC_PER_SEC / 10)
+		return VBLANK_TIMER_PERIOD;
+
+	return period;
+}
+
+static enum hrtimer_restart vblank_timer_fn(struct hrtimer *data)
+{
+	struct intel_vgpu_vblank_timer *vblank_timer;
+	struct intel_vgpu *vgpu;
+
+	vblank_timer = container_of(data, struct intel_vgpu_vblank_timer,
+				    timer);
+	vgpu = container_of(vblank_timer, struct intel_vgpu,
+			    display.vblank_timer);
+
+	queue_work(system_highpri_wq, &vblank_timer->work);
+	hrtimer_add_expires_ns(&vblank_timer->timer, vblank_timer->period);
+	return HRTIMER_RESTART;
+}
+
 /**
- * intel_gvt_check_vblank_emulation - check if vblank emulation timer should
- * be turned on/off when a virtual pipe is enabled/disabled.
- * @gvt: a GVT device
+ * intel_vgpu_update_vblank_emulation - start/stop the vblank timer of a vGPU
+ * @vgpu: a vGPU
  *
- * This function is used to turn on/off vblank timer according to currently
- * enabled/disabled virtual pipes.
+ * This function is used to turn on/off the vblank timer of a vGPU according
+ * to its enabled virtual pipes, and to follow the refresh rate the guest
+ * programmed on them. The caller should hold vgpu_lock.
  *
  */
-void intel_gvt_check_vblank_emulation(struct intel_gvt *gvt)
+void intel_vgpu_update_vblank_emulation(struct intel_vgpu *vgpu)
 {
-	struct intel_gvt_irq *irq = &gvt->irq;
-	struct intel_vgpu *vgpu;
-	int pipe, id;
+	struct intel_vgpu_vblank_timer *vblank_timer =
+		&vgpu->display.vblank_timer;
+	int pipe;
+	u64 period;
 
-	if (WARN_ON(!mutex_is_locked(&gvt->lock)))
-		return;
+	for (pipe = 0; pipe < I915_MAX_PIPES; pipe++) {
+		if (pipe_is_enabled(vgpu, pipe))
+			break;
+	}
 
-	for_each_active_vgpu(gvt, vgpu, id) {
-		for (pipe = 0; pipe < I915_MAX_PIPES; pipe++) {
-			if (pipe_is_enabled(vgpu, pipe))
-				goto out;
-		}
+	if (pipe == I915_MAX_PIPES ||
+	    vblank_timer->mode == INTEL_VGPU_VBLANK_CONSUMER) {
+		/* all the pipes are disabled */
+		hrtimer_cancel(&vblank_timer->timer);
+		return;
 	}
 
-	/* all the pipes are disabled */
-	hrtimer_cancel(&irq->vblank_timer.timer);
-	return;
+	period = vgpu_pipe_vblank_period(vgpu, pipe);
+	if (hrtimer_active(&vblank_timer->timer) &&
+	    vblank_timer->period == period)
+		return;
 
-out:
-	hrtimer_start(&irq->vblank_timer.timer,
-		ktime_add_ns(ktime_get(), irq->vblank_timer.period),
+	hrtimer_cancel(&vblank_timer->timer);
+	vblank_timer->period = period;
+	hrtimer_start(&vblank_timer->timer,
+		ktime_add_ns(ktime_get(), period),
 		HRTIMER_MODE_ABS);
-
 }
 
 static void emulate_vblank_on_pipe(struct intel_vgpu *vgpu, int pipe)
@@ -379,30 +492,348 @@ static void emulate_vblank_on_pipe(struct intel_vgpu *vgpu, int pipe)
 	}
 }
 
+static void cursor_page_begin(struct vfio_igd_cursor *page)
+{
+	WRITE_ONCE(page->seq, page->seq + 1);
+	smp_wmb();
+}
+
+static void cursor_page_end(struct vfio_igd_cursor *page)
+{
+	smp_wmb();
+	WRITE_ONCE(page->seq, page->seq + 1);
+}
+
+static u32 cursor_shape_lookup(struct intel_vgpu_cursor *cursor)
+{
+	struct intel_vgpu_cursor_shape *shape;
+	int i;
+
+	for (i = 0; i < INTEL_VGPU_CURSOR_SHAPES; i++) {
+		shape = &cursor->shapes[i];
+		if (shape->dmabuf_id && shape->base == cursor->base &&
+		    shape->width == cursor->width &&
+		    shape->drm_format == cursor->drm_format)
+			return shape->dmabuf_id;
+	}
+	return 0;
+}
+
+/* Decode the cursor and publish it on the cursor page. */
+static void commit_cursor(struct intel_vgpu *vgpu)
+{
+	struct intel_vgpu_frame *frame = &vgpu->display.frame;
+	struct intel_vgpu_cursor_plane_format *c = &frame->cursor;
+	struct intel_vgpu_cursor *cursor = &vgpu->display.cursor;
+	struct vfio_igd_cursor *page = cursor->page;
+	bool visible;
+
+	frame->cursor_ret = intel_vgpu_decode_cursor_plane(vgpu, c);
+	if (!++frame->cursor_seqno)
+		frame->cursor_seqno = 1;
+	visible = !frame->cursor_ret;
+
+	spin_lock(&cursor->lock);
+	cursor_page_begin(page);
+	page->flags = visible ? VFIO_IGD_CURSOR_VISIBLE : 0;
+	if (visible) {
+		page->x_pos = c->x_sign ? -(s32)c->x_pos : c->x_pos;
+		page->y_pos = c->y_sign ? -(s32)c->y_pos : c->y_pos;
+		if (c->base != cursor->base || c->width != cursor->width ||
+		    c->drm_format != cursor->drm_format) {
+			cursor->base = c->base;
+			cursor->width = c->width;
+			cursor->drm_format = c->drm_format;
+			page->width = c->width;
+			page->height = c->height;
+			page->dmabuf_id = cursor_shape_lookup(cursor);
+			page->shape_seq++;
+		}
+	}
+	page->plane_seq = frame->seqno;
+	cursor_page_end(page);
+	spin_unlock(&cursor->lock);
+}
+
+/**
+ * intel_vgpu_queue_flip - queue a plane update for the next vblank
+ * @vgpu: a vGPU
+ * @pipe: pipe of the plane
+ * @plane: the plane that was updated
+ * @event: flip done event to deliver at vblank, or -1 for none
+ *
+ * The update is committed together with the other planes of the frame by
+ * the next vblank, which decodes the planes once and notifies the display
+ * consumer once, however many plane registers the guest wrote.
+ *
+ */
+void intel_vgpu_queue_flip(struct intel_vgpu *vgpu, int pipe,
+			   enum intel_vgpu_flip_plane plane, int event)
+{
+	struct intel_vgpu_display *display = &vgpu->display;
+	bool consumer, idle;
+
+	if (pipe < PIPE_A || pipe > PIPE_C)
+		return;
+
+	consumer = READ_ONCE(display->vblank_timer.mode) ==
+		   INTEL_VGPU_VBLANK_CONSUMER;
+
+	/*
+	 * In consumer mode the vblank waits for the consumer to take a frame,
+	 * the cursor doesn't, it moves while the frame stays.
+	 */
+	if (consumer && plane == INTEL_VGPU_FLIP_CURSOR) {
+		commit_cursor(vgpu);
+		intel_gvt_hypervisor_notify_plane_flip(vgpu);
+		return;
+	}
+
+	idle = !READ_ONCE(display->flip_pending[pipe]);
+	if (event >= 0)
+		set_bit(event, vgpu->irq.flip_done_event[pipe]);
+	set_bit(plane, &display->flip_pending[pipe]);
+
+	/*
+	 * Also tell the consumer about the first update of the frame then, so
+	 * that it comes and takes it.
+	 */
+	if (idle && consumer)
+		intel_gvt_hypervisor_notify_plane_flip(vgpu);
+}
+
+/*
+ * A frame that only moved the cursor is published on the cursor page
+ * alone, remote display clients follow it without querying the planes.
+ */
+static void commit_frame(struct intel_vgpu *vgpu, unsigned long planes)
+{
+	struct intel_vgpu_frame *frame = &vgpu->display.frame;
+
+	if (planes & ~BIT(INTEL_VGPU_FLIP_CURSOR)) {
+		frame->primary_ret = intel_vgpu_decode_primary_plane(vgpu,
+							&frame->primary);
+		if (!++frame->seqno)
+			frame->seqno = 1;
+	}
+
+	if (planes & BIT(INTEL_VGPU_FLIP_PRIMARY))
+		intel_vgpu_fb_damage_full(vgpu);
+
+	commit_cursor(vgpu);
+
+	if (READ_ONCE(vgpu->display.vblank_timer.mode) !=
+	    INTEL_VGPU_VBLANK_CONSUMER)
+		intel_gvt_hypervisor_notify_plane_flip(vgpu);
+}
+
 static void emulate_vblank(struct intel_vgpu *vgpu)
 {
+	unsigned long planes = 0;
 	int pipe;
 
+	mutex_lock(&vgpu->vgpu_lock);
+	for_each_pipe(vgpu->gvt->dev_priv, pipe)
+		planes |= xchg(&vgpu->display.flip_pending[pipe], 0);
+
+	/* commit the frame before its flip done events reach the guest */
+	if (planes)
+		commit_frame(vgpu, planes);
+
 	for_each_pipe(vgpu->gvt->dev_priv, pipe)
 		emulate_vblank_on_pipe(vgpu, pipe);
+	mutex_unlock(&vgpu->vgpu_lock);
 }
 
 /**
- * intel_gvt_emulate_vblank - trigger vblank events for vGPUs on GVT device
- * @gvt: a GVT device
+ * intel_vgpu_frame_primary_plane - get the primary plane of the last frame
+ * @vgpu: a vGPU
+ * @plane: primary plane to fill
  *
- * This function is used to trigger vblank interrupts for vGPUs on GVT device
+ * The plane is the one decoded when the last frame was committed at vblank,
+ * or decoded now if no frame has been committed yet.
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
  *
  */
-void intel_gvt_emulate_vblank(struct intel_gvt *gvt)
+int intel_vgpu_frame_primary_plane(struct intel_vgpu *vgpu,
+	struct intel_vgpu_primary_plane_format *plane)
 {
-	struct intel_vgpu *vgpu;
-	int id;
+	struct intel_vgpu_frame *frame = &vgpu->display.frame;
+	bool committed;
+	int ret;
+
+	mutex_lock(&vgpu->vgpu_lock);
+	committed = frame->seqno;
+	if (committed) {
+		*plane = frame->primary;
+		ret = frame->primary_ret;
+	}
+	mutex_unlock(&vgpu->vgpu_lock);
+
+	if (!committed)
+		ret = intel_vgpu_decode_primary_plane(vgpu, plane);
+	return ret;
+}
 
-	if (WARN_ON(!mutex_is_locked(&gvt->lock)))
+/**
+ * intel_vgpu_frame_cursor_plane - get the cursor plane of the last frame
+ * @vgpu: a vGPU
+ * @plane: cursor plane to fill
+ *
+ * Like intel_vgpu_frame_primary_plane(), for the cursor plane.
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ *
+ */
+int intel_vgpu_frame_cursor_plane(struct intel_vgpu *vgpu,
+	struct intel_vgpu_cursor_plane_format *plane)
+{
+	struct intel_vgpu_frame *frame = &vgpu->display.frame;
+	bool committed;
+	int ret;
+
+	mutex_lock(&vgpu->vgpu_lock);
+	committed = frame->cursor_seqno;
+	if (committed) {
+		*plane = frame->cursor;
+		ret = frame->cursor_ret;
+	}
+	mutex_unlock(&vgpu->vgpu_lock);
+
+	if (!committed)
+		ret = intel_vgpu_decode_cursor_plane(vgpu, plane);
+	return ret;
+}
+
+/**
+ * intel_vgpu_set_vblank_mode - select how vblank events of a vGPU are paced
+ * @vgpu: a vGPU
+ * @mode: one of enum intel_vgpu_vblank_mode
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ *
+ */
+int intel_vgpu_set_vblank_mode(struct intel_vgpu *vgpu, int mode)
+{
+	if (mode != INTEL_VGPU_VBLANK_TIMER &&
+	    mode != INTEL_VGPU_VBLANK_CONSUMER)
+		return -EINVAL;
+
+	mutex_lock(&vgpu->vgpu_lock);
+	vgpu->display.vblank_timer.mode = mode;
+	intel_vgpu_update_vblank_emulation(vgpu);
+	mutex_unlock(&vgpu->vgpu_lock);
+
+	return 0;
+}
+
+/**
+ * intel_vgpu_frame_consumed - the display consumer is done with a frame
+ * @vgpu: a vGPU
+ *
+ * This function is called when the consumer asks for the next frame of the
+ * primary plane. In consumer mode, it delivers the vblank and the pending
+ * flip done events which let the guest go on rendering.
+ *
+ */
+void intel_vgpu_frame_consumed(struct intel_vgpu *vgpu)
+{
+	if (READ_ONCE(vgpu->display.vblank_timer.mode) !=
+	    INTEL_VGPU_VBLANK_CONSUMER || !vgpu->active)
 		return;
 
-	for_each_active_vgpu(gvt, vgpu, id)
+	emulate_vblank(vgpu);
+}
+
+/**
+ * intel_vgpu_cursor_exported - a cursor shape was exported as a dmabuf
+ * @vgpu: a vGPU
+ * @base: cursor base in graphics memory
+ * @width: cursor width
+ * @drm_format: cursor format
+ * @dmabuf_id: id of the dmabuf
+ *
+ * The dmabuf id is kept for the shape, and put on the cursor page whenever
+ * the guest shows the shape again, so that clients don't need to query the
+ * cursor plane for shapes they already have.
+ *
+ */
+void intel_vgpu_cursor_exported(struct intel_vgpu *vgpu, u32 base, u32 width,
+				u32 drm_format, u32 dmabuf_id)
+{
+	struct intel_vgpu_cursor *cursor = &vgpu->display.cursor;
+	struct intel_vgpu_cursor_shape *shape;
+	int i;
+
+	spin_lock(&cursor->lock);
+	for (i = 0; i < INTEL_VGPU_CURSOR_SHAPES; i++) {
+		shape = &cursor->shapes[i];
+		if (shape->base == base && shape->width == width &&
+		    shape->drm_format == drm_format)
+			break;
+	}
+	if (i == INTEL_VGPU_CURSOR_SHAPES) {
+		shape = &cursor->shapes[cursor->next_shape];
+		cursor->next_shape = (cursor->next_shape + 1) %
+				     INTEL_VGPU_CURSOR_SHAPES;
+		shape->base = base;
+		shape->width = width;
+		shape->drm_format = drm_format;
+	}
+	shape->dmabuf_id = dmabuf_id;
+
+	if (cursor->base == base && cursor->width == width &&
+	    cursor->drm_format == drm_format &&
+	    cursor->page->dmabuf_id != dmabuf_id) {
+		cursor_page_begin(cursor->page);
+		cursor->page->dmabuf_id = dmabuf_id;
+		cursor_page_end(cursor->page);
+	}
+	spin_unlock(&cursor->lock);
+}
+
+/**
+ * intel_vgpu_cursor_released - a dmabuf of a vGPU is released
+ * @vgpu: a vGPU
+ * @dmabuf_id: id of the dmabuf
+ *
+ * Forget the dmabuf if it was a cursor shape, its id may be reused.
+ *
+ */
+void intel_vgpu_cursor_released(struct intel_vgpu *vgpu, u32 dmabuf_id)
+{
+	struct intel_vgpu_cursor *cursor = &vgpu->display.cursor;
+	int i;
+
+	spin_lock(&cursor->lock);
+	for (i = 0; i < INTEL_VGPU_CURSOR_SHAPES; i++) {
+		if (cursor->shapes[i].dmabuf_id == dmabuf_id)
+			cursor->shapes[i].dmabuf_id = 0;
+	}
+
+	if (cursor->page->dmabuf_id == dmabuf_id) {
+		cursor_page_begin(cursor->page);
+		cursor->page->dmabuf_id = 0;
+		cursor_page_end(cursor->page);
+	}
+	spin_unlock(&cursor->lock);
+}
+
+/*
+ * The vblank of each vGPU is delivered by its own work item on the high
+ * priority workqueue, so that vGPUs don't wait on each other and the
+ * scheduling decisions of the service thread don't wait on them.
+ */
+static void vblank_work_fn(struct work_struct *work)
+{
+	struct intel_vgpu *vgpu = container_of(work, struct intel_vgpu,
+					       display.vblank_timer.work);
+
+	if (READ_ONCE(vgpu->active))
 		emulate_vblank(vgpu);
 }
 
@@ -417,10 +848,15 @@ void intel_vgpu_clean_display(struct intel_vgpu *vgpu)
 {
 	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
 
+	hrtimer_cancel(&vgpu->display.vblank_timer.timer);
+
 	if (IS_SKYLAKE(dev_priv) || IS_KABYLAKE(dev_priv))
 		clean_virtual_dp_monitor(vgpu, PORT_D);
 	else
 		clean_virtual_dp_monitor(vgpu, PORT_B);
+
+	free_page((unsigned long)vgpu->display.cursor.page);
+	vgpu->display.cursor.page = NULL;
 }
 
 /**
@@ -436,15 +872,35 @@ void intel_vgpu_clean_display(struct intel_vgpu *vgpu)
 int intel_vgpu_init_display(struct intel_vgpu *vgpu, u64 resolution)
 {
 	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
+	struct intel_vgpu_vblank_timer *vblank_timer =
+		&vgpu->display.vblank_timer;
+	struct intel_vgpu_cursor *cursor = &vgpu->display.cursor;
+	int ret;
+
+	cursor->page = (void *)get_zeroed_page(GFP_KERNEL);
+	if (!cursor->page)
+		return -ENOMEM;
+	spin_lock_init(&cursor->lock);
 
 	intel_vgpu_init_i2c_edid(vgpu);
 
+	hrtimer_init(&vblank_timer->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	vblank_timer->timer.function = vblank_timer_fn;
+	INIT_WORK(&vblank_timer->work, vblank_work_fn);
+	vblank_timer->period = VBLANK_TIMER_PERIOD;
+	vblank_timer->mode = INTEL_VGPU_VBLANK_TIMER;
+
 	if (IS_SKYLAKE(dev_priv) || IS_KABYLAKE(dev_priv))
-		return setup_virtual_dp_monitor(vgpu, PORT_D, GVT_DP_D,
-						resolution);
+		ret = setup_virtual_dp_monitor(vgpu, PORT_D, GVT_DP_D,
+					       resolution);
 	else
-		return setup_virtual_dp_monitor(vgpu, PORT_B, GVT_DP_B,
-						resolution);
+		ret = setup_virtual_dp_monitor(vgpu, PORT_B, GVT_DP_B,
+					       resolution);
+	if (ret) {
+		free_page((unsigned long)cursor->page);
+		cursor->page = NULL;
+	}
+	return ret;
 }
 
 /**
@@ -456,5 +912,11 @@ int intel_vgpu_init_display(struct intel_vgpu *vgpu, u64 resolution)
  */
 void intel_vgpu_reset_display(struct intel_vgpu *vgpu)
 {
+	struct intel_vgpu_display *display = &vgpu->display;
+
+	memset(display->flip_pending, 0, sizeof(display->flip_pending));
+	memset(&display->frame, 0, sizeof(display->frame));
+
 	emulate_monitor_status_change(vgpu);
+	intel_vgpu_update_vblank_emulation(vgpu);
 }
@@ -172,8 +172,71 @@ static inline char *vgpu_edid_str(enum intel_vgpu_edid id)
 	}
 }
 
-void intel_gvt_emulate_vblank(struct intel_gvt *gvt);
-void intel_gvt_check_vblank_emulation(struct intel_gvt *gvt);
+/*
+ * In consumer mode no vblank timer runs. A vblank is delivered whenever the
+ * display consumer queries the primary plane for the next frame, so a guest
+ * renders no faster than its frames are actually picked up.
+ */
+enum intel_vgpu_vblank_mode {
+	INTEL_VGPU_VBLANK_TIMER = 0,
+	INTEL_VGPU_VBLANK_CONSUMER,
+};
+
+struct intel_vgpu_vblank_timer {
+	struct hrtimer timer;
+	struct work_struct work;	/* delivers the vblank of the timer */
+	u64 period;
+	int mode;
+};
+
+/*
+ * Plane updates of a pipe are queued as they are written by the guest and
+ * committed together at the next virtual vblank, like the double buffered
+ * plane registers of the hardware.
+ */
+enum intel_vgpu_flip_plane {
+	INTEL_VGPU_FLIP_PRIMARY = 0,
+	INTEL_VGPU_FLIP_SPRITE,
+	INTEL_VGPU_FLIP_CURSOR,
+};
+
+void intel_vgpu_queue_flip(struct intel_vgpu *vgpu, int pipe,
+			   enum intel_vgpu_flip_plane plane, int event);
+
+#define INTEL_VGPU_CURSOR_SHAPES	8
+
+/* a cursor shape the display consumer exported as a dmabuf */
+struct intel_vgpu_cursor_shape {
+	u32 base;
+	u32 width;
+	u32 drm_format;
+	u32 dmabuf_id;
+};
+
+struct vfio_igd_cursor;
+
+/*
+ * The cursor as shown to remote display clients through a shared page, so
+ * that following it takes no plane query or framebuffer work.
+ */
+struct intel_vgpu_cursor {
+	spinlock_t lock;	/* protects the page and the shapes */
+	struct vfio_igd_cursor *page;
+	struct intel_vgpu_cursor_shape shapes[INTEL_VGPU_CURSOR_SHAPES];
+	unsigned int next_shape;
+	/* shape on the page */
+	u32 base;
+	u32 width;
+	u32 drm_format;
+};
+
+void intel_vgpu_cursor_exported(struct intel_vgpu *vgpu, u32 base, u32 width,
+				u32 drm_format, u32 dmabuf_id);
+void intel_vgpu_cursor_released(struct intel_vgpu *vgpu, u32 dmabuf_id);
+
+void intel_vgpu_update_vblank_emulation(struct intel_vgpu *vgpu);
+int intel_vgpu_set_vblank_mode(struct intel_vgpu *vgpu, int mode);
+void intel_vgpu_frame_consumed(struct intel_vgpu *vgpu);
 
 int intel_vgpu_init_display(struct intel_vgpu *vgpu, u64 resolution);
 void intel_vgpu_reset_display(struct intel_vgpu *vgpu);
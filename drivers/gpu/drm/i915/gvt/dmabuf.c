@@ -29,6 +29,7 @@
  */
 
 #include <linux/dma-buf.h>
+#include <linux/dma-fence-array.h>
 #include <drm/drmP.h>
 #include <linux/vfio.h>
 
@@ -37,49 +38,131 @@
 
 #define GEN8_DECODE_PTE(pte) (pte & GENMASK_ULL(63, 12))
 
-static int vgpu_gem_get_pages(
-		struct drm_i915_gem_object *obj)
+static void dmabuf_pages_free(struct kref *kref)
 {
-	struct drm_i915_private *dev_priv = to_i915(obj->base.dev);
-	struct sg_table *st;
-	struct scatterlist *sg;
-	int i, ret;
-	gen8_pte_t __iomem *gtt_entries;
-	struct intel_vgpu_fb_info *fb_info;
+	struct intel_vgpu_dmabuf_pages *pages =
+		container_of(kref, struct intel_vgpu_dmabuf_pages, kref);
 
-	fb_info = (struct intel_vgpu_fb_info *)obj->gvt_info;
-	if (WARN_ON(!fb_info))
-		return -ENODEV;
+	sg_free_table(&pages->st);
+	kfree(pages);
+}
 
-	st = kmalloc(sizeof(*st), GFP_KERNEL);
-	if (unlikely(!st))
-		return -ENOMEM;
+static struct intel_vgpu_dmabuf_pages *
+dmabuf_pages_create(struct drm_i915_private *dev_priv,
+		    struct intel_vgpu_fb_info *fb_info, unsigned int ggtt_gen)
+{
+	struct intel_vgpu_dmabuf_pages *pages;
+	struct scatterlist *sg = NULL;
+	gen8_pte_t __iomem *gtt_entries;
+	dma_addr_t addr;
+	unsigned int nents = 0;
+	int i, ret;
+
+	pages = kmalloc(sizeof(*pages), GFP_KERNEL);
+	if (unlikely(!pages))
+		return ERR_PTR(-ENOMEM);
 
-	ret = sg_alloc_table(st, fb_info->size, GFP_KERNEL);
+	ret = sg_alloc_table(&pages->st, fb_info->size, GFP_KERNEL);
 	if (ret) {
-		kfree(st);
-		return ret;
+		kfree(pages);
+		return ERR_PTR(ret);
 	}
 	gtt_entries = (gen8_pte_t __iomem *)dev_priv->ggtt.gsm +
 		(fb_info->start >> PAGE_SHIFT);
-	for_each_sg(st->sgl, sg, fb_info->size, i) {
+
+	/*
+	 * Framebuffers backed by huge guest pages are DMA contiguous, merge
+	 * the runs so that the object gets large sg entries and i915 can use
+	 * huge GTT pages when binding it into a PPGTT.
+	 */
+	for (i = 0; i < fb_info->size; i++) {
+		addr = GEN8_DECODE_PTE(readq(&gtt_entries[i]));
+		if (sg && sg_dma_address(sg) + sg->length == addr) {
+			sg->length += PAGE_SIZE;
+			sg_dma_len(sg) += PAGE_SIZE;
+			continue;
+		}
+
+		sg = sg ? sg_next(sg) : pages->st.sgl;
 		sg->offset = 0;
 		sg->length = PAGE_SIZE;
-		sg_dma_address(sg) =
-			GEN8_DECODE_PTE(readq(&gtt_entries[i]));
+		sg_dma_address(sg) = addr;
 		sg_dma_len(sg) = PAGE_SIZE;
+		nents++;
+	}
+	if (sg)
+		sg_mark_end(sg);
+	pages->st.nents = nents;
+
+	kref_init(&pages->kref);
+	pages->ggtt_gen = ggtt_gen;
+	return pages;
+}
+
+static int vgpu_gem_get_pages(
+		struct drm_i915_gem_object *obj)
+{
+	struct drm_i915_private *dev_priv = to_i915(obj->base.dev);
+	struct intel_vgpu_fb_info *fb_info;
+	struct intel_vgpu_dmabuf_obj *dmabuf_obj;
+	struct intel_vgpu_dmabuf_pages *pages;
+	struct intel_vgpu *vgpu;
+	unsigned int ggtt_gen;
+
+	fb_info = (struct intel_vgpu_fb_info *)obj->gvt_info;
+	if (WARN_ON(!fb_info))
+		return -ENODEV;
+
+	dmabuf_obj = fb_info->obj;
+	vgpu = dmabuf_obj->vgpu;
+	if (!vgpu) {
+		/* orphan dmabuf_obj, don't bother caching */
+		pages = dmabuf_pages_create(dev_priv, fb_info, 0);
+		if (IS_ERR(pages))
+			return PTR_ERR(pages);
+		goto out;
 	}
 
-	__i915_gem_object_set_pages(obj, st, PAGE_SIZE);
+	mutex_lock(&vgpu->dmabuf_lock);
+	/* sample the generation before reading the entries it covers */
+	ggtt_gen = READ_ONCE(vgpu->gtt.ggtt_gen);
+	pages = dmabuf_obj->pages;
+	if (!pages || pages->ggtt_gen != ggtt_gen) {
+		pages = dmabuf_pages_create(dev_priv, fb_info, ggtt_gen);
+		if (IS_ERR(pages)) {
+			mutex_unlock(&vgpu->dmabuf_lock);
+			return PTR_ERR(pages);
+		}
+		/* GEM objects still using the stale list keep their ref */
+		if (dmabuf_obj->pages)
+			kref_put(&dmabuf_obj->pages->kref, dmabuf_pages_free);
+		dmabuf_obj->pages = pages;
+	}
+	kref_get(&pages->kref);
+	mutex_unlock(&vgpu->dmabuf_lock);
+
+out:
+	__i915_gem_object_set_pages(obj, &pages->st,
+				    i915_sg_page_sizes(pages->st.sgl));
 
 	return 0;
 }
 
 static void vgpu_gem_put_pages(struct drm_i915_gem_object *obj,
-		struct sg_table *pages)
+		struct sg_table *st)
 {
-	sg_free_table(pages);
-	kfree(pages);
+	struct intel_vgpu_dmabuf_pages *pages =
+		container_of(st, struct intel_vgpu_dmabuf_pages, st);
+
+	kref_put(&pages->kref, dmabuf_pages_free);
+}
+
+static void dmabuf_obj_free(struct intel_vgpu_dmabuf_obj *dmabuf_obj)
+{
+	if (dmabuf_obj->pages)
+		kref_put(&dmabuf_obj->pages->kref, dmabuf_pages_free);
+	kfree(dmabuf_obj->info);
+	kfree(dmabuf_obj);
 }
 
 static void dmabuf_gem_object_free(struct kref *kref)
@@ -96,18 +179,19 @@ static void dmabuf_gem_object_free(struct kref *kref)
 					struct intel_vgpu_dmabuf_obj, list);
 			if (dmabuf_obj == obj) {
 				intel_gvt_hypervisor_put_vfio_device(vgpu);
+				intel_vgpu_cursor_released(vgpu,
+							   dmabuf_obj->dmabuf_id);
 				idr_remove(&vgpu->object_idr,
 					   dmabuf_obj->dmabuf_id);
-				kfree(dmabuf_obj->info);
-				kfree(dmabuf_obj);
 				list_del(pos);
+				hash_del(&dmabuf_obj->hnode);
+				dmabuf_obj_free(dmabuf_obj);
 				break;
 			}
 		}
 	} else {
 		/* Free the orphan dmabuf_objs here */
-		kfree(obj->info);
-		kfree(obj);
+		dmabuf_obj_free(obj);
 	}
 }
 
@@ -132,6 +216,8 @@ static void vgpu_gem_release(struct drm_i915_gem_object *gem_obj)
 	if (vgpu) {
 		mutex_lock(&vgpu->dmabuf_lock);
 		gem_obj->base.dma_buf = NULL;
+		if (obj->gem == gem_obj)
+			obj->gem = NULL;
 		dmabuf_obj_put(obj);
 		mutex_unlock(&vgpu->dmabuf_lock);
 	} else {
@@ -142,12 +228,68 @@ static void vgpu_gem_release(struct drm_i915_gem_object *gem_obj)
 }
 
 static const struct drm_i915_gem_object_ops intel_vgpu_gem_ops = {
-	.flags = I915_GEM_OBJECT_IS_PROXY,
+	/* plane buffers are re-imported by the display whenever they flip */
+	.flags = I915_GEM_OBJECT_IS_PROXY | I915_GEM_OBJECT_CACHE_DMABUF_MAPS,
 	.get_pages = vgpu_gem_get_pages,
 	.put_pages = vgpu_gem_put_pages,
 	.release = vgpu_gem_release,
 };
 
+/*
+ * Make the exported buffer wait for the guest rendering submitted so far.
+ * GVT can't tell which workload writes the surface, so the fence covers the
+ * last workload of every ring that is still running. The caller should hold
+ * dmabuf_lock.
+ */
+static void dmabuf_obj_attach_fence(struct intel_vgpu *vgpu,
+				    struct drm_i915_gem_object *obj)
+{
+	struct intel_vgpu_submission *s = &vgpu->submission;
+	struct dma_fence *fences[I915_NUM_ENGINES];
+	struct dma_fence_array *array;
+	struct dma_fence **shared;
+	struct dma_fence *fence;
+	int i, count = 0;
+
+	rcu_read_lock();
+	for (i = 0; i < ARRAY_SIZE(s->last_fence); i++) {
+		fence = dma_fence_get_rcu_safe(&s->last_fence[i]);
+		if (!fence)
+			continue;
+		if (dma_fence_is_signaled(fence)) {
+			dma_fence_put(fence);
+			continue;
+		}
+		fences[count++] = fence;
+	}
+	rcu_read_unlock();
+
+	if (!count)
+		return;
+
+	if (count == 1) {
+		fence = fences[0];
+	} else {
+		shared = kmemdup(fences, count * sizeof(*fences), GFP_KERNEL);
+		array = shared ? dma_fence_array_create(count, shared,
+				s->fence_context, ++s->fence_seqno, false) :
+			NULL;
+		if (!array) {
+			kfree(shared);
+			while (count--)
+				dma_fence_put(fences[count]);
+			return;
+		}
+		/* the array owns the fences now */
+		fence = &array->base;
+	}
+
+	reservation_object_lock(obj->resv, NULL);
+	reservation_object_add_excl_fence(obj->resv, fence);
+	reservation_object_unlock(obj->resv);
+	dma_fence_put(fence);
+}
+
 static struct drm_i915_gem_object *vgpu_create_gem(struct drm_device *dev,
 		struct intel_vgpu_fb_info *info)
 {
@@ -203,7 +345,7 @@ static int vgpu_get_plane_info(struct drm_device *dev,
 	int ret;
 
 	if (plane_id == DRM_PLANE_TYPE_PRIMARY) {
-		ret = intel_vgpu_decode_primary_plane(vgpu, &p);
+		ret = intel_vgpu_frame_primary_plane(vgpu, &p);
 		if (ret)
 			return ret;
 		info->start = p.base;
@@ -216,7 +358,7 @@ static int vgpu_get_plane_info(struct drm_device *dev,
 		info->size = (((p.stride * p.height * p.bpp) / 8) +
 				(PAGE_SIZE - 1)) >> PAGE_SHIFT;
 	} else if (plane_id == DRM_PLANE_TYPE_CURSOR) {
-		ret = intel_vgpu_decode_cursor_plane(vgpu, &c);
+		ret = intel_vgpu_frame_cursor_plane(vgpu, &c);
 		if (ret)
 			return ret;
 		info->start = c.base;
@@ -269,54 +411,33 @@ static struct intel_vgpu_dmabuf_obj *
 pick_dmabuf_by_info(struct intel_vgpu *vgpu,
 		    struct intel_vgpu_fb_info *latest_info)
 {
-	struct list_head *pos;
 	struct intel_vgpu_fb_info *fb_info;
-	struct intel_vgpu_dmabuf_obj *dmabuf_obj = NULL;
-	struct intel_vgpu_dmabuf_obj *ret = NULL;
+	struct intel_vgpu_dmabuf_obj *dmabuf_obj;
 
-	list_for_each(pos, &vgpu->dmabuf_obj_list_head) {
-		dmabuf_obj = container_of(pos, struct intel_vgpu_dmabuf_obj,
-						list);
-		if ((dmabuf_obj == NULL) ||
-		    (dmabuf_obj->info == NULL))
+	hash_for_each_possible(vgpu->dmabuf_obj_table, dmabuf_obj, hnode,
+			       latest_info->start) {
+		fb_info = (struct intel_vgpu_fb_info *)dmabuf_obj->info;
+		if (!fb_info)
 			continue;
 
-		fb_info = (struct intel_vgpu_fb_info *)dmabuf_obj->info;
 		if ((fb_info->start == latest_info->start) &&
 		    (fb_info->start_gpa == latest_info->start_gpa) &&
 		    (fb_info->size == latest_info->size) &&
 		    (fb_info->drm_format_mod == latest_info->drm_format_mod) &&
 		    (fb_info->drm_format == latest_info->drm_format) &&
 		    (fb_info->width == latest_info->width) &&
-		    (fb_info->height == latest_info->height)) {
-			ret = dmabuf_obj;
-			break;
-		}
+		    (fb_info->height == latest_info->height) &&
+		    (fb_info->stride == latest_info->stride))
+			return dmabuf_obj;
 	}
 
-	return ret;
+	return NULL;
 }
 
 static struct intel_vgpu_dmabuf_obj *
 pick_dmabuf_by_num(struct intel_vgpu *vgpu, u32 id)
 {
-	struct list_head *pos;
-	struct intel_vgpu_dmabuf_obj *dmabuf_obj = NULL;
-	struct intel_vgpu_dmabuf_obj *ret = NULL;
-
-	list_for_each(pos, &vgpu->dmabuf_obj_list_head) {
-		dmabuf_obj = container_of(pos, struct intel_vgpu_dmabuf_obj,
-						list);
-		if (!dmabuf_obj)
-			continue;
-
-		if (dmabuf_obj->dmabuf_id == id) {
-			ret = dmabuf_obj;
-			break;
-		}
-	}
-
-	return ret;
+	return idr_find(&vgpu->object_idr, id);
 }
 
 static void update_fb_info(struct vfio_device_gfx_plane_info *gvt_dmabuf,
@@ -333,6 +454,187 @@ static void update_fb_info(struct vfio_device_gfx_plane_info *gvt_dmabuf,
 	gvt_dmabuf->y_hot = fb_info->y_hot;
 }
 
+/**
+ * intel_vgpu_fb_damage_full - damage the whole primary plane
+ * @vgpu: a vGPU
+ *
+ * Called for every change of the displayed surface the damage tracking can
+ * not bound, e.g. a flip or a workload which may render into the surface.
+ */
+void intel_vgpu_fb_damage_full(struct intel_vgpu *vgpu)
+{
+	WRITE_ONCE(vgpu->fb_damage.full, true);
+}
+
+/**
+ * intel_vgpu_fb_damage_ggtt - a GGTT entry of the vGPU has been updated
+ * @vgpu: a vGPU
+ * @gma: graphics memory address mapped by the entry
+ *
+ * The caller should hold vgpu_lock.
+ */
+void intel_vgpu_fb_damage_ggtt(struct intel_vgpu *vgpu, u64 gma)
+{
+	struct intel_vgpu_fb_damage *damage = &vgpu->fb_damage;
+
+	if (!damage->nr_pages || gma < damage->start ||
+	    gma >= damage->start + ((u64)damage->nr_pages << PAGE_SHIFT))
+		return;
+
+	/* the pages backing the surface are no longer the tracked ones */
+	damage->stale = true;
+	damage->full = true;
+}
+
+static int fb_damage_page_write(struct intel_vgpu_page_track *page_track,
+		u64 gpa, void *data, int bytes)
+{
+	struct intel_vgpu_fb_damage_page *page = page_track->priv_data;
+	struct intel_vgpu_fb_damage *damage = &page->vgpu->fb_damage;
+	u32 line_bytes = damage->stride * damage->tile_height;
+	u64 offset = ((u64)page->index << PAGE_SHIFT) +
+		(gpa & (PAGE_SIZE - 1));
+	u32 y1, y2;
+
+	y1 = div_u64(offset, line_bytes) * damage->tile_height;
+	y2 = (div_u64(offset + bytes - 1, line_bytes) + 1) *
+		damage->tile_height;
+
+	if (damage->y2 <= damage->y1) {
+		damage->y1 = y1;
+		damage->y2 = y2;
+	} else {
+		damage->y1 = min(damage->y1, y1);
+		damage->y2 = max(damage->y2, y2);
+	}
+
+	/*
+	 * The write itself has already been done by the hypervisor. Drop the
+	 * protection so that the rest of the frame is written at full speed,
+	 * the page is protected again on the next query.
+	 */
+	intel_vgpu_disable_page_track(page->vgpu, page->gfn);
+	return 0;
+}
+
+static void fb_damage_untrack(struct intel_vgpu *vgpu)
+{
+	struct intel_vgpu_fb_damage *damage = &vgpu->fb_damage;
+	unsigned int i;
+
+	for (i = 0; i < damage->nr_pages; i++)
+		intel_vgpu_unregister_page_track(vgpu, damage->pages[i].gfn);
+
+	kvfree(damage->pages);
+	damage->pages = NULL;
+	damage->nr_pages = 0;
+	damage->start = 0;
+	damage->stale = false;
+}
+
+static int fb_damage_track(struct intel_vgpu *vgpu,
+		struct intel_vgpu_fb_info *fb_info, u32 tile_height)
+{
+	struct intel_vgpu_fb_damage *damage = &vgpu->fb_damage;
+	struct intel_vgpu_fb_damage_page *pages;
+	unsigned int i, nr_pages;
+	unsigned long gpa;
+	int ret;
+
+	nr_pages = DIV_ROUND_UP((u64)fb_info->stride *
+			roundup(fb_info->height, tile_height), PAGE_SIZE);
+	pages = kvmalloc_array(nr_pages, sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+
+	damage->pages = pages;
+	damage->start = fb_info->start;
+	damage->stride = fb_info->stride;
+	damage->height = fb_info->height;
+	damage->tile_height = tile_height;
+
+	for (i = 0; i < nr_pages; i++) {
+		gpa = intel_vgpu_gma_to_gpa(vgpu->gtt.ggtt_mm,
+				fb_info->start + ((u64)i << PAGE_SHIFT));
+		if (gpa == INTEL_GVT_INVALID_ADDR) {
+			ret = -EFAULT;
+			goto err;
+		}
+
+		pages[i].vgpu = vgpu;
+		pages[i].gfn = gpa >> PAGE_SHIFT;
+		pages[i].index = i;
+
+		/* pages shared with page tables or mapped twice give up */
+		ret = intel_vgpu_register_page_track(vgpu, pages[i].gfn,
+				fb_damage_page_write, &pages[i]);
+		if (ret)
+			goto err;
+		damage->nr_pages = i + 1;
+	}
+
+	return 0;
+err:
+	fb_damage_untrack(vgpu);
+	return ret;
+}
+
+/* Report the damage of the primary plane since the last query and reset. */
+static void fb_damage_query(struct intel_vgpu *vgpu,
+		struct intel_vgpu_fb_info *fb_info,
+		struct vfio_device_gfx_plane_info *gfx_plane_info)
+{
+	struct intel_vgpu_fb_damage *damage = &vgpu->fb_damage;
+	u32 tile_height = fb_info->drm_format_mod ? 32 : 1;
+	u32 y1 = 0, y2 = fb_info->height;
+	unsigned int i;
+
+	mutex_lock(&vgpu->vgpu_lock);
+
+	if (damage->stale || damage->start != fb_info->start ||
+	    damage->stride != fb_info->stride ||
+	    damage->height != fb_info->height ||
+	    damage->tile_height != tile_height) {
+		fb_damage_untrack(vgpu);
+		damage->full = true;
+
+		/* CPU writes through the aperture can't be trapped */
+		if (!vgpu_gmadr_is_aperture(vgpu, fb_info->start))
+			fb_damage_track(vgpu, fb_info, tile_height);
+	}
+
+	if (!damage->nr_pages || damage->full) {
+		/* untracked surfaces or unbounded changes */
+	} else if (damage->y2 > damage->y1) {
+		y1 = min(damage->y1, fb_info->height);
+		y2 = min(damage->y2, fb_info->height);
+	} else {
+		y1 = y2 = 0;
+	}
+
+	gfx_plane_info->damage_x = 0;
+	gfx_plane_info->damage_y = y1;
+	gfx_plane_info->damage_width = y2 > y1 ? fb_info->width : 0;
+	gfx_plane_info->damage_height = y2 - y1;
+
+	damage->full = false;
+	damage->y1 = damage->y2 = 0;
+	for (i = 0; i < damage->nr_pages; i++)
+		intel_vgpu_enable_page_track(vgpu, damage->pages[i].gfn);
+
+	mutex_unlock(&vgpu->vgpu_lock);
+}
+
+static void cursor_shape_exported(struct intel_vgpu *vgpu,
+		struct vfio_device_gfx_plane_info *gfx_plane_info,
+		struct intel_vgpu_fb_info *fb_info)
+{
+	if (gfx_plane_info->drm_plane_type == DRM_PLANE_TYPE_CURSOR)
+		intel_vgpu_cursor_exported(vgpu, fb_info->start, fb_info->width,
+					   fb_info->drm_format,
+					   gfx_plane_info->dmabuf_id);
+}
+
 int intel_vgpu_query_plane(struct intel_vgpu *vgpu, void *args)
 {
 	struct drm_device *dev = &vgpu->gvt->dev_priv->drm;
@@ -348,11 +650,23 @@ int intel_vgpu_query_plane(struct intel_vgpu *vgpu, void *args)
 			(!gfx_plane_info->flags))
 		return -EINVAL;
 
+	if (gfx_plane_info->drm_plane_type == DRM_PLANE_TYPE_PRIMARY)
+		intel_vgpu_frame_consumed(vgpu);
+
 	ret = vgpu_get_plane_info(dev, vgpu, &fb_info,
 					gfx_plane_info->drm_plane_type);
 	if (ret != 0)
 		goto out;
 
+	if (gfx_plane_info->drm_plane_type == DRM_PLANE_TYPE_PRIMARY) {
+		fb_damage_query(vgpu, &fb_info, gfx_plane_info);
+	} else {
+		gfx_plane_info->damage_x = 0;
+		gfx_plane_info->damage_y = 0;
+		gfx_plane_info->damage_width = fb_info.width;
+		gfx_plane_info->damage_height = fb_info.height;
+	}
+
 	mutex_lock(&vgpu->dmabuf_lock);
 	/* If exists, pick up the exposed dmabuf_obj */
 	dmabuf_obj = pick_dmabuf_by_info(vgpu, &fb_info);
@@ -368,11 +682,14 @@ int intel_vgpu_query_plane(struct intel_vgpu *vgpu, void *args)
 			dmabuf_obj->initref = true;
 			dmabuf_obj_get(dmabuf_obj);
 		}
+		if (dmabuf_obj->gem)
+			dmabuf_obj_attach_fence(vgpu, dmabuf_obj->gem);
 		ret = 0;
 		gvt_dbg_dpy("vgpu%d: re-use dmabuf_obj ref %d, id %d\n",
 			    vgpu->id, kref_read(&dmabuf_obj->kref),
 			    gfx_plane_info->dmabuf_id);
 		mutex_unlock(&vgpu->dmabuf_lock);
+		cursor_shape_exported(vgpu, gfx_plane_info, &fb_info);
 		goto out;
 	}
 
@@ -398,6 +715,8 @@ int intel_vgpu_query_plane(struct intel_vgpu *vgpu, void *args)
 	((struct intel_vgpu_fb_info *)dmabuf_obj->info)->obj = dmabuf_obj;
 
 	dmabuf_obj->vgpu = vgpu;
+	dmabuf_obj->pages = NULL;
+	dmabuf_obj->gem = NULL;
 
 	ret = idr_alloc(&vgpu->object_idr, dmabuf_obj, 1, 0, GFP_NOWAIT);
 	if (ret < 0)
@@ -412,6 +731,8 @@ int intel_vgpu_query_plane(struct intel_vgpu *vgpu, void *args)
 	mutex_lock(&vgpu->dmabuf_lock);
 	if (intel_gvt_hypervisor_get_vfio_device(vgpu)) {
 		gvt_vgpu_err("get vfio device failed\n");
+		/* dmabuf_objs are looked up by id, don't leave a stale one */
+		idr_remove(&vgpu->object_idr, dmabuf_obj->dmabuf_id);
 		mutex_unlock(&vgpu->dmabuf_lock);
 		goto out_free_info;
 	}
@@ -422,11 +743,13 @@ int intel_vgpu_query_plane(struct intel_vgpu *vgpu, void *args)
 	INIT_LIST_HEAD(&dmabuf_obj->list);
 	mutex_lock(&vgpu->dmabuf_lock);
 	list_add_tail(&dmabuf_obj->list, &vgpu->dmabuf_obj_list_head);
+	hash_add(vgpu->dmabuf_obj_table, &dmabuf_obj->hnode, fb_info.start);
 	mutex_unlock(&vgpu->dmabuf_lock);
 
 	gvt_dbg_dpy("vgpu%d: %s new dmabuf_obj ref %d, id %d\n", vgpu->id,
 		    __func__, kref_read(&dmabuf_obj->kref), ret);
 
+	cursor_shape_exported(vgpu, gfx_plane_info, &fb_info);
 	return 0;
 
 out_free_info:
@@ -465,6 +788,7 @@ int intel_vgpu_get_dmabuf(struct intel_vgpu *vgpu, unsigned int dmabuf_id)
 	}
 
 	obj->gvt_info = dmabuf_obj->info;
+	dmabuf_obj_attach_fence(vgpu, obj);
 
 	dmabuf = i915_gem_prime_export(dev, &obj->base, DRM_CLOEXEC | DRM_RDWR);
 	if (IS_ERR(dmabuf)) {
@@ -483,6 +807,7 @@ int intel_vgpu_get_dmabuf(struct intel_vgpu *vgpu, unsigned int dmabuf_id)
 	dmabuf_fd = ret;
 
 	dmabuf_obj_get(dmabuf_obj);
+	dmabuf_obj->gem = obj;
 
 	if (dmabuf_obj->initref) {
 		dmabuf_obj->initref = false;
@@ -515,15 +840,19 @@ void intel_vgpu_dmabuf_cleanup(struct intel_vgpu *vgpu)
 	struct list_head *pos, *n;
 	struct intel_vgpu_dmabuf_obj *dmabuf_obj;
 
+	fb_damage_untrack(vgpu);
+
 	mutex_lock(&vgpu->dmabuf_lock);
 	list_for_each_safe(pos, n, &vgpu->dmabuf_obj_list_head) {
 		dmabuf_obj = container_of(pos, struct intel_vgpu_dmabuf_obj,
 						list);
 		dmabuf_obj->vgpu = NULL;
 
+		intel_vgpu_cursor_released(vgpu, dmabuf_obj->dmabuf_id);
 		idr_remove(&vgpu->object_idr, dmabuf_obj->dmabuf_id);
 		intel_gvt_hypervisor_put_vfio_device(vgpu);
 		list_del(pos);
+		hash_del(&dmabuf_obj->hnode);
 
 		/* dmabuf_obj might be freed in dmabuf_obj_put */
 		if (dmabuf_obj->initref) {
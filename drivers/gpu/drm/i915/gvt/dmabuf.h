@@ -48,6 +48,17 @@ struct intel_vgpu_fb_info {
 	struct intel_vgpu_dmabuf_obj *obj;
 };
 
+/*
+ * Page list of an exposed surface built from the host GGTT entries. It is
+ * shared by all the GEM objects created for the same dmabuf_obj until the
+ * GGTT of the vGPU is updated.
+ */
+struct intel_vgpu_dmabuf_pages {
+	struct sg_table st;
+	struct kref kref;
+	unsigned int ggtt_gen;
+};
+
 /**
  * struct intel_vgpu_dmabuf_obj- Intel vGPU device buffer object
  */
@@ -58,8 +69,40 @@ struct intel_vgpu_dmabuf_obj {
 	struct kref kref;
 	bool initref;
 	struct list_head list;
+	struct hlist_node hnode;	/* in vgpu->dmabuf_obj_table */
+	struct intel_vgpu_dmabuf_pages *pages;
+	/* last GEM object exported, cleared when it is released */
+	struct drm_i915_gem_object *gem;
 };
 
+struct intel_vgpu_fb_damage_page {
+	struct intel_vgpu *vgpu;
+	unsigned long gfn;
+	unsigned int index;
+};
+
+/*
+ * Damage of the primary plane since the last query. CPU writes to the pages
+ * backing the surface are caught with one-shot write protection and recorded
+ * as a band of lines. Anything GVT cannot bound (flips, GPU workloads, GGTT
+ * updates of the surface, surfaces reachable through the aperture) damages
+ * the whole plane.
+ */
+struct intel_vgpu_fb_damage {
+	u64 start;	/* tracked surface in graphics memory */
+	u32 stride;
+	u32 height;
+	u32 tile_height;
+	unsigned int nr_pages;
+	struct intel_vgpu_fb_damage_page *pages;
+	bool stale;	/* tracked surface layout must be rebuilt */
+	bool full;
+	u32 y1, y2;	/* damaged lines [y1, y2) */
+};
+
+void intel_vgpu_fb_damage_full(struct intel_vgpu *vgpu);
+void intel_vgpu_fb_damage_ggtt(struct intel_vgpu *vgpu, u64 gma);
+
 int intel_vgpu_query_plane(struct intel_vgpu *vgpu, void *args);
 int intel_vgpu_get_dmabuf(struct intel_vgpu *vgpu, unsigned int dmabuf_id);
 void intel_vgpu_dmabuf_cleanup(struct intel_vgpu *vgpu);
@@ -34,7 +34,9 @@
 
 #include "i915_drv.h"
 #include "gvt.h"
+#include "i915_pvinfo.h"
 
+#define _EL_OFFSET_SUBMITPORT   0x230
 #define _EL_OFFSET_STATUS       0x234
 #define _EL_OFFSET_STATUS_BUF   0x370
 #define _EL_OFFSET_STATUS_PTR   0x3A0
@@ -469,6 +471,9 @@ int intel_vgpu_submit_execlist(struct intel_vgpu *vgpu, int ring_id)
 	struct execlist_ctx_descriptor_format *desc[2];
 	int i, ret;
 
+	/* the workloads may use PPGTTs the guest only posted so far */
+	intel_vgpu_drain_pv_mailbox(vgpu);
+
 	desc[0] = get_desc_from_elsp_dwords(&execlist->elsp_dwords, 0);
 	desc[1] = get_desc_from_elsp_dwords(&execlist->elsp_dwords, 1);
 
@@ -505,6 +510,153 @@ int intel_vgpu_submit_execlist(struct intel_vgpu *vgpu, int ring_id)
 	return -EINVAL;
 }
 
+/**
+ * intel_vgpu_latch_elsp - latch an ELSP write without submitting it
+ * @vgpu: a vGPU
+ * @offset: register offset
+ * @data: the written dword
+ *
+ * This is used by the MMIO fast path when the MPT module asked for deferred
+ * ELSP submission. The dwords are latched as the ELSP handler does, and the
+ * submission of a complete ELSP write is left to the ELSP work.
+ *
+ * Returns:
+ * Zero if the write was latched, -EOPNOTSUPP if it has to go through the
+ * normal MMIO emulation path.
+ */
+int intel_vgpu_latch_elsp(struct intel_vgpu *vgpu, unsigned int offset,
+			  u32 data)
+{
+	struct intel_vgpu_submission *s = &vgpu->submission;
+	struct intel_vgpu_execlist *execlist;
+	int ring_id;
+
+	if (!vgpu->active || !s->active ||
+	    s->virtual_submission_interface != INTEL_VGPU_EXECLIST_SUBMISSION)
+		return -EOPNOTSUPP;
+
+	ring_id = intel_gvt_render_mmio_to_ring_id(vgpu->gvt, offset);
+	if (ring_id < 0 || offset != execlist_ring_mmio(vgpu->gvt, ring_id,
+							_EL_OFFSET_SUBMITPORT))
+		return -EOPNOTSUPP;
+
+	execlist = &s->execlist[ring_id];
+
+	execlist->elsp_dwords.data[3 - execlist->elsp_dwords.index] = data;
+	if (execlist->elsp_dwords.index == 3) {
+		set_bit(ring_id, s->elsp_pending);
+		schedule_work(&s->elsp_work);
+	}
+
+	++execlist->elsp_dwords.index;
+	execlist->elsp_dwords.index &= 0x3;
+	return 0;
+}
+
+/**
+ * intel_vgpu_flush_elsp - submit the ELSP writes latched by the fast path
+ * @vgpu: a vGPU
+ *
+ * This is called before emulating any other MMIO access, so the guest never
+ * observes an ELSP write which has been latched but not submitted.
+ */
+void intel_vgpu_flush_elsp(struct intel_vgpu *vgpu)
+{
+	struct intel_vgpu_submission *s = &vgpu->submission;
+	int ring_id;
+
+	for_each_set_bit(ring_id, s->elsp_pending, I915_NUM_ENGINES) {
+		clear_bit(ring_id, s->elsp_pending);
+		if (intel_vgpu_submit_execlist(vgpu, ring_id))
+			gvt_vgpu_err("fail submit workload on ring %d\n",
+				     ring_id);
+	}
+}
+
+/**
+ * intel_vgpu_register_pv_submission - set the submission page of a PV guest
+ * @vgpu: a vGPU
+ * @gpa: guest physical address of the page, 0 to drop it
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+int intel_vgpu_register_pv_submission(struct intel_vgpu *vgpu, u64 gpa)
+{
+	vgpu->submission.pv_submission_gpa = 0;
+
+	if (!gpa)
+		return 0;
+
+	if (!IS_ALIGNED(gpa, PAGE_SIZE) ||
+	    !intel_gvt_hypervisor_is_valid_gfn(vgpu, gpa >> PAGE_SHIFT)) {
+		gvt_vgpu_err("invalid PV submission page 0x%llx\n", gpa);
+		return -EINVAL;
+	}
+
+	vgpu->submission.pv_submission_gpa = gpa;
+	return 0;
+}
+
+/**
+ * intel_vgpu_pv_submit - handle the submission doorbell of a PV guest
+ * @vgpu: a vGPU
+ *
+ * Submit the execlist of every engine whose slot in the submission page
+ * was filled since the last doorbell, as if it had been written to the
+ * ELSP of the engine.
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+int intel_vgpu_pv_submit(struct intel_vgpu *vgpu)
+{
+	struct intel_vgpu_submission *s = &vgpu->submission;
+	u64 gpa = s->pv_submission_gpa;
+	struct vgt_pv_submission_slot slot;
+	struct intel_vgpu_execlist *execlist;
+	struct intel_engine_cs *engine;
+	enum intel_engine_id id;
+	u64 slot_gpa;
+	int ret;
+
+	if (!gpa || !s->active ||
+	    s->virtual_submission_interface != INTEL_VGPU_EXECLIST_SUBMISSION)
+		return -EINVAL;
+
+	for_each_engine(engine, vgpu->gvt->dev_priv, id) {
+		slot_gpa = gpa + offsetof(struct vgt_pv_submission, engine[id]);
+		ret = intel_gvt_hypervisor_read_gpa(vgpu, slot_gpa, &slot,
+						    sizeof(slot));
+		if (ret)
+			return ret;
+
+		if (slot.submitted == slot.consumed)
+			continue;
+
+		execlist = &s->execlist[id];
+		execlist->elsp_dwords.data[0] = lower_32_bits(slot.desc[0]);
+		execlist->elsp_dwords.data[1] = upper_32_bits(slot.desc[0]);
+		execlist->elsp_dwords.data[2] = lower_32_bits(slot.desc[1]);
+		execlist->elsp_dwords.data[3] = upper_32_bits(slot.desc[1]);
+		execlist->elsp_dwords.index = 0;
+
+		ret = intel_gvt_hypervisor_write_gpa(vgpu,
+			slot_gpa + offsetof(struct vgt_pv_submission_slot,
+					    consumed),
+			&slot.submitted, sizeof(slot.submitted));
+		if (ret)
+			return ret;
+
+		ret = intel_vgpu_submit_execlist(vgpu, id);
+		if (ret) {
+			gvt_vgpu_err("fail submit workload on ring %d\n", id);
+			return ret;
+		}
+	}
+	return 0;
+}
+
 static void init_vgpu_execlist(struct intel_vgpu *vgpu, int ring_id)
 {
 	struct intel_vgpu_submission *s = &vgpu->submission;
@@ -548,8 +700,10 @@ static void reset_execlist(struct intel_vgpu *vgpu,
 	struct intel_engine_cs *engine;
 	unsigned int tmp;
 
-	for_each_engine_masked(engine, dev_priv, engine_mask, tmp)
+	for_each_engine_masked(engine, dev_priv, engine_mask, tmp) {
+		clear_bit(engine->id, vgpu->submission.elsp_pending);
 		init_vgpu_execlist(vgpu, engine->id);
+	}
 }
 
 static int init_execlist(struct intel_vgpu *vgpu,
@@ -182,6 +182,15 @@ int intel_vgpu_init_execlist(struct intel_vgpu *vgpu);
 
 int intel_vgpu_submit_execlist(struct intel_vgpu *vgpu, int ring_id);
 
+int intel_vgpu_latch_elsp(struct intel_vgpu *vgpu, unsigned int offset,
+			  u32 data);
+
+void intel_vgpu_flush_elsp(struct intel_vgpu *vgpu);
+
+int intel_vgpu_register_pv_submission(struct intel_vgpu *vgpu, u64 gpa);
+
+int intel_vgpu_pv_submit(struct intel_vgpu *vgpu);
+
 void intel_vgpu_reset_execlist(struct intel_vgpu *vgpu,
 		unsigned long engine_mask);
 
@@ -159,11 +159,25 @@ struct intel_vgpu_fb_format {
 	struct intel_vgpu_pipe_format	pipes[I915_MAX_PIPES];
 };
 
+/* The planes decoded once when a frame is committed at vblank. */
+struct intel_vgpu_frame {
+	unsigned int seqno;		/* frames committed, 0 before the first */
+	unsigned int cursor_seqno;	/* cursor updates committed, likewise */
+	int primary_ret;
+	int cursor_ret;
+	struct intel_vgpu_primary_plane_format primary;
+	struct intel_vgpu_cursor_plane_format cursor;
+};
+
 int intel_vgpu_decode_primary_plane(struct intel_vgpu *vgpu,
 	struct intel_vgpu_primary_plane_format *plane);
 int intel_vgpu_decode_cursor_plane(struct intel_vgpu *vgpu,
 	struct intel_vgpu_cursor_plane_format *plane);
 int intel_vgpu_decode_sprite_plane(struct intel_vgpu *vgpu,
 	struct intel_vgpu_sprite_plane_format *plane);
+int intel_vgpu_frame_primary_plane(struct intel_vgpu *vgpu,
+	struct intel_vgpu_primary_plane_format *plane);
+int intel_vgpu_frame_cursor_plane(struct intel_vgpu *vgpu,
+	struct intel_vgpu_cursor_plane_format *plane);
 
 #endif
@@ -44,9 +44,18 @@
 #define gvt_vdbg_mm(fmt, args...)
 #endif
 
-static bool enable_out_of_sync = false;
 static int preallocated_oos_pages = 8192;
 
+/*
+ * A page table taking gvt_oos_hot_writes trapped writes goes out of sync,
+ * and one with fewer entries changed between two submissions goes back to
+ * write protection.
+ */
+static inline int oos_hot_writes(void)
+{
+	return max(i915_modparams.gvt_oos_hot_writes, 1);
+}
+
 /*
  * validate a gm address and related range size,
  * translate it to host gm address
@@ -226,6 +235,11 @@ static struct gtt_type_table_entry gtt_type_table[] = {
 			GTT_TYPE_PPGTT_PTE_PT,
 			GTT_TYPE_INVALID,
 			GTT_TYPE_INVALID),
+	GTT_TYPE_TABLE_ENTRY(GTT_TYPE_PPGTT_PTE_64K_ENTRY,
+			GTT_TYPE_PPGTT_PTE_4K_ENTRY,
+			GTT_TYPE_PPGTT_PTE_PT,
+			GTT_TYPE_INVALID,
+			GTT_TYPE_INVALID),
 	GTT_TYPE_TABLE_ENTRY(GTT_TYPE_PPGTT_PTE_2M_ENTRY,
 			GTT_TYPE_PPGTT_PDE_ENTRY,
 			GTT_TYPE_PPGTT_PDE_PT,
@@ -339,8 +353,11 @@ static inline int gtt_set_entry64(void *pt,
 
 #define ADDR_1G_MASK	GENMASK_ULL(GTT_HAW - 1, 30)
 #define ADDR_2M_MASK	GENMASK_ULL(GTT_HAW - 1, 21)
+#define ADDR_64K_MASK	GENMASK_ULL(GTT_HAW - 1, 16)
 #define ADDR_4K_MASK	GENMASK_ULL(GTT_HAW - 1, 12)
 
+#define GTT_64K_PTE_STRIDE 16
+
 static unsigned long gen8_gtt_get_pfn(struct intel_gvt_gtt_entry *e)
 {
 	unsigned long pfn;
@@ -349,6 +366,8 @@ static unsigned long gen8_gtt_get_pfn(struct intel_gvt_gtt_entry *e)
 		pfn = (e->val64 & ADDR_1G_MASK) >> PAGE_SHIFT;
 	else if (e->type == GTT_TYPE_PPGTT_PTE_2M_ENTRY)
 		pfn = (e->val64 & ADDR_2M_MASK) >> PAGE_SHIFT;
+	else if (e->type == GTT_TYPE_PPGTT_PTE_64K_ENTRY)
+		pfn = (e->val64 & ADDR_64K_MASK) >> PAGE_SHIFT;
 	else
 		pfn = (e->val64 & ADDR_4K_MASK) >> PAGE_SHIFT;
 	return pfn;
@@ -362,6 +381,9 @@ static void gen8_gtt_set_pfn(struct intel_gvt_gtt_entry *e, unsigned long pfn)
 	} else if (e->type == GTT_TYPE_PPGTT_PTE_2M_ENTRY) {
 		e->val64 &= ~ADDR_2M_MASK;
 		pfn &= (ADDR_2M_MASK >> PAGE_SHIFT);
+	} else if (e->type == GTT_TYPE_PPGTT_PTE_64K_ENTRY) {
+		e->val64 &= ~ADDR_64K_MASK;
+		pfn &= (ADDR_64K_MASK >> PAGE_SHIFT);
 	} else {
 		e->val64 &= ~ADDR_4K_MASK;
 		pfn &= (ADDR_4K_MASK >> PAGE_SHIFT);
@@ -384,6 +406,40 @@ static bool gen8_gtt_test_pse(struct intel_gvt_gtt_entry *e)
 	return true;
 }
 
+static void gen8_gtt_clear_pse(struct intel_gvt_gtt_entry *e)
+{
+	if (gen8_gtt_test_pse(e)) {
+		switch (e->type) {
+		case GTT_TYPE_PPGTT_PTE_2M_ENTRY:
+			e->val64 &= ~_PAGE_PSE;
+			e->type = GTT_TYPE_PPGTT_PDE_ENTRY;
+			break;
+		case GTT_TYPE_PPGTT_PTE_1G_ENTRY:
+			e->type = GTT_TYPE_PPGTT_PDP_ENTRY;
+			e->val64 &= ~_PAGE_PSE;
+			break;
+		default:
+			WARN_ON(1);
+		}
+	}
+}
+
+static bool gen8_gtt_test_ips(struct intel_gvt_gtt_entry *e)
+{
+	if (GEM_WARN_ON(e->type != GTT_TYPE_PPGTT_PDE_ENTRY))
+		return false;
+
+	return !!(e->val64 & GEN8_PDE_IPS_64K);
+}
+
+static void gen8_gtt_clear_ips(struct intel_gvt_gtt_entry *e)
+{
+	if (GEM_WARN_ON(e->type != GTT_TYPE_PPGTT_PDE_ENTRY))
+		return;
+
+	e->val64 &= ~GEN8_PDE_IPS_64K;
+}
+
 static bool gen8_gtt_test_present(struct intel_gvt_gtt_entry *e)
 {
 	/*
@@ -440,6 +496,9 @@ static struct intel_gvt_gtt_pte_ops gen8_gtt_pte_ops = {
 	.set_present = gtt_entry_set_present,
 	.test_present = gen8_gtt_test_present,
 	.test_pse = gen8_gtt_test_pse,
+	.clear_pse = gen8_gtt_clear_pse,
+	.clear_ips = gen8_gtt_clear_ips,
+	.test_ips = gen8_gtt_test_ips,
 	.get_pfn = gen8_gtt_get_pfn,
 	.set_pfn = gen8_gtt_set_pfn,
 };
@@ -543,6 +602,18 @@ static void ggtt_set_host_entry(struct intel_vgpu_mm *mm,
 /*
  * PPGTT shadow page table helpers.
  */
+
+/*
+ * The 64K entries of a guest page table with IPS set in its PDE are
+ * shadowed as 4K ones, so only the guest side sees them.
+ */
+static inline void ppgtt_update_guest_entry_type(
+		struct intel_vgpu_ppgtt_spt *spt, struct intel_gvt_gtt_entry *e)
+{
+	if (e->type == GTT_TYPE_PPGTT_PTE_4K_ENTRY && spt->guest_page.pde_ips)
+		e->type = GTT_TYPE_PPGTT_PTE_64K_ENTRY;
+}
+
 static inline int ppgtt_spt_get_entry(
 		struct intel_vgpu_ppgtt_spt *spt,
 		void *page_table, int type,
@@ -566,6 +637,9 @@ static inline int ppgtt_spt_get_entry(
 
 	ops->test_pse(e);
 
+	if (guest)
+		ppgtt_update_guest_entry_type(spt, e);
+
 	gvt_vdbg_mm("read ppgtt entry, spt type %d, entry type %d, index %lu, value %llx\n",
 		    type, e->type, index, e->val64);
 	return 0;
@@ -607,17 +681,92 @@ static inline int ppgtt_spt_set_entry(
 	ppgtt_spt_set_entry(spt, spt->shadow_page.vaddr, \
 		spt->shadow_page.type, e, index, false)
 
-static void *alloc_spt(gfp_t gfp_mask)
+/*
+ * Freed shadow pages are kept in a per-vGPU pool with their DMA mapping,
+ * so that a burst of new guest page tables neither goes to the page
+ * allocator nor maps pages through the IOMMU for each of them. The DMA
+ * address of a pooled page is kept in its page_private.
+ */
+#define GVT_SPT_PAGE_POOL_SIZE 256
+
+static struct page *get_spt_page(struct intel_vgpu *vgpu, gfp_t gfp_mask)
+{
+	struct device *kdev = &vgpu->gvt->dev_priv->drm.pdev->dev;
+	struct intel_vgpu_gtt *gtt = &vgpu->gtt;
+	struct page *page;
+	dma_addr_t daddr;
+
+	page = list_first_entry_or_null(&gtt->spt_page_pool, struct page, lru);
+	if (page) {
+		list_del(&page->lru);
+		gtt->spt_page_pool_cnt--;
+		clear_page(page_address(page));
+		return page;
+	}
+
+	page = alloc_pages_node(vgpu->gvt->numa_node,
+				gfp_mask | __GFP_ZERO | __GFP_ACCOUNT, 0);
+	if (!page)
+		return NULL;
+
+	daddr = dma_map_page(kdev, page, 0, PAGE_SIZE, PCI_DMA_BIDIRECTIONAL);
+	if (dma_mapping_error(kdev, daddr)) {
+		gvt_vgpu_err("fail to map dma addr\n");
+		__free_page(page);
+		return NULL;
+	}
+	set_page_private(page, daddr);
+	return page;
+}
+
+static void release_spt_page(struct intel_vgpu *vgpu, struct page *page)
+{
+	struct device *kdev = &vgpu->gvt->dev_priv->drm.pdev->dev;
+
+	dma_unmap_page(kdev, page_private(page), PAGE_SIZE,
+		       PCI_DMA_BIDIRECTIONAL);
+	set_page_private(page, 0);
+	__free_page(page);
+}
+
+static void put_spt_page(struct intel_vgpu *vgpu, struct page *page)
+{
+	struct intel_vgpu_gtt *gtt = &vgpu->gtt;
+
+	if (gtt->spt_page_pool_cnt >= GVT_SPT_PAGE_POOL_SIZE) {
+		release_spt_page(vgpu, page);
+		return;
+	}
+
+	list_add(&page->lru, &gtt->spt_page_pool);
+	gtt->spt_page_pool_cnt++;
+}
+
+static void drain_spt_page_pool(struct intel_vgpu *vgpu)
+{
+	struct intel_vgpu_gtt *gtt = &vgpu->gtt;
+	struct page *page, *n;
+
+	list_for_each_entry_safe(page, n, &gtt->spt_page_pool, lru) {
+		list_del(&page->lru);
+		release_spt_page(vgpu, page);
+	}
+	gtt->spt_page_pool_cnt = 0;
+}
+
+static struct intel_vgpu_ppgtt_spt *alloc_spt(struct intel_vgpu *vgpu,
+		gfp_t gfp_mask)
 {
 	struct intel_vgpu_ppgtt_spt *spt;
 
-	spt = kzalloc(sizeof(*spt), gfp_mask);
+	spt = kmem_cache_alloc_node(vgpu->gvt->gtt.spt_cache,
+				    gfp_mask | __GFP_ZERO, vgpu->gvt->numa_node);
 	if (!spt)
 		return NULL;
 
-	spt->shadow_page.page = alloc_page(gfp_mask);
+	spt->shadow_page.page = get_spt_page(vgpu, gfp_mask);
 	if (!spt->shadow_page.page) {
-		kfree(spt);
+		kmem_cache_free(vgpu->gvt->gtt.spt_cache, spt);
 		return NULL;
 	}
 	return spt;
@@ -625,8 +774,10 @@ static void *alloc_spt(gfp_t gfp_mask)
 
 static void free_spt(struct intel_vgpu_ppgtt_spt *spt)
 {
-	__free_page(spt->shadow_page.page);
-	kfree(spt);
+	struct intel_vgpu *vgpu = spt->vgpu;
+
+	put_spt_page(vgpu, spt->shadow_page.page);
+	kmem_cache_free(vgpu->gvt->gtt.spt_cache, spt);
 }
 
 static int detach_oos_page(struct intel_vgpu *vgpu,
@@ -634,21 +785,21 @@ static int detach_oos_page(struct intel_vgpu *vgpu,
 
 static void ppgtt_free_spt(struct intel_vgpu_ppgtt_spt *spt)
 {
-	struct device *kdev = &spt->vgpu->gvt->dev_priv->drm.pdev->dev;
-
 	trace_spt_free(spt->vgpu->id, spt, spt->guest_page.type);
 
-	dma_unmap_page(kdev, spt->shadow_page.mfn << I915_GTT_PAGE_SHIFT, 4096,
-		       PCI_DMA_BIDIRECTIONAL);
-
 	radix_tree_delete(&spt->vgpu->gtt.spt_tree, spt->shadow_page.mfn);
 
-	if (spt->guest_page.oos_page)
-		detach_oos_page(spt->vgpu, spt->guest_page.oos_page);
+	if (spt->guest_page.type != GTT_TYPE_INVALID) {
+		if (spt->guest_page.oos_page)
+			detach_oos_page(spt->vgpu, spt->guest_page.oos_page);
 
-	intel_vgpu_unregister_page_track(spt->vgpu, spt->guest_page.gfn);
+		intel_vgpu_unregister_page_track(spt->vgpu,
+						 spt->guest_page.gfn);
+	}
 
 	list_del_init(&spt->post_shadow_list);
+	atomic_dec(&spt->vgpu->gvt->gtt.num_spt);
+	spt->vgpu->gtt.num_spt--;
 	free_spt(spt);
 }
 
@@ -673,12 +824,19 @@ static int ppgtt_write_protection_handler(
 		u64 gpa, void *data, int bytes)
 {
 	struct intel_vgpu_ppgtt_spt *spt = page_track->priv_data;
+	u32 val = 0;
 
 	int ret;
 
 	if (bytes != 4 && bytes != 8)
 		return -EINVAL;
 
+	intel_vgpu_stat_inc(spt->vgpu, INTEL_VGPU_STAT_WP_FAULT);
+	/* data may be unaligned, record the low dword of the write */
+	memcpy(&val, data, min(bytes, 4));
+	intel_gvt_record(spt->vgpu, INTEL_GVT_REC_WP_FAULT, gpa >> PAGE_SHIFT,
+			 val, 0);
+
 	ret = ppgtt_handle_guest_write_page_table_bytes(spt, gpa, data, bytes);
 	if (ret)
 		return ret;
@@ -705,20 +863,31 @@ static inline struct intel_vgpu_ppgtt_spt *intel_vgpu_find_spt_by_mfn(
 	return radix_tree_lookup(&vgpu->gtt.spt_tree, mfn);
 }
 
-static int reclaim_one_ppgtt_mm(struct intel_gvt *gvt);
+static int reclaim_one_ppgtt_mm(struct intel_vgpu *vgpu, bool own);
 
+/* Allocate a shadow page table which has no guest page behind it. */
 static struct intel_vgpu_ppgtt_spt *ppgtt_alloc_spt(
-		struct intel_vgpu *vgpu, int type, unsigned long gfn)
+		struct intel_vgpu *vgpu, intel_gvt_gtt_type_t type)
 {
-	struct device *kdev = &vgpu->gvt->dev_priv->drm.pdev->dev;
 	struct intel_vgpu_ppgtt_spt *spt = NULL;
-	dma_addr_t daddr;
 	int ret;
 
+	/*
+	 * Above its limit, a vGPU recycles its own page tables before its
+	 * memcg or the host runs out of memory and the shrinker has to.
+	 * While a guest entry is being shadowed, the unpinned mm it belongs
+	 * to could be recycled from under us, so the limit is only enforced
+	 * again by the next allocation outside of that.
+	 */
+	while (!vgpu->gtt.populating && vgpu->gtt.spt_limit &&
+	       vgpu->gtt.num_spt >= vgpu->gtt.spt_limit &&
+	       reclaim_one_ppgtt_mm(vgpu, true))
+		;
+
 retry:
-	spt = alloc_spt(GFP_KERNEL | __GFP_ZERO);
+	spt = alloc_spt(vgpu, GFP_KERNEL);
 	if (!spt) {
-		if (reclaim_one_ppgtt_mm(vgpu->gvt))
+		if (reclaim_one_ppgtt_mm(vgpu, false))
 			goto retry;
 
 		gvt_vgpu_err("fail to allocate ppgtt shadow page\n");
@@ -733,41 +902,52 @@ static struct intel_vgpu_ppgtt_spt *ppgtt_alloc_spt(
 	 * Init shadow_page.
 	 */
 	spt->shadow_page.type = type;
-	daddr = dma_map_page(kdev, spt->shadow_page.page,
-			     0, 4096, PCI_DMA_BIDIRECTIONAL);
-	if (dma_mapping_error(kdev, daddr)) {
-		gvt_vgpu_err("fail to map dma addr\n");
-		ret = -EINVAL;
-		goto err_free_spt;
-	}
 	spt->shadow_page.vaddr = page_address(spt->shadow_page.page);
-	spt->shadow_page.mfn = daddr >> I915_GTT_PAGE_SHIFT;
+	spt->shadow_page.mfn = page_private(spt->shadow_page.page) >>
+			       I915_GTT_PAGE_SHIFT;
+
+	spt->guest_page.type = GTT_TYPE_INVALID;
+
+	ret = radix_tree_insert(&vgpu->gtt.spt_tree, spt->shadow_page.mfn, spt);
+	if (ret) {
+		free_spt(spt);
+		return ERR_PTR(ret);
+	}
+
+	atomic_inc(&vgpu->gvt->gtt.num_spt);
+	vgpu->gtt.num_spt++;
+	return spt;
+}
+
+/* Allocate a shadow page table for a write protected guest page table. */
+static struct intel_vgpu_ppgtt_spt *ppgtt_alloc_spt_gfn(
+		struct intel_vgpu *vgpu, intel_gvt_gtt_type_t type,
+		unsigned long gfn, bool guest_pde_ips)
+{
+	struct intel_vgpu_ppgtt_spt *spt;
+	int ret;
+
+	spt = ppgtt_alloc_spt(vgpu, type);
+	if (IS_ERR(spt))
+		return spt;
 
 	/*
 	 * Init guest_page.
 	 */
 	spt->guest_page.type = type;
 	spt->guest_page.gfn = gfn;
+	spt->guest_page.pde_ips = guest_pde_ips;
 
 	ret = intel_vgpu_register_page_track(vgpu, spt->guest_page.gfn,
 					ppgtt_write_protection_handler, spt);
-	if (ret)
-		goto err_unmap_dma;
-
-	ret = radix_tree_insert(&vgpu->gtt.spt_tree, spt->shadow_page.mfn, spt);
-	if (ret)
-		goto err_unreg_page_track;
+	if (ret) {
+		spt->guest_page.type = GTT_TYPE_INVALID;
+		ppgtt_free_spt(spt);
+		return ERR_PTR(ret);
+	}
 
 	trace_spt_alloc(vgpu->id, spt, type, spt->shadow_page.mfn, gfn);
 	return spt;
-
-err_unreg_page_track:
-	intel_vgpu_unregister_page_track(vgpu, spt->guest_page.gfn);
-err_unmap_dma:
-	dma_unmap_page(kdev, daddr, PAGE_SIZE, PCI_DMA_BIDIRECTIONAL);
-err_free_spt:
-	free_spt(spt);
-	return ERR_PTR(ret);
 }
 
 #define pt_entry_size_shift(spt) \
@@ -777,7 +957,8 @@ static struct intel_vgpu_ppgtt_spt *ppgtt_alloc_spt(
 	(I915_GTT_PAGE_SIZE >> pt_entry_size_shift(spt))
 
 #define for_each_present_guest_entry(spt, e, i) \
-	for (i = 0; i < pt_entries(spt); i++) \
+	for (i = 0; i < pt_entries(spt); \
+	     i += spt->guest_page.pde_ips ? GTT_64K_PTE_STRIDE : 1) \
 		if (!ppgtt_get_guest_entry(spt, e, i) && \
 		    spt->vgpu->gvt->gtt.pte_ops->test_present(e))
 
@@ -836,7 +1017,9 @@ static inline void ppgtt_invalidate_pte(struct intel_vgpu_ppgtt_spt *spt,
 	if (pfn == vgpu->gtt.scratch_pt[type].page_mfn)
 		return;
 
-	intel_gvt_hypervisor_dma_unmap_guest_page(vgpu, pfn << PAGE_SHIFT);
+	intel_gvt_hypervisor_dma_unmap_guest_page(vgpu, pfn << PAGE_SHIFT,
+		entry->type == GTT_TYPE_PPGTT_PTE_2M_ENTRY ?
+		I915_GTT_PAGE_SIZE_2M : I915_GTT_PAGE_SIZE_4K);
 }
 
 static int ppgtt_invalidate_spt(struct intel_vgpu_ppgtt_spt *spt)
@@ -862,8 +1045,11 @@ static int ppgtt_invalidate_spt(struct intel_vgpu_ppgtt_spt *spt)
 			ppgtt_invalidate_pte(spt, &e);
 			break;
 		case GTT_TYPE_PPGTT_PTE_2M_ENTRY:
+			gvt_vdbg_mm("invalidate 2M entry\n");
+			ppgtt_invalidate_pte(spt, &e);
+			break;
 		case GTT_TYPE_PPGTT_PTE_1G_ENTRY:
-			WARN(1, "GVT doesn't support 2M/1GB page\n");
+			WARN(1, "GVT doesn't support 1GB page\n");
 			continue;
 		case GTT_TYPE_PPGTT_PML4_ENTRY:
 		case GTT_TYPE_PPGTT_PDP_ENTRY:
@@ -891,38 +1077,144 @@ static int ppgtt_invalidate_spt(struct intel_vgpu_ppgtt_spt *spt)
 
 static int ppgtt_populate_spt(struct intel_vgpu_ppgtt_spt *spt);
 
-static struct intel_vgpu_ppgtt_spt *ppgtt_populate_spt_by_guest_entry(
-		struct intel_vgpu *vgpu, struct intel_gvt_gtt_entry *we)
+static bool vgpu_ips_enabled(struct intel_vgpu *vgpu)
+{
+	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
+
+	if (INTEL_GEN(dev_priv) == 9 || INTEL_GEN(dev_priv) == 10) {
+		u32 ips = vgpu_vreg_t(vgpu, GEN8_GAMW_ECO_DEV_RW_IA) &
+			GAMW_ECO_ENABLE_64K_IPS_FIELD;
+
+		return ips == GAMW_ECO_ENABLE_64K_IPS_FIELD;
+	} else if (INTEL_GEN(dev_priv) >= 11) {
+		/* 64K paging only controlled by IPS bit in PTE now. */
+		return true;
+	} else
+		return false;
+}
+
+/* Drop the shadow of a page table whose PDE has changed its IPS bit. */
+static int ppgtt_reshadow_spt(struct intel_vgpu_ppgtt_spt *spt, bool ips)
+{
+	struct intel_gvt_gtt_entry e;
+	unsigned long index;
+
+	int ret;
+
+	gvt_dbg_mm("reshadow PTE page since ips changed to %d\n", ips);
+
+	/* 64K page tables are never out of sync, write protect it again. */
+	if (spt->guest_page.oos_page) {
+		detach_oos_page(spt->vgpu, spt->guest_page.oos_page);
+		ret = intel_vgpu_enable_page_track(spt->vgpu,
+						   spt->guest_page.gfn);
+		if (ret)
+			return ret;
+	}
+
+	for_each_present_shadow_entry(spt, &e, index)
+		ppgtt_invalidate_pte(spt, &e);
+
+	clear_page(spt->shadow_page.vaddr);
+	spt->guest_page.pde_ips = ips;
+	return ppgtt_populate_spt(spt);
+}
+
+/*
+ * Find or allocate the shadow of the page table a guest entry points to.
+ * @populate is set if it was just allocated, in which case the caller has
+ * to write protect and populate it.
+ */
+static struct intel_vgpu_ppgtt_spt *ppgtt_get_spt_by_guest_entry(
+		struct intel_vgpu *vgpu, struct intel_gvt_gtt_entry *we,
+		bool *populate)
 {
 	struct intel_gvt_gtt_pte_ops *ops = vgpu->gvt->gtt.pte_ops;
 	struct intel_vgpu_ppgtt_spt *spt = NULL;
+	bool ips = false;
 	int ret;
 
+	*populate = false;
+
 	GEM_BUG_ON(!gtt_type_is_pt(get_next_pt_type(we->type)));
 
+	if (we->type == GTT_TYPE_PPGTT_PDE_ENTRY)
+		ips = vgpu_ips_enabled(vgpu) && ops->test_ips(we);
+
+	/*
+	 * Shadow page tables are shared by every entry, in any mm of this
+	 * vGPU, pointing to the same guest page table, so an already
+	 * shadowed subtree only takes a reference. A guest page can only be
+	 * tracked once though, so it can't be shared between two levels.
+	 */
 	spt = intel_vgpu_find_spt_by_gfn(vgpu, ops->get_pfn(we));
-	if (spt)
+	if (spt) {
+		if (spt->guest_page.type != get_next_pt_type(we->type)) {
+			gvt_vgpu_err("guest page table 0x%lx used as type %d and %d\n",
+				     spt->guest_page.gfn, spt->guest_page.type,
+				     get_next_pt_type(we->type));
+			ret = -EINVAL;
+			goto fail;
+		}
+
 		ppgtt_get_spt(spt);
-	else {
+
+		if (ips != spt->guest_page.pde_ips) {
+			ret = ppgtt_reshadow_spt(spt, ips);
+			if (ret)
+				goto fail;
+		}
+	} else {
 		int type = get_next_pt_type(we->type);
 
-		spt = ppgtt_alloc_spt(vgpu, type, ops->get_pfn(we));
+		spt = ppgtt_alloc_spt_gfn(vgpu, type, ops->get_pfn(we), ips);
 		if (IS_ERR(spt)) {
 			ret = PTR_ERR(spt);
 			goto fail;
 		}
+		*populate = true;
+	}
+	return spt;
+fail:
+	gvt_vgpu_err("fail: shadow page %p guest entry 0x%llx type %d\n",
+		     spt, we->val64, we->type);
+	return ERR_PTR(ret);
+}
 
-		ret = intel_vgpu_enable_page_track(vgpu, spt->guest_page.gfn);
-		if (ret)
-			goto fail;
+static int ppgtt_populate_new_spt(struct intel_vgpu_ppgtt_spt *spt)
+{
+	int ret;
+
+	ret = ppgtt_populate_spt(spt);
+	if (ret)
+		return ret;
+
+	trace_spt_change(spt->vgpu->id, "new", spt, spt->guest_page.gfn,
+			 spt->shadow_page.type);
+	return 0;
+}
 
-		ret = ppgtt_populate_spt(spt);
+static struct intel_vgpu_ppgtt_spt *ppgtt_populate_spt_by_guest_entry(
+		struct intel_vgpu *vgpu, struct intel_gvt_gtt_entry *we)
+{
+	struct intel_vgpu_ppgtt_spt *spt;
+	bool populate;
+	int ret;
+
+	spt = ppgtt_get_spt_by_guest_entry(vgpu, we, &populate);
+	if (IS_ERR(spt) || !populate)
+		return spt;
+
+	/* PV guests report their page table updates instead. */
+	if (!vgpu->gtt.pv_ring_gpa) {
+		ret = intel_vgpu_enable_page_track(vgpu, spt->guest_page.gfn);
 		if (ret)
 			goto fail;
-
-		trace_spt_change(vgpu->id, "new", spt, spt->guest_page.gfn,
-				 spt->shadow_page.type);
 	}
+
+	ret = ppgtt_populate_new_spt(spt);
+	if (ret)
+		goto fail;
 	return spt;
 fail:
 	gvt_vgpu_err("fail: shadow page %p guest entry 0x%llx type %d\n",
@@ -938,9 +1230,96 @@ static inline void ppgtt_generate_shadow_entry(struct intel_gvt_gtt_entry *se,
 	se->type = ge->type;
 	se->val64 = ge->val64;
 
+	/* Because we always split 64KB pages, so clear IPS in shadow PDE. */
+	if (se->type == GTT_TYPE_PPGTT_PDE_ENTRY)
+		ops->clear_ips(se);
+
 	ops->set_pfn(se, s->shadow_page.mfn);
 }
 
+/*
+ * Shadow a guest 2M entry with a page table of 4K entries, used when the
+ * host pages backing it are not contiguous.
+ */
+static int split_2MB_gtt_entry(struct intel_vgpu *vgpu,
+	struct intel_vgpu_ppgtt_spt *spt, unsigned long index,
+	struct intel_gvt_gtt_entry *se)
+{
+	struct intel_gvt_gtt_pte_ops *ops = vgpu->gvt->gtt.pte_ops;
+	struct intel_vgpu_ppgtt_spt *sub_spt;
+	struct intel_gvt_gtt_entry sub_se;
+	unsigned long start_gfn;
+	dma_addr_t dma_addr;
+	unsigned long sub_index;
+	int ret;
+
+	gvt_dbg_mm("Split 2M gtt entry, index %lu\n", index);
+
+	start_gfn = ops->get_pfn(se);
+
+	sub_spt = ppgtt_alloc_spt(vgpu, GTT_TYPE_PPGTT_PTE_PT);
+	if (IS_ERR(sub_spt))
+		return PTR_ERR(sub_spt);
+
+	sub_se.type = GTT_TYPE_PPGTT_PTE_4K_ENTRY;
+	for (sub_index = 0; sub_index < pt_entries(sub_spt); sub_index++) {
+		ret = intel_gvt_hypervisor_dma_map_guest_page(vgpu,
+				start_gfn + sub_index, PAGE_SIZE, &dma_addr);
+		if (ret) {
+			ppgtt_invalidate_spt(sub_spt);
+			return ret;
+		}
+		sub_se.val64 = se->val64;
+
+		/* Copy the PAT field from PDE. */
+		sub_se.val64 &= ~_PAGE_PAT;
+		sub_se.val64 |= (se->val64 & _PAGE_PAT_LARGE) >> 5;
+
+		ops->set_pfn(&sub_se, dma_addr >> PAGE_SHIFT);
+		ppgtt_set_shadow_entry(sub_spt, &sub_se, sub_index);
+	}
+
+	/* Clear dirty field. */
+	se->val64 &= ~_PAGE_DIRTY;
+
+	ops->clear_pse(se);
+	ops->clear_ips(se);
+	ops->set_pfn(se, sub_spt->shadow_page.mfn);
+	ppgtt_set_shadow_entry(spt, se, index);
+	return 0;
+}
+
+/* Shadow a guest 64K entry with 16 consecutive 4K entries. */
+static int split_64KB_gtt_entry(struct intel_vgpu *vgpu,
+	struct intel_vgpu_ppgtt_spt *spt, unsigned long index,
+	struct intel_gvt_gtt_entry *se)
+{
+	struct intel_gvt_gtt_pte_ops *ops = vgpu->gvt->gtt.pte_ops;
+	struct intel_gvt_gtt_entry entry = *se;
+	unsigned long start_gfn;
+	dma_addr_t dma_addr;
+	int i, ret;
+
+	gvt_vdbg_mm("Split 64K gtt entry, index %lu\n", index);
+
+	GEM_BUG_ON(index % GTT_64K_PTE_STRIDE);
+
+	start_gfn = ops->get_pfn(se);
+
+	entry.type = GTT_TYPE_PPGTT_PTE_4K_ENTRY;
+
+	for (i = 0; i < GTT_64K_PTE_STRIDE; i++) {
+		ret = intel_gvt_hypervisor_dma_map_guest_page(vgpu,
+					start_gfn + i, PAGE_SIZE, &dma_addr);
+		if (ret)
+			return ret;
+
+		ops->set_pfn(&entry, dma_addr >> PAGE_SHIFT);
+		ppgtt_set_shadow_entry(spt, &entry, index + i);
+	}
+	return 0;
+}
+
 static int ppgtt_populate_shadow_entry(struct intel_vgpu *vgpu,
 	struct intel_vgpu_ppgtt_spt *spt, unsigned long index,
 	struct intel_gvt_gtt_entry *ge)
@@ -960,16 +1339,41 @@ static int ppgtt_populate_shadow_entry(struct intel_vgpu *vgpu,
 	case GTT_TYPE_PPGTT_PTE_4K_ENTRY:
 		gvt_vdbg_mm("shadow 4K gtt entry\n");
 		break;
+	case GTT_TYPE_PPGTT_PTE_64K_ENTRY:
+		gvt_vdbg_mm("shadow 64K gtt entry\n");
+		/*
+		 * The layout of 64K page is special, the page size is
+		 * controlled by upper PDE. To be simple, we always split
+		 * 64K page to smaller 4K pages in shadow PT.
+		 */
+		return split_64KB_gtt_entry(vgpu, spt, index, &se);
 	case GTT_TYPE_PPGTT_PTE_2M_ENTRY:
+		gvt_vdbg_mm("shadow 2M gtt entry\n");
+		if (!HAS_PAGE_SIZES(vgpu->gvt->dev_priv,
+				    I915_GTT_PAGE_SIZE_2M))
+			return split_2MB_gtt_entry(vgpu, spt, index, &se);
+
+		/* Fall back to 4K entries if the host backing isn't huge. */
+		ret = intel_gvt_hypervisor_dma_map_guest_page(vgpu, gfn,
+					I915_GTT_PAGE_SIZE_2M, &dma_addr);
+		if (ret == -E2BIG)
+			return split_2MB_gtt_entry(vgpu, spt, index, &se);
+		if (ret)
+			return -ENXIO;
+
+		pte_ops->set_pfn(&se, dma_addr >> PAGE_SHIFT);
+		ppgtt_set_shadow_entry(spt, &se, index);
+		return 0;
 	case GTT_TYPE_PPGTT_PTE_1G_ENTRY:
-		gvt_vgpu_err("GVT doesn't support 2M/1GB entry\n");
+		gvt_vgpu_err("GVT doesn't support 1GB entry\n");
 		return -EINVAL;
 	default:
 		GEM_BUG_ON(1);
 	};
 
 	/* direct shadow */
-	ret = intel_gvt_hypervisor_dma_map_guest_page(vgpu, gfn, &dma_addr);
+	ret = intel_gvt_hypervisor_dma_map_guest_page(vgpu, gfn, PAGE_SIZE,
+						      &dma_addr);
 	if (ret)
 		return -ENXIO;
 
@@ -978,35 +1382,122 @@ static int ppgtt_populate_shadow_entry(struct intel_vgpu *vgpu,
 	return 0;
 }
 
-static int ppgtt_populate_spt(struct intel_vgpu_ppgtt_spt *spt)
+/*
+ * Shadow a last level page table of 4K entries, mapping all of its guest
+ * pages in one go instead of entry by entry.
+ */
+static int ppgtt_populate_pte_spt(struct intel_vgpu_ppgtt_spt *spt)
 {
 	struct intel_vgpu *vgpu = spt->vgpu;
 	struct intel_gvt *gvt = vgpu->gvt;
 	struct intel_gvt_gtt_pte_ops *ops = gvt->gtt.pte_ops;
-	struct intel_vgpu_ppgtt_spt *s;
 	struct intel_gvt_gtt_entry se, ge;
-	unsigned long gfn, i;
-	int ret;
-
-	trace_spt_change(spt->vgpu->id, "born", spt,
-			 spt->guest_page.gfn, spt->shadow_page.type);
+	unsigned long *gfns, *index, i;
+	dma_addr_t *dma_addrs;
+	u64 *vals;
+	unsigned int n = 0;
+	int ret = 0;
+
+	gfns = kmalloc_array(pt_entries(spt), sizeof(*gfns), GFP_KERNEL);
+	index = kmalloc_array(pt_entries(spt), sizeof(*index), GFP_KERNEL);
+	dma_addrs = kmalloc_array(pt_entries(spt), sizeof(*dma_addrs),
+				  GFP_KERNEL);
+	vals = kmalloc_array(pt_entries(spt), sizeof(*vals), GFP_KERNEL);
+	if (!gfns || !index || !dma_addrs || !vals) {
+		ret = -ENOMEM;
+		goto out;
+	}
 
 	for_each_present_guest_entry(spt, &ge, i) {
-		if (gtt_type_is_pt(get_next_pt_type(ge.type))) {
-			s = ppgtt_populate_spt_by_guest_entry(vgpu, &ge);
-			if (IS_ERR(s)) {
-				ret = PTR_ERR(s);
-				goto fail;
-			}
-			ppgtt_get_shadow_entry(spt, &se, i);
-			ppgtt_generate_shadow_entry(&se, s, &ge);
+		if (!intel_gvt_hypervisor_is_valid_gfn(vgpu, ops->get_pfn(&ge))) {
+			se = ge;
+			ops->set_pfn(&se, gvt->gtt.scratch_mfn);
 			ppgtt_set_shadow_entry(spt, &se, i);
-		} else {
-			gfn = ops->get_pfn(&ge);
-			if (!intel_gvt_hypervisor_is_valid_gfn(vgpu, gfn)) {
-				ops->set_pfn(&se, gvt->gtt.scratch_mfn);
-				ppgtt_set_shadow_entry(spt, &se, i);
-				continue;
+			continue;
+		}
+		index[n] = i;
+		vals[n] = ge.val64;
+		gfns[n++] = ops->get_pfn(&ge);
+	}
+
+	if (!n)
+		goto out;
+
+	ret = intel_gvt_hypervisor_dma_map_guest_pages(vgpu, gfns, n,
+						       dma_addrs);
+	if (ret) {
+		ret = -ENXIO;
+		goto out;
+	}
+
+	se.type = get_entry_type(spt->guest_page.type);
+	for (i = 0; i < n; i++) {
+		se.val64 = vals[i];
+		ops->set_pfn(&se, dma_addrs[i] >> PAGE_SHIFT);
+		ppgtt_set_shadow_entry(spt, &se, index[i]);
+	}
+out:
+	kfree(vals);
+	kfree(dma_addrs);
+	kfree(index);
+	kfree(gfns);
+	return ret;
+}
+
+static int ppgtt_populate_spt(struct intel_vgpu_ppgtt_spt *spt)
+{
+	struct intel_vgpu *vgpu = spt->vgpu;
+	struct intel_gvt *gvt = vgpu->gvt;
+	struct intel_gvt_gtt_pte_ops *ops = gvt->gtt.pte_ops;
+	struct intel_vgpu_ppgtt_spt *s, **children;
+	struct intel_gvt_gtt_entry se, ge;
+	unsigned long gfn, i, *gfns;
+	unsigned int nr = 0;
+	bool populate;
+	int ret = 0;
+
+	trace_spt_change(spt->vgpu->id, "born", spt,
+			 spt->guest_page.gfn, spt->shadow_page.type);
+
+	if (spt->shadow_page.type == GTT_TYPE_PPGTT_PTE_PT &&
+	    !spt->guest_page.pde_ips) {
+		ret = ppgtt_populate_pte_spt(spt);
+		if (ret)
+			gvt_vgpu_err("fail: shadow page %p populate %d\n",
+				     spt, ret);
+		return ret;
+	}
+
+	/*
+	 * The new page tables this one points to are linked first, then
+	 * write protected in one batch before their own entries get read.
+	 */
+	children = kmalloc_array(GTT_ENTRY_NUM_IN_ONE_PAGE,
+				 sizeof(*children) + sizeof(*gfns), GFP_KERNEL);
+	if (!children)
+		return -ENOMEM;
+	gfns = (unsigned long *)(children + GTT_ENTRY_NUM_IN_ONE_PAGE);
+
+	for_each_present_guest_entry(spt, &ge, i) {
+		if (gtt_type_is_pt(get_next_pt_type(ge.type))) {
+			s = ppgtt_get_spt_by_guest_entry(vgpu, &ge, &populate);
+			if (IS_ERR(s)) {
+				ret = PTR_ERR(s);
+				goto fail;
+			}
+			ppgtt_get_shadow_entry(spt, &se, i);
+			ppgtt_generate_shadow_entry(&se, s, &ge);
+			ppgtt_set_shadow_entry(spt, &se, i);
+			if (populate) {
+				children[nr] = s;
+				gfns[nr++] = s->guest_page.gfn;
+			}
+		} else {
+			gfn = ops->get_pfn(&ge);
+			if (!intel_gvt_hypervisor_is_valid_gfn(vgpu, gfn)) {
+				ops->set_pfn(&se, gvt->gtt.scratch_mfn);
+				ppgtt_set_shadow_entry(spt, &se, i);
+				continue;
 			}
 
 			ret = ppgtt_populate_shadow_entry(vgpu, spt, i, &ge);
@@ -1014,8 +1505,23 @@ static int ppgtt_populate_spt(struct intel_vgpu_ppgtt_spt *spt)
 				goto fail;
 		}
 	}
-	return 0;
+
+	if (nr && !vgpu->gtt.pv_ring_gpa) {
+		ret = intel_vgpu_enable_page_tracks(vgpu, gfns, nr);
+		if (ret)
+			goto out;
+	}
+
+	for (i = 0; i < nr; i++) {
+		ret = ppgtt_populate_new_spt(children[i]);
+		if (ret)
+			break;
+	}
+out:
+	kfree(children);
+	return ret;
 fail:
+	kfree(children);
 	gvt_vgpu_err("fail: shadow page %p guest entry 0x%llx type %d\n",
 			spt, ge.val64, ge.type);
 	return ret;
@@ -1076,6 +1582,8 @@ static int ppgtt_handle_guest_entry_add(struct intel_vgpu_ppgtt_spt *spt,
 	gvt_vdbg_mm("add shadow entry: type %d, index %lu, value %llx\n",
 		    we->type, index, we->val64);
 
+	/* @spt may belong to an unpinned mm, see reclaim_one_ppgtt_mm() */
+	vgpu->gtt.populating++;
 	if (gtt_type_is_pt(get_next_pt_type(we->type))) {
 		s = ppgtt_populate_spt_by_guest_entry(vgpu, we);
 		if (IS_ERR(s)) {
@@ -1090,8 +1598,10 @@ static int ppgtt_handle_guest_entry_add(struct intel_vgpu_ppgtt_spt *spt,
 		if (ret)
 			goto fail;
 	}
+	vgpu->gtt.populating--;
 	return 0;
 fail:
+	vgpu->gtt.populating--;
 	gvt_vgpu_err("fail: spt %p guest entry 0x%llx type %d\n",
 		spt, we->val64, we->type);
 	return ret;
@@ -1105,7 +1615,7 @@ static int sync_oos_page(struct intel_vgpu *vgpu,
 	struct intel_gvt_gtt_pte_ops *ops = gvt->gtt.pte_ops;
 	struct intel_vgpu_ppgtt_spt *spt = oos_page->spt;
 	struct intel_gvt_gtt_entry old, new;
-	int index;
+	int index, changed = 0;
 	int ret;
 
 	trace_oos_change(vgpu->id, "sync", oos_page->id,
@@ -1133,11 +1643,12 @@ static int sync_oos_page(struct intel_vgpu *vgpu,
 			return ret;
 
 		ops->set_entry(oos_page->mem, &new, index, false, 0, vgpu);
+		changed++;
 	}
 
 	spt->guest_page.write_cnt = 0;
 	list_del_init(&spt->post_shadow_list);
-	return 0;
+	return changed;
 }
 
 static int detach_oos_page(struct intel_vgpu *vgpu,
@@ -1154,7 +1665,11 @@ static int detach_oos_page(struct intel_vgpu *vgpu,
 	oos_page->spt = NULL;
 
 	list_del_init(&oos_page->vm_list);
+
+	mutex_lock(&gvt->gtt.oos_page_lock);
 	list_move_tail(&oos_page->list, &gvt->gtt.oos_page_free_list_head);
+	vgpu->gtt.num_oos_pages--;
+	mutex_unlock(&gvt->gtt.oos_page_lock);
 
 	return 0;
 }
@@ -1168,19 +1683,27 @@ static int attach_oos_page(struct intel_vgpu_oos_page *oos_page,
 	ret = intel_gvt_hypervisor_read_gpa(spt->vgpu,
 			spt->guest_page.gfn << I915_GTT_PAGE_SHIFT,
 			oos_page->mem, I915_GTT_PAGE_SIZE);
-	if (ret)
+	if (ret) {
+		mutex_lock(&gvt->gtt.oos_page_lock);
+		list_add(&oos_page->list, &gvt->gtt.oos_page_free_list_head);
+		mutex_unlock(&gvt->gtt.oos_page_lock);
 		return ret;
+	}
 
 	oos_page->spt = spt;
 	spt->guest_page.oos_page = oos_page;
 
-	list_move_tail(&oos_page->list, &gvt->gtt.oos_page_use_list_head);
+	mutex_lock(&gvt->gtt.oos_page_lock);
+	list_add_tail(&oos_page->list, &gvt->gtt.oos_page_use_list_head);
+	spt->vgpu->gtt.num_oos_pages++;
+	mutex_unlock(&gvt->gtt.oos_page_lock);
 
 	trace_oos_change(spt->vgpu->id, "attach", oos_page->id,
 			 spt, spt->guest_page.type);
 	return 0;
 }
 
+/* Returns the number of guest entries changed while out of sync. */
 static int ppgtt_set_guest_page_sync(struct intel_vgpu_ppgtt_spt *spt)
 {
 	struct intel_vgpu_oos_page *oos_page = spt->guest_page.oos_page;
@@ -1197,27 +1720,77 @@ static int ppgtt_set_guest_page_sync(struct intel_vgpu_ppgtt_spt *spt)
 	return sync_oos_page(spt->vgpu, oos_page);
 }
 
+/* Called with gtt->oos_page_lock held, or before the pool is in use. */
+static struct intel_vgpu_oos_page *alloc_oos_page(struct intel_gvt_gtt *gtt)
+{
+	struct intel_vgpu_oos_page *oos_page;
+
+	oos_page = kzalloc(sizeof(*oos_page), GFP_KERNEL);
+	if (!oos_page)
+		return NULL;
+
+	INIT_LIST_HEAD(&oos_page->list);
+	INIT_LIST_HEAD(&oos_page->vm_list);
+	oos_page->id = gtt->num_oos_pages++;
+	return oos_page;
+}
+
 static int ppgtt_allocate_oos_page(struct intel_vgpu_ppgtt_spt *spt)
 {
-	struct intel_gvt *gvt = spt->vgpu->gvt;
-	struct intel_gvt_gtt *gtt = &gvt->gtt;
+	struct intel_vgpu *vgpu = spt->vgpu;
+	struct intel_gvt_gtt *gtt = &vgpu->gvt->gtt;
 	struct intel_vgpu_oos_page *oos_page = spt->guest_page.oos_page;
+	struct intel_vgpu_oos_page *pos;
+	int quota = i915_modparams.gvt_oos_page_quota;
 	int ret;
 
 	WARN(oos_page, "shadow PPGTT page has already has a oos page\n");
 
-	if (list_empty(&gtt->oos_page_free_list_head)) {
-		oos_page = container_of(gtt->oos_page_use_list_head.next,
-			struct intel_vgpu_oos_page, list);
+retry:
+	mutex_lock(&gtt->oos_page_lock);
+	/* Grow the pool on demand, the preallocated pages are only a start. */
+	if (list_empty(&gtt->oos_page_free_list_head) &&
+	    (quota <= 0 || vgpu->gtt.num_oos_pages < quota)) {
+		oos_page = alloc_oos_page(gtt);
+		if (oos_page)
+			list_add_tail(&oos_page->list,
+				      &gtt->oos_page_free_list_head);
+	}
+
+	if (list_empty(&gtt->oos_page_free_list_head) ||
+	    (quota > 0 && vgpu->gtt.num_oos_pages >= quota)) {
+		/*
+		 * Only the oos pages owned by this vGPU can be recycled here,
+		 * as the guest page table states of other vGPUs are protected
+		 * by their own vgpu_lock. The use list is in LRU order, so
+		 * the page table written least recently goes first.
+		 */
+		oos_page = NULL;
+		list_for_each_entry(pos, &gtt->oos_page_use_list_head, list) {
+			if (pos->spt->vgpu == vgpu) {
+				oos_page = pos;
+				break;
+			}
+		}
+		mutex_unlock(&gtt->oos_page_lock);
+
+		if (!oos_page)
+			return -ENOSPC;
+
 		ret = ppgtt_set_guest_page_sync(oos_page->spt);
-		if (ret)
+		if (ret < 0)
 			return ret;
-		ret = detach_oos_page(spt->vgpu, oos_page);
+		ret = detach_oos_page(vgpu, oos_page);
 		if (ret)
 			return ret;
-	} else
-		oos_page = container_of(gtt->oos_page_free_list_head.next,
+		goto retry;
+	}
+
+	oos_page = container_of(gtt->oos_page_free_list_head.next,
 			struct intel_vgpu_oos_page, list);
+	list_del_init(&oos_page->list);
+	mutex_unlock(&gtt->oos_page_lock);
+
 	return attach_oos_page(oos_page, spt);
 }
 
@@ -1231,7 +1804,17 @@ static int ppgtt_set_guest_page_oos(struct intel_vgpu_ppgtt_spt *spt)
 	trace_oos_change(spt->vgpu->id, "set page out of sync", oos_page->id,
 			 spt, spt->guest_page.type);
 
+	/*
+	 * Going out of sync again means the guest keeps writing this page
+	 * table, so make it the last one to be recycled.
+	 */
+	mutex_lock(&spt->vgpu->gvt->gtt.oos_page_lock);
+	list_move_tail(&oos_page->list,
+		       &spt->vgpu->gvt->gtt.oos_page_use_list_head);
+	mutex_unlock(&spt->vgpu->gvt->gtt.oos_page_lock);
+
 	list_add_tail(&oos_page->vm_list, &spt->vgpu->gtt.oos_page_list_head);
+	spt->vgpu->gtt.oos_stats.to_oos++;
 	return intel_vgpu_disable_page_track(spt->vgpu, spt->guest_page.gfn);
 }
 
@@ -1251,15 +1834,26 @@ int intel_vgpu_sync_oos_pages(struct intel_vgpu *vgpu)
 	struct intel_vgpu_oos_page *oos_page;
 	int ret;
 
-	if (!enable_out_of_sync)
+	if (!i915_modparams.enable_gvt_oos)
 		return 0;
 
 	list_for_each_safe(pos, n, &vgpu->gtt.oos_page_list_head) {
 		oos_page = container_of(pos,
 				struct intel_vgpu_oos_page, vm_list);
 		ret = ppgtt_set_guest_page_sync(oos_page->spt);
-		if (ret)
+		if (ret < 0)
 			return ret;
+		vgpu->gtt.oos_stats.syncs++;
+		intel_vgpu_stat_inc(vgpu, INTEL_VGPU_STAT_OOS_SYNC);
+
+		/*
+		 * The page table went cold, trapping its few writes is cheaper
+		 * than comparing the whole page at every submission.
+		 */
+		if (ret < oos_hot_writes()) {
+			detach_oos_page(vgpu, oos_page);
+			vgpu->gtt.oos_stats.to_wp++;
+		}
 	}
 	return 0;
 }
@@ -1274,10 +1868,21 @@ static int ppgtt_handle_guest_write_page_table(
 	struct intel_vgpu *vgpu = spt->vgpu;
 	int type = spt->shadow_page.type;
 	struct intel_gvt_gtt_pte_ops *ops = vgpu->gvt->gtt.pte_ops;
-	struct intel_gvt_gtt_entry old_se;
+	struct intel_gvt_gtt_entry old_se[GTT_64K_PTE_STRIDE];
+	unsigned long i, count = 1;
 	int new_present;
 	int ret;
 
+	/*
+	 * A 64K page is described by the first of its 16 entries and is
+	 * shadowed by 16 4K entries.
+	 */
+	if (spt->guest_page.pde_ips) {
+		if (index % GTT_64K_PTE_STRIDE)
+			return 0;
+		count = GTT_64K_PTE_STRIDE;
+	}
+
 	new_present = ops->test_present(we);
 
 	/*
@@ -1285,7 +1890,8 @@ static int ppgtt_handle_guest_write_page_table(
 	 * guarantee the ppgtt table is validated during the window between
 	 * adding and removal.
 	 */
-	ppgtt_get_shadow_entry(spt, &old_se, index);
+	for (i = 0; i < count; i++)
+		ppgtt_get_shadow_entry(spt, &old_se[i], index + i);
 
 	if (new_present) {
 		ret = ppgtt_handle_guest_entry_add(spt, we, index);
@@ -1293,13 +1899,17 @@ static int ppgtt_handle_guest_write_page_table(
 			goto fail;
 	}
 
-	ret = ppgtt_handle_guest_entry_removal(spt, &old_se, index);
-	if (ret)
-		goto fail;
+	for (i = 0; i < count; i++) {
+		ret = ppgtt_handle_guest_entry_removal(spt, &old_se[i],
+						       index + i);
+		if (ret)
+			goto fail;
 
-	if (!new_present) {
-		ops->set_pfn(&old_se, vgpu->gtt.scratch_pt[type].page_mfn);
-		ppgtt_set_shadow_entry(spt, &old_se, index);
+		if (!new_present) {
+			ops->set_pfn(&old_se[i],
+				     vgpu->gtt.scratch_pt[type].page_mfn);
+			ppgtt_set_shadow_entry(spt, &old_se[i], index + i);
+		}
 	}
 
 	return 0;
@@ -1313,9 +1923,10 @@ static int ppgtt_handle_guest_write_page_table(
 
 static inline bool can_do_out_of_sync(struct intel_vgpu_ppgtt_spt *spt)
 {
-	return enable_out_of_sync
+	return i915_modparams.enable_gvt_oos
 		&& gtt_type_is_pte_pt(spt->guest_page.type)
-		&& spt->guest_page.write_cnt >= 2;
+		&& !spt->guest_page.pde_ips
+		&& spt->guest_page.write_cnt >= oos_hot_writes();
 }
 
 static void ppgtt_set_post_shadow(struct intel_vgpu_ppgtt_spt *spt,
@@ -1341,29 +1952,62 @@ static void ppgtt_set_post_shadow(struct intel_vgpu_ppgtt_spt *spt,
  */
 int intel_vgpu_flush_post_shadow(struct intel_vgpu *vgpu)
 {
+	const struct intel_gvt_device_info *info = &vgpu->gvt->device_info;
+	struct intel_gvt_gtt_pte_ops *ops = vgpu->gvt->gtt.pte_ops;
 	struct list_head *pos, *n;
 	struct intel_vgpu_ppgtt_spt *spt;
 	struct intel_gvt_gtt_entry ge;
-	unsigned long index;
-	int ret;
+	unsigned long index, first, last;
+	void *buf;
+	int ret = 0;
+
+	if (list_empty(&vgpu->gtt.post_shadow_list_head))
+		return 0;
+
+	buf = kmalloc(I915_GTT_PAGE_SIZE, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
 
 	list_for_each_safe(pos, n, &vgpu->gtt.post_shadow_list_head) {
 		spt = container_of(pos, struct intel_vgpu_ppgtt_spt,
 				post_shadow_list);
 
+		/*
+		 * Read all the dirty entries of a guest page table at once
+		 * rather than going to the hypervisor for each of them.
+		 */
+		first = find_first_bit(spt->post_shadow_bitmap,
+				       GTT_ENTRY_NUM_IN_ONE_PAGE);
+		last = find_last_bit(spt->post_shadow_bitmap,
+				     GTT_ENTRY_NUM_IN_ONE_PAGE);
+		if (first < GTT_ENTRY_NUM_IN_ONE_PAGE) {
+			ret = intel_gvt_hypervisor_read_gpa(vgpu,
+				(spt->guest_page.gfn << I915_GTT_PAGE_SHIFT) +
+				(first << info->gtt_entry_size_shift),
+				buf + (first << info->gtt_entry_size_shift),
+				(last - first + 1) << info->gtt_entry_size_shift);
+			if (ret)
+				goto out;
+		}
+
 		for_each_set_bit(index, spt->post_shadow_bitmap,
 				GTT_ENTRY_NUM_IN_ONE_PAGE) {
-			ppgtt_get_guest_entry(spt, &ge, index);
+			ge.type = get_entry_type(spt->guest_page.type);
+			ops->get_entry(buf, &ge, index, false, 0, vgpu);
+			ops->test_pse(&ge);
+			ppgtt_update_guest_entry_type(spt, &ge);
 
 			ret = ppgtt_handle_guest_write_page_table(spt,
 							&ge, index);
 			if (ret)
-				return ret;
+				goto out;
 			clear_bit(index, spt->post_shadow_bitmap);
 		}
 		list_del_init(&spt->post_shadow_list);
 	}
-	return 0;
+out:
+	kfree(buf);
+	return ret;
 }
 
 static int ppgtt_handle_guest_write_page_table_bytes(
@@ -1379,6 +2023,8 @@ static int ppgtt_handle_guest_write_page_table_bytes(
 
 	index = (pa & (PAGE_SIZE - 1)) >> info->gtt_entry_size_shift;
 
+	vgpu->gtt.oos_stats.wp_writes++;
+
 	ppgtt_get_guest_entry(spt, &we, index);
 
 	ops->test_pse(&we);
@@ -1387,21 +2033,29 @@ static int ppgtt_handle_guest_write_page_table_bytes(
 		ret = ppgtt_handle_guest_write_page_table(spt, &we, index);
 		if (ret)
 			return ret;
-	} else {
+	} else if (!spt->guest_page.pde_ips ||
+		   !(index % GTT_64K_PTE_STRIDE)) {
 		if (!test_bit(index, spt->post_shadow_bitmap)) {
 			int type = spt->shadow_page.type;
-
-			ppgtt_get_shadow_entry(spt, &se, index);
-			ret = ppgtt_handle_guest_entry_removal(spt, &se, index);
-			if (ret)
-				return ret;
-			ops->set_pfn(&se, vgpu->gtt.scratch_pt[type].page_mfn);
-			ppgtt_set_shadow_entry(spt, &se, index);
+			unsigned long i, count = spt->guest_page.pde_ips ?
+				GTT_64K_PTE_STRIDE : 1;
+
+			for (i = 0; i < count; i++) {
+				ppgtt_get_shadow_entry(spt, &se, index + i);
+				ret = ppgtt_handle_guest_entry_removal(spt,
+							&se, index + i);
+				if (ret)
+					return ret;
+				ops->set_pfn(&se,
+					vgpu->gtt.scratch_pt[type].page_mfn);
+				ppgtt_set_shadow_entry(spt, &se, index + i);
+			}
 		}
 		ppgtt_set_post_shadow(spt, index);
 	}
 
-	if (!enable_out_of_sync)
+	/* Page tables of PV guests are not write protected to begin with. */
+	if (!i915_modparams.enable_gvt_oos || vgpu->gtt.pv_ring_gpa)
 		return 0;
 
 	spt->guest_page.write_cnt++;
@@ -1411,8 +2065,10 @@ static int ppgtt_handle_guest_write_page_table_bytes(
 				false, 0, vgpu);
 
 	if (can_do_out_of_sync(spt)) {
-		if (!spt->guest_page.oos_page)
-			ppgtt_allocate_oos_page(spt);
+		/* Keep the page write-protected if no oos page is available. */
+		if (!spt->guest_page.oos_page &&
+		    ppgtt_allocate_oos_page(spt))
+			return 0;
 
 		ret = ppgtt_set_guest_page_oos(spt);
 		if (ret < 0)
@@ -1421,6 +2077,136 @@ static int ppgtt_handle_guest_write_page_table_bytes(
 	return 0;
 }
 
+/**
+ * intel_vgpu_register_pv_ppgtt - set the PPGTT update ring of a PV guest
+ * @vgpu: a vGPU
+ * @gpa: guest physical address of the ring, 0 to drop it
+ *
+ * Page tables shadowed from now on are not write protected, the guest
+ * logs its page table writes in the ring instead. The ring is consumed
+ * before each submission, or when the guest asks for it once full.
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+int intel_vgpu_register_pv_ppgtt(struct intel_vgpu *vgpu, u64 gpa)
+{
+	struct vgt_pv_ppgtt_ring ring = {};
+	int ret;
+
+	if (vgpu->gtt.pv_ring_gpa)
+		intel_vgpu_sync_pv_ppgtt(vgpu);
+	vgpu->gtt.pv_ring_gpa = 0;
+
+	if (!gpa)
+		return 0;
+
+	if (!IS_ALIGNED(gpa, PAGE_SIZE) ||
+	    !intel_gvt_hypervisor_is_valid_gfn(vgpu, gpa >> PAGE_SHIFT)) {
+		gvt_vgpu_err("invalid PV PPGTT ring 0x%llx\n", gpa);
+		return -EINVAL;
+	}
+
+	ret = intel_gvt_hypervisor_write_gpa(vgpu, gpa, &ring,
+			offsetof(struct vgt_pv_ppgtt_ring, entry));
+	if (ret)
+		return ret;
+
+	vgpu->gtt.pv_ring_gpa = gpa;
+	return 0;
+}
+
+static int sync_pv_ppgtt_update(struct intel_vgpu *vgpu,
+				const struct vgt_pv_ppgtt_update *update)
+{
+	const struct intel_gvt_device_info *info = &vgpu->gvt->device_info;
+	unsigned long index = (update->gpa & (PAGE_SIZE - 1)) >>
+			      info->gtt_entry_size_shift;
+	struct intel_vgpu_page_track *track;
+	struct intel_vgpu_ppgtt_spt *spt;
+	unsigned long i, count;
+	int ret;
+
+	/* Write protected page tables were updated when they got trapped. */
+	track = intel_vgpu_find_page_track(vgpu, update->gpa >> PAGE_SHIFT);
+	if (!track || track->tracked ||
+	    track->handler != ppgtt_write_protection_handler)
+		return 0;
+	spt = track->priv_data;
+
+	count = min_t(unsigned long, update->count,
+		      (PAGE_SIZE >> info->gtt_entry_size_shift) - index);
+	for (i = 0; i < count; i++) {
+		ret = ppgtt_handle_guest_write_page_table_bytes(spt,
+				update->gpa + (i << info->gtt_entry_size_shift),
+				NULL, info->gtt_entry_size);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/**
+ * intel_vgpu_sync_pv_ppgtt - apply the page table updates of a PV guest
+ * @vgpu: a vGPU
+ *
+ * This function is called before submitting a guest workload to host, to
+ * sync the shadow of the page tables the guest logged since the last call.
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+int intel_vgpu_sync_pv_ppgtt(struct intel_vgpu *vgpu)
+{
+	u64 gpa = vgpu->gtt.pv_ring_gpa;
+	struct vgt_pv_ppgtt_update batch[16];
+	u32 head, tail, pos, n, i;
+	int ret;
+
+	if (!gpa)
+		return 0;
+
+	ret = intel_gvt_hypervisor_read_gpa(vgpu,
+			gpa + offsetof(struct vgt_pv_ppgtt_ring, head),
+			&head, sizeof(head));
+	if (!ret)
+		ret = intel_gvt_hypervisor_read_gpa(vgpu,
+			gpa + offsetof(struct vgt_pv_ppgtt_ring, tail),
+			&tail, sizeof(tail));
+	if (ret)
+		return ret;
+
+	if (tail - head > VGT_PV_PPGTT_RING_ENTRIES) {
+		gvt_vgpu_err("PV PPGTT ring overflow, head %u tail %u\n",
+			     head, tail);
+		head = tail - VGT_PV_PPGTT_RING_ENTRIES;
+	}
+
+	while (head != tail) {
+		pos = head % VGT_PV_PPGTT_RING_ENTRIES;
+		n = min3(tail - head, VGT_PV_PPGTT_RING_ENTRIES - pos,
+			 (u32)ARRAY_SIZE(batch));
+
+		ret = intel_gvt_hypervisor_read_gpa(vgpu,
+				gpa + offsetof(struct vgt_pv_ppgtt_ring,
+					       entry[pos]),
+				batch, n * sizeof(batch[0]));
+		if (ret)
+			return ret;
+
+		for (i = 0; i < n; i++) {
+			ret = sync_pv_ppgtt_update(vgpu, &batch[i]);
+			if (ret)
+				return ret;
+		}
+		head += n;
+	}
+
+	return intel_gvt_hypervisor_write_gpa(vgpu,
+			gpa + offsetof(struct vgt_pv_ppgtt_ring, head),
+			&head, sizeof(head));
+}
+
 static void invalidate_ppgtt_mm(struct intel_vgpu_mm *mm)
 {
 	struct intel_vgpu *vgpu = mm->vgpu;
@@ -1498,7 +2284,7 @@ static struct intel_vgpu_mm *vgpu_alloc_mm(struct intel_vgpu *vgpu)
 {
 	struct intel_vgpu_mm *mm;
 
-	mm = kzalloc(sizeof(*mm), GFP_KERNEL);
+	mm = kzalloc(sizeof(*mm), GFP_KERNEL_ACCOUNT);
 	if (!mm)
 		return NULL;
 
@@ -1551,15 +2337,29 @@ struct intel_vgpu_mm *intel_vgpu_create_ppgtt_mm(struct intel_vgpu *vgpu,
 		memcpy(mm->ppgtt_mm.guest_pdps, pdps,
 		       sizeof(mm->ppgtt_mm.guest_pdps));
 
-	ret = shadow_ppgtt_mm(mm);
-	if (ret) {
-		gvt_vgpu_err("failed to shadow ppgtt mm\n");
-		vgpu_free_mm(mm);
-		return ERR_PTR(ret);
+	/*
+	 * In lazy mode the page tables are only shadowed when the mm is
+	 * pinned for a workload or when a GMA is translated through it, so
+	 * that a guest creating many address spaces it never submits to
+	 * doesn't pay for shadowing all of them.
+	 */
+	if (!i915_modparams.enable_gvt_lazy_ppgtt) {
+		ret = shadow_ppgtt_mm(mm);
+		if (ret) {
+			gvt_vgpu_err("failed to shadow ppgtt mm\n");
+			vgpu_free_mm(mm);
+			return ERR_PTR(ret);
+		}
 	}
 
 	list_add_tail(&mm->ppgtt_mm.list, &vgpu->gtt.ppgtt_mm_list_head);
+	hash_add(vgpu->gtt.ppgtt_mm_table, &mm->ppgtt_mm.node,
+		 mm->ppgtt_mm.guest_pdps[0]);
+
+	mutex_lock(&gvt->gtt.ppgtt_mm_lock);
 	list_add_tail(&mm->ppgtt_mm.lru_list, &gvt->gtt.ppgtt_mm_lru_list_head);
+	mutex_unlock(&gvt->gtt.ppgtt_mm_lock);
+
 	return mm;
 }
 
@@ -1601,7 +2401,14 @@ void _intel_vgpu_mm_release(struct kref *mm_ref)
 
 	if (mm->type == INTEL_GVT_MM_PPGTT) {
 		list_del(&mm->ppgtt_mm.list);
+		hash_del(&mm->ppgtt_mm.node);
+		if (mm->vgpu->gtt.last_ppgtt_mm == mm)
+			mm->vgpu->gtt.last_ppgtt_mm = NULL;
+
+		mutex_lock(&mm->vgpu->gvt->gtt.ppgtt_mm_lock);
 		list_del(&mm->ppgtt_mm.lru_list);
+		mutex_unlock(&mm->vgpu->gvt->gtt.ppgtt_mm_lock);
+
 		invalidate_ppgtt_mm(mm);
 	} else {
 		vfree(mm->ggtt_mm.virtual_ggtt);
@@ -1643,37 +2450,131 @@ int intel_vgpu_pin_mm(struct intel_vgpu_mm *mm)
 		if (ret)
 			return ret;
 
+		mutex_lock(&mm->vgpu->gvt->gtt.ppgtt_mm_lock);
 		list_move_tail(&mm->ppgtt_mm.lru_list,
 			       &mm->vgpu->gvt->gtt.ppgtt_mm_lru_list_head);
-
+		mutex_unlock(&mm->vgpu->gvt->gtt.ppgtt_mm_lock);
 	}
 
 	return 0;
 }
 
-static int reclaim_one_ppgtt_mm(struct intel_gvt *gvt)
+static int reclaim_one_ppgtt_mm(struct intel_vgpu *vgpu, bool own)
 {
+	struct intel_gvt *gvt = vgpu->gvt;
 	struct intel_vgpu_mm *mm;
 	struct list_head *pos, *n;
+	int ret = 0;
+
+	mutex_lock(&gvt->gtt.ppgtt_mm_lock);
 
 	list_for_each_safe(pos, n, &gvt->gtt.ppgtt_mm_lru_list_head) {
 		mm = container_of(pos, struct intel_vgpu_mm, ppgtt_mm.lru_list);
 
-		if (atomic_read(&mm->pincount))
+		if (atomic_read(&mm->pincount) || (own && mm->vgpu != vgpu))
+			continue;
+
+		/*
+		 * The page table being shadowed may belong to any unpinned mm
+		 * of @vgpu, which must stay until the write is handled.
+		 */
+		if (mm->vgpu == vgpu && vgpu->gtt.populating)
+			continue;
+
+		/*
+		 * The caller holds the vgpu_lock of @vgpu. The mm of other
+		 * vGPUs can only be reclaimed when their vgpu_lock is free,
+		 * otherwise just skip to the next one.
+		 */
+		if (mm->vgpu != vgpu && !mutex_trylock(&mm->vgpu->vgpu_lock))
 			continue;
 
 		list_del_init(&mm->ppgtt_mm.lru_list);
 		invalidate_ppgtt_mm(mm);
-		return 1;
+
+		if (mm->vgpu != vgpu)
+			mutex_unlock(&mm->vgpu->vgpu_lock);
+		ret = 1;
+		break;
 	}
-	return 0;
+
+	mutex_unlock(&gvt->gtt.ppgtt_mm_lock);
+	return ret;
+}
+
+static unsigned long
+ppgtt_shrinker_count(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct intel_gvt *gvt =
+		container_of(shrinker, struct intel_gvt, gtt.shrinker);
+
+	/* Pinned mm can't be reclaimed, so this is an upper bound. */
+	return atomic_read(&gvt->gtt.num_spt);
+}
+
+static void ppgtt_shrink_work(struct work_struct *work)
+{
+	struct intel_gvt *gvt =
+		container_of(work, struct intel_gvt, gtt.shrink_work);
+	long nr_to_scan = atomic_long_xchg(&gvt->gtt.nr_to_shrink, 0);
+	struct intel_vgpu_mm *mm;
+	struct list_head *pos, *n;
+	long freed = 0;
+	int before;
+
+	mutex_lock(&gvt->gtt.ppgtt_mm_lock);
+
+	list_for_each_safe(pos, n, &gvt->gtt.ppgtt_mm_lru_list_head) {
+		mm = container_of(pos, struct intel_vgpu_mm, ppgtt_mm.lru_list);
+
+		if (freed >= nr_to_scan)
+			break;
+
+		if (!mm->ppgtt_mm.shadowed || atomic_read(&mm->pincount))
+			continue;
+
+		/* The vgpu_lock nests outside of ppgtt_mm_lock. */
+		if (!mutex_trylock(&mm->vgpu->vgpu_lock))
+			continue;
+
+		/* Check again, the mm could have been pinned meanwhile. */
+		if (!atomic_read(&mm->pincount)) {
+			before = atomic_read(&gvt->gtt.num_spt);
+			list_del_init(&mm->ppgtt_mm.lru_list);
+			invalidate_ppgtt_mm(mm);
+			freed += max(before - atomic_read(&gvt->gtt.num_spt), 0);
+		}
+		/* Give the pooled shadow pages back as well. */
+		drain_spt_page_pool(mm->vgpu);
+
+		mutex_unlock(&mm->vgpu->vgpu_lock);
+	}
+
+	mutex_unlock(&gvt->gtt.ppgtt_mm_lock);
+}
+
+static unsigned long
+ppgtt_shrinker_scan(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct intel_gvt *gvt =
+		container_of(shrinker, struct intel_gvt, gtt.shrinker);
+
+	/*
+	 * Invalidating a shadow PPGTT takes the hypervisor's and the OOS
+	 * page locks, which are held across GFP_KERNEL allocations, so it
+	 * can't be done from reclaim. Leave it to a work.
+	 */
+	atomic_long_add(sc->nr_to_scan, &gvt->gtt.nr_to_shrink);
+	schedule_work(&gvt->gtt.shrink_work);
+	return SHRINK_STOP;
 }
 
 /*
  * GMA translation APIs.
  */
 static inline int ppgtt_get_next_level_entry(struct intel_vgpu_mm *mm,
-		struct intel_gvt_gtt_entry *e, unsigned long index, bool guest)
+		struct intel_gvt_gtt_entry *e, unsigned long index, bool guest,
+		struct intel_vgpu_ppgtt_spt **spt)
 {
 	struct intel_vgpu *vgpu = mm->vgpu;
 	struct intel_gvt_gtt_pte_ops *ops = vgpu->gvt->gtt.pte_ops;
@@ -1687,9 +2588,29 @@ static inline int ppgtt_get_next_level_entry(struct intel_vgpu_mm *mm,
 		ppgtt_get_shadow_entry(s, e, index);
 	else
 		ppgtt_get_guest_entry(s, e, index);
+	*spt = s;
 	return 0;
 }
 
+/*
+ * Check if a shadow PDE maps a guest 2M page, either with a 2M shadow entry
+ * or with a split shadow page table which has no guest page behind it.
+ */
+static bool ppgtt_shadow_entry_is_2M(struct intel_vgpu *vgpu,
+		struct intel_gvt_gtt_entry *e)
+{
+	struct intel_gvt_gtt_pte_ops *ops = vgpu->gvt->gtt.pte_ops;
+	struct intel_vgpu_ppgtt_spt *s;
+
+	if (e->type == GTT_TYPE_PPGTT_PTE_2M_ENTRY)
+		return true;
+	if (e->type != GTT_TYPE_PPGTT_PDE_ENTRY)
+		return false;
+
+	s = intel_vgpu_find_spt_by_mfn(vgpu, ops->get_pfn(e));
+	return s && s->guest_page.type == GTT_TYPE_INVALID;
+}
+
 /**
  * intel_vgpu_gma_to_gpa - translate a gma to GPA
  * @mm: mm object. could be a PPGTT or GGTT mm object
@@ -1709,7 +2630,9 @@ unsigned long intel_vgpu_gma_to_gpa(struct intel_vgpu_mm *mm, unsigned long gma)
 	struct intel_gvt_gtt_gma_ops *gma_ops = gvt->gtt.gma_ops;
 	unsigned long gpa = INTEL_GVT_INVALID_ADDR;
 	unsigned long gma_index[4];
+	struct intel_vgpu_ppgtt_spt *s;
 	struct intel_gvt_gtt_entry e;
+	unsigned long offset_mask;
 	int i, levels = 0;
 	int ret;
 
@@ -1728,6 +2651,11 @@ unsigned long intel_vgpu_gma_to_gpa(struct intel_vgpu_mm *mm, unsigned long gma)
 
 		trace_gma_translate(vgpu->id, "ggtt", 0, 0, gma, gpa);
 	} else {
+		/* The mm may not be shadowed yet, or have been reclaimed. */
+		ret = shadow_ppgtt_mm(mm);
+		if (ret)
+			goto err;
+
 		switch (mm->ppgtt_mm.root_entry_type) {
 		case GTT_TYPE_PPGTT_ROOT_L4_ENTRY:
 			ppgtt_get_shadow_root_entry(mm, &e, 0);
@@ -1753,7 +2681,7 @@ unsigned long intel_vgpu_gma_to_gpa(struct intel_vgpu_mm *mm, unsigned long gma)
 		/* walk the shadow page table and get gpa from guest entry */
 		for (i = 0; i < levels; i++) {
 			ret = ppgtt_get_next_level_entry(mm, &e, gma_index[i],
-				(i == levels - 1));
+				(i == levels - 1), &s);
 			if (ret)
 				goto err;
 
@@ -1761,10 +2689,24 @@ unsigned long intel_vgpu_gma_to_gpa(struct intel_vgpu_mm *mm, unsigned long gma)
 				gvt_dbg_core("GMA 0x%lx is not present\n", gma);
 				goto err;
 			}
+
+			/* A guest 2M page ends the walk one level earlier. */
+			if (i == levels - 2 &&
+			    ppgtt_shadow_entry_is_2M(vgpu, &e)) {
+				ppgtt_get_guest_entry(s, &e, gma_index[i]);
+				break;
+			}
 		}
 
+		if (e.type == GTT_TYPE_PPGTT_PTE_2M_ENTRY)
+			offset_mask = I915_GTT_PAGE_SIZE_2M - 1;
+		else if (e.type == GTT_TYPE_PPGTT_PTE_64K_ENTRY)
+			offset_mask = I915_GTT_PAGE_SIZE_64K - 1;
+		else
+			offset_mask = ~I915_GTT_PAGE_MASK;
+
 		gpa = (pte_ops->get_pfn(&e) << I915_GTT_PAGE_SHIFT) +
-					(gma & ~I915_GTT_PAGE_MASK);
+					(gma & offset_mask);
 		trace_gma_translate(vgpu->id, "ppgtt", 0,
 				    mm->ppgtt_mm.root_entry_type, gma, gpa);
 	}
@@ -1818,6 +2760,92 @@ int intel_vgpu_emulate_ggtt_mmio_read(struct intel_vgpu *vgpu, unsigned int off,
 	return ret;
 }
 
+static void ggtt_commit_entry(struct intel_vgpu *vgpu, unsigned long index,
+		struct intel_gvt_gtt_entry *e, struct intel_gvt_gtt_entry *m)
+{
+	struct intel_vgpu_mm *ggtt_mm = vgpu->gtt.ggtt_mm;
+
+	ggtt_set_host_entry(ggtt_mm, m, index);
+	WRITE_ONCE(vgpu->gtt.ggtt_gen, vgpu->gtt.ggtt_gen + 1);
+	/*
+	 * The guest flushes the GGTT itself after a batch of updates, so the
+	 * host invalidation is deferred to that flush or to the next
+	 * workload submission instead of being done for every entry.
+	 */
+	vgpu->gtt.ggtt_dirty = true;
+	ggtt_set_guest_entry(ggtt_mm, e, index);
+	intel_vgpu_fb_damage_ggtt(vgpu, index << I915_GTT_PAGE_SHIFT);
+}
+
+/*
+ * GGTT readahead
+ *
+ * A guest binding an object writes its GGTT entries one after the other,
+ * and mostly with guest pages that follow each other too. Once two entries
+ * in a row point at consecutive guest pages, the next GGTT_RA_PAGES pages
+ * are mapped for DMA in one batch, and the writes that go on with the run
+ * take their DMA address from this window instead of mapping the page on
+ * their own. The window holds a reference on each page it hasn't handed out
+ * yet, they are dropped by the first write that breaks the run.
+ */
+static void ggtt_ra_drop(struct intel_vgpu *vgpu)
+{
+	struct intel_vgpu_ggtt_ra *ra = &vgpu->gtt.ggtt_ra;
+
+	while (ra->head < ra->count)
+		intel_gvt_hypervisor_dma_unmap_guest_page(vgpu,
+				ra->dma_addrs[ra->head++], PAGE_SIZE);
+	ra->head = ra->count = 0;
+}
+
+static bool ggtt_ra_take(struct intel_vgpu *vgpu, unsigned long index,
+		unsigned long gfn, dma_addr_t *dma_addr)
+{
+	struct intel_vgpu_ggtt_ra *ra = &vgpu->gtt.ggtt_ra;
+
+	if (ra->head == ra->count)
+		return false;
+
+	if (index == ra->last_index + 1 && gfn == ra->gfn + ra->head) {
+		*dma_addr = ra->dma_addrs[ra->head++];
+		return true;
+	}
+
+	/* an entry written in two halves doesn't break the run */
+	if (index != ra->last_index)
+		ggtt_ra_drop(vgpu);
+	return false;
+}
+
+static void ggtt_ra_update(struct intel_vgpu *vgpu, unsigned long index,
+		unsigned long gfn)
+{
+	struct intel_vgpu_ggtt_ra *ra = &vgpu->gtt.ggtt_ra;
+	unsigned long gfns[GGTT_RA_PAGES];
+	bool sequential;
+	unsigned int n;
+
+	sequential = index == ra->last_index + 1 && gfn == ra->last_gfn + 1;
+	ra->last_index = index;
+	ra->last_gfn = gfn;
+
+	if (!sequential || ra->head < ra->count)
+		return;
+
+	for (n = 0; n < GGTT_RA_PAGES; n++) {
+		gfns[n] = gfn + 1 + n;
+		if (!intel_gvt_hypervisor_is_valid_gfn(vgpu, gfns[n]))
+			break;
+	}
+
+	ra->head = ra->count = 0;
+	if (n && !intel_gvt_hypervisor_dma_map_guest_pages(vgpu, gfns, n,
+							   ra->dma_addrs)) {
+		ra->gfn = gfn + 1;
+		ra->count = n;
+	}
+}
+
 static int emulate_ggtt_mmio_write(struct intel_vgpu *vgpu, unsigned int off,
 	void *p_data, unsigned int bytes)
 {
@@ -1840,6 +2868,9 @@ static int emulate_ggtt_mmio_write(struct intel_vgpu *vgpu, unsigned int off,
 	if (!vgpu_gmadr_is_valid(vgpu, gma))
 		return 0;
 
+	if (unlikely(vgpu->gtt.ggtt_save_bitmap))
+		set_bit(g_gtt_index, vgpu->gtt.ggtt_save_bitmap);
+
 	ggtt_get_guest_entry(ggtt_mm, &e, g_gtt_index);
 
 	memcpy((void *)&e.val64 + (off & (info->gtt_entry_size - 1)), p_data,
@@ -1857,8 +2888,11 @@ static int emulate_ggtt_mmio_write(struct intel_vgpu *vgpu, unsigned int off,
 			goto out;
 		}
 
-		ret = intel_gvt_hypervisor_dma_map_guest_page(vgpu, gfn,
-							      &dma_addr);
+		if (ggtt_ra_take(vgpu, g_gtt_index, gfn, &dma_addr))
+			ret = 0;
+		else
+			ret = intel_gvt_hypervisor_dma_map_guest_page(vgpu,
+						gfn, PAGE_SIZE, &dma_addr);
 		if (ret) {
 			gvt_vgpu_err("fail to populate guest ggtt entry\n");
 			/* guest driver may read/write the entry when partial
@@ -1866,18 +2900,132 @@ static int emulate_ggtt_mmio_write(struct intel_vgpu *vgpu, unsigned int off,
 			 * settting the shadow entry to point to a scratch page
 			 */
 			ops->set_pfn(&m, gvt->gtt.scratch_mfn);
-		} else
+		} else {
 			ops->set_pfn(&m, dma_addr >> PAGE_SHIFT);
+			ggtt_ra_update(vgpu, g_gtt_index, gfn);
+		}
 	} else
 		ops->set_pfn(&m, gvt->gtt.scratch_mfn);
 
 out:
-	ggtt_set_host_entry(ggtt_mm, &m, g_gtt_index);
-	ggtt_invalidate(gvt->dev_priv);
-	ggtt_set_guest_entry(ggtt_mm, &e, g_gtt_index);
+	ggtt_commit_entry(vgpu, g_gtt_index, &e, &m);
 	return 0;
 }
 
+/**
+ * intel_vgpu_emulate_ggtt_bulk_rw - emulate an access to many GGTT entries
+ * @vgpu: a vGPU
+ * @off: register offset of the first entry
+ * @p_data: the entries
+ * @bytes: data length, a multiple of the entry size
+ * @is_write: write or read
+ *
+ * Unlike a guest access, a bulk access from the VMM during restore or save
+ * only writes whole entries, so the guest pages of a bulk write are mapped
+ * for DMA in one batch. The GGTT is invalidated once at the end. The caller
+ * must hold the vgpu_lock.
+ *
+ * Returns:
+ * Zero on success, error code if failed.
+ */
+int intel_vgpu_emulate_ggtt_bulk_rw(struct intel_vgpu *vgpu, unsigned int off,
+		void *p_data, unsigned int bytes, bool is_write)
+{
+	struct intel_gvt *gvt = vgpu->gvt;
+	const struct intel_gvt_device_info *info = &gvt->device_info;
+	struct intel_gvt_gtt_pte_ops *ops = gvt->gtt.pte_ops;
+	unsigned int size = info->gtt_entry_size;
+	unsigned int i, n = bytes / size, nr_gfns = 0;
+	unsigned long index, gma, *gfns = NULL;
+	struct intel_gvt_gtt_entry e, m;
+	dma_addr_t *dma_addrs = NULL;
+	int ret = 0;
+
+	lockdep_assert_held(&vgpu->vgpu_lock);
+
+	off -= info->gtt_start_offset;
+	if (!IS_ALIGNED(off, size) || !IS_ALIGNED(bytes, size))
+		return -EINVAL;
+
+	if (!is_write) {
+		for (i = 0; i < n && !ret; i++)
+			ret = emulate_ggtt_mmio_read(vgpu, off + i * size,
+					p_data + i * size, size);
+		return ret;
+	}
+
+	gfns = kmalloc_array(n, sizeof(*gfns), GFP_KERNEL);
+	dma_addrs = kmalloc_array(n, sizeof(*dma_addrs), GFP_KERNEL);
+	if (!gfns || !dma_addrs)
+		goto slow;
+
+	index = off >> info->gtt_entry_size_shift;
+	for (i = 0; i < n; i++) {
+		gma = (index + i) << I915_GTT_PAGE_SHIFT;
+		if (!vgpu_gmadr_is_valid(vgpu, gma))
+			continue;
+
+		e.type = GTT_TYPE_GGTT_PTE;
+		memcpy(&e.val64, p_data + i * size, size);
+		if (ops->test_present(&e) &&
+		    intel_gvt_hypervisor_is_valid_gfn(vgpu, ops->get_pfn(&e)))
+			gfns[nr_gfns++] = ops->get_pfn(&e);
+	}
+
+	if (intel_gvt_hypervisor_dma_map_guest_pages(vgpu, gfns, nr_gfns,
+						     dma_addrs))
+		goto slow;
+
+	nr_gfns = 0;
+	for (i = 0; i < n; i++) {
+		gma = (index + i) << I915_GTT_PAGE_SHIFT;
+		if (!vgpu_gmadr_is_valid(vgpu, gma))
+			continue;
+
+		if (unlikely(vgpu->gtt.ggtt_save_bitmap))
+			set_bit(index + i, vgpu->gtt.ggtt_save_bitmap);
+
+		e.type = GTT_TYPE_GGTT_PTE;
+		memcpy(&e.val64, p_data + i * size, size);
+		m = e;
+		if (ops->test_present(&e) &&
+		    intel_gvt_hypervisor_is_valid_gfn(vgpu, ops->get_pfn(&e)))
+			ops->set_pfn(&m, dma_addrs[nr_gfns++] >> PAGE_SHIFT);
+		else
+			ops->set_pfn(&m, gvt->gtt.scratch_mfn);
+
+		ggtt_commit_entry(vgpu, index + i, &e, &m);
+	}
+	goto out;
+
+slow:
+	for (i = 0; i < n && !ret; i++)
+		ret = emulate_ggtt_mmio_write(vgpu, off + i * size,
+				p_data + i * size, size);
+out:
+	intel_vgpu_flush_ggtt(vgpu);
+	kfree(dma_addrs);
+	kfree(gfns);
+	return ret;
+}
+
+/**
+ * intel_vgpu_flush_ggtt - flush the deferred GGTT updates of a vGPU
+ * @vgpu: a vGPU
+ *
+ * This function is called when the guest flushes the GGTT and before
+ * submitting a guest workload, to invalidate the GGTT entries written by
+ * the guest since the last flush.
+ */
+void intel_vgpu_flush_ggtt(struct intel_vgpu *vgpu)
+{
+	if (!vgpu->gtt.ggtt_dirty)
+		return;
+
+	ggtt_invalidate(vgpu->gvt->dev_priv);
+	vgpu->gtt.ggtt_dirty = false;
+}
+
 /*
  * intel_vgpu_emulate_ggtt_mmio_write - emulate GTT MMIO register write
  * @vgpu: a vGPU
@@ -1904,16 +3052,15 @@ int intel_vgpu_emulate_ggtt_mmio_write(struct intel_vgpu *vgpu,
 	return ret;
 }
 
-static int alloc_scratch_pages(struct intel_vgpu *vgpu,
-		intel_gvt_gtt_type_t type)
+static int alloc_scratch_pages(struct intel_gvt *gvt,
+		struct intel_vgpu_scratch_pt *tree, intel_gvt_gtt_type_t type)
 {
-	struct intel_vgpu_gtt *gtt = &vgpu->gtt;
-	struct intel_gvt_gtt_pte_ops *ops = vgpu->gvt->gtt.pte_ops;
+	struct intel_gvt_gtt_pte_ops *ops = gvt->gtt.pte_ops;
 	int page_entry_num = I915_GTT_PAGE_SIZE >>
-				vgpu->gvt->device_info.gtt_entry_size_shift;
+				gvt->device_info.gtt_entry_size_shift;
 	void *scratch_pt;
 	int i;
-	struct device *dev = &vgpu->gvt->dev_priv->drm.pdev->dev;
+	struct device *dev = &gvt->dev_priv->drm.pdev->dev;
 	dma_addr_t daddr;
 
 	if (WARN_ON(type < GTT_TYPE_PPGTT_PTE_PT || type >= GTT_TYPE_MAX))
@@ -1921,22 +3068,21 @@ static int alloc_scratch_pages(struct intel_vgpu *vgpu,
 
 	scratch_pt = (void *)get_zeroed_page(GFP_KERNEL);
 	if (!scratch_pt) {
-		gvt_vgpu_err("fail to allocate scratch page\n");
+		gvt_err("fail to allocate scratch page\n");
 		return -ENOMEM;
 	}
 
 	daddr = dma_map_page(dev, virt_to_page(scratch_pt), 0,
 			4096, PCI_DMA_BIDIRECTIONAL);
 	if (dma_mapping_error(dev, daddr)) {
-		gvt_vgpu_err("fail to dmamap scratch_pt\n");
+		gvt_err("fail to dmamap scratch_pt\n");
 		__free_page(virt_to_page(scratch_pt));
 		return -ENOMEM;
 	}
-	gtt->scratch_pt[type].page_mfn =
-		(unsigned long)(daddr >> I915_GTT_PAGE_SHIFT);
-	gtt->scratch_pt[type].page = virt_to_page(scratch_pt);
-	gvt_dbg_mm("vgpu%d create scratch_pt: type %d mfn=0x%lx\n",
-			vgpu->id, type, gtt->scratch_pt[type].page_mfn);
+	tree[type].page_mfn = (unsigned long)(daddr >> I915_GTT_PAGE_SHIFT);
+	tree[type].page = virt_to_page(scratch_pt);
+	gvt_dbg_mm("create scratch_pt: type %d mfn=0x%lx\n",
+			type, tree[type].page_mfn);
 
 	/* Build the tree by full filled the scratch pt with the entries which
 	 * point to the next level scratch pt or scratch page. The
@@ -1951,7 +3097,7 @@ static int alloc_scratch_pages(struct intel_vgpu *vgpu,
 
 		memset(&se, 0, sizeof(struct intel_gvt_gtt_entry));
 		se.type = get_entry_type(type - 1);
-		ops->set_pfn(&se, gtt->scratch_pt[type - 1].page_mfn);
+		ops->set_pfn(&se, tree[type - 1].page_mfn);
 
 		/* The entry parameters like present/writeable/cache type
 		 * set to the same as i915's scratch page tree.
@@ -1960,39 +3106,40 @@ static int alloc_scratch_pages(struct intel_vgpu *vgpu,
 		if (type == GTT_TYPE_PPGTT_PDE_PT)
 			se.val64 |= PPAT_CACHED;
 
+		/* the shared tree is built before any vGPU exists */
 		for (i = 0; i < page_entry_num; i++)
-			ops->set_entry(scratch_pt, &se, i, false, 0, vgpu);
+			((u64 *)scratch_pt)[i] = se.val64;
 	}
 
 	return 0;
 }
 
-static int release_scratch_page_tree(struct intel_vgpu *vgpu)
+static void release_scratch_page_tree(struct intel_gvt *gvt,
+		struct intel_vgpu_scratch_pt *tree)
 {
 	int i;
-	struct device *dev = &vgpu->gvt->dev_priv->drm.pdev->dev;
+	struct device *dev = &gvt->dev_priv->drm.pdev->dev;
 	dma_addr_t daddr;
 
 	for (i = GTT_TYPE_PPGTT_PTE_PT; i < GTT_TYPE_MAX; i++) {
-		if (vgpu->gtt.scratch_pt[i].page != NULL) {
-			daddr = (dma_addr_t)(vgpu->gtt.scratch_pt[i].page_mfn <<
+		if (tree[i].page != NULL) {
+			daddr = (dma_addr_t)(tree[i].page_mfn <<
 					I915_GTT_PAGE_SHIFT);
 			dma_unmap_page(dev, daddr, 4096, PCI_DMA_BIDIRECTIONAL);
-			__free_page(vgpu->gtt.scratch_pt[i].page);
-			vgpu->gtt.scratch_pt[i].page = NULL;
-			vgpu->gtt.scratch_pt[i].page_mfn = 0;
+			__free_page(tree[i].page);
+			tree[i].page = NULL;
+			tree[i].page_mfn = 0;
 		}
 	}
-
-	return 0;
 }
 
-static int create_scratch_page_tree(struct intel_vgpu *vgpu)
+static int create_scratch_page_tree(struct intel_gvt *gvt,
+		struct intel_vgpu_scratch_pt *tree)
 {
 	int i, ret;
 
 	for (i = GTT_TYPE_PPGTT_PTE_PT; i < GTT_TYPE_MAX; i++) {
-		ret = alloc_scratch_pages(vgpu, i);
+		ret = alloc_scratch_pages(gvt, tree, i);
 		if (ret)
 			goto err;
 	}
@@ -2000,7 +3147,7 @@ static int create_scratch_page_tree(struct intel_vgpu *vgpu)
 	return 0;
 
 err:
-	release_scratch_page_tree(vgpu);
+	release_scratch_page_tree(gvt, tree);
 	return ret;
 }
 
@@ -2021,6 +3168,8 @@ int intel_vgpu_init_gtt(struct intel_vgpu *vgpu)
 	INIT_RADIX_TREE(&gtt->spt_tree, GFP_KERNEL);
 
 	INIT_LIST_HEAD(&gtt->ppgtt_mm_list_head);
+	hash_init(gtt->ppgtt_mm_table);
+	INIT_LIST_HEAD(&gtt->spt_page_pool);
 	INIT_LIST_HEAD(&gtt->oos_page_list_head);
 	INIT_LIST_HEAD(&gtt->post_shadow_list_head);
 
@@ -2032,7 +3181,18 @@ int intel_vgpu_init_gtt(struct intel_vgpu *vgpu)
 
 	intel_vgpu_reset_ggtt(vgpu);
 
-	return create_scratch_page_tree(vgpu);
+	/*
+	 * The GPU only reads the scratch page tables, so by default all the
+	 * vGPUs point their invalid entries at the one of the GVT device.
+	 */
+	if (!i915_modparams.enable_gvt_private_scratch) {
+		memcpy(gtt->scratch_pt, vgpu->gvt->gtt.scratch_pt,
+		       sizeof(gtt->scratch_pt));
+		return 0;
+	}
+
+	gtt->private_scratch = true;
+	return create_scratch_page_tree(vgpu->gvt, gtt->scratch_pt);
 }
 
 static void intel_vgpu_destroy_all_ppgtt_mm(struct intel_vgpu *vgpu)
@@ -2072,9 +3232,14 @@ static void intel_vgpu_destroy_ggtt_mm(struct intel_vgpu *vgpu)
  */
 void intel_vgpu_clean_gtt(struct intel_vgpu *vgpu)
 {
+	ggtt_ra_drop(vgpu);
 	intel_vgpu_destroy_all_ppgtt_mm(vgpu);
 	intel_vgpu_destroy_ggtt_mm(vgpu);
-	release_scratch_page_tree(vgpu);
+	if (vgpu->gtt.private_scratch)
+		release_scratch_page_tree(vgpu->gvt, vgpu->gtt.scratch_pt);
+	drain_spt_page_pool(vgpu);
+	vfree(vgpu->gtt.ggtt_save_bitmap);
+	vgpu->gtt.ggtt_save_bitmap = NULL;
 }
 
 static void clean_spt_oos(struct intel_gvt *gvt)
@@ -2100,19 +3265,17 @@ static int setup_spt_oos(struct intel_gvt *gvt)
 	int i;
 	int ret;
 
+	mutex_init(&gtt->oos_page_lock);
 	INIT_LIST_HEAD(&gtt->oos_page_free_list_head);
 	INIT_LIST_HEAD(&gtt->oos_page_use_list_head);
 
 	for (i = 0; i < preallocated_oos_pages; i++) {
-		oos_page = kzalloc(sizeof(*oos_page), GFP_KERNEL);
+		oos_page = alloc_oos_page(gtt);
 		if (!oos_page) {
 			ret = -ENOMEM;
 			goto fail;
 		}
 
-		INIT_LIST_HEAD(&oos_page->list);
-		INIT_LIST_HEAD(&oos_page->vm_list);
-		oos_page->id = i;
 		list_add_tail(&oos_page->list, &gtt->oos_page_free_list_head);
 	}
 
@@ -2124,6 +3287,20 @@ static int setup_spt_oos(struct intel_gvt *gvt)
 	return ret;
 }
 
+static bool ppgtt_mm_match(struct intel_vgpu_mm *mm, u64 pdps[])
+{
+	switch (mm->ppgtt_mm.root_entry_type) {
+	case GTT_TYPE_PPGTT_ROOT_L4_ENTRY:
+		return pdps[0] == mm->ppgtt_mm.guest_pdps[0];
+	case GTT_TYPE_PPGTT_ROOT_L3_ENTRY:
+		return !memcmp(pdps, mm->ppgtt_mm.guest_pdps,
+			       sizeof(mm->ppgtt_mm.guest_pdps));
+	default:
+		GEM_BUG_ON(1);
+	}
+	return false;
+}
+
 /**
  * intel_vgpu_find_ppgtt_mm - find a PPGTT mm object
  * @vgpu: a vGPU
@@ -2138,24 +3315,17 @@ static int setup_spt_oos(struct intel_gvt *gvt)
 struct intel_vgpu_mm *intel_vgpu_find_ppgtt_mm(struct intel_vgpu *vgpu,
 		u64 pdps[])
 {
-	struct intel_vgpu_mm *mm;
-	struct list_head *pos;
+	struct intel_vgpu_mm *mm = vgpu->gtt.last_ppgtt_mm;
 
-	list_for_each(pos, &vgpu->gtt.ppgtt_mm_list_head) {
-		mm = container_of(pos, struct intel_vgpu_mm, ppgtt_mm.list);
+	/* Consecutive workloads mostly come from the same context. */
+	if (mm && ppgtt_mm_match(mm, pdps))
+		return mm;
 
-		switch (mm->ppgtt_mm.root_entry_type) {
-		case GTT_TYPE_PPGTT_ROOT_L4_ENTRY:
-			if (pdps[0] == mm->ppgtt_mm.guest_pdps[0])
-				return mm;
-			break;
-		case GTT_TYPE_PPGTT_ROOT_L3_ENTRY:
-			if (!memcmp(pdps, mm->ppgtt_mm.guest_pdps,
-				    sizeof(mm->ppgtt_mm.guest_pdps)))
-				return mm;
-			break;
-		default:
-			GEM_BUG_ON(1);
+	hash_for_each_possible(vgpu->gtt.ppgtt_mm_table, mm, ppgtt_mm.node,
+			       pdps[0]) {
+		if (ppgtt_mm_match(mm, pdps)) {
+			vgpu->gtt.last_ppgtt_mm = mm;
+			return mm;
 		}
 	}
 	return NULL;
@@ -2255,16 +3425,57 @@ int intel_gvt_init_gtt(struct intel_gvt *gvt)
 	gvt->gtt.scratch_page = virt_to_page(page);
 	gvt->gtt.scratch_mfn = (unsigned long)(daddr >> I915_GTT_PAGE_SHIFT);
 
-	if (enable_out_of_sync) {
+	gvt->gtt.spt_cache = kmem_cache_create("gvt-g_ppgtt_spt",
+			sizeof(struct intel_vgpu_ppgtt_spt), 0, SLAB_ACCOUNT, NULL);
+	if (!gvt->gtt.spt_cache) {
+		gvt_err("fail to create spt cache\n");
+		dma_unmap_page(dev, daddr, 4096, PCI_DMA_BIDIRECTIONAL);
+		__free_page(gvt->gtt.scratch_page);
+		return -ENOMEM;
+	}
+
+	if (i915_modparams.enable_gvt_oos) {
 		ret = setup_spt_oos(gvt);
 		if (ret) {
 			gvt_err("fail to initialize SPT oos\n");
+			kmem_cache_destroy(gvt->gtt.spt_cache);
 			dma_unmap_page(dev, daddr, 4096, PCI_DMA_BIDIRECTIONAL);
 			__free_page(gvt->gtt.scratch_page);
 			return ret;
 		}
 	}
+
+	ret = create_scratch_page_tree(gvt, gvt->gtt.scratch_pt);
+	if (ret) {
+		gvt_err("fail to create scratch page tree\n");
+		if (i915_modparams.enable_gvt_oos)
+			clean_spt_oos(gvt);
+		kmem_cache_destroy(gvt->gtt.spt_cache);
+		dma_unmap_page(dev, daddr, 4096, PCI_DMA_BIDIRECTIONAL);
+		__free_page(gvt->gtt.scratch_page);
+		return ret;
+	}
+
+	mutex_init(&gvt->gtt.ppgtt_mm_lock);
 	INIT_LIST_HEAD(&gvt->gtt.ppgtt_mm_lru_list_head);
+
+	/* Let the unpinned shadow PPGTTs go under host memory pressure. */
+	INIT_WORK(&gvt->gtt.shrink_work, ppgtt_shrink_work);
+	atomic_long_set(&gvt->gtt.nr_to_shrink, 0);
+	gvt->gtt.shrinker.count_objects = ppgtt_shrinker_count;
+	gvt->gtt.shrinker.scan_objects = ppgtt_shrinker_scan;
+	gvt->gtt.shrinker.seeks = DEFAULT_SEEKS;
+	ret = register_shrinker(&gvt->gtt.shrinker);
+	if (ret) {
+		gvt_err("fail to register ppgtt shrinker\n");
+		release_scratch_page_tree(gvt, gvt->gtt.scratch_pt);
+		if (i915_modparams.enable_gvt_oos)
+			clean_spt_oos(gvt);
+		kmem_cache_destroy(gvt->gtt.spt_cache);
+		dma_unmap_page(dev, daddr, 4096, PCI_DMA_BIDIRECTIONAL);
+		__free_page(gvt->gtt.scratch_page);
+		return ret;
+	}
 	return 0;
 }
 
@@ -2282,12 +3493,18 @@ void intel_gvt_clean_gtt(struct intel_gvt *gvt)
 	dma_addr_t daddr = (dma_addr_t)(gvt->gtt.scratch_mfn <<
 					I915_GTT_PAGE_SHIFT);
 
+	unregister_shrinker(&gvt->gtt.shrinker);
+	cancel_work_sync(&gvt->gtt.shrink_work);
+
+	release_scratch_page_tree(gvt, gvt->gtt.scratch_pt);
 	dma_unmap_page(dev, daddr, 4096, PCI_DMA_BIDIRECTIONAL);
 
 	__free_page(gvt->gtt.scratch_page);
 
-	if (enable_out_of_sync)
+	if (i915_modparams.enable_gvt_oos)
 		clean_spt_oos(gvt);
+
+	kmem_cache_destroy(gvt->gtt.spt_cache);
 }
 
 /**
@@ -2312,6 +3529,31 @@ void intel_vgpu_invalidate_ppgtt(struct intel_vgpu *vgpu)
 	}
 }
 
+/**
+ * intel_vgpu_set_spt_limit - limit the shadow page tables of a vGPU
+ * @vgpu: a vGPU
+ * @limit: number of shadow page tables, 0 for no limit
+ *
+ * Above @limit, the vGPU reclaims the shadow page tables of its own idle
+ * PPGTT mm before shadowing new guest page tables. The ones above a new
+ * limit are reclaimed right away as far as possible.
+ *
+ * Returns:
+ * Zero on success.
+ */
+int intel_vgpu_set_spt_limit(struct intel_vgpu *vgpu, unsigned int limit)
+{
+	mutex_lock(&vgpu->vgpu_lock);
+	vgpu->gtt.spt_limit = limit;
+	while (limit && vgpu->gtt.num_spt > limit &&
+	       reclaim_one_ppgtt_mm(vgpu, true))
+		;
+	if (limit)
+		drain_spt_page_pool(vgpu);
+	mutex_unlock(&vgpu->vgpu_lock);
+	return 0;
+}
+
 /**
  * intel_vgpu_reset_ggtt - reset the GGTT entry
  * @vgpu: a vGPU
@@ -2329,6 +3571,8 @@ void intel_vgpu_reset_ggtt(struct intel_vgpu *vgpu)
 	u32 index;
 	u32 num_entries;
 
+	ggtt_ra_drop(vgpu);
+
 	pte_ops->set_pfn(&entry, gvt->gtt.scratch_mfn);
 	pte_ops->set_present(&entry);
 
@@ -2342,9 +3586,37 @@ void intel_vgpu_reset_ggtt(struct intel_vgpu *vgpu)
 	while (num_entries--)
 		ggtt_set_host_entry(vgpu->gtt.ggtt_mm, &entry, index++);
 
+	WRITE_ONCE(vgpu->gtt.ggtt_gen, vgpu->gtt.ggtt_gen + 1);
 	ggtt_invalidate(dev_priv);
 }
 
+/**
+ * intel_vgpu_reset_ggtt_range - point a GGTT range of a vGPU at scratch
+ * @vgpu: a vGPU
+ * @gmadr: start of the range
+ * @size: size of the range in bytes
+ *
+ * This function is called when a vGPU gives up a part of its GM.
+ */
+void intel_vgpu_reset_ggtt_range(struct intel_vgpu *vgpu, u64 gmadr,
+				 u64 size)
+{
+	struct intel_gvt *gvt = vgpu->gvt;
+	struct intel_gvt_gtt_pte_ops *pte_ops = gvt->gtt.pte_ops;
+	struct intel_gvt_gtt_entry entry = {.type = GTT_TYPE_GGTT_PTE};
+	u32 index = gmadr >> PAGE_SHIFT;
+	u32 num_entries = size >> PAGE_SHIFT;
+
+	pte_ops->set_pfn(&entry, gvt->gtt.scratch_mfn);
+	pte_ops->set_present(&entry);
+
+	while (num_entries--)
+		ggtt_set_host_entry(vgpu->gtt.ggtt_mm, &entry, index++);
+
+	WRITE_ONCE(vgpu->gtt.ggtt_gen, vgpu->gtt.ggtt_gen + 1);
+	ggtt_invalidate(gvt->dev_priv);
+}
+
 /**
  * intel_vgpu_reset_gtt - reset the all GTT related status
  * @vgpu: a vGPU
@@ -2361,4 +3633,5 @@ void intel_vgpu_reset_gtt(struct intel_vgpu *vgpu)
 	 */
 	intel_vgpu_destroy_all_ppgtt_mm(vgpu);
 	intel_vgpu_reset_ggtt(vgpu);
+	vgpu->gtt.pv_ring_gpa = 0;
 }
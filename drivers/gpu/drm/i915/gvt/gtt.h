@@ -63,6 +63,9 @@ struct intel_gvt_gtt_pte_ops {
 	void (*clear_present)(struct intel_gvt_gtt_entry *e);
 	void (*set_present)(struct intel_gvt_gtt_entry *e);
 	bool (*test_pse)(struct intel_gvt_gtt_entry *e);
+	void (*clear_pse)(struct intel_gvt_gtt_entry *e);
+	bool (*test_ips)(struct intel_gvt_gtt_entry *e);
+	void (*clear_ips)(struct intel_gvt_gtt_entry *e);
 	void (*set_pfn)(struct intel_gvt_gtt_entry *e, unsigned long pfn);
 	unsigned long (*get_pfn)(struct intel_gvt_gtt_entry *e);
 };
@@ -76,25 +79,13 @@ struct intel_gvt_gtt_gma_ops {
 	unsigned long (*gma_to_pml4_index)(unsigned long gma);
 };
 
-struct intel_gvt_gtt {
-	struct intel_gvt_gtt_pte_ops *pte_ops;
-	struct intel_gvt_gtt_gma_ops *gma_ops;
-	int (*mm_alloc_page_table)(struct intel_vgpu_mm *mm);
-	void (*mm_free_page_table)(struct intel_vgpu_mm *mm);
-	struct list_head oos_page_use_list_head;
-	struct list_head oos_page_free_list_head;
-	struct list_head ppgtt_mm_lru_list_head;
-
-	struct page *scratch_page;
-	unsigned long scratch_mfn;
-};
-
 typedef enum {
 	GTT_TYPE_INVALID = -1,
 
 	GTT_TYPE_GGTT_PTE,
 
 	GTT_TYPE_PPGTT_PTE_4K_ENTRY,
+	GTT_TYPE_PPGTT_PTE_64K_ENTRY,
 	GTT_TYPE_PPGTT_PTE_2M_ENTRY,
 	GTT_TYPE_PPGTT_PTE_1G_ENTRY,
 
@@ -119,6 +110,35 @@ typedef enum {
 	GTT_TYPE_MAX,
 } intel_gvt_gtt_type_t;
 
+struct intel_vgpu_scratch_pt {
+	struct page *page;
+	unsigned long page_mfn;
+};
+
+struct intel_gvt_gtt {
+	struct intel_gvt_gtt_pte_ops *pte_ops;
+	struct intel_gvt_gtt_gma_ops *gma_ops;
+	int (*mm_alloc_page_table)(struct intel_vgpu_mm *mm);
+	void (*mm_free_page_table)(struct intel_vgpu_mm *mm);
+	struct mutex oos_page_lock; /* protect oos page free/use lists */
+	struct list_head oos_page_use_list_head; /* in LRU order */
+	struct list_head oos_page_free_list_head;
+	unsigned int num_oos_pages;
+	struct mutex ppgtt_mm_lock; /* protect ppgtt mm lru list */
+	struct list_head ppgtt_mm_lru_list_head;
+	atomic_t num_spt; /* shadow page tables of all vGPUs */
+	struct kmem_cache *spt_cache;
+	struct shrinker shrinker;
+	/* invalidates what the shrinker asked for outside of reclaim */
+	struct work_struct shrink_work;
+	atomic_long_t nr_to_shrink;
+
+	struct page *scratch_page;
+	unsigned long scratch_mfn;
+	/* PPGTT scratch page tree shared by the vGPUs */
+	struct intel_vgpu_scratch_pt scratch_pt[GTT_TYPE_MAX];
+};
+
 enum intel_gvt_mm_type {
 	INTEL_GVT_MM_GGTT,
 	INTEL_GVT_MM_PPGTT,
@@ -146,6 +166,7 @@ struct intel_vgpu_mm {
 			bool shadowed;
 
 			struct list_head list;
+			struct hlist_node node;
 			struct list_head lru_list;
 		} ppgtt_mm;
 		struct {
@@ -176,25 +197,61 @@ static inline void intel_vgpu_destroy_mm(struct intel_vgpu_mm *mm)
 
 struct intel_vgpu_guest_page;
 
-struct intel_vgpu_scratch_pt {
-	struct page *page;
-	unsigned long page_mfn;
+#define GGTT_RA_PAGES	64
+
+/* Guest pages mapped ahead of sequential GGTT writes, see gtt.c */
+struct intel_vgpu_ggtt_ra {
+	unsigned long last_index;	/* last GGTT entry mapped */
+	unsigned long last_gfn;		/* and the guest page it points at */
+	unsigned long gfn;		/* first guest page of the window */
+	unsigned int head;		/* next page to hand out */
+	unsigned int count;		/* pages mapped in the window */
+	dma_addr_t dma_addrs[GGTT_RA_PAGES];
 };
 
 struct intel_vgpu_gtt {
 	struct intel_vgpu_mm *ggtt_mm;
+	bool ggtt_dirty; /* GGTT entries written but not invalidated */
+	unsigned int ggtt_gen; /* bumped on every host GGTT entry update */
+	/* GGTT entries written since the last state save, see migrate.c */
+	unsigned long *ggtt_save_bitmap;
+	struct intel_vgpu_ggtt_ra ggtt_ra;
+	/* PPGTT update ring of a PV guest, 0 if write protection is used */
+	u64 pv_ring_gpa;
 	unsigned long active_ppgtt_mm_bitmap;
 	struct list_head ppgtt_mm_list_head;
+	/* PPGTT mm objects keyed by PDP0, and the last one looked up. */
+	DECLARE_HASHTABLE(ppgtt_mm_table, 7);
+	struct intel_vgpu_mm *last_ppgtt_mm;
 	struct radix_tree_root spt_tree;
+	struct list_head spt_page_pool; /* DMA mapped free shadow pages */
+	unsigned int spt_page_pool_cnt;
+	unsigned int num_spt; /* shadow page tables of this vGPU */
+	/* own page tables are reclaimed above this many, 0 for no limit */
+	unsigned int spt_limit;
+	/* guest entries are being shadowed, own mm can't be reclaimed */
+	unsigned int populating;
 	struct list_head oos_page_list_head;
+	unsigned int num_oos_pages; /* protected by gtt.oos_page_lock */
+	struct {
+		u64 wp_writes;	/* trapped guest page table writes */
+		u64 to_oos;	/* page tables set out of sync */
+		u64 to_wp;	/* cold page tables write protected again */
+		u64 syncs;	/* out of sync page tables synced */
+	} oos_stats;
 	struct list_head post_shadow_list_head;
 	struct intel_vgpu_scratch_pt scratch_pt[GTT_TYPE_MAX];
+	bool private_scratch; /* scratch_pt is owned, not the shared one */
 };
 
 extern int intel_vgpu_init_gtt(struct intel_vgpu *vgpu);
 extern void intel_vgpu_clean_gtt(struct intel_vgpu *vgpu);
 void intel_vgpu_reset_ggtt(struct intel_vgpu *vgpu);
+void intel_vgpu_reset_ggtt_range(struct intel_vgpu *vgpu, u64 gmadr,
+				 u64 size);
+void intel_vgpu_flush_ggtt(struct intel_vgpu *vgpu);
 void intel_vgpu_invalidate_ppgtt(struct intel_vgpu *vgpu);
+int intel_vgpu_set_spt_limit(struct intel_vgpu *vgpu, unsigned int limit);
 
 extern int intel_gvt_init_gtt(struct intel_gvt *gvt);
 void intel_vgpu_reset_gtt(struct intel_vgpu *vgpu);
@@ -225,8 +282,13 @@ struct intel_vgpu_ppgtt_spt {
 		unsigned long mfn;
 	} shadow_page;
 
+	/*
+	 * An spt splitting a guest 2M entry has no guest page, its
+	 * guest_page.type is GTT_TYPE_INVALID.
+	 */
 	struct {
 		intel_gvt_gtt_type_t type;
+		bool pde_ips; /* for 64KB PTEs */
 		unsigned long gfn;
 		unsigned long write_cnt;
 		struct intel_vgpu_oos_page *oos_page;
@@ -238,6 +300,10 @@ struct intel_vgpu_ppgtt_spt {
 
 int intel_vgpu_sync_oos_pages(struct intel_vgpu *vgpu);
 
+int intel_vgpu_register_pv_ppgtt(struct intel_vgpu *vgpu, u64 gpa);
+
+int intel_vgpu_sync_pv_ppgtt(struct intel_vgpu *vgpu);
+
 int intel_vgpu_flush_post_shadow(struct intel_vgpu *vgpu);
 
 int intel_vgpu_pin_mm(struct intel_vgpu_mm *mm);
@@ -261,4 +327,7 @@ int intel_vgpu_emulate_ggtt_mmio_read(struct intel_vgpu *vgpu,
 int intel_vgpu_emulate_ggtt_mmio_write(struct intel_vgpu *vgpu,
 	unsigned int off, void *p_data, unsigned int bytes);
 
+int intel_vgpu_emulate_ggtt_bulk_rw(struct intel_vgpu *vgpu,
+	unsigned int off, void *p_data, unsigned int bytes, bool is_write);
+
 #endif /* _GVT_GTT_H_ */
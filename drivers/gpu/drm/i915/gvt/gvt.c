@@ -33,6 +33,8 @@
 #include <linux/types.h>
 #include <xen/xen.h>
 #include <linux/kthread.h>
+#include <linux/sched/deadline.h>
+#include <uapi/linux/sched/types.h>
 
 #include "i915_drv.h"
 #include "gvt.h"
@@ -75,11 +77,44 @@ static ssize_t available_instances_show(struct kobject *kobj,
 	if (!type)
 		num = 0;
 	else
-		num = type->avail_instance;
+		num = type->avail_instance + type->pooled;
 
 	return sprintf(buf, "%u\n", num);
 }
 
+static ssize_t pool_size_show(struct kobject *kobj, struct device *dev,
+			      char *buf)
+{
+	struct intel_vgpu_type *type;
+	void *gvt = kdev_to_i915(dev)->gvt;
+
+	type = intel_gvt_find_vgpu_type(gvt, kobject_name(kobj));
+	if (!type)
+		return 0;
+
+	return sprintf(buf, "%u\n", type->pool_size);
+}
+
+static ssize_t pool_size_store(struct kobject *kobj, struct device *dev,
+			       const char *buf, size_t count)
+{
+	struct intel_vgpu_type *type;
+	void *gvt = kdev_to_i915(dev)->gvt;
+	unsigned int size;
+	int ret;
+
+	type = intel_gvt_find_vgpu_type(gvt, kobject_name(kobj));
+	if (!type)
+		return -EINVAL;
+
+	ret = kstrtouint(buf, 0, &size);
+	if (ret)
+		return ret;
+
+	ret = intel_gvt_set_vgpu_pool_size(gvt, type, size);
+	return ret ? ret : count;
+}
+
 static ssize_t device_api_show(struct kobject *kobj, struct device *dev,
 		char *buf)
 {
@@ -105,14 +140,56 @@ static ssize_t description_show(struct kobject *kobj, struct device *dev,
 		       type->weight);
 }
 
+/*
+ * Load and resource headroom of the GPU the type belongs to, the same for
+ * all of its types, for placing vGPUs across GPUs. busy_ns counts up, the
+ * load is its rate of change.
+ */
+static ssize_t gpu_load_show(struct kobject *kobj, struct device *dev,
+			     char *buf)
+{
+	struct drm_i915_private *dev_priv = kdev_to_i915(dev);
+	struct intel_gvt *gvt = dev_priv->gvt;
+	struct intel_engine_cs *engine;
+	enum intel_engine_id id;
+	u64 low_avail, high_avail;
+	unsigned long fence_avail;
+	ssize_t len;
+
+	mutex_lock(&gvt->lock);
+	low_avail = gvt_aperture_sz(gvt) - HOST_LOW_GM_SIZE -
+		gvt->gm.vgpu_allocated_low_gm_size;
+	high_avail = gvt_hidden_sz(gvt) - HOST_HIGH_GM_SIZE -
+		gvt->gm.vgpu_allocated_high_gm_size;
+	fence_avail = gvt_fence_sz(gvt) - HOST_FENCE -
+		gvt->fence.vgpu_allocated_fence_num;
+	mutex_unlock(&gvt->lock);
+
+	len = sprintf(buf, "numa_node: %d\nlow_gm_avail: %lluMB\n"
+		      "high_gm_avail: %lluMB\nfence_avail: %lu\n"
+		      "shadow_page_tables: %d\n",
+		      dev_to_node(dev), BYTES_TO_MB(low_avail),
+		      BYTES_TO_MB(high_avail), fence_avail,
+		      atomic_read(&gvt->gtt.num_spt));
+
+	for_each_engine(engine, dev_priv, id)
+		len += sprintf(buf + len, "busy_ns %s: %lld\n", engine->name,
+			       (s64)atomic64_read(&gvt->engine_busy_ns[id]));
+	return len;
+}
+
 static MDEV_TYPE_ATTR_RO(available_instances);
 static MDEV_TYPE_ATTR_RO(device_api);
 static MDEV_TYPE_ATTR_RO(description);
+static MDEV_TYPE_ATTR_RW(pool_size);
+static MDEV_TYPE_ATTR_RO(gpu_load);
 
 static struct attribute *gvt_type_attrs[] = {
 	&mdev_type_attr_available_instances.attr,
 	&mdev_type_attr_device_api.attr,
 	&mdev_type_attr_description.attr,
+	&mdev_type_attr_pool_size.attr,
+	&mdev_type_attr_gpu_load.attr,
 	NULL,
 };
 
@@ -174,6 +251,8 @@ static const struct intel_gvt_ops intel_gvt_ops = {
 	.emulate_cfg_write = intel_vgpu_emulate_cfg_write,
 	.emulate_mmio_read = intel_vgpu_emulate_mmio_read,
 	.emulate_mmio_write = intel_vgpu_emulate_mmio_write,
+	.emulate_mmio_fast_rw = intel_vgpu_emulate_mmio_fast_rw,
+	.emulate_ggtt_rw = intel_vgpu_emulate_ggtt_rw,
 	.vgpu_create = intel_gvt_create_vgpu,
 	.vgpu_destroy = intel_gvt_destroy_vgpu,
 	.vgpu_reset = intel_gvt_reset_vgpu,
@@ -184,6 +263,19 @@ static const struct intel_gvt_ops intel_gvt_ops = {
 	.vgpu_query_plane = intel_vgpu_query_plane,
 	.vgpu_get_dmabuf = intel_vgpu_get_dmabuf,
 	.write_protect_handler = intel_vgpu_page_track_handler,
+	.vgpu_set_weight = intel_vgpu_set_sched_weight,
+	.vgpu_set_latency = intel_vgpu_set_sched_latency,
+	.vgpu_set_deadline = intel_vgpu_set_sched_deadline,
+	.vgpu_set_vblank_mode = intel_vgpu_set_vblank_mode,
+	.vgpu_set_irq_moderation = intel_vgpu_set_irq_moderation,
+	.vgpu_set_hidden_gm = intel_gvt_resize_vgpu_hidden_gm,
+	.vgpu_save_state = intel_vgpu_save_state,
+	.vgpu_stop_save_state = intel_vgpu_stop_save_state,
+	.vgpu_load_state = intel_vgpu_load_state,
+	.vgpu_set_postcopy = intel_vgpu_set_postcopy,
+	.vgpu_set_spt_limit = intel_vgpu_set_spt_limit,
+	.vgpu_set_scan_level = intel_vgpu_set_scan_level,
+	.memcpy_from_wc = i915_unaligned_memcpy_from_wc,
 };
 
 /**
@@ -262,7 +354,9 @@ static int gvt_service_thread(void *data)
 
 	while (!kthread_should_stop()) {
 		ret = wait_event_interruptible(gvt->service_thread_wq,
-				kthread_should_stop() || gvt->service_request);
+				kthread_should_stop() ||
+				!bitmap_empty(gvt->service_request,
+					      INTEL_GVT_REQUEST_MAX));
 
 		if (kthread_should_stop())
 			break;
@@ -270,17 +364,9 @@ static int gvt_service_thread(void *data)
 		if (WARN_ONCE(ret, "service thread is waken up by signal.\n"))
 			continue;
 
-		if (test_and_clear_bit(INTEL_GVT_REQUEST_EMULATE_VBLANK,
-					(void *)&gvt->service_request)) {
-			mutex_lock(&gvt->lock);
-			intel_gvt_emulate_vblank(gvt);
-			mutex_unlock(&gvt->lock);
-		}
-
-		if (test_bit(INTEL_GVT_REQUEST_SCHED,
-				(void *)&gvt->service_request) ||
-			test_bit(INTEL_GVT_REQUEST_EVENT_SCHED,
-					(void *)&gvt->service_request)) {
+		if (test_bit(INTEL_GVT_REQUEST_SCHED, gvt->service_request) ||
+		    test_bit(INTEL_GVT_REQUEST_EVENT_SCHED,
+			     gvt->service_request)) {
 			intel_gvt_schedule(gvt);
 		}
 	}
@@ -288,6 +374,90 @@ static int gvt_service_thread(void *data)
 	return 0;
 }
 
+static void gvt_thread_set_sched(struct task_struct *thread)
+{
+	int ret = 0;
+
+	switch (i915_modparams.gvt_thread_sched) {
+	case 1: {
+		struct sched_param param = {
+			.sched_priority = MAX_USER_RT_PRIO / 2,
+		};
+
+		ret = sched_setscheduler_nocheck(thread, SCHED_FIFO, &param);
+		break;
+	}
+	case 2: {
+		u64 runtime = (u64)i915_modparams.gvt_thread_dl_runtime_us *
+			      NSEC_PER_USEC;
+		u64 period = (u64)i915_modparams.gvt_thread_dl_period_us *
+			     NSEC_PER_USEC;
+		struct sched_attr attr = {
+			.size = sizeof(attr),
+			.sched_policy = SCHED_DEADLINE,
+			.sched_runtime = runtime,
+			.sched_deadline = period,
+			.sched_period = period,
+		};
+
+		ret = sched_setattr(thread, &attr);
+		break;
+	}
+	default:
+		break;
+	}
+
+	if (ret)
+		gvt_err("fail to set scheduling class of %s: %d\n",
+			thread->comm, ret);
+}
+
+static void gvt_thread_set_cpus(struct intel_gvt *gvt,
+				struct task_struct *thread)
+{
+	cpumask_var_t cpus;
+
+	/* SCHED_DEADLINE admission control needs the whole root domain */
+	if (dl_task(thread))
+		return;
+
+	if (i915_modparams.gvt_thread_cpus &&
+	    alloc_cpumask_var(&cpus, GFP_KERNEL)) {
+		if (!cpulist_parse(i915_modparams.gvt_thread_cpus, cpus) &&
+		    !set_cpus_allowed_ptr(thread, cpus)) {
+			free_cpumask_var(cpus);
+			return;
+		}
+		free_cpumask_var(cpus);
+		gvt_err("invalid gvt_thread_cpus %s\n",
+			i915_modparams.gvt_thread_cpus);
+	}
+
+	if (gvt->numa_node != NUMA_NO_NODE)
+		set_cpus_allowed_ptr(thread, cpumask_of_node(gvt->numa_node));
+}
+
+/**
+ * intel_gvt_start_thread - place and start a GVT thread
+ * @gvt: intel gvt device
+ * @thread: a thread created with kthread_create_on_node()
+ * @ring_id: the ring a workload thread serves, or -1 for the service thread
+ *
+ * Give the thread the scheduling class set with gvt_thread_sched, unless
+ * it is a workload thread of a ring left out of gvt_thread_sched_rings.
+ * Then keep it on the gvt_thread_cpus CPUs, by default the CPUs closest
+ * to the GPU so that the shadow structures it allocates stay there too.
+ * Then start it.
+ */
+void intel_gvt_start_thread(struct intel_gvt *gvt, struct task_struct *thread,
+			    int ring_id)
+{
+	if (ring_id < 0 || i915_modparams.gvt_thread_sched_rings & BIT(ring_id))
+		gvt_thread_set_sched(thread);
+	gvt_thread_set_cpus(gvt, thread);
+	wake_up_process(thread);
+}
+
 static void clean_service_thread(struct intel_gvt *gvt)
 {
 	kthread_stop(gvt->service_thread);
@@ -297,15 +467,47 @@ static int init_service_thread(struct intel_gvt *gvt)
 {
 	init_waitqueue_head(&gvt->service_thread_wq);
 
-	gvt->service_thread = kthread_run(gvt_service_thread,
-			gvt, "gvt_service_thread");
+	gvt->service_thread = kthread_create_on_node(gvt_service_thread,
+			gvt, gvt->numa_node, "gvt_service_thread");
 	if (IS_ERR(gvt->service_thread)) {
 		gvt_err("fail to start service thread.\n");
 		return PTR_ERR(gvt->service_thread);
 	}
+	intel_gvt_start_thread(gvt, gvt->service_thread, -1);
 	return 0;
 }
 
+/**
+ * intel_gvt_get_vgpu_context - get the shadow context of a vGPU
+ * @dev_priv: drm i915 private data
+ * @id: ID of the vGPU
+ *
+ * i915_perf uses this to filter the OA reports of a vGPU, which carry the
+ * hardware ID of its shadow context. The caller must drop the reference
+ * with i915_gem_context_put().
+ *
+ * Returns:
+ * The referenced context, or an ERR_PTR if there is no such vGPU.
+ */
+struct i915_gem_context *
+intel_gvt_get_vgpu_context(struct drm_i915_private *dev_priv, unsigned int id)
+{
+	struct intel_gvt *gvt = to_gvt(dev_priv);
+	struct i915_gem_context *ctx = ERR_PTR(-ENOENT);
+	struct intel_vgpu *vgpu;
+
+	if (!gvt)
+		return ERR_PTR(-ENODEV);
+
+	mutex_lock(&gvt->lock);
+	vgpu = idr_find(&gvt->vgpu_idr, id);
+	if (vgpu)
+		ctx = i915_gem_context_get(vgpu->submission.shadow_ctx);
+	mutex_unlock(&gvt->lock);
+
+	return ctx;
+}
+
 /**
  * intel_gvt_clean_device - clean a GVT device
  * @gvt: intel gvt device
@@ -321,13 +523,15 @@ void intel_gvt_clean_device(struct drm_i915_private *dev_priv)
 	if (WARN_ON(!gvt))
 		return;
 
+	intel_gvt_clean_vgpu_pool(gvt);
+	intel_gvt_pmu_clean(gvt);
 	intel_gvt_debugfs_clean(gvt);
 	clean_service_thread(gvt);
+	intel_gvt_recorder_clean(gvt);
 	intel_gvt_clean_cmd_parser(gvt);
 	intel_gvt_clean_sched_policy(gvt);
 	intel_gvt_clean_workload_scheduler(gvt);
 	intel_gvt_clean_gtt(gvt);
-	intel_gvt_clean_irq(gvt);
 	intel_gvt_clean_mmio_info(gvt);
 	intel_gvt_free_firmware(gvt);
 
@@ -379,7 +583,9 @@ int intel_gvt_init_device(struct drm_i915_private *dev_priv)
 	idr_init(&gvt->vgpu_idr);
 	spin_lock_init(&gvt->scheduler.mmio_context_lock);
 	mutex_init(&gvt->lock);
+	mutex_init(&gvt->sched_lock);
 	gvt->dev_priv = dev_priv;
+	gvt->numa_node = dev_to_node(&dev_priv->drm.pdev->dev);
 
 	init_device_info(gvt);
 
@@ -399,7 +605,7 @@ int intel_gvt_init_device(struct drm_i915_private *dev_priv)
 
 	ret = intel_gvt_init_gtt(gvt);
 	if (ret)
-		goto out_clean_irq;
+		goto out_free_firmware;
 
 	ret = intel_gvt_init_workload_scheduler(gvt);
 	if (ret)
@@ -446,6 +652,14 @@ int intel_gvt_init_device(struct drm_i915_private *dev_priv)
 	if (ret)
 		gvt_err("debugfs registeration failed, go on.\n");
 
+	ret = intel_gvt_pmu_init(gvt);
+	if (ret)
+		gvt_err("pmu registration failed, go on.\n");
+
+	ret = intel_gvt_recorder_init(gvt);
+	if (ret)
+		gvt_err("flight recorder setup failed, go on.\n");
+
 	gvt_dbg_core("gvt device initialization is done\n");
 	dev_priv->gvt = gvt;
 	return 0;
@@ -462,8 +676,6 @@ int intel_gvt_init_device(struct drm_i915_private *dev_priv)
 	intel_gvt_clean_workload_scheduler(gvt);
 out_clean_gtt:
 	intel_gvt_clean_gtt(gvt);
-out_clean_irq:
-	intel_gvt_clean_irq(gvt);
 out_free_firmware:
 	intel_gvt_free_firmware(gvt);
 out_clean_mmio_info:
@@ -50,7 +50,7 @@
 #include "dmabuf.h"
 #include "page_track.h"
 
-#define GVT_MAX_VGPU 8
+#define GVT_MAX_VGPU 32
 
 enum {
 	INTEL_GVT_HYPERVISOR_XEN = 0,
@@ -85,6 +85,17 @@ struct intel_vgpu_gm {
 	u64 hidden_sz;
 	struct drm_mm_node low_gm_node;
 	struct drm_mm_node high_gm_node;
+
+	/*
+	 * Live resize of the hidden GM through the guest balloon, see
+	 * VGT_CAPS_GGTT_BALLOON. While a request is pending, high_gm_node
+	 * covers both the current and the requested range.
+	 */
+	bool balloon_capable;
+	u32 balloon_seqno;
+	u64 hidden_request;
+	u64 balloon_ack;
+	struct work_struct balloon_work;
 };
 
 #define INTEL_GVT_MAX_NUM_FENCES 32
@@ -98,8 +109,18 @@ struct intel_vgpu_fence {
 
 struct intel_vgpu_mmio {
 	void *vreg;
-	void *sreg;
+	/* golden state, shared read-only with every other vGPU */
+	const void *sreg;
+	/* private pages backing vreg, NULL where the template is mapped */
+	struct page **pages;
+	struct vm_struct *area;
+	/* bumped around guest MMIO writes, for lockless vreg readers */
+	seqcount_t vreg_seq;
 	bool disable_warn_untrack;
+	/* rings whose RING_TIMESTAMP_UDW vreg was read along with the LDW */
+	unsigned long ts_udw_cached;
+	/* jiffies of that LDW read, the cached UDW is stale after a tick */
+	unsigned long ts_ldw_jiffies[I915_NUM_ENGINES];
 };
 
 #define INTEL_GVT_MAX_BAR_NUM 4
@@ -122,6 +143,66 @@ struct intel_vgpu_irq {
 	bool irq_warn_once[INTEL_GVT_EVENT_MAX];
 	DECLARE_BITMAP(flip_done_event[INTEL_GVT_MAX_PIPE],
 		       INTEL_GVT_EVENT_MAX);
+	/* time of the last MSI not yet acknowledged by the guest */
+	ktime_t msi_inflight;
+	/* moderation of ring completion interrupts */
+	struct hrtimer moderation_timer;
+	struct work_struct flush_work;	/* injects when the timer expires */
+	unsigned int moderation_usecs;
+	unsigned int moderation_count;
+	unsigned int moderated;
+};
+
+/* host side costs of a vGPU, counted per CPU */
+enum intel_vgpu_stat {
+	INTEL_VGPU_STAT_MMIO_READ = 0,
+	INTEL_VGPU_STAT_MMIO_WRITE,
+	INTEL_VGPU_STAT_WP_FAULT,
+	INTEL_VGPU_STAT_OOS_SYNC,
+	INTEL_VGPU_STAT_WORKLOAD_SCAN,
+	INTEL_VGPU_STAT_SHADOW_BYTES,
+	INTEL_VGPU_STAT_SCAN_NS,
+	INTEL_VGPU_STAT_SHADOW_NS,
+	INTEL_VGPU_STAT_DISPATCH_NS,
+	INTEL_VGPU_STAT_COMPLETE_NS,
+	INTEL_VGPU_STAT_BUSY_NS,
+	INTEL_VGPU_STAT_TIMESLICE_NS,
+	INTEL_VGPU_STAT_PREEMPT,
+	INTEL_VGPU_STAT_WAITBOOST,
+	INTEL_VGPU_STAT_MAX,
+};
+
+struct intel_vgpu_stats {
+	u64 counter[INTEL_VGPU_STAT_MAX];
+};
+
+enum intel_gvt_rec_type {
+	INTEL_GVT_REC_MMIO_READ,
+	INTEL_GVT_REC_MMIO_WRITE,
+	INTEL_GVT_REC_WP_FAULT,
+	INTEL_GVT_REC_INJECT_MSI,
+	INTEL_GVT_REC_DISPATCH,
+	INTEL_GVT_REC_COMPLETE,
+	INTEL_GVT_REC_FAILSAFE,
+	INTEL_GVT_REC_HANG,
+	INTEL_GVT_REC_MAX,
+};
+
+/* A flight recorder event, see recorder.c */
+struct intel_gvt_rec {
+	u64 ts;
+	u32 data;
+	u32 val;
+	u32 latency;	/* in ns */
+	u16 vgpu_id;
+	u8 type;
+};
+
+#define INTEL_GVT_REC_ENTRIES	1024	/* per CPU, a power of two */
+
+struct intel_gvt_rec_ring {
+	unsigned int head;
+	struct intel_gvt_rec *rec;
 };
 
 struct intel_vgpu_opregion {
@@ -136,10 +217,27 @@ struct intel_vgpu_display {
 	struct intel_vgpu_i2c_edid i2c_edid;
 	struct intel_vgpu_port ports[I915_MAX_PORTS];
 	struct intel_vgpu_sbi sbi;
+	struct intel_vgpu_vblank_timer vblank_timer;
+	/* INTEL_VGPU_FLIP_* planes flipped on each pipe since its last vblank */
+	unsigned long flip_pending[I915_MAX_PIPES];
+	/* planes as of the last vblank that committed a flip */
+	struct intel_vgpu_frame frame;
+	struct intel_vgpu_cursor cursor;
+};
+
+#define VGPU_MAX_WEIGHT 16
+
+enum intel_vgpu_latency_class {
+	INTEL_VGPU_LATENCY_BATCH = 0,
+	INTEL_VGPU_LATENCY_INTERACTIVE,
 };
 
 struct vgpu_sched_ctl {
 	int weight;
+	enum intel_vgpu_latency_class latency;
+	/* GPU time reservation of the eds policy, period 0 if none */
+	unsigned int period_us;
+	unsigned int budget_us;
 };
 
 enum {
@@ -147,6 +245,16 @@ enum {
 	INTEL_VGPU_GUC_SUBMISSION,
 };
 
+/*
+ * How deeply the workloads of a vGPU are scanned. A vGPU running a trusted
+ * guest image may only need the commands that reach privileged state
+ * audited, see intel_vgpu_set_scan_level().
+ */
+enum intel_vgpu_scan_level {
+	INTEL_VGPU_SCAN_FULL = 0,
+	INTEL_VGPU_SCAN_PRIVILEGED,
+};
+
 struct intel_vgpu_submission_ops {
 	const char *name;
 	int (*init)(struct intel_vgpu *vgpu, unsigned long engine_mask);
@@ -159,26 +267,77 @@ struct intel_vgpu_submission {
 	struct list_head workload_q_head[I915_NUM_ENGINES];
 	struct kmem_cache *workloads;
 	atomic_t running_workload_num;
+	atomic_t running_ring_workload_num[I915_NUM_ENGINES];
+	/* workloads waiting for the completion worker, under sched_lock */
+	unsigned int completing[I915_NUM_ENGINES];
 	struct i915_gem_context *shadow_ctx;
-	DECLARE_BITMAP(shadow_ctx_desc_updated, I915_NUM_ENGINES);
-	DECLARE_BITMAP(tlb_handle_pending, I915_NUM_ENGINES);
+	/* rings the shadow context is kept pinned on */
+	DECLARE_BITMAP(shadow_ctx_pinned, I915_NUM_ENGINES);
 	void *ring_scan_buffer[I915_NUM_ENGINES];
 	int ring_scan_buffer_size[I915_NUM_ENGINES];
+	/* guest context pages as read in by the last workload of a ring */
+	void *ctx_snapshot[I915_NUM_ENGINES];
+	/* idle shadow batch buffers, protected by struct_mutex */
+	struct list_head shadow_bb_pool[4];
+	unsigned int shadow_bb_pool_count;
+	/* scanned ring level batch buffers, see cmd_parser.c */
+	DECLARE_HASHTABLE(bb_scan_cache, 6);
+	unsigned int bb_scan_cache_count;
+	/* scanned indirect contexts, see cmd_parser.c */
+	struct list_head wa_ctx_cache;
+	unsigned int wa_ctx_cache_count;
+	/* guest batch buffer pages executed in place, see cmd_parser.c */
+	DECLARE_HASHTABLE(direct_bb_pages, 4);
+	int scan_level;
+	/* guest page translations of the scan in progress */
+	struct intel_vgpu_gma_tlb_entry gma_tlb[GVT_GMA_TLB_SIZE];
+	/* recorded workload streams, see cmd_parser.c */
+	struct list_head captures;
+	unsigned int capture_remaining;
+	struct intel_vgpu_capture *capture;
+	bool replaying;
 	const struct intel_vgpu_submission_ops *ops;
 	int virtual_submission_interface;
 	bool active;
+	/* submission page of a PV guest, see intel_vgpu_pv_submit() */
+	u64 pv_submission_gpa;
+	/* ELSP writes latched by the MMIO fast path, not submitted yet */
+	bool defer_elsp;
+	DECLARE_BITMAP(elsp_pending, I915_NUM_ENGINES);
+	struct work_struct elsp_work;
+	/* rings whose first queued workload waits for an async scan */
+	DECLARE_BITMAP(scan_pending, I915_NUM_ENGINES);
+	struct work_struct scan_work;
+	/* fence of the last workload submitted to i915 on each ring */
+	struct dma_fence __rcu *last_fence[I915_NUM_ENGINES];
+	/* timeline of the fences attached to exported dmabufs */
+	u64 fence_context;
+	unsigned int fence_seqno;
+	/* stage to stage latencies of completed workloads, per ring */
+	struct intel_vgpu_workload_latency latency[I915_NUM_ENGINES];
 };
 
 struct intel_vgpu {
 	struct intel_gvt *gvt;
+	struct mutex vgpu_lock; /* protect vGPU virtual state (vreg, gtt, ...) */
 	int id;
 	unsigned long handle; /* vGPU handle used by hypervisor MPT modules */
 	bool active;
 	bool pv_notified;
 	bool failsafe;
+	/* guest memory still being pulled, see intel_vgpu_set_postcopy() */
+	bool postcopy;
+	/* memcg of the VMM, charged for the host memory the vGPU uses */
+	struct mem_cgroup *memcg;
+	/* mailbox page of a PV guest, see intel_vgpu_drain_pv_mailbox() */
+	u64 pv_mailbox_gpa;
+	/* timestamp page of a PV guest, see intel_vgpu_update_pv_timestamp() */
+	u64 pv_timestamp_gpa;
+	u32 pv_timestamp_generation;
 	unsigned int resetting_eng;
 	void *sched_data;
 	struct vgpu_sched_ctl sched_ctl;
+	struct list_head pool_node; /* on its type pool until handed out */
 
 	struct intel_vgpu_fence fence;
 	struct intel_vgpu_gm gm;
@@ -193,6 +352,9 @@ struct intel_vgpu {
 	u32 hws_pga[I915_NUM_ENGINES];
 
 	struct dentry *debugfs;
+	struct intel_vgpu_stats __percpu *stats;
+	/* GPU time its contexts ran for on each engine, in ns */
+	atomic64_t engine_busy_ns[I915_NUM_ENGINES];
 
 #if IS_ENABLED(CONFIG_DRM_I915_GVT_KVMGT)
 	struct {
@@ -201,15 +363,27 @@ struct intel_vgpu {
 		int num_regions;
 		struct eventfd_ctx *intx_trigger;
 		struct eventfd_ctx *msi_trigger;
+		/* signalled on every primary plane flip of the guest */
+		struct eventfd_ctx *display_trigger;
+		spinlock_t display_trigger_lock;
 
 		/*
 		 * Two caches are used to avoid mapping duplicated pages (eg.
 		 * scratch pages). This help to reduce dma setup overhead.
 		 */
-		struct rb_root gfn_cache;
-		struct rb_root dma_addr_cache;
+		struct radix_tree_root gfn_cache;
+		struct radix_tree_root dma_addr_cache;
 		unsigned long nr_cache_entries;
+		/* unreferenced mappings kept for reuse, see kvmgt.c */
+		struct list_head dma_idle_list;
+		unsigned long dma_idle_size;
 		struct mutex cache_lock;
+		/* guest pages mapped for DMA while logging, see kvmgt.c */
+		unsigned long *dirty_bitmap;
+		unsigned long dirty_bitmap_pages;
+		struct mutex state_lock; /* protects state_data */
+		void *state_data;
+		size_t state_size;
 
 		struct notifier_block iommu_notifier;
 		struct notifier_block group_notifier;
@@ -217,17 +391,34 @@ struct intel_vgpu {
 		struct work_struct release_work;
 		atomic_t released;
 		struct vfio_device *vfio_device;
+		/* WC mapping of the aperture of the vGPU while opened */
+		void __iomem *aperture_va;
 	} vdev;
 #endif
 
 	struct list_head dmabuf_obj_list_head;
+	/* exposed dmabuf_objs, hashed by surface address */
+	DECLARE_HASHTABLE(dmabuf_obj_table, 4);
 	struct mutex dmabuf_lock;
+	struct intel_vgpu_fb_damage fb_damage;
 	struct idr object_idr;
 
 	struct completion vblank_done;
 
 };
 
+static inline void intel_vgpu_stat_add(struct intel_vgpu *vgpu,
+				       enum intel_vgpu_stat stat, u64 val)
+{
+	this_cpu_add(vgpu->stats->counter[stat], val);
+}
+
+static inline void intel_vgpu_stat_inc(struct intel_vgpu *vgpu,
+				       enum intel_vgpu_stat stat)
+{
+	this_cpu_inc(vgpu->stats->counter[stat]);
+}
+
 /* validating GM healthy status*/
 #define vgpu_is_vm_unhealthy(ret_val) \
 	(((ret_val) == -EBADRQC) || ((ret_val) == -EFAULT))
@@ -268,11 +459,23 @@ struct intel_gvt_mmio {
 #define F_CMD_ACCESSED	(1 << 5)
 /* This reg could be accessed by unaligned address */
 #define F_UNALIGN	(1 << 6)
+/* This reg has no emulation side effect beyond its vreg */
+#define F_NO_SIDE_EFFECT	(1 << 7)
 
 	struct gvt_mmio_block *mmio_block;
 	unsigned int num_mmio_block;
 
+	/* Only used while building the MMIO information table. */
 	DECLARE_HASHTABLE(mmio_info_table, INTEL_GVT_MMIO_HASH_BITS);
+
+	/*
+	 * Compact MMIO information table sorted by offset, together with a
+	 * dense index from (offset / 4) to (position in mmio_info + 1). Both
+	 * are immutable once intel_gvt_setup_mmio_info() returns, so they can
+	 * be accessed without holding any lock.
+	 */
+	struct intel_gvt_mmio_info *mmio_info;
+	u16 *mmio_info_index;
 	unsigned long num_tracked_mmio;
 };
 
@@ -282,6 +485,14 @@ struct intel_gvt_firmware {
 	bool firmware_loaded;
 };
 
+/* pristine vGPU state cloned by every new vGPU */
+struct intel_gvt_vgpu_template {
+	void *mmio;
+	/* MMIO space pages holding tracked registers */
+	unsigned long *mmio_tracked;
+	void *opregion;
+};
+
 #define NR_MAX_INTEL_VGPU_TYPES 20
 struct intel_vgpu_type {
 	char name[16];
@@ -291,30 +502,62 @@ struct intel_vgpu_type {
 	unsigned int fence;
 	unsigned int weight;
 	enum intel_vgpu_edid resolution;
+	/* created vGPUs kept ready for mdev create, protected by gvt->lock */
+	unsigned int pool_size;
+	unsigned int pooled;
+	struct list_head pool;
+};
+
+enum {
+	/* Scheduling trigger by timer */
+	INTEL_GVT_REQUEST_SCHED = 0,
+
+	/* Scheduling trigger by event */
+	INTEL_GVT_REQUEST_EVENT_SCHED = 1,
+
+	INTEL_GVT_REQUEST_MAX,
 };
 
 struct intel_gvt {
+	/* GVT scope lock, protect GVT itself, and all resource currently
+	 * not yet protected by special locks(vgpu and scheduler lock).
+	 */
 	struct mutex lock;
+	/* scheduler scope lock, protect gvt and vgpu schedule related data */
+	struct mutex sched_lock;
+
 	struct drm_i915_private *dev_priv;
+	int numa_node;		/* node the GPU is attached to */
 	struct idr vgpu_idr;	/* vGPU IDR pool */
 
 	struct intel_gvt_device_info device_info;
 	struct intel_gvt_gm gm;
 	struct intel_gvt_fence fence;
+	/* GPU time of all vGPUs on each engine, in ns */
+	atomic64_t engine_busy_ns[I915_NUM_ENGINES];
 	struct intel_gvt_mmio mmio;
 	struct intel_gvt_firmware firmware;
+	struct intel_gvt_vgpu_template vgpu_template;
+	struct work_struct vgpu_pool_work;
 	struct intel_gvt_irq irq;
 	struct intel_gvt_gtt gtt;
 	struct intel_gvt_workload_scheduler scheduler;
 	struct notifier_block shadow_ctx_notifier_block[I915_NUM_ENGINES];
-	DECLARE_HASHTABLE(cmd_table, GVT_CMD_HASH_BITS);
+	/* direct-indexed cmd_info lookup, per ring and per command type */
+	struct cmd_info **cmd_table[I915_NUM_ENGINES][GVT_CMD_TYPE_NUM];
+	/* audit policy of each register operand of LRI/LRR/LRM/SRM */
+	u8 *cmd_reg_policy;
+	/* scanned batch buffers shared by content, under struct_mutex */
+	DECLARE_HASHTABLE(bb_dedup, 8);
+	struct list_head bb_dedup_lru;
+	unsigned int bb_dedup_count;
 	struct intel_vgpu_type *types;
 	unsigned int num_types;
 	struct intel_vgpu *idle_vgpu;
 
 	struct task_struct *service_thread;
 	wait_queue_head_t service_thread_wq;
-	unsigned long service_request;
+	DECLARE_BITMAP(service_request, INTEL_GVT_REQUEST_MAX);
 
 	struct {
 		struct engine_mmio *mmio;
@@ -322,6 +565,16 @@ struct intel_gvt {
 	} engine_mmio_list;
 
 	struct dentry *debugfs_root;
+	struct intel_gvt_rec_ring __percpu *recorder;
+
+	struct {
+		struct pmu base;
+		/* moves the events off a CPU going offline */
+		struct hlist_node node;
+		/* protects vgpu[] against the PMU readers */
+		spinlock_t lock;
+		struct intel_vgpu *vgpu[GVT_MAX_VGPU];
+	} pmu;
 };
 
 static inline struct intel_gvt *to_gvt(struct drm_i915_private *i915)
@@ -329,24 +582,17 @@ static inline struct intel_gvt *to_gvt(struct drm_i915_private *i915)
 	return i915->gvt;
 }
 
-enum {
-	INTEL_GVT_REQUEST_EMULATE_VBLANK = 0,
-
-	/* Scheduling trigger by timer */
-	INTEL_GVT_REQUEST_SCHED = 1,
-
-	/* Scheduling trigger by event */
-	INTEL_GVT_REQUEST_EVENT_SCHED = 2,
-};
-
 static inline void intel_gvt_request_service(struct intel_gvt *gvt,
 		int service)
 {
-	set_bit(service, (void *)&gvt->service_request);
+	set_bit(service, gvt->service_request);
 	wake_up(&gvt->service_thread_wq);
 }
 
 void intel_gvt_free_firmware(struct intel_gvt *gvt);
+
+void intel_gvt_start_thread(struct intel_gvt *gvt, struct task_struct *thread,
+			    int ring_id);
 int intel_gvt_load_firmware(struct intel_gvt *gvt);
 
 /* Aperture/GM space definitions for GVT device */
@@ -418,6 +664,8 @@ int intel_vgpu_alloc_resource(struct intel_vgpu *vgpu,
 			      struct intel_vgpu_creation_params *param);
 void intel_vgpu_reset_resource(struct intel_vgpu *vgpu);
 void intel_vgpu_free_resource(struct intel_vgpu *vgpu);
+int intel_vgpu_resize_hidden_gm(struct intel_vgpu *vgpu, u64 size);
+int intel_vgpu_resize_hidden_gm_in_place(struct intel_vgpu *vgpu, u64 size);
 void intel_vgpu_write_fence(struct intel_vgpu *vgpu,
 	u32 fence, u64 value);
 
@@ -432,9 +680,9 @@ void intel_vgpu_write_fence(struct intel_vgpu *vgpu,
 #define vgpu_vreg64(vgpu, offset) \
 	(*(u64 *)(vgpu->mmio.vreg + (offset)))
 #define vgpu_sreg_t(vgpu, reg) \
-	(*(u32 *)(vgpu->mmio.sreg + i915_mmio_reg_offset(reg)))
+	(*(const u32 *)(vgpu->mmio.sreg + i915_mmio_reg_offset(reg)))
 #define vgpu_sreg(vgpu, offset) \
-	(*(u32 *)(vgpu->mmio.sreg + (offset)))
+	(*(const u32 *)(vgpu->mmio.sreg + (offset)))
 
 #define for_each_active_vgpu(gvt, vgpu, id) \
 	idr_for_each_entry((&(gvt)->vgpu_idr), (vgpu), (id)) \
@@ -462,6 +710,10 @@ static inline void intel_vgpu_write_pci_bar(struct intel_vgpu *vgpu,
 
 int intel_gvt_init_vgpu_types(struct intel_gvt *gvt);
 void intel_gvt_clean_vgpu_types(struct intel_gvt *gvt);
+int intel_gvt_set_vgpu_pool_size(struct intel_gvt *gvt,
+				 struct intel_vgpu_type *type,
+				 unsigned int size);
+void intel_gvt_clean_vgpu_pool(struct intel_gvt *gvt);
 
 struct intel_vgpu *intel_gvt_create_idle_vgpu(struct intel_gvt *gvt);
 void intel_gvt_destroy_idle_vgpu(struct intel_vgpu *vgpu);
@@ -471,9 +723,21 @@ void intel_gvt_destroy_vgpu(struct intel_vgpu *vgpu);
 void intel_gvt_reset_vgpu_locked(struct intel_vgpu *vgpu, bool dmlr,
 				 unsigned int engine_mask);
 void intel_gvt_reset_vgpu(struct intel_vgpu *vgpu);
+int intel_gvt_resize_vgpu_hidden_gm(struct intel_vgpu *vgpu,
+				    unsigned int size);
+void intel_gvt_ack_vgpu_balloon(struct intel_vgpu *vgpu, u32 seqno,
+				u64 size);
+void intel_vgpu_balloon_work(struct work_struct *work);
 void intel_gvt_activate_vgpu(struct intel_vgpu *vgpu);
 void intel_gvt_deactivate_vgpu(struct intel_vgpu *vgpu);
 
+int intel_vgpu_save_state(struct intel_vgpu *vgpu, bool final,
+			  void **data, size_t *size);
+void intel_vgpu_stop_save_state(struct intel_vgpu *vgpu);
+int intel_vgpu_load_state(struct intel_vgpu *vgpu, const void *data,
+			  size_t size);
+int intel_vgpu_set_postcopy(struct intel_vgpu *vgpu, bool on);
+
 /* validating GM functions */
 #define vgpu_gmadr_is_aperture(vgpu, gmadr) \
 	((gmadr >= vgpu_aperture_gmadr_base(vgpu)) && \
@@ -525,6 +789,7 @@ static inline u64 intel_vgpu_get_bar_gpa(struct intel_vgpu *vgpu, int bar)
 }
 
 void intel_vgpu_clean_opregion(struct intel_vgpu *vgpu);
+void intel_gvt_setup_opregion_template(void *buf);
 int intel_vgpu_init_opregion(struct intel_vgpu *vgpu);
 int intel_vgpu_opregion_base_write_handler(struct intel_vgpu *vgpu, u32 gpa);
 
@@ -543,6 +808,10 @@ struct intel_gvt_ops {
 				unsigned int);
 	int (*emulate_mmio_write)(struct intel_vgpu *, u64, void *,
 				unsigned int);
+	int (*emulate_ggtt_rw)(struct intel_vgpu *, u64, void *,
+				unsigned int, bool);
+	int (*emulate_mmio_fast_rw)(struct intel_vgpu *, u64, void *,
+				unsigned int, bool);
 	struct intel_vgpu *(*vgpu_create)(struct intel_gvt *,
 				struct intel_vgpu_type *);
 	void (*vgpu_destroy)(struct intel_vgpu *);
@@ -557,6 +826,24 @@ struct intel_gvt_ops {
 	int (*vgpu_get_dmabuf)(struct intel_vgpu *vgpu, unsigned int);
 	int (*write_protect_handler)(struct intel_vgpu *, u64, void *,
 				     unsigned int);
+	int (*vgpu_set_weight)(struct intel_vgpu *vgpu, int weight);
+	int (*vgpu_set_latency)(struct intel_vgpu *vgpu, int latency);
+	int (*vgpu_set_deadline)(struct intel_vgpu *vgpu,
+				 unsigned int period_us,
+				 unsigned int budget_us);
+	int (*vgpu_set_vblank_mode)(struct intel_vgpu *vgpu, int mode);
+	int (*vgpu_set_irq_moderation)(struct intel_vgpu *vgpu,
+				       unsigned int usecs, unsigned int count);
+	int (*vgpu_set_hidden_gm)(struct intel_vgpu *vgpu, unsigned int size);
+	int (*vgpu_save_state)(struct intel_vgpu *vgpu, bool final,
+			       void **data, size_t *size);
+	void (*vgpu_stop_save_state)(struct intel_vgpu *vgpu);
+	int (*vgpu_load_state)(struct intel_vgpu *vgpu, const void *data,
+			       size_t size);
+	int (*vgpu_set_postcopy)(struct intel_vgpu *vgpu, bool on);
+	int (*vgpu_set_spt_limit)(struct intel_vgpu *vgpu, unsigned int limit);
+	int (*vgpu_set_scan_level)(struct intel_vgpu *vgpu, int level);
+	bool (*memcpy_from_wc)(void *dst, const void *src, unsigned long len);
 };
 
 
@@ -639,11 +926,38 @@ static inline bool intel_gvt_mmio_has_mode_mask(
 	return gvt->mmio.mmio_attribute[offset >> 2] & F_MODE_MASK;
 }
 
+/**
+ * intel_gvt_mmio_is_side_effect_free - if a MMIO only lives in the vreg
+ * @gvt: a GVT device
+ * @offset: register offset
+ *
+ * Returns:
+ * True if a MMIO is emulated by the default handlers only, so accessing it
+ * doesn't need to leave the fast path of the hypervisor.
+ *
+ */
+static inline bool intel_gvt_mmio_is_side_effect_free(
+			struct intel_gvt *gvt, unsigned int offset)
+{
+	return gvt->mmio.mmio_attribute[offset >> 2] & F_NO_SIDE_EFFECT;
+}
+
 int intel_gvt_debugfs_add_vgpu(struct intel_vgpu *vgpu);
 void intel_gvt_debugfs_remove_vgpu(struct intel_vgpu *vgpu);
 int intel_gvt_debugfs_init(struct intel_gvt *gvt);
 void intel_gvt_debugfs_clean(struct intel_gvt *gvt);
 
+void intel_gvt_pmu_add_vgpu(struct intel_vgpu *vgpu);
+void intel_gvt_pmu_remove_vgpu(struct intel_vgpu *vgpu);
+int intel_gvt_pmu_init(struct intel_gvt *gvt);
+void intel_gvt_pmu_clean(struct intel_gvt *gvt);
+
+void intel_gvt_record(struct intel_vgpu *vgpu, enum intel_gvt_rec_type type,
+		      u32 data, u32 val, u64 start);
+void intel_gvt_recorder_dump_vgpu(struct intel_vgpu *vgpu);
+int intel_gvt_recorder_init(struct intel_gvt *gvt);
+void intel_gvt_recorder_clean(struct intel_gvt *gvt);
+
 
 #include "trace.h"
 #include "mpt.h"
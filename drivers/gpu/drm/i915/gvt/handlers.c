@@ -79,6 +79,21 @@ static void write_vreg(struct intel_vgpu *vgpu, unsigned int offset,
 
 static struct intel_gvt_mmio_info *find_mmio_info(struct intel_gvt *gvt,
 						  unsigned int offset)
+{
+	u16 index;
+
+	if (unlikely(offset >= gvt->device_info.mmio_size))
+		return NULL;
+
+	index = gvt->mmio.mmio_info_index[offset >> 2];
+	if (!index)
+		return NULL;
+
+	return &gvt->mmio.mmio_info[index - 1];
+}
+
+static struct intel_gvt_mmio_info *find_staging_mmio_info(
+		struct intel_gvt *gvt, unsigned int offset)
 {
 	struct intel_gvt_mmio_info *e;
 
@@ -112,7 +127,7 @@ static int new_mmio_info(struct intel_gvt *gvt,
 			return -ENOMEM;
 
 		info->offset = i;
-		p = find_mmio_info(gvt, info->offset);
+		p = find_staging_mmio_info(gvt, info->offset);
 		if (p) {
 			WARN(1, "dup mmio definition offset %x\n",
 				info->offset);
@@ -182,6 +197,8 @@ void enter_failsafe_mode(struct intel_vgpu *vgpu, int reason)
 		break;
 	}
 	pr_err("Now vgpu %d will enter failsafe mode.\n", vgpu->id);
+	intel_gvt_record(vgpu, INTEL_GVT_REC_FAILSAFE, reason, 0, 0);
+	intel_gvt_recorder_dump_vgpu(vgpu);
 	vgpu->failsafe = true;
 }
 
@@ -423,7 +440,7 @@ static int pipeconf_mmio_write(struct intel_vgpu *vgpu, unsigned int offset,
 		vgpu_vreg(vgpu, offset) |= I965_PIPECONF_ACTIVE;
 	else
 		vgpu_vreg(vgpu, offset) &= ~I965_PIPECONF_ACTIVE;
-	intel_gvt_check_vblank_emulation(vgpu->gvt);
+	intel_vgpu_update_vblank_emulation(vgpu);
 	return 0;
 }
 
@@ -725,7 +742,8 @@ static int pri_surf_mmio_write(struct intel_vgpu *vgpu, unsigned int offset,
 	write_vreg(vgpu, offset, p_data, bytes);
 	vgpu_vreg_t(vgpu, surflive_reg) = vgpu_vreg(vgpu, offset);
 
-	set_bit(flip_event[index], vgpu->irq.flip_done_event[index]);
+	intel_vgpu_queue_flip(vgpu, index, INTEL_VGPU_FLIP_PRIMARY,
+			      flip_event[index]);
 	return 0;
 }
 
@@ -746,7 +764,22 @@ static int spr_surf_mmio_write(struct intel_vgpu *vgpu, unsigned int offset,
 	write_vreg(vgpu, offset, p_data, bytes);
 	vgpu_vreg_t(vgpu, surflive_reg) = vgpu_vreg(vgpu, offset);
 
-	set_bit(flip_event[index], vgpu->irq.flip_done_event[index]);
+	intel_vgpu_queue_flip(vgpu, index, INTEL_VGPU_FLIP_SPRITE,
+			      flip_event[index]);
+	return 0;
+}
+
+#define CURBASE_TO_PIPE(offset) \
+	calc_index(offset, _CURABASE, _CURBBASE_IVB, 0, CURBASE(PIPE_C))
+
+static int cur_surf_mmio_write(struct intel_vgpu *vgpu, unsigned int offset,
+		void *p_data, unsigned int bytes)
+{
+	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
+
+	write_vreg(vgpu, offset, p_data, bytes);
+	intel_vgpu_queue_flip(vgpu, CURBASE_TO_PIPE(offset),
+			      INTEL_VGPU_FLIP_CURSOR, -1);
 	return 0;
 }
 
@@ -1120,9 +1153,9 @@ static int pvinfo_mmio_read(struct intel_vgpu *vgpu, unsigned int offset,
 			invalid_read = true;
 		break;
 	case _vgtif_reg(avail_rs.mappable_gmadr.base) ...
-		_vgtif_reg(avail_rs.fence_num):
+		_vgtif_reg(avail_rs.balloon_seqno):
 		if (offset + bytes >
-			_vgtif_reg(avail_rs.fence_num) + 4)
+			_vgtif_reg(avail_rs.balloon_seqno) + 4)
 			invalid_read = true;
 		break;
 	case 0x78010:	/* vgt_caps */
@@ -1139,13 +1172,11 @@ static int pvinfo_mmio_read(struct intel_vgpu *vgpu, unsigned int offset,
 	return 0;
 }
 
-static int handle_g2v_notification(struct intel_vgpu *vgpu, int notification)
+static int handle_g2v_message(struct intel_vgpu *vgpu, int notification,
+			      u64 *pdps)
 {
 	intel_gvt_gtt_type_t root_entry_type = GTT_TYPE_PPGTT_ROOT_L4_ENTRY;
 	struct intel_vgpu_mm *mm;
-	u64 *pdps;
-
-	pdps = (u64 *)&vgpu_vreg64_t(vgpu, vgtif_reg(pdp[0]));
 
 	switch (notification) {
 	case VGT_G2V_PPGTT_L3_PAGE_TABLE_CREATE:
@@ -1156,6 +1187,20 @@ static int handle_g2v_notification(struct intel_vgpu *vgpu, int notification)
 	case VGT_G2V_PPGTT_L3_PAGE_TABLE_DESTROY:
 	case VGT_G2V_PPGTT_L4_PAGE_TABLE_DESTROY:
 		return intel_vgpu_put_ppgtt_mm(vgpu, pdps);
+	case VGT_G2V_PPGTT_PV_RING_REGISTER:
+		return intel_vgpu_register_pv_ppgtt(vgpu, pdps[0]);
+	case VGT_G2V_PPGTT_PV_RING_FLUSH:
+		return intel_vgpu_sync_pv_ppgtt(vgpu);
+	case VGT_G2V_PV_SUBMISSION_REGISTER:
+		return intel_vgpu_register_pv_submission(vgpu, pdps[0]);
+	case VGT_G2V_PV_SUBMISSION_DOORBELL:
+		return intel_vgpu_pv_submit(vgpu);
+	case VGT_G2V_PV_TIMESTAMP_REGISTER:
+		return intel_vgpu_register_pv_timestamp(vgpu, pdps[0]);
+	case VGT_G2V_GGTT_BALLOON_ACK:
+		intel_gvt_ack_vgpu_balloon(vgpu, upper_32_bits(pdps[0]),
+					   lower_32_bits(pdps[0]));
+		return 0;
 	case VGT_G2V_EXECLIST_CONTEXT_CREATE:
 	case VGT_G2V_EXECLIST_CONTEXT_DESTROY:
 	case 1:	/* Remove this in guest driver. */
@@ -1166,6 +1211,117 @@ static int handle_g2v_notification(struct intel_vgpu *vgpu, int notification)
 	return 0;
 }
 
+/**
+ * intel_vgpu_register_pv_mailbox - set the mailbox page of a PV guest
+ * @vgpu: a vGPU
+ * @gpa: guest physical address of the page, 0 to drop it
+ *
+ * The notifications posted to the previous mailbox are handled first.
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+int intel_vgpu_register_pv_mailbox(struct intel_vgpu *vgpu, u64 gpa)
+{
+	intel_vgpu_drain_pv_mailbox(vgpu);
+	vgpu->pv_mailbox_gpa = 0;
+
+	if (!gpa)
+		return 0;
+
+	if (!IS_ALIGNED(gpa, PAGE_SIZE) ||
+	    !intel_gvt_hypervisor_is_valid_gfn(vgpu, gpa >> PAGE_SHIFT)) {
+		gvt_vgpu_err("invalid PV mailbox page 0x%llx\n", gpa);
+		return -EINVAL;
+	}
+
+	vgpu->pv_mailbox_gpa = gpa;
+	return 0;
+}
+
+/**
+ * intel_vgpu_drain_pv_mailbox - handle the notifications posted by a guest
+ * @vgpu: a vGPU
+ *
+ * This is called before handling a trapped notification and before any
+ * submission, so the guest's notifications are handled in order and
+ * always before the workloads that depend on them.
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+int intel_vgpu_drain_pv_mailbox(struct intel_vgpu *vgpu)
+{
+	u64 gpa = vgpu->pv_mailbox_gpa;
+	struct vgt_pv_mailbox_msg msg;
+	u32 head, tail;
+	int ret;
+
+	if (!gpa)
+		return 0;
+
+	ret = intel_gvt_hypervisor_read_gpa(vgpu,
+			gpa + offsetof(struct vgt_pv_mailbox, head),
+			&head, sizeof(head));
+	if (!ret)
+		ret = intel_gvt_hypervisor_read_gpa(vgpu,
+			gpa + offsetof(struct vgt_pv_mailbox, tail),
+			&tail, sizeof(tail));
+	if (ret || head == tail)
+		return ret;
+
+	if (tail - head > VGT_PV_MAILBOX_ENTRIES) {
+		gvt_vgpu_err("invalid PV mailbox head %u tail %u\n", head,
+			     tail);
+		head = tail;
+		ret = -EINVAL;
+	}
+
+	for (; head != tail; head++) {
+		ret = intel_gvt_hypervisor_read_gpa(vgpu,
+			gpa + offsetof(struct vgt_pv_mailbox,
+				       msg[head % VGT_PV_MAILBOX_ENTRIES]),
+			&msg, sizeof(msg));
+		if (ret)
+			break;
+
+		/* those would drain the mailbox again from here */
+		if (msg.notification == VGT_G2V_PV_MAILBOX_REGISTER ||
+		    msg.notification == VGT_G2V_PV_MAILBOX_DOORBELL ||
+		    msg.notification == VGT_G2V_PV_SUBMISSION_DOORBELL) {
+			gvt_vgpu_err("invalid posted PV notification %d\n",
+				     msg.notification);
+			continue;
+		}
+
+		if (handle_g2v_message(vgpu, msg.notification, msg.data))
+			gvt_vgpu_err("fail to handle posted PV notification %d\n",
+				     msg.notification);
+	}
+
+	if (intel_gvt_hypervisor_write_gpa(vgpu,
+			gpa + offsetof(struct vgt_pv_mailbox, head),
+			&head, sizeof(head)))
+		return -EFAULT;
+	return ret;
+}
+
+static int handle_g2v_notification(struct intel_vgpu *vgpu, int notification)
+{
+	u64 *pdps = (u64 *)&vgpu_vreg64_t(vgpu, vgtif_reg(pdp[0]));
+
+	switch (notification) {
+	case VGT_G2V_PV_MAILBOX_REGISTER:
+		return intel_vgpu_register_pv_mailbox(vgpu, pdps[0]);
+	case VGT_G2V_PV_MAILBOX_DOORBELL:
+		return intel_vgpu_drain_pv_mailbox(vgpu);
+	}
+
+	/* what the guest posted before comes first */
+	intel_vgpu_drain_pv_mailbox(vgpu);
+	return handle_g2v_message(vgpu, notification, pdps);
+}
+
 static int send_display_ready_uevent(struct intel_vgpu *vgpu, int ready)
 {
 	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
@@ -1318,6 +1474,30 @@ static int gen9_trtt_chicken_write(struct intel_vgpu *vgpu, unsigned int offset,
 	return 0;
 }
 
+static int gfx_flsh_cntl_write(struct intel_vgpu *vgpu, unsigned int offset,
+		void *p_data, unsigned int bytes)
+{
+	write_vreg(vgpu, offset, p_data, bytes);
+	intel_vgpu_flush_ggtt(vgpu);
+	return 0;
+}
+
+static int gamw_echo_dev_rw_ia_write(struct intel_vgpu *vgpu,
+		unsigned int offset, void *p_data, unsigned int bytes)
+{
+	u32 ips = (*(u32 *)p_data) & GAMW_ECO_ENABLE_64K_IPS_FIELD;
+
+	/* All engines must be enabled together for vGPU. */
+	if (ips != 0 && ips != GAMW_ECO_ENABLE_64K_IPS_FIELD) {
+		gvt_vgpu_err("Unsupported IPS setting %x, cannot enable 64K gtt.\n",
+			     ips);
+		return -EINVAL;
+	}
+
+	write_vreg(vgpu, offset, p_data, bytes);
+	return 0;
+}
+
 static int dpll_status_read(struct intel_vgpu *vgpu, unsigned int offset,
 		void *p_data, unsigned int bytes)
 {
@@ -1438,6 +1618,108 @@ static int skl_lcpll_write(struct intel_vgpu *vgpu, unsigned int offset,
 	return 0;
 }
 
+/*
+ * Guests read the ring timestamp as a LDW and UDW pair. Read both halves
+ * under one forcewake reference when the LDW is read, and let the UDW
+ * read that follows be served from the vreg, rather than taking forcewake
+ * for each half. Only a UDW read right after the LDW one is served so, a
+ * later or lone one reads the hardware.
+ */
+static void read_ring_timestamp(struct intel_vgpu *vgpu, int ring_id,
+				u32 ring_base)
+{
+	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
+	i915_reg_t ldw = RING_TIMESTAMP(ring_base);
+	i915_reg_t udw = RING_TIMESTAMP_UDW(ring_base);
+	enum forcewake_domains fw;
+	u32 upper, lower, old_upper, loop = 0;
+
+	clear_bit(ring_id, &vgpu->mmio.ts_udw_cached);
+
+	fw = intel_uncore_forcewake_for_reg(dev_priv, ldw, FW_REG_READ) |
+	     intel_uncore_forcewake_for_reg(dev_priv, udw, FW_REG_READ);
+
+	mmio_hw_access_pre(dev_priv);
+	intel_uncore_forcewake_get(dev_priv, fw);
+	upper = I915_READ_FW(udw);
+	do {
+		old_upper = upper;
+		lower = I915_READ_FW(ldw);
+		upper = I915_READ_FW(udw);
+	} while (upper != old_upper && loop++ < 2);
+	intel_uncore_forcewake_put(dev_priv, fw);
+	mmio_hw_access_post(dev_priv);
+
+	vgpu_vreg_t(vgpu, ldw) = lower;
+	vgpu_vreg_t(vgpu, udw) = upper;
+	vgpu->mmio.ts_ldw_jiffies[ring_id] = jiffies;
+	set_bit(ring_id, &vgpu->mmio.ts_udw_cached);
+}
+
+/**
+ * intel_vgpu_update_pv_timestamp - update the timestamp page of a PV guest
+ * @vgpu: a vGPU
+ *
+ * The generation follows the GPU reset count, since a reset may make the
+ * ring timestamp jump, after which the guest has to read it again. Called
+ * on workload completion, which a reset goes through.
+ */
+void intel_vgpu_update_pv_timestamp(struct intel_vgpu *vgpu)
+{
+	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
+	struct vgt_pv_timestamp page = {};
+
+	if (!vgpu->pv_timestamp_gpa)
+		return;
+
+	page.generation = i915_reset_count(&dev_priv->gpu_error);
+	if (page.generation == vgpu->pv_timestamp_generation)
+		return;
+
+	page.freq_khz = INTEL_INFO(dev_priv)->cs_timestamp_frequency_khz;
+	if (intel_gvt_hypervisor_write_gpa(vgpu, vgpu->pv_timestamp_gpa,
+					   &page, sizeof(page)))
+		return;
+
+	vgpu->pv_timestamp_generation = page.generation;
+}
+
+/**
+ * intel_vgpu_register_pv_timestamp - set the timestamp page of a PV guest
+ * @vgpu: a vGPU
+ * @gpa: guest physical address of the page, 0 to drop it
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+int intel_vgpu_register_pv_timestamp(struct intel_vgpu *vgpu, u64 gpa)
+{
+	struct vgt_pv_timestamp page = {};
+
+	vgpu->pv_timestamp_gpa = 0;
+
+	if (!gpa)
+		return 0;
+
+	if (!IS_ALIGNED(gpa, PAGE_SIZE) ||
+	    !intel_gvt_hypervisor_is_valid_gfn(vgpu, gpa >> PAGE_SHIFT)) {
+		gvt_vgpu_err("invalid PV timestamp page 0x%llx\n", gpa);
+		return -EINVAL;
+	}
+
+	/* Without a known frequency the guest keeps reading the register. */
+	page.freq_khz =
+		INTEL_INFO(vgpu->gvt->dev_priv)->cs_timestamp_frequency_khz;
+	page.generation =
+		i915_reset_count(&vgpu->gvt->dev_priv->gpu_error);
+	if (intel_gvt_hypervisor_write_gpa(vgpu, gpa, &page, sizeof(page)))
+		return -EFAULT;
+
+	vgpu->pv_timestamp_gpa = gpa;
+	vgpu->pv_timestamp_generation = page.generation;
+	return 0;
+}
+
 static int mmio_read_from_hw(struct intel_vgpu *vgpu,
 		unsigned int offset, void *p_data, unsigned int bytes)
 {
@@ -1453,17 +1735,29 @@ static int mmio_read_from_hw(struct intel_vgpu *vgpu,
 	 * b. the offset's ring is running on hw.
 	 * c. the offset is ring time stamp mmio
 	 */
-	if (ring_id >= 0)
+	if (ring_id >= 0) {
 		ring_base = dev_priv->engine[ring_id]->mmio_base;
 
+		if (offset == i915_mmio_reg_offset(RING_TIMESTAMP(ring_base))) {
+			read_ring_timestamp(vgpu, ring_id, ring_base);
+			goto out;
+		}
+		if (offset ==
+		    i915_mmio_reg_offset(RING_TIMESTAMP_UDW(ring_base)) &&
+		    test_and_clear_bit(ring_id, &vgpu->mmio.ts_udw_cached) &&
+		    time_before_eq(jiffies,
+				   vgpu->mmio.ts_ldw_jiffies[ring_id] + 1))
+			goto out;
+	}
+
 	if (ring_id < 0 || vgpu  == gvt->scheduler.engine_owner[ring_id] ||
-	    offset == i915_mmio_reg_offset(RING_TIMESTAMP(ring_base)) ||
 	    offset == i915_mmio_reg_offset(RING_TIMESTAMP_UDW(ring_base))) {
 		mmio_hw_access_pre(dev_priv);
 		vgpu_vreg(vgpu, offset) = I915_READ(_MMIO(offset));
 		mmio_hw_access_post(dev_priv);
 	}
 
+out:
 	return intel_vgpu_default_mmio_read(vgpu, offset, p_data, bytes);
 }
 
@@ -1538,31 +1832,25 @@ static int ring_mode_mmio_write(struct intel_vgpu *vgpu, unsigned int offset,
 static int gvt_reg_tlb_control_handler(struct intel_vgpu *vgpu,
 		unsigned int offset, void *p_data, unsigned int bytes)
 {
-	unsigned int id = 0;
-
-	write_vreg(vgpu, offset, p_data, bytes);
-	vgpu_vreg(vgpu, offset) = 0;
-
 	switch (offset) {
 	case 0x4260:
-		id = RCS;
-		break;
 	case 0x4264:
-		id = VCS;
-		break;
 	case 0x4268:
-		id = VCS2;
-		break;
 	case 0x426c:
-		id = BCS;
-		break;
 	case 0x4270:
-		id = VECS;
 		break;
 	default:
 		return -EINVAL;
 	}
-	set_bit(id, (void *)vgpu->submission.tlb_handle_pending);
+
+	/*
+	 * Every shadow request starts with a TLB invalidating flush emitted
+	 * by i915 (MI_FLUSH_DW or PIPE_CONTROL), so the GPU never runs a
+	 * guest workload behind a stale TLB. Report the invalidation as
+	 * complete right away instead of poking the hardware.
+	 */
+	write_vreg(vgpu, offset, p_data, bytes);
+	vgpu_vreg(vgpu, offset) = 0;
 
 	return 0;
 }
@@ -1763,9 +2051,9 @@ static int init_generic_mmio_info(struct intel_gvt *gvt)
 	MMIO_D(CURPOS(PIPE_B), D_ALL);
 	MMIO_D(CURPOS(PIPE_C), D_ALL);
 
-	MMIO_D(CURBASE(PIPE_A), D_ALL);
-	MMIO_D(CURBASE(PIPE_B), D_ALL);
-	MMIO_D(CURBASE(PIPE_C), D_ALL);
+	MMIO_DH(CURBASE(PIPE_A), D_ALL, NULL, cur_surf_mmio_write);
+	MMIO_DH(CURBASE(PIPE_B), D_ALL, NULL, cur_surf_mmio_write);
+	MMIO_DH(CURBASE(PIPE_C), D_ALL, NULL, cur_surf_mmio_write);
 
 	MMIO_D(_MMIO(0x700ac), D_ALL);
 	MMIO_D(_MMIO(0x710ac), D_ALL);
@@ -2310,7 +2598,7 @@ static int init_generic_mmio_info(struct intel_gvt *gvt)
 	MMIO_DH(GEN7_ERR_INT, D_ALL, NULL, NULL);
 	MMIO_D(HSW_EDRAM_CAP, D_ALL);
 	MMIO_D(HSW_IDICR, D_ALL);
-	MMIO_DH(GFX_FLSH_CNTL_GEN6, D_ALL, NULL, NULL);
+	MMIO_DH(GFX_FLSH_CNTL_GEN6, D_ALL, NULL, gfx_flsh_cntl_write);
 
 	MMIO_D(_MMIO(0x3c), D_ALL);
 	MMIO_D(_MMIO(0x860), D_ALL);
@@ -2650,6 +2938,8 @@ static int init_skl_mmio_info(struct intel_gvt *gvt)
 	MMIO_D(GEN9_MEDIA_PG_IDLE_HYSTERESIS, D_SKL_PLUS);
 	MMIO_D(GEN9_RENDER_PG_IDLE_HYSTERESIS, D_SKL_PLUS);
 	MMIO_DFH(GEN9_GAMT_ECO_REG_RW_IA, D_SKL_PLUS, F_CMD_ACCESS, NULL, NULL);
+	MMIO_DH(GEN8_GAMW_ECO_DEV_RW_IA, D_SKL_PLUS, NULL,
+		gamw_echo_dev_rw_ia_write);
 	MMIO_DH(_MMIO(0x4ddc), D_SKL_PLUS, NULL, NULL);
 	MMIO_DH(_MMIO(0x42080), D_SKL_PLUS, NULL, NULL);
 	MMIO_D(_MMIO(0x45504), D_SKL_PLUS);
@@ -2892,13 +3182,88 @@ void intel_gvt_clean_mmio_info(struct intel_gvt *gvt)
 	struct intel_gvt_mmio_info *e;
 	int i;
 
-	hash_for_each_safe(gvt->mmio.mmio_info_table, i, tmp, e, node)
+	hash_for_each_safe(gvt->mmio.mmio_info_table, i, tmp, e, node) {
+		hash_del(&e->node);
 		kfree(e);
+	}
+
+	vfree(gvt->mmio.mmio_info);
+	gvt->mmio.mmio_info = NULL;
+	vfree(gvt->mmio.mmio_info_index);
+	gvt->mmio.mmio_info_index = NULL;
 
 	vfree(gvt->mmio.mmio_attribute);
 	gvt->mmio.mmio_attribute = NULL;
 }
 
+/*
+ * Move the MMIO information built in the hash table into a compact array
+ * sorted by offset, and build the dense offset index used by the emulation
+ * path. Registers close to each other end up in the same cache lines,
+ * and a lookup needs no hash walk.
+ */
+static int compact_mmio_info(struct intel_gvt *gvt)
+{
+	unsigned int num = gvt->device_info.mmio_size >> 2;
+	struct intel_gvt_mmio_info *e;
+	struct hlist_node *tmp;
+	unsigned int i, pos;
+
+	if (WARN_ON(gvt->mmio.num_tracked_mmio >= U16_MAX))
+		return -EINVAL;
+
+	gvt->mmio.mmio_info_index = vzalloc(num * sizeof(u16));
+	if (!gvt->mmio.mmio_info_index)
+		return -ENOMEM;
+
+	gvt->mmio.mmio_info = vzalloc(gvt->mmio.num_tracked_mmio *
+				      sizeof(*gvt->mmio.mmio_info));
+	if (!gvt->mmio.mmio_info)
+		return -ENOMEM;
+
+	hash_for_each(gvt->mmio.mmio_info_table, i, e, node)
+		gvt->mmio.mmio_info_index[e->offset >> 2] = 1;
+
+	for (i = 0, pos = 0; i < num; i++) {
+		if (gvt->mmio.mmio_info_index[i])
+			gvt->mmio.mmio_info_index[i] = ++pos;
+	}
+
+	hash_for_each_safe(gvt->mmio.mmio_info_table, i, tmp, e, node) {
+		pos = gvt->mmio.mmio_info_index[e->offset >> 2] - 1;
+
+		hash_del(&e->node);
+		gvt->mmio.mmio_info[pos] = *e;
+		INIT_HLIST_NODE(&gvt->mmio.mmio_info[pos].node);
+		kfree(e);
+	}
+	return 0;
+}
+
+/*
+ * Registers emulated by the default handlers only keep their state in the
+ * vreg, so the hypervisor module is free to emulate them without leaving
+ * its MMIO exit path.
+ */
+static void mark_side_effect_free_mmio(struct intel_gvt *gvt)
+{
+	struct intel_gvt_mmio_info *info;
+	int i;
+
+	for (i = 0; i < gvt->mmio.num_tracked_mmio; i++) {
+		info = &gvt->mmio.mmio_info[i];
+
+		if (info->read != intel_vgpu_default_mmio_read ||
+		    info->write != intel_vgpu_default_mmio_write)
+			continue;
+		if (find_mmio_block(gvt, info->offset))
+			continue;
+
+		gvt->mmio.mmio_attribute[info->offset >> 2] |=
+			F_NO_SIDE_EFFECT;
+	}
+}
+
 /* Special MMIO blocks. */
 static struct gvt_mmio_block mmio_blocks[] = {
 	{D_SKL_PLUS, _MMIO(CSR_MMIO_START_RANGE), 0x3000, NULL, NULL},
@@ -2949,9 +3314,14 @@ int intel_gvt_setup_mmio_info(struct intel_gvt *gvt)
 			goto err;
 	}
 
+	ret = compact_mmio_info(gvt);
+	if (ret)
+		goto err;
+
 	gvt->mmio.mmio_block = mmio_blocks;
 	gvt->mmio.num_mmio_block = ARRAY_SIZE(mmio_blocks);
 
+	mark_side_effect_free_mmio(gvt);
 	return 0;
 err:
 	intel_gvt_clean_mmio_info(gvt);
@@ -2972,11 +3342,10 @@ int intel_gvt_for_each_tracked_mmio(struct intel_gvt *gvt,
 	void *data)
 {
 	struct gvt_mmio_block *block = gvt->mmio.mmio_block;
-	struct intel_gvt_mmio_info *e;
 	int i, j, ret;
 
-	hash_for_each(gvt->mmio.mmio_info_table, i, e, node) {
-		ret = handler(gvt, e->offset, data);
+	for (i = 0; i < gvt->mmio.num_tracked_mmio; i++) {
+		ret = handler(gvt, gvt->mmio.mmio_info[i].offset, data);
 		if (ret)
 			return ret;
 	}
@@ -3023,6 +3392,12 @@ int intel_vgpu_default_mmio_read(struct intel_vgpu *vgpu, unsigned int offset,
 int intel_vgpu_default_mmio_write(struct intel_vgpu *vgpu, unsigned int offset,
 		void *p_data, unsigned int bytes)
 {
+	int ret;
+
+	ret = intel_vgpu_own_vreg(vgpu, offset, bytes);
+	if (ret)
+		return ret;
+
 	write_vreg(vgpu, offset, p_data, bytes);
 	return 0;
 }
@@ -3092,13 +3467,11 @@ int intel_vgpu_mmio_reg_rw(struct intel_vgpu *vgpu, unsigned int offset,
 		return mmio_info->read(vgpu, offset, pdata, bytes);
 	else {
 		u64 ro_mask = mmio_info->ro_mask;
-		u32 old_vreg = 0, old_sreg = 0;
+		u32 old_vreg = 0;
 		u64 data = 0;
 
-		if (intel_gvt_mmio_has_mode_mask(gvt, mmio_info->offset)) {
+		if (intel_gvt_mmio_has_mode_mask(gvt, mmio_info->offset))
 			old_vreg = vgpu_vreg(vgpu, offset);
-			old_sreg = vgpu_sreg(vgpu, offset);
-		}
 
 		if (likely(!ro_mask))
 			ret = mmio_info->write(vgpu, offset, pdata, bytes);
@@ -3119,8 +3492,6 @@ int intel_vgpu_mmio_reg_rw(struct intel_vgpu *vgpu, unsigned int offset,
 
 			vgpu_vreg(vgpu, offset) = (old_vreg & ~mask)
 					| (vgpu_vreg(vgpu, offset) & mask);
-			vgpu_sreg(vgpu, offset) = (old_sreg & ~mask)
-					| (vgpu_sreg(vgpu, offset) & mask);
 		}
 	}
 
@@ -33,6 +33,13 @@
 #ifndef _GVT_HYPERCALL_H_
 #define _GVT_HYPERCALL_H_
 
+/* one guest physical range and its host buffer for bulk guest copies */
+struct intel_gvt_gpa_buf {
+	unsigned long gpa;
+	void *buf;
+	unsigned long len;
+};
+
 /*
  * Specific GVT-g MPT modules function collections. Currently GVT-g supports
  * both Xen and KVM by providing dedicated hypervisor-related MPT modules.
@@ -46,15 +53,22 @@ struct intel_gvt_mpt {
 	unsigned long (*from_virt_to_mfn)(void *p);
 	int (*enable_page_track)(unsigned long handle, u64 gfn);
 	int (*disable_page_track)(unsigned long handle, u64 gfn);
+	int (*enable_page_tracks)(unsigned long handle, unsigned long *gfns,
+				  unsigned int count);
 	int (*read_gpa)(unsigned long handle, unsigned long gpa, void *buf,
 			unsigned long len);
 	int (*write_gpa)(unsigned long handle, unsigned long gpa, void *buf,
 			 unsigned long len);
+	int (*rw_gpa_bulk)(unsigned long handle, struct intel_gvt_gpa_buf *bufs,
+			   unsigned int count, bool write);
 	unsigned long (*gfn_to_mfn)(unsigned long handle, unsigned long gfn);
 
 	int (*dma_map_guest_page)(unsigned long handle, unsigned long gfn,
-				  dma_addr_t *dma_addr);
-	void (*dma_unmap_guest_page)(unsigned long handle, dma_addr_t dma_addr);
+				  unsigned long size, dma_addr_t *dma_addr);
+	int (*dma_map_guest_pages)(unsigned long handle, unsigned long *gfns,
+				   unsigned int count, dma_addr_t *dma_addrs);
+	void (*dma_unmap_guest_page)(unsigned long handle, dma_addr_t dma_addr,
+				     unsigned long size);
 
 	int (*map_gfn_to_mfn)(unsigned long handle, unsigned long gfn,
 			      unsigned long mfn, unsigned int nr, bool map);
@@ -64,6 +78,9 @@ struct intel_gvt_mpt {
 	int (*get_vfio_device)(void *vgpu);
 	void (*put_vfio_device)(void *vgpu);
 	bool (*is_valid_gfn)(unsigned long handle, unsigned long gfn);
+	void (*notify_plane_flip)(unsigned long handle);
+	struct page *(*get_guest_page)(unsigned long handle, unsigned long gfn);
+	void (*put_guest_page)(unsigned long handle, struct page *page);
 };
 
 extern struct intel_gvt_mpt xengt_mpt;
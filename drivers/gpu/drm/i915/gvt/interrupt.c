@@ -48,6 +48,15 @@
 #define irq_to_gvt(irq) \
 	container_of(irq, struct intel_gvt, irq)
 
+/*
+ * An MSI which the guest hasn't acknowledged within one scheduling
+ * tick is considered lost and is injected again.
+ */
+#define GVT_MSI_COALESCE_PERIOD	1000000
+
+/* upper bound of the latency added by interrupt moderation */
+#define GVT_IRQ_MODERATION_MAX_USECS	10000
+
 static void update_upstream_irq(struct intel_vgpu *vgpu,
 		struct intel_gvt_irq_info *info);
 
@@ -223,6 +232,12 @@ int intel_vgpu_reg_master_irq_handler(struct intel_vgpu *vgpu,
 	vgpu_vreg(vgpu, reg) &= ~GEN8_MASTER_IRQ_CONTROL;
 	vgpu_vreg(vgpu, reg) |= ier;
 
+	/*
+	 * The guest touches the master IRQ register on entering and
+	 * leaving its interrupt handler, so the MSI has been taken.
+	 */
+	vgpu->irq.msi_inflight = 0;
+
 	ops->check_pending_irq(vgpu);
 
 	return 0;
@@ -393,6 +408,19 @@ static void init_irq_map(struct intel_gvt_irq *irq)
 /* =======================vEvent injection===================== */
 static int inject_virtual_interrupt(struct intel_vgpu *vgpu)
 {
+	ktime_t now = ktime_get();
+
+	/*
+	 * Events raised while an earlier MSI is still being delivered
+	 * are picked up by the guest handler of that MSI, so coalesce
+	 * them instead of kicking the hypervisor once per event.
+	 */
+	if (vgpu->irq.msi_inflight &&
+	    ktime_before(now, ktime_add_ns(vgpu->irq.msi_inflight,
+					   GVT_MSI_COALESCE_PERIOD)))
+		return 0;
+
+	vgpu->irq.msi_inflight = now;
 	return intel_gvt_hypervisor_inject_msi(vgpu);
 }
 
@@ -604,6 +632,59 @@ static struct intel_gvt_irq_ops gen8_irq_ops = {
 	.check_pending_irq = gen8_check_pending_irq,
 };
 
+static bool is_ring_completion_event(enum intel_gvt_event_type event)
+{
+	switch (event) {
+	case RCS_MI_USER_INTERRUPT:
+	case RCS_AS_CONTEXT_SWITCH:
+	case VCS_MI_USER_INTERRUPT:
+	case VCS_AS_CONTEXT_SWITCH:
+	case VCS2_MI_USER_INTERRUPT:
+	case VCS2_AS_CONTEXT_SWITCH:
+	case BCS_MI_USER_INTERRUPT:
+	case BCS_AS_CONTEXT_SWITCH:
+	case VECS_MI_USER_INTERRUPT:
+	case VECS_AS_CONTEXT_SWITCH:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Hold back the injection of a ring completion event until enough of them
+ * have been collected or the moderation window expires. The IIR bits are
+ * latched already, so the guest sees every event once the MSI arrives.
+ * Returns true if the injection is deferred.
+ */
+static bool moderate_virtual_event(struct intel_vgpu *vgpu,
+	enum intel_gvt_event_type event)
+{
+	struct intel_vgpu_irq *irq = &vgpu->irq;
+
+	if (!irq->moderation_usecs || !is_ring_completion_event(event)) {
+		if (irq->moderated) {
+			hrtimer_try_to_cancel(&irq->moderation_timer);
+			irq->moderated = 0;
+		}
+		return false;
+	}
+
+	if (irq->moderation_count &&
+	    irq->moderated + 1 >= irq->moderation_count) {
+		hrtimer_try_to_cancel(&irq->moderation_timer);
+		irq->moderated = 0;
+		return false;
+	}
+
+	if (!irq->moderated++)
+		hrtimer_start(&irq->moderation_timer,
+			      ns_to_ktime(irq->moderation_usecs *
+					  NSEC_PER_USEC),
+			      HRTIMER_MODE_REL);
+	return true;
+}
+
 /**
  * intel_vgpu_trigger_virtual_event - Trigger a virtual event for a vGPU
  * @vgpu: a vGPU
@@ -627,51 +708,107 @@ void intel_vgpu_trigger_virtual_event(struct intel_vgpu *vgpu,
 
 	handler(irq, event, vgpu);
 
+	if (moderate_virtual_event(vgpu, event))
+		return;
+
 	ops->check_pending_irq(vgpu);
 }
 
-static void init_events(
-	struct intel_gvt_irq *irq)
+static enum hrtimer_restart moderation_timer_fn(struct hrtimer *data)
 {
-	int i;
+	struct intel_vgpu_irq *irq;
+	struct intel_vgpu *vgpu;
 
-	for (i = 0; i < INTEL_GVT_EVENT_MAX; i++) {
-		irq->events[i].info = NULL;
-		irq->events[i].v_handler = handle_default_event_virt;
+	irq = container_of(data, struct intel_vgpu_irq, moderation_timer);
+	vgpu = container_of(irq, struct intel_vgpu, irq);
+
+	queue_work(system_highpri_wq, &irq->flush_work);
+	return HRTIMER_NORESTART;
+}
+
+/* Inject the interrupts held back once the moderation window expired. */
+static void flush_irq_work_fn(struct work_struct *work)
+{
+	struct intel_vgpu *vgpu = container_of(work, struct intel_vgpu,
+					       irq.flush_work);
+
+	mutex_lock(&vgpu->vgpu_lock);
+	if (vgpu->active && vgpu->irq.moderated) {
+		vgpu->irq.moderated = 0;
+		vgpu->gvt->irq.ops->check_pending_irq(vgpu);
 	}
+	mutex_unlock(&vgpu->vgpu_lock);
 }
 
-static enum hrtimer_restart vblank_timer_fn(struct hrtimer *data)
+/**
+ * intel_vgpu_set_irq_moderation - set the interrupt moderation of a vGPU
+ * @vgpu: a vGPU
+ * @usecs: longest time a ring completion interrupt may be held back
+ * @count: number of held back events which forces an injection
+ *
+ * This function configures how ring completion interrupts of a vGPU are
+ * batched. A zero @usecs disables the moderation, a zero @count leaves only
+ * the time limit in place.
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+int intel_vgpu_set_irq_moderation(struct intel_vgpu *vgpu,
+	unsigned int usecs, unsigned int count)
 {
-	struct intel_gvt_vblank_timer *vblank_timer;
-	struct intel_gvt_irq *irq;
-	struct intel_gvt *gvt;
+	if (usecs > GVT_IRQ_MODERATION_MAX_USECS)
+		return -EINVAL;
 
-	vblank_timer = container_of(data, struct intel_gvt_vblank_timer, timer);
-	irq = container_of(vblank_timer, struct intel_gvt_irq, vblank_timer);
-	gvt = container_of(irq, struct intel_gvt, irq);
+	mutex_lock(&vgpu->vgpu_lock);
+	vgpu->irq.moderation_usecs = usecs;
+	vgpu->irq.moderation_count = count;
+	if (!usecs && vgpu->irq.moderated) {
+		hrtimer_cancel(&vgpu->irq.moderation_timer);
+		vgpu->irq.moderated = 0;
+		if (vgpu->active)
+			vgpu->gvt->irq.ops->check_pending_irq(vgpu);
+	}
+	mutex_unlock(&vgpu->vgpu_lock);
 
-	intel_gvt_request_service(gvt, INTEL_GVT_REQUEST_EMULATE_VBLANK);
-	hrtimer_add_expires_ns(&vblank_timer->timer, vblank_timer->period);
-	return HRTIMER_RESTART;
+	return 0;
 }
 
 /**
- * intel_gvt_clean_irq - clean up GVT-g IRQ emulation subsystem
- * @gvt: a GVT device
- *
- * This function is called at driver unloading stage, to clean up GVT-g IRQ
- * emulation subsystem.
+ * intel_vgpu_init_irq - initialize the per-vGPU IRQ emulation state
+ * @vgpu: a vGPU
  *
  */
-void intel_gvt_clean_irq(struct intel_gvt *gvt)
+void intel_vgpu_init_irq(struct intel_vgpu *vgpu)
 {
-	struct intel_gvt_irq *irq = &gvt->irq;
+	hrtimer_init(&vgpu->irq.moderation_timer, CLOCK_MONOTONIC,
+		     HRTIMER_MODE_REL);
+	vgpu->irq.moderation_timer.function = moderation_timer_fn;
+	INIT_WORK(&vgpu->irq.flush_work, flush_irq_work_fn);
+}
 
-	hrtimer_cancel(&irq->vblank_timer.timer);
+/**
+ * intel_vgpu_clean_irq - stop the per-vGPU IRQ emulation
+ * @vgpu: a vGPU
+ *
+ * This function drops the interrupts still held back by the moderation.
+ *
+ */
+void intel_vgpu_clean_irq(struct intel_vgpu *vgpu)
+{
+	hrtimer_cancel(&vgpu->irq.moderation_timer);
+	vgpu->irq.moderated = 0;
 }
 
-#define VBLNAK_TIMER_PERIOD 16000000
+static void init_events(
+	struct intel_gvt_irq *irq)
+{
+	int i;
+
+	for (i = 0; i < INTEL_GVT_EVENT_MAX; i++) {
+		irq->events[i].info = NULL;
+		irq->events[i].v_handler = handle_default_event_virt;
+	}
+}
 
 /**
  * intel_gvt_init_irq - initialize GVT-g IRQ emulation subsystem
@@ -686,7 +823,6 @@ void intel_gvt_clean_irq(struct intel_gvt *gvt)
 int intel_gvt_init_irq(struct intel_gvt *gvt)
 {
 	struct intel_gvt_irq *irq = &gvt->irq;
-	struct intel_gvt_vblank_timer *vblank_timer = &irq->vblank_timer;
 
 	gvt_dbg_core("init irq framework\n");
 
@@ -707,9 +843,5 @@ int intel_gvt_init_irq(struct intel_gvt *gvt)
 
 	init_irq_map(irq);
 
-	hrtimer_init(&vblank_timer->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
-	vblank_timer->timer.function = vblank_timer_fn;
-	vblank_timer->period = VBLNAK_TIMER_PERIOD;
-
 	return 0;
 }
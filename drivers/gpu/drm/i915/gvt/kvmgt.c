@@ -31,7 +31,9 @@
 #include <linux/init.h>
 #include <linux/device.h>
 #include <linux/mm.h>
+#include <linux/pfn_t.h>
 #include <linux/mmu_context.h>
+#include <linux/sched/mm.h>
 #include <linux/types.h>
 #include <linux/list.h>
 #include <linux/rbtree.h>
@@ -39,9 +41,11 @@
 #include <linux/eventfd.h>
 #include <linux/uuid.h>
 #include <linux/kvm_host.h>
+#include <kvm/iodev.h>
 #include <linux/vfio.h>
 #include <linux/mdev.h>
 #include <linux/debugfs.h>
+#include <linux/sort.h>
 
 #include "i915_drv.h"
 #include "gvt.h"
@@ -62,6 +66,8 @@ struct intel_vgpu_regops {
 			size_t count, loff_t *ppos, bool iswrite);
 	void (*release)(struct intel_vgpu *vgpu,
 			struct vfio_region *region);
+	int (*mmap)(struct intel_vgpu *vgpu, struct vfio_region *region,
+			struct vm_area_struct *vma);
 };
 
 struct vfio_region {
@@ -86,17 +92,32 @@ struct kvmgt_guest_info {
 	struct hlist_head ptable[NR_BKT];
 #undef NR_BKT
 	struct dentry *debugfs_cache_entries;
+	struct kvm_io_device mmio_dev;
+	struct work_struct mmio_dev_work;
+	u64 mmio_dev_gpa;
+	u64 mmio_dev_base;
 };
 
 struct gvt_dma {
 	struct intel_vgpu *vgpu;
-	struct rb_node gfn_node;
-	struct rb_node dma_addr_node;
 	gfn_t gfn;
 	dma_addr_t dma_addr;
+	unsigned long size;
 	struct kref ref;
+	struct list_head idle;	/* on vdev.dma_idle_list when ref is 0 */
+	struct rcu_head rcu;
 };
 
+static bool defer_elsp;
+module_param(defer_elsp, bool, 0444);
+MODULE_PARM_DESC(defer_elsp,
+	"Latch guest ELSP writes in kernel and submit them from a worker");
+
+static unsigned int dma_retain_mb = 1024;
+module_param(dma_retain_mb, uint, 0644);
+MODULE_PARM_DESC(dma_retain_mb,
+	"Guest DMA mappings kept cached per vGPU once unused, in MB (default: 1024)");
+
 static inline bool handle_valid(unsigned long handle)
 {
 	return !!(handle & ~0xff);
@@ -106,30 +127,144 @@ static int kvmgt_guest_init(struct mdev_device *mdev);
 static void intel_vgpu_release_work(struct work_struct *work);
 static bool kvmgt_guest_exit(struct kvmgt_guest_info *info);
 
-static int gvt_dma_map_page(struct intel_vgpu *vgpu, unsigned long gfn,
-		dma_addr_t *dma_addr)
+/* Fill gfns with the consecutive guest pfns of [gfn, gfn + size). */
+static unsigned long *gvt_alloc_gfn_range(unsigned long gfn,
+		unsigned long size)
 {
-	struct device *dev = &vgpu->gvt->dev_priv->drm.pdev->dev;
-	struct page *page;
-	unsigned long pfn;
+	unsigned long npage = size >> PAGE_SHIFT, i;
+	unsigned long *gfns;
+
+	gfns = kmalloc_array(npage, sizeof(*gfns), GFP_KERNEL);
+	if (!gfns)
+		return NULL;
+
+	for (i = 0; i < npage; i++)
+		gfns[i] = gfn + i;
+	return gfns;
+}
+
+/* gfns unpinned per vfio_unpin_pages() call, from an on-stack array */
+#define GVT_UNPIN_CHUNK 16
+
+static void gvt_unpin_guest_page(struct intel_vgpu *vgpu, unsigned long gfn,
+		unsigned long size)
+{
+	unsigned long npage = size >> PAGE_SHIFT;
+	unsigned long gfns[GVT_UNPIN_CHUNK];
+	unsigned long i, n;
+	int ret;
+
+	/*
+	 * Unpinning can't fail for lack of memory, or the pins would leak.
+	 * vfio unpins each gfn on its own anyway.
+	 */
+	while (npage) {
+		n = min_t(unsigned long, npage, GVT_UNPIN_CHUNK);
+		for (i = 0; i < n; i++)
+			gfns[i] = gfn + i;
+
+		ret = vfio_unpin_pages(mdev_dev(vgpu->vdev.mdev), gfns, n);
+		WARN_ON(ret != n);
+
+		gfn += n;
+		npage -= n;
+	}
+}
+
+/*
+ * Pin the guest pages backing [gfn, gfn + size) with one vfio_pin_pages()
+ * call, so that vfio can track a contiguous range as a single extent. A
+ * range larger than a page is only pinned if its host pages are
+ * contiguous, -E2BIG is returned if they are not, so that the caller can
+ * fall back to 4K mappings.
+ */
+static int gvt_pin_guest_page(struct intel_vgpu *vgpu, unsigned long gfn,
+		unsigned long size, struct page **page)
+{
+	unsigned long npage = size >> PAGE_SHIFT, i;
+	unsigned long *gfns, *pfns, pfn;
 	int ret;
 
-	/* Pin the page first. */
-	ret = vfio_pin_pages(mdev_dev(vgpu->vdev.mdev), &gfn, 1,
-			     IOMMU_READ | IOMMU_WRITE, &pfn);
-	if (ret != 1) {
+	if (WARN_ON(npage > VFIO_PIN_PAGES_MAX_ENTRIES))
+		return -EINVAL;
+
+	if (npage == 1) {
+		gfns = &gfn;
+		pfns = &pfn;
+	} else {
+		gfns = gvt_alloc_gfn_range(gfn, size);
+		pfns = kmalloc_array(npage, sizeof(*pfns), GFP_KERNEL);
+		if (!gfns || !pfns) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	ret = vfio_pin_pages(mdev_dev(vgpu->vdev.mdev), gfns, npage,
+			     IOMMU_READ | IOMMU_WRITE, pfns);
+	if (ret != npage) {
 		gvt_vgpu_err("vfio_pin_pages failed for gfn 0x%lx: %d\n",
 			     gfn, ret);
-		return -EINVAL;
+		if (ret > 0)
+			vfio_unpin_pages(mdev_dev(vgpu->vdev.mdev), gfns, ret);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (!pfn_valid(pfns[0])) {
+		gvt_vgpu_err("pfn 0x%lx is not mem backed\n", pfns[0]);
+		ret = -EFAULT;
+		goto err;
+	}
+
+	if (npage > 1) {
+		struct page *head = compound_head(pfn_to_page(pfns[0]));
+
+		/* Only map the range at once if a huge page backs it. */
+		if (!IS_ALIGNED(pfns[0], npage) || !PageCompound(head) ||
+		    (PAGE_SIZE << compound_order(head)) < size) {
+			ret = -E2BIG;
+			goto err;
+		}
+
+		for (i = 1; i < npage; i++) {
+			if (pfns[i] != pfns[0] + i) {
+				ret = -E2BIG;
+				goto err;
+			}
+		}
+	}
+
+	*page = pfn_to_page(pfns[0]);
+	ret = 0;
+	goto out;
+err:
+	vfio_unpin_pages(mdev_dev(vgpu->vdev.mdev), gfns, npage);
+out:
+	if (npage > 1) {
+		kfree(pfns);
+		kfree(gfns);
 	}
+	return ret;
+}
+
+static int gvt_dma_map_page(struct intel_vgpu *vgpu, unsigned long gfn,
+		dma_addr_t *dma_addr, unsigned long size)
+{
+	struct device *dev = &vgpu->gvt->dev_priv->drm.pdev->dev;
+	struct page *page = NULL;
+	int ret;
+
+	/* Pin the pages first. */
+	ret = gvt_pin_guest_page(vgpu, gfn, size, &page);
+	if (ret)
+		return ret;
 
 	/* Setup DMA mapping. */
-	page = pfn_to_page(pfn);
-	*dma_addr = dma_map_page(dev, page, 0, PAGE_SIZE,
-				 PCI_DMA_BIDIRECTIONAL);
+	*dma_addr = dma_map_page(dev, page, 0, size, PCI_DMA_BIDIRECTIONAL);
 	if (dma_mapping_error(dev, *dma_addr)) {
 		gvt_vgpu_err("DMA mapping failed for gfn 0x%lx\n", gfn);
-		vfio_unpin_pages(mdev_dev(vgpu->vdev.mdev), &gfn, 1);
+		gvt_unpin_guest_page(vgpu, gfn, size);
 		return -ENOMEM;
 	}
 
@@ -137,134 +272,326 @@ static int gvt_dma_map_page(struct intel_vgpu *vgpu, unsigned long gfn,
 }
 
 static void gvt_dma_unmap_page(struct intel_vgpu *vgpu, unsigned long gfn,
-		dma_addr_t dma_addr)
+		dma_addr_t dma_addr, unsigned long size)
 {
 	struct device *dev = &vgpu->gvt->dev_priv->drm.pdev->dev;
+
+	dma_unmap_page(dev, dma_addr, size, PCI_DMA_BIDIRECTIONAL);
+	gvt_unpin_guest_page(vgpu, gfn, size);
+}
+
+/*
+ * Tearing down many cached mappings at once (vGPU destruction, or the
+ * guest unmapping a large iova range) would otherwise cost a
+ * vfio_unpin_pages() call, and so an iommu container lookup and lock,
+ * per 4K page. Collect the single page gfns and unpin them together;
+ * huge entries are already unpinned as a single range.
+ */
+#define GVT_UNPIN_BATCH 32
+
+struct gvt_unpin_batch {
+	struct intel_vgpu *vgpu;
+	unsigned int count;
+	unsigned long gfns[GVT_UNPIN_BATCH];
+};
+
+static void gvt_unpin_batch_flush(struct gvt_unpin_batch *batch)
+{
 	int ret;
 
-	dma_unmap_page(dev, dma_addr, PAGE_SIZE, PCI_DMA_BIDIRECTIONAL);
-	ret = vfio_unpin_pages(mdev_dev(vgpu->vdev.mdev), &gfn, 1);
-	WARN_ON(ret != 1);
+	if (!batch->count)
+		return;
+
+	ret = vfio_unpin_pages(mdev_dev(batch->vgpu->vdev.mdev),
+			       batch->gfns, batch->count);
+	WARN_ON(ret != batch->count);
+	batch->count = 0;
 }
 
-static struct gvt_dma *__gvt_cache_find_dma_addr(struct intel_vgpu *vgpu,
-		dma_addr_t dma_addr)
+static void gvt_dma_unmap_page_batched(struct gvt_unpin_batch *batch,
+		unsigned long gfn, dma_addr_t dma_addr, unsigned long size)
 {
-	struct rb_node *node = vgpu->vdev.dma_addr_cache.rb_node;
-	struct gvt_dma *itr;
+	struct intel_vgpu *vgpu = batch->vgpu;
+	struct device *dev = &vgpu->gvt->dev_priv->drm.pdev->dev;
 
-	while (node) {
-		itr = rb_entry(node, struct gvt_dma, dma_addr_node);
+	dma_unmap_page(dev, dma_addr, size, PCI_DMA_BIDIRECTIONAL);
 
-		if (dma_addr < itr->dma_addr)
-			node = node->rb_left;
-		else if (dma_addr > itr->dma_addr)
-			node = node->rb_right;
-		else
-			return itr;
+	if (size != PAGE_SIZE) {
+		gvt_unpin_guest_page(vgpu, gfn, size);
+		return;
 	}
-	return NULL;
+
+	batch->gfns[batch->count++] = gfn;
+	if (batch->count == ARRAY_SIZE(batch->gfns))
+		gvt_unpin_batch_flush(batch);
+}
+
+/*
+ * The caches are radix trees keyed by page frame number and size, as a
+ * guest page can be mapped both on its own and as part of a huge page at
+ * the same time. Lookups can be done under RCU, changes are serialized by
+ * cache_lock.
+ */
+static unsigned long gvt_dma_key(u64 pfn, unsigned long size)
+{
+	return (pfn << 1) | (size > PAGE_SIZE);
 }
 
-static struct gvt_dma *__gvt_cache_find_gfn(struct intel_vgpu *vgpu, gfn_t gfn)
+static struct gvt_dma *__gvt_cache_find_dma_addr(struct intel_vgpu *vgpu,
+		dma_addr_t dma_addr, unsigned long size)
 {
-	struct rb_node *node = vgpu->vdev.gfn_cache.rb_node;
-	struct gvt_dma *itr;
+	return radix_tree_lookup(&vgpu->vdev.dma_addr_cache,
+				 gvt_dma_key(dma_addr >> PAGE_SHIFT, size));
+}
 
-	while (node) {
-		itr = rb_entry(node, struct gvt_dma, gfn_node);
+static struct gvt_dma *__gvt_cache_find_gfn(struct intel_vgpu *vgpu, gfn_t gfn,
+		unsigned long size)
+{
+	return radix_tree_lookup(&vgpu->vdev.gfn_cache,
+				 gvt_dma_key(gfn, size));
+}
 
-		if (gfn < itr->gfn)
-			node = node->rb_left;
-		else if (gfn > itr->gfn)
-			node = node->rb_right;
-		else
-			return itr;
-	}
-	return NULL;
+/*
+ * Dirty page logging
+ *
+ * The GPU may write any guest page mapped for its DMA, whether it backs a
+ * render target or a writable PTE, so the pages are accounted dirty as
+ * long as they stay mapped: when they get mapped, when they get unmapped,
+ * and on every read of the bitmap for the ones mapped in between. Nothing
+ * but a NULL check is paid while logging is off. The bitmap is protected
+ * by the cache_lock.
+ */
+#define GVT_DIRTY_BITMAP_OFFSET	PAGE_SIZE
+/* enough for 1TB of guest memory */
+#define GVT_DIRTY_BITMAP_MAX	SZ_32M
+
+static void gvt_dirty_mark(struct intel_vgpu *vgpu, gfn_t gfn,
+		unsigned long size)
+{
+	unsigned long n = DIV_ROUND_UP(size, PAGE_SIZE);
+
+	if (gfn >= vgpu->vdev.dirty_bitmap_pages)
+		return;
+
+	n = min_t(unsigned long, n, vgpu->vdev.dirty_bitmap_pages - gfn);
+	bitmap_set(vgpu->vdev.dirty_bitmap, gfn, n);
 }
 
 static int __gvt_cache_add(struct intel_vgpu *vgpu, gfn_t gfn,
-		dma_addr_t dma_addr)
+		dma_addr_t dma_addr, unsigned long size)
 {
-	struct gvt_dma *new, *itr;
-	struct rb_node **link, *parent = NULL;
+	struct gvt_dma *new;
+	int ret;
 
-	new = kzalloc(sizeof(struct gvt_dma), GFP_KERNEL);
+	new = kzalloc(sizeof(struct gvt_dma), GFP_KERNEL_ACCOUNT);
 	if (!new)
 		return -ENOMEM;
 
 	new->vgpu = vgpu;
 	new->gfn = gfn;
 	new->dma_addr = dma_addr;
+	new->size = size;
 	kref_init(&new->ref);
+	INIT_LIST_HEAD(&new->idle);
 
 	/* gfn_cache maps gfn to struct gvt_dma. */
-	link = &vgpu->vdev.gfn_cache.rb_node;
-	while (*link) {
-		parent = *link;
-		itr = rb_entry(parent, struct gvt_dma, gfn_node);
-
-		if (gfn < itr->gfn)
-			link = &parent->rb_left;
-		else
-			link = &parent->rb_right;
-	}
-	rb_link_node(&new->gfn_node, parent, link);
-	rb_insert_color(&new->gfn_node, &vgpu->vdev.gfn_cache);
+	ret = radix_tree_insert(&vgpu->vdev.gfn_cache,
+				gvt_dma_key(gfn, size), new);
+	if (ret)
+		goto err_free;
 
 	/* dma_addr_cache maps dma addr to struct gvt_dma. */
-	parent = NULL;
-	link = &vgpu->vdev.dma_addr_cache.rb_node;
-	while (*link) {
-		parent = *link;
-		itr = rb_entry(parent, struct gvt_dma, dma_addr_node);
-
-		if (dma_addr < itr->dma_addr)
-			link = &parent->rb_left;
-		else
-			link = &parent->rb_right;
-	}
-	rb_link_node(&new->dma_addr_node, parent, link);
-	rb_insert_color(&new->dma_addr_node, &vgpu->vdev.dma_addr_cache);
+	ret = radix_tree_insert(&vgpu->vdev.dma_addr_cache,
+				gvt_dma_key(dma_addr >> PAGE_SHIFT, size), new);
+	if (ret)
+		goto err_delete;
 
 	vgpu->vdev.nr_cache_entries++;
+	if (unlikely(vgpu->vdev.dirty_bitmap))
+		gvt_dirty_mark(vgpu, gfn, size);
 	return 0;
+
+err_delete:
+	radix_tree_delete(&vgpu->vdev.gfn_cache, gvt_dma_key(gfn, size));
+err_free:
+	kfree(new);
+	return ret;
 }
 
 static void __gvt_cache_remove_entry(struct intel_vgpu *vgpu,
 				struct gvt_dma *entry)
 {
-	rb_erase(&entry->gfn_node, &vgpu->vdev.gfn_cache);
-	rb_erase(&entry->dma_addr_node, &vgpu->vdev.dma_addr_cache);
-	kfree(entry);
+	if (unlikely(vgpu->vdev.dirty_bitmap))
+		gvt_dirty_mark(vgpu, entry->gfn, entry->size);
+	if (!list_empty(&entry->idle)) {
+		list_del(&entry->idle);
+		vgpu->vdev.dma_idle_size -= entry->size;
+	}
+	radix_tree_delete(&vgpu->vdev.gfn_cache,
+			  gvt_dma_key(entry->gfn, entry->size));
+	radix_tree_delete(&vgpu->vdev.dma_addr_cache,
+			  gvt_dma_key(entry->dma_addr >> PAGE_SHIFT, entry->size));
+	/* Lockless lookups may still be looking at it. */
+	kfree_rcu(entry, rcu);
 	vgpu->vdev.nr_cache_entries--;
 }
 
+/*
+ * Idle entries
+ *
+ * An entry whose last user is gone stays mapped on the idle list instead of
+ * being unmapped, up to dma_retain_mb per vGPU. A guest that reboots or
+ * reloads its driver tears down every GTT and maps the same pages again
+ * right away, finding them here spares pinning its working set once more.
+ * Idle entries go away, oldest first, beyond the limit, when the memory
+ * slot or the vfio mapping of their pages is removed, and at guest exit.
+ */
+static void __gvt_dma_get(struct gvt_dma *entry)
+{
+	if (kref_get_unless_zero(&entry->ref))
+		return;
+
+	list_del_init(&entry->idle);
+	entry->vgpu->vdev.dma_idle_size -= entry->size;
+	kref_init(&entry->ref);
+}
+
+static void __gvt_dma_idle_trim(struct intel_vgpu *vgpu, unsigned long limit)
+{
+	struct gvt_dma *entry;
+
+	while (vgpu->vdev.dma_idle_size > limit) {
+		entry = list_last_entry(&vgpu->vdev.dma_idle_list,
+					struct gvt_dma, idle);
+		gvt_dma_unmap_page(vgpu, entry->gfn, entry->dma_addr,
+				   entry->size);
+		__gvt_cache_remove_entry(vgpu, entry);
+	}
+}
+
+static void gvt_dma_idle_drop_range(struct intel_vgpu *vgpu, gfn_t gfn,
+		unsigned long npages)
+{
+	struct gvt_unpin_batch batch = { .vgpu = vgpu };
+	struct gvt_dma *entry, *tmp;
+
+	mutex_lock(&vgpu->vdev.cache_lock);
+	list_for_each_entry_safe(entry, tmp, &vgpu->vdev.dma_idle_list, idle) {
+		if (entry->gfn >= gfn + npages ||
+		    entry->gfn + (entry->size >> PAGE_SHIFT) <= gfn)
+			continue;
+
+		gvt_dma_unmap_page_batched(&batch, entry->gfn,
+					   entry->dma_addr, entry->size);
+		__gvt_cache_remove_entry(vgpu, entry);
+	}
+	gvt_unpin_batch_flush(&batch);
+	mutex_unlock(&vgpu->vdev.cache_lock);
+}
+
 static void gvt_cache_destroy(struct intel_vgpu *vgpu)
 {
+	struct gvt_unpin_batch batch = { .vgpu = vgpu };
 	struct gvt_dma *dma;
-	struct rb_node *node = NULL;
+	unsigned int n;
 
-	for (;;) {
+	do {
 		mutex_lock(&vgpu->vdev.cache_lock);
-		node = rb_first(&vgpu->vdev.gfn_cache);
-		if (!node) {
-			mutex_unlock(&vgpu->vdev.cache_lock);
-			break;
+		for (n = 0; n < GVT_UNPIN_BATCH; n++) {
+			if (!radix_tree_gang_lookup(&vgpu->vdev.gfn_cache,
+						    (void **)&dma, 0, 1))
+				break;
+
+			gvt_dma_unmap_page_batched(&batch, dma->gfn,
+						   dma->dma_addr, dma->size);
+			__gvt_cache_remove_entry(vgpu, dma);
 		}
-		dma = rb_entry(node, struct gvt_dma, gfn_node);
-		gvt_dma_unmap_page(vgpu, dma->gfn, dma->dma_addr);
-		__gvt_cache_remove_entry(vgpu, dma);
+		gvt_unpin_batch_flush(&batch);
+		mutex_unlock(&vgpu->vdev.cache_lock);
+	} while (n == GVT_UNPIN_BATCH);
+}
+
+static void gvt_dirty_log_stop(struct intel_vgpu *vgpu)
+{
+	mutex_lock(&vgpu->vdev.cache_lock);
+	kvfree(vgpu->vdev.dirty_bitmap);
+	vgpu->vdev.dirty_bitmap = NULL;
+	vgpu->vdev.dirty_bitmap_pages = 0;
+	mutex_unlock(&vgpu->vdev.cache_lock);
+}
+
+static int gvt_dirty_log_start(struct intel_vgpu *vgpu)
+{
+	struct kvm *kvm = vgpu->vdev.kvm;
+	struct kvm_memory_slot *memslot;
+	unsigned long *bitmap, pages = 0;
+	int idx;
+
+	idx = srcu_read_lock(&kvm->srcu);
+	kvm_for_each_memslot(memslot, kvm_memslots(kvm))
+		pages = max(pages, (unsigned long)(memslot->base_gfn +
+						   memslot->npages));
+	srcu_read_unlock(&kvm->srcu, idx);
+
+	if (BITS_TO_LONGS(pages) * sizeof(long) > GVT_DIRTY_BITMAP_MAX)
+		return -E2BIG;
+
+	bitmap = kvzalloc(BITS_TO_LONGS(pages) * sizeof(long), GFP_KERNEL);
+	if (!bitmap)
+		return -ENOMEM;
+
+	mutex_lock(&vgpu->vdev.cache_lock);
+	if (vgpu->vdev.dirty_bitmap) {
 		mutex_unlock(&vgpu->vdev.cache_lock);
+		kvfree(bitmap);
+		return 0;
+	}
+	vgpu->vdev.dirty_bitmap = bitmap;
+	vgpu->vdev.dirty_bitmap_pages = pages;
+	mutex_unlock(&vgpu->vdev.cache_lock);
+	return 0;
+}
+
+/* Copy out the bitmap in [pos, pos + count) and clear it. */
+static size_t gvt_dirty_log_read(struct intel_vgpu *vgpu, char *buf,
+		size_t count, loff_t pos)
+{
+	size_t size = BITS_TO_LONGS(vgpu->vdev.dirty_bitmap_pages) *
+		      sizeof(long);
+	struct radix_tree_iter iter;
+	struct gvt_dma *entry;
+	void __rcu **slot;
+	size_t len = 0;
+
+	mutex_lock(&vgpu->vdev.cache_lock);
+	if (!vgpu->vdev.dirty_bitmap)
+		goto out;
+
+	rcu_read_lock();
+	radix_tree_for_each_slot(slot, &vgpu->vdev.gfn_cache, &iter, 0) {
+		entry = radix_tree_deref_slot(slot);
+		gvt_dirty_mark(vgpu, entry->gfn, entry->size);
+	}
+	rcu_read_unlock();
+
+	if (pos < size) {
+		len = min(count, (size_t)(size - pos));
+		memcpy(buf, (void *)vgpu->vdev.dirty_bitmap + pos, len);
+		memset((void *)vgpu->vdev.dirty_bitmap + pos, 0, len);
 	}
+out:
+	mutex_unlock(&vgpu->vdev.cache_lock);
+	memset(buf + len, 0, count - len);
+	return count;
 }
 
 static void gvt_cache_init(struct intel_vgpu *vgpu)
 {
-	vgpu->vdev.gfn_cache = RB_ROOT;
-	vgpu->vdev.dma_addr_cache = RB_ROOT;
+	INIT_RADIX_TREE(&vgpu->vdev.gfn_cache, GFP_KERNEL);
+	INIT_RADIX_TREE(&vgpu->vdev.dma_addr_cache, GFP_KERNEL);
 	vgpu->vdev.nr_cache_entries = 0;
+	INIT_LIST_HEAD(&vgpu->vdev.dma_idle_list);
+	vgpu->vdev.dma_idle_size = 0;
 	mutex_init(&vgpu->vdev.cache_lock);
 }
 
@@ -364,90 +691,322 @@ static const struct intel_vgpu_regops intel_vgpu_regops_opregion = {
 	.release = intel_vgpu_reg_release_opregion,
 };
 
-static int intel_vgpu_register_reg(struct intel_vgpu *vgpu,
-		unsigned int type, unsigned int subtype,
-		const struct intel_vgpu_regops *ops,
-		size_t size, u32 flags, void *data)
+static size_t intel_vgpu_reg_rw_dirty_bitmap(struct intel_vgpu *vgpu,
+		char *buf, size_t count, loff_t *ppos, bool iswrite)
 {
-	struct vfio_region *region;
-
-	region = krealloc(vgpu->vdev.region,
-			(vgpu->vdev.num_regions + 1) * sizeof(*region),
-			GFP_KERNEL);
-	if (!region)
-		return -ENOMEM;
+	unsigned int i = VFIO_PCI_OFFSET_TO_INDEX(*ppos) -
+			VFIO_PCI_NUM_REGIONS;
+	loff_t pos = *ppos & VFIO_PCI_OFFSET_MASK;
+	struct vfio_igd_dirty_bitmap_ctl ctl;
+	int ret;
 
-	vgpu->vdev.region = region;
-	vgpu->vdev.region[vgpu->vdev.num_regions].type = type;
-	vgpu->vdev.region[vgpu->vdev.num_regions].subtype = subtype;
-	vgpu->vdev.region[vgpu->vdev.num_regions].ops = ops;
-	vgpu->vdev.region[vgpu->vdev.num_regions].size = size;
-	vgpu->vdev.region[vgpu->vdev.num_regions].flags = flags;
-	vgpu->vdev.region[vgpu->vdev.num_regions].data = data;
-	vgpu->vdev.num_regions++;
-	return 0;
-}
+	if (!handle_valid(vgpu->handle))
+		return -ENODEV;
 
-static int kvmgt_get_vfio_device(void *p_vgpu)
-{
-	struct intel_vgpu *vgpu = (struct intel_vgpu *)p_vgpu;
+	if (pos >= GVT_DIRTY_BITMAP_OFFSET) {
+		if (iswrite || pos + count > vgpu->vdev.region[i].size)
+			return -EINVAL;
+		return gvt_dirty_log_read(vgpu, buf, count,
+					  pos - GVT_DIRTY_BITMAP_OFFSET);
+	}
 
-	vgpu->vdev.vfio_device = vfio_device_get_from_dev(
-		mdev_dev(vgpu->vdev.mdev));
-	if (!vgpu->vdev.vfio_device) {
-		gvt_vgpu_err("failed to get vfio device\n");
-		return -ENODEV;
+	if (iswrite) {
+		if (pos != offsetof(struct vfio_igd_dirty_bitmap_ctl, logging) ||
+		    count != sizeof(ctl.logging))
+			return -EINVAL;
+		memcpy(&ctl.logging, buf, count);
+		if (!ctl.logging) {
+			gvt_dirty_log_stop(vgpu);
+			return count;
+		}
+		ret = gvt_dirty_log_start(vgpu);
+		return ret ? ret : count;
 	}
-	return 0;
-}
 
+	if (pos + count > sizeof(ctl))
+		return -EINVAL;
 
-static int kvmgt_set_opregion(void *p_vgpu)
-{
-	struct intel_vgpu *vgpu = (struct intel_vgpu *)p_vgpu;
-	void *base;
-	int ret;
+	mutex_lock(&vgpu->vdev.cache_lock);
+	ctl.logging = !!vgpu->vdev.dirty_bitmap;
+	ctl.nr_pages = vgpu->vdev.dirty_bitmap_pages;
+	mutex_unlock(&vgpu->vdev.cache_lock);
+	ctl.bitmap_offset = GVT_DIRTY_BITMAP_OFFSET;
+	memcpy(buf, (void *)&ctl + pos, count);
+	return count;
+}
 
-	/* Each vgpu has its own opregion, although VFIO would create another
-	 * one later. This one is used to expose opregion to VFIO. And the
-	 * other one created by VFIO later, is used by guest actually.
-	 */
-	base = vgpu_opregion(vgpu)->va;
-	if (!base)
-		return -ENOMEM;
+static void intel_vgpu_reg_release_dirty_bitmap(struct intel_vgpu *vgpu,
+		struct vfio_region *region)
+{
+}
 
-	if (memcmp(base, OPREGION_SIGNATURE, 16)) {
-		memunmap(base);
-		return -EINVAL;
-	}
+static const struct intel_vgpu_regops intel_vgpu_regops_dirty_bitmap = {
+	.rw = intel_vgpu_reg_rw_dirty_bitmap,
+	.release = intel_vgpu_reg_release_dirty_bitmap,
+};
 
-	ret = intel_vgpu_register_reg(vgpu,
-			PCI_VENDOR_ID_INTEL | VFIO_REGION_TYPE_PCI_VENDOR_TYPE,
-			VFIO_REGION_SUBTYPE_INTEL_IGD_OPREGION,
-			&intel_vgpu_regops_opregion, OPREGION_SIZE,
-			VFIO_REGION_INFO_FLAG_READ, base);
+/*
+ * Device state
+ *
+ * The state saved by the last PRECOPY or SAVE action, or written for the
+ * next LOAD one, is buffered in state_data until it is replaced.
+ */
+#define GVT_DEVICE_STATE_OFFSET	PAGE_SIZE
+#define GVT_DEVICE_STATE_MAX	SZ_32M
 
-	return ret;
+static void gvt_state_free(struct intel_vgpu *vgpu)
+{
+	kvfree(vgpu->vdev.state_data);
+	vgpu->vdev.state_data = NULL;
+	vgpu->vdev.state_size = 0;
 }
 
-static void kvmgt_put_vfio_device(void *vgpu)
+static int gvt_state_action(struct intel_vgpu *vgpu, u32 action)
 {
-	if (WARN_ON(!((struct intel_vgpu *)vgpu)->vdev.vfio_device))
-		return;
+	int ret;
 
-	vfio_device_put(((struct intel_vgpu *)vgpu)->vdev.vfio_device);
+	switch (action) {
+	case VFIO_IGD_DEVICE_STATE_PRECOPY:
+	case VFIO_IGD_DEVICE_STATE_SAVE:
+		gvt_state_free(vgpu);
+		ret = intel_gvt_ops->vgpu_save_state(vgpu,
+				action == VFIO_IGD_DEVICE_STATE_SAVE,
+				&vgpu->vdev.state_data, &vgpu->vdev.state_size);
+		if (!ret && vgpu->vdev.state_size > GVT_DEVICE_STATE_MAX) {
+			gvt_state_free(vgpu);
+			ret = -E2BIG;
+		}
+		return ret;
+	case VFIO_IGD_DEVICE_STATE_LOAD:
+		if (!vgpu->vdev.state_data)
+			return -EINVAL;
+		ret = intel_gvt_ops->vgpu_load_state(vgpu,
+				vgpu->vdev.state_data, vgpu->vdev.state_size);
+		gvt_state_free(vgpu);
+		return ret;
+	case VFIO_IGD_DEVICE_STATE_CANCEL:
+		intel_gvt_ops->vgpu_stop_save_state(vgpu);
+		gvt_state_free(vgpu);
+		return 0;
+	default:
+		return -EINVAL;
+	}
 }
 
-static int intel_vgpu_create(struct kobject *kobj, struct mdev_device *mdev)
+static size_t gvt_state_rw_ctl(struct intel_vgpu *vgpu, char *buf,
+		size_t count, loff_t pos, bool iswrite)
 {
-	struct intel_vgpu *vgpu = NULL;
-	struct intel_vgpu_type *type;
-	struct device *pdev;
-	void *gvt;
+	struct vfio_igd_device_state_ctl ctl;
+	u64 size;
 	int ret;
 
-	pdev = mdev_parent_dev(mdev);
-	gvt = kdev_to_i915(pdev)->gvt;
+	if (pos + count > sizeof(ctl))
+		return -EINVAL;
+
+	if (!iswrite) {
+		ctl.action = 0;
+		ctl.reserved = 0;
+		ctl.data_size = vgpu->vdev.state_size;
+		ctl.data_offset = GVT_DEVICE_STATE_OFFSET;
+		memcpy(buf, (void *)&ctl + pos, count);
+		return count;
+	}
+
+	if (pos == offsetof(struct vfio_igd_device_state_ctl, action) &&
+	    count == sizeof(ctl.action)) {
+		memcpy(&ctl.action, buf, count);
+		ret = gvt_state_action(vgpu, ctl.action);
+		return ret ? ret : count;
+	}
+
+	if (pos == offsetof(struct vfio_igd_device_state_ctl, data_size) &&
+	    count == sizeof(ctl.data_size)) {
+		memcpy(&size, buf, count);
+		if (!size || size > GVT_DEVICE_STATE_MAX)
+			return -EINVAL;
+		gvt_state_free(vgpu);
+		vgpu->vdev.state_data = kvzalloc(size, GFP_KERNEL);
+		if (!vgpu->vdev.state_data)
+			return -ENOMEM;
+		vgpu->vdev.state_size = size;
+		return count;
+	}
+
+	return -EINVAL;
+}
+
+static size_t intel_vgpu_reg_rw_device_state(struct intel_vgpu *vgpu,
+		char *buf, size_t count, loff_t *ppos, bool iswrite)
+{
+	loff_t pos = *ppos & VFIO_PCI_OFFSET_MASK;
+	size_t ret;
+
+	if (!handle_valid(vgpu->handle))
+		return -ENODEV;
+
+	mutex_lock(&vgpu->vdev.state_lock);
+	if (pos < GVT_DEVICE_STATE_OFFSET) {
+		ret = gvt_state_rw_ctl(vgpu, buf, count, pos, iswrite);
+		goto out;
+	}
+
+	pos -= GVT_DEVICE_STATE_OFFSET;
+	if (pos + count > vgpu->vdev.state_size) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (iswrite)
+		memcpy(vgpu->vdev.state_data + pos, buf, count);
+	else
+		memcpy(buf, vgpu->vdev.state_data + pos, count);
+	ret = count;
+out:
+	mutex_unlock(&vgpu->vdev.state_lock);
+	return ret;
+}
+
+static void intel_vgpu_reg_release_device_state(struct intel_vgpu *vgpu,
+		struct vfio_region *region)
+{
+	mutex_lock(&vgpu->vdev.state_lock);
+	gvt_state_free(vgpu);
+	mutex_unlock(&vgpu->vdev.state_lock);
+}
+
+static const struct intel_vgpu_regops intel_vgpu_regops_device_state = {
+	.rw = intel_vgpu_reg_rw_device_state,
+	.release = intel_vgpu_reg_release_device_state,
+};
+
+static size_t intel_vgpu_reg_rw_cursor(struct intel_vgpu *vgpu, char *buf,
+		size_t count, loff_t *ppos, bool iswrite)
+{
+	unsigned int i = VFIO_PCI_OFFSET_TO_INDEX(*ppos) -
+			VFIO_PCI_NUM_REGIONS;
+	loff_t pos = *ppos & VFIO_PCI_OFFSET_MASK;
+
+	if (pos >= vgpu->vdev.region[i].size || iswrite)
+		return -EINVAL;
+	count = min(count, (size_t)(vgpu->vdev.region[i].size - pos));
+	memcpy(buf, vgpu->vdev.region[i].data + pos, count);
+
+	return count;
+}
+
+static void intel_vgpu_reg_release_cursor(struct intel_vgpu *vgpu,
+		struct vfio_region *region)
+{
+}
+
+/*
+ * The cursor page is inserted as a normal page, the mapping holds a
+ * reference on it which keeps it around after the vGPU is gone.
+ */
+static int intel_vgpu_reg_mmap_cursor(struct intel_vgpu *vgpu,
+		struct vfio_region *region, struct vm_area_struct *vma)
+{
+	unsigned long pgoff = vma->vm_pgoff &
+		((1UL << (VFIO_PCI_OFFSET_SHIFT - PAGE_SHIFT)) - 1);
+
+	if (pgoff || vma->vm_end - vma->vm_start != region->size ||
+	    (vma->vm_flags & VM_WRITE))
+		return -EINVAL;
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	return vm_insert_page(vma, vma->vm_start, virt_to_page(region->data));
+}
+
+static const struct intel_vgpu_regops intel_vgpu_regops_cursor = {
+	.rw = intel_vgpu_reg_rw_cursor,
+	.release = intel_vgpu_reg_release_cursor,
+	.mmap = intel_vgpu_reg_mmap_cursor,
+};
+
+static int intel_vgpu_register_reg(struct intel_vgpu *vgpu,
+		unsigned int type, unsigned int subtype,
+		const struct intel_vgpu_regops *ops,
+		size_t size, u32 flags, void *data)
+{
+	struct vfio_region *region;
+
+	region = krealloc(vgpu->vdev.region,
+			(vgpu->vdev.num_regions + 1) * sizeof(*region),
+			GFP_KERNEL);
+	if (!region)
+		return -ENOMEM;
+
+	vgpu->vdev.region = region;
+	vgpu->vdev.region[vgpu->vdev.num_regions].type = type;
+	vgpu->vdev.region[vgpu->vdev.num_regions].subtype = subtype;
+	vgpu->vdev.region[vgpu->vdev.num_regions].ops = ops;
+	vgpu->vdev.region[vgpu->vdev.num_regions].size = size;
+	vgpu->vdev.region[vgpu->vdev.num_regions].flags = flags;
+	vgpu->vdev.region[vgpu->vdev.num_regions].data = data;
+	vgpu->vdev.num_regions++;
+	return 0;
+}
+
+static int kvmgt_get_vfio_device(void *p_vgpu)
+{
+	struct intel_vgpu *vgpu = (struct intel_vgpu *)p_vgpu;
+
+	vgpu->vdev.vfio_device = vfio_device_get_from_dev(
+		mdev_dev(vgpu->vdev.mdev));
+	if (!vgpu->vdev.vfio_device) {
+		gvt_vgpu_err("failed to get vfio device\n");
+		return -ENODEV;
+	}
+	return 0;
+}
+
+
+static int kvmgt_set_opregion(void *p_vgpu)
+{
+	struct intel_vgpu *vgpu = (struct intel_vgpu *)p_vgpu;
+	void *base;
+	int ret;
+
+	/* Each vgpu has its own opregion, although VFIO would create another
+	 * one later. This one is used to expose opregion to VFIO. And the
+	 * other one created by VFIO later, is used by guest actually.
+	 */
+	base = vgpu_opregion(vgpu)->va;
+	if (!base)
+		return -ENOMEM;
+
+	if (memcmp(base, OPREGION_SIGNATURE, 16)) {
+		memunmap(base);
+		return -EINVAL;
+	}
+
+	ret = intel_vgpu_register_reg(vgpu,
+			PCI_VENDOR_ID_INTEL | VFIO_REGION_TYPE_PCI_VENDOR_TYPE,
+			VFIO_REGION_SUBTYPE_INTEL_IGD_OPREGION,
+			&intel_vgpu_regops_opregion, OPREGION_SIZE,
+			VFIO_REGION_INFO_FLAG_READ, base);
+
+	return ret;
+}
+
+static void kvmgt_put_vfio_device(void *vgpu)
+{
+	if (WARN_ON(!((struct intel_vgpu *)vgpu)->vdev.vfio_device))
+		return;
+
+	vfio_device_put(((struct intel_vgpu *)vgpu)->vdev.vfio_device);
+}
+
+static int intel_vgpu_create(struct kobject *kobj, struct mdev_device *mdev)
+{
+	struct intel_vgpu *vgpu = NULL;
+	struct intel_vgpu_type *type;
+	struct device *pdev;
+	void *gvt;
+	int ret;
+
+	pdev = mdev_parent_dev(mdev);
+	gvt = kdev_to_i915(pdev)->gvt;
 
 	type = intel_gvt_ops->gvt_find_vgpu_type(gvt, kobject_name(kobj));
 	if (!type) {
@@ -465,10 +1024,43 @@ static int intel_vgpu_create(struct kobject *kobj, struct mdev_device *mdev)
 	}
 
 	INIT_WORK(&vgpu->vdev.release_work, intel_vgpu_release_work);
+	spin_lock_init(&vgpu->vdev.display_trigger_lock);
 
 	vgpu->vdev.mdev = mdev;
 	mdev_set_drvdata(mdev, vgpu);
 
+	ret = intel_vgpu_register_reg(vgpu,
+			PCI_VENDOR_ID_INTEL | VFIO_REGION_TYPE_PCI_VENDOR_TYPE,
+			VFIO_REGION_SUBTYPE_INTEL_IGD_DIRTY_BITMAP,
+			&intel_vgpu_regops_dirty_bitmap,
+			GVT_DIRTY_BITMAP_OFFSET + GVT_DIRTY_BITMAP_MAX,
+			VFIO_REGION_INFO_FLAG_READ |
+			VFIO_REGION_INFO_FLAG_WRITE, NULL);
+	if (ret)
+		gvt_vgpu_err("failed to register dirty bitmap region: %d\n",
+			     ret);
+
+	mutex_init(&vgpu->vdev.state_lock);
+	ret = intel_vgpu_register_reg(vgpu,
+			PCI_VENDOR_ID_INTEL | VFIO_REGION_TYPE_PCI_VENDOR_TYPE,
+			VFIO_REGION_SUBTYPE_INTEL_IGD_DEVICE_STATE,
+			&intel_vgpu_regops_device_state,
+			GVT_DEVICE_STATE_OFFSET + GVT_DEVICE_STATE_MAX,
+			VFIO_REGION_INFO_FLAG_READ |
+			VFIO_REGION_INFO_FLAG_WRITE, NULL);
+	if (ret)
+		gvt_vgpu_err("failed to register device state region: %d\n",
+			     ret);
+
+	ret = intel_vgpu_register_reg(vgpu,
+			PCI_VENDOR_ID_INTEL | VFIO_REGION_TYPE_PCI_VENDOR_TYPE,
+			VFIO_REGION_SUBTYPE_INTEL_IGD_CURSOR,
+			&intel_vgpu_regops_cursor, PAGE_SIZE,
+			VFIO_REGION_INFO_FLAG_READ |
+			VFIO_REGION_INFO_FLAG_MMAP, vgpu->display.cursor.page);
+	if (ret)
+		gvt_vgpu_err("failed to register cursor region: %d\n", ret);
+
 	gvt_dbg_core("intel_vgpu_create succeeded for mdev: %s\n",
 		     dev_name(mdev_dev(mdev)));
 	ret = 0;
@@ -497,21 +1089,35 @@ static int intel_vgpu_iommu_notifier(struct notifier_block *nb,
 
 	if (action == VFIO_IOMMU_NOTIFY_DMA_UNMAP) {
 		struct vfio_iommu_type1_dma_unmap *unmap = data;
+		struct gvt_unpin_batch batch = { .vgpu = vgpu };
 		struct gvt_dma *entry;
-		unsigned long iov_pfn, end_iov_pfn;
+		unsigned long iov_pfn, end_iov_pfn, key;
 
 		iov_pfn = unmap->iova >> PAGE_SHIFT;
 		end_iov_pfn = iov_pfn + unmap->size / PAGE_SIZE;
 
+		/*
+		 * Drop every cached mapping overlapping the unmapped range,
+		 * starting early enough to catch a 2M one, the largest size
+		 * that gets mapped.
+		 */
+		key = gvt_dma_key(round_down(iov_pfn, SZ_2M >> PAGE_SHIFT), 0);
+
 		mutex_lock(&vgpu->vdev.cache_lock);
-		for (; iov_pfn < end_iov_pfn; iov_pfn++) {
-			entry = __gvt_cache_find_gfn(vgpu, iov_pfn);
-			if (!entry)
+		while (radix_tree_gang_lookup(&vgpu->vdev.gfn_cache,
+					      (void **)&entry, key, 1)) {
+			if (entry->gfn >= end_iov_pfn)
+				break;
+
+			key = gvt_dma_key(entry->gfn, entry->size) + 1;
+			if (entry->gfn + (entry->size >> PAGE_SHIFT) <= iov_pfn)
 				continue;
 
-			gvt_dma_unmap_page(vgpu, entry->gfn, entry->dma_addr);
+			gvt_dma_unmap_page_batched(&batch, entry->gfn,
+						   entry->dma_addr, entry->size);
 			__gvt_cache_remove_entry(vgpu, entry);
 		}
+		gvt_unpin_batch_flush(&batch);
 		mutex_unlock(&vgpu->vdev.cache_lock);
 	}
 
@@ -563,15 +1169,27 @@ static int intel_vgpu_open(struct mdev_device *mdev)
 		goto undo_iommu;
 	}
 
+	vgpu->vdev.aperture_va = io_mapping_map_wc(
+			&vgpu->gvt->dev_priv->ggtt.iomap,
+			vgpu_aperture_offset(vgpu), vgpu_aperture_sz(vgpu));
+	if (!vgpu->vdev.aperture_va) {
+		ret = -EIO;
+		goto undo_group;
+	}
+
 	ret = kvmgt_guest_init(mdev);
 	if (ret)
-		goto undo_group;
+		goto undo_aperture;
 
 	intel_gvt_ops->vgpu_activate(vgpu);
 
 	atomic_set(&vgpu->vdev.released, 0);
 	return ret;
 
+undo_aperture:
+	io_mapping_unmap(vgpu->vdev.aperture_va);
+	vgpu->vdev.aperture_va = NULL;
+
 undo_group:
 	vfio_unregister_notifier(mdev_dev(mdev), VFIO_GROUP_NOTIFY,
 					&vgpu->vdev.group_notifier);
@@ -583,6 +1201,17 @@ static int intel_vgpu_open(struct mdev_device *mdev)
 	return ret;
 }
 
+static void intel_vgpu_swap_display_trigger(struct intel_vgpu *vgpu,
+		struct eventfd_ctx *trigger)
+{
+	spin_lock(&vgpu->vdev.display_trigger_lock);
+	swap(vgpu->vdev.display_trigger, trigger);
+	spin_unlock(&vgpu->vdev.display_trigger_lock);
+
+	if (trigger)
+		eventfd_ctx_put(trigger);
+}
+
 static void __intel_vgpu_release(struct intel_vgpu *vgpu)
 {
 	struct kvmgt_guest_info *info;
@@ -604,9 +1233,14 @@ static void __intel_vgpu_release(struct intel_vgpu *vgpu)
 					&vgpu->vdev.group_notifier);
 	WARN(ret, "vfio_unregister_notifier for group failed: %d\n", ret);
 
+	intel_vgpu_swap_display_trigger(vgpu, NULL);
+
 	info = (struct kvmgt_guest_info *)vgpu->handle;
 	kvmgt_guest_exit(info);
 
+	io_mapping_unmap(vgpu->vdev.aperture_va);
+	vgpu->vdev.aperture_va = NULL;
+
 	vgpu->vdev.kvm = NULL;
 	vgpu->handle = 0;
 }
@@ -674,10 +1308,13 @@ static inline bool intel_vgpu_in_aperture(struct intel_vgpu *vgpu, uint64_t off)
 	       off < vgpu_aperture_offset(vgpu) + vgpu_aperture_sz(vgpu);
 }
 
+/* BAR2 accesses from read() and write() of at least this size are bulk */
+#define APERTURE_BULK_MIN	64
+
 static int intel_vgpu_aperture_rw(struct intel_vgpu *vgpu, uint64_t off,
 		void *buf, unsigned long count, bool is_write)
 {
-	void *aperture_va;
+	void __iomem *aperture_va;
 
 	if (!intel_vgpu_in_aperture(vgpu, off) ||
 	    !intel_vgpu_in_aperture(vgpu, off + count)) {
@@ -685,18 +1322,18 @@ static int intel_vgpu_aperture_rw(struct intel_vgpu *vgpu, uint64_t off,
 		return -EINVAL;
 	}
 
-	aperture_va = io_mapping_map_wc(&vgpu->gvt->dev_priv->ggtt.iomap,
-					ALIGN_DOWN(off, PAGE_SIZE),
-					count + offset_in_page(off));
-	if (!aperture_va)
+	if (!vgpu->vdev.aperture_va)
 		return -EIO;
 
-	if (is_write)
-		memcpy(aperture_va + offset_in_page(off), buf, count);
-	else
-		memcpy(buf, aperture_va + offset_in_page(off), count);
+	aperture_va = vgpu->vdev.aperture_va + off - vgpu_aperture_offset(vgpu);
 
-	io_mapping_unmap(aperture_va);
+	/* Reads from WC memory are uncached, stream the large ones. */
+	if (is_write)
+		memcpy_toio(aperture_va, buf, count);
+	else if (count < APERTURE_BULK_MIN ||
+		 !intel_gvt_ops->memcpy_from_wc(buf,
+				(const void __force *)aperture_va, count))
+		memcpy_fromio(buf, aperture_va, count);
 
 	return 0;
 }
@@ -758,29 +1395,102 @@ static bool gtt_entry(struct mdev_device *mdev, loff_t *ppos)
 	int offset;
 
 	/* Only allow MMIO GGTT entry access */
-	if (index != PCI_BASE_ADDRESS_0)
+	if (index != VFIO_PCI_BAR0_REGION_INDEX)
 		return false;
 
-	offset = (u64)(*ppos & VFIO_PCI_OFFSET_MASK) -
-		intel_vgpu_get_bar_gpa(vgpu, PCI_BASE_ADDRESS_0);
+	offset = (u64)(*ppos & VFIO_PCI_OFFSET_MASK);
 
 	return (offset >= gvt->device_info.gtt_start_offset &&
 		offset < gvt->device_info.gtt_start_offset + gvt_ggtt_sz(gvt)) ?
 			true : false;
 }
 
+/*
+ * Large BAR2 accesses go through a bounce page a page at a time instead of
+ * an aperture access per dword. The chunks are aligned to the aperture
+ * pages after the first one.
+ */
+static bool aperture_bulk(loff_t pos, size_t count)
+{
+	return VFIO_PCI_OFFSET_TO_INDEX(pos) == VFIO_PCI_BAR2_REGION_INDEX &&
+	       count >= APERTURE_BULK_MIN;
+}
+
+/*
+ * Large aligned accesses to the GGTT entries in BAR0, as done by a VMM
+ * saving or restoring the GGTT, are emulated a bounce page at a time under
+ * a single lock hold. Returns the size of the bulk access at *ppos, or 0.
+ */
+static size_t gtt_bulk_len(struct mdev_device *mdev, loff_t *ppos,
+			   size_t count)
+{
+	struct intel_vgpu *vgpu = mdev_get_drvdata(mdev);
+	const struct intel_gvt_device_info *info = &vgpu->gvt->device_info;
+	u64 offset = *ppos & VFIO_PCI_OFFSET_MASK;
+	u64 end = info->gtt_start_offset + gvt_ggtt_sz(vgpu->gvt);
+
+	if (count < 2 * info->gtt_entry_size ||
+	    !IS_ALIGNED(offset, info->gtt_entry_size) || !gtt_entry(mdev, ppos))
+		return 0;
+
+	count = min_t(u64, count, end - offset);
+	count = min_t(size_t, count, PAGE_SIZE - offset_in_page(offset));
+	return round_down(count, info->gtt_entry_size);
+}
+
+static int intel_vgpu_ggtt_rw(struct mdev_device *mdev, loff_t pos,
+			      void *buf, size_t count, bool is_write)
+{
+	struct intel_vgpu *vgpu = mdev_get_drvdata(mdev);
+	u64 bar_start = intel_vgpu_get_bar_addr(vgpu, PCI_BASE_ADDRESS_0);
+
+	return intel_gvt_ops->emulate_ggtt_rw(vgpu,
+			bar_start + (pos & VFIO_PCI_OFFSET_MASK), buf, count,
+			is_write);
+}
+
 static ssize_t intel_vgpu_read(struct mdev_device *mdev, char __user *buf,
 			size_t count, loff_t *ppos)
 {
 	unsigned int done = 0;
+	void *bounce = NULL;
 	int ret;
 
 	while (count) {
 		size_t filled;
 
-		/* Only support GGTT entry 8 bytes read */
-		if (count >= 8 && !(*ppos % 8) &&
+		if (aperture_bulk(*ppos, count)) {
+			if (!bounce) {
+				bounce = (void *)__get_free_page(GFP_KERNEL);
+				if (!bounce)
+					goto read_err;
+			}
+
+			filled = min_t(size_t, count,
+				       PAGE_SIZE - offset_in_page(*ppos));
+			ret = intel_vgpu_rw(mdev, bounce, filled, ppos, false);
+			if (ret <= 0)
+				goto read_err;
+
+			if (copy_to_user(buf, bounce, filled))
+				goto read_err;
+		} else if (gtt_bulk_len(mdev, ppos, count)) {
+			if (!bounce) {
+				bounce = (void *)__get_free_page(GFP_KERNEL);
+				if (!bounce)
+					goto read_err;
+			}
+
+			filled = gtt_bulk_len(mdev, ppos, count);
+			if (intel_vgpu_ggtt_rw(mdev, *ppos, bounce, filled,
+					       false))
+				goto read_err;
+
+			if (copy_to_user(buf, bounce, filled))
+				goto read_err;
+		} else if (count >= 8 && !(*ppos % 8) &&
 			gtt_entry(mdev, ppos)) {
+			/* Only support GGTT entry 8 bytes read */
 			u64 val;
 
 			ret = intel_vgpu_rw(mdev, (char *)&val, sizeof(val),
@@ -836,9 +1546,11 @@ static ssize_t intel_vgpu_read(struct mdev_device *mdev, char __user *buf,
 		buf += filled;
 	}
 
+	free_page((unsigned long)bounce);
 	return done;
 
 read_err:
+	free_page((unsigned long)bounce);
 	return -EFAULT;
 }
 
@@ -847,14 +1559,44 @@ static ssize_t intel_vgpu_write(struct mdev_device *mdev,
 				size_t count, loff_t *ppos)
 {
 	unsigned int done = 0;
+	void *bounce = NULL;
 	int ret;
 
 	while (count) {
 		size_t filled;
 
-		/* Only support GGTT entry 8 bytes write */
-		if (count >= 8 && !(*ppos % 8) &&
+		if (aperture_bulk(*ppos, count)) {
+			if (!bounce) {
+				bounce = (void *)__get_free_page(GFP_KERNEL);
+				if (!bounce)
+					goto write_err;
+			}
+
+			filled = min_t(size_t, count,
+				       PAGE_SIZE - offset_in_page(*ppos));
+			if (copy_from_user(bounce, buf, filled))
+				goto write_err;
+
+			ret = intel_vgpu_rw(mdev, bounce, filled, ppos, true);
+			if (ret <= 0)
+				goto write_err;
+		} else if (gtt_bulk_len(mdev, ppos, count)) {
+			if (!bounce) {
+				bounce = (void *)__get_free_page(GFP_KERNEL);
+				if (!bounce)
+					goto write_err;
+			}
+
+			filled = gtt_bulk_len(mdev, ppos, count);
+			if (copy_from_user(bounce, buf, filled))
+				goto write_err;
+
+			if (intel_vgpu_ggtt_rw(mdev, *ppos, bounce, filled,
+					       true))
+				goto write_err;
+		} else if (count >= 8 && !(*ppos % 8) &&
 			gtt_entry(mdev, ppos)) {
+			/* Only support GGTT entry 8 bytes write */
 			u64 val;
 
 			if (copy_from_user(&val, buf, sizeof(val)))
@@ -910,20 +1652,85 @@ static ssize_t intel_vgpu_write(struct mdev_device *mdev,
 		buf += filled;
 	}
 
+	free_page((unsigned long)bounce);
 	return done;
 write_err:
+	free_page((unsigned long)bounce);
 	return -EFAULT;
 }
 
+/*
+ * The aperture is mapped on fault, with PMD sized entries where the vGPU
+ * aperture is aligned for it, so that a VMM or a display consumer CPU
+ * accessing the framebuffer doesn't go through hundreds of MB of 4K PTEs.
+ */
+static int intel_vgpu_aperture_huge_fault(struct vm_fault *vmf,
+		enum page_entry_size pe_size)
+{
+	struct vm_area_struct *vma = vmf->vma;
+	struct intel_vgpu *vgpu = vma->vm_private_data;
+	unsigned long base = vgpu_aperture_pa_base(vgpu) >> PAGE_SHIFT;
+	unsigned long end = base + (vgpu_aperture_sz(vgpu) >> PAGE_SHIFT);
+	unsigned long addr = vmf->address & PAGE_MASK;
+	unsigned long pfn;
+	int ret;
+
+	switch (pe_size) {
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	case PE_SIZE_PMD:
+		addr &= PMD_MASK;
+		pfn = base + ((addr - vma->vm_start) >> PAGE_SHIFT);
+		if (addr < vma->vm_start || addr + PMD_SIZE > vma->vm_end ||
+		    !IS_ALIGNED(pfn, PMD_SIZE >> PAGE_SHIFT) ||
+		    pfn + (PMD_SIZE >> PAGE_SHIFT) > end)
+			return VM_FAULT_FALLBACK;
+
+		return vmf_insert_pfn_pmd(vma, addr, vmf->pmd,
+				__pfn_to_pfn_t(pfn, PFN_DEV | PFN_MAP),
+				vmf->flags & FAULT_FLAG_WRITE);
+#endif
+	case PE_SIZE_PTE:
+		pfn = base + ((addr - vma->vm_start) >> PAGE_SHIFT);
+		if (pfn >= end)
+			return VM_FAULT_SIGBUS;
+
+		ret = vm_insert_pfn(vma, addr, pfn);
+		if (ret == -ENOMEM)
+			return VM_FAULT_OOM;
+		if (ret && ret != -EBUSY)
+			return VM_FAULT_SIGBUS;
+		return VM_FAULT_NOPAGE;
+	default:
+		return VM_FAULT_FALLBACK;
+	}
+}
+
+static int intel_vgpu_aperture_fault(struct vm_fault *vmf)
+{
+	return intel_vgpu_aperture_huge_fault(vmf, PE_SIZE_PTE);
+}
+
+static const struct vm_operations_struct intel_vgpu_aperture_vm_ops = {
+	.fault = intel_vgpu_aperture_fault,
+	.huge_fault = intel_vgpu_aperture_huge_fault,
+};
+
 static int intel_vgpu_mmap(struct mdev_device *mdev, struct vm_area_struct *vma)
 {
 	unsigned int index;
-	u64 virtaddr;
-	unsigned long req_size, pgoff = 0;
-	pgprot_t pg_prot;
 	struct intel_vgpu *vgpu = mdev_get_drvdata(mdev);
 
 	index = vma->vm_pgoff >> (VFIO_PCI_OFFSET_SHIFT - PAGE_SHIFT);
+	if (index >= VFIO_PCI_NUM_REGIONS) {
+		struct vfio_region *region;
+
+		if (index >= VFIO_PCI_NUM_REGIONS + vgpu->vdev.num_regions)
+			return -EINVAL;
+		region = &vgpu->vdev.region[index - VFIO_PCI_NUM_REGIONS];
+		if (!region->ops->mmap || (vma->vm_flags & VM_SHARED) == 0)
+			return -EINVAL;
+		return region->ops->mmap(vgpu, region, vma);
+	}
 	if (index >= VFIO_PCI_ROM_REGION_INDEX)
 		return -EINVAL;
 
@@ -934,17 +1741,27 @@ static int intel_vgpu_mmap(struct mdev_device *mdev, struct vm_area_struct *vma)
 	if (index != VFIO_PCI_BAR2_REGION_INDEX)
 		return -EINVAL;
 
-	pg_prot = vma->vm_page_prot;
-	virtaddr = vma->vm_start;
-	req_size = vma->vm_end - vma->vm_start;
-	pgoff = vgpu_aperture_pa_base(vgpu) >> PAGE_SHIFT;
-
-	return remap_pfn_range(vma, virtaddr, pgoff, req_size, pg_prot);
+	/* allow huge entries when THP is only enabled on madvise */
+	vma->vm_flags |= VM_IO | VM_PFNMAP | VM_DONTEXPAND | VM_DONTDUMP |
+			 VM_HUGEPAGE;
+	vma->vm_ops = &intel_vgpu_aperture_vm_ops;
+	vma->vm_private_data = vgpu;
+	return 0;
 }
 
+/*
+ * Device specific irq, right after the PCI ones, which is signalled each
+ * time the guest flips its primary plane. Display consumers can wait on it
+ * and query the new plane with VFIO_DEVICE_QUERY_GFX_PLANE, instead of
+ * polling for new frames.
+ */
+#define INTEL_VGPU_DISPLAY_IRQ_INDEX	VFIO_PCI_NUM_IRQS
+#define INTEL_VGPU_NUM_IRQS		(INTEL_VGPU_DISPLAY_IRQ_INDEX + 1)
+
 static int intel_vgpu_get_irq_count(struct intel_vgpu *vgpu, int type)
 {
-	if (type == VFIO_PCI_INTX_IRQ_INDEX || type == VFIO_PCI_MSI_IRQ_INDEX)
+	if (type == VFIO_PCI_INTX_IRQ_INDEX || type == VFIO_PCI_MSI_IRQ_INDEX ||
+	    type == INTEL_VGPU_DISPLAY_IRQ_INDEX)
 		return 1;
 
 	return 0;
@@ -992,6 +1809,33 @@ static int intel_vgpu_set_msi_trigger(struct intel_vgpu *vgpu,
 	return 0;
 }
 
+static int intel_vgpu_set_display_trigger(struct intel_vgpu *vgpu,
+		unsigned int index, unsigned int start, unsigned int count,
+		uint32_t flags, void *data)
+{
+	struct eventfd_ctx *trigger = NULL;
+
+	if (!count && (flags & VFIO_IRQ_SET_DATA_NONE)) {
+		intel_vgpu_swap_display_trigger(vgpu, NULL);
+		return 0;
+	}
+
+	if (flags & VFIO_IRQ_SET_DATA_EVENTFD) {
+		int fd = *(int *)data;
+
+		if (fd >= 0) {
+			trigger = eventfd_ctx_fdget(fd);
+			if (IS_ERR(trigger)) {
+				gvt_vgpu_err("eventfd_ctx_fdget failed\n");
+				return PTR_ERR(trigger);
+			}
+		}
+		intel_vgpu_swap_display_trigger(vgpu, trigger);
+	}
+
+	return 0;
+}
+
 static int intel_vgpu_set_irqs(struct intel_vgpu *vgpu, uint32_t flags,
 		unsigned int index, unsigned int start, unsigned int count,
 		void *data)
@@ -1025,6 +1869,11 @@ static int intel_vgpu_set_irqs(struct intel_vgpu *vgpu, uint32_t flags,
 			break;
 		}
 		break;
+	case INTEL_VGPU_DISPLAY_IRQ_INDEX:
+		if ((flags & VFIO_IRQ_SET_ACTION_TYPE_MASK) ==
+		    VFIO_IRQ_SET_ACTION_TRIGGER)
+			func = intel_vgpu_set_display_trigger;
+		break;
 	}
 
 	if (!func)
@@ -1056,7 +1905,7 @@ static long intel_vgpu_ioctl(struct mdev_device *mdev, unsigned int cmd,
 		info.flags |= VFIO_DEVICE_FLAGS_RESET;
 		info.num_regions = VFIO_PCI_NUM_REGIONS +
 				vgpu->vdev.num_regions;
-		info.num_irqs = VFIO_PCI_NUM_IRQS;
+		info.num_irqs = INTEL_VGPU_NUM_IRQS;
 
 		return copy_to_user((void __user *)arg, &info, minsz) ?
 			-EFAULT : 0;
@@ -1213,12 +2062,13 @@ static long intel_vgpu_ioctl(struct mdev_device *mdev, unsigned int cmd,
 		if (copy_from_user(&info, (void __user *)arg, minsz))
 			return -EFAULT;
 
-		if (info.argsz < minsz || info.index >= VFIO_PCI_NUM_IRQS)
+		if (info.argsz < minsz || info.index >= INTEL_VGPU_NUM_IRQS)
 			return -EINVAL;
 
 		switch (info.index) {
 		case VFIO_PCI_INTX_IRQ_INDEX:
 		case VFIO_PCI_MSI_IRQ_INDEX:
+		case INTEL_VGPU_DISPLAY_IRQ_INDEX:
 			break;
 		default:
 			return -EINVAL;
@@ -1251,7 +2101,7 @@ static long intel_vgpu_ioctl(struct mdev_device *mdev, unsigned int cmd,
 			int max = intel_vgpu_get_irq_count(vgpu, hdr.index);
 
 			ret = vfio_set_irqs_validate_and_prepare(&hdr, max,
-						VFIO_PCI_NUM_IRQS, &data_size);
+						INTEL_VGPU_NUM_IRQS, &data_size);
 			if (ret) {
 				gvt_vgpu_err("intel:vfio_set_irqs_validate_and_prepare failed\n");
 				return -EINVAL;
@@ -1283,6 +2133,13 @@ static long intel_vgpu_ioctl(struct mdev_device *mdev, unsigned int cmd,
 		if (dmabuf.argsz < minsz)
 			return -EINVAL;
 
+		/* damage is only reported to callers which know about it */
+		if (dmabuf.argsz >= sizeof(dmabuf)) {
+			minsz = sizeof(dmabuf);
+			if (copy_from_user(&dmabuf, (void __user *)arg, minsz))
+				return -EFAULT;
+		}
+
 		ret = intel_gvt_ops->vgpu_query_plane(vgpu, &dmabuf);
 		if (ret != 0)
 			return ret;
@@ -1333,12 +2190,428 @@ hw_id_show(struct device *dev, struct device_attribute *attr,
 	return sprintf(buf, "\n");
 }
 
+static ssize_t
+weight_show(struct device *dev, struct device_attribute *attr,
+	    char *buf)
+{
+	struct mdev_device *mdev = mdev_from_dev(dev);
+
+	if (mdev) {
+		struct intel_vgpu *vgpu = (struct intel_vgpu *)
+			mdev_get_drvdata(mdev);
+		return sprintf(buf, "%d\n", vgpu->sched_ctl.weight);
+	}
+	return sprintf(buf, "\n");
+}
+
+static ssize_t
+weight_store(struct device *dev, struct device_attribute *attr,
+	     const char *buf, size_t count)
+{
+	struct mdev_device *mdev = mdev_from_dev(dev);
+	struct intel_vgpu *vgpu;
+	int weight, ret;
+
+	if (!mdev)
+		return -ENODEV;
+
+	ret = kstrtoint(buf, 0, &weight);
+	if (ret)
+		return ret;
+
+	vgpu = (struct intel_vgpu *)mdev_get_drvdata(mdev);
+	ret = intel_gvt_ops->vgpu_set_weight(vgpu, weight);
+	return ret ? ret : count;
+}
+
+static const char * const latency_class_names[] = {
+	[INTEL_VGPU_LATENCY_BATCH] = "batch",
+	[INTEL_VGPU_LATENCY_INTERACTIVE] = "interactive",
+};
+
+static ssize_t
+latency_class_show(struct device *dev, struct device_attribute *attr,
+		   char *buf)
+{
+	struct mdev_device *mdev = mdev_from_dev(dev);
+
+	if (mdev) {
+		struct intel_vgpu *vgpu = (struct intel_vgpu *)
+			mdev_get_drvdata(mdev);
+		return sprintf(buf, "%s\n",
+			       latency_class_names[vgpu->sched_ctl.latency]);
+	}
+	return sprintf(buf, "\n");
+}
+
+static ssize_t
+latency_class_store(struct device *dev, struct device_attribute *attr,
+		    const char *buf, size_t count)
+{
+	struct mdev_device *mdev = mdev_from_dev(dev);
+	struct intel_vgpu *vgpu;
+	int i, ret;
+
+	if (!mdev)
+		return -ENODEV;
+
+	for (i = 0; i < ARRAY_SIZE(latency_class_names); i++) {
+		if (sysfs_streq(buf, latency_class_names[i]))
+			break;
+	}
+	if (i == ARRAY_SIZE(latency_class_names))
+		return -EINVAL;
+
+	vgpu = (struct intel_vgpu *)mdev_get_drvdata(mdev);
+	ret = intel_gvt_ops->vgpu_set_latency(vgpu, i);
+	return ret ? ret : count;
+}
+
+static ssize_t
+deadline_show(struct device *dev, struct device_attribute *attr,
+	      char *buf)
+{
+	struct mdev_device *mdev = mdev_from_dev(dev);
+
+	if (mdev) {
+		struct intel_vgpu *vgpu = (struct intel_vgpu *)
+			mdev_get_drvdata(mdev);
+		return sprintf(buf, "%u %u\n", vgpu->sched_ctl.period_us,
+			       vgpu->sched_ctl.budget_us);
+	}
+	return sprintf(buf, "\n");
+}
+
+/* "<period_us> <budget_us>", or "0 0" to drop the reservation */
+static ssize_t
+deadline_store(struct device *dev, struct device_attribute *attr,
+	       const char *buf, size_t count)
+{
+	struct mdev_device *mdev = mdev_from_dev(dev);
+	struct intel_vgpu *vgpu;
+	unsigned int period, budget;
+	int ret;
+
+	if (!mdev)
+		return -ENODEV;
+
+	if (sscanf(buf, "%u %u", &period, &budget) != 2)
+		return -EINVAL;
+
+	vgpu = (struct intel_vgpu *)mdev_get_drvdata(mdev);
+	ret = intel_gvt_ops->vgpu_set_deadline(vgpu, period, budget);
+	return ret ? ret : count;
+}
+
+static const char * const vblank_mode_names[] = {
+	[INTEL_VGPU_VBLANK_TIMER] = "timer",
+	[INTEL_VGPU_VBLANK_CONSUMER] = "consumer",
+};
+
+static ssize_t
+vblank_mode_show(struct device *dev, struct device_attribute *attr,
+		 char *buf)
+{
+	struct mdev_device *mdev = mdev_from_dev(dev);
+
+	if (mdev) {
+		struct intel_vgpu *vgpu = (struct intel_vgpu *)
+			mdev_get_drvdata(mdev);
+		return sprintf(buf, "%s\n",
+			vblank_mode_names[vgpu->display.vblank_timer.mode]);
+	}
+	return sprintf(buf, "\n");
+}
+
+static ssize_t
+vblank_mode_store(struct device *dev, struct device_attribute *attr,
+		  const char *buf, size_t count)
+{
+	struct mdev_device *mdev = mdev_from_dev(dev);
+	struct intel_vgpu *vgpu;
+	int i, ret;
+
+	if (!mdev)
+		return -ENODEV;
+
+	for (i = 0; i < ARRAY_SIZE(vblank_mode_names); i++) {
+		if (sysfs_streq(buf, vblank_mode_names[i]))
+			break;
+	}
+	if (i == ARRAY_SIZE(vblank_mode_names))
+		return -EINVAL;
+
+	vgpu = (struct intel_vgpu *)mdev_get_drvdata(mdev);
+	ret = intel_gvt_ops->vgpu_set_vblank_mode(vgpu, i);
+	return ret ? ret : count;
+}
+
+static ssize_t
+irq_moderation_usecs_show(struct device *dev, struct device_attribute *attr,
+			  char *buf)
+{
+	struct mdev_device *mdev = mdev_from_dev(dev);
+
+	if (mdev) {
+		struct intel_vgpu *vgpu = (struct intel_vgpu *)
+			mdev_get_drvdata(mdev);
+		return sprintf(buf, "%u\n", vgpu->irq.moderation_usecs);
+	}
+	return sprintf(buf, "\n");
+}
+
+static ssize_t
+irq_moderation_usecs_store(struct device *dev, struct device_attribute *attr,
+			   const char *buf, size_t count)
+{
+	struct mdev_device *mdev = mdev_from_dev(dev);
+	struct intel_vgpu *vgpu;
+	unsigned int usecs;
+	int ret;
+
+	if (!mdev)
+		return -ENODEV;
+
+	ret = kstrtouint(buf, 0, &usecs);
+	if (ret)
+		return ret;
+
+	vgpu = (struct intel_vgpu *)mdev_get_drvdata(mdev);
+	ret = intel_gvt_ops->vgpu_set_irq_moderation(vgpu, usecs,
+			vgpu->irq.moderation_count);
+	return ret ? ret : count;
+}
+
+static ssize_t
+irq_moderation_count_show(struct device *dev, struct device_attribute *attr,
+			  char *buf)
+{
+	struct mdev_device *mdev = mdev_from_dev(dev);
+
+	if (mdev) {
+		struct intel_vgpu *vgpu = (struct intel_vgpu *)
+			mdev_get_drvdata(mdev);
+		return sprintf(buf, "%u\n", vgpu->irq.moderation_count);
+	}
+	return sprintf(buf, "\n");
+}
+
+static ssize_t
+irq_moderation_count_store(struct device *dev, struct device_attribute *attr,
+			   const char *buf, size_t count)
+{
+	struct mdev_device *mdev = mdev_from_dev(dev);
+	struct intel_vgpu *vgpu;
+	unsigned int events;
+	int ret;
+
+	if (!mdev)
+		return -ENODEV;
+
+	ret = kstrtouint(buf, 0, &events);
+	if (ret)
+		return ret;
+
+	vgpu = (struct intel_vgpu *)mdev_get_drvdata(mdev);
+	ret = intel_gvt_ops->vgpu_set_irq_moderation(vgpu,
+			vgpu->irq.moderation_usecs, events);
+	return ret ? ret : count;
+}
+
+static ssize_t
+hidden_gm_size_show(struct device *dev, struct device_attribute *attr,
+		    char *buf)
+{
+	struct mdev_device *mdev = mdev_from_dev(dev);
+
+	if (mdev) {
+		struct intel_vgpu *vgpu = (struct intel_vgpu *)
+			mdev_get_drvdata(mdev);
+		return sprintf(buf, "%llu\n",
+			       BYTES_TO_MB(vgpu_hidden_sz(vgpu)));
+	}
+	return sprintf(buf, "\n");
+}
+
+static ssize_t
+hidden_gm_size_store(struct device *dev, struct device_attribute *attr,
+		     const char *buf, size_t count)
+{
+	struct mdev_device *mdev = mdev_from_dev(dev);
+	struct intel_vgpu *vgpu;
+	unsigned int size;
+	int ret;
+
+	if (!mdev)
+		return -ENODEV;
+
+	ret = kstrtouint(buf, 0, &size);
+	if (ret)
+		return ret;
+
+	vgpu = (struct intel_vgpu *)mdev_get_drvdata(mdev);
+	ret = intel_gvt_ops->vgpu_set_hidden_gm(vgpu, size);
+	return ret ? ret : count;
+}
+
+static ssize_t
+engine_busy_ns_show(struct device *dev, struct device_attribute *attr,
+		    char *buf)
+{
+	struct mdev_device *mdev = mdev_from_dev(dev);
+	struct intel_engine_cs *engine;
+	struct intel_vgpu *vgpu;
+	enum intel_engine_id id;
+	ssize_t len = 0;
+
+	if (!mdev)
+		return sprintf(buf, "\n");
+
+	vgpu = (struct intel_vgpu *)mdev_get_drvdata(mdev);
+	for_each_engine(engine, vgpu->gvt->dev_priv, id)
+		len += sprintf(buf + len, "%s %lld\n", engine->name,
+			       (s64)atomic64_read(&vgpu->engine_busy_ns[id]));
+	return len;
+}
+
+static ssize_t
+postcopy_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct mdev_device *mdev = mdev_from_dev(dev);
+
+	if (mdev) {
+		struct intel_vgpu *vgpu = (struct intel_vgpu *)
+			mdev_get_drvdata(mdev);
+		return sprintf(buf, "%d\n", vgpu->postcopy);
+	}
+	return sprintf(buf, "\n");
+}
+
+static ssize_t
+postcopy_store(struct device *dev, struct device_attribute *attr,
+	       const char *buf, size_t count)
+{
+	struct mdev_device *mdev = mdev_from_dev(dev);
+	struct intel_vgpu *vgpu;
+	bool on;
+	int ret;
+
+	if (!mdev)
+		return -ENODEV;
+
+	ret = kstrtobool(buf, &on);
+	if (ret)
+		return ret;
+
+	vgpu = (struct intel_vgpu *)mdev_get_drvdata(mdev);
+	ret = intel_gvt_ops->vgpu_set_postcopy(vgpu, on);
+	return ret ? ret : count;
+}
+
+static ssize_t
+spt_limit_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct mdev_device *mdev = mdev_from_dev(dev);
+
+	if (mdev) {
+		struct intel_vgpu *vgpu = (struct intel_vgpu *)
+			mdev_get_drvdata(mdev);
+		return sprintf(buf, "%u\n", vgpu->gtt.spt_limit);
+	}
+	return sprintf(buf, "\n");
+}
+
+static ssize_t
+spt_limit_store(struct device *dev, struct device_attribute *attr,
+		const char *buf, size_t count)
+{
+	struct mdev_device *mdev = mdev_from_dev(dev);
+	struct intel_vgpu *vgpu;
+	unsigned int limit;
+	int ret;
+
+	if (!mdev)
+		return -ENODEV;
+
+	ret = kstrtouint(buf, 0, &limit);
+	if (ret)
+		return ret;
+
+	vgpu = (struct intel_vgpu *)mdev_get_drvdata(mdev);
+	ret = intel_gvt_ops->vgpu_set_spt_limit(vgpu, limit);
+	return ret ? ret : count;
+}
+
+static const char * const scan_level_names[] = {
+	[INTEL_VGPU_SCAN_FULL] = "full",
+	[INTEL_VGPU_SCAN_PRIVILEGED] = "privileged",
+};
+
+static ssize_t
+scan_level_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct mdev_device *mdev = mdev_from_dev(dev);
+
+	if (mdev) {
+		struct intel_vgpu *vgpu = (struct intel_vgpu *)
+			mdev_get_drvdata(mdev);
+		return sprintf(buf, "%s\n",
+			scan_level_names[READ_ONCE(vgpu->submission.scan_level)]);
+	}
+	return sprintf(buf, "\n");
+}
+
+static ssize_t
+scan_level_store(struct device *dev, struct device_attribute *attr,
+		 const char *buf, size_t count)
+{
+	struct mdev_device *mdev = mdev_from_dev(dev);
+	struct intel_vgpu *vgpu;
+	int i, ret;
+
+	if (!mdev)
+		return -ENODEV;
+
+	for (i = 0; i < ARRAY_SIZE(scan_level_names); i++) {
+		if (sysfs_streq(buf, scan_level_names[i]))
+			break;
+	}
+	if (i == ARRAY_SIZE(scan_level_names))
+		return -EINVAL;
+
+	vgpu = (struct intel_vgpu *)mdev_get_drvdata(mdev);
+	ret = intel_gvt_ops->vgpu_set_scan_level(vgpu, i);
+	return ret ? ret : count;
+}
+
 static DEVICE_ATTR_RO(vgpu_id);
 static DEVICE_ATTR_RO(hw_id);
+static DEVICE_ATTR_RW(weight);
+static DEVICE_ATTR_RW(latency_class);
+static DEVICE_ATTR_RW(deadline);
+static DEVICE_ATTR_RW(vblank_mode);
+static DEVICE_ATTR_RW(irq_moderation_usecs);
+static DEVICE_ATTR_RW(irq_moderation_count);
+static DEVICE_ATTR_RW(hidden_gm_size);
+static DEVICE_ATTR_RO(engine_busy_ns);
+static DEVICE_ATTR_RW(postcopy);
+static DEVICE_ATTR_RW(spt_limit);
+static DEVICE_ATTR_RW(scan_level);
 
 static struct attribute *intel_vgpu_attrs[] = {
 	&dev_attr_vgpu_id.attr,
 	&dev_attr_hw_id.attr,
+	&dev_attr_weight.attr,
+	&dev_attr_latency_class.attr,
+	&dev_attr_deadline.attr,
+	&dev_attr_vblank_mode.attr,
+	&dev_attr_irq_moderation_usecs.attr,
+	&dev_attr_irq_moderation_count.attr,
+	&dev_attr_hidden_gm_size.attr,
+	&dev_attr_engine_busy_ns.attr,
+	&dev_attr_postcopy.attr,
+	&dev_attr_spt_limit.attr,
+	&dev_attr_scan_level.attr,
 	NULL
 };
 
@@ -1385,12 +2658,34 @@ static void kvmgt_host_exit(struct device *dev, void *gvt)
 	mdev_unregister_device(dev);
 }
 
+/*
+ * Record a freshly write protected gfn and have KVM route its writes
+ * straight to us. Drops the protection again if that isn't possible, as
+ * the writes would be lost otherwise.
+ */
+static int kvmgt_protect_table_claim(struct kvmgt_guest_info *info,
+		struct kvm_memory_slot *slot, gfn_t gfn)
+{
+	int ret;
+
+	ret = kvm_page_track_set_owner(info->kvm, gfn, &info->track_node,
+				       info);
+	if (ret) {
+		kvm_slot_page_track_remove_page(info->kvm, slot, gfn,
+						KVM_PAGE_TRACK_WRITE);
+		return ret;
+	}
+
+	kvmgt_protect_table_add(info, gfn);
+	return 0;
+}
+
 static int kvmgt_page_track_add(unsigned long handle, u64 gfn)
 {
 	struct kvmgt_guest_info *info;
 	struct kvm *kvm;
 	struct kvm_memory_slot *slot;
-	int idx;
+	int idx, ret = 0;
 
 	if (!handle_valid(handle))
 		return -ESRCH;
@@ -1411,12 +2706,73 @@ static int kvmgt_page_track_add(unsigned long handle, u64 gfn)
 		goto out;
 
 	kvm_slot_page_track_add_page(kvm, slot, gfn, KVM_PAGE_TRACK_WRITE);
-	kvmgt_protect_table_add(info, gfn);
+	ret = kvmgt_protect_table_claim(info, slot, gfn);
 
 out:
 	spin_unlock(&kvm->mmu_lock);
 	srcu_read_unlock(&kvm->srcu, idx);
-	return 0;
+	return ret;
+}
+
+static int gfn_cmp(const void *a, const void *b)
+{
+	unsigned long l = *(const unsigned long *)a;
+	unsigned long r = *(const unsigned long *)b;
+
+	return l < r ? -1 : l > r;
+}
+
+/*
+ * Protect a batch of gfns holding the mmu_lock once, and write protecting
+ * each run of contiguous gfns with a single TLB flush.
+ */
+static int kvmgt_page_track_add_pages(unsigned long handle,
+		unsigned long *gfns, unsigned int count)
+{
+	struct kvmgt_guest_info *info;
+	struct kvm *kvm;
+	struct kvm_memory_slot *slot;
+	unsigned int i, j, k;
+	int idx, ret = 0;
+
+	if (!handle_valid(handle))
+		return -ESRCH;
+
+	info = (struct kvmgt_guest_info *)handle;
+	kvm = info->kvm;
+
+	sort(gfns, count, sizeof(*gfns), gfn_cmp, NULL);
+
+	idx = srcu_read_lock(&kvm->srcu);
+	spin_lock(&kvm->mmu_lock);
+
+	for (i = 0; i < count; i = j) {
+		j = i + 1;
+		if (kvmgt_gfn_is_write_protected(info, gfns[i]))
+			continue;
+
+		slot = gfn_to_memslot(kvm, gfns[i]);
+		if (!slot) {
+			ret = -EINVAL;
+			break;
+		}
+
+		while (j < count && gfns[j] == gfns[j - 1] + 1 &&
+		       gfns[j] < slot->base_gfn + slot->npages &&
+		       !kvmgt_gfn_is_write_protected(info, gfns[j]))
+			j++;
+
+		kvm_slot_page_track_add_range(kvm, slot, gfns[i], j - i,
+					      KVM_PAGE_TRACK_WRITE);
+		for (k = i; k < j; k++) {
+			if (kvmgt_protect_table_claim(info, slot, gfns[k]))
+				ret = -ENOMEM;
+		}
+	}
+
+	spin_unlock(&kvm->mmu_lock);
+	srcu_read_unlock(&kvm->srcu, idx);
+	return ret;
 }
 
 static int kvmgt_page_track_remove(unsigned long handle, u64 gfn)
@@ -1446,6 +2802,7 @@ static int kvmgt_page_track_remove(unsigned long handle, u64 gfn)
 
 	kvm_slot_page_track_remove_page(kvm, slot, gfn, KVM_PAGE_TRACK_WRITE);
 	kvmgt_protect_table_del(info, gfn);
+	kvm_page_track_clear_owner(kvm, gfn, &info->track_node);
 
 out:
 	spin_unlock(&kvm->mmu_lock);
@@ -1453,16 +2810,17 @@ static int kvmgt_page_track_remove(unsigned long handle, u64 gfn)
 	return 0;
 }
 
+/*
+ * Only called by KVM for the gfns claimed in kvmgt_page_track_add(), so
+ * there is no need to look the gfn up in the protect table again.
+ */
 static void kvmgt_page_track_write(struct kvm_vcpu *vcpu, gpa_t gpa,
-		const u8 *val, int len,
-		struct kvm_page_track_notifier_node *node)
+		const u8 *val, int len, void *data)
 {
-	struct kvmgt_guest_info *info = container_of(node,
-					struct kvmgt_guest_info, track_node);
+	struct kvmgt_guest_info *info = data;
 
-	if (kvmgt_gfn_is_write_protected(info, gpa_to_gfn(gpa)))
-		intel_gvt_ops->write_protect_handler(info->vgpu, gpa,
-						     (void *)val, len);
+	intel_gvt_ops->write_protect_handler(info->vgpu, gpa,
+					     (void *)val, len);
 }
 
 static void kvmgt_page_track_flush_slot(struct kvm *kvm,
@@ -1473,17 +2831,45 @@ static void kvmgt_page_track_flush_slot(struct kvm *kvm,
 	gfn_t gfn;
 	struct kvmgt_guest_info *info = container_of(node,
 					struct kvmgt_guest_info, track_node);
+	struct kvmgt_pgfn *p;
+	struct hlist_node *tmp;
 
 	spin_lock(&kvm->mmu_lock);
+
+	/*
+	 * A slot of guest RAM is usually far larger than the protect table,
+	 * walk whichever is smaller so that vCPU faults are not held off on
+	 * mmu_lock for a lookup of every page of a multi-GB slot.
+	 */
+	if (slot->npages > HASH_SIZE(info->ptable)) {
+		hash_for_each_safe(info->ptable, i, tmp, p, hnode) {
+			gfn = p->gfn;
+			if (gfn < slot->base_gfn ||
+			    gfn >= slot->base_gfn + slot->npages)
+				continue;
+
+			kvm_slot_page_track_remove_page(kvm, slot, gfn,
+						KVM_PAGE_TRACK_WRITE);
+			hash_del(&p->hnode);
+			kfree(p);
+			kvm_page_track_clear_owner(kvm, gfn, &info->track_node);
+		}
+		goto out;
+	}
+
 	for (i = 0; i < slot->npages; i++) {
 		gfn = slot->base_gfn + i;
 		if (kvmgt_gfn_is_write_protected(info, gfn)) {
 			kvm_slot_page_track_remove_page(kvm, slot, gfn,
 						KVM_PAGE_TRACK_WRITE);
 			kvmgt_protect_table_del(info, gfn);
+			kvm_page_track_clear_owner(kvm, gfn, &info->track_node);
 		}
 	}
+out:
 	spin_unlock(&kvm->mmu_lock);
+
+	gvt_dma_idle_drop_range(info->vgpu, slot->base_gfn, slot->npages);
 }
 
 static bool __kvmgt_vgpu_exist(struct intel_vgpu *vgpu, struct kvm *kvm)
@@ -1509,6 +2895,67 @@ static bool __kvmgt_vgpu_exist(struct intel_vgpu *vgpu, struct kvm *kvm)
 	return ret;
 }
 
+static int kvmgt_mmio_dev_read(struct kvm_vcpu *vcpu,
+			       struct kvm_io_device *dev, gpa_t addr,
+			       int len, void *val)
+{
+	struct kvmgt_guest_info *info = container_of(dev,
+					struct kvmgt_guest_info, mmio_dev);
+
+	return intel_gvt_ops->emulate_mmio_fast_rw(info->vgpu, addr, val,
+						   len, true);
+}
+
+static int kvmgt_mmio_dev_write(struct kvm_vcpu *vcpu,
+				struct kvm_io_device *dev, gpa_t addr,
+				int len, const void *val)
+{
+	struct kvmgt_guest_info *info = container_of(dev,
+					struct kvmgt_guest_info, mmio_dev);
+
+	return intel_gvt_ops->emulate_mmio_fast_rw(info->vgpu, addr,
+						   (void *)val, len, false);
+}
+
+static const struct kvm_io_device_ops kvmgt_mmio_dev_ops = {
+	.read = kvmgt_mmio_dev_read,
+	.write = kvmgt_mmio_dev_write,
+};
+
+/*
+ * Updating the KVM MMIO bus waits for all the vCPUs to leave their exit
+ * path, which may be blocked on the vGPU lock held by our caller, so the
+ * in-kernel MMIO device is moved along with BAR0 from a work.
+ */
+static void kvmgt_mmio_dev_update(struct work_struct *work)
+{
+	struct kvmgt_guest_info *info = container_of(work,
+					struct kvmgt_guest_info, mmio_dev_work);
+	struct intel_vgpu *vgpu = info->vgpu;
+	struct kvm *kvm = info->kvm;
+	u64 gpa = READ_ONCE(info->mmio_dev_gpa);
+	int ret;
+
+	mutex_lock(&kvm->slots_lock);
+
+	if (info->mmio_dev_base && info->mmio_dev_base != gpa) {
+		kvm_io_bus_unregister_dev(kvm, KVM_MMIO_BUS, &info->mmio_dev);
+		info->mmio_dev_base = 0;
+	}
+
+	if (gpa && !info->mmio_dev_base) {
+		ret = kvm_io_bus_register_dev(kvm, KVM_MMIO_BUS, gpa,
+				vgpu->gvt->device_info.mmio_size,
+				&info->mmio_dev);
+		if (ret)
+			gvt_vgpu_err("fail to register MMIO device: %d\n", ret);
+		else
+			info->mmio_dev_base = gpa;
+	}
+
+	mutex_unlock(&kvm->slots_lock);
+}
+
 static int kvmgt_guest_init(struct mdev_device *mdev)
 {
 	struct kvmgt_guest_info *info;
@@ -1543,10 +2990,14 @@ static int kvmgt_guest_init(struct mdev_device *mdev)
 	mutex_init(&vgpu->dmabuf_lock);
 	init_completion(&vgpu->vblank_done);
 
-	info->track_node.track_write = kvmgt_page_track_write;
+	info->track_node.track_write_owned = kvmgt_page_track_write;
 	info->track_node.track_flush_slot = kvmgt_page_track_flush_slot;
 	kvm_page_track_register_notifier(kvm, &info->track_node);
 
+	kvm_iodevice_init(&info->mmio_dev, &kvmgt_mmio_dev_ops);
+	INIT_WORK(&info->mmio_dev_work, kvmgt_mmio_dev_update);
+	vgpu->submission.defer_elsp = defer_elsp;
+
 	info->debugfs_cache_entries = debugfs_create_ulong(
 						"kvmgt_nr_cache_entries",
 						0444, vgpu->debugfs,
@@ -1561,10 +3012,18 @@ static bool kvmgt_guest_exit(struct kvmgt_guest_info *info)
 {
 	debugfs_remove(info->debugfs_cache_entries);
 
+	cancel_work_sync(&info->mmio_dev_work);
+	WRITE_ONCE(info->mmio_dev_gpa, 0);
+	kvmgt_mmio_dev_update(&info->mmio_dev_work);
+	info->vgpu->submission.defer_elsp = false;
+
 	kvm_page_track_unregister_notifier(info->kvm, &info->track_node);
 	kvm_put_kvm(info->kvm);
 	kvmgt_protect_table_destroy(info);
 	gvt_cache_destroy(info->vgpu);
+	gvt_dirty_log_stop(info->vgpu);
+	intel_gvt_ops->vgpu_stop_save_state(info->vgpu);
+	intel_vgpu_reg_release_device_state(info->vgpu, NULL);
 	vfree(info);
 
 	return true;
@@ -1598,6 +3057,23 @@ static int kvmgt_inject_msi(unsigned long handle, u32 addr, u16 data)
 	return -EFAULT;
 }
 
+static void kvmgt_notify_plane_flip(unsigned long handle)
+{
+	struct kvmgt_guest_info *info;
+	struct intel_vgpu *vgpu;
+
+	if (!handle_valid(handle))
+		return;
+
+	info = (struct kvmgt_guest_info *)handle;
+	vgpu = info->vgpu;
+
+	spin_lock(&vgpu->vdev.display_trigger_lock);
+	if (vgpu->vdev.display_trigger)
+		eventfd_signal(vgpu->vdev.display_trigger, 1);
+	spin_unlock(&vgpu->vdev.display_trigger_lock);
+}
+
 static unsigned long kvmgt_gfn_to_pfn(unsigned long handle, unsigned long gfn)
 {
 	struct kvmgt_guest_info *info;
@@ -1615,8 +3091,113 @@ static unsigned long kvmgt_gfn_to_pfn(unsigned long handle, unsigned long gfn)
 	return pfn;
 }
 
+/*
+ * A guest backed by huge pages on the host (THP or hugetlbfs) still asks
+ * for most of its pages one 4K PTE at a time. Rather than pinning and
+ * mapping each of them, the first miss in a host huge page maps the whole
+ * 2M around it, and its neighbours are then served from that entry by
+ * offset. Such an entry holds one reference per 4K user.
+ */
+#define GVT_HUGE_NPAGES (SZ_2M >> PAGE_SHIFT)
+
+static struct gvt_dma *__gvt_cache_find_page(struct intel_vgpu *vgpu,
+		gfn_t gfn, dma_addr_t *dma_addr)
+{
+	struct gvt_dma *entry;
+
+	entry = __gvt_cache_find_gfn(vgpu, gfn, PAGE_SIZE);
+	if (entry) {
+		*dma_addr = entry->dma_addr;
+		return entry;
+	}
+
+	entry = __gvt_cache_find_gfn(vgpu, round_down(gfn, GVT_HUGE_NPAGES),
+				     SZ_2M);
+	if (entry && entry->size == SZ_2M) {
+		*dma_addr = entry->dma_addr +
+			    ((gfn - entry->gfn) << PAGE_SHIFT);
+		return entry;
+	}
+
+	return NULL;
+}
+
+static struct gvt_dma *__gvt_cache_find_page_dma_addr(struct intel_vgpu *vgpu,
+		dma_addr_t dma_addr)
+{
+	struct gvt_dma *entry;
+
+	entry = __gvt_cache_find_dma_addr(vgpu, dma_addr, PAGE_SIZE);
+	if (entry)
+		return entry;
+
+	entry = __gvt_cache_find_dma_addr(vgpu, round_down(dma_addr, SZ_2M),
+					  SZ_2M);
+	if (entry && entry->size == SZ_2M)
+		return entry;
+
+	return NULL;
+}
+
+/*
+ * Probe with the pin of @gfn alone whether a host huge page backs it, before
+ * pinning the 2M around it. This is reached from the workload thread, so
+ * the pfn is taken from vfio, which pins through the mm of the VM's owner,
+ * and not from KVM, which would fault through current->mm.
+ */
+static bool gvt_host_huge_backed(struct kvmgt_guest_info *info, gfn_t gfn)
+{
+	struct device *dev = mdev_dev(info->vgpu->vdev.mdev);
+	unsigned long user_pfn = gfn, pfn;
+	struct page *head;
+	bool ret = false;
+
+	if (vfio_pin_pages(dev, &user_pfn, 1, IOMMU_READ | IOMMU_WRITE,
+			   &pfn) != 1)
+		return false;
+
+	if (pfn_valid(pfn)) {
+		head = compound_head(pfn_to_page(pfn));
+		ret = PageCompound(head) &&
+		      (PAGE_SIZE << compound_order(head)) >= SZ_2M &&
+		      (pfn & (GVT_HUGE_NPAGES - 1)) ==
+		      (gfn & (GVT_HUGE_NPAGES - 1));
+	}
+
+	vfio_unpin_pages(dev, &user_pfn, 1);
+	return ret;
+}
+
+/*
+ * Map and cache the 2M around @gfn if a host huge page backs it. The new
+ * entry comes with the reference of the caller.
+ */
+static struct gvt_dma *__gvt_cache_map_huge(struct kvmgt_guest_info *info,
+		gfn_t gfn)
+{
+	struct intel_vgpu *vgpu = info->vgpu;
+	gfn_t base = round_down(gfn, GVT_HUGE_NPAGES);
+	dma_addr_t dma_addr;
+
+	if (__gvt_cache_find_gfn(vgpu, base, SZ_2M) ||
+	    !gvt_host_huge_backed(info, gfn))
+		return NULL;
+
+	if (gvt_dma_map_page(vgpu, base, &dma_addr, SZ_2M))
+		return NULL;
+
+	/* The dma address of a 4K user must lead back to this entry. */
+	if (!IS_ALIGNED(dma_addr, SZ_2M) ||
+	    __gvt_cache_add(vgpu, base, dma_addr, SZ_2M)) {
+		gvt_dma_unmap_page(vgpu, base, dma_addr, SZ_2M);
+		return NULL;
+	}
+
+	return __gvt_cache_find_gfn(vgpu, base, SZ_2M);
+}
+
 int kvmgt_dma_map_guest_page(unsigned long handle, unsigned long gfn,
-		dma_addr_t *dma_addr)
+		unsigned long size, dma_addr_t *dma_addr)
 {
 	struct kvmgt_guest_info *info;
 	struct intel_vgpu *vgpu;
@@ -1629,27 +3210,58 @@ int kvmgt_dma_map_guest_page(unsigned long handle, unsigned long gfn,
 	info = (struct kvmgt_guest_info *)handle;
 	vgpu = info->vgpu;
 
+	/* Fast path, the page is mapped already. */
+	rcu_read_lock();
+	if (size == PAGE_SIZE) {
+		entry = __gvt_cache_find_page(vgpu, gfn, dma_addr);
+	} else {
+		entry = __gvt_cache_find_gfn(vgpu, gfn, size);
+		if (entry)
+			*dma_addr = entry->dma_addr;
+	}
+	if (entry && kref_get_unless_zero(&entry->ref)) {
+		rcu_read_unlock();
+		return 0;
+	}
+	rcu_read_unlock();
+
 	mutex_lock(&info->vgpu->vdev.cache_lock);
 
-	entry = __gvt_cache_find_gfn(info->vgpu, gfn);
+	if (size == PAGE_SIZE) {
+		entry = __gvt_cache_find_page(vgpu, gfn, dma_addr);
+		if (entry) {
+			__gvt_dma_get(entry);
+			goto out_unlock;
+		}
+
+		entry = __gvt_cache_map_huge(info, gfn);
+		if (entry) {
+			*dma_addr = entry->dma_addr +
+				    ((gfn - entry->gfn) << PAGE_SHIFT);
+			goto out_unlock;
+		}
+	}
+
+	entry = __gvt_cache_find_gfn(info->vgpu, gfn, size);
 	if (!entry) {
-		ret = gvt_dma_map_page(vgpu, gfn, dma_addr);
+		ret = gvt_dma_map_page(vgpu, gfn, dma_addr, size);
 		if (ret)
 			goto err_unlock;
 
-		ret = __gvt_cache_add(info->vgpu, gfn, *dma_addr);
+		ret = __gvt_cache_add(info->vgpu, gfn, *dma_addr, size);
 		if (ret)
 			goto err_unmap;
 	} else {
-		kref_get(&entry->ref);
+		__gvt_dma_get(entry);
 		*dma_addr = entry->dma_addr;
 	}
 
+out_unlock:
 	mutex_unlock(&info->vgpu->vdev.cache_lock);
 	return 0;
 
 err_unmap:
-	gvt_dma_unmap_page(vgpu, gfn, *dma_addr);
+	gvt_dma_unmap_page(vgpu, gfn, *dma_addr, size);
 err_unlock:
 	mutex_unlock(&info->vgpu->vdev.cache_lock);
 	return ret;
@@ -1658,12 +3270,22 @@ int kvmgt_dma_map_guest_page(unsigned long handle, unsigned long gfn,
 static void __gvt_dma_release(struct kref *ref)
 {
 	struct gvt_dma *entry = container_of(ref, typeof(*entry), ref);
+	struct intel_vgpu *vgpu = entry->vgpu;
+	unsigned long limit = (unsigned long)READ_ONCE(dma_retain_mb) << 20;
+
+	if (entry->size <= limit) {
+		list_add(&entry->idle, &vgpu->vdev.dma_idle_list);
+		vgpu->vdev.dma_idle_size += entry->size;
+		__gvt_dma_idle_trim(vgpu, limit);
+		return;
+	}
 
-	gvt_dma_unmap_page(entry->vgpu, entry->gfn, entry->dma_addr);
-	__gvt_cache_remove_entry(entry->vgpu, entry);
+	gvt_dma_unmap_page(vgpu, entry->gfn, entry->dma_addr, entry->size);
+	__gvt_cache_remove_entry(vgpu, entry);
 }
 
-void kvmgt_dma_unmap_guest_page(unsigned long handle, dma_addr_t dma_addr)
+void kvmgt_dma_unmap_guest_page(unsigned long handle, dma_addr_t dma_addr,
+		unsigned long size)
 {
 	struct kvmgt_guest_info *info;
 	struct gvt_dma *entry;
@@ -1674,18 +3296,160 @@ void kvmgt_dma_unmap_guest_page(unsigned long handle, dma_addr_t dma_addr)
 	info = (struct kvmgt_guest_info *)handle;
 
 	mutex_lock(&info->vgpu->vdev.cache_lock);
-	entry = __gvt_cache_find_dma_addr(info->vgpu, dma_addr);
+	if (size == PAGE_SIZE)
+		entry = __gvt_cache_find_page_dma_addr(info->vgpu, dma_addr);
+	else
+		entry = __gvt_cache_find_dma_addr(info->vgpu, dma_addr, size);
 	if (entry)
 		kref_put(&entry->ref, __gvt_dma_release);
 	mutex_unlock(&info->vgpu->vdev.cache_lock);
 }
 
-static int kvmgt_rw_gpa(unsigned long handle, unsigned long gpa,
-			void *buf, unsigned long len, bool write)
+/*
+ * Map a batch of 4K guest pages. The ones not cached yet are pinned with a
+ * single vfio_pin_pages() call instead of one call per page.
+ */
+int kvmgt_dma_map_guest_pages(unsigned long handle, unsigned long *gfns,
+		unsigned int count, dma_addr_t *dma_addrs)
+{
+	struct kvmgt_guest_info *info;
+	struct intel_vgpu *vgpu;
+	struct device *dev;
+	struct gvt_dma *entry;
+	unsigned long *pin_gfns, *pfns;
+	unsigned int *pin_idx;
+	unsigned int i, j, npin = 0;
+	DECLARE_BITMAP(huge, VFIO_PIN_PAGES_MAX_ENTRIES);
+	dma_addr_t dma_addr;
+	int ret = 0;
+
+	if (!handle_valid(handle))
+		return -EINVAL;
+
+	if (count > VFIO_PIN_PAGES_MAX_ENTRIES)
+		return -E2BIG;
+
+	info = (struct kvmgt_guest_info *)handle;
+	vgpu = info->vgpu;
+	dev = &vgpu->gvt->dev_priv->drm.pdev->dev;
+
+	/* One scratch allocation per batch for the gfns, pfns and indices. */
+	pin_gfns = kmalloc_array(count, 2 * sizeof(*pin_gfns) +
+				 sizeof(*pin_idx), GFP_KERNEL);
+	if (!pin_gfns)
+		return -ENOMEM;
+	pfns = pin_gfns + count;
+	pin_idx = (unsigned int *)(pfns + count);
+
+	bitmap_zero(huge, count);
+
+	mutex_lock(&vgpu->vdev.cache_lock);
+
+	for (i = 0; i < count; i++) {
+		if (__gvt_cache_find_page(vgpu, gfns[i], &dma_addrs[i]))
+			continue;
+
+		/* Keep the reference of a new huge entry for this page. */
+		entry = __gvt_cache_map_huge(info, gfns[i]);
+		if (entry) {
+			dma_addrs[i] = entry->dma_addr +
+				       ((gfns[i] - entry->gfn) << PAGE_SHIFT);
+			__set_bit(i, huge);
+			continue;
+		}
+
+		pin_idx[npin] = i;
+		pin_gfns[npin++] = gfns[i];
+	}
+
+	if (npin) {
+		ret = vfio_pin_pages(mdev_dev(vgpu->vdev.mdev), pin_gfns, npin,
+				     IOMMU_READ | IOMMU_WRITE, pfns);
+		if (ret != npin) {
+			gvt_vgpu_err("vfio_pin_pages failed for %u pages: %d\n",
+				     npin, ret);
+			if (ret > 0)
+				vfio_unpin_pages(mdev_dev(vgpu->vdev.mdev),
+						 pin_gfns, ret);
+			ret = -EINVAL;
+			goto err_huge;
+		}
+		ret = 0;
+	}
+
+	for (j = 0; j < npin; j++) {
+		/* The same page may show up more than once in a batch. */
+		entry = __gvt_cache_find_gfn(vgpu, pin_gfns[j], PAGE_SIZE);
+		if (entry) {
+			vfio_unpin_pages(mdev_dev(vgpu->vdev.mdev),
+					 &pin_gfns[j], 1);
+			__gvt_dma_get(entry);
+			dma_addrs[pin_idx[j]] = entry->dma_addr;
+			continue;
+		}
+
+		if (!pfn_valid(pfns[j])) {
+			gvt_vgpu_err("pfn 0x%lx is not mem backed\n", pfns[j]);
+			ret = -EFAULT;
+			goto err_unpin;
+		}
+
+		dma_addr = dma_map_page(dev, pfn_to_page(pfns[j]), 0, PAGE_SIZE,
+					PCI_DMA_BIDIRECTIONAL);
+		if (dma_mapping_error(dev, dma_addr)) {
+			gvt_vgpu_err("DMA mapping failed for gfn 0x%lx\n",
+				     pin_gfns[j]);
+			ret = -ENOMEM;
+			goto err_unpin;
+		}
+
+		ret = __gvt_cache_add(vgpu, pin_gfns[j], dma_addr, PAGE_SIZE);
+		if (ret) {
+			dma_unmap_page(dev, dma_addr, PAGE_SIZE,
+				       PCI_DMA_BIDIRECTIONAL);
+			goto err_unpin;
+		}
+		dma_addrs[pin_idx[j]] = dma_addr;
+	}
+
+	/* Nothing can fail from here on, take the cached ones. */
+	for (i = 0, j = 0; i < count; i++) {
+		if (j < npin && pin_idx[j] == i) {
+			j++;
+			continue;
+		}
+		if (test_bit(i, huge))
+			continue;
+		entry = __gvt_cache_find_page(vgpu, gfns[i], &dma_addrs[i]);
+		__gvt_dma_get(entry);
+	}
+	goto out_unlock;
+
+err_unpin:
+	vfio_unpin_pages(mdev_dev(vgpu->vdev.mdev), &pin_gfns[j], npin - j);
+	while (j--) {
+		entry = __gvt_cache_find_gfn(vgpu, pin_gfns[j], PAGE_SIZE);
+		kref_put(&entry->ref, __gvt_dma_release);
+	}
+err_huge:
+	for_each_set_bit(i, huge, count) {
+		entry = __gvt_cache_find_page(vgpu, gfns[i], &dma_addr);
+		kref_put(&entry->ref, __gvt_dma_release);
+	}
+out_unlock:
+	mutex_unlock(&vgpu->vdev.cache_lock);
+	kfree(pin_gfns);
+	return ret;
+}
+
+static int kvmgt_rw_gpa_bulk(unsigned long handle,
+			     struct intel_gvt_gpa_buf *bufs,
+			     unsigned int count, bool write)
 {
 	struct kvmgt_guest_info *info;
 	struct kvm *kvm;
-	int idx, ret;
+	unsigned int i;
+	int idx, ret = 0;
 	bool kthread = current->mm == NULL;
 
 	if (!handle_valid(handle))
@@ -1698,8 +3462,12 @@ static int kvmgt_rw_gpa(unsigned long handle, unsigned long gpa,
 		use_mm(kvm->mm);
 
 	idx = srcu_read_lock(&kvm->srcu);
-	ret = write ? kvm_write_guest(kvm, gpa, buf, len) :
-		      kvm_read_guest(kvm, gpa, buf, len);
+	for (i = 0; i < count && !ret; i++)
+		ret = write ?
+		      kvm_write_guest(kvm, bufs[i].gpa, bufs[i].buf,
+				      bufs[i].len) :
+		      kvm_read_guest(kvm, bufs[i].gpa, bufs[i].buf,
+				     bufs[i].len);
 	srcu_read_unlock(&kvm->srcu, idx);
 
 	if (kthread)
@@ -1708,6 +3476,18 @@ static int kvmgt_rw_gpa(unsigned long handle, unsigned long gpa,
 	return ret;
 }
 
+static int kvmgt_rw_gpa(unsigned long handle, unsigned long gpa,
+			void *buf, unsigned long len, bool write)
+{
+	struct intel_gvt_gpa_buf gpa_buf = {
+		.gpa = gpa,
+		.buf = buf,
+		.len = len,
+	};
+
+	return kvmgt_rw_gpa_bulk(handle, &gpa_buf, 1, write);
+}
+
 static int kvmgt_read_gpa(unsigned long handle, unsigned long gpa,
 			void *buf, unsigned long len)
 {
@@ -1740,6 +3520,66 @@ static bool kvmgt_is_valid_gfn(unsigned long handle, unsigned long gfn)
 
 }
 
+static struct page *kvmgt_get_guest_page(unsigned long handle,
+					 unsigned long gfn)
+{
+	struct kvmgt_guest_info *info;
+	struct kvm *kvm;
+	struct page *page;
+	bool kthread = current->mm == NULL;
+
+	if (!handle_valid(handle))
+		return ERR_PTR(-ESRCH);
+
+	info = (struct kvmgt_guest_info *)handle;
+	kvm = info->kvm;
+
+	/* the scan runs in the workload thread and the scan workers */
+	if (kthread) {
+		/* the VM is going away, its pages can't be pinned anymore */
+		if (!mmget_not_zero(kvm->mm))
+			return ERR_PTR(-ESRCH);
+		use_mm(kvm->mm);
+	}
+
+	page = gfn_to_page(kvm, gfn);
+
+	if (kthread) {
+		unuse_mm(kvm->mm);
+		mmput(kvm->mm);
+	}
+
+	if (is_error_page(page))
+		return ERR_PTR(-EFAULT);
+
+	return page;
+}
+
+static void kvmgt_put_guest_page(unsigned long handle, struct page *page)
+{
+	kvm_release_page_clean(page);
+}
+
+static int kvmgt_set_trap_area(unsigned long handle, u64 start, u64 end,
+			       bool map)
+{
+	struct kvmgt_guest_info *info;
+
+	if (!handle_valid(handle))
+		return 0;
+
+	info = (struct kvmgt_guest_info *)handle;
+
+	/*
+	 * Everything in BAR0 is trapped by VFIO already, the MMIO device only
+	 * lets the side-effect free registers be emulated without going out
+	 * to userspace.
+	 */
+	WRITE_ONCE(info->mmio_dev_gpa, map ? start : 0);
+	schedule_work(&info->mmio_dev_work);
+	return 0;
+}
+
 struct intel_gvt_mpt kvmgt_mpt = {
 	.host_init = kvmgt_host_init,
 	.host_exit = kvmgt_host_exit,
@@ -1749,15 +3589,22 @@ struct intel_gvt_mpt kvmgt_mpt = {
 	.from_virt_to_mfn = kvmgt_virt_to_pfn,
 	.enable_page_track = kvmgt_page_track_add,
 	.disable_page_track = kvmgt_page_track_remove,
+	.enable_page_tracks = kvmgt_page_track_add_pages,
 	.read_gpa = kvmgt_read_gpa,
 	.write_gpa = kvmgt_write_gpa,
+	.rw_gpa_bulk = kvmgt_rw_gpa_bulk,
 	.gfn_to_mfn = kvmgt_gfn_to_pfn,
 	.dma_map_guest_page = kvmgt_dma_map_guest_page,
+	.dma_map_guest_pages = kvmgt_dma_map_guest_pages,
 	.dma_unmap_guest_page = kvmgt_dma_unmap_guest_page,
 	.set_opregion = kvmgt_set_opregion,
 	.get_vfio_device = kvmgt_get_vfio_device,
 	.put_vfio_device = kvmgt_put_vfio_device,
 	.is_valid_gfn = kvmgt_is_valid_gfn,
+	.set_trap_area = kvmgt_set_trap_area,
+	.notify_plane_flip = kvmgt_notify_plane_flip,
+	.get_guest_page = kvmgt_get_guest_page,
+	.put_guest_page = kvmgt_put_guest_page,
 };
 EXPORT_SYMBOL_GPL(kvmgt_mpt);
 
@@ -0,0 +1,520 @@
+/*
+ * Copyright(c) 2011-2017 Intel Corporation. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "i915_drv.h"
+#include "gvt.h"
+
+/*
+ * vGPU device state is saved as a stream of sections behind a header:
+ *
+ *	struct gvt_state_header
+ *	struct gvt_state_section, data
+ *	...
+ *
+ * A pre-copy stream carries only the GGTT entries the guest wrote since
+ * the previous one (all of them the first time), while the VM keeps
+ * running. The final stream, saved with the vGPU idle, carries the rest
+ * of the state and the GGTT entries written since the last pre-copy, so
+ * the downtime only depends on what changed meanwhile.
+ *
+ * Guest graphics addresses are host ones, so a stream is only accepted by
+ * a vGPU of the same GM and fence layout.
+ */
+#define GVT_STATE_MAGIC		0x53545647	/* "GVTS" */
+#define GVT_STATE_VERSION	1
+
+#define GVT_STATE_FINAL		BIT(0)
+
+enum {
+	GVT_STATE_SECTION_LAYOUT = 1,
+	GVT_STATE_SECTION_VREG,
+	GVT_STATE_SECTION_CFG,
+	GVT_STATE_SECTION_OPREGION,
+	GVT_STATE_SECTION_EXECLIST,
+	GVT_STATE_SECTION_GGTT,
+};
+
+struct gvt_state_header {
+	u32 magic;
+	u32 version;
+	u32 flags;
+	u32 nr_sections;
+};
+
+struct gvt_state_section {
+	u32 id;
+	u32 reserved;
+	u64 size;
+};
+
+struct gvt_state_layout {
+	u64 aperture_base;
+	u64 aperture_sz;
+	u64 hidden_base;
+	u64 hidden_sz;
+	u32 fence_sz;
+	u32 mmio_size;
+};
+
+struct gvt_state_execlist {
+	u32 ring_id;
+	s32 running_slot;
+	s32 pending_slot;
+	s32 running_context;
+	struct intel_vgpu_execlist_slot slot[2];
+	struct intel_vgpu_elsp_dwords elsp_dwords;
+};
+
+struct gvt_state_ggtt_entry {
+	u64 index;
+	u64 val;
+};
+
+struct gvt_state_buf {
+	void *data;
+	size_t size;
+	size_t pos;
+	struct gvt_state_header *header;
+};
+
+static void *state_section(struct gvt_state_buf *buf, u32 id, u64 size)
+{
+	struct gvt_state_section *s = buf->data + buf->pos;
+
+	s->id = id;
+	s->reserved = 0;
+	s->size = size;
+	buf->pos += sizeof(*s) + size;
+	buf->header->nr_sections++;
+	return s + 1;
+}
+
+static void save_layout(struct intel_vgpu *vgpu, struct gvt_state_layout *l)
+{
+	l->aperture_base = vgpu_aperture_gmadr_base(vgpu);
+	l->aperture_sz = vgpu_aperture_sz(vgpu);
+	l->hidden_base = vgpu_hidden_gmadr_base(vgpu);
+	l->hidden_sz = vgpu_hidden_sz(vgpu);
+	l->fence_sz = vgpu_fence_sz(vgpu);
+	l->mmio_size = vgpu->gvt->device_info.mmio_size;
+}
+
+static int slot_index(struct intel_vgpu_execlist *execlist,
+		      struct intel_vgpu_execlist_slot *slot)
+{
+	return slot ? slot - execlist->slot : -1;
+}
+
+static void save_execlist(struct intel_vgpu *vgpu,
+			  struct gvt_state_execlist *s)
+{
+	struct intel_engine_cs *engine;
+	enum intel_engine_id id;
+
+	for_each_engine(engine, vgpu->gvt->dev_priv, id) {
+		struct intel_vgpu_execlist *execlist =
+			&vgpu->submission.execlist[id];
+
+		s->ring_id = id;
+		s->running_slot = slot_index(execlist, execlist->running_slot);
+		s->pending_slot = slot_index(execlist, execlist->pending_slot);
+		s->running_context = -1;
+		if (execlist->running_slot && execlist->running_context)
+			s->running_context = execlist->running_context -
+					     execlist->running_slot->ctx;
+		memcpy(s->slot, execlist->slot, sizeof(s->slot));
+		s->elsp_dwords = execlist->elsp_dwords;
+		s++;
+	}
+}
+
+static void mark_ggtt_range(struct intel_vgpu *vgpu, u64 base, u64 size)
+{
+	bitmap_set(vgpu->gtt.ggtt_save_bitmap, base >> I915_GTT_PAGE_SHIFT,
+		   size >> I915_GTT_PAGE_SHIFT);
+}
+
+static unsigned long nr_ggtt_entries(struct intel_gvt *gvt)
+{
+	return gvt_ggtt_gm_sz(gvt) >> I915_GTT_PAGE_SHIFT;
+}
+
+/* Move the entries written since the last call into the stream. */
+static void save_ggtt(struct intel_vgpu *vgpu, struct gvt_state_buf *buf,
+		      unsigned long count)
+{
+	unsigned long nr = nr_ggtt_entries(vgpu->gvt);
+	u64 *ggtt = vgpu->gtt.ggtt_mm->ggtt_mm.virtual_ggtt;
+	struct gvt_state_ggtt_entry *e;
+	unsigned long index;
+
+	e = state_section(buf, GVT_STATE_SECTION_GGTT, count * sizeof(*e));
+	for_each_set_bit(index, vgpu->gtt.ggtt_save_bitmap, nr) {
+		e->index = index;
+		e->val = ggtt[index];
+		e++;
+	}
+	bitmap_zero(vgpu->gtt.ggtt_save_bitmap, nr);
+}
+
+static int vgpu_wait_idle(struct intel_vgpu *vgpu)
+{
+	struct intel_engine_cs *engine;
+	enum intel_engine_id id;
+
+	if (atomic_read(&vgpu->submission.running_workload_num)) {
+		mutex_unlock(&vgpu->vgpu_lock);
+		intel_gvt_wait_vgpu_idle(vgpu);
+		mutex_lock(&vgpu->vgpu_lock);
+	}
+
+	for_each_engine(engine, vgpu->gvt->dev_priv, id) {
+		if (!list_empty(workload_q_head(vgpu, id)))
+			return -EBUSY;
+	}
+	return 0;
+}
+
+/**
+ * intel_vgpu_save_state - save the device state of a vGPU
+ * @vgpu: a vGPU
+ * @final: save the whole state rather than a pre-copy round
+ * @data: returns the stream, to be freed with kvfree()
+ * @size: returns the size of the stream
+ *
+ * A pre-copy round only saves the GGTT entries written since the previous
+ * round. The final save expects the guest to be stopped and fails with
+ * -EBUSY if the vGPU still has workloads queued afterwards.
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+int intel_vgpu_save_state(struct intel_vgpu *vgpu, bool final,
+			  void **data, size_t *size)
+{
+	struct intel_gvt *gvt = vgpu->gvt;
+	const struct intel_gvt_device_info *info = &gvt->device_info;
+	unsigned long nr = nr_ggtt_entries(gvt);
+	struct gvt_state_buf buf = {};
+	unsigned int nr_engines = 0;
+	struct intel_engine_cs *engine;
+	enum intel_engine_id id;
+	unsigned long count;
+	int ret = 0;
+
+	for_each_engine(engine, gvt->dev_priv, id)
+		nr_engines++;
+
+	mutex_lock(&vgpu->vgpu_lock);
+
+	if (final) {
+		ret = vgpu_wait_idle(vgpu);
+		if (ret)
+			goto out;
+	}
+
+	if (!vgpu->gtt.ggtt_save_bitmap) {
+		vgpu->gtt.ggtt_save_bitmap = vzalloc(BITS_TO_LONGS(nr) *
+						     sizeof(long));
+		if (!vgpu->gtt.ggtt_save_bitmap) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		mark_ggtt_range(vgpu, vgpu_aperture_gmadr_base(vgpu),
+				vgpu_aperture_sz(vgpu));
+		mark_ggtt_range(vgpu, vgpu_hidden_gmadr_base(vgpu),
+				vgpu_hidden_sz(vgpu));
+	}
+	count = bitmap_weight(vgpu->gtt.ggtt_save_bitmap, nr);
+
+	buf.size = sizeof(struct gvt_state_header) +
+		   sizeof(struct gvt_state_section) * 2 +
+		   sizeof(struct gvt_state_layout) +
+		   count * sizeof(struct gvt_state_ggtt_entry);
+	if (final)
+		buf.size += sizeof(struct gvt_state_section) * 4 +
+			    info->mmio_size + info->cfg_space_size +
+			    INTEL_GVT_OPREGION_SIZE +
+			    nr_engines * sizeof(struct gvt_state_execlist);
+
+	buf.data = kvzalloc(buf.size, GFP_KERNEL);
+	if (!buf.data) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	buf.header = buf.data;
+	buf.header->magic = GVT_STATE_MAGIC;
+	buf.header->version = GVT_STATE_VERSION;
+	buf.header->flags = final ? GVT_STATE_FINAL : 0;
+	buf.pos = sizeof(*buf.header);
+
+	save_layout(vgpu, state_section(&buf, GVT_STATE_SECTION_LAYOUT,
+					sizeof(struct gvt_state_layout)));
+
+	if (final) {
+		memcpy(state_section(&buf, GVT_STATE_SECTION_VREG,
+				     info->mmio_size),
+		       vgpu->mmio.vreg, info->mmio_size);
+		memcpy(state_section(&buf, GVT_STATE_SECTION_CFG,
+				     info->cfg_space_size),
+		       vgpu_cfg_space(vgpu), info->cfg_space_size);
+		memcpy(state_section(&buf, GVT_STATE_SECTION_OPREGION,
+				     INTEL_GVT_OPREGION_SIZE),
+		       vgpu_opregion(vgpu)->va, INTEL_GVT_OPREGION_SIZE);
+		save_execlist(vgpu, state_section(&buf,
+				GVT_STATE_SECTION_EXECLIST,
+				nr_engines * sizeof(struct gvt_state_execlist)));
+	}
+
+	save_ggtt(vgpu, &buf, count);
+
+	if (final) {
+		vfree(vgpu->gtt.ggtt_save_bitmap);
+		vgpu->gtt.ggtt_save_bitmap = NULL;
+	}
+
+	*data = buf.data;
+	*size = buf.pos;
+out:
+	mutex_unlock(&vgpu->vgpu_lock);
+	return ret;
+}
+
+/**
+ * intel_vgpu_set_postcopy - mark the post-copy phase of a migration
+ * @vgpu: a vGPU
+ * @on: whether the guest memory is still being pulled from the source
+ *
+ * Set by the VMM on the destination while the guest runs with pages still
+ * missing. Meanwhile the guest pages of a workload are faulted in by the
+ * scan worker of the vGPU before it is dispatched, so that waiting for
+ * them doesn't stall the other vGPUs.
+ *
+ * Returns:
+ * Zero on success.
+ */
+int intel_vgpu_set_postcopy(struct intel_vgpu *vgpu, bool on)
+{
+	struct intel_gvt_workload_scheduler *scheduler =
+		&vgpu->gvt->scheduler;
+	enum intel_engine_id id;
+
+	mutex_lock(&vgpu->vgpu_lock);
+	vgpu->postcopy = on;
+	mutex_unlock(&vgpu->vgpu_lock);
+
+	/* release the workloads held back for their pages */
+	if (!on) {
+		for (id = 0; id < I915_NUM_ENGINES; id++)
+			wake_up(&scheduler->waitq[id]);
+	}
+	return 0;
+}
+
+/**
+ * intel_vgpu_stop_save_state - abort a migration of a vGPU
+ * @vgpu: a vGPU
+ *
+ * Stop tracking the GGTT entries written since the last pre-copy round.
+ */
+void intel_vgpu_stop_save_state(struct intel_vgpu *vgpu)
+{
+	mutex_lock(&vgpu->vgpu_lock);
+	vfree(vgpu->gtt.ggtt_save_bitmap);
+	vgpu->gtt.ggtt_save_bitmap = NULL;
+	mutex_unlock(&vgpu->vgpu_lock);
+}
+
+static int load_layout(struct intel_vgpu *vgpu,
+		       const struct gvt_state_layout *l)
+{
+	struct gvt_state_layout layout;
+
+	save_layout(vgpu, &layout);
+	if (memcmp(&layout, l, sizeof(layout))) {
+		gvt_vgpu_err("state of a vGPU with a different layout\n");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int load_execlist(struct intel_vgpu *vgpu,
+			 const struct gvt_state_execlist *s, u64 size)
+{
+	struct intel_vgpu_execlist *execlist;
+
+	for (; size >= sizeof(*s); s++, size -= sizeof(*s)) {
+		if (s->ring_id >= I915_NUM_ENGINES ||
+		    s->running_slot >= 2 || s->pending_slot >= 2 ||
+		    s->running_context >= 2 ||
+		    (s->running_context >= 0 && s->running_slot < 0))
+			return -EINVAL;
+
+		execlist = &vgpu->submission.execlist[s->ring_id];
+		memcpy(execlist->slot, s->slot, sizeof(execlist->slot));
+		execlist->elsp_dwords = s->elsp_dwords;
+		execlist->running_slot = s->running_slot < 0 ? NULL :
+			&execlist->slot[s->running_slot];
+		execlist->pending_slot = s->pending_slot < 0 ? NULL :
+			&execlist->slot[s->pending_slot];
+		execlist->running_context = s->running_context < 0 ? NULL :
+			&execlist->running_slot->ctx[s->running_context];
+	}
+	return 0;
+}
+
+static int load_ggtt(struct intel_vgpu *vgpu,
+		     const struct gvt_state_ggtt_entry *e, u64 size)
+{
+	const struct intel_gvt_device_info *info = &vgpu->gvt->device_info;
+	unsigned long nr = nr_ggtt_entries(vgpu->gvt);
+	u64 val;
+	int ret;
+
+	for (; size >= sizeof(*e); e++, size -= sizeof(*e)) {
+		if (e->index >= nr)
+			return -EINVAL;
+		val = e->val;
+		ret = intel_vgpu_emulate_ggtt_mmio_write(vgpu,
+				info->gtt_start_offset +
+				(e->index << info->gtt_entry_size_shift),
+				&val, sizeof(val));
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static void load_fences(struct intel_vgpu *vgpu)
+{
+	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
+	int i;
+
+	mmio_hw_access_pre(dev_priv);
+	for (i = 0; i < vgpu_fence_sz(vgpu); i++)
+		intel_vgpu_write_fence(vgpu, i,
+				vgpu_vreg64(vgpu, i915_mmio_reg_offset(
+						     FENCE_REG_GEN6_LO(i))));
+	mmio_hw_access_post(dev_priv);
+}
+
+/**
+ * intel_vgpu_load_state - load the device state of a vGPU
+ * @vgpu: a vGPU
+ * @data: a stream from intel_vgpu_save_state()
+ * @size: size of the stream
+ *
+ * Pre-copy streams are loaded in the order they were saved, then the
+ * final one. The vGPU must not run workloads meanwhile.
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+int intel_vgpu_load_state(struct intel_vgpu *vgpu, const void *data,
+			  size_t size)
+{
+	const struct intel_gvt_device_info *info = &vgpu->gvt->device_info;
+	const struct gvt_state_header *header = data;
+	const struct gvt_state_section *s;
+	bool has_layout = false;
+	size_t pos;
+	u32 i;
+	int ret;
+
+	if (size < sizeof(*header) || header->magic != GVT_STATE_MAGIC)
+		return -EINVAL;
+	if (header->version != GVT_STATE_VERSION) {
+		gvt_vgpu_err("unsupported state version %u\n",
+			     header->version);
+		return -EINVAL;
+	}
+
+	mutex_lock(&vgpu->vgpu_lock);
+
+	ret = vgpu_wait_idle(vgpu);
+	if (ret)
+		goto out;
+
+	pos = sizeof(*header);
+	for (i = 0; i < header->nr_sections; i++) {
+		const void *p;
+
+		ret = -EINVAL;
+		if (size - pos < sizeof(*s))
+			goto out;
+		s = data + pos;
+		p = s + 1;
+		pos += sizeof(*s);
+		if (size - pos < s->size)
+			goto out;
+		pos += s->size;
+
+		if (!has_layout && s->id != GVT_STATE_SECTION_LAYOUT)
+			goto out;
+
+		switch (s->id) {
+		case GVT_STATE_SECTION_LAYOUT:
+			if (s->size != sizeof(struct gvt_state_layout))
+				goto out;
+			ret = load_layout(vgpu, p);
+			has_layout = true;
+			break;
+		case GVT_STATE_SECTION_VREG:
+			if (s->size != info->mmio_size)
+				goto out;
+			ret = intel_vgpu_load_vreg(vgpu, p);
+			if (ret)
+				goto out;
+			load_fences(vgpu);
+			break;
+		case GVT_STATE_SECTION_CFG:
+			if (s->size != info->cfg_space_size)
+				goto out;
+			memcpy(vgpu_cfg_space(vgpu), p, info->cfg_space_size);
+			ret = 0;
+			break;
+		case GVT_STATE_SECTION_OPREGION:
+			if (s->size != INTEL_GVT_OPREGION_SIZE)
+				goto out;
+			memcpy(vgpu_opregion(vgpu)->va, p,
+			       INTEL_GVT_OPREGION_SIZE);
+			ret = 0;
+			break;
+		case GVT_STATE_SECTION_EXECLIST:
+			ret = load_execlist(vgpu, p, s->size);
+			break;
+		case GVT_STATE_SECTION_GGTT:
+			ret = load_ggtt(vgpu, p, s->size);
+			break;
+		default:
+			gvt_vgpu_err("unknown state section %u\n", s->id);
+			break;
+		}
+		if (ret)
+			goto out;
+	}
+	ret = 0;
+out:
+	mutex_unlock(&vgpu->vgpu_lock);
+	return ret;
+}
@@ -35,6 +35,7 @@
 
 #include "i915_drv.h"
 #include "gvt.h"
+#include "trace.h"
 
 /**
  * intel_vgpu_gpa_to_mmio_offset - translate a GPA to MMIO offset
@@ -67,7 +68,7 @@ static void failsafe_emulate_mmio_rw(struct intel_vgpu *vgpu, uint64_t pa,
 		return;
 
 	gvt = vgpu->gvt;
-	mutex_lock(&gvt->lock);
+	mutex_lock(&vgpu->vgpu_lock);
 	offset = intel_vgpu_gpa_to_mmio_offset(vgpu, pa);
 	if (reg_is_mmio(gvt, offset)) {
 		if (read)
@@ -85,7 +86,21 @@ static void failsafe_emulate_mmio_rw(struct intel_vgpu *vgpu, uint64_t pa,
 			memcpy(pt, p_data, bytes);
 
 	}
-	mutex_unlock(&gvt->lock);
+	mutex_unlock(&vgpu->vgpu_lock);
+}
+
+static void record_mmio(struct intel_vgpu *vgpu,
+			enum intel_gvt_rec_type type, unsigned int offset,
+			void *p_data, unsigned int bytes, u64 start)
+{
+	u32 val = 0;
+
+	memcpy(&val, p_data, min_t(unsigned int, bytes, sizeof(val)));
+	intel_gvt_record(vgpu, type, offset, val, start);
+	if (trace_vgpu_mmio_enabled())
+		trace_vgpu_mmio(vgpu->id, offset, bytes,
+				type == INTEL_GVT_REC_MMIO_WRITE,
+				ktime_get_ns() - start);
 }
 
 /**
@@ -103,13 +118,17 @@ int intel_vgpu_emulate_mmio_read(struct intel_vgpu *vgpu, uint64_t pa,
 {
 	struct intel_gvt *gvt = vgpu->gvt;
 	unsigned int offset = 0;
+	u64 start = ktime_get_ns();
 	int ret = -EINVAL;
 
 	if (vgpu->failsafe) {
 		failsafe_emulate_mmio_rw(vgpu, pa, p_data, bytes, true);
 		return 0;
 	}
-	mutex_lock(&gvt->lock);
+	intel_vgpu_stat_inc(vgpu, INTEL_VGPU_STAT_MMIO_READ);
+	mutex_lock(&vgpu->vgpu_lock);
+
+	intel_vgpu_flush_elsp(vgpu);
 
 	offset = intel_vgpu_gpa_to_mmio_offset(vgpu, pa);
 
@@ -156,7 +175,9 @@ int intel_vgpu_emulate_mmio_read(struct intel_vgpu *vgpu, uint64_t pa,
 	gvt_vgpu_err("fail to emulate MMIO read %08x len %d\n",
 			offset, bytes);
 out:
-	mutex_unlock(&gvt->lock);
+	mutex_unlock(&vgpu->vgpu_lock);
+	record_mmio(vgpu, INTEL_GVT_REC_MMIO_READ, offset, p_data, bytes,
+		    start);
 	return ret;
 }
 
@@ -175,6 +196,7 @@ int intel_vgpu_emulate_mmio_write(struct intel_vgpu *vgpu, uint64_t pa,
 {
 	struct intel_gvt *gvt = vgpu->gvt;
 	unsigned int offset = 0;
+	u64 start = ktime_get_ns();
 	int ret = -EINVAL;
 
 	if (vgpu->failsafe) {
@@ -182,7 +204,10 @@ int intel_vgpu_emulate_mmio_write(struct intel_vgpu *vgpu, uint64_t pa,
 		return 0;
 	}
 
-	mutex_lock(&gvt->lock);
+	intel_vgpu_stat_inc(vgpu, INTEL_VGPU_STAT_MMIO_WRITE);
+	mutex_lock(&vgpu->vgpu_lock);
+
+	intel_vgpu_flush_elsp(vgpu);
 
 	offset = intel_vgpu_gpa_to_mmio_offset(vgpu, pa);
 
@@ -209,7 +234,9 @@ int intel_vgpu_emulate_mmio_write(struct intel_vgpu *vgpu, uint64_t pa,
 		goto out;
 	}
 
+	write_seqcount_begin(&vgpu->mmio.vreg_seq);
 	ret = intel_vgpu_mmio_reg_rw(vgpu, offset, p_data, bytes, false);
+	write_seqcount_end(&vgpu->mmio.vreg_seq);
 	if (ret < 0)
 		goto err;
 
@@ -220,10 +247,242 @@ int intel_vgpu_emulate_mmio_write(struct intel_vgpu *vgpu, uint64_t pa,
 	gvt_vgpu_err("fail to emulate MMIO write %08x len %d\n", offset,
 		     bytes);
 out:
-	mutex_unlock(&gvt->lock);
+	mutex_unlock(&vgpu->vgpu_lock);
+	record_mmio(vgpu, INTEL_GVT_REC_MMIO_WRITE, offset, p_data, bytes,
+		    start);
+	return ret;
+}
+
+/**
+ * intel_vgpu_emulate_ggtt_rw - emulate a bulk access to the GGTT entries
+ * @vgpu: a vGPU
+ * @pa: guest physical address of the first entry
+ * @p_data: data buffer
+ * @bytes: access data length, a multiple of the entry size
+ * @is_write: write or read
+ *
+ * This is used by the hypervisor module for large accesses of the VMM,
+ * e.g. to save or restore the GGTT, which would otherwise be split into as
+ * many MMIO accesses as entries.
+ *
+ * Returns:
+ * Zero on success, negative error code if failed
+ */
+int intel_vgpu_emulate_ggtt_rw(struct intel_vgpu *vgpu, u64 pa,
+		void *p_data, unsigned int bytes, bool is_write)
+{
+	struct intel_gvt *gvt = vgpu->gvt;
+	unsigned int offset;
+	int ret;
+
+	if (vgpu->failsafe) {
+		failsafe_emulate_mmio_rw(vgpu, pa, p_data, bytes, !is_write);
+		return 0;
+	}
+
+	mutex_lock(&vgpu->vgpu_lock);
+
+	offset = intel_vgpu_gpa_to_mmio_offset(vgpu, pa);
+	if (WARN_ON(!reg_is_gtt(gvt, offset) ||
+		    !reg_is_gtt(gvt, offset + bytes - 1))) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	ret = intel_vgpu_emulate_ggtt_bulk_rw(vgpu, offset, p_data, bytes,
+					      is_write);
+	if (ret)
+		gvt_vgpu_err("fail to emulate GGTT %s %08x len %d\n",
+			     is_write ? "write" : "read", offset, bytes);
+out:
+	mutex_unlock(&vgpu->vgpu_lock);
 	return ret;
 }
 
+/**
+ * intel_vgpu_emulate_mmio_fast_rw - emulate a side-effect free MMIO access
+ * @vgpu: a vGPU
+ * @pa: guest physical address
+ * @p_data: data buffer
+ * @bytes: access data length
+ * @is_read: read or write
+ *
+ * This is called by the hypervisor module straight from the vCPU exit path,
+ * so it never sleeps on the vGPU lock: a trap area update could be waiting
+ * for that exit to finish while holding it. Only accesses fully covered by
+ * side-effect free registers are handled here, besides ELSP writes which are
+ * latched and submitted later when the MPT module asked for deferred ELSP
+ * submission.
+ *
+ * Returns:
+ * Zero on success, -EOPNOTSUPP if the access has to go through the normal
+ * MMIO emulation path, other negative error code if failed.
+ */
+int intel_vgpu_emulate_mmio_fast_rw(struct intel_vgpu *vgpu, u64 pa,
+		void *p_data, unsigned int bytes, bool is_read)
+{
+	struct intel_gvt *gvt = vgpu->gvt;
+	bool elsp = false;
+	u64 offset;
+	int ret;
+
+	if (vgpu->failsafe ||
+	    !(vgpu_cfg_space(vgpu)[PCI_COMMAND] & PCI_COMMAND_MEMORY))
+		return -EOPNOTSUPP;
+
+	offset = pa - intel_vgpu_get_bar_gpa(vgpu, PCI_BASE_ADDRESS_0);
+
+	if ((bytes != 4 && bytes != 8) || !IS_ALIGNED(offset, bytes) ||
+	    offset + bytes > gvt->device_info.mmio_size)
+		return -EOPNOTSUPP;
+
+	if (!intel_gvt_mmio_is_side_effect_free(gvt, offset) ||
+	    !intel_gvt_mmio_is_side_effect_free(gvt, offset + bytes - 4)) {
+		if (is_read || bytes != 4 || !vgpu->submission.defer_elsp)
+			return -EOPNOTSUPP;
+		elsp = true;
+	}
+
+	if (!mutex_trylock(&vgpu->vgpu_lock))
+		return -EOPNOTSUPP;
+
+	/* pending ELSP writes are flushed by the normal path first */
+	if (!bitmap_empty(vgpu->submission.elsp_pending, I915_NUM_ENGINES)) {
+		ret = -EOPNOTSUPP;
+		goto out;
+	}
+
+	if (elsp)
+		ret = intel_vgpu_latch_elsp(vgpu, offset, *(u32 *)p_data);
+	else
+		ret = intel_vgpu_mmio_reg_rw(vgpu, offset, p_data, bytes,
+					     is_read);
+	if (!ret) {
+		intel_gvt_mmio_set_accessed(gvt, offset);
+		intel_vgpu_stat_inc(vgpu, is_read ? INTEL_VGPU_STAT_MMIO_READ :
+				    INTEL_VGPU_STAT_MMIO_WRITE);
+	}
+out:
+	mutex_unlock(&vgpu->vgpu_lock);
+	return ret;
+}
+
+/*
+ * The vreg space is a kernel mapping of one page per 4K of MMIO space. Pages
+ * holding tracked registers are private to the vGPU, all the others map the
+ * golden template read-only until the guest writes an untracked register in
+ * them. Only the default MMIO handlers touch untracked registers, always
+ * under vgpu_lock, so nobody can access a page while it is being replaced.
+ */
+static int map_vreg_page(struct intel_vgpu *vgpu, unsigned int i)
+{
+	unsigned long addr = (unsigned long)vgpu->mmio.vreg + i * PAGE_SIZE;
+	struct page *page = vgpu->mmio.pages[i];
+	pgprot_t prot = PAGE_KERNEL;
+	int ret;
+
+	if (!page) {
+		page = vmalloc_to_page(vgpu->mmio.sreg + i * PAGE_SIZE);
+		prot = PAGE_KERNEL_RO;
+	}
+
+	ret = map_kernel_range_noflush(addr, PAGE_SIZE, prot, &page);
+	return ret < 0 ? ret : 0;
+}
+
+static int own_vreg_page(struct intel_vgpu *vgpu, unsigned int i)
+{
+	unsigned long addr = (unsigned long)vgpu->mmio.vreg + i * PAGE_SIZE;
+	struct page *page;
+
+	if (vgpu->mmio.pages[i])
+		return 0;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	memcpy(page_address(page), vgpu->mmio.sreg + i * PAGE_SIZE, PAGE_SIZE);
+
+	unmap_kernel_range(addr, PAGE_SIZE);
+	vgpu->mmio.pages[i] = page;
+	/* the page tables are still there, this cannot fail */
+	WARN_ON(map_vreg_page(vgpu, i));
+	flush_cache_vmap(addr, addr + PAGE_SIZE);
+	return 0;
+}
+
+/**
+ * intel_vgpu_own_vreg - make a vreg range writable
+ * @vgpu: a vGPU
+ * @offset: register offset
+ * @bytes: access length
+ *
+ * This function gives the vGPU a private copy of the vreg pages covering
+ * the range, if they still map the golden template.
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+int intel_vgpu_own_vreg(struct intel_vgpu *vgpu, unsigned int offset,
+			unsigned int bytes)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = offset >> PAGE_SHIFT; i <= (offset + bytes - 1) >> PAGE_SHIFT;
+	     i++) {
+		ret = own_vreg_page(vgpu, i);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/**
+ * intel_vgpu_load_vreg - load a full MMIO image into vreg
+ * @vgpu: a vGPU
+ * @mmio: MMIO image of the MMIO space size
+ *
+ * Pages identical to the golden template are left shared.
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+int intel_vgpu_load_vreg(struct intel_vgpu *vgpu, const void *mmio)
+{
+	unsigned int i, nr = vgpu->gvt->device_info.mmio_size >> PAGE_SHIFT;
+	int ret;
+
+	for (i = 0; i < nr; i++) {
+		if (!vgpu->mmio.pages[i] &&
+		    !memcmp(mmio + i * PAGE_SIZE,
+			    vgpu->mmio.sreg + i * PAGE_SIZE, PAGE_SIZE))
+			continue;
+
+		ret = own_vreg_page(vgpu, i);
+		if (ret)
+			return ret;
+
+		memcpy(vgpu->mmio.vreg + i * PAGE_SIZE, mmio + i * PAGE_SIZE,
+		       PAGE_SIZE);
+	}
+	return 0;
+}
+
+/* shared pages always hold the golden state, only private ones need it */
+static void reset_vreg(struct intel_vgpu *vgpu, unsigned int size)
+{
+	unsigned int i;
+
+	for (i = 0; i < DIV_ROUND_UP(size, PAGE_SIZE); i++) {
+		if (vgpu->mmio.pages[i])
+			memcpy(vgpu->mmio.vreg + i * PAGE_SIZE,
+			       vgpu->mmio.sreg + i * PAGE_SIZE,
+			       min_t(unsigned int, size - i * PAGE_SIZE,
+				     PAGE_SIZE));
+	}
+}
 
 /**
  * intel_vgpu_reset_mmio - reset virtual MMIO space
@@ -234,16 +493,9 @@ void intel_vgpu_reset_mmio(struct intel_vgpu *vgpu, bool dmlr)
 {
 	struct intel_gvt *gvt = vgpu->gvt;
 	const struct intel_gvt_device_info *info = &gvt->device_info;
-	void  *mmio = gvt->firmware.mmio;
 
 	if (dmlr) {
-		memcpy(vgpu->mmio.vreg, mmio, info->mmio_size);
-		memcpy(vgpu->mmio.sreg, mmio, info->mmio_size);
-
-		vgpu_vreg_t(vgpu, GEN6_GT_THREAD_STATUS_REG) = 0;
-
-		/* set the bit 0:2(Core C-State ) to C0 */
-		vgpu_vreg_t(vgpu, GEN6_GT_CORE_STATUS) = 0;
+		reset_vreg(vgpu, info->mmio_size);
 
 		vgpu->mmio.disable_warn_untrack = false;
 	} else {
@@ -252,12 +504,45 @@ void intel_vgpu_reset_mmio(struct intel_vgpu *vgpu, bool dmlr)
 		 * interrupt include DE,display mmio related will not be
 		 * touched
 		 */
-		memcpy(vgpu->mmio.vreg, mmio, GVT_GEN8_MMIO_RESET_OFFSET);
-		memcpy(vgpu->mmio.sreg, mmio, GVT_GEN8_MMIO_RESET_OFFSET);
+		reset_vreg(vgpu, GVT_GEN8_MMIO_RESET_OFFSET);
 	}
 
 }
 
+static int mark_tracked_page(struct intel_gvt *gvt, u32 offset, void *data)
+{
+	set_bit(offset >> PAGE_SHIFT, data);
+	return 0;
+}
+
+/**
+ * intel_gvt_setup_mmio_template - prepare the MMIO image of a fresh vGPU
+ * @gvt: a GVT device
+ * @mmio: buffer of the MMIO space size
+ *
+ * @tracked: bitmap of the MMIO space pages
+ *
+ * This function builds the MMIO image that vGPUs are reset to, from the
+ * firmware snapshot. The template is the only consumer of the snapshot,
+ * so the snapshot is released once it has been copied. The pages holding
+ * tracked registers are marked in @tracked.
+ *
+ */
+void intel_gvt_setup_mmio_template(struct intel_gvt *gvt, void *mmio,
+				   unsigned long *tracked)
+{
+	memcpy(mmio, gvt->firmware.mmio, gvt->device_info.mmio_size);
+	kfree(gvt->firmware.mmio);
+	gvt->firmware.mmio = NULL;
+
+	*(u32 *)(mmio + i915_mmio_reg_offset(GEN6_GT_THREAD_STATUS_REG)) = 0;
+
+	/* set the bit 0:2(Core C-State ) to C0 */
+	*(u32 *)(mmio + i915_mmio_reg_offset(GEN6_GT_CORE_STATUS)) = 0;
+
+	intel_gvt_for_each_tracked_mmio(gvt, mark_tracked_page, tracked);
+}
+
 /**
  * intel_vgpu_init_mmio - init MMIO  space
  * @vgpu: a vGPU
@@ -267,17 +552,52 @@ void intel_vgpu_reset_mmio(struct intel_vgpu *vgpu, bool dmlr)
  */
 int intel_vgpu_init_mmio(struct intel_vgpu *vgpu)
 {
-	const struct intel_gvt_device_info *info = &vgpu->gvt->device_info;
+	struct intel_gvt *gvt = vgpu->gvt;
+	const struct intel_gvt_device_info *info = &gvt->device_info;
+	unsigned int i, nr = info->mmio_size >> PAGE_SHIFT;
+	struct vm_struct *area;
+	unsigned long addr;
+
+	/*
+	 * The shadow registers only ever hold the golden value, which the
+	 * mode mask handling merges back into the masked bits. Share the
+	 * template instead of keeping a private copy per vGPU.
+	 */
+	vgpu->mmio.sreg = gvt->vgpu_template.mmio;
+	seqcount_init(&vgpu->mmio.vreg_seq);
+
+	vgpu->mmio.pages = kcalloc(nr, sizeof(struct page *), GFP_KERNEL);
+	if (!vgpu->mmio.pages)
+		goto err;
 
-	vgpu->mmio.vreg = vzalloc(info->mmio_size * 2);
-	if (!vgpu->mmio.vreg)
-		return -ENOMEM;
+	/* fully initialized from the template below */
+	for_each_set_bit(i, gvt->vgpu_template.mmio_tracked, nr) {
+		vgpu->mmio.pages[i] = alloc_page(GFP_KERNEL);
+		if (!vgpu->mmio.pages[i])
+			goto err;
+	}
+
+	area = __get_vm_area(info->mmio_size, VM_MAP, VMALLOC_START,
+			     VMALLOC_END);
+	if (!area)
+		goto err;
 
-	vgpu->mmio.sreg = vgpu->mmio.vreg + info->mmio_size;
+	vgpu->mmio.area = area;
+	vgpu->mmio.vreg = area->addr;
+	addr = (unsigned long)area->addr;
+
+	for (i = 0; i < nr; i++) {
+		if (map_vreg_page(vgpu, i))
+			goto err;
+	}
+	flush_cache_vmap(addr, addr + info->mmio_size);
 
 	intel_vgpu_reset_mmio(vgpu, true);
 
 	return 0;
+err:
+	intel_vgpu_clean_mmio(vgpu);
+	return -ENOMEM;
 }
 
 /**
@@ -287,6 +607,21 @@ int intel_vgpu_init_mmio(struct intel_vgpu *vgpu)
  */
 void intel_vgpu_clean_mmio(struct intel_vgpu *vgpu)
 {
-	vfree(vgpu->mmio.vreg);
-	vgpu->mmio.vreg = vgpu->mmio.sreg = NULL;
+	unsigned int i, nr = vgpu->gvt->device_info.mmio_size >> PAGE_SHIFT;
+
+	if (vgpu->mmio.area)
+		free_vm_area(vgpu->mmio.area);
+
+	if (vgpu->mmio.pages) {
+		for (i = 0; i < nr; i++) {
+			if (vgpu->mmio.pages[i])
+				__free_page(vgpu->mmio.pages[i]);
+		}
+		kfree(vgpu->mmio.pages);
+	}
+
+	vgpu->mmio.area = NULL;
+	vgpu->mmio.pages = NULL;
+	vgpu->mmio.vreg = NULL;
+	vgpu->mmio.sreg = NULL;
 }
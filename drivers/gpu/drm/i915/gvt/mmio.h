@@ -57,8 +57,8 @@ typedef int (*gvt_mmio_func)(struct intel_vgpu *, unsigned int, void *,
 
 struct intel_gvt_mmio_info {
 	u32 offset;
-	u64 ro_mask;
 	u32 device;
+	u64 ro_mask;
 	gvt_mmio_func read;
 	gvt_mmio_func write;
 	u32 addr_range;
@@ -76,9 +76,14 @@ int intel_gvt_for_each_tracked_mmio(struct intel_gvt *gvt,
 	int (*handler)(struct intel_gvt *gvt, u32 offset, void *data),
 	void *data);
 
+void intel_gvt_setup_mmio_template(struct intel_gvt *gvt, void *mmio,
+				   unsigned long *tracked);
 int intel_vgpu_init_mmio(struct intel_vgpu *vgpu);
 void intel_vgpu_reset_mmio(struct intel_vgpu *vgpu, bool dmlr);
 void intel_vgpu_clean_mmio(struct intel_vgpu *vgpu);
+int intel_vgpu_own_vreg(struct intel_vgpu *vgpu, unsigned int offset,
+			unsigned int bytes);
+int intel_vgpu_load_vreg(struct intel_vgpu *vgpu, const void *mmio);
 
 int intel_vgpu_gpa_to_mmio_offset(struct intel_vgpu *vgpu, u64 gpa);
 
@@ -86,6 +91,15 @@ int intel_vgpu_emulate_mmio_read(struct intel_vgpu *vgpu, u64 pa,
 				void *p_data, unsigned int bytes);
 int intel_vgpu_emulate_mmio_write(struct intel_vgpu *vgpu, u64 pa,
 				void *p_data, unsigned int bytes);
+int intel_vgpu_emulate_mmio_fast_rw(struct intel_vgpu *vgpu, u64 pa,
+				void *p_data, unsigned int bytes, bool is_read);
+int intel_vgpu_emulate_ggtt_rw(struct intel_vgpu *vgpu, u64 pa,
+				void *p_data, unsigned int bytes, bool is_write);
+
+int intel_vgpu_register_pv_mailbox(struct intel_vgpu *vgpu, u64 gpa);
+int intel_vgpu_drain_pv_mailbox(struct intel_vgpu *vgpu);
+int intel_vgpu_register_pv_timestamp(struct intel_vgpu *vgpu, u64 gpa);
+void intel_vgpu_update_pv_timestamp(struct intel_vgpu *vgpu);
 
 int intel_vgpu_default_mmio_read(struct intel_vgpu *vgpu, unsigned int offset,
 				 void *p_data, unsigned int bytes);
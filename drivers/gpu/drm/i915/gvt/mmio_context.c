@@ -335,52 +335,6 @@ int intel_vgpu_restore_inhibit_context(struct intel_vgpu *vgpu,
 	return ret;
 }
 
-static void handle_tlb_pending_event(struct intel_vgpu *vgpu, int ring_id)
-{
-	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
-	struct intel_vgpu_submission *s = &vgpu->submission;
-	enum forcewake_domains fw;
-	i915_reg_t reg;
-	u32 regs[] = {
-		[RCS] = 0x4260,
-		[VCS] = 0x4264,
-		[VCS2] = 0x4268,
-		[BCS] = 0x426c,
-		[VECS] = 0x4270,
-	};
-
-	if (WARN_ON(ring_id >= ARRAY_SIZE(regs)))
-		return;
-
-	if (!test_and_clear_bit(ring_id, (void *)s->tlb_handle_pending))
-		return;
-
-	reg = _MMIO(regs[ring_id]);
-
-	/* WaForceWakeRenderDuringMmioTLBInvalidate:skl
-	 * we need to put a forcewake when invalidating RCS TLB caches,
-	 * otherwise device can go to RC6 state and interrupt invalidation
-	 * process
-	 */
-	fw = intel_uncore_forcewake_for_reg(dev_priv, reg,
-					    FW_REG_READ | FW_REG_WRITE);
-	if (ring_id == RCS && (IS_SKYLAKE(dev_priv) || IS_KABYLAKE(dev_priv)))
-		fw |= FORCEWAKE_RENDER;
-
-	intel_uncore_forcewake_get(dev_priv, fw);
-
-	I915_WRITE_FW(reg, 0x1);
-
-	if (wait_for_atomic((I915_READ_FW(reg) == 0), 50))
-		gvt_vgpu_err("timeout in invalidate ring (%d) tlb\n", ring_id);
-	else
-		vgpu_vreg_t(vgpu, reg) = 0;
-
-	intel_uncore_forcewake_put(dev_priv, fw);
-
-	gvt_dbg_core("invalidate TLB for ring %d\n", ring_id);
-}
-
 static void switch_mocs(struct intel_vgpu *pre, struct intel_vgpu *next,
 			int ring_id)
 {
@@ -504,19 +458,26 @@ static void switch_mmio(struct intel_vgpu *pre,
 			    !is_inhibit_context(s->shadow_ctx, ring_id))
 				continue;
 
-			if (mmio->mask)
-				new_v = vgpu_vreg_t(next, mmio->reg) |
-							(mmio->mask << 16);
-			else
-				new_v = vgpu_vreg_t(next, mmio->reg);
+			new_v = vgpu_vreg_t(next, mmio->reg);
 		} else {
 			if (mmio->in_context)
 				continue;
-			if (mmio->mask)
-				new_v = mmio->value | (mmio->mask << 16);
-			else
-				new_v = mmio->value;
+			new_v = mmio->value;
 		}
+		if (mmio->mask)
+			new_v &= ~(mmio->mask << 16);
+
+		/*
+		 * old_v is what the hardware holds right now, so there is
+		 * nothing to load if next wants the same value. Most of the
+		 * list is static configuration which rarely differs between
+		 * vGPUs, so this skips the bulk of the writes on a switch.
+		 */
+		if (old_v == new_v)
+			continue;
+
+		if (mmio->mask)
+			new_v |= mmio->mask << 16;
 
 		I915_WRITE_FW(mmio->reg, new_v);
 
@@ -526,9 +487,6 @@ static void switch_mmio(struct intel_vgpu *pre,
 				  i915_mmio_reg_offset(mmio->reg),
 				  old_v, new_v);
 	}
-
-	if (next)
-		handle_tlb_pending_event(next, ring_id);
 }
 
 /**
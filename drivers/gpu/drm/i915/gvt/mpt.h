@@ -134,6 +134,7 @@ static inline int intel_gvt_hypervisor_inject_msi(struct intel_vgpu *vgpu)
 		return -EINVAL;
 
 	trace_inject_msi(vgpu->id, addr, data);
+	intel_gvt_record(vgpu, INTEL_GVT_REC_INJECT_MSI, addr, data, 0);
 
 	ret = intel_gvt_host.mpt->inject_msi(vgpu->handle, addr, data);
 	if (ret)
@@ -167,6 +168,35 @@ static inline int intel_gvt_hypervisor_enable_page_track(
 	return intel_gvt_host.mpt->enable_page_track(vgpu->handle, gfn);
 }
 
+/**
+ * intel_gvt_hypervisor_enable_page_tracks - track a batch of guest pages
+ * @vgpu: a vGPU
+ * @gfns: the gfns of guest, may be reordered
+ * @count: number of entries in @gfns
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+static inline int intel_gvt_hypervisor_enable_page_tracks(
+		struct intel_vgpu *vgpu, unsigned long *gfns,
+		unsigned int count)
+{
+	unsigned int i;
+	int ret;
+
+	if (intel_gvt_host.mpt->enable_page_tracks)
+		return intel_gvt_host.mpt->enable_page_tracks(vgpu->handle,
+				gfns, count);
+
+	for (i = 0; i < count; i++) {
+		ret = intel_gvt_host.mpt->enable_page_track(vgpu->handle,
+				gfns[i]);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
 /**
  * intel_gvt_hypervisor_disable_page_track - untrack a guest page
  * @vgpu: a vGPU
@@ -213,6 +243,40 @@ static inline int intel_gvt_hypervisor_write_gpa(struct intel_vgpu *vgpu,
 	return intel_gvt_host.mpt->write_gpa(vgpu->handle, gpa, buf, len);
 }
 
+/**
+ * intel_gvt_hypervisor_rw_gpa_bulk - copy data between several GPA ranges
+ * and host data buffers
+ * @vgpu: a vGPU
+ * @bufs: GPA ranges and their host data buffers
+ * @count: number of entries in @bufs
+ * @write: copy from the host data buffers to guest if true
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+static inline int intel_gvt_hypervisor_rw_gpa_bulk(struct intel_vgpu *vgpu,
+		struct intel_gvt_gpa_buf *bufs, unsigned int count, bool write)
+{
+	unsigned int i;
+	int ret;
+
+	if (intel_gvt_host.mpt->rw_gpa_bulk)
+		return intel_gvt_host.mpt->rw_gpa_bulk(vgpu->handle, bufs,
+						       count, write);
+
+	for (i = 0; i < count; i++) {
+		if (write)
+			ret = intel_gvt_hypervisor_write_gpa(vgpu, bufs[i].gpa,
+					bufs[i].buf, bufs[i].len);
+		else
+			ret = intel_gvt_hypervisor_read_gpa(vgpu, bufs[i].gpa,
+					bufs[i].buf, bufs[i].len);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
 /**
  * intel_gvt_hypervisor_gfn_to_mfn - translate a GFN to MFN
  * @vgpu: a vGPU
@@ -231,28 +295,68 @@ static inline unsigned long intel_gvt_hypervisor_gfn_to_mfn(
  * intel_gvt_hypervisor_dma_map_guest_page - setup dma map for guest page
  * @vgpu: a vGPU
  * @gpfn: guest pfn
+ * @size: page size, larger than PAGE_SIZE for a huge page
  * @dma_addr: retrieve allocated dma addr
  *
  * Returns:
- * 0 on success, negative error code if failed.
+ * 0 on success, -E2BIG if the host pages backing a huge page are not
+ * contiguous, negative error code if failed.
  */
 static inline int intel_gvt_hypervisor_dma_map_guest_page(
-		struct intel_vgpu *vgpu, unsigned long gfn,
+		struct intel_vgpu *vgpu, unsigned long gfn, unsigned long size,
 		dma_addr_t *dma_addr)
 {
-	return intel_gvt_host.mpt->dma_map_guest_page(vgpu->handle, gfn,
+	return intel_gvt_host.mpt->dma_map_guest_page(vgpu->handle, gfn, size,
 						      dma_addr);
 }
 
+/**
+ * intel_gvt_hypervisor_dma_map_guest_pages - setup dma map for a batch of
+ * guest pages
+ * @vgpu: a vGPU
+ * @gfns: guest pfns of 4K pages
+ * @count: number of entries in @gfns
+ * @dma_addrs: retrieve allocated dma addrs
+ *
+ * Returns:
+ * 0 on success, negative error code if failed, in which case none of the
+ * pages is left mapped.
+ */
+static inline int intel_gvt_hypervisor_dma_map_guest_pages(
+		struct intel_vgpu *vgpu, unsigned long *gfns,
+		unsigned int count, dma_addr_t *dma_addrs)
+{
+	unsigned int i;
+	int ret;
+
+	if (intel_gvt_host.mpt->dma_map_guest_pages)
+		return intel_gvt_host.mpt->dma_map_guest_pages(vgpu->handle,
+				gfns, count, dma_addrs);
+
+	for (i = 0; i < count; i++) {
+		ret = intel_gvt_host.mpt->dma_map_guest_page(vgpu->handle,
+				gfns[i], PAGE_SIZE, &dma_addrs[i]);
+		if (ret)
+			goto err;
+	}
+	return 0;
+err:
+	while (i--)
+		intel_gvt_host.mpt->dma_unmap_guest_page(vgpu->handle,
+				dma_addrs[i], PAGE_SIZE);
+	return ret;
+}
+
 /**
  * intel_gvt_hypervisor_dma_unmap_guest_page - cancel dma map for guest page
  * @vgpu: a vGPU
  * @dma_addr: the mapped dma addr
+ * @size: page size passed when the dma addr was mapped
  */
 static inline void intel_gvt_hypervisor_dma_unmap_guest_page(
-		struct intel_vgpu *vgpu, dma_addr_t dma_addr)
+		struct intel_vgpu *vgpu, dma_addr_t dma_addr, unsigned long size)
 {
-	intel_gvt_host.mpt->dma_unmap_guest_page(vgpu->handle, dma_addr);
+	intel_gvt_host.mpt->dma_unmap_guest_page(vgpu->handle, dma_addr, size);
 }
 
 /**
@@ -361,4 +465,48 @@ static inline bool intel_gvt_hypervisor_is_valid_gfn(
 	return intel_gvt_host.mpt->is_valid_gfn(vgpu->handle, gfn);
 }
 
+/**
+ * intel_gvt_hypervisor_get_guest_page - pin the host page backing a gfn
+ * @vgpu: a vGPU
+ * @gfn: guest PFN
+ *
+ * This may be called from a kernel thread.
+ *
+ * Returns:
+ * The pinned page on success, ERR_PTR if failed.
+ */
+static inline struct page *intel_gvt_hypervisor_get_guest_page(
+		struct intel_vgpu *vgpu, unsigned long gfn)
+{
+	if (!intel_gvt_host.mpt->get_guest_page)
+		return ERR_PTR(-ENODEV);
+
+	return intel_gvt_host.mpt->get_guest_page(vgpu->handle, gfn);
+}
+
+/**
+ * intel_gvt_hypervisor_put_guest_page - unpin a page from get_guest_page
+ * @vgpu: a vGPU
+ * @page: the page returned by intel_gvt_hypervisor_get_guest_page()
+ */
+static inline void intel_gvt_hypervisor_put_guest_page(
+		struct intel_vgpu *vgpu, struct page *page)
+{
+	intel_gvt_host.mpt->put_guest_page(vgpu->handle, page);
+}
+
+/**
+ * intel_gvt_hypervisor_notify_plane_flip - tell the display consumer that
+ * the guest flipped its primary plane
+ * @vgpu: a vGPU
+ */
+static inline void intel_gvt_hypervisor_notify_plane_flip(
+		struct intel_vgpu *vgpu)
+{
+	if (!intel_gvt_host.mpt->notify_plane_flip)
+		return;
+
+	intel_gvt_host.mpt->notify_plane_flip(vgpu->handle);
+}
+
 #endif /* _GVT_MPT_H_ */
@@ -216,30 +216,40 @@ static void virt_vbt_generation(struct vbt *v)
 /**
  * intel_vgpu_init_opregion - initialize the stuff used to emulate opregion
  * @vgpu: a vGPU
- * @gpa: guest physical address of opregion
  *
  * Returns:
  * Zero on success, negative error code if failed.
  */
 int intel_vgpu_init_opregion(struct intel_vgpu *vgpu)
 {
-	u8 *buf;
-	struct opregion_header *header;
-	struct vbt v;
-	const char opregion_signature[16] = OPREGION_SIGNATURE;
-
 	gvt_dbg_core("init vgpu%d opregion\n", vgpu->id);
-	vgpu_opregion(vgpu)->va = (void *)__get_free_pages(GFP_KERNEL |
-			__GFP_ZERO,
+	vgpu_opregion(vgpu)->va = (void *)__get_free_pages(GFP_KERNEL,
 			get_order(INTEL_GVT_OPREGION_SIZE));
 	if (!vgpu_opregion(vgpu)->va) {
 		gvt_err("fail to get memory for vgpu virt opregion\n");
 		return -ENOMEM;
 	}
 
+	memcpy(vgpu_opregion(vgpu)->va, vgpu->gvt->vgpu_template.opregion,
+	       INTEL_GVT_OPREGION_SIZE);
+	return 0;
+}
+
+/**
+ * intel_gvt_setup_opregion_template - prepare the opregion of a fresh vGPU
+ * @buf: zeroed buffer of INTEL_GVT_OPREGION_SIZE
+ *
+ * This function builds the emulated opregion image which is copied into
+ * every new vGPU.
+ *
+ */
+void intel_gvt_setup_opregion_template(void *buf)
+{
+	struct opregion_header *header = buf;
+	struct vbt v;
+	const char opregion_signature[16] = OPREGION_SIGNATURE;
+
 	/* emulated opregion with VBT mailbox only */
-	buf = (u8 *)vgpu_opregion(vgpu)->va;
-	header = (struct opregion_header *)buf;
 	memcpy(header->signature, opregion_signature,
 	       sizeof(opregion_signature));
 	header->size = 0x8;
@@ -250,13 +260,11 @@ int intel_vgpu_init_opregion(struct intel_vgpu *vgpu)
 	 * which block the windows guest, so workaround it by force
 	 * setting it to "OPEN"
 	 */
-	buf[INTEL_GVT_OPREGION_CLID] = 0x3;
+	((u8 *)buf)[INTEL_GVT_OPREGION_CLID] = 0x3;
 
 	/* emulated vbt from virt vbt generation */
 	virt_vbt_generation(&v);
 	memcpy(buf + INTEL_GVT_OPREGION_VBT_OFFSET, &v, sizeof(struct vbt));
-
-	return 0;
 }
 
 static int map_vgpu_opregion(struct intel_vgpu *vgpu, bool map)
@@ -28,6 +28,9 @@
  * @vgpu: a vGPU
  * @gfn: the gfn of guest page
  *
+ * The caller either holds vgpu_lock or is in an RCU read side section, in
+ * which case the record must not be used past it without a reference.
+ *
  * Returns:
  * A pointer to struct intel_vgpu_page_track if found, else NULL returned.
  */
@@ -61,6 +64,7 @@ int intel_vgpu_register_page_track(struct intel_vgpu *vgpu, unsigned long gfn,
 
 	track->handler = handler;
 	track->priv_data = priv;
+	kref_init(&track->ref);
 
 	ret = radix_tree_insert(&vgpu->page_track_tree, gfn, track);
 	if (ret) {
@@ -71,6 +75,14 @@ int intel_vgpu_register_page_track(struct intel_vgpu *vgpu, unsigned long gfn,
 	return 0;
 }
 
+static void page_track_release(struct kref *ref)
+{
+	struct intel_vgpu_page_track *track =
+		container_of(ref, struct intel_vgpu_page_track, ref);
+
+	kfree_rcu(track, rcu);
+}
+
 /**
  * intel_vgpu_unregister_page_track - unregister the tracked guest page
  * @vgpu: a vGPU
@@ -86,7 +98,7 @@ void intel_vgpu_unregister_page_track(struct intel_vgpu *vgpu,
 	if (track) {
 		if (track->tracked)
 			intel_gvt_hypervisor_disable_page_track(vgpu, gfn);
-		kfree(track);
+		kref_put(&track->ref, page_track_release);
 	}
 }
 
@@ -117,6 +129,53 @@ int intel_vgpu_enable_page_track(struct intel_vgpu *vgpu, unsigned long gfn)
 	return 0;
 }
 
+/**
+ * intel_vgpu_enable_page_tracks - set write-protection on a batch of pages
+ * @vgpu: a vGPU
+ * @gfns: the gfns of guest pages, overwritten
+ * @count: number of entries in @gfns
+ *
+ * This is the batched intel_vgpu_enable_page_track(), which lets the
+ * hypervisor protect all the pages at once. On failure, none of the pages
+ * that weren't tracked before is left protected.
+ *
+ * Returns:
+ * zero on success, negative error code if failed.
+ */
+int intel_vgpu_enable_page_tracks(struct intel_vgpu *vgpu, unsigned long *gfns,
+		unsigned int count)
+{
+	struct intel_vgpu_page_track *track;
+	unsigned int i, n = 0;
+	int ret;
+
+	for (i = 0; i < count; i++) {
+		track = intel_vgpu_find_page_track(vgpu, gfns[i]);
+		if (!track)
+			return -ENXIO;
+		if (!track->tracked)
+			gfns[n++] = gfns[i];
+	}
+
+	if (!n)
+		return 0;
+
+	ret = intel_gvt_hypervisor_enable_page_tracks(vgpu, gfns, n);
+	if (ret) {
+		/*
+		 * Some of the pages may be protected already, unprotect them
+		 * again so that none is left protected but untracked.
+		 */
+		for (i = 0; i < n; i++)
+			intel_gvt_hypervisor_disable_page_track(vgpu, gfns[i]);
+		return ret;
+	}
+
+	for (i = 0; i < n; i++)
+		intel_vgpu_find_page_track(vgpu, gfns[i])->tracked = true;
+	return 0;
+}
+
 /**
  * intel_vgpu_enable_page_track - cancel write-protection on guest page
  * @vgpu: a vGPU
@@ -151,20 +210,31 @@ int intel_vgpu_disable_page_track(struct intel_vgpu *vgpu, unsigned long gfn)
  * @data: the writed data
  * @bytes: the length of this write
  *
+ * The record is looked up locklessly, so that writes racing with the
+ * removal of the page track don't have to wait for vgpu_lock.
+ *
  * Returns:
  * zero on success, negative error code if failed.
  */
 int intel_vgpu_page_track_handler(struct intel_vgpu *vgpu, u64 gpa,
 		void *data, unsigned int bytes)
 {
-	struct intel_gvt *gvt = vgpu->gvt;
 	struct intel_vgpu_page_track *page_track;
 	int ret = 0;
 
-	mutex_lock(&gvt->lock);
-
+	rcu_read_lock();
 	page_track = intel_vgpu_find_page_track(vgpu, gpa >> PAGE_SHIFT);
-	if (!page_track) {
+	if (page_track && !kref_get_unless_zero(&page_track->ref))
+		page_track = NULL;
+	rcu_read_unlock();
+
+	if (!page_track)
+		return -ENXIO;
+
+	mutex_lock(&vgpu->vgpu_lock);
+
+	/* Unregistered while we were waiting for the lock. */
+	if (intel_vgpu_find_page_track(vgpu, gpa >> PAGE_SHIFT) != page_track) {
 		ret = -ENXIO;
 		goto out;
 	}
@@ -179,6 +249,7 @@ int intel_vgpu_page_track_handler(struct intel_vgpu *vgpu, u64 gpa,
 	}
 
 out:
-	mutex_unlock(&gvt->lock);
+	mutex_unlock(&vgpu->vgpu_lock);
+	kref_put(&page_track->ref, page_track_release);
 	return ret;
 }
@@ -31,11 +31,17 @@ typedef int (*gvt_page_track_handler_t)(
 			struct intel_vgpu_page_track *page_track,
 			u64 gpa, void *data, int bytes);
 
-/* Track record for a write-protected guest page. */
+/*
+ * Track record for a write-protected guest page. The record is added and
+ * removed under vgpu_lock, but may be looked up under RCU. The write trap
+ * path holds a reference while it waits for vgpu_lock.
+ */
 struct intel_vgpu_page_track {
 	gvt_page_track_handler_t handler;
 	bool tracked;
 	void *priv_data;
+	struct kref ref;
+	struct rcu_head rcu;
 };
 
 struct intel_vgpu_page_track *intel_vgpu_find_page_track(
@@ -48,6 +54,8 @@ void intel_vgpu_unregister_page_track(struct intel_vgpu *vgpu,
 		unsigned long gfn);
 
 int intel_vgpu_enable_page_track(struct intel_vgpu *vgpu, unsigned long gfn);
+int intel_vgpu_enable_page_tracks(struct intel_vgpu *vgpu, unsigned long *gfns,
+		unsigned int count);
 int intel_vgpu_disable_page_track(struct intel_vgpu *vgpu, unsigned long gfn);
 
 int intel_vgpu_page_track_handler(struct intel_vgpu *vgpu, u64 gpa,
@@ -0,0 +1,404 @@
+/*
+ * Copyright(c) 2011-2017 Intel Corporation. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <linux/cpuhotplug.h>
+#include <linux/perf_event.h>
+#include "i915_drv.h"
+#include "gvt.h"
+
+/*
+ * GVT exports its per-vGPU counters through a software PMU named
+ * "i915_gvt". An event is selected by its id in config:0-7 and the vGPU
+ * it counts by the vGPU id in config:8-15, e.g.
+ *
+ *	perf stat -a -e i915_gvt/busy,vgpu=1/
+ *
+ * The per-engine events take the engine id in config:16-23, e.g.
+ *
+ *	perf stat -a -e i915_gvt/engine-busy,vgpu=1,engine=0/
+ *
+ * The counters are device wide, so the events are opened on a single CPU
+ * only, like the ones of the i915 PMU, and move to another CPU when that
+ * one goes offline. All of them are updated as the
+ * vGPU's contexts are scheduled in and out and only read when perf asks,
+ * so unlike the sampled counters of the i915 PMU they need no timer,
+ * however many vGPUs are monitored.
+ */
+#define GVT_PMU_EVENT(config)	((config) & 0xff)
+#define GVT_PMU_VGPU(config)	(((config) >> 8) & 0xff)
+#define GVT_PMU_ENGINE(config)	(((config) >> 16) & 0xff)
+
+/* the CPU the events are read on */
+static cpumask_t gvt_pmu_cpumask;
+
+enum {
+	GVT_PMU_BUSY = 0,
+	GVT_PMU_TIMESLICE,
+	GVT_PMU_PREEMPT,
+	GVT_PMU_MMIO_EXIT,
+	GVT_PMU_ENGINE_BUSY,
+	GVT_PMU_MAX,
+};
+
+static u64 vgpu_stat_read(struct intel_vgpu *vgpu, enum intel_vgpu_stat stat)
+{
+	u64 val = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		val += per_cpu_ptr(vgpu->stats, cpu)->counter[stat];
+	return val;
+}
+
+static u64 gvt_pmu_sample(struct intel_gvt *gvt, u64 config)
+{
+	struct intel_vgpu *vgpu;
+	unsigned long flags;
+	u64 val = 0;
+
+	spin_lock_irqsave(&gvt->pmu.lock, flags);
+	vgpu = gvt->pmu.vgpu[GVT_PMU_VGPU(config)];
+	if (!vgpu)
+		goto out;
+
+	switch (GVT_PMU_EVENT(config)) {
+	case GVT_PMU_BUSY:
+		val = vgpu_stat_read(vgpu, INTEL_VGPU_STAT_BUSY_NS);
+		break;
+	case GVT_PMU_TIMESLICE:
+		val = vgpu_stat_read(vgpu, INTEL_VGPU_STAT_TIMESLICE_NS);
+		break;
+	case GVT_PMU_PREEMPT:
+		val = vgpu_stat_read(vgpu, INTEL_VGPU_STAT_PREEMPT);
+		break;
+	case GVT_PMU_MMIO_EXIT:
+		val = vgpu_stat_read(vgpu, INTEL_VGPU_STAT_MMIO_READ) +
+		      vgpu_stat_read(vgpu, INTEL_VGPU_STAT_MMIO_WRITE);
+		break;
+	case GVT_PMU_ENGINE_BUSY:
+		val = atomic64_read(
+			&vgpu->engine_busy_ns[GVT_PMU_ENGINE(config)]);
+		break;
+	}
+out:
+	spin_unlock_irqrestore(&gvt->pmu.lock, flags);
+	return val;
+}
+
+static int gvt_pmu_event_init(struct perf_event *event)
+{
+	struct intel_gvt *gvt = container_of(event->pmu, struct intel_gvt,
+					     pmu.base);
+	u64 config = event->attr.config;
+
+	if (event->attr.type != event->pmu->type)
+		return -ENOENT;
+
+	/* no sampling */
+	if (event->attr.sample_period)
+		return -EINVAL;
+
+	if (has_branch_stack(event))
+		return -EOPNOTSUPP;
+
+	if (event->cpu < 0)
+		return -EINVAL;
+
+	if (!cpumask_test_cpu(event->cpu, &gvt_pmu_cpumask))
+		return -EINVAL;
+
+	if (GVT_PMU_EVENT(config) >= GVT_PMU_MAX ||
+	    GVT_PMU_VGPU(config) >= GVT_MAX_VGPU)
+		return -ENOENT;
+
+	if (GVT_PMU_EVENT(config) == GVT_PMU_ENGINE_BUSY &&
+	    (GVT_PMU_ENGINE(config) >= I915_NUM_ENGINES ||
+	     !gvt->dev_priv->engine[GVT_PMU_ENGINE(config)]))
+		return -ENOENT;
+
+	return 0;
+}
+
+static void gvt_pmu_event_read(struct perf_event *event)
+{
+	struct intel_gvt *gvt = container_of(event->pmu, struct intel_gvt,
+					     pmu.base);
+	struct hw_perf_event *hwc = &event->hw;
+	u64 prev, new;
+
+again:
+	prev = local64_read(&hwc->prev_count);
+	new = gvt_pmu_sample(gvt, event->attr.config);
+
+	if (local64_cmpxchg(&hwc->prev_count, prev, new) != prev)
+		goto again;
+
+	/* the counters restart from zero when a vGPU id gets reused */
+	local64_add(new >= prev ? new - prev : new, &event->count);
+}
+
+static void gvt_pmu_event_start(struct perf_event *event, int flags)
+{
+	struct intel_gvt *gvt = container_of(event->pmu, struct intel_gvt,
+					     pmu.base);
+
+	local64_set(&event->hw.prev_count,
+		    gvt_pmu_sample(gvt, event->attr.config));
+	event->hw.state = 0;
+}
+
+static void gvt_pmu_event_stop(struct perf_event *event, int flags)
+{
+	if (flags & PERF_EF_UPDATE)
+		gvt_pmu_event_read(event);
+	event->hw.state = PERF_HES_STOPPED;
+}
+
+static int gvt_pmu_event_add(struct perf_event *event, int flags)
+{
+	if (flags & PERF_EF_START)
+		gvt_pmu_event_start(event, flags);
+
+	return 0;
+}
+
+static void gvt_pmu_event_del(struct perf_event *event, int flags)
+{
+	gvt_pmu_event_stop(event, PERF_EF_UPDATE);
+}
+
+static int gvt_pmu_event_idx(struct perf_event *event)
+{
+	return 0;
+}
+
+PMU_FORMAT_ATTR(event, "config:0-7");
+PMU_FORMAT_ATTR(vgpu, "config:8-15");
+PMU_FORMAT_ATTR(engine, "config:16-23");
+
+static struct attribute *gvt_pmu_format_attrs[] = {
+	&format_attr_event.attr,
+	&format_attr_vgpu.attr,
+	&format_attr_engine.attr,
+	NULL,
+};
+
+static const struct attribute_group gvt_pmu_format_attr_group = {
+	.name = "format",
+	.attrs = gvt_pmu_format_attrs,
+};
+
+PMU_EVENT_ATTR_STRING(busy, gvt_pmu_busy, "event=0x00");
+PMU_EVENT_ATTR_STRING(busy.unit, gvt_pmu_busy_unit, "ns");
+PMU_EVENT_ATTR_STRING(timeslice, gvt_pmu_timeslice, "event=0x01");
+PMU_EVENT_ATTR_STRING(timeslice.unit, gvt_pmu_timeslice_unit, "ns");
+PMU_EVENT_ATTR_STRING(preempt, gvt_pmu_preempt, "event=0x02");
+PMU_EVENT_ATTR_STRING(mmio_exit, gvt_pmu_mmio_exit, "event=0x03");
+PMU_EVENT_ATTR_STRING(engine-busy, gvt_pmu_engine_busy, "event=0x04");
+PMU_EVENT_ATTR_STRING(engine-busy.unit, gvt_pmu_engine_busy_unit, "ns");
+
+static struct attribute *gvt_pmu_events_attrs[] = {
+	&gvt_pmu_busy.attr.attr,
+	&gvt_pmu_busy_unit.attr.attr,
+	&gvt_pmu_timeslice.attr.attr,
+	&gvt_pmu_timeslice_unit.attr.attr,
+	&gvt_pmu_preempt.attr.attr,
+	&gvt_pmu_mmio_exit.attr.attr,
+	&gvt_pmu_engine_busy.attr.attr,
+	&gvt_pmu_engine_busy_unit.attr.attr,
+	NULL,
+};
+
+static const struct attribute_group gvt_pmu_events_attr_group = {
+	.name = "events",
+	.attrs = gvt_pmu_events_attrs,
+};
+
+static ssize_t gvt_pmu_cpumask_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	return cpumap_print_to_pagebuf(true, buf, &gvt_pmu_cpumask);
+}
+
+static struct device_attribute gvt_pmu_cpumask_attr =
+	__ATTR(cpumask, 0444, gvt_pmu_cpumask_show, NULL);
+
+static struct attribute *gvt_pmu_cpumask_attrs[] = {
+	&gvt_pmu_cpumask_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group gvt_pmu_cpumask_attr_group = {
+	.attrs = gvt_pmu_cpumask_attrs,
+};
+
+static const struct attribute_group *gvt_pmu_attr_groups[] = {
+	&gvt_pmu_format_attr_group,
+	&gvt_pmu_events_attr_group,
+	&gvt_pmu_cpumask_attr_group,
+	NULL,
+};
+
+/**
+ * intel_gvt_pmu_add_vgpu - start exporting the counters of a vGPU
+ * @vgpu: a vGPU
+ */
+void intel_gvt_pmu_add_vgpu(struct intel_vgpu *vgpu)
+{
+	struct intel_gvt *gvt = vgpu->gvt;
+	unsigned long flags;
+
+	spin_lock_irqsave(&gvt->pmu.lock, flags);
+	gvt->pmu.vgpu[vgpu->id] = vgpu;
+	spin_unlock_irqrestore(&gvt->pmu.lock, flags);
+}
+
+/**
+ * intel_gvt_pmu_remove_vgpu - stop exporting the counters of a vGPU
+ * @vgpu: a vGPU
+ *
+ * Must be called before the counters of the vGPU are freed.
+ */
+void intel_gvt_pmu_remove_vgpu(struct intel_vgpu *vgpu)
+{
+	struct intel_gvt *gvt = vgpu->gvt;
+	unsigned long flags;
+
+	spin_lock_irqsave(&gvt->pmu.lock, flags);
+	gvt->pmu.vgpu[vgpu->id] = NULL;
+	spin_unlock_irqrestore(&gvt->pmu.lock, flags);
+}
+
+static int gvt_pmu_cpu_online(unsigned int cpu, struct hlist_node *node)
+{
+	/* the first online CPU reads the events */
+	if (!cpumask_weight(&gvt_pmu_cpumask))
+		cpumask_set_cpu(cpu, &gvt_pmu_cpumask);
+
+	return 0;
+}
+
+static int gvt_pmu_cpu_offline(unsigned int cpu, struct hlist_node *node)
+{
+	struct intel_gvt *gvt = hlist_entry_safe(node, typeof(*gvt), pmu.node);
+	unsigned int target;
+
+	if (cpumask_test_and_clear_cpu(cpu, &gvt_pmu_cpumask)) {
+		target = cpumask_any_but(cpu_online_mask, cpu);
+		if (target < nr_cpu_ids) {
+			cpumask_set_cpu(target, &gvt_pmu_cpumask);
+			perf_pmu_migrate_context(&gvt->pmu.base, cpu, target);
+		}
+	}
+
+	return 0;
+}
+
+static enum cpuhp_state cpuhp_slot = CPUHP_INVALID;
+
+static int gvt_pmu_register_cpuhp_state(struct intel_gvt *gvt)
+{
+	enum cpuhp_state slot;
+	int ret;
+
+	ret = cpuhp_setup_state_multi(CPUHP_AP_ONLINE_DYN,
+				      "perf/x86/intel/i915_gvt:online",
+				      gvt_pmu_cpu_online,
+				      gvt_pmu_cpu_offline);
+	if (ret < 0)
+		return ret;
+
+	slot = ret;
+	ret = cpuhp_state_add_instance(slot, &gvt->pmu.node);
+	if (ret) {
+		cpuhp_remove_multi_state(slot);
+		return ret;
+	}
+
+	cpuhp_slot = slot;
+	return 0;
+}
+
+static void gvt_pmu_unregister_cpuhp_state(struct intel_gvt *gvt)
+{
+	WARN_ON(cpuhp_slot == CPUHP_INVALID);
+	WARN_ON(cpuhp_state_remove_instance(cpuhp_slot, &gvt->pmu.node));
+	cpuhp_remove_multi_state(cpuhp_slot);
+	cpuhp_slot = CPUHP_INVALID;
+}
+
+/**
+ * intel_gvt_pmu_init - register the GVT PMU
+ * @gvt: GVT device
+ *
+ * A failure is not fatal, GVT just goes on without the PMU.
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+int intel_gvt_pmu_init(struct intel_gvt *gvt)
+{
+	int ret;
+
+	spin_lock_init(&gvt->pmu.lock);
+
+	gvt->pmu.base.attr_groups	= gvt_pmu_attr_groups;
+	gvt->pmu.base.task_ctx_nr	= perf_invalid_context;
+	gvt->pmu.base.event_init	= gvt_pmu_event_init;
+	gvt->pmu.base.add		= gvt_pmu_event_add;
+	gvt->pmu.base.del		= gvt_pmu_event_del;
+	gvt->pmu.base.start		= gvt_pmu_event_start;
+	gvt->pmu.base.stop		= gvt_pmu_event_stop;
+	gvt->pmu.base.read		= gvt_pmu_event_read;
+	gvt->pmu.base.event_idx		= gvt_pmu_event_idx;
+
+	ret = perf_pmu_register(&gvt->pmu.base, "i915_gvt", -1);
+	if (ret)
+		goto err;
+
+	ret = gvt_pmu_register_cpuhp_state(gvt);
+	if (ret)
+		goto err_unreg;
+
+	return 0;
+
+err_unreg:
+	perf_pmu_unregister(&gvt->pmu.base);
+err:
+	gvt->pmu.base.event_init = NULL;
+	return ret;
+}
+
+/**
+ * intel_gvt_pmu_clean - unregister the GVT PMU
+ * @gvt: GVT device
+ */
+void intel_gvt_pmu_clean(struct intel_gvt *gvt)
+{
+	if (!gvt->pmu.base.event_init)
+		return;
+
+	gvt_pmu_unregister_cpuhp_state(gvt);
+
+	perf_pmu_unregister(&gvt->pmu.base);
+	gvt->pmu.base.event_init = NULL;
+}
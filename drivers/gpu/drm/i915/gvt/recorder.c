@@ -0,0 +1,257 @@
+/*
+ * Copyright(c) 2011-2017 Intel Corporation. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <linux/debugfs.h>
+#include <linux/sort.h>
+#include "i915_drv.h"
+#include "gvt.h"
+
+/*
+ * The flight recorder keeps the last events of all vGPUs in a ring of
+ * compact binary records per CPU. Recording an event is a couple of
+ * stores into the ring of the local CPU, so unlike the tracepoints it is
+ * always on. The rings are only decoded when they are dumped, through
+ * the "flight_recorder" debugfs file or when a vGPU enters failsafe mode.
+ *
+ * Writers don't synchronize with a dump, a record being overwritten while
+ * it is dumped may show up torn.
+ */
+#define GVT_REC_MASK		(INTEL_GVT_REC_ENTRIES - 1)
+/* records of the failing vGPU printed when it enters failsafe mode */
+#define GVT_REC_FAILSAFE_DUMP	32
+
+static const char * const rec_names[INTEL_GVT_REC_MAX] = {
+	[INTEL_GVT_REC_MMIO_READ] = "mmio_read",
+	[INTEL_GVT_REC_MMIO_WRITE] = "mmio_write",
+	[INTEL_GVT_REC_WP_FAULT] = "wp_fault",
+	[INTEL_GVT_REC_INJECT_MSI] = "inject_msi",
+	[INTEL_GVT_REC_DISPATCH] = "dispatch",
+	[INTEL_GVT_REC_COMPLETE] = "complete",
+	[INTEL_GVT_REC_FAILSAFE] = "failsafe",
+	[INTEL_GVT_REC_HANG] = "hang",
+};
+
+/**
+ * intel_gvt_record - record an event in the flight recorder
+ * @vgpu: a vGPU
+ * @type: event type
+ * @data: MMIO offset, gfn, ring id or reason, depending on @type
+ * @val: value of the event, e.g. the MMIO data
+ * @start: ktime_get_ns() at the start of the event, 0 if it has no duration
+ */
+void intel_gvt_record(struct intel_vgpu *vgpu, enum intel_gvt_rec_type type,
+		      u32 data, u32 val, u64 start)
+{
+	struct intel_gvt_rec_ring __percpu *rings = vgpu->gvt->recorder;
+	struct intel_gvt_rec *rec;
+	u64 now = ktime_get_ns();
+	unsigned int idx;
+
+	if (!rings)
+		return;
+
+	preempt_disable();
+	/* the increment is irq safe, a nested event takes the next slot */
+	idx = this_cpu_inc_return(rings->head) - 1;
+	rec = &this_cpu_ptr(rings)->rec[idx & GVT_REC_MASK];
+	rec->ts = now;
+	rec->data = data;
+	rec->val = val;
+	rec->latency = start ? min_t(u64, now - start, U32_MAX) : 0;
+	rec->vgpu_id = vgpu->id;
+	rec->type = type;
+	preempt_enable();
+}
+
+static void rec_print(struct seq_file *s, const struct intel_gvt_rec *rec)
+{
+	const char *name = rec->type < INTEL_GVT_REC_MAX ?
+		rec_names[rec->type] : "?";
+
+	if (s)
+		seq_printf(s, "%llu %u %s %08x %08x %u\n", rec->ts,
+			   rec->vgpu_id, name, rec->data, rec->val,
+			   rec->latency);
+	else
+		pr_err("  %llu %s %08x %08x %uns\n", rec->ts, name,
+		       rec->data, rec->val, rec->latency);
+}
+
+static int rec_cmp(const void *a, const void *b)
+{
+	const struct intel_gvt_rec *ra = a, *rb = b;
+
+	if (ra->ts == rb->ts)
+		return 0;
+	return ra->ts < rb->ts ? -1 : 1;
+}
+
+/* Show the records of all the CPUs, oldest first. */
+static int gvt_recorder_show(struct seq_file *s, void *unused)
+{
+	struct intel_gvt *gvt = s->private;
+	struct intel_gvt_rec *recs;
+	unsigned int n = 0, i;
+	int cpu;
+
+	recs = vmalloc(num_possible_cpus() * INTEL_GVT_REC_ENTRIES *
+		       sizeof(*recs));
+	if (!recs)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		const struct intel_gvt_rec_ring *ring =
+			per_cpu_ptr(gvt->recorder, cpu);
+
+		for (i = 0; i < INTEL_GVT_REC_ENTRIES; i++) {
+			if (READ_ONCE(ring->rec[i].ts))
+				recs[n++] = ring->rec[i];
+		}
+	}
+
+	sort(recs, n, sizeof(*recs), rec_cmp, NULL);
+
+	seq_puts(s, "ts vgpu event data val latency\n");
+	for (i = 0; i < n; i++)
+		rec_print(s, &recs[i]);
+
+	vfree(recs);
+	return 0;
+}
+
+static int gvt_recorder_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, gvt_recorder_show, inode->i_private);
+}
+
+static const struct file_operations gvt_recorder_fops = {
+	.open		= gvt_recorder_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/**
+ * intel_gvt_recorder_dump_vgpu - print the last events of a vGPU
+ * @vgpu: a vGPU
+ *
+ * This is called when @vgpu enters failsafe mode, to leave the events
+ * that led there in the kernel log.
+ */
+void intel_gvt_recorder_dump_vgpu(struct intel_vgpu *vgpu)
+{
+	struct intel_gvt_rec recs[GVT_REC_FAILSAFE_DUMP];
+	unsigned int n = 0, oldest = 0, i, j;
+	int cpu;
+
+	if (!vgpu->gvt->recorder)
+		return;
+
+	/* keep the newest records of the vGPU, in no particular order */
+	for_each_possible_cpu(cpu) {
+		const struct intel_gvt_rec_ring *ring =
+			per_cpu_ptr(vgpu->gvt->recorder, cpu);
+
+		for (i = 0; i < INTEL_GVT_REC_ENTRIES; i++) {
+			const struct intel_gvt_rec *rec = &ring->rec[i];
+
+			if (!rec->ts || rec->vgpu_id != vgpu->id)
+				continue;
+
+			if (n < GVT_REC_FAILSAFE_DUMP) {
+				recs[n++] = *rec;
+			} else if (rec->ts > recs[oldest].ts) {
+				recs[oldest] = *rec;
+			} else {
+				continue;
+			}
+
+			for (j = 0; j < n; j++) {
+				if (recs[j].ts < recs[oldest].ts)
+					oldest = j;
+			}
+		}
+	}
+
+	sort(recs, n, sizeof(*recs), rec_cmp, NULL);
+
+	pr_err("last %u events of vgpu %d:\n", n, vgpu->id);
+	for (i = 0; i < n; i++)
+		rec_print(NULL, &recs[i]);
+}
+
+/**
+ * intel_gvt_recorder_init - set up the flight recorder
+ * @gvt: GVT device
+ *
+ * Returns:
+ * zero on success, negative error code if failed.
+ */
+int intel_gvt_recorder_init(struct intel_gvt *gvt)
+{
+	struct intel_gvt_rec_ring __percpu *rings;
+	int cpu;
+
+	rings = alloc_percpu(struct intel_gvt_rec_ring);
+	if (!rings)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct intel_gvt_rec_ring *ring = per_cpu_ptr(rings, cpu);
+
+		ring->rec = vzalloc_node(INTEL_GVT_REC_ENTRIES *
+					 sizeof(*ring->rec), cpu_to_node(cpu));
+		if (!ring->rec)
+			goto err;
+	}
+
+	gvt->recorder = rings;
+
+	if (gvt->debugfs_root &&
+	    !debugfs_create_file("flight_recorder", 0444, gvt->debugfs_root,
+				 gvt, &gvt_recorder_fops))
+		gvt_err("failed to create flight recorder debugfs file\n");
+	return 0;
+
+err:
+	for_each_possible_cpu(cpu)
+		vfree(per_cpu_ptr(rings, cpu)->rec);
+	free_percpu(rings);
+	return -ENOMEM;
+}
+
+/**
+ * intel_gvt_recorder_clean - tear down the flight recorder
+ * @gvt: GVT device
+ */
+void intel_gvt_recorder_clean(struct intel_gvt *gvt)
+{
+	int cpu;
+
+	if (!gvt->recorder)
+		return;
+
+	for_each_possible_cpu(cpu)
+		vfree(per_cpu_ptr(gvt->recorder, cpu)->rec);
+	free_percpu(gvt->recorder);
+	gvt->recorder = NULL;
+}
@@ -52,12 +52,19 @@ struct vgpu_sched_data {
 	struct intel_vgpu *vgpu;
 	bool active;
 
-	ktime_t sched_in_time;
-	ktime_t sched_out_time;
-	ktime_t sched_time;
-	ktime_t left_ts;
+	/* Time slices are accounted per engine. */
+	ktime_t sched_in_time[I915_NUM_ENGINES];
+	ktime_t sched_out_time[I915_NUM_ENGINES];
+	ktime_t sched_time[I915_NUM_ENGINES];
+	/* vgpu->engine_busy_ns when the vGPU was scheduled in */
+	u64 sched_in_busy[I915_NUM_ENGINES];
+	ktime_t left_ts[I915_NUM_ENGINES];
 	ktime_t allocated_ts;
 
+	/* Deadline reservation, only used by the eds policy. */
+	ktime_t deadline;
+	ktime_t dl_left[I915_NUM_ENGINES];
+
 	struct vgpu_sched_ctl sched_ctl;
 };
 
@@ -66,17 +73,39 @@ struct gvt_sched_data {
 	struct hrtimer timer;
 	unsigned long period;
 	struct list_head lru_runq_head;
+	/* Fires on the next budget or deadline event of the eds policy. */
+	struct hrtimer dl_timer;
 };
 
-static void vgpu_update_timeslice(struct intel_vgpu *pre_vgpu)
+/* GPU time the vGPU's contexts ran for on ring_id since it was scheduled in */
+static ktime_t vgpu_busy_since_sched_in(struct vgpu_sched_data *vgpu_data,
+					int ring_id)
+{
+	struct intel_vgpu *vgpu = vgpu_data->vgpu;
+
+	return ns_to_ktime(atomic64_read(&vgpu->engine_busy_ns[ring_id]) -
+			   vgpu_data->sched_in_busy[ring_id]);
+}
+
+/*
+ * The vGPU owned the ring for delta_ts, but it is only charged for the
+ * time its contexts actually ran, so the pipeline drain and the idle
+ * gaps of the ownership period don't count against its time slice.
+ */
+static void vgpu_update_timeslice(struct intel_vgpu *pre_vgpu, int ring_id)
 {
-	ktime_t delta_ts;
+	ktime_t delta_ts, busy_ts;
 	struct vgpu_sched_data *vgpu_data = pre_vgpu->sched_data;
 
-	delta_ts = vgpu_data->sched_out_time - vgpu_data->sched_in_time;
+	delta_ts = vgpu_data->sched_out_time[ring_id] -
+		   vgpu_data->sched_in_time[ring_id];
+	busy_ts = vgpu_busy_since_sched_in(vgpu_data, ring_id);
 
-	vgpu_data->sched_time += delta_ts;
-	vgpu_data->left_ts -= delta_ts;
+	vgpu_data->sched_time[ring_id] += busy_ts;
+	vgpu_data->left_ts[ring_id] -= busy_ts;
+	vgpu_data->dl_left[ring_id] -= busy_ts;
+	intel_vgpu_stat_add(pre_vgpu, INTEL_VGPU_STAT_TIMESLICE_NS,
+			    ktime_to_ns(delta_ts));
 }
 
 #define GVT_TS_BALANCE_PERIOD_MS 100
@@ -88,6 +117,7 @@ static void gvt_balance_timeslice(struct gvt_sched_data *sched_data)
 	struct list_head *pos;
 	static uint64_t stage_check;
 	int stage = stage_check++ % GVT_TS_BALANCE_STAGE_NUM;
+	int i;
 
 	/* The timeslice accumulation reset at stage 0, which is
 	 * allocated again without adding previous debt.
@@ -107,7 +137,8 @@ static void gvt_balance_timeslice(struct gvt_sched_data *sched_data)
 						     total_weight) * vgpu_data->sched_ctl.weight;
 
 			vgpu_data->allocated_ts = fair_timeslice;
-			vgpu_data->left_ts = vgpu_data->allocated_ts;
+			for (i = 0; i < I915_NUM_ENGINES; i++)
+				vgpu_data->left_ts[i] = vgpu_data->allocated_ts;
 		}
 	} else {
 		list_for_each(pos, &sched_data->lru_runq_head) {
@@ -116,60 +147,94 @@ static void gvt_balance_timeslice(struct gvt_sched_data *sched_data)
 			/* timeslice for next 100ms should add the left/debt
 			 * slice of previous stages.
 			 */
-			vgpu_data->left_ts += vgpu_data->allocated_ts;
+			for (i = 0; i < I915_NUM_ENGINES; i++)
+				vgpu_data->left_ts[i] += vgpu_data->allocated_ts;
 		}
 	}
 }
 
-static void try_to_schedule_next_vgpu(struct intel_gvt *gvt)
+/*
+ * Switch the engines of ring_mask to their next vGPU. Engines the current
+ * vGPU has no workload on switch right away, the others once their current
+ * workload is done, so a whole GPU switch doesn't keep idle engines from
+ * serving the next vGPU while the busy ones drain.
+ */
+static void try_to_schedule_next_vgpu(struct intel_gvt *gvt,
+				      unsigned int ring_mask)
 {
 	struct intel_gvt_workload_scheduler *scheduler = &gvt->scheduler;
 	enum intel_engine_id i;
 	struct intel_engine_cs *engine;
 	struct vgpu_sched_data *vgpu_data;
+	unsigned int switch_mask = 0, tmp;
 	ktime_t cur_time;
 
 	/* no need to schedule if next_vgpu is the same with current_vgpu,
 	 * let scheduler chose next_vgpu again by setting it to NULL.
 	 */
-	if (scheduler->next_vgpu == scheduler->current_vgpu) {
-		scheduler->next_vgpu = NULL;
-		return;
+	for_each_engine(engine, gvt->dev_priv, i) {
+		if (!(ring_mask & BIT(i)) || !scheduler->next_vgpu[i])
+			continue;
+
+		if (scheduler->next_vgpu[i] == scheduler->current_vgpu[i]) {
+			scheduler->next_vgpu[i] = NULL;
+			continue;
+		}
+		switch_mask |= BIT(i);
 	}
 
+	if (!switch_mask)
+		return;
+
 	/*
 	 * after the flag is set, workload dispatch thread will
 	 * stop dispatching workload for current vgpu
 	 */
-	scheduler->need_reschedule = true;
+	for_each_engine_masked(engine, gvt->dev_priv, switch_mask, tmp)
+		scheduler->need_reschedule[engine->id] = true;
 
-	/* still have uncompleted workload? */
-	for_each_engine(engine, gvt->dev_priv, i) {
-		if (scheduler->current_workload[i])
-			return;
+	/* engines with uncompleted workload switch when it completes */
+	for_each_engine_masked(engine, gvt->dev_priv, switch_mask, tmp) {
+		if (scheduler->current_workload[engine->id])
+			switch_mask &= ~BIT(engine->id);
 	}
 
+	if (!switch_mask)
+		return;
+
 	cur_time = ktime_get();
-	if (scheduler->current_vgpu) {
-		vgpu_data = scheduler->current_vgpu->sched_data;
-		vgpu_data->sched_out_time = cur_time;
-		vgpu_update_timeslice(scheduler->current_vgpu);
-	}
-	vgpu_data = scheduler->next_vgpu->sched_data;
-	vgpu_data->sched_in_time = cur_time;
+	for_each_engine_masked(engine, gvt->dev_priv, switch_mask, tmp) {
+		int ring_id = engine->id;
+
+		if (scheduler->current_vgpu[ring_id]) {
+			vgpu_data = scheduler->current_vgpu[ring_id]->sched_data;
+			vgpu_data->sched_out_time[ring_id] = cur_time;
+			vgpu_update_timeslice(scheduler->current_vgpu[ring_id],
+					      ring_id);
+		}
+		vgpu_data = scheduler->next_vgpu[ring_id]->sched_data;
+		vgpu_data->sched_in_time[ring_id] = cur_time;
+		vgpu_data->sched_in_busy[ring_id] = atomic64_read(
+			&scheduler->next_vgpu[ring_id]->engine_busy_ns[ring_id]);
 
-	/* switch current vgpu */
-	scheduler->current_vgpu = scheduler->next_vgpu;
-	scheduler->next_vgpu = NULL;
+		/* switch current vgpu */
+		scheduler->current_vgpu[ring_id] = scheduler->next_vgpu[ring_id];
+		scheduler->next_vgpu[ring_id] = NULL;
 
-	scheduler->need_reschedule = false;
+		scheduler->need_reschedule[ring_id] = false;
 
-	/* wake up workload dispatch thread */
-	for_each_engine(engine, gvt->dev_priv, i)
-		wake_up(&scheduler->waitq[i]);
+		/* wake up workload dispatch thread */
+		wake_up(&scheduler->waitq[ring_id]);
+	}
 }
 
-static struct intel_vgpu *find_busy_vgpu(struct gvt_sched_data *sched_data)
+/*
+ * Search a vGPU with pending workload on ring_id, or on any engine if
+ * ring_id is negative, only considering interactive vGPUs if
+ * interactive_only is set.
+ */
+static struct intel_vgpu *find_busy_vgpu(struct gvt_sched_data *sched_data,
+					 int ring_id, bool interactive_only)
 {
 	struct vgpu_sched_data *vgpu_data;
 	struct intel_vgpu *vgpu = NULL;
@@ -180,11 +245,21 @@ static struct intel_vgpu *find_busy_vgpu(struct gvt_sched_data *sched_data)
 	list_for_each(pos, head) {
 
 		vgpu_data = container_of(pos, struct vgpu_sched_data, lru_list);
-		if (!vgpu_has_pending_workload(vgpu_data->vgpu))
+		if (interactive_only && vgpu_data->sched_ctl.latency !=
+		    INTEL_VGPU_LATENCY_INTERACTIVE)
+			continue;
+
+		if (ring_id < 0 ?
+		    !vgpu_has_pending_workload(vgpu_data->vgpu) :
+		    list_empty(workload_q_head(vgpu_data->vgpu, ring_id)))
 			continue;
 
-		/* Return the vGPU only if it has time slice left */
-		if (vgpu_data->left_ts > 0) {
+		/*
+		 * Return the vGPU only if it has time slice left. All the
+		 * engines switch together for a whole GPU switch, so any of
+		 * them tells the time slice left.
+		 */
+		if (vgpu_data->left_ts[ring_id < 0 ? RCS : ring_id] > 0) {
 			vgpu = vgpu_data->vgpu;
 			break;
 		}
@@ -196,50 +271,240 @@ static struct intel_vgpu *find_busy_vgpu(struct gvt_sched_data *sched_data)
 /* in nanosecond */
 #define GVT_DEFAULT_TIME_SLICE 1000000
 
-static void tbs_sched_func(struct gvt_sched_data *sched_data)
+static struct intel_vgpu *tbs_pick_vgpu(struct gvt_sched_data *sched_data,
+					int ring_id)
+{
+	return find_busy_vgpu(sched_data, ring_id, false);
+}
+
+/*
+ * Interactive vGPUs go first as long as they have time slice left, batch
+ * vGPUs run in the remaining time. Weights still bound the share of each.
+ */
+static struct intel_vgpu *lcs_pick_vgpu(struct gvt_sched_data *sched_data,
+					int ring_id)
+{
+	struct intel_vgpu *vgpu;
+
+	vgpu = find_busy_vgpu(sched_data, ring_id, true);
+	if (!vgpu)
+		vgpu = find_busy_vgpu(sched_data, ring_id, false);
+
+	return vgpu;
+}
+
+/* Pick the next vGPU of ring_id, or of the whole GPU if it is negative. */
+static void tbs_sched_engines(struct gvt_sched_data *sched_data, int ring_id,
+		struct intel_vgpu *(*pick_vgpu)(struct gvt_sched_data *, int))
 {
 	struct intel_gvt *gvt = sched_data->gvt;
 	struct intel_gvt_workload_scheduler *scheduler = &gvt->scheduler;
+	unsigned int ring_mask = ring_id < 0 ? ALL_ENGINES : BIT(ring_id);
 	struct vgpu_sched_data *vgpu_data;
+	struct intel_engine_cs *engine;
 	struct intel_vgpu *vgpu = NULL;
+	unsigned int tmp;
+
 	/* no active vgpu or has already had a target */
-	if (list_empty(&sched_data->lru_runq_head) || scheduler->next_vgpu)
+	if (list_empty(&sched_data->lru_runq_head))
 		goto out;
 
-	vgpu = find_busy_vgpu(sched_data);
-	if (vgpu) {
-		scheduler->next_vgpu = vgpu;
+	for_each_engine_masked(engine, gvt->dev_priv, ring_mask, tmp) {
+		if (scheduler->next_vgpu[engine->id])
+			goto out;
+	}
 
+	vgpu = pick_vgpu(sched_data, ring_id);
+	if (vgpu) {
 		/* Move the last used vGPU to the tail of lru_list */
 		vgpu_data = vgpu->sched_data;
 		list_del_init(&vgpu_data->lru_list);
 		list_add_tail(&vgpu_data->lru_list,
 				&sched_data->lru_runq_head);
 	} else {
-		scheduler->next_vgpu = gvt->idle_vgpu;
+		vgpu = gvt->idle_vgpu;
 	}
+
+	for_each_engine_masked(engine, gvt->dev_priv, ring_mask, tmp)
+		scheduler->next_vgpu[engine->id] = vgpu;
 out:
-	if (scheduler->next_vgpu)
-		try_to_schedule_next_vgpu(gvt);
+	try_to_schedule_next_vgpu(gvt, ring_mask);
 }
 
-void intel_gvt_schedule(struct intel_gvt *gvt)
+static void tbs_sched_func(struct gvt_sched_data *sched_data,
+		struct intel_vgpu *(*pick_vgpu)(struct gvt_sched_data *, int))
+{
+	struct intel_engine_cs *engine;
+	enum intel_engine_id i;
+
+	if (!i915_modparams.enable_gvt_engine_sched) {
+		tbs_sched_engines(sched_data, -1, pick_vgpu);
+		return;
+	}
+
+	/* Let every engine run the vGPU of its own choice. */
+	for_each_engine(engine, sched_data->gvt->dev_priv, i)
+		tbs_sched_engines(sched_data, i, pick_vgpu);
+}
+
+static void __tbs_schedule(struct intel_gvt *gvt,
+		struct intel_vgpu *(*pick_vgpu)(struct gvt_sched_data *, int))
 {
 	struct gvt_sched_data *sched_data = gvt->scheduler.sched_data;
 	static uint64_t timer_check;
 
-	mutex_lock(&gvt->lock);
-
 	if (test_and_clear_bit(INTEL_GVT_REQUEST_SCHED,
-				(void *)&gvt->service_request)) {
+			       gvt->service_request)) {
 		if (!(timer_check++ % GVT_TS_BALANCE_PERIOD_MS))
 			gvt_balance_timeslice(sched_data);
 	}
-	clear_bit(INTEL_GVT_REQUEST_EVENT_SCHED, (void *)&gvt->service_request);
+	clear_bit(INTEL_GVT_REQUEST_EVENT_SCHED, gvt->service_request);
 
-	tbs_sched_func(sched_data);
+	tbs_sched_func(sched_data, pick_vgpu);
+}
 
-	mutex_unlock(&gvt->lock);
+static void tbs_schedule(struct intel_gvt *gvt)
+{
+	__tbs_schedule(gvt, tbs_pick_vgpu);
+}
+
+/*
+ * Budget a reserved vGPU has left on ring_id at now. Busy time is only
+ * known once a context is scheduled out, so the whole time since the vGPU
+ * was scheduled in is taken off as an upper bound.
+ */
+static ktime_t eds_budget_left(struct intel_gvt *gvt,
+			       struct vgpu_sched_data *vgpu_data,
+			       int ring_id, ktime_t now)
+{
+	ktime_t left = vgpu_data->dl_left[ring_id];
+
+	if (gvt->scheduler.current_vgpu[ring_id] == vgpu_data->vgpu)
+		left -= ktime_sub(now, vgpu_data->sched_in_time[ring_id]);
+
+	return left;
+}
+
+/* Start a new period once the deadline of the current one has passed. */
+static void eds_replenish(struct intel_gvt *gvt,
+			  struct vgpu_sched_data *vgpu_data, ktime_t now)
+{
+	ktime_t period = us_to_ktime(vgpu_data->sched_ctl.period_us);
+	ktime_t budget = us_to_ktime(vgpu_data->sched_ctl.budget_us);
+	int i;
+
+	if (ktime_before(now, vgpu_data->deadline))
+		return;
+
+	/* Periods the vGPU slept through are not made up for. */
+	if (ktime_before(now, ktime_add(vgpu_data->deadline, period)))
+		vgpu_data->deadline = ktime_add(vgpu_data->deadline, period);
+	else
+		vgpu_data->deadline = ktime_add(now, period);
+
+	for (i = 0; i < I915_NUM_ENGINES; i++) {
+		vgpu_data->dl_left[i] = budget;
+		/*
+		 * Time run in the previous period is taken off dl_left when
+		 * the vGPU is scheduled out, so credit it back here.
+		 */
+		if (gvt->scheduler.current_vgpu[i] == vgpu_data->vgpu)
+			vgpu_data->dl_left[i] +=
+				vgpu_busy_since_sched_in(vgpu_data, i);
+	}
+}
+
+/*
+ * Earliest deadline first among the busy vGPUs with a reservation and
+ * budget left. The GPU time they leave unused goes to all busy vGPUs in
+ * the time based way, so reserved vGPUs can run beyond their budget when
+ * nobody else needs the GPU.
+ */
+static struct intel_vgpu *eds_pick_vgpu(struct gvt_sched_data *sched_data,
+					int ring_id)
+{
+	struct intel_gvt *gvt = sched_data->gvt;
+	int idx = ring_id < 0 ? RCS : ring_id;
+	struct vgpu_sched_data *vgpu_data, *best = NULL;
+	ktime_t now = ktime_get();
+
+	list_for_each_entry(vgpu_data, &sched_data->lru_runq_head, lru_list) {
+		if (!vgpu_data->sched_ctl.period_us)
+			continue;
+
+		eds_replenish(gvt, vgpu_data, now);
+
+		if (ring_id < 0 ?
+		    !vgpu_has_pending_workload(vgpu_data->vgpu) :
+		    list_empty(workload_q_head(vgpu_data->vgpu, ring_id)))
+			continue;
+
+		if (eds_budget_left(gvt, vgpu_data, idx, now) <= 0)
+			continue;
+
+		if (!best || ktime_before(vgpu_data->deadline, best->deadline))
+			best = vgpu_data;
+	}
+
+	if (best)
+		return best->vgpu;
+
+	return find_busy_vgpu(sched_data, ring_id, false);
+}
+
+/*
+ * Program the deadline timer to the next replenishment of a reserved
+ * vGPU with queued work, or to the moment a running one runs out of
+ * budget, whichever comes first. Idle vGPUs are left to the periodic
+ * tick, like everything else.
+ */
+static void eds_arm_dl_timer(struct gvt_sched_data *sched_data)
+{
+	struct intel_gvt *gvt = sched_data->gvt;
+	struct vgpu_sched_data *vgpu_data;
+	ktime_t now = ktime_get(), next = KTIME_MAX, left;
+	int i;
+
+	list_for_each_entry(vgpu_data, &sched_data->lru_runq_head, lru_list) {
+		if (!vgpu_data->sched_ctl.period_us)
+			continue;
+
+		/* Don't arm for a deadline which has already passed. */
+		eds_replenish(gvt, vgpu_data, now);
+
+		if (vgpu_has_pending_workload(vgpu_data->vgpu))
+			next = min(next, vgpu_data->deadline);
+
+		for (i = 0; i < I915_NUM_ENGINES; i++) {
+			if (gvt->scheduler.current_vgpu[i] != vgpu_data->vgpu)
+				continue;
+
+			left = eds_budget_left(gvt, vgpu_data, i, now);
+			if (left > 0)
+				next = min(next, ktime_add(now, left));
+		}
+	}
+
+	if (next != KTIME_MAX)
+		hrtimer_start(&sched_data->dl_timer, next, HRTIMER_MODE_ABS);
+}
+
+static void eds_schedule(struct intel_gvt *gvt)
+{
+	__tbs_schedule(gvt, eds_pick_vgpu);
+	eds_arm_dl_timer(gvt->scheduler.sched_data);
+}
+
+static void lcs_schedule(struct intel_gvt *gvt)
+{
+	__tbs_schedule(gvt, lcs_pick_vgpu);
+}
+
+void intel_gvt_schedule(struct intel_gvt *gvt)
+{
+	mutex_lock(&gvt->sched_lock);
+	gvt->scheduler.sched_ops->schedule(gvt);
+	mutex_unlock(&gvt->sched_lock);
 }
 
 static enum hrtimer_restart tbs_timer_fn(struct hrtimer *timer_data)
@@ -255,6 +520,17 @@ static enum hrtimer_restart tbs_timer_fn(struct hrtimer *timer_data)
 	return HRTIMER_RESTART;
 }
 
+static enum hrtimer_restart eds_dl_timer_fn(struct hrtimer *timer_data)
+{
+	struct gvt_sched_data *data;
+
+	data = container_of(timer_data, struct gvt_sched_data, dl_timer);
+
+	intel_gvt_request_service(data->gvt, INTEL_GVT_REQUEST_EVENT_SCHED);
+
+	return HRTIMER_NORESTART;
+}
+
 static int tbs_sched_init(struct intel_gvt *gvt)
 {
 	struct intel_gvt_workload_scheduler *scheduler =
@@ -270,6 +546,8 @@ static int tbs_sched_init(struct intel_gvt *gvt)
 	hrtimer_init(&data->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
 	data->timer.function = tbs_timer_fn;
 	data->period = GVT_DEFAULT_TIME_SLICE;
+	hrtimer_init(&data->dl_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	data->dl_timer.function = eds_dl_timer_fn;
 	data->gvt = gvt;
 
 	scheduler->sched_data = data;
@@ -284,6 +562,7 @@ static void tbs_sched_clean(struct intel_gvt *gvt)
 	struct gvt_sched_data *data = scheduler->sched_data;
 
 	hrtimer_cancel(&data->timer);
+	hrtimer_cancel(&data->dl_timer);
 
 	kfree(data);
 	scheduler->sched_data = NULL;
@@ -297,7 +576,7 @@ static int tbs_sched_init_vgpu(struct intel_vgpu *vgpu)
 	if (!data)
 		return -ENOMEM;
 
-	data->sched_ctl.weight = vgpu->sched_ctl.weight;
+	data->sched_ctl = vgpu->sched_ctl;
 	data->vgpu = vgpu;
 	INIT_LIST_HEAD(&data->lru_list);
 
@@ -315,8 +594,10 @@ static void tbs_sched_clean_vgpu(struct intel_vgpu *vgpu)
 	vgpu->sched_data = NULL;
 
 	/* this vgpu id has been removed */
-	if (idr_is_empty(&gvt->vgpu_idr))
+	if (idr_is_empty(&gvt->vgpu_idr)) {
 		hrtimer_cancel(&sched_data->timer);
+		hrtimer_cancel(&sched_data->dl_timer);
+	}
 }
 
 static void tbs_sched_start_schedule(struct intel_vgpu *vgpu)
@@ -350,38 +631,86 @@ static struct intel_gvt_sched_policy_ops tbs_schedule_ops = {
 	.clean_vgpu = tbs_sched_clean_vgpu,
 	.start_schedule = tbs_sched_start_schedule,
 	.stop_schedule = tbs_sched_stop_schedule,
+	.schedule = tbs_schedule,
+};
+
+/* Latency class aware scheduler, sharing the time slice accounting of tbs. */
+static struct intel_gvt_sched_policy_ops lcs_schedule_ops = {
+	.init = tbs_sched_init,
+	.clean = tbs_sched_clean,
+	.init_vgpu = tbs_sched_init_vgpu,
+	.clean_vgpu = tbs_sched_clean_vgpu,
+	.start_schedule = tbs_sched_start_schedule,
+	.stop_schedule = tbs_sched_stop_schedule,
+	.schedule = lcs_schedule,
+};
+
+/*
+ * Earliest deadline first scheduler for vGPUs with a period and budget,
+ * sharing the time slice accounting of tbs for the rest of the GPU time.
+ */
+static struct intel_gvt_sched_policy_ops eds_schedule_ops = {
+	.init = tbs_sched_init,
+	.clean = tbs_sched_clean,
+	.init_vgpu = tbs_sched_init_vgpu,
+	.clean_vgpu = tbs_sched_clean_vgpu,
+	.start_schedule = tbs_sched_start_schedule,
+	.stop_schedule = tbs_sched_stop_schedule,
+	.schedule = eds_schedule,
 };
 
 int intel_gvt_init_sched_policy(struct intel_gvt *gvt)
 {
-	gvt->scheduler.sched_ops = &tbs_schedule_ops;
-
-	return gvt->scheduler.sched_ops->init(gvt);
+	int ret;
+
+	mutex_lock(&gvt->sched_lock);
+	if (i915_modparams.gvt_sched_policy == 1)
+		gvt->scheduler.sched_ops = &lcs_schedule_ops;
+	else if (i915_modparams.gvt_sched_policy == 2)
+		gvt->scheduler.sched_ops = &eds_schedule_ops;
+	else
+		gvt->scheduler.sched_ops = &tbs_schedule_ops;
+	ret = gvt->scheduler.sched_ops->init(gvt);
+	mutex_unlock(&gvt->sched_lock);
+
+	return ret;
 }
 
 void intel_gvt_clean_sched_policy(struct intel_gvt *gvt)
 {
+	mutex_lock(&gvt->sched_lock);
 	gvt->scheduler.sched_ops->clean(gvt);
+	mutex_unlock(&gvt->sched_lock);
 }
 
 int intel_vgpu_init_sched_policy(struct intel_vgpu *vgpu)
 {
-	return vgpu->gvt->scheduler.sched_ops->init_vgpu(vgpu);
+	int ret;
+
+	mutex_lock(&vgpu->gvt->sched_lock);
+	ret = vgpu->gvt->scheduler.sched_ops->init_vgpu(vgpu);
+	mutex_unlock(&vgpu->gvt->sched_lock);
+
+	return ret;
 }
 
 void intel_vgpu_clean_sched_policy(struct intel_vgpu *vgpu)
 {
+	mutex_lock(&vgpu->gvt->sched_lock);
 	vgpu->gvt->scheduler.sched_ops->clean_vgpu(vgpu);
+	mutex_unlock(&vgpu->gvt->sched_lock);
 }
 
 void intel_vgpu_start_schedule(struct intel_vgpu *vgpu)
 {
 	struct vgpu_sched_data *vgpu_data = vgpu->sched_data;
 
+	mutex_lock(&vgpu->gvt->sched_lock);
 	if (!vgpu_data->active) {
 		gvt_dbg_core("vgpu%d: start schedule\n", vgpu->id);
 		vgpu->gvt->scheduler.sched_ops->start_schedule(vgpu);
 	}
+	mutex_unlock(&vgpu->gvt->sched_lock);
 }
 
 void intel_gvt_kick_schedule(struct intel_gvt *gvt)
@@ -389,6 +718,109 @@ void intel_gvt_kick_schedule(struct intel_gvt *gvt)
 	intel_gvt_request_service(gvt, INTEL_GVT_REQUEST_EVENT_SCHED);
 }
 
+/**
+ * intel_vgpu_set_sched_weight - change the scheduling weight of a vGPU
+ * @vgpu: a vGPU
+ * @weight: new weight, from 1 to VGPU_MAX_WEIGHT
+ *
+ * The new weight is used from the next time slice balance period on.
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+int intel_vgpu_set_sched_weight(struct intel_vgpu *vgpu, int weight)
+{
+	struct vgpu_sched_data *vgpu_data = vgpu->sched_data;
+
+	if (weight < 1 || weight > VGPU_MAX_WEIGHT)
+		return -EINVAL;
+
+	mutex_lock(&vgpu->gvt->sched_lock);
+	vgpu->sched_ctl.weight = weight;
+	vgpu_data->sched_ctl.weight = weight;
+	mutex_unlock(&vgpu->gvt->sched_lock);
+
+	return 0;
+}
+
+/**
+ * intel_vgpu_set_sched_latency - change the latency class of a vGPU
+ * @vgpu: a vGPU
+ * @latency: new latency class, one of enum intel_vgpu_latency_class
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+int intel_vgpu_set_sched_latency(struct intel_vgpu *vgpu, int latency)
+{
+	struct vgpu_sched_data *vgpu_data = vgpu->sched_data;
+
+	if (latency != INTEL_VGPU_LATENCY_BATCH &&
+	    latency != INTEL_VGPU_LATENCY_INTERACTIVE)
+		return -EINVAL;
+
+	mutex_lock(&vgpu->gvt->sched_lock);
+	vgpu->sched_ctl.latency = latency;
+	vgpu_data->sched_ctl.latency = latency;
+	mutex_unlock(&vgpu->gvt->sched_lock);
+
+	return 0;
+}
+
+/**
+ * intel_vgpu_set_sched_deadline - change the GPU time reservation of a vGPU
+ * @vgpu: a vGPU
+ * @period_us: reservation period in us, 0 to drop the reservation
+ * @budget_us: GPU time in us the vGPU is guaranteed in each period
+ *
+ * Only the earliest deadline first policy honours reservations. The sum of
+ * budget_us / period_us over all vGPUs can't exceed one GPU.
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+int intel_vgpu_set_sched_deadline(struct intel_vgpu *vgpu,
+				  unsigned int period_us,
+				  unsigned int budget_us)
+{
+	struct vgpu_sched_data *vgpu_data = vgpu->sched_data;
+	struct intel_gvt *gvt = vgpu->gvt;
+	struct intel_vgpu *other;
+	u64 util = 0;
+	int id, ret = 0;
+
+	if (period_us ? !budget_us || budget_us > period_us : budget_us)
+		return -EINVAL;
+
+	mutex_lock(&gvt->lock);
+	mutex_lock(&gvt->sched_lock);
+
+	/* utilization in 1/2^20 units of the GPU */
+	if (period_us)
+		util = div_u64((u64)budget_us << 20, period_us);
+	idr_for_each_entry(&gvt->vgpu_idr, other, id) {
+		if (other == vgpu || !other->sched_ctl.period_us)
+			continue;
+		util += div_u64((u64)other->sched_ctl.budget_us << 20,
+				other->sched_ctl.period_us);
+	}
+	if (util > 1 << 20) {
+		ret = -ENOSPC;
+		goto out;
+	}
+
+	vgpu->sched_ctl.period_us = period_us;
+	vgpu->sched_ctl.budget_us = budget_us;
+	vgpu_data->sched_ctl = vgpu->sched_ctl;
+	/* start a fresh period on the next scheduling decision */
+	vgpu_data->deadline = 0;
+out:
+	mutex_unlock(&gvt->sched_lock);
+	mutex_unlock(&gvt->lock);
+
+	return ret;
+}
+
 void intel_vgpu_stop_schedule(struct intel_vgpu *vgpu)
 {
 	struct intel_gvt_workload_scheduler *scheduler =
@@ -396,20 +828,23 @@ void intel_vgpu_stop_schedule(struct intel_vgpu *vgpu)
 	int ring_id;
 	struct vgpu_sched_data *vgpu_data = vgpu->sched_data;
 
+	mutex_lock(&vgpu->gvt->sched_lock);
 	if (!vgpu_data->active)
-		return;
+		goto out;
 
 	gvt_dbg_core("vgpu%d: stop schedule\n", vgpu->id);
 
 	scheduler->sched_ops->stop_schedule(vgpu);
 
-	if (scheduler->next_vgpu == vgpu)
-		scheduler->next_vgpu = NULL;
+	for (ring_id = 0; ring_id < I915_NUM_ENGINES; ring_id++) {
+		if (scheduler->next_vgpu[ring_id] == vgpu)
+			scheduler->next_vgpu[ring_id] = NULL;
 
-	if (scheduler->current_vgpu == vgpu) {
-		/* stop workload dispatching */
-		scheduler->need_reschedule = true;
-		scheduler->current_vgpu = NULL;
+		if (scheduler->current_vgpu[ring_id] == vgpu) {
+			/* stop workload dispatching */
+			scheduler->need_reschedule[ring_id] = true;
+			scheduler->current_vgpu[ring_id] = NULL;
+		}
 	}
 
 	spin_lock_bh(&scheduler->mmio_context_lock);
@@ -420,4 +855,6 @@ void intel_vgpu_stop_schedule(struct intel_vgpu *vgpu)
 		}
 	}
 	spin_unlock_bh(&scheduler->mmio_context_lock);
+out:
+	mutex_unlock(&vgpu->gvt->sched_lock);
 }
@@ -41,6 +41,7 @@ struct intel_gvt_sched_policy_ops {
 	void (*clean_vgpu)(struct intel_vgpu *vgpu);
 	void (*start_schedule)(struct intel_vgpu *vgpu);
 	void (*stop_schedule)(struct intel_vgpu *vgpu);
+	void (*schedule)(struct intel_gvt *gvt);
 };
 
 void intel_gvt_schedule(struct intel_gvt *gvt);
@@ -59,4 +60,12 @@ void intel_vgpu_stop_schedule(struct intel_vgpu *vgpu);
 
 void intel_gvt_kick_schedule(struct intel_gvt *gvt);
 
+int intel_vgpu_set_sched_weight(struct intel_vgpu *vgpu, int weight);
+
+int intel_vgpu_set_sched_latency(struct intel_vgpu *vgpu, int latency);
+
+int intel_vgpu_set_sched_deadline(struct intel_vgpu *vgpu,
+				  unsigned int period_us,
+				  unsigned int budget_us);
+
 #endif
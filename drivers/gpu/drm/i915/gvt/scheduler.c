@@ -34,8 +34,11 @@
  */
 
 #include <linux/kthread.h>
+#include <linux/sched/mm.h>
 
 #include "i915_drv.h"
+#include "i915_gem_clflush.h"
+#include "intel_lrc_reg.h"
 #include "gvt.h"
 
 #define RING_CTX_OFF(x) \
@@ -123,48 +126,116 @@ static void sr_oa_regs(struct intel_vgpu_workload *workload,
 	}
 }
 
+static unsigned long context_page_num(struct intel_vgpu_workload *workload)
+{
+	struct drm_i915_private *dev_priv = workload->vgpu->gvt->dev_priv;
+	int ring_id = workload->ring_id;
+
+	if (IS_BROADWELL(dev_priv) && ring_id == RCS)
+		return 19;
+
+	return dev_priv->engine[ring_id]->context_size >> PAGE_SHIFT;
+}
+
+static void unmap_context_pages(struct intel_gvt_gpa_buf *bufs,
+				unsigned int count)
+{
+	while (count--)
+		kunmap(kmap_to_page(bufs[count].buf));
+}
+
+/*
+ * Map the guest context pages following the ppHWSP and the ring context
+ * page in the shadow context, with the guest physical address behind each.
+ */
+static int map_context_pages(struct intel_vgpu_workload *workload,
+			     struct intel_gvt_gpa_buf *bufs)
+{
+	struct intel_vgpu *vgpu = workload->vgpu;
+	struct drm_i915_gem_object *ctx_obj =
+		vgpu->submission.shadow_ctx->engine[workload->ring_id].state->obj;
+	unsigned long context_gpa, i;
+	unsigned int n = 0;
+
+	for (i = 2; i < context_page_num(workload); i++) {
+		context_gpa = intel_vgpu_gma_to_gpa(vgpu->gtt.ggtt_mm,
+				(u32)((workload->ctx_desc.lrca + i) <<
+				I915_GTT_PAGE_SHIFT));
+		if (context_gpa == INTEL_GVT_INVALID_ADDR) {
+			gvt_vgpu_err("invalid guest context descriptor\n");
+			unmap_context_pages(bufs, n);
+			return -EFAULT;
+		}
+
+		bufs[n].gpa = context_gpa;
+		bufs[n].buf = kmap(i915_gem_object_get_page(ctx_obj,
+					LRC_HEADER_PAGES + i));
+		bufs[n].len = I915_GTT_PAGE_SIZE;
+		n++;
+	}
+	return n;
+}
+
+static void snapshot_context_pages(struct intel_vgpu_workload *workload,
+				   struct intel_gvt_gpa_buf *bufs,
+				   unsigned int count)
+{
+	struct intel_vgpu_submission *s = &workload->vgpu->submission;
+	int ring_id = workload->ring_id;
+	unsigned int i;
+
+	if (!i915_modparams.enable_gvt_ctx_diff)
+		return;
+
+	if (!s->ctx_snapshot[ring_id]) {
+		s->ctx_snapshot[ring_id] = vmalloc(context_page_num(workload) *
+						   I915_GTT_PAGE_SIZE);
+		if (!s->ctx_snapshot[ring_id])
+			return;
+	}
+
+	for (i = 0; i < count; i++)
+		memcpy(s->ctx_snapshot[ring_id] + i * I915_GTT_PAGE_SIZE,
+		       bufs[i].buf, I915_GTT_PAGE_SIZE);
+	workload->ctx_snapshot = true;
+}
+
 static int populate_shadow_context(struct intel_vgpu_workload *workload)
 {
 	struct intel_vgpu *vgpu = workload->vgpu;
-	struct intel_gvt *gvt = vgpu->gvt;
 	int ring_id = workload->ring_id;
 	struct i915_gem_context *shadow_ctx = vgpu->submission.shadow_ctx;
 	struct drm_i915_gem_object *ctx_obj =
 		shadow_ctx->engine[ring_id].state->obj;
 	struct execlist_ring_context *shadow_ring_context;
+	struct intel_gvt_gpa_buf *bufs;
 	struct page *page;
-	void *dst;
-	unsigned long context_gpa, context_page_num;
-	int i;
+	int count, ret;
 
 	gvt_dbg_sched("ring id %d workload lrca %x", ring_id,
 			workload->ctx_desc.lrca);
 
-	context_page_num = gvt->dev_priv->engine[ring_id]->context_size;
-
-	context_page_num = context_page_num >> PAGE_SHIFT;
-
-	if (IS_BROADWELL(gvt->dev_priv) && ring_id == RCS)
-		context_page_num = 19;
+	bufs = kcalloc(context_page_num(workload), sizeof(*bufs), GFP_KERNEL);
+	if (!bufs)
+		return -ENOMEM;
 
-	i = 2;
+	count = map_context_pages(workload, bufs);
+	if (count < 0) {
+		kfree(bufs);
+		return count;
+	}
 
-	while (i < context_page_num) {
-		context_gpa = intel_vgpu_gma_to_gpa(vgpu->gtt.ggtt_mm,
-				(u32)((workload->ctx_desc.lrca + i) <<
-				I915_GTT_PAGE_SHIFT));
-		if (context_gpa == INTEL_GVT_INVALID_ADDR) {
-			gvt_vgpu_err("Invalid guest context descriptor\n");
-			return -EFAULT;
-		}
+	workload->ctx_snapshot = false;
+	ret = intel_gvt_hypervisor_rw_gpa_bulk(vgpu, bufs, count, false);
+	if (ret)
+		gvt_vgpu_err("fail to read guest context\n");
+	else
+		snapshot_context_pages(workload, bufs, count);
 
-		page = i915_gem_object_get_page(ctx_obj, LRC_HEADER_PAGES + i);
-		dst = kmap(page);
-		intel_gvt_hypervisor_read_gpa(vgpu, context_gpa, dst,
-				I915_GTT_PAGE_SIZE);
-		kunmap(page);
-		i++;
-	}
+	unmap_context_pages(bufs, count);
+	kfree(bufs);
+	if (ret)
+		return ret;
 
 	page = i915_gem_object_get_page(ctx_obj, LRC_STATE_PN);
 	shadow_ring_context = kmap(page);
@@ -215,6 +286,73 @@ static void save_ring_hw_state(struct intel_vgpu *vgpu, int ring_id)
 	vgpu_vreg(vgpu, i915_mmio_reg_offset(reg)) = I915_READ_FW(reg);
 }
 
+/*
+ * A preempted workload may get back onto the engine while another one is
+ * the current workload, so find the workload of the request.
+ */
+static struct intel_vgpu_workload *find_workload_by_req(
+		struct intel_gvt_workload_scheduler *scheduler,
+		struct i915_request *req)
+{
+	enum intel_engine_id ring_id = req->engine->id;
+	struct intel_vgpu_workload *workload;
+	unsigned long flags;
+
+	workload = scheduler->current_workload[ring_id];
+	if (likely(workload && workload->req == req))
+		return workload;
+
+	spin_lock_irqsave(&scheduler->mmio_context_lock, flags);
+	list_for_each_entry(workload, &scheduler->preempted_q[ring_id],
+			    preempt_list) {
+		if (workload->req == req) {
+			spin_unlock_irqrestore(&scheduler->mmio_context_lock,
+					       flags);
+			return workload;
+		}
+	}
+	spin_unlock_irqrestore(&scheduler->mmio_context_lock, flags);
+
+	return scheduler->current_workload[ring_id];
+}
+
+static u32 *workload_reg_state(struct intel_vgpu_workload *workload)
+{
+	struct i915_gem_context *shadow_ctx =
+		workload->vgpu->submission.shadow_ctx;
+
+	return shadow_ctx->engine[workload->ring_id].lrc_reg_state;
+}
+
+/*
+ * Charge the GPU time the shadow context ran for since it was scheduled
+ * in. It comes from the CTX_TIMESTAMP the engine saves in the context
+ * image, so the pipeline drain and idle time around the context switch
+ * are left out. Fall back to the CPU side times if the timestamp
+ * frequency is unknown.
+ */
+static void workload_account_busy(struct intel_vgpu_workload *workload,
+				  u64 now)
+{
+	struct intel_vgpu *vgpu = workload->vgpu;
+	u32 freq = INTEL_INFO(vgpu->gvt->dev_priv)->cs_timestamp_frequency_khz;
+	u32 *reg_state = workload_reg_state(workload);
+	u64 busy;
+
+	if (freq && reg_state) {
+		u32 ticks = reg_state[CTX_CTX_TIMESTAMP + 1] -
+			    workload->ctx_timestamp;
+
+		busy = div_u64((u64)ticks * USEC_PER_SEC, freq);
+	} else {
+		busy = now - workload->sched_in_ns;
+	}
+
+	atomic64_add(busy, &vgpu->engine_busy_ns[workload->ring_id]);
+	atomic64_add(busy, &vgpu->gvt->engine_busy_ns[workload->ring_id]);
+	intel_vgpu_stat_add(vgpu, INTEL_VGPU_STAT_BUSY_NS, busy);
+}
+
 static int shadow_context_status_change(struct notifier_block *nb,
 		unsigned long action, void *data)
 {
@@ -225,6 +363,7 @@ static int shadow_context_status_change(struct notifier_block *nb,
 	enum intel_engine_id ring_id = req->engine->id;
 	struct intel_vgpu_workload *workload;
 	unsigned long flags;
+	u32 *reg_state;
 
 	if (!is_gvt_request(req)) {
 		spin_lock_irqsave(&scheduler->mmio_context_lock, flags);
@@ -240,7 +379,7 @@ static int shadow_context_status_change(struct notifier_block *nb,
 		return NOTIFY_OK;
 	}
 
-	workload = scheduler->current_workload[ring_id];
+	workload = find_workload_by_req(scheduler, req);
 	if (unlikely(!workload))
 		return NOTIFY_OK;
 
@@ -257,13 +396,26 @@ static int shadow_context_status_change(struct notifier_block *nb,
 				      ring_id, workload->vgpu->id);
 		spin_unlock_irqrestore(&scheduler->mmio_context_lock, flags);
 		atomic_set(&workload->shadow_ctx_active, 1);
+		workload->sched_in_ns = ktime_get_ns();
+		reg_state = workload_reg_state(workload);
+		if (reg_state)
+			workload->ctx_timestamp =
+				reg_state[CTX_CTX_TIMESTAMP + 1];
+		if (!workload->stamp[WORKLOAD_STAGE_GPU_START])
+			workload->stamp[WORKLOAD_STAGE_GPU_START] =
+				workload->sched_in_ns;
 		break;
 	case INTEL_CONTEXT_SCHEDULE_OUT:
 		save_ring_hw_state(workload->vgpu, ring_id);
 		atomic_set(&workload->shadow_ctx_active, 0);
+		workload->stamp[WORKLOAD_STAGE_GPU_END] = ktime_get_ns();
+		workload_account_busy(workload,
+				      workload->stamp[WORKLOAD_STAGE_GPU_END]);
 		break;
 	case INTEL_CONTEXT_SCHEDULE_PREEMPTED:
 		save_ring_hw_state(workload->vgpu, ring_id);
+		workload_account_busy(workload, ktime_get_ns());
+		intel_vgpu_stat_inc(workload->vgpu, INTEL_VGPU_STAT_PREEMPT);
 		break;
 	default:
 		WARN_ON(1);
@@ -323,13 +475,128 @@ static int copy_workload_to_ring_buffer(struct intel_vgpu_workload *workload)
 	return 0;
 }
 
+/* Must be called with struct_mutex held. */
+static void __release_shadow_wa_ctx(struct intel_shadow_wa_ctx *wa_ctx)
+{
+	struct intel_vgpu_workload *workload = container_of(wa_ctx,
+					struct intel_vgpu_workload,
+					wa_ctx);
+
+	if (!wa_ctx->indirect_ctx.bb)
+		return;
+
+	intel_vgpu_put_shadow_bb(workload->vgpu, wa_ctx->indirect_ctx.bb);
+	wa_ctx->indirect_ctx.bb = NULL;
+	wa_ctx->indirect_ctx.shadow_va = NULL;
+}
+
 static void release_shadow_wa_ctx(struct intel_shadow_wa_ctx *wa_ctx)
 {
-	if (!wa_ctx->indirect_ctx.obj)
+	struct intel_vgpu_workload *workload = container_of(wa_ctx,
+					struct intel_vgpu_workload,
+					wa_ctx);
+	struct drm_i915_private *dev_priv = workload->vgpu->gvt->dev_priv;
+
+	if (!wa_ctx->indirect_ctx.bb)
 		return;
 
-	i915_gem_object_unpin_map(wa_ctx->indirect_ctx.obj);
-	i915_gem_object_put(wa_ctx->indirect_ctx.obj);
+	mutex_lock(&dev_priv->drm.struct_mutex);
+	__release_shadow_wa_ctx(wa_ctx);
+	mutex_unlock(&dev_priv->drm.struct_mutex);
+}
+
+static int scan_wa_ctx(struct intel_vgpu_workload *workload)
+{
+	if ((workload->ring_id == RCS) &&
+	    (workload->wa_ctx.indirect_ctx.size != 0))
+		return intel_gvt_scan_and_shadow_wa_ctx(&workload->wa_ctx);
+	return 0;
+}
+
+static int scan_workload(struct intel_vgpu_workload *workload)
+{
+	int ret;
+
+	if (workload->scanned)
+		return 0;
+
+	ret = intel_gvt_scan_and_shadow_ringbuffer(workload);
+	if (ret)
+		return ret;
+
+	ret = scan_wa_ctx(workload);
+	if (ret)
+		return ret;
+
+	workload->scanned = true;
+	return 0;
+}
+
+/*
+ * i915 pins the shadow context for as long as a request uses it, but GVT
+ * updates the guest context from the shadow one once the workload is
+ * completed, when i915 may have unpinned it already. The shadow context
+ * of a ring is hence pinned by GVT as well, from the first workload
+ * shadowed on the ring until the submission is cleaned, which spares the
+ * pin and unpin in the path of every workload.
+ */
+static int pin_shadow_context(struct intel_vgpu *vgpu, int ring_id)
+{
+	struct intel_vgpu_submission *s = &vgpu->submission;
+	struct intel_engine_cs *engine = vgpu->gvt->dev_priv->engine[ring_id];
+	struct intel_ring *ring;
+
+	if (test_bit(ring_id, s->shadow_ctx_pinned))
+		return 0;
+
+	ring = engine->context_pin(engine, s->shadow_ctx);
+	if (IS_ERR(ring))
+		return PTR_ERR(ring);
+
+	set_bit(ring_id, s->shadow_ctx_pinned);
+	atomic_inc(&vgpu->gvt->scheduler.shadow_ctx_pinned);
+	return 0;
+}
+
+static void unpin_shadow_contexts(struct intel_vgpu *vgpu)
+{
+	struct intel_vgpu_submission *s = &vgpu->submission;
+	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
+	int ring_id;
+
+	mutex_lock(&dev_priv->drm.struct_mutex);
+	for_each_set_bit(ring_id, s->shadow_ctx_pinned, I915_NUM_ENGINES)
+		dev_priv->engine[ring_id]->context_unpin(
+				dev_priv->engine[ring_id], s->shadow_ctx);
+	atomic_sub(bitmap_weight(s->shadow_ctx_pinned, I915_NUM_ENGINES),
+		   &vgpu->gvt->scheduler.shadow_ctx_pinned);
+	bitmap_zero(s->shadow_ctx_pinned, I915_NUM_ENGINES);
+	mutex_unlock(&dev_priv->drm.struct_mutex);
+}
+
+/*
+ * Once no workload of the ring is left, nothing reads the shadow context
+ * anymore before the next one is shadowed, which pins it again. Unpinned,
+ * i915 can swap out the context image and free the ring buffer.
+ */
+static void unpin_idle_shadow_contexts(struct intel_vgpu *vgpu)
+{
+	struct intel_vgpu_submission *s = &vgpu->submission;
+	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
+	int ring_id;
+
+	lockdep_assert_held(&vgpu->vgpu_lock);
+	lockdep_assert_held(&dev_priv->drm.struct_mutex);
+
+	for_each_set_bit(ring_id, s->shadow_ctx_pinned, I915_NUM_ENGINES) {
+		if (!list_empty(workload_q_head(vgpu, ring_id)))
+			continue;
+
+		dev_priv->engine[ring_id]->context_unpin(
+				dev_priv->engine[ring_id], s->shadow_ctx);
+		clear_bit(ring_id, s->shadow_ctx_pinned);
+		atomic_dec(&vgpu->gvt->scheduler.shadow_ctx_pinned);
+	}
 }
 
 /**
@@ -347,8 +614,7 @@ int intel_gvt_scan_and_shadow_workload(struct intel_vgpu_workload *workload)
 	struct i915_gem_context *shadow_ctx = s->shadow_ctx;
 	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
 	int ring_id = workload->ring_id;
-	struct intel_engine_cs *engine = dev_priv->engine[ring_id];
-	struct intel_ring *ring;
+	u64 start, scanned;
 	int ret;
 
 	lockdep_assert_held(&dev_priv->drm.struct_mutex);
@@ -356,49 +622,41 @@ int intel_gvt_scan_and_shadow_workload(struct intel_vgpu_workload *workload)
 	if (workload->shadowed)
 		return 0;
 
+	start = ktime_get_ns();
+
 	shadow_ctx->desc_template &= ~(0x3 << GEN8_CTX_ADDRESSING_MODE_SHIFT);
 	shadow_ctx->desc_template |= workload->ctx_desc.addressing_mode <<
 				    GEN8_CTX_ADDRESSING_MODE_SHIFT;
 
-	if (!test_and_set_bit(ring_id, s->shadow_ctx_desc_updated))
-		shadow_context_descriptor_update(shadow_ctx,
-					dev_priv->engine[ring_id]);
-
-	ret = intel_gvt_scan_and_shadow_ringbuffer(workload);
+	ret = scan_workload(workload);
 	if (ret)
 		goto err_scan;
 
-	if ((workload->ring_id == RCS) &&
-	    (workload->wa_ctx.indirect_ctx.size != 0)) {
-		ret = intel_gvt_scan_and_shadow_wa_ctx(&workload->wa_ctx);
-		if (ret)
-			goto err_scan;
-	}
+	scanned = ktime_get_ns();
+	intel_vgpu_stat_inc(vgpu, INTEL_VGPU_STAT_WORKLOAD_SCAN);
+	intel_vgpu_stat_add(vgpu, INTEL_VGPU_STAT_SCAN_NS, scanned - start);
 
-	/* pin shadow context by gvt even the shadow context will be pinned
-	 * when i915 alloc request. That is because gvt will update the guest
-	 * context from shadow context when workload is completed, and at that
-	 * moment, i915 may already unpined the shadow context to make the
-	 * shadow_ctx pages invalid. So gvt need to pin itself. After update
-	 * the guest context, gvt can unpin the shadow_ctx safely.
-	 */
-	ring = engine->context_pin(engine, shadow_ctx);
-	if (IS_ERR(ring)) {
-		ret = PTR_ERR(ring);
+	ret = pin_shadow_context(vgpu, ring_id);
+	if (ret) {
 		gvt_vgpu_err("fail to pin shadow context\n");
 		goto err_shadow;
 	}
 
+	/* the descriptor is only built by i915 when the context is pinned */
+	shadow_context_descriptor_update(shadow_ctx, dev_priv->engine[ring_id]);
+
 	ret = populate_shadow_context(workload);
 	if (ret)
-		goto err_unpin;
+		goto err_shadow;
 	workload->shadowed = true;
+	workload->stamp[WORKLOAD_STAGE_SHADOWED] = ktime_get_ns();
+	intel_vgpu_stat_add(vgpu, INTEL_VGPU_STAT_SHADOW_NS,
+			    workload->stamp[WORKLOAD_STAGE_SHADOWED] - scanned);
 	return 0;
 
-err_unpin:
-	engine->context_unpin(engine, shadow_ctx);
 err_shadow:
-	release_shadow_wa_ctx(&workload->wa_ctx);
+	__release_shadow_wa_ctx(&workload->wa_ctx);
+	workload->scanned = false;
 err_scan:
 	return ret;
 }
@@ -407,7 +665,6 @@ static int intel_gvt_generate_request(struct intel_vgpu_workload *workload)
 {
 	int ring_id = workload->ring_id;
 	struct drm_i915_private *dev_priv = workload->vgpu->gvt->dev_priv;
-	struct intel_engine_cs *engine = dev_priv->engine[ring_id];
 	struct i915_request *rq;
 	struct intel_vgpu *vgpu = workload->vgpu;
 	struct intel_vgpu_submission *s = &vgpu->submission;
@@ -418,7 +675,7 @@ static int intel_gvt_generate_request(struct intel_vgpu_workload *workload)
 	if (IS_ERR(rq)) {
 		gvt_vgpu_err("fail to allocate gem request\n");
 		ret = PTR_ERR(rq);
-		goto err_unpin;
+		goto err_release;
 	}
 
 	gvt_dbg_sched("ring id %d get i915 gem request %p\n", ring_id, rq);
@@ -426,16 +683,67 @@ static int intel_gvt_generate_request(struct intel_vgpu_workload *workload)
 	workload->req = i915_request_get(rq);
 	ret = copy_workload_to_ring_buffer(workload);
 	if (ret)
-		goto err_unpin;
+		goto err_release;
 	return 0;
 
-err_unpin:
-	engine->context_unpin(engine, shadow_ctx);
-	release_shadow_wa_ctx(&workload->wa_ctx);
+err_release:
+	__release_shadow_wa_ctx(&workload->wa_ctx);
 	return ret;
 }
 
-static void release_shadow_batch_buffer(struct intel_vgpu_workload *workload);
+static void __release_shadow_batch_buffer(struct intel_vgpu_workload *workload);
+
+/*
+ * Pin a shadow batch buffer into the GGTT. The vma of a pooled object is
+ * known already, so the lookup is skipped, and pinning it is only a check
+ * of the node unless it was evicted in the meantime.
+ */
+static int pin_shadow_bb(struct intel_vgpu_shadow_bb *bb, u64 alignment)
+{
+	int ret;
+
+	if (bb->ggtt_vma) {
+		ret = i915_vma_pin(bb->ggtt_vma, 0, alignment, PIN_GLOBAL);
+		bb->vma = ret ? ERR_PTR(ret) : bb->ggtt_vma;
+	} else {
+		bb->vma = i915_gem_object_ggtt_pin(bb->obj, NULL,
+						   0, alignment, 0);
+	}
+	return PTR_ERR_OR_ZERO(bb->vma);
+}
+
+/* below this the worker round trip costs more than the flush itself */
+#define SHADOW_BB_ASYNC_CLFLUSH_MIN	SZ_64K
+
+/*
+ * Move a shadow batch buffer written through its CPU mapping over to the
+ * GTT domain for @rq. Without LLC the copy has to be flushed out of the
+ * CPU caches first; for big buffers this is left to the async clflush
+ * worker, so that it overlaps with the rest of the dispatch and with the
+ * scan of the next workload, and @rq waits for the flush instead.
+ */
+static int flush_shadow_bb(struct intel_vgpu_shadow_bb *bb,
+			   struct i915_request *rq)
+{
+	struct drm_i915_gem_object *obj = bb->obj;
+	bool async = false;
+	int ret;
+
+	if (bb->clflush & CLFLUSH_AFTER) {
+		async = obj->base.size >= SHADOW_BB_ASYNC_CLFLUSH_MIN;
+		if (!async)
+			drm_clflush_virt_range(bb->va, obj->base.size);
+		bb->clflush &= ~CLFLUSH_AFTER;
+	}
+
+	ret = i915_gem_object_set_to_gtt_domain(obj, false);
+	if (ret || !async)
+		return ret;
+
+	obj->cache_dirty = true;
+	i915_gem_clflush_object(obj, I915_CLFLUSH_FORCE);
+	return i915_request_await_object(rq, obj, false);
+}
 
 static int prepare_shadow_batch_buffer(struct intel_vgpu_workload *workload)
 {
@@ -445,11 +753,9 @@ static int prepare_shadow_batch_buffer(struct intel_vgpu_workload *workload)
 	int ret;
 
 	list_for_each_entry(bb, &workload->shadow_bb, list) {
-		bb->vma = i915_gem_object_ggtt_pin(bb->obj, NULL, 0, 0, 0);
-		if (IS_ERR(bb->vma)) {
-			ret = PTR_ERR(bb->vma);
+		ret = pin_shadow_bb(bb, 0);
+		if (ret)
 			goto err;
-		}
 
 		/* For privilge batch buffer and not wa_ctx, the bb_start_cmd_va
 		 * is only updated into ring_scan_buffer, not real ring address
@@ -468,23 +774,20 @@ static int prepare_shadow_batch_buffer(struct intel_vgpu_workload *workload)
 			bb->bb_start_cmd_va[2] = 0;
 
 		/* No one is going to touch shadow bb from now on. */
-		if (bb->clflush & CLFLUSH_AFTER) {
-			drm_clflush_virt_range(bb->va, bb->obj->base.size);
-			bb->clflush &= ~CLFLUSH_AFTER;
-		}
-
-		ret = i915_gem_object_set_to_gtt_domain(bb->obj, false);
+		ret = flush_shadow_bb(bb, workload->req);
 		if (ret)
 			goto err;
 
-		i915_gem_obj_finish_shmem_access(bb->obj);
-		bb->accessing = false;
+		if (bb->accessing) {
+			i915_gem_obj_finish_shmem_access(bb->obj);
+			bb->accessing = false;
+		}
 
 		i915_vma_move_to_active(bb->vma, workload->req, 0);
 	}
 	return 0;
 err:
-	release_shadow_batch_buffer(workload);
+	__release_shadow_batch_buffer(workload);
 	return ret;
 }
 
@@ -517,69 +820,309 @@ static int update_wa_ctx_2_shadow_ctx(struct intel_shadow_wa_ctx *wa_ctx)
 
 static int prepare_shadow_wa_ctx(struct intel_shadow_wa_ctx *wa_ctx)
 {
-	struct i915_vma *vma;
+	struct intel_vgpu_workload *workload = container_of(wa_ctx,
+					struct intel_vgpu_workload,
+					wa_ctx);
+	struct intel_vgpu_shadow_bb *bb = wa_ctx->indirect_ctx.bb;
 	unsigned char *per_ctx_va =
 		(unsigned char *)wa_ctx->indirect_ctx.shadow_va +
 		wa_ctx->indirect_ctx.size;
+	int ret;
 
 	if (wa_ctx->indirect_ctx.size == 0)
 		return 0;
 
-	vma = i915_gem_object_ggtt_pin(wa_ctx->indirect_ctx.obj, NULL,
-				       0, CACHELINE_BYTES, 0);
-	if (IS_ERR(vma))
-		return PTR_ERR(vma);
-
-	/* FIXME: we are not tracking our pinned VMA leaving it
-	 * up to the core to fix up the stray pin_count upon
-	 * free.
-	 */
+	ret = pin_shadow_bb(bb, CACHELINE_BYTES);
+	if (ret)
+		return ret;
 
-	wa_ctx->indirect_ctx.shadow_gma = i915_ggtt_offset(vma);
+	wa_ctx->indirect_ctx.shadow_gma = i915_ggtt_offset(bb->vma);
 
 	wa_ctx->per_ctx.shadow_gma = *((unsigned int *)per_ctx_va + 1);
 	memset(per_ctx_va, 0, CACHELINE_BYTES);
 
+	ret = flush_shadow_bb(bb, workload->req);
+	if (ret)
+		return ret;
+
+	if (bb->accessing) {
+		i915_gem_obj_finish_shmem_access(bb->obj);
+		bb->accessing = false;
+	}
+
+	/* keeps the object out of the pool until the request is done */
+	i915_vma_move_to_active(bb->vma, workload->req, 0);
+
 	update_wa_ctx_2_shadow_ctx(wa_ctx);
 	return 0;
 }
 
-static void release_shadow_batch_buffer(struct intel_vgpu_workload *workload)
+/*
+ * Shadow batch buffers are kept in a small per-vGPU pool once they are not
+ * used by a workload anymore, still mapped and bound into the GGTT, so that
+ * shadowing a batch buffer usually doesn't need to create, map and bind a
+ * new object. Like the i915 batch pool, the buckets hold objects of 1, 2, 4
+ * and 8+ pages.
+ */
+#define SHADOW_BB_POOL_MAX	32
+
+static struct list_head *
+shadow_bb_pool_bucket(struct intel_vgpu_submission *s, size_t size)
+{
+	int n = fls(size >> PAGE_SHIFT) - 1;
+
+	if (n >= ARRAY_SIZE(s->shadow_bb_pool))
+		n = ARRAY_SIZE(s->shadow_bb_pool) - 1;
+	return &s->shadow_bb_pool[n];
+}
+
+static void free_shadow_bb(struct intel_vgpu_shadow_bb *bb)
+{
+	if (bb->va && !IS_ERR(bb->va))
+		i915_gem_object_unpin_map(bb->obj);
+
+	if (bb->vma && !IS_ERR(bb->vma))
+		i915_vma_close(bb->vma);
+
+	__i915_gem_object_release_unless_active(bb->obj);
+	kfree(bb);
+}
+
+/**
+ * intel_vgpu_get_shadow_bb - get a shadow batch buffer
+ * @vgpu: a vGPU
+ * @size: the minimum size of the shadow batch buffer
+ *
+ * An idle shadow batch buffer from the pool of the vGPU is returned if there
+ * is one big enough, with its object still mapped at bb->va. Otherwise a new
+ * shadow batch buffer is allocated, which isn't mapped yet. The caller must
+ * hold the struct_mutex.
+ *
+ * Returns:
+ * The shadow batch buffer, or an error pointer if failed.
+ */
+struct intel_vgpu_shadow_bb *
+intel_vgpu_get_shadow_bb(struct intel_vgpu *vgpu, unsigned long size)
 {
-	struct intel_vgpu *vgpu = workload->vgpu;
 	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
-	struct intel_vgpu_shadow_bb *bb, *pos;
+	struct intel_vgpu_submission *s = &vgpu->submission;
+	struct intel_vgpu_shadow_bb *bb;
+	struct list_head *bucket;
+
+	lockdep_assert_held(&dev_priv->drm.struct_mutex);
+
+	/*
+	 * gemfs backs an object with huge pages only as far as it covers
+	 * them whole, so round big batch buffers up to get fewer, contiguous
+	 * chunks to map and copy the guest commands into.
+	 */
+	if (dev_priv->mm.gemfs && size >= I915_GTT_PAGE_SIZE_2M)
+		size = roundup(size, I915_GTT_PAGE_SIZE_2M);
+	else
+		size = roundup(size, PAGE_SIZE);
+	bucket = shadow_bb_pool_bucket(s, size);
+
+	list_for_each_entry(bb, bucket, list) {
+		if (bb->obj->base.size < size)
+			continue;
+		if (!reservation_object_test_signaled_rcu(bb->obj->resv, true))
+			continue;
+
+		list_del_init(&bb->list);
+		s->shadow_bb_pool_count--;
+		atomic_dec(&vgpu->gvt->scheduler.shadow_bb_pooled);
+		return bb;
+	}
+
+	bb = kzalloc(sizeof(*bb), GFP_KERNEL);
+	if (!bb)
+		return ERR_PTR(-ENOMEM);
+
+	INIT_LIST_HEAD(&bb->list);
+
+	bb->obj = i915_gem_object_create(dev_priv, size);
+	if (IS_ERR(bb->obj)) {
+		int ret = PTR_ERR(bb->obj);
+
+		kfree(bb);
+		return ERR_PTR(ret);
+	}
+	return bb;
+}
+
+/**
+ * intel_vgpu_put_shadow_bb - release a shadow batch buffer
+ * @vgpu: a vGPU
+ * @bb: the shadow batch buffer
+ *
+ * The shadow batch buffer is unpinned and goes back to the pool of the
+ * vGPU, or is freed if the pool is full or it was never mapped. The caller
+ * must hold the struct_mutex.
+ */
+void intel_vgpu_put_shadow_bb(struct intel_vgpu *vgpu,
+			      struct intel_vgpu_shadow_bb *bb)
+{
+	struct intel_vgpu_submission *s = &vgpu->submission;
 
-	if (list_empty(&workload->shadow_bb))
+	lockdep_assert_held(&vgpu->gvt->dev_priv->drm.struct_mutex);
+
+	if (bb->accessing) {
+		i915_gem_obj_finish_shmem_access(bb->obj);
+		bb->accessing = false;
+	}
+
+	if (bb->vma && !IS_ERR(bb->vma))
+		i915_vma_unpin(bb->vma);
+
+	if (bb->cached) {
+		__i915_gem_object_release_unless_active(bb->obj);
+		kfree(bb);
 		return;
+	}
 
-	bb = list_first_entry(&workload->shadow_bb,
-			struct intel_vgpu_shadow_bb, list);
+	if (IS_ERR_OR_NULL(bb->va) ||
+	    s->shadow_bb_pool_count >= SHADOW_BB_POOL_MAX) {
+		free_shadow_bb(bb);
+		return;
+	}
 
-	mutex_lock(&dev_priv->drm.struct_mutex);
+	/* the object stays bound, it is pinned again on the next use */
+	if (!IS_ERR_OR_NULL(bb->vma))
+		bb->ggtt_vma = bb->vma;
+	bb->vma = NULL;
+	list_add(&bb->list, shadow_bb_pool_bucket(s, bb->obj->base.size));
+	s->shadow_bb_pool_count++;
+	atomic_inc(&vgpu->gvt->scheduler.shadow_bb_pooled);
+}
 
-	list_for_each_entry_safe(bb, pos, &workload->shadow_bb, list) {
-		if (bb->obj) {
-			if (bb->accessing)
-				i915_gem_obj_finish_shmem_access(bb->obj);
+static void clean_shadow_bb_pool(struct intel_vgpu *vgpu)
+{
+	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
+	struct intel_vgpu_submission *s = &vgpu->submission;
+	struct intel_vgpu_shadow_bb *bb, *pos;
+	int i;
 
-			if (bb->va && !IS_ERR(bb->va))
-				i915_gem_object_unpin_map(bb->obj);
+	mutex_lock(&dev_priv->drm.struct_mutex);
+	for (i = 0; i < ARRAY_SIZE(s->shadow_bb_pool); i++) {
+		list_for_each_entry_safe(bb, pos, &s->shadow_bb_pool[i], list) {
+			list_del(&bb->list);
+			free_shadow_bb(bb);
+		}
+	}
+	atomic_sub(s->shadow_bb_pool_count,
+		   &vgpu->gvt->scheduler.shadow_bb_pooled);
+	s->shadow_bb_pool_count = 0;
+	mutex_unlock(&dev_priv->drm.struct_mutex);
+}
 
-			if (bb->vma && !IS_ERR(bb->vma)) {
-				i915_vma_unpin(bb->vma);
-				i915_vma_close(bb->vma);
-			}
-			__i915_gem_object_release_unless_active(bb->obj);
+/*
+ * The pooled objects stay mapped, so the i915 shrinker can't take their
+ * pages back. Under memory pressure the pools are trimmed from a worker
+ * rather than in reclaim, which can't wait for struct_mutex: every vGPU
+ * gives up the older half of each bucket, so that a vGPU with a large
+ * pool doesn't keep it at the expense of the others. The worker unpins
+ * the shadow contexts of the idle rings as well.
+ */
+static void trim_shadow_bb_pool(struct intel_vgpu *vgpu)
+{
+	struct intel_vgpu_submission *s = &vgpu->submission;
+	struct intel_vgpu_shadow_bb *bb, *pos;
+	unsigned int n, i;
+
+	for (i = 0; i < ARRAY_SIZE(s->shadow_bb_pool); i++) {
+		n = 0;
+		list_for_each_entry(bb, &s->shadow_bb_pool[i], list)
+			n++;
+
+		/* the buckets are kept most recently used first */
+		n = DIV_ROUND_UP(n, 2);
+		list_for_each_entry_safe_reverse(bb, pos,
+						 &s->shadow_bb_pool[i], list) {
+			if (!n--)
+				break;
+			list_del(&bb->list);
+			free_shadow_bb(bb);
+			s->shadow_bb_pool_count--;
+			atomic_dec(&vgpu->gvt->scheduler.shadow_bb_pooled);
 		}
-		list_del(&bb->list);
-		kfree(bb);
 	}
+}
+
+static void shrink_work_func(struct work_struct *work)
+{
+	struct intel_gvt *gvt = container_of(work, struct intel_gvt,
+					     scheduler.shrink_work);
+	struct drm_i915_private *dev_priv = gvt->dev_priv;
+	struct intel_vgpu *vgpu;
+	int id;
+
+	mutex_lock(&gvt->lock);
+	idr_for_each_entry(&gvt->vgpu_idr, vgpu, id) {
+		mutex_lock(&vgpu->vgpu_lock);
+		mutex_lock(&dev_priv->drm.struct_mutex);
+		trim_shadow_bb_pool(vgpu);
+		unpin_idle_shadow_contexts(vgpu);
+		mutex_unlock(&dev_priv->drm.struct_mutex);
+		mutex_unlock(&vgpu->vgpu_lock);
+	}
+	mutex_unlock(&gvt->lock);
+}
+
+static unsigned long gvt_shrinker_count(struct shrinker *shrinker,
+					struct shrink_control *sc)
+{
+	struct intel_gvt_workload_scheduler *scheduler =
+		container_of(shrinker, struct intel_gvt_workload_scheduler,
+			     shrinker);
+
+	return atomic_read(&scheduler->shadow_bb_pooled) +
+	       atomic_read(&scheduler->shadow_ctx_pinned);
+}
+
+static unsigned long gvt_shrinker_scan(struct shrinker *shrinker,
+				       struct shrink_control *sc)
+{
+	struct intel_gvt_workload_scheduler *scheduler =
+		container_of(shrinker, struct intel_gvt_workload_scheduler,
+			     shrinker);
 
+	/* nothing is freed right away, the worker does it */
+	queue_work(system_unbound_wq, &scheduler->shrink_work);
+	return SHRINK_STOP;
+}
+
+/* Must be called with struct_mutex held. */
+static void __release_shadow_batch_buffer(struct intel_vgpu_workload *workload)
+{
+	struct intel_vgpu *vgpu = workload->vgpu;
+	struct intel_vgpu_shadow_bb *bb, *pos;
+
+	list_for_each_entry_safe(bb, pos, &workload->shadow_bb, list) {
+		list_del_init(&bb->list);
+		intel_vgpu_put_shadow_bb(vgpu, bb);
+	}
+	intel_gvt_release_direct_bbs(workload);
+}
+
+static void release_shadow_batch_buffer(struct intel_vgpu_workload *workload)
+{
+	struct drm_i915_private *dev_priv = workload->vgpu->gvt->dev_priv;
+
+	if (list_empty(&workload->shadow_bb) &&
+	    list_empty(&workload->direct_bb))
+		return;
+
+	mutex_lock(&dev_priv->drm.struct_mutex);
+	__release_shadow_batch_buffer(workload);
 	mutex_unlock(&dev_priv->drm.struct_mutex);
 }
 
-static int prepare_workload(struct intel_vgpu_workload *workload)
+/*
+ * Bring the shadow GTT of the workload in sync with the guest. The shadow
+ * page tables are protected by the vgpu_lock and only walk guest memory,
+ * so unlike the rest of the preparation this runs without struct_mutex.
+ */
+static int prepare_workload_mm(struct intel_vgpu_workload *workload)
 {
 	struct intel_vgpu *vgpu = workload->vgpu;
 	int ret = 0;
@@ -590,7 +1133,13 @@ static int prepare_workload(struct intel_vgpu_workload *workload)
 		return ret;
 	}
 
-	update_shadow_pdps(workload);
+	intel_vgpu_flush_ggtt(workload->vgpu);
+
+	ret = intel_vgpu_sync_pv_ppgtt(workload->vgpu);
+	if (ret) {
+		gvt_vgpu_err("fail to sync PV PPGTT updates\n");
+		goto err_unpin_mm;
+	}
 
 	ret = intel_vgpu_sync_oos_pages(workload->vgpu);
 	if (ret) {
@@ -604,16 +1153,29 @@ static int prepare_workload(struct intel_vgpu_workload *workload)
 		goto err_unpin_mm;
 	}
 
+	return 0;
+err_unpin_mm:
+	intel_vgpu_unpin_mm(workload->shadow_mm);
+	return ret;
+}
+
+static int prepare_workload(struct intel_vgpu_workload *workload)
+{
+	struct intel_vgpu *vgpu = workload->vgpu;
+	int ret = 0;
+
+	update_shadow_pdps(workload);
+
 	ret = intel_gvt_generate_request(workload);
 	if (ret) {
 		gvt_vgpu_err("fail to generate request\n");
-		goto err_unpin_mm;
+		return ret;
 	}
 
 	ret = prepare_shadow_batch_buffer(workload);
 	if (ret) {
 		gvt_vgpu_err("fail to prepare_shadow_batch_buffer\n");
-		goto err_unpin_mm;
+		return ret;
 	}
 
 	ret = prepare_shadow_wa_ctx(&workload->wa_ctx);
@@ -630,78 +1192,195 @@ static int prepare_workload(struct intel_vgpu_workload *workload)
 
 	return 0;
 err_shadow_wa_ctx:
-	release_shadow_wa_ctx(&workload->wa_ctx);
+	__release_shadow_wa_ctx(&workload->wa_ctx);
 err_shadow_batch:
-	release_shadow_batch_buffer(workload);
-err_unpin_mm:
-	intel_vgpu_unpin_mm(workload->shadow_mm);
+	__release_shadow_batch_buffer(workload);
 	return ret;
 }
 
+/* workloads queued behind the current one that make a vGPU boost the GT */
+#define GVT_WAITBOOST_DEPTH	2
+
+/*
+ * Time slicing hides from RPS how busy a vGPU is: each vGPU only keeps the
+ * engine busy in bursts, so the GT may stay at a low frequency while the
+ * guests miss their frames. Boost it like i915 does for the requests a
+ * client waits on, for interactive vGPUs and for vGPUs falling behind.
+ */
+static bool workload_wants_boost(struct intel_vgpu_workload *workload)
+{
+	struct intel_vgpu *vgpu = workload->vgpu;
+	struct list_head *pos;
+	int depth = 0;
+
+	if (vgpu->sched_ctl.latency == INTEL_VGPU_LATENCY_INTERACTIVE)
+		return true;
+
+	/* the current workload stays queued until it completes */
+	list_for_each(pos, workload_q_head(vgpu, workload->ring_id)) {
+		if (++depth > GVT_WAITBOOST_DEPTH)
+			return true;
+	}
+	return false;
+}
+
 static int dispatch_workload(struct intel_vgpu_workload *workload)
 {
 	struct intel_vgpu *vgpu = workload->vgpu;
-	struct intel_vgpu_submission *s = &vgpu->submission;
-	struct i915_gem_context *shadow_ctx = s->shadow_ctx;
 	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
 	int ring_id = workload->ring_id;
 	struct intel_engine_cs *engine = dev_priv->engine[ring_id];
+	u64 start, mm_ns;
 	int ret = 0;
 
 	gvt_dbg_sched("ring id %d prepare to dispatch workload %p\n",
 		ring_id, workload);
 
+	start = ktime_get_ns();
+	ret = prepare_workload_mm(workload);
+	if (ret) {
+		workload->status = ret;
+		return ret;
+	}
+	mm_ns = ktime_get_ns() - start;
+
 	mutex_lock(&dev_priv->drm.struct_mutex);
 
 	ret = intel_gvt_scan_and_shadow_workload(workload);
 	if (ret)
 		goto out;
 
-	ret = prepare_workload(workload);
-	if (ret) {
-		engine->context_unpin(engine, shadow_ctx);
-		goto out;
-	}
+	/* scan and shadow are accounted on their own */
+	start = ktime_get_ns();
 
+	ret = prepare_workload(workload);
 out:
-	if (ret)
+	if (ret) {
+		intel_vgpu_unpin_mm(workload->shadow_mm);
 		workload->status = ret;
+	}
 
 	if (!IS_ERR_OR_NULL(workload->req)) {
 		gvt_dbg_sched("ring id %d submit workload to i915 %p\n",
 				ring_id, workload->req);
 		i915_request_add(workload->req);
 		workload->dispatched = true;
+		workload->stamp[WORKLOAD_STAGE_DISPATCH] = ktime_get_ns();
+		intel_gvt_record(vgpu, INTEL_GVT_REC_DISPATCH, ring_id,
+				 workload->ctx_desc.context_id,
+				 workload->stamp[WORKLOAD_STAGE_CREATE]);
+
+		if (i915_modparams.enable_gvt_waitboost &&
+		    workload_wants_boost(workload)) {
+			bool boosted = READ_ONCE(workload->req->waitboost);
+
+			/*
+			 * Only count the boosts that took, not the ones of a
+			 * disabled RPS or of an already completed request.
+			 */
+			gen6_rps_boost(workload->req, NULL);
+			if (!boosted && READ_ONCE(workload->req->waitboost))
+				intel_vgpu_stat_inc(vgpu,
+						    INTEL_VGPU_STAT_WAITBOOST);
+		}
+
+		/* Exported dmabufs wait for it, see dmabuf_obj_attach_fence() */
+		dma_fence_put(rcu_dereference_protected(
+			xchg(&vgpu->submission.last_fence[ring_id],
+			     dma_fence_get(&workload->req->fence)), 1));
+
+		/* Get ahead of the workloads preempted on the engine. */
+		if (!list_empty(&vgpu->gvt->scheduler.preempted_q[ring_id]) &&
+		    engine->schedule)
+			engine->schedule(workload->req, INT_MAX);
 	}
 
+	if (!ret)
+		intel_vgpu_stat_add(vgpu, INTEL_VGPU_STAT_DISPATCH_NS,
+				    mm_ns + ktime_get_ns() - start);
 	mutex_unlock(&dev_priv->drm.struct_mutex);
 	return ret;
 }
 
+/*
+ * Return a preempted workload of the ring, preferring one whose request
+ * is done already.
+ */
+static struct intel_vgpu_workload *find_preempted_workload(
+		struct intel_gvt_workload_scheduler *scheduler, int ring_id,
+		bool completed)
+{
+	struct intel_vgpu_workload *workload;
+
+	list_for_each_entry(workload, &scheduler->preempted_q[ring_id],
+			    preempt_list) {
+		if (!completed || i915_request_completed(workload->req))
+			return workload;
+	}
+	return NULL;
+}
+
+/* Make a preempted workload current again, to wait for and complete it. */
+static void resume_preempted_workload(
+		struct intel_gvt_workload_scheduler *scheduler,
+		struct intel_vgpu_workload *workload)
+{
+	int ring_id = workload->ring_id;
+
+	gvt_dbg_sched("ring id %d resume preempted workload %p\n",
+		      ring_id, workload);
+
+	spin_lock_bh(&scheduler->mmio_context_lock);
+	list_del_init(&workload->preempt_list);
+	scheduler->current_workload[ring_id] = workload;
+	spin_unlock_bh(&scheduler->mmio_context_lock);
+}
+
+static void queue_scan_work(struct intel_vgpu *vgpu, int ring_id);
+
 static struct intel_vgpu_workload *pick_next_workload(
 		struct intel_gvt *gvt, int ring_id)
 {
 	struct intel_gvt_workload_scheduler *scheduler = &gvt->scheduler;
 	struct intel_vgpu_workload *workload = NULL;
 
-	mutex_lock(&gvt->lock);
+	mutex_lock(&gvt->sched_lock);
+
+	if (!scheduler->current_workload[ring_id]) {
+		workload = find_preempted_workload(scheduler, ring_id, true);
+		if (workload) {
+			resume_preempted_workload(scheduler, workload);
+			goto out;
+		}
+	}
 
 	/*
 	 * no current vgpu / will be scheduled out / no workload
 	 * bail out
 	 */
-	if (!scheduler->current_vgpu) {
+	if (!scheduler->current_vgpu[ring_id]) {
 		gvt_dbg_sched("ring id %d stop - no current vgpu\n", ring_id);
-		goto out;
+		goto out_preempted;
 	}
 
-	if (scheduler->need_reschedule) {
+	if (scheduler->need_reschedule[ring_id]) {
 		gvt_dbg_sched("ring id %d stop - will reschedule\n", ring_id);
-		goto out;
+		goto out_preempted;
 	}
 
-	if (list_empty(workload_q_head(scheduler->current_vgpu, ring_id)))
-		goto out;
+	if (scheduler->current_vgpu[ring_id]->resetting_eng &
+	    ENGINE_MASK(ring_id)) {
+		gvt_dbg_sched("ring id %d stop - engine reset\n", ring_id);
+		goto out_preempted;
+	}
+
+	if (list_empty(workload_q_head(scheduler->current_vgpu[ring_id],
+				       ring_id)))
+		goto out_preempted;
+
+	/* the head of the queue may be a workload being completed */
+	if (scheduler->current_vgpu[ring_id]->submission.completing[ring_id])
+		goto out_preempted;
 
 	/*
 	 * still have current workload, maybe the workload disptacher
@@ -714,69 +1393,176 @@ static struct intel_vgpu_workload *pick_next_workload(
 		goto out;
 	}
 
+	workload = container_of(
+			workload_q_head(scheduler->current_vgpu[ring_id],
+					ring_id)->next,
+			struct intel_vgpu_workload, list);
+
+	/* during post-copy the scan worker faults its pages in first */
+	if (workload->vgpu->postcopy && !workload->prefaulted &&
+	    list_empty(&workload->preempt_list)) {
+		queue_scan_work(workload->vgpu, ring_id);
+		workload = NULL;
+		goto out_preempted;
+	}
+
 	/*
 	 * pick a workload as current workload
 	 * once current workload is set, schedule policy routines
 	 * will wait the current workload is finished when trying to
 	 * schedule out a vgpu.
 	 */
-	scheduler->current_workload[ring_id] = container_of(
-			workload_q_head(scheduler->current_vgpu, ring_id)->next,
-			struct intel_vgpu_workload, list);
+	scheduler->current_workload[ring_id] = workload;
 
-	workload = scheduler->current_workload[ring_id];
+	/* the head of a vGPU queue may be one it got preempted in */
+	if (!list_empty(&workload->preempt_list)) {
+		resume_preempted_workload(scheduler, workload);
+		goto out;
+	}
 
 	gvt_dbg_sched("ring id %d pick new workload %p\n", ring_id, workload);
 
 	atomic_inc(&workload->vgpu->submission.running_workload_num);
+	atomic_inc(&workload->vgpu->submission.running_ring_workload_num[
+			ring_id]);
+	goto out;
+
+out_preempted:
+	/* Nothing else to run, wait for a preempted workload to finish. */
+	if (!scheduler->current_workload[ring_id]) {
+		workload = find_preempted_workload(scheduler, ring_id, false);
+		if (workload)
+			resume_preempted_workload(scheduler, workload);
+	}
 out:
-	mutex_unlock(&gvt->lock);
+	mutex_unlock(&gvt->sched_lock);
 	return workload;
 }
 
+/*
+ * Preempt the current workload of a ring at the end of its vGPU's time
+ * slice, if another vGPU waits for the ring. The workload stays queued in
+ * i915, which resubmits it after the workload of the next vGPU gets ahead
+ * of it, and it is completed once its request is done.
+ */
+static bool preempt_current_workload(struct intel_gvt *gvt, int ring_id)
+{
+	struct intel_gvt_workload_scheduler *scheduler = &gvt->scheduler;
+	struct intel_vgpu_workload *workload;
+	struct intel_vgpu *next;
+	bool preempted = false;
+
+	mutex_lock(&gvt->sched_lock);
+
+	workload = scheduler->current_workload[ring_id];
+	next = scheduler->next_vgpu[ring_id];
+	if (!workload || !scheduler->need_reschedule[ring_id] || !next ||
+	    next == gvt->idle_vgpu || next == workload->vgpu ||
+	    list_empty(workload_q_head(next, ring_id)))
+		goto out;
+
+	gvt_dbg_sched("ring id %d preempt workload %p of vgpu %d\n",
+		      ring_id, workload, workload->vgpu->id);
+
+	spin_lock_bh(&scheduler->mmio_context_lock);
+	list_add_tail(&workload->preempt_list, &scheduler->preempted_q[ring_id]);
+	scheduler->current_workload[ring_id] = NULL;
+	spin_unlock_bh(&scheduler->mmio_context_lock);
+
+	intel_gvt_request_service(gvt, INTEL_GVT_REQUEST_EVENT_SCHED);
+	preempted = true;
+out:
+	mutex_unlock(&gvt->sched_lock);
+	return preempted;
+}
+
+/* How often a running workload is checked for preemption, in jiffies. */
+#define GVT_PREEMPT_CHECK_PERIOD msecs_to_jiffies(1)
+
+static bool wait_workload(struct intel_gvt *gvt,
+			  struct intel_vgpu_workload *workload)
+{
+	if (!i915_modparams.enable_gvt_preemption ||
+	    !HAS_LOGICAL_RING_PREEMPTION(gvt->dev_priv)) {
+		i915_request_wait(workload->req, 0, MAX_SCHEDULE_TIMEOUT);
+		return true;
+	}
+
+	/*
+	 * The shadow context notifier wakes us up from the execlists tasklet
+	 * when the context is scheduled out, so poll the seqno on those and
+	 * on the preemption checks rather than adding and removing a
+	 * breadcrumb waiter every period.
+	 */
+	while (!wait_event_timeout(workload->shadow_ctx_status_wq,
+				   i915_request_completed(workload->req),
+				   GVT_PREEMPT_CHECK_PERIOD)) {
+		if (preempt_current_workload(gvt, workload->ring_id))
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Drop the context pages the GPU left unchanged since they were read in
+ * from the guest, so that only the modified pages get written back.
+ */
+static unsigned int skip_unchanged_context_pages(
+		struct intel_vgpu_workload *workload,
+		struct intel_gvt_gpa_buf *bufs, unsigned int count)
+{
+	void *snapshot = workload->vgpu->submission.ctx_snapshot[
+				workload->ring_id];
+	unsigned int i, n = 0;
+
+	if (!workload->ctx_snapshot)
+		return count;
+
+	for (i = 0; i < count; i++) {
+		if (!memcmp(bufs[i].buf, snapshot + i * I915_GTT_PAGE_SIZE,
+			    I915_GTT_PAGE_SIZE)) {
+			kunmap(kmap_to_page(bufs[i].buf));
+			continue;
+		}
+		bufs[n++] = bufs[i];
+	}
+	return n;
+}
+
 static void update_guest_context(struct intel_vgpu_workload *workload)
 {
 	struct intel_vgpu *vgpu = workload->vgpu;
-	struct intel_gvt *gvt = vgpu->gvt;
 	struct intel_vgpu_submission *s = &vgpu->submission;
 	struct i915_gem_context *shadow_ctx = s->shadow_ctx;
 	int ring_id = workload->ring_id;
 	struct drm_i915_gem_object *ctx_obj =
 		shadow_ctx->engine[ring_id].state->obj;
 	struct execlist_ring_context *shadow_ring_context;
+	struct intel_gvt_gpa_buf *bufs;
 	struct page *page;
-	void *src;
-	unsigned long context_gpa, context_page_num;
-	int i;
+	int count;
 
 	gvt_dbg_sched("ring id %d workload lrca %x\n", ring_id,
 			workload->ctx_desc.lrca);
 
-	context_page_num = gvt->dev_priv->engine[ring_id]->context_size;
-
-	context_page_num = context_page_num >> PAGE_SHIFT;
-
-	if (IS_BROADWELL(gvt->dev_priv) && ring_id == RCS)
-		context_page_num = 19;
+	bufs = kcalloc(context_page_num(workload), sizeof(*bufs), GFP_KERNEL);
+	if (!bufs) {
+		gvt_vgpu_err("fail to update guest context\n");
+		return;
+	}
 
-	i = 2;
+	count = map_context_pages(workload, bufs);
+	if (count < 0) {
+		kfree(bufs);
+		return;
+	}
 
-	while (i < context_page_num) {
-		context_gpa = intel_vgpu_gma_to_gpa(vgpu->gtt.ggtt_mm,
-				(u32)((workload->ctx_desc.lrca + i) <<
-					I915_GTT_PAGE_SHIFT));
-		if (context_gpa == INTEL_GVT_INVALID_ADDR) {
-			gvt_vgpu_err("invalid guest context descriptor\n");
-			return;
-		}
+	count = skip_unchanged_context_pages(workload, bufs, count);
+	if (intel_gvt_hypervisor_rw_gpa_bulk(vgpu, bufs, count, true))
+		gvt_vgpu_err("fail to write back guest context\n");
 
-		page = i915_gem_object_get_page(ctx_obj, LRC_HEADER_PAGES + i);
-		src = kmap(page);
-		intel_gvt_hypervisor_write_gpa(vgpu, context_gpa, src,
-				I915_GTT_PAGE_SIZE);
-		kunmap(page);
-		i++;
-	}
+	unmap_context_pages(bufs, count);
+	kfree(bufs);
 
 	intel_gvt_hypervisor_write_gpa(vgpu, workload->ring_context_gpa +
 		RING_CTX_OFF(ring_header.val), &workload->rb_tail, 4);
@@ -816,35 +1602,101 @@ static void clean_workloads(struct intel_vgpu *vgpu, unsigned long engine_mask)
 		list_for_each_entry_safe(pos, n,
 			&s->workload_q_head[engine->id], list) {
 			list_del_init(&pos->list);
+			if (!pos->dispatched) {
+				release_shadow_batch_buffer(pos);
+				release_shadow_wa_ctx(&pos->wa_ctx);
+			}
 			intel_vgpu_destroy_workload(pos);
 		}
-		clear_bit(engine->id, s->shadow_ctx_desc_updated);
 	}
 }
 
-static void complete_current_workload(struct intel_gvt *gvt, int ring_id)
+/*
+ * Account the time between every two stages of a completed workload in
+ * the latency histograms of its ring.
+ */
+static void update_workload_latency(struct intel_vgpu_workload *workload)
+{
+	struct intel_vgpu_submission *s = &workload->vgpu->submission;
+	struct intel_vgpu_workload_latency *latency =
+		&s->latency[workload->ring_id];
+	u64 *stamp = workload->stamp;
+	u64 us;
+	int i;
+
+	stamp[WORKLOAD_STAGE_COMPLETE] = ktime_get_ns();
+	intel_gvt_record(workload->vgpu, INTEL_GVT_REC_COMPLETE,
+			 workload->ring_id, workload->status,
+			 stamp[WORKLOAD_STAGE_CREATE]);
+
+	for (i = 0; i < WORKLOAD_STAGE_MAX; i++) {
+		if (!stamp[i])
+			return;
+	}
+
+	/* a workload may be shadowed before it is queued, e.g. on reuse */
+	for (i = 1; i < WORKLOAD_STAGE_MAX; i++) {
+		if (stamp[i] < stamp[i - 1])
+			stamp[i] = stamp[i - 1];
+		us = div_u64(stamp[i] - stamp[i - 1], NSEC_PER_USEC);
+		latency->hist[i - 1][min(fls64(us),
+					 GVT_LATENCY_BUCKETS - 1)]++;
+	}
+
+	trace_workload_latency(workload->vgpu->id, workload->ring_id, stamp);
+}
+
+/*
+ * Have the scan worker of the vGPU prepare the next workload of a ring, so
+ * that the ring threads only have to dispatch and the CPU side work of
+ * different vGPUs runs in parallel.
+ *
+ * The scan workqueue is unbound, so it runs the work on the node of the CPU
+ * it is queued from. That is the submitting vCPU, unless the work is
+ * steered to the GPU's node.
+ */
+static void queue_scan_work(struct intel_vgpu *vgpu, int ring_id)
+{
+	struct intel_gvt *gvt = vgpu->gvt;
+	int cpu = nr_cpu_ids;
+
+	set_bit(ring_id, vgpu->submission.scan_pending);
+
+	if (!i915_modparams.gvt_scan_on_vcpu_node &&
+	    gvt->numa_node != NUMA_NO_NODE)
+		cpu = cpumask_any_and(cpumask_of_node(gvt->numa_node),
+				      cpu_online_mask);
+
+	if (cpu < nr_cpu_ids)
+		queue_work_on(cpu, gvt->scheduler.scan_wq,
+			      &vgpu->submission.scan_work);
+	else
+		queue_work(gvt->scheduler.scan_wq,
+			   &vgpu->submission.scan_work);
+}
+
+static void complete_workload(struct intel_gvt *gvt,
+			      struct intel_vgpu_workload *workload)
 {
 	struct intel_gvt_workload_scheduler *scheduler = &gvt->scheduler;
-	struct intel_vgpu_workload *workload =
-		scheduler->current_workload[ring_id];
 	struct intel_vgpu *vgpu = workload->vgpu;
 	struct intel_vgpu_submission *s = &vgpu->submission;
+	int ring_id = workload->ring_id;
+	u64 start;
 	int event;
 
-	mutex_lock(&gvt->lock);
+	mutex_lock(&vgpu->vgpu_lock);
+	mutex_lock(&gvt->sched_lock);
+	start = ktime_get_ns();
 
-	/* For the workload w/ request, needs to wait for the context
-	 * switch to make sure request is completed.
-	 * For the workload w/o request, directly complete the workload.
+	list_del_init(&workload->complete_list);
+	s->completing[ring_id]--;
+
+	/* For the workload w/ request, the context switch was waited for by
+	 * the workload thread. For the workload w/o request, directly
+	 * complete the workload.
 	 */
 	if (workload->req) {
-		struct drm_i915_private *dev_priv =
-			workload->vgpu->gvt->dev_priv;
-		struct intel_engine_cs *engine =
-			dev_priv->engine[workload->ring_id];
-		wait_event(workload->shadow_ctx_status_wq,
-			   !atomic_read(&workload->shadow_ctx_active));
-
 		/* If this request caused GPU hang, req->fence.error will
 		 * be set to -EIO. Use -EIO to set workload status so
 		 * that when this request caused GPU hang, didn't trigger
@@ -857,6 +1709,19 @@ static void complete_current_workload(struct intel_gvt *gvt, int ring_id)
 				workload->status = 0;
 		}
 
+		/*
+		 * Only the guilty request of a reset is failed, the other
+		 * vGPUs' requests are replayed. The hung vGPU sees a hang
+		 * of its own ring and recovers it with a virtual engine
+		 * reset, see clean_workloads() below.
+		 */
+		if (workload->status == -EIO) {
+			gvt_vgpu_err("hung ring %d, workload %p\n",
+				     ring_id, workload);
+			intel_gvt_record(vgpu, INTEL_GVT_REC_HANG, ring_id,
+					 workload->ctx_desc.lrca, 0);
+		}
+
 		i915_request_put(fetch_and_zero(&workload->req));
 
 		if (!workload->status && !(vgpu->resetting_eng &
@@ -867,22 +1732,19 @@ static void complete_current_workload(struct intel_gvt *gvt, int ring_id)
 					 INTEL_GVT_EVENT_MAX)
 				intel_vgpu_trigger_virtual_event(vgpu, event);
 		}
-		mutex_lock(&dev_priv->drm.struct_mutex);
-		/* unpin shadow ctx as the shadow_ctx update is done */
-		engine->context_unpin(engine, s->shadow_ctx);
-		mutex_unlock(&dev_priv->drm.struct_mutex);
 	}
 
 	gvt_dbg_sched("ring id %d complete workload %p status %d\n",
 			ring_id, workload, workload->status);
 
-	scheduler->current_workload[ring_id] = NULL;
-
 	list_del_init(&workload->list);
 
 	if (!workload->status) {
 		release_shadow_batch_buffer(workload);
 		release_shadow_wa_ctx(&workload->wa_ctx);
+	} else {
+		/* don't leave the guest pages write protected */
+		intel_gvt_release_direct_bbs(workload);
 	}
 
 	if (workload->status || (vgpu->resetting_eng & ENGINE_MASK(ring_id))) {
@@ -900,17 +1762,84 @@ static void complete_current_workload(struct intel_gvt *gvt, int ring_id)
 		 * the workload clean up here doesn't have any impact.
 		 **/
 		clean_workloads(vgpu, ENGINE_MASK(ring_id));
+	} else {
+		update_workload_latency(workload);
+		/* shadow the new head while this ring serves other vGPUs */
+		if (!list_empty(workload_q_head(vgpu, ring_id)))
+			queue_scan_work(vgpu, ring_id);
 	}
 
 	workload->complete(workload);
+	intel_vgpu_update_pv_timestamp(vgpu);
 
+	atomic_dec(&s->running_ring_workload_num[ring_id]);
 	atomic_dec(&s->running_workload_num);
 	wake_up(&scheduler->workload_complete_wq);
+	/* the ring may wait for this vGPU's next workload */
+	wake_up(&scheduler->waitq[ring_id]);
 
-	if (gvt->scheduler.need_reschedule)
+	/*
+	 * Give the ring away now rather than at the next tick if it waits
+	 * for a switch, or if this vGPU has nothing more to run on it.
+	 */
+	if (gvt->scheduler.need_reschedule[ring_id] ||
+	    list_empty(workload_q_head(vgpu, ring_id)))
 		intel_gvt_request_service(gvt, INTEL_GVT_REQUEST_EVENT_SCHED);
 
-	mutex_unlock(&gvt->lock);
+	intel_vgpu_stat_add(vgpu, INTEL_VGPU_STAT_COMPLETE_NS,
+			    ktime_get_ns() - start);
+	mutex_unlock(&gvt->sched_lock);
+	mutex_unlock(&vgpu->vgpu_lock);
+}
+
+/*
+ * Workloads are completed, i.e. their guest context written back and
+ * their context switch emulated to the guest, by a worker so that the
+ * workload thread can dispatch the next workload of the ring right away.
+ * The next workload of the same vGPU on the ring isn't picked before the
+ * completion, which keeps the guest visible order. A single work item
+ * serves all the rings, completions of a ring are done in order.
+ */
+static void complete_work_func(struct work_struct *work)
+{
+	struct intel_gvt_workload_scheduler *scheduler =
+		container_of(work, struct intel_gvt_workload_scheduler,
+			     complete_work);
+	struct intel_gvt *gvt =
+		container_of(scheduler, struct intel_gvt, scheduler);
+	struct intel_vgpu_workload *workload;
+	int ring_id;
+
+	for (ring_id = 0; ring_id < I915_NUM_ENGINES; ring_id++) {
+		for (;;) {
+			mutex_lock(&gvt->sched_lock);
+			workload = list_first_entry_or_null(
+					&scheduler->complete_q[ring_id],
+					struct intel_vgpu_workload,
+					complete_list);
+			mutex_unlock(&gvt->sched_lock);
+			if (!workload)
+				break;
+
+			complete_workload(gvt, workload);
+		}
+	}
+}
+
+static void queue_workload_completion(struct intel_gvt *gvt, int ring_id)
+{
+	struct intel_gvt_workload_scheduler *scheduler = &gvt->scheduler;
+	struct intel_vgpu_workload *workload;
+
+	mutex_lock(&gvt->sched_lock);
+	workload = scheduler->current_workload[ring_id];
+	scheduler->current_workload[ring_id] = NULL;
+	workload->vgpu->submission.completing[ring_id]++;
+	list_add_tail(&workload->complete_list,
+		      &scheduler->complete_q[ring_id]);
+	mutex_unlock(&gvt->sched_lock);
+
+	queue_work(system_highpri_wq, &scheduler->complete_work);
 }
 
 struct workload_thread_param {
@@ -962,9 +1891,16 @@ static int workload_thread(void *priv)
 			intel_uncore_forcewake_get(gvt->dev_priv,
 					FORCEWAKE_ALL);
 
-		mutex_lock(&gvt->lock);
+		/* a preempted workload is in i915 already */
+		ret = 0;
+		if (workload->dispatched)
+			goto wait;
+
+		mutex_lock(&workload->vgpu->vgpu_lock);
+		memalloc_use_memcg(workload->vgpu->memcg);
 		ret = dispatch_workload(workload);
-		mutex_unlock(&gvt->lock);
+		memalloc_unuse_memcg();
+		mutex_unlock(&workload->vgpu->vgpu_lock);
 
 		if (ret) {
 			vgpu = workload->vgpu;
@@ -972,16 +1908,31 @@ static int workload_thread(void *priv)
 			goto complete;
 		}
 
+		if (i915_modparams.enable_gvt_prefetch)
+			queue_scan_work(workload->vgpu, ring_id);
+
+wait:
 		gvt_dbg_sched("ring id %d wait workload %p\n",
 				workload->ring_id, workload);
-		i915_request_wait(workload->req, 0, MAX_SCHEDULE_TIMEOUT);
+		if (!wait_workload(gvt, workload))
+			goto put;
 
 complete:
 		gvt_dbg_sched("will complete workload %p, status: %d\n",
 				workload, workload->status);
 
-		complete_current_workload(gvt, ring_id);
+		/*
+		 * The context switch notification may come after the request
+		 * is completed, it has to find the workload as the current
+		 * one of the ring.
+		 */
+		if (workload->req)
+			wait_event(workload->shadow_ctx_status_wq,
+				   !atomic_read(&workload->shadow_ctx_active));
+
+		queue_workload_completion(gvt, ring_id);
 
+put:
 		if (need_force_wake)
 			intel_uncore_forcewake_put(gvt->dev_priv,
 					FORCEWAKE_ALL);
@@ -1007,6 +1958,31 @@ void intel_gvt_wait_vgpu_idle(struct intel_vgpu *vgpu)
 	}
 }
 
+/**
+ * intel_gvt_wait_vgpu_engines_idle - wait for the workloads of some engines
+ * @vgpu: a vGPU
+ * @engine_mask: engines to wait for
+ *
+ * Unlike intel_gvt_wait_vgpu_idle(), the workloads of the vGPU running on
+ * other engines are left alone.
+ *
+ */
+void intel_gvt_wait_vgpu_engines_idle(struct intel_vgpu *vgpu,
+				      unsigned long engine_mask)
+{
+	struct intel_vgpu_submission *s = &vgpu->submission;
+	struct intel_gvt_workload_scheduler *scheduler =
+		&vgpu->gvt->scheduler;
+	int ring_id;
+
+	for_each_set_bit(ring_id, &engine_mask, I915_NUM_ENGINES) {
+		gvt_dbg_sched("wait vgpu ring id %d idle\n", ring_id);
+
+		wait_event(scheduler->workload_complete_wq,
+			   !atomic_read(&s->running_ring_workload_num[ring_id]));
+	}
+}
+
 void intel_gvt_clean_workload_scheduler(struct intel_gvt *gvt)
 {
 	struct intel_gvt_workload_scheduler *scheduler = &gvt->scheduler;
@@ -1021,6 +1997,16 @@ void intel_gvt_clean_workload_scheduler(struct intel_gvt *gvt)
 					&gvt->shadow_ctx_notifier_block[i]);
 		kthread_stop(scheduler->thread[i]);
 	}
+
+	flush_work(&scheduler->complete_work);
+
+	unregister_shrinker(&scheduler->shrinker);
+	cancel_work_sync(&scheduler->shrink_work);
+
+	if (scheduler->scan_wq) {
+		destroy_workqueue(scheduler->scan_wq);
+		scheduler->scan_wq = NULL;
+	}
 }
 
 int intel_gvt_init_workload_scheduler(struct intel_gvt *gvt)
@@ -1035,8 +2021,21 @@ int intel_gvt_init_workload_scheduler(struct intel_gvt *gvt)
 
 	init_waitqueue_head(&scheduler->workload_complete_wq);
 
+	for (i = 0; i < I915_NUM_ENGINES; i++)
+		INIT_LIST_HEAD(&scheduler->complete_q[i]);
+	INIT_WORK(&scheduler->complete_work, complete_work_func);
+	INIT_WORK(&scheduler->shrink_work, shrink_work_func);
+	atomic_set(&scheduler->shadow_bb_pooled, 0);
+	atomic_set(&scheduler->shadow_ctx_pinned, 0);
+
+	scheduler->scan_wq = alloc_workqueue("gvt_scan", WQ_UNBOUND,
+					     num_online_cpus());
+	if (!scheduler->scan_wq)
+		return -ENOMEM;
+
 	for_each_engine(engine, gvt->dev_priv, i) {
 		init_waitqueue_head(&scheduler->waitq[i]);
+		INIT_LIST_HEAD(&scheduler->preempted_q[i]);
 
 		param = kzalloc(sizeof(*param), GFP_KERNEL);
 		if (!param) {
@@ -1047,19 +2046,27 @@ int intel_gvt_init_workload_scheduler(struct intel_gvt *gvt)
 		param->gvt = gvt;
 		param->ring_id = i;
 
-		scheduler->thread[i] = kthread_run(workload_thread, param,
-			"gvt workload %d", i);
+		scheduler->thread[i] = kthread_create_on_node(workload_thread,
+			param, gvt->numa_node, "gvt workload %d", i);
 		if (IS_ERR(scheduler->thread[i])) {
 			gvt_err("fail to create workload thread\n");
 			ret = PTR_ERR(scheduler->thread[i]);
 			goto err;
 		}
+		intel_gvt_start_thread(gvt, scheduler->thread[i], i);
 
 		gvt->shadow_ctx_notifier_block[i].notifier_call =
 					shadow_context_status_change;
 		atomic_notifier_chain_register(&engine->context_status_notifier,
 					&gvt->shadow_ctx_notifier_block[i]);
 	}
+
+	scheduler->shrinker.count_objects = gvt_shrinker_count;
+	scheduler->shrinker.scan_objects = gvt_shrinker_scan;
+	scheduler->shrinker.seeks = DEFAULT_SEEKS;
+	ret = register_shrinker(&scheduler->shrinker);
+	if (ret)
+		goto err;
 	return 0;
 err:
 	intel_gvt_clean_workload_scheduler(gvt);
@@ -1078,8 +2085,20 @@ int intel_gvt_init_workload_scheduler(struct intel_gvt *gvt)
 void intel_vgpu_clean_submission(struct intel_vgpu *vgpu)
 {
 	struct intel_vgpu_submission *s = &vgpu->submission;
+	int i;
 
 	intel_vgpu_select_submission_ops(vgpu, ALL_ENGINES, 0);
+	unpin_shadow_contexts(vgpu);
+	intel_vgpu_clean_bb_scan_cache(vgpu);
+	intel_vgpu_clean_captures(vgpu);
+	clean_shadow_bb_pool(vgpu);
+	for (i = 0; i < ARRAY_SIZE(s->ctx_snapshot); i++) {
+		vfree(s->ctx_snapshot[i]);
+		s->ctx_snapshot[i] = NULL;
+	}
+	for (i = 0; i < ARRAY_SIZE(s->last_fence); i++)
+		dma_fence_put(rcu_dereference_protected(
+			xchg(&s->last_fence[i], NULL), 1));
 	i915_gem_context_put(s->shadow_ctx);
 	kmem_cache_destroy(s->workloads);
 }
@@ -1101,10 +2120,131 @@ void intel_vgpu_reset_submission(struct intel_vgpu *vgpu,
 	if (!s->active)
 		return;
 
+	/* scanned batch buffers stay valid as long as the PPGTT does */
+	if (engine_mask == ALL_ENGINES)
+		intel_vgpu_clean_bb_scan_cache(vgpu);
 	clean_workloads(vgpu, engine_mask);
 	s->ops->reset(vgpu, engine_mask);
 }
 
+static void elsp_work_func(struct work_struct *work)
+{
+	struct intel_vgpu_submission *s =
+		container_of(work, struct intel_vgpu_submission, elsp_work);
+	struct intel_vgpu *vgpu =
+		container_of(s, struct intel_vgpu, submission);
+
+	mutex_lock(&vgpu->vgpu_lock);
+	memalloc_use_memcg(vgpu->memcg);
+	intel_vgpu_flush_elsp(vgpu);
+	memalloc_unuse_memcg();
+	mutex_unlock(&vgpu->vgpu_lock);
+}
+
+/*
+ * During the post-copy phase of a migration, guest pages which didn't
+ * arrive yet are fetched from the source by the VMM when touched, and
+ * touching them blocks until then. Fault in the context and ring pages of
+ * a workload before struct_mutex is taken, so that such a wait only holds
+ * up this vGPU; pick_next_workload() doesn't dispatch it before.
+ */
+static void prefault_workload(struct intel_vgpu_workload *workload)
+{
+	struct intel_vgpu *vgpu = workload->vgpu;
+	struct intel_vgpu_mm *mm = vgpu->gtt.ggtt_mm;
+	unsigned long size = _RING_CTL_BUF_SIZE(workload->rb_ctl);
+	unsigned long offset, gpa, i, n;
+	u8 byte;
+
+	for (i = 0; i < context_page_num(workload); i++) {
+		gpa = intel_vgpu_gma_to_gpa(mm,
+				(u32)((workload->ctx_desc.lrca + i) <<
+				I915_GTT_PAGE_SHIFT));
+		if (gpa != INTEL_GVT_INVALID_ADDR)
+			intel_gvt_hypervisor_read_gpa(vgpu, gpa, &byte, 1);
+	}
+
+	offset = workload->rb_head & I915_GTT_PAGE_MASK;
+	n = DIV_ROUND_UP(offset_in_page(workload->rb_head) +
+			 intel_gvt_ring_buffer_len(workload),
+			 I915_GTT_PAGE_SIZE);
+	for (i = 0; i < n; i++) {
+		gpa = intel_vgpu_gma_to_gpa(mm, workload->rb_start + offset);
+		if (gpa != INTEL_GVT_INVALID_ADDR)
+			intel_gvt_hypervisor_read_gpa(vgpu, gpa, &byte, 1);
+		offset = (offset + I915_GTT_PAGE_SIZE) % size;
+	}
+
+	workload->prefaulted = true;
+}
+
+static void scan_work_func(struct work_struct *work)
+{
+	struct intel_vgpu_submission *s =
+		container_of(work, struct intel_vgpu_submission, scan_work);
+	struct intel_vgpu *vgpu =
+		container_of(s, struct intel_vgpu, submission);
+	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
+	struct intel_vgpu_workload *workload;
+	struct list_head *q;
+	bool head;
+	int ring_id;
+
+	mutex_lock(&vgpu->vgpu_lock);
+	/* charge what is shadowed here to the VM, not to the kworker */
+	memalloc_use_memcg(vgpu->memcg);
+	for_each_set_bit(ring_id, s->scan_pending, I915_NUM_ENGINES) {
+		clear_bit(ring_id, s->scan_pending);
+
+		q = workload_q_head(vgpu, ring_id);
+		if (!s->active || list_empty(q))
+			continue;
+
+		/*
+		 * Only the first workload in the queue can be shadowed, as
+		 * there is only one ring scan buffer per ring. Once it is
+		 * dispatched, its shadow context image is still in use, so
+		 * only the commands of the one behind it are scanned. A scan
+		 * error is reported again when the workload is dispatched.
+		 */
+		workload = container_of(q->next,
+				struct intel_vgpu_workload, list);
+		head = !workload->dispatched;
+		if (!head) {
+			if (!i915_modparams.enable_gvt_prefetch ||
+			    list_is_last(&workload->list, q))
+				continue;
+			workload = list_next_entry(workload, list);
+		}
+
+		if (vgpu->postcopy && !workload->prefaulted)
+			prefault_workload(workload);
+
+		intel_runtime_pm_get(dev_priv);
+		mutex_lock(&dev_priv->drm.struct_mutex);
+		if (head)
+			intel_gvt_scan_and_shadow_workload(workload);
+		else
+			scan_workload(workload);
+		mutex_unlock(&dev_priv->drm.struct_mutex);
+		intel_runtime_pm_put(dev_priv);
+
+		/* a ring may be waiting for the pages of this workload */
+		if (vgpu->postcopy)
+			wake_up(&vgpu->gvt->scheduler.waitq[ring_id]);
+	}
+	memalloc_unuse_memcg();
+	mutex_unlock(&vgpu->vgpu_lock);
+}
+
+static void workload_ctor(void *p)
+{
+	struct intel_vgpu_workload *workload = p;
+
+	atomic_set(&workload->shadow_ctx_active, 0);
+	init_waitqueue_head(&workload->shadow_ctx_status_wq);
+}
+
 /**
  * intel_vgpu_setup_submission - setup submission-related resource for vGPU
  * @vgpu: a vGPU
@@ -1127,17 +2267,25 @@ int intel_vgpu_setup_submission(struct intel_vgpu *vgpu)
 	if (IS_ERR(s->shadow_ctx))
 		return PTR_ERR(s->shadow_ctx);
 
+	/* attribute hangs and error states of the context to the vGPU */
+	s->shadow_ctx->name = kasprintf(GFP_KERNEL, "gvt-vgpu%d", vgpu->id);
+
+	/*
+	 * Leave room above the vGPU contexts for a vGPU to preempt another
+	 * one at the end of its time slice.
+	 */
 	if (HAS_LOGICAL_RING_PREEMPTION(vgpu->gvt->dev_priv))
-		s->shadow_ctx->priority = INT_MAX;
+		s->shadow_ctx->priority = i915_modparams.enable_gvt_preemption ?
+					  INT_MAX - 1 : INT_MAX;
 
-	bitmap_zero(s->shadow_ctx_desc_updated, I915_NUM_ENGINES);
+	bitmap_zero(s->shadow_ctx_pinned, I915_NUM_ENGINES);
 
 	s->workloads = kmem_cache_create_usercopy("gvt-g_vgpu_workload",
 						  sizeof(struct intel_vgpu_workload), 0,
-						  SLAB_HWCACHE_ALIGN,
+						  SLAB_HWCACHE_ALIGN | SLAB_ACCOUNT,
 						  offsetof(struct intel_vgpu_workload, rb_tail),
 						  sizeof_field(struct intel_vgpu_workload, rb_tail),
-						  NULL);
+						  workload_ctor);
 
 	if (!s->workloads) {
 		ret = -ENOMEM;
@@ -1147,8 +2295,28 @@ int intel_vgpu_setup_submission(struct intel_vgpu *vgpu)
 	for_each_engine(engine, vgpu->gvt->dev_priv, i)
 		INIT_LIST_HEAD(&s->workload_q_head[i]);
 
+	for (i = 0; i < ARRAY_SIZE(s->shadow_bb_pool); i++)
+		INIT_LIST_HEAD(&s->shadow_bb_pool[i]);
+	s->shadow_bb_pool_count = 0;
+
+	hash_init(s->bb_scan_cache);
+	s->bb_scan_cache_count = 0;
+	INIT_LIST_HEAD(&s->wa_ctx_cache);
+	s->wa_ctx_cache_count = 0;
+	hash_init(s->direct_bb_pages);
+
+	INIT_LIST_HEAD(&s->captures);
+	s->capture_remaining = 0;
+
 	atomic_set(&s->running_workload_num, 0);
-	bitmap_zero(s->tlb_handle_pending, I915_NUM_ENGINES);
+	for (i = 0; i < I915_NUM_ENGINES; i++)
+		atomic_set(&s->running_ring_workload_num[i], 0);
+	bitmap_zero(s->elsp_pending, I915_NUM_ENGINES);
+	INIT_WORK(&s->elsp_work, elsp_work_func);
+	bitmap_zero(s->scan_pending, I915_NUM_ENGINES);
+	INIT_WORK(&s->scan_work, scan_work_func);
+	s->fence_context = dma_fence_context_alloc(1);
+	s->fence_seqno = 0;
 
 	return 0;
 
@@ -1233,40 +2401,41 @@ alloc_workload(struct intel_vgpu *vgpu)
 	struct intel_vgpu_submission *s = &vgpu->submission;
 	struct intel_vgpu_workload *workload;
 
-	workload = kmem_cache_zalloc(s->workloads, GFP_KERNEL);
+	workload = kmem_cache_alloc_node(s->workloads, GFP_KERNEL,
+					 vgpu->gvt->numa_node);
 	if (!workload)
 		return ERR_PTR(-ENOMEM);
 
+	memset(workload, 0,
+	       offsetof(struct intel_vgpu_workload, shadow_ctx_active));
+
 	INIT_LIST_HEAD(&workload->list);
+	INIT_LIST_HEAD(&workload->preempt_list);
+	INIT_LIST_HEAD(&workload->complete_list);
 	INIT_LIST_HEAD(&workload->shadow_bb);
-
-	init_waitqueue_head(&workload->shadow_ctx_status_wq);
-	atomic_set(&workload->shadow_ctx_active, 0);
+	INIT_LIST_HEAD(&workload->direct_bb);
 
 	workload->status = -EINPROGRESS;
 	workload->shadowed = false;
+	workload->prefaulted = false;
 	workload->vgpu = vgpu;
+	workload->stamp[WORKLOAD_STAGE_CREATE] = ktime_get_ns();
 
 	return workload;
 }
 
-#define RING_CTX_OFF(x) \
-	offsetof(struct execlist_ring_context, x)
-
-static void read_guest_pdps(struct intel_vgpu *vgpu,
-		u64 ring_context_gpa, u32 pdp[8])
+static void get_guest_pdps(const struct execlist_ring_context *ring_context,
+		u32 pdp[8])
 {
-	u64 gpa;
+	const struct execlist_mmio_pair *pair = &ring_context->pdp3_UDW;
 	int i;
 
-	gpa = ring_context_gpa + RING_CTX_OFF(pdp3_UDW.val);
-
 	for (i = 0; i < 8; i++)
-		intel_gvt_hypervisor_read_gpa(vgpu,
-				gpa + i * 8, &pdp[7 - i], 4);
+		pdp[7 - i] = pair[i].val;
 }
 
-static int prepare_mm(struct intel_vgpu_workload *workload)
+static int prepare_mm(struct intel_vgpu_workload *workload,
+		const struct execlist_ring_context *ring_context)
 {
 	struct execlist_ctx_descriptor_format *desc = &workload->ctx_desc;
 	struct intel_vgpu_mm *mm;
@@ -1286,7 +2455,7 @@ static int prepare_mm(struct intel_vgpu_workload *workload)
 		return -EINVAL;
 	}
 
-	read_guest_pdps(workload->vgpu, workload->ring_context_gpa, (void *)pdps);
+	get_guest_pdps(ring_context, (void *)pdps);
 
 	mm = intel_vgpu_get_ppgtt_mm(workload->vgpu, root_entry_type, pdps);
 	if (IS_ERR(mm))
@@ -1322,9 +2491,9 @@ intel_vgpu_create_workload(struct intel_vgpu *vgpu, int ring_id,
 	struct list_head *q = workload_q_head(vgpu, ring_id);
 	struct intel_vgpu_workload *last_workload = get_last_workload(q);
 	struct intel_vgpu_workload *workload = NULL;
-	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
+	struct execlist_ring_context ring_context;
 	u64 ring_context_gpa;
-	u32 head, tail, start, ctl, ctx_ctl, per_ctx, indirect_ctx;
+	u32 head, tail, start, ctl, per_ctx, indirect_ctx;
 	int ret;
 
 	ring_context_gpa = intel_vgpu_gma_to_gpa(vgpu->gtt.ggtt_mm,
@@ -1334,14 +2503,16 @@ intel_vgpu_create_workload(struct intel_vgpu *vgpu, int ring_id,
 		return ERR_PTR(-EINVAL);
 	}
 
-	intel_gvt_hypervisor_read_gpa(vgpu, ring_context_gpa +
-			RING_CTX_OFF(ring_header.val), &head, 4);
-
-	intel_gvt_hypervisor_read_gpa(vgpu, ring_context_gpa +
-			RING_CTX_OFF(ring_tail.val), &tail, 4);
+	/* the ring context header sits at the start of a page, read it once */
+	ret = intel_gvt_hypervisor_read_gpa(vgpu, ring_context_gpa,
+			&ring_context, sizeof(ring_context));
+	if (ret) {
+		gvt_vgpu_err("fail to read guest ring context\n");
+		return ERR_PTR(ret);
+	}
 
-	head &= RB_HEAD_OFF_MASK;
-	tail &= RB_TAIL_OFF_MASK;
+	head = ring_context.ring_header.val & RB_HEAD_OFF_MASK;
+	tail = ring_context.ring_tail.val & RB_TAIL_OFF_MASK;
 
 	if (last_workload && same_context(&last_workload->ctx_desc, desc)) {
 		gvt_dbg_el("ring id %d cur workload == last\n", ring_id);
@@ -1357,12 +2528,8 @@ intel_vgpu_create_workload(struct intel_vgpu *vgpu, int ring_id,
 	gvt_dbg_el("ring id %d begin a new workload\n", ring_id);
 
 	/* record some ring buffer register values for scan and shadow */
-	intel_gvt_hypervisor_read_gpa(vgpu, ring_context_gpa +
-			RING_CTX_OFF(rb_start.val), &start, 4);
-	intel_gvt_hypervisor_read_gpa(vgpu, ring_context_gpa +
-			RING_CTX_OFF(rb_ctrl.val), &ctl, 4);
-	intel_gvt_hypervisor_read_gpa(vgpu, ring_context_gpa +
-			RING_CTX_OFF(ctx_ctrl.val), &ctx_ctl, 4);
+	start = ring_context.rb_start.val;
+	ctl = ring_context.rb_ctrl.val;
 
 	workload = alloc_workload(vgpu);
 	if (IS_ERR(workload))
@@ -1377,10 +2544,8 @@ intel_vgpu_create_workload(struct intel_vgpu *vgpu, int ring_id,
 	workload->rb_ctl = ctl;
 
 	if (ring_id == RCS) {
-		intel_gvt_hypervisor_read_gpa(vgpu, ring_context_gpa +
-			RING_CTX_OFF(bb_per_ctx_ptr.val), &per_ctx, 4);
-		intel_gvt_hypervisor_read_gpa(vgpu, ring_context_gpa +
-			RING_CTX_OFF(rcs_indirect_ctx.val), &indirect_ctx, 4);
+		per_ctx = ring_context.bb_per_ctx_ptr.val;
+		indirect_ctx = ring_context.rcs_indirect_ctx.val;
 
 		workload->wa_ctx.indirect_ctx.guest_gma =
 			indirect_ctx & INDIRECT_CTX_ADDR_MASK;
@@ -1395,29 +2560,12 @@ intel_vgpu_create_workload(struct intel_vgpu *vgpu, int ring_id,
 	gvt_dbg_el("workload %p ring id %d head %x tail %x start %x ctl %x\n",
 			workload, ring_id, head, tail, start, ctl);
 
-	ret = prepare_mm(workload);
+	ret = prepare_mm(workload, &ring_context);
 	if (ret) {
 		kmem_cache_free(s->workloads, workload);
 		return ERR_PTR(ret);
 	}
 
-	/* Only scan and shadow the first workload in the queue
-	 * as there is only one pre-allocated buf-obj for shadow.
-	 */
-	if (list_empty(workload_q_head(vgpu, ring_id))) {
-		intel_runtime_pm_get(dev_priv);
-		mutex_lock(&dev_priv->drm.struct_mutex);
-		ret = intel_gvt_scan_and_shadow_workload(workload);
-		mutex_unlock(&dev_priv->drm.struct_mutex);
-		intel_runtime_pm_put(dev_priv);
-	}
-
-	if (ret && (vgpu_is_vm_unhealthy(ret))) {
-		enter_failsafe_mode(vgpu, GVT_FAILSAFE_GUEST_ERR);
-		intel_vgpu_destroy_workload(workload);
-		return ERR_PTR(ret);
-	}
-
 	return workload;
 }
 
@@ -1427,8 +2575,22 @@ intel_vgpu_create_workload(struct intel_vgpu *vgpu, int ring_id,
  */
 void intel_vgpu_queue_workload(struct intel_vgpu_workload *workload)
 {
-	list_add_tail(&workload->list,
-		workload_q_head(workload->vgpu, workload->ring_id));
+	struct intel_vgpu *vgpu = workload->vgpu;
+	struct list_head *q = workload_q_head(vgpu, workload->ring_id);
+
+	/*
+	 * Scan and shadow the first workload of a ring from the scan
+	 * workqueue, so that the vCPU doesn't wait for it and the scans of
+	 * different vGPUs can run on different host cores.
+	 */
+	if (list_empty(q) && !workload->shadowed) {
+		queue_scan_work(vgpu, workload->ring_id);
+	}
+
+	/* GPU rendering into the displayed surface can't be bounded */
+	intel_vgpu_fb_damage_full(vgpu);
+
+	list_add_tail(&workload->list, q);
 	intel_gvt_kick_schedule(workload->vgpu->gvt);
 	wake_up(&workload->vgpu->gvt->scheduler.waitq[workload->ring_id]);
 }
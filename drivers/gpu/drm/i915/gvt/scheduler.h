@@ -37,10 +37,13 @@
 #define _GVT_SCHEDULER_H_
 
 struct intel_gvt_workload_scheduler {
-	struct intel_vgpu *current_vgpu;
-	struct intel_vgpu *next_vgpu;
+	/* the vGPU each engine runs, all the same unless scheduled per engine */
+	struct intel_vgpu *current_vgpu[I915_NUM_ENGINES];
+	struct intel_vgpu *next_vgpu[I915_NUM_ENGINES];
 	struct intel_vgpu_workload *current_workload[I915_NUM_ENGINES];
-	bool need_reschedule;
+	bool need_reschedule[I915_NUM_ENGINES];
+	/* workloads preempted by other vGPUs, still queued in i915 */
+	struct list_head preempted_q[I915_NUM_ENGINES];
 
 	spinlock_t mmio_context_lock;
 	/* can be null when owner is host */
@@ -49,6 +52,19 @@ struct intel_gvt_workload_scheduler {
 	wait_queue_head_t workload_complete_wq;
 	struct task_struct *thread[I915_NUM_ENGINES];
 	wait_queue_head_t waitq[I915_NUM_ENGINES];
+	/* scans queued workloads of all vGPUs off the vCPU exit path */
+	struct workqueue_struct *scan_wq;
+	/* finished workloads waiting for complete_work */
+	struct list_head complete_q[I915_NUM_ENGINES];
+	struct work_struct complete_work;
+	/*
+	 * trims the shadow bb pools and unpins the idle shadow contexts of
+	 * all vGPUs under memory pressure
+	 */
+	struct shrinker shrinker;
+	struct work_struct shrink_work;
+	atomic_t shadow_bb_pooled;
+	atomic_t shadow_ctx_pinned;
 
 	void *sched_data;
 	struct intel_gvt_sched_policy_ops *sched_ops;
@@ -57,7 +73,7 @@ struct intel_gvt_workload_scheduler {
 #define INDIRECT_CTX_ADDR_MASK 0xffffffc0
 #define INDIRECT_CTX_SIZE_MASK 0x3f
 struct shadow_indirect_ctx {
-	struct drm_i915_gem_object *obj;
+	struct intel_vgpu_shadow_bb *bb;
 	unsigned long guest_gma;
 	unsigned long shadow_gma;
 	void *shadow_va;
@@ -77,13 +93,37 @@ struct intel_shadow_wa_ctx {
 
 };
 
+/* points in the life of a workload, timestamped in ns */
+enum intel_vgpu_workload_stage {
+	WORKLOAD_STAGE_CREATE = 0,	/* queued from the guest submission */
+	WORKLOAD_STAGE_SHADOWED,	/* scanned and shadowed */
+	WORKLOAD_STAGE_DISPATCH,	/* request submitted to i915 */
+	WORKLOAD_STAGE_GPU_START,	/* first scheduled in on the engine */
+	WORKLOAD_STAGE_GPU_END,		/* last scheduled out of the engine */
+	WORKLOAD_STAGE_COMPLETE,	/* guest context written back */
+	WORKLOAD_STAGE_MAX,
+};
+
+/* log2 buckets of the time between two stages, in us */
+#define GVT_LATENCY_BUCKETS	24
+
+struct intel_vgpu_workload_latency {
+	u32 hist[WORKLOAD_STAGE_MAX - 1][GVT_LATENCY_BUCKETS];
+};
+
 struct intel_vgpu_workload {
 	struct intel_vgpu *vgpu;
 	int ring_id;
 	struct i915_request *req;
 	/* if this workload has been dispatched to i915? */
 	bool dispatched;
+	/* ring buffer and wa ctx have been scanned and shadowed */
+	bool scanned;
 	bool shadowed;
+	/* guest pages faulted in during a post-copy migration */
+	bool prefaulted;
+	/* scan again with every batch buffer shadowed */
+	bool no_direct_bb;
 	int status;
 
 	struct intel_vgpu_mm *shadow_mm;
@@ -92,6 +132,10 @@ struct intel_vgpu_workload {
 	int (*prepare)(struct intel_vgpu_workload *);
 	int (*complete)(struct intel_vgpu_workload *);
 	struct list_head list;
+	/* on the preempted_q of its ring while preempted */
+	struct list_head preempt_list;
+	/* on the complete_q of its ring until it is completed */
+	struct list_head complete_list;
 
 	DECLARE_BITMAP(pending_events, INTEL_GVT_EVENT_MAX);
 	void *shadow_ring_buffer_va;
@@ -101,32 +145,57 @@ struct intel_vgpu_workload {
 	struct execlist_ring_context *ring_context;
 	unsigned long rb_head, rb_tail, rb_ctl, rb_start, rb_len;
 	bool restore_inhibit;
+	/* submission->ctx_snapshot holds the context of this workload */
+	bool ctx_snapshot;
 	struct intel_vgpu_elsp_dwords elsp_dwords;
 	bool emulate_schedule_in;
-	atomic_t shadow_ctx_active;
-	wait_queue_head_t shadow_ctx_status_wq;
 	u64 ring_context_gpa;
 
 	/* shadow batch buffer */
 	struct list_head shadow_bb;
+	/* guest batch buffers executed in place */
+	struct list_head direct_bb;
 	struct intel_shadow_wa_ctx wa_ctx;
 
 	/* oa registers */
 	u32 oactxctrl;
 	u32 flex_mmio[7];
+
+	u64 stamp[WORKLOAD_STAGE_MAX];
+	/* last time the shadow context was scheduled in, in ns */
+	u64 sched_in_ns;
+	/* CTX_TIMESTAMP of the shadow context when it was scheduled in */
+	u32 ctx_timestamp;
+
+	/*
+	 * Initialized by the slab constructor and not cleared on allocation,
+	 * a workload is always idle and has no waiter when it is freed.
+	 */
+	atomic_t shadow_ctx_active;
+	wait_queue_head_t shadow_ctx_status_wq;
 };
 
 struct intel_vgpu_shadow_bb {
 	struct list_head list;
 	struct drm_i915_gem_object *obj;
 	struct i915_vma *vma;
+	/* the GGTT vma of a pooled object, unpinned but usually still bound */
+	struct i915_vma *ggtt_vma;
 	void *va;
 	u32 *bb_start_cmd_va;
 	unsigned int clflush;
 	bool accessing;
+	/* the object is owned by the scan cache */
+	bool cached;
 	unsigned long bb_offset;
 };
 
+struct intel_vgpu_shadow_bb *
+intel_vgpu_get_shadow_bb(struct intel_vgpu *vgpu, unsigned long size);
+
+void intel_vgpu_put_shadow_bb(struct intel_vgpu *vgpu,
+			      struct intel_vgpu_shadow_bb *bb);
+
 #define workload_q_head(vgpu, ring_id) \
 	(&(vgpu->submission.workload_q_head[ring_id]))
 
@@ -138,6 +207,9 @@ void intel_gvt_clean_workload_scheduler(struct intel_gvt *gvt);
 
 void intel_gvt_wait_vgpu_idle(struct intel_vgpu *vgpu);
 
+void intel_gvt_wait_vgpu_engines_idle(struct intel_vgpu *vgpu,
+				      unsigned long engine_mask);
+
 int intel_vgpu_setup_submission(struct intel_vgpu *vgpu);
 
 void intel_vgpu_reset_submission(struct intel_vgpu *vgpu,
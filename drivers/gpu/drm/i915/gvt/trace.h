@@ -359,6 +359,68 @@ TRACE_EVENT(render_mmio,
 		  __entry->old_val, __entry->new_val)
 );
 
+TRACE_EVENT(workload_latency,
+	TP_PROTO(int id, int ring_id, const u64 *stamp),
+
+	TP_ARGS(id, ring_id, stamp),
+
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(int, ring_id)
+		__field(u64, shadow)
+		__field(u64, wait)
+		__field(u64, queue)
+		__field(u64, exec)
+		__field(u64, complete)
+	),
+
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->ring_id = ring_id;
+		__entry->shadow = stamp[1] - stamp[0];
+		__entry->wait = stamp[2] - stamp[1];
+		__entry->queue = stamp[3] - stamp[2];
+		__entry->exec = stamp[4] - stamp[3];
+		__entry->complete = stamp[5] - stamp[4];
+	),
+
+	TP_printk("vgpu%d ring %d: shadow %llu wait %llu queue %llu exec %llu complete %llu ns\n",
+		  __entry->id, __entry->ring_id, __entry->shadow,
+		  __entry->wait, __entry->queue, __entry->exec,
+		  __entry->complete)
+);
+
+/*
+ * Emitted at the end of the emulation of a guest MMIO access, in the
+ * thread of the vCPU that did it, see "perf kvm stat report --event=gvt".
+ */
+TRACE_EVENT(vgpu_mmio,
+	TP_PROTO(int id, unsigned int offset, unsigned int bytes, bool write,
+		 u64 latency),
+
+	TP_ARGS(id, offset, bytes, write, latency),
+
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(unsigned int, offset)
+		__field(unsigned int, bytes)
+		__field(bool, write)
+		__field(u64, latency)
+	),
+
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->offset = offset;
+		__entry->bytes = bytes;
+		__entry->write = write;
+		__entry->latency = latency;
+	),
+
+	TP_printk("vgpu%d %s %x len %u in %llu ns\n",
+		  __entry->id, __entry->write ? "write" : "read",
+		  __entry->offset, __entry->bytes, __entry->latency)
+);
+
 #endif /* _GVT_TRACE_H_ */
 
 /* This part must be out of protection */
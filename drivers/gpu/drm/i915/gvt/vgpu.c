@@ -31,6 +31,8 @@
  *
  */
 
+#include <linux/memcontrol.h>
+
 #include "i915_drv.h"
 #include "gvt.h"
 #include "i915_pvinfo.h"
@@ -46,6 +48,12 @@ void populate_pvinfo_page(struct intel_vgpu *vgpu)
 
 	vgpu_vreg_t(vgpu, vgtif_reg(vgt_caps)) = VGT_CAPS_FULL_48BIT_PPGTT;
 	vgpu_vreg_t(vgpu, vgtif_reg(vgt_caps)) |= VGT_CAPS_HWSP_EMULATION;
+	vgpu_vreg_t(vgpu, vgtif_reg(vgt_caps)) |= VGT_CAPS_HUGE_GTT;
+	vgpu_vreg_t(vgpu, vgtif_reg(vgt_caps)) |= VGT_CAPS_PV_PPGTT;
+	vgpu_vreg_t(vgpu, vgtif_reg(vgt_caps)) |= VGT_CAPS_PV_SUBMISSION;
+	vgpu_vreg_t(vgpu, vgtif_reg(vgt_caps)) |= VGT_CAPS_PV_TIMESTAMP;
+	vgpu_vreg_t(vgpu, vgtif_reg(vgt_caps)) |= VGT_CAPS_GGTT_BALLOON;
+	vgpu_vreg_t(vgpu, vgtif_reg(vgt_caps)) |= VGT_CAPS_PV_MAILBOX;
 
 	vgpu_vreg_t(vgpu, vgtif_reg(avail_rs.mappable_gmadr.base)) =
 		vgpu_aperture_gmadr_base(vgpu);
@@ -58,6 +66,11 @@ void populate_pvinfo_page(struct intel_vgpu *vgpu)
 
 	vgpu_vreg_t(vgpu, vgtif_reg(avail_rs.fence_num)) = vgpu_fence_sz(vgpu);
 
+	vgpu_vreg_t(vgpu, vgtif_reg(avail_rs.nonmappable_request)) =
+		vgpu->gm.hidden_request ?: vgpu_hidden_sz(vgpu);
+	vgpu_vreg_t(vgpu, vgtif_reg(avail_rs.balloon_seqno)) =
+		vgpu->gm.balloon_seqno;
+
 	gvt_dbg_core("Populate PVINFO PAGE for vGPU %d\n", vgpu->id);
 	gvt_dbg_core("aperture base [GMADR] 0x%llx size 0x%llx\n",
 		vgpu_aperture_gmadr_base(vgpu), vgpu_aperture_sz(vgpu));
@@ -68,7 +81,6 @@ void populate_pvinfo_page(struct intel_vgpu *vgpu)
 	WARN_ON(sizeof(struct vgt_if) != VGT_PVINFO_SIZE);
 }
 
-#define VGPU_MAX_WEIGHT 16
 #define VGPU_WEIGHT(vgpu_num)	\
 	(VGPU_MAX_WEIGHT / (vgpu_num))
 
@@ -86,12 +98,64 @@ static struct {
 	char *name;
 } vgpu_types[] = {
 /* Fixed vGPU type table */
+	{ MB_TO_BYTES(32), MB_TO_BYTES(192), 2, VGPU_WEIGHT(16), GVT_EDID_1024_768, "16" },
 	{ MB_TO_BYTES(64), MB_TO_BYTES(384), 4, VGPU_WEIGHT(8), GVT_EDID_1024_768, "8" },
 	{ MB_TO_BYTES(128), MB_TO_BYTES(512), 4, VGPU_WEIGHT(4), GVT_EDID_1920_1200, "4" },
 	{ MB_TO_BYTES(256), MB_TO_BYTES(1024), 4, VGPU_WEIGHT(2), GVT_EDID_1920_1200, "2" },
 	{ MB_TO_BYTES(512), MB_TO_BYTES(2048), 4, VGPU_WEIGHT(1), GVT_EDID_1920_1200, "1" },
 };
 
+static void intel_gvt_vgpu_pool_work(struct work_struct *work);
+
+/*
+ * None of the cloned state depends on the vGPU type: the type specific
+ * resources are allocated and published per vGPU afterwards, so a single
+ * template serves all the types.
+ */
+static int init_vgpu_template(struct intel_gvt *gvt)
+{
+	struct intel_gvt_vgpu_template *tmpl = &gvt->vgpu_template;
+
+	tmpl->mmio = vmalloc(gvt->device_info.mmio_size);
+	if (!tmpl->mmio)
+		return -ENOMEM;
+
+	tmpl->mmio_tracked = kcalloc(BITS_TO_LONGS(gvt->device_info.mmio_size >>
+						   PAGE_SHIFT),
+				     sizeof(unsigned long), GFP_KERNEL);
+	if (!tmpl->mmio_tracked)
+		goto err_tracked;
+
+	tmpl->opregion = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO,
+			get_order(INTEL_GVT_OPREGION_SIZE));
+	if (!tmpl->opregion)
+		goto err_opregion;
+
+	intel_gvt_setup_mmio_template(gvt, tmpl->mmio, tmpl->mmio_tracked);
+	intel_gvt_setup_opregion_template(tmpl->opregion);
+	return 0;
+
+err_opregion:
+	kfree(tmpl->mmio_tracked);
+	tmpl->mmio_tracked = NULL;
+err_tracked:
+	vfree(tmpl->mmio);
+	tmpl->mmio = NULL;
+	return -ENOMEM;
+}
+
+static void clean_vgpu_template(struct intel_gvt *gvt)
+{
+	struct intel_gvt_vgpu_template *tmpl = &gvt->vgpu_template;
+
+	free_pages((unsigned long)tmpl->opregion,
+		   get_order(INTEL_GVT_OPREGION_SIZE));
+	kfree(tmpl->mmio_tracked);
+	vfree(tmpl->mmio);
+	tmpl->opregion = tmpl->mmio = NULL;
+	tmpl->mmio_tracked = NULL;
+}
+
 /**
  * intel_gvt_init_vgpu_types - initialize vGPU type list
  * @gvt : GVT device
@@ -141,6 +205,7 @@ int intel_gvt_init_vgpu_types(struct intel_gvt *gvt)
 
 		gvt->types[i].weight = vgpu_types[i].weight;
 		gvt->types[i].resolution = vgpu_types[i].edid;
+		INIT_LIST_HEAD(&gvt->types[i].pool);
 		gvt->types[i].avail_instance = min(low_avail / vgpu_types[i].low_mm,
 						   high_avail / vgpu_types[i].high_mm);
 
@@ -161,11 +226,18 @@ int intel_gvt_init_vgpu_types(struct intel_gvt *gvt)
 	}
 
 	gvt->num_types = i;
+	INIT_WORK(&gvt->vgpu_pool_work, intel_gvt_vgpu_pool_work);
+
+	if (init_vgpu_template(gvt)) {
+		kfree(gvt->types);
+		return -ENOMEM;
+	}
 	return 0;
 }
 
 void intel_gvt_clean_vgpu_types(struct intel_gvt *gvt)
 {
+	clean_vgpu_template(gvt);
 	kfree(gvt->types);
 }
 
@@ -204,13 +276,25 @@ static void intel_gvt_update_vgpu_types(struct intel_gvt *gvt)
  * @vgpu: virtual GPU
  *
  * This function is called when user wants to activate a virtual GPU.
+ * It is called by the VMM process, whose memcg is then charged for the
+ * host memory GVT allocates on behalf of the vGPU.
  *
  */
 void intel_gvt_activate_vgpu(struct intel_vgpu *vgpu)
 {
+	struct mem_cgroup *memcg = get_mem_cgroup_from_mm(current->mm);
+
 	mutex_lock(&vgpu->gvt->lock);
 	vgpu->active = true;
 	mutex_unlock(&vgpu->gvt->lock);
+
+	mutex_lock(&vgpu->vgpu_lock);
+	swap(vgpu->memcg, memcg);
+	intel_vgpu_update_vblank_emulation(vgpu);
+	mutex_unlock(&vgpu->vgpu_lock);
+
+	if (memcg)
+		mem_cgroup_put(memcg);
 }
 
 /**
@@ -226,19 +310,28 @@ void intel_gvt_deactivate_vgpu(struct intel_vgpu *vgpu)
 	struct intel_gvt *gvt = vgpu->gvt;
 
 	mutex_lock(&gvt->lock);
-
 	vgpu->active = false;
+	mutex_unlock(&gvt->lock);
+
+	cancel_work_sync(&vgpu->submission.elsp_work);
+	cancel_work_sync(&vgpu->submission.scan_work);
+	cancel_work_sync(&vgpu->display.vblank_timer.work);
+	cancel_work_sync(&vgpu->irq.flush_work);
+
+	mutex_lock(&vgpu->vgpu_lock);
 
 	if (atomic_read(&vgpu->submission.running_workload_num)) {
-		mutex_unlock(&gvt->lock);
+		mutex_unlock(&vgpu->vgpu_lock);
 		intel_gvt_wait_vgpu_idle(vgpu);
-		mutex_lock(&gvt->lock);
+		mutex_lock(&vgpu->vgpu_lock);
 	}
 
 	intel_vgpu_stop_schedule(vgpu);
 	intel_vgpu_dmabuf_cleanup(vgpu);
+	hrtimer_cancel(&vgpu->display.vblank_timer.timer);
+	intel_vgpu_clean_irq(vgpu);
 
-	mutex_unlock(&gvt->lock);
+	mutex_unlock(&vgpu->vgpu_lock);
 }
 
 /**
@@ -252,27 +345,52 @@ void intel_gvt_destroy_vgpu(struct intel_vgpu *vgpu)
 {
 	struct intel_gvt *gvt = vgpu->gvt;
 
+	cancel_work_sync(&vgpu->submission.elsp_work);
+	cancel_work_sync(&vgpu->submission.scan_work);
+	cancel_work_sync(&vgpu->gm.balloon_work);
+
+	/* the timers queue the vblank and interrupt work, stop them first */
+	hrtimer_cancel(&vgpu->display.vblank_timer.timer);
+	hrtimer_cancel(&vgpu->irq.moderation_timer);
+	cancel_work_sync(&vgpu->display.vblank_timer.work);
+	cancel_work_sync(&vgpu->irq.flush_work);
+
 	mutex_lock(&gvt->lock);
+	mutex_lock(&vgpu->vgpu_lock);
 
 	WARN(vgpu->active, "vGPU is still active!\n");
 
 	intel_gvt_debugfs_remove_vgpu(vgpu);
+	intel_gvt_pmu_remove_vgpu(vgpu);
 	idr_remove(&gvt->vgpu_idr, vgpu->id);
-	if (idr_is_empty(&gvt->vgpu_idr))
-		intel_gvt_clean_irq(gvt);
 	intel_vgpu_clean_sched_policy(vgpu);
+	mutex_unlock(&gvt->lock);
+
+	/*
+	 * The vGPU can't be looked up anymore, so the heavy part of the
+	 * teardown only needs the vGPU lock and doesn't stall the other
+	 * vGPUs on gvt->lock. GM and fences go back to the pool last,
+	 * once the GTT doesn't point at them anymore.
+	 */
 	intel_vgpu_clean_submission(vgpu);
 	intel_vgpu_clean_display(vgpu);
+	intel_vgpu_clean_irq(vgpu);
 	intel_vgpu_clean_opregion(vgpu);
 	intel_vgpu_clean_gtt(vgpu);
 	intel_gvt_hypervisor_detach_vgpu(vgpu);
-	intel_vgpu_free_resource(vgpu);
 	intel_vgpu_clean_mmio(vgpu);
 	intel_vgpu_dmabuf_cleanup(vgpu);
-	vfree(vgpu);
+	mutex_unlock(&vgpu->vgpu_lock);
 
+	mutex_lock(&gvt->lock);
+	intel_vgpu_free_resource(vgpu);
 	intel_gvt_update_vgpu_types(gvt);
 	mutex_unlock(&gvt->lock);
+
+	if (vgpu->memcg)
+		mem_cgroup_put(vgpu->memcg);
+	free_percpu(vgpu->stats);
+	vfree(vgpu);
 }
 
 #define IDLE_VGPU_IDR 0
@@ -298,6 +416,7 @@ struct intel_vgpu *intel_gvt_create_idle_vgpu(struct intel_gvt *gvt)
 
 	vgpu->id = IDLE_VGPU_IDR;
 	vgpu->gvt = gvt;
+	mutex_init(&vgpu->vgpu_lock);
 
 	for (i = 0; i < I915_NUM_ENGINES; i++)
 		INIT_LIST_HEAD(&vgpu->submission.workload_q_head[i]);
@@ -342,6 +461,12 @@ static struct intel_vgpu *__intel_gvt_create_vgpu(struct intel_gvt *gvt,
 	if (!vgpu)
 		return ERR_PTR(-ENOMEM);
 
+	vgpu->stats = alloc_percpu(struct intel_vgpu_stats);
+	if (!vgpu->stats) {
+		vfree(vgpu);
+		return ERR_PTR(-ENOMEM);
+	}
+
 	mutex_lock(&gvt->lock);
 
 	ret = idr_alloc(&gvt->vgpu_idr, vgpu, IDLE_VGPU_IDR + 1, GVT_MAX_VGPU,
@@ -353,9 +478,14 @@ static struct intel_vgpu *__intel_gvt_create_vgpu(struct intel_gvt *gvt,
 	vgpu->handle = param->handle;
 	vgpu->gvt = gvt;
 	vgpu->sched_ctl.weight = param->weight;
+	mutex_init(&vgpu->vgpu_lock);
 	INIT_LIST_HEAD(&vgpu->dmabuf_obj_list_head);
+	INIT_LIST_HEAD(&vgpu->pool_node);
+	hash_init(vgpu->dmabuf_obj_table);
 	INIT_RADIX_TREE(&vgpu->page_track_tree, GFP_KERNEL);
 	idr_init(&vgpu->object_idr);
+	INIT_WORK(&vgpu->gm.balloon_work, intel_vgpu_balloon_work);
+	intel_vgpu_init_irq(vgpu);
 	intel_vgpu_init_cfg_space(vgpu, param->primary);
 
 	ret = intel_vgpu_init_mmio(vgpu);
@@ -400,6 +530,8 @@ static struct intel_vgpu *__intel_gvt_create_vgpu(struct intel_gvt *gvt,
 	if (ret)
 		goto out_clean_sched_policy;
 
+	intel_gvt_pmu_add_vgpu(vgpu);
+
 	mutex_unlock(&gvt->lock);
 
 	return vgpu;
@@ -423,6 +555,7 @@ static struct intel_vgpu *__intel_gvt_create_vgpu(struct intel_gvt *gvt,
 out_clean_idr:
 	idr_remove(&gvt->vgpu_idr, vgpu->id);
 out_free_vgpu:
+	free_percpu(vgpu->stats);
 	vfree(vgpu);
 	mutex_unlock(&gvt->lock);
 	return ERR_PTR(ret);
@@ -438,11 +571,10 @@ static struct intel_vgpu *__intel_gvt_create_vgpu(struct intel_gvt *gvt,
  * Returns:
  * pointer to intel_vgpu, error pointer if failed.
  */
-struct intel_vgpu *intel_gvt_create_vgpu(struct intel_gvt *gvt,
-				struct intel_vgpu_type *type)
+static struct intel_vgpu *create_vgpu_of_type(struct intel_gvt *gvt,
+		struct intel_vgpu_type *type)
 {
 	struct intel_vgpu_creation_params param;
-	struct intel_vgpu *vgpu;
 
 	param.handle = 0;
 	param.primary = 1;
@@ -456,7 +588,40 @@ struct intel_vgpu *intel_gvt_create_vgpu(struct intel_gvt *gvt,
 	param.low_gm_sz = BYTES_TO_MB(param.low_gm_sz);
 	param.high_gm_sz = BYTES_TO_MB(param.high_gm_sz);
 
-	vgpu = __intel_gvt_create_vgpu(gvt, &param);
+	return __intel_gvt_create_vgpu(gvt, &param);
+}
+
+static struct intel_vgpu *take_pooled_vgpu(struct intel_gvt *gvt,
+		struct intel_vgpu_type *type)
+{
+	struct intel_vgpu *vgpu = NULL;
+
+	mutex_lock(&gvt->lock);
+	if (!list_empty(&type->pool)) {
+		vgpu = list_first_entry(&type->pool, struct intel_vgpu,
+					pool_node);
+		list_del_init(&vgpu->pool_node);
+		type->pooled--;
+	}
+	mutex_unlock(&gvt->lock);
+
+	return vgpu;
+}
+
+struct intel_vgpu *intel_gvt_create_vgpu(struct intel_gvt *gvt,
+				struct intel_vgpu_type *type)
+{
+	struct intel_vgpu *vgpu;
+
+	vgpu = take_pooled_vgpu(gvt, type);
+	if (vgpu) {
+		gvt_dbg_core("hand out pooled vgpu%d of type %s\n",
+			     vgpu->id, type->name);
+		queue_work(system_unbound_wq, &gvt->vgpu_pool_work);
+		return vgpu;
+	}
+
+	vgpu = create_vgpu_of_type(gvt, type);
 	if (IS_ERR(vgpu))
 		return vgpu;
 
@@ -466,6 +631,294 @@ struct intel_vgpu *intel_gvt_create_vgpu(struct intel_gvt *gvt,
 	return vgpu;
 }
 
+/*
+ * Bring the pool of every vGPU type to its configured size. The pooled
+ * vGPUs are fully created and reset, so handing one out on mdev create
+ * skips the resource allocation and GTT setup.
+ */
+static void intel_gvt_vgpu_pool_work(struct work_struct *work)
+{
+	struct intel_gvt *gvt = container_of(work, struct intel_gvt,
+					     vgpu_pool_work);
+	struct intel_vgpu_type *type;
+	struct intel_vgpu *vgpu;
+	bool fill;
+	int i;
+
+	for (i = 0; i < gvt->num_types; i++) {
+		type = &gvt->types[i];
+
+		for (;;) {
+			mutex_lock(&gvt->lock);
+			fill = type->pooled < type->pool_size;
+			mutex_unlock(&gvt->lock);
+			if (!fill)
+				break;
+
+			vgpu = create_vgpu_of_type(gvt, type);
+			if (IS_ERR(vgpu)) {
+				gvt_dbg_core("stop filling pool of %s: %ld\n",
+					     type->name, PTR_ERR(vgpu));
+				break;
+			}
+
+			mutex_lock(&gvt->lock);
+			list_add_tail(&vgpu->pool_node, &type->pool);
+			type->pooled++;
+			mutex_unlock(&gvt->lock);
+
+			intel_gvt_update_vgpu_types(gvt);
+		}
+
+		for (;;) {
+			vgpu = NULL;
+			mutex_lock(&gvt->lock);
+			if (type->pooled > type->pool_size) {
+				vgpu = list_last_entry(&type->pool,
+						struct intel_vgpu, pool_node);
+				list_del_init(&vgpu->pool_node);
+				type->pooled--;
+			}
+			mutex_unlock(&gvt->lock);
+			if (!vgpu)
+				break;
+
+			intel_gvt_destroy_vgpu(vgpu);
+		}
+	}
+}
+
+/**
+ * intel_gvt_set_vgpu_pool_size - set the number of pre-created vGPUs
+ * @gvt: GVT device
+ * @type: vGPU type of the pool
+ * @size: number of vGPUs to keep ready
+ *
+ * This function resizes the pool of vGPUs handed out on vGPU creation of
+ * @type. The pool is filled or trimmed in the background.
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+int intel_gvt_set_vgpu_pool_size(struct intel_gvt *gvt,
+				 struct intel_vgpu_type *type,
+				 unsigned int size)
+{
+	int ret = 0;
+
+	mutex_lock(&gvt->lock);
+	if (size > type->avail_instance + type->pooled)
+		ret = -ENOSPC;
+	else
+		type->pool_size = size;
+	mutex_unlock(&gvt->lock);
+
+	if (!ret)
+		queue_work(system_unbound_wq, &gvt->vgpu_pool_work);
+	return ret;
+}
+
+/**
+ * intel_gvt_clean_vgpu_pool - destroy all the pooled vGPUs
+ * @gvt: GVT device
+ *
+ */
+void intel_gvt_clean_vgpu_pool(struct intel_gvt *gvt)
+{
+	int i;
+
+	mutex_lock(&gvt->lock);
+	for (i = 0; i < gvt->num_types; i++)
+		gvt->types[i].pool_size = 0;
+	mutex_unlock(&gvt->lock);
+
+	cancel_work_sync(&gvt->vgpu_pool_work);
+	intel_gvt_vgpu_pool_work(&gvt->vgpu_pool_work);
+}
+
+/* Drop a balloon request the guest hasn't answered, called with gvt->lock */
+static void cancel_balloon_request(struct intel_vgpu *vgpu)
+{
+	if (!vgpu->gm.hidden_request)
+		return;
+
+	/* shrinking back the range the request may have added can't fail */
+	WARN_ON(intel_vgpu_resize_hidden_gm_in_place(vgpu,
+						     vgpu_hidden_sz(vgpu)));
+	vgpu->gm.hidden_request = 0;
+	vgpu_vreg_t(vgpu, vgtif_reg(avail_rs.nonmappable_request)) =
+		vgpu_hidden_sz(vgpu);
+}
+
+/*
+ * Ask the guest to move the end of its hidden GM. A larger range is taken
+ * right away, the guest only uses it once it has acknowledged the request.
+ */
+static int request_balloon_resize(struct intel_vgpu *vgpu, u64 size)
+{
+	int ret;
+
+	if (!vgpu->gm.balloon_capable)
+		return -EBUSY;
+
+	cancel_balloon_request(vgpu);
+
+	size = ALIGN(size, I915_GTT_PAGE_SIZE);
+	if (!size || size > U32_MAX)
+		return -EINVAL;
+	if (size == vgpu_hidden_sz(vgpu))
+		return 0;
+
+	if (size > vgpu_hidden_sz(vgpu)) {
+		ret = intel_vgpu_resize_hidden_gm_in_place(vgpu, size);
+		if (ret) {
+			gvt_vgpu_err("fail to grow hidden gm to %lluMB\n",
+				     BYTES_TO_MB(size));
+			return ret;
+		}
+		/* don't leave what the range was last used for mapped */
+		intel_vgpu_reset_ggtt_range(vgpu,
+			vgpu_hidden_gmadr_base(vgpu) + vgpu_hidden_sz(vgpu),
+			size - vgpu_hidden_sz(vgpu));
+	}
+
+	vgpu->gm.hidden_request = size;
+	vgpu->gm.balloon_seqno++;
+	vgpu_vreg_t(vgpu, vgtif_reg(avail_rs.nonmappable_request)) = size;
+	vgpu_vreg_t(vgpu, vgtif_reg(avail_rs.balloon_seqno)) =
+		vgpu->gm.balloon_seqno;
+
+	gvt_dbg_core("vgpu%d: request hidden GM size %llx\n",
+		     vgpu->id, size);
+	return 0;
+}
+
+/**
+ * intel_vgpu_balloon_work - apply the answer of a guest to a balloon request
+ * @work: the balloon work of a vGPU
+ *
+ * The range given up by the guest is pointed at scratch and returned to the
+ * pool, or the range it couldn't take is, if it refused to grow.
+ */
+void intel_vgpu_balloon_work(struct work_struct *work)
+{
+	struct intel_vgpu *vgpu =
+		container_of(work, struct intel_vgpu, gm.balloon_work);
+	struct intel_gvt *gvt = vgpu->gvt;
+	u64 size;
+
+	mutex_lock(&gvt->lock);
+	mutex_lock(&vgpu->vgpu_lock);
+
+	size = vgpu->gm.balloon_ack;
+	if (!vgpu->gm.hidden_request ||
+	    (size != vgpu->gm.hidden_request && size != vgpu_hidden_sz(vgpu)))
+		goto out;
+
+	if (size < vgpu_hidden_sz(vgpu))
+		intel_vgpu_reset_ggtt_range(vgpu,
+					    vgpu_hidden_gmadr_base(vgpu) + size,
+					    vgpu_hidden_sz(vgpu) - size);
+
+	vgpu_hidden_sz(vgpu) = size;
+	vgpu->gm.hidden_request = 0;
+	/* shrinking the range can't fail */
+	WARN_ON(intel_vgpu_resize_hidden_gm_in_place(vgpu, size));
+
+	vgpu_vreg_t(vgpu, vgtif_reg(avail_rs.nonmappable_gmadr.size)) = size;
+	vgpu_vreg_t(vgpu, vgtif_reg(avail_rs.nonmappable_request)) = size;
+
+	gvt_dbg_core("vgpu%d: hidden GM resized to %llx\n", vgpu->id, size);
+
+out:
+	mutex_unlock(&vgpu->vgpu_lock);
+	intel_gvt_update_vgpu_types(gvt);
+	mutex_unlock(&gvt->lock);
+}
+
+/**
+ * intel_gvt_ack_vgpu_balloon - handle the answer to a balloon request
+ * @vgpu: a vGPU
+ * @seqno: the request the guest answers
+ * @size: hidden GM size the guest now uses
+ *
+ * This function is called from the MMIO emulation with the vGPU lock held.
+ * An accepted grow is committed right away, its range was reserved and
+ * accounted when it was requested and the guest starts using it as soon
+ * as it sees the new size. Everything else returns GM to the pool and is
+ * applied by a work which can take gvt->lock.
+ */
+void intel_gvt_ack_vgpu_balloon(struct intel_vgpu *vgpu, u32 seqno,
+				u64 size)
+{
+	vgpu->gm.balloon_capable = true;
+
+	if (!vgpu->gm.hidden_request || seqno != vgpu->gm.balloon_seqno)
+		return;
+
+	if (size == vgpu->gm.hidden_request && size > vgpu_hidden_sz(vgpu)) {
+		vgpu_hidden_sz(vgpu) = size;
+		vgpu->gm.hidden_request = 0;
+		vgpu_vreg_t(vgpu, vgtif_reg(avail_rs.nonmappable_gmadr.size)) =
+			size;
+		gvt_dbg_core("vgpu%d: hidden GM grown to %llx\n",
+			     vgpu->id, size);
+		return;
+	}
+
+	vgpu->gm.balloon_ack = size;
+	schedule_work(&vgpu->gm.balloon_work);
+}
+
+/**
+ * intel_gvt_resize_vgpu_hidden_gm - change the hidden GM size of a vGPU
+ * @vgpu: a vGPU
+ * @size: new hidden GM size in MB
+ *
+ * This function changes the non-mappable graphics memory of a vGPU. When
+ * the vGPU isn't used by a guest, the range is simply moved: the guest
+ * driver balloons out everything beyond the range published in the PVINFO
+ * page when it loads. A running guest which supports it is asked to resize
+ * its balloon instead, and the new size takes effect once it has answered.
+ *
+ * Returns:
+ * Zero on success, negative error code if failed.
+ */
+int intel_gvt_resize_vgpu_hidden_gm(struct intel_vgpu *vgpu,
+				    unsigned int size)
+{
+	struct intel_gvt *gvt = vgpu->gvt;
+	int ret;
+
+	mutex_lock(&gvt->lock);
+	if (vgpu->active) {
+		mutex_lock(&vgpu->vgpu_lock);
+		ret = request_balloon_resize(vgpu, MB_TO_BYTES(size));
+		mutex_unlock(&vgpu->vgpu_lock);
+		if (!ret)
+			intel_gvt_update_vgpu_types(gvt);
+		mutex_unlock(&gvt->lock);
+		return ret;
+	}
+
+	mutex_lock(&vgpu->vgpu_lock);
+	cancel_balloon_request(vgpu);
+	/* don't leave guest pages mapped in the range being given up */
+	intel_vgpu_reset_ggtt(vgpu);
+	ret = intel_vgpu_resize_hidden_gm(vgpu, MB_TO_BYTES(size));
+	if (!ret) {
+		intel_vgpu_reset_ggtt(vgpu);
+		populate_pvinfo_page(vgpu);
+	}
+	mutex_unlock(&vgpu->vgpu_lock);
+
+	if (!ret)
+		intel_gvt_update_vgpu_types(gvt);
+	mutex_unlock(&gvt->lock);
+
+	return ret;
+}
+
 /**
  * intel_gvt_reset_vgpu_locked - reset a virtual GPU by DMLR or GT reset
  * @vgpu: virtual GPU
@@ -473,7 +926,7 @@ struct intel_vgpu *intel_gvt_create_vgpu(struct intel_gvt *gvt,
  * @engine_mask: engines to reset for GT reset
  *
  * This function is called when user wants to reset a virtual GPU through
- * device model reset or GT reset. The caller should hold the gvt lock.
+ * device model reset or GT reset. The caller should hold the vgpu lock.
  *
  * vGPU Device Model Level Reset (DMLR) simulates the PCI level reset to reset
  * the whole vGPU to default state as when it is created. This vGPU function
@@ -497,25 +950,37 @@ struct intel_vgpu *intel_gvt_create_vgpu(struct intel_gvt *gvt,
 void intel_gvt_reset_vgpu_locked(struct intel_vgpu *vgpu, bool dmlr,
 				 unsigned int engine_mask)
 {
-	struct intel_gvt *gvt = vgpu->gvt;
-	struct intel_gvt_workload_scheduler *scheduler = &gvt->scheduler;
 	unsigned int resetting_eng = dmlr ? ALL_ENGINES : engine_mask;
 
 	gvt_dbg_core("------------------------------------------\n");
 	gvt_dbg_core("resseting vgpu%d, dmlr %d, engine_mask %08x\n",
 		     vgpu->id, dmlr, engine_mask);
 
+	/* the scheduler picks no new workload of the resetting engines */
+	mutex_lock(&vgpu->gvt->sched_lock);
 	vgpu->resetting_eng = resetting_eng;
-
-	intel_vgpu_stop_schedule(vgpu);
-	/*
-	 * The current_vgpu will set to NULL after stopping the
-	 * scheduler when the reset is triggered by current vgpu.
-	 */
-	if (scheduler->current_vgpu == NULL) {
-		mutex_unlock(&gvt->lock);
-		intel_gvt_wait_vgpu_idle(vgpu);
-		mutex_lock(&gvt->lock);
+	mutex_unlock(&vgpu->gvt->sched_lock);
+
+	if (resetting_eng == ALL_ENGINES) {
+		intel_vgpu_stop_schedule(vgpu);
+		/*
+		 * The vGPU may still have workloads running on the engines
+		 * it was the current vGPU of, wait for them before resetting.
+		 */
+		if (atomic_read(&vgpu->submission.running_workload_num)) {
+			mutex_unlock(&vgpu->vgpu_lock);
+			intel_gvt_wait_vgpu_idle(vgpu);
+			mutex_lock(&vgpu->vgpu_lock);
+		}
+	} else {
+		/*
+		 * The vGPU keeps its time slices and its other engines keep
+		 * running, only the workloads of the resetting engines are
+		 * waited for.
+		 */
+		mutex_unlock(&vgpu->vgpu_lock);
+		intel_gvt_wait_vgpu_engines_idle(vgpu, resetting_eng);
+		mutex_lock(&vgpu->vgpu_lock);
 	}
 
 	intel_vgpu_reset_submission(vgpu, resetting_eng);
@@ -538,6 +1003,10 @@ void intel_gvt_reset_vgpu_locked(struct intel_vgpu *vgpu, bool dmlr,
 			/* only reset the failsafe mode when dmlr reset */
 			vgpu->failsafe = false;
 			vgpu->pv_notified = false;
+			vgpu->submission.pv_submission_gpa = 0;
+			vgpu->pv_mailbox_gpa = 0;
+			vgpu->pv_timestamp_gpa = 0;
+			vgpu->gm.balloon_capable = false;
 		}
 	}
 
@@ -555,7 +1024,7 @@ void intel_gvt_reset_vgpu_locked(struct intel_vgpu *vgpu, bool dmlr,
  */
 void intel_gvt_reset_vgpu(struct intel_vgpu *vgpu)
 {
-	mutex_lock(&vgpu->gvt->lock);
+	mutex_lock(&vgpu->vgpu_lock);
 	intel_gvt_reset_vgpu_locked(vgpu, true, 0);
-	mutex_unlock(&vgpu->gvt->lock);
+	mutex_unlock(&vgpu->vgpu_lock);
 }
@@ -952,6 +952,13 @@ struct i915_gem_mm {
 	/** PPGTT used for aliasing the PPGTT with the GTT */
 	struct i915_hw_ppgtt *aliasing_ppgtt;
 
+	/**
+	 * Released full PPGTTs, kept with their scratch and top level page
+	 * tables for the next i915_ppgtt_create(). Protected by struct_mutex.
+	 */
+	struct list_head ppgtt_cache;
+	unsigned int ppgtt_cache_count;
+
 	struct notifier_block oom_notifier;
 	struct notifier_block vmap_notifier;
 	struct shrinker shrinker;
@@ -1300,6 +1307,25 @@ struct i915_workarounds {
 struct i915_virtual_gpu {
 	bool active;
 	u32 caps;
+	/* notifications posted to GVT, see i915_pvinfo.h */
+	struct vgt_pv_mailbox *pv_mailbox;
+	spinlock_t pv_mailbox_lock;
+	/* page table updates reported to GVT, see i915_pvinfo.h */
+	struct vgt_pv_ppgtt_ring *pv_ppgtt;
+	spinlock_t pv_ppgtt_lock;
+	/* ELSP writes replaced by a doorbell, see i915_pvinfo.h */
+	struct vgt_pv_submission *pv_submission;
+	/* RING_TIMESTAMP extrapolated from the CPU clock, see i915_pvinfo.h */
+	struct vgt_pv_timestamp *pv_timestamp;
+	spinlock_t pv_timestamp_lock;
+	u32 pv_timestamp_generation;
+	u64 pv_timestamp_base;
+	u64 pv_timestamp_base_ns;
+	u64 pv_timestamp_last;
+	/* polls for GGTT balloon resizes, see i915_pvinfo.h */
+	struct delayed_work balloon_work;
+	u32 balloon_seqno;
+	bool balloon_polling;
 };
 
 /* used in computing the new watermarks state */
@@ -3777,6 +3803,8 @@ __i915_request_irq_complete(const struct i915_request *rq)
 
 void i915_memcpy_init_early(struct drm_i915_private *dev_priv);
 bool i915_memcpy_from_wc(void *dst, const void *src, unsigned long len);
+bool i915_unaligned_memcpy_from_wc(void *dst, const void *src,
+				   unsigned long len);
 
 /* The movntdqa instructions used for memcpy-from-wc require 16-byte alignment,
  * as well as SSE4.1 support. i915_memcpy_from_wc() will report if it cannot
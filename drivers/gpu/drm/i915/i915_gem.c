@@ -3553,8 +3553,9 @@ void i915_gem_close_object(struct drm_gem_object *gem, struct drm_file *file)
 		if (ctx->file_priv != fpriv)
 			continue;
 
-		vma = radix_tree_delete(&ctx->handles_vma, lut->handle);
+		vma = lut->vma;
 		GEM_BUG_ON(vma->obj != obj);
+		i915_gem_context_remove_lut(ctx, lut);
 
 		/* We allow the process to have multiple handles to the same
 		 * vma, in the same fd namespace, by virtue of flink/open.
@@ -4555,6 +4556,8 @@ void i915_gem_object_init(struct drm_i915_gem_object *obj,
 	INIT_LIST_HEAD(&obj->vma_list);
 	INIT_LIST_HEAD(&obj->lut_list);
 	INIT_LIST_HEAD(&obj->batch_pool_link);
+	spin_lock_init(&obj->dmabuf_maps.lock);
+	INIT_LIST_HEAD(&obj->dmabuf_maps.list);
 
 	obj->ops = ops;
 
@@ -5278,11 +5281,9 @@ int i915_gem_init(struct drm_i915_private *dev_priv)
 	int ret;
 
 	/*
-	 * We need to fallback to 4K pages since gvt gtt handling doesn't
-	 * support huge page entries - we will need to check either hypervisor
-	 * mm can support huge guest page or just do emulation in gvt.
+	 * We need to fallback to 4K pages if host doesn't support huge gtt.
 	 */
-	if (intel_vgpu_active(dev_priv))
+	if (intel_vgpu_active(dev_priv) && !intel_vgpu_has_huge_gtt(dev_priv))
 		mkwrite_device_info(dev_priv)->page_sizes =
 			I915_GTT_PAGE_SIZE_4K;
 
@@ -5481,6 +5482,7 @@ static void i915_gem_init__mm(struct drm_i915_private *i915)
 	INIT_LIST_HEAD(&i915->mm.bound_list);
 	INIT_LIST_HEAD(&i915->mm.fence_list);
 	INIT_LIST_HEAD(&i915->mm.userfault_list);
+	INIT_LIST_HEAD(&i915->mm.ppgtt_cache);
 
 	INIT_WORK(&i915->mm.free_work, __i915_gem_free_work);
 }
@@ -93,25 +93,76 @@
 
 #define ALL_L3_SLICES(dev) (1 << NUM_L3_SLICES(dev)) - 1
 
+static const struct rhashtable_params lut_params = {
+	.key_len = sizeof(u32),
+	.key_offset = offsetof(struct i915_lut_handle, handle),
+	.head_offset = offsetof(struct i915_lut_handle, hash),
+	.automatic_shrinking = true,
+};
+
+/**
+ * i915_gem_context_lookup_vma - find the vma of a handle in a context
+ * @ctx: the context
+ * @handle: the user handle of the object
+ *
+ * The lookups are freed as soon as they are removed from the hashtable,
+ * and the vma is only kept alive by struct_mutex, which the caller must
+ * hold.
+ *
+ * Returns the vma, or NULL if @handle has no lookup in @ctx yet.
+ */
+struct i915_vma *
+i915_gem_context_lookup_vma(struct i915_gem_context *ctx, u32 handle)
+{
+	struct i915_lut_handle *lut;
+
+	lockdep_assert_held(&ctx->i915->drm.struct_mutex);
+
+	lut = rhashtable_lookup_fast(&ctx->handles_vma, &handle, lut_params);
+	return lut ? lut->vma : NULL;
+}
+
+/**
+ * i915_gem_context_add_lut - add the lookup of a handle to a context
+ * @ctx: the context
+ * @lut: the lookup, with its handle and vma set
+ *
+ * Returns 0 on success, -EEXIST if the handle already has a lookup, or
+ * another negative error code if the table couldn't be grown.
+ */
+int i915_gem_context_add_lut(struct i915_gem_context *ctx,
+			     struct i915_lut_handle *lut)
+{
+	lockdep_assert_held(&ctx->i915->drm.struct_mutex);
+
+	return rhashtable_lookup_insert_fast(&ctx->handles_vma, &lut->hash,
+					     lut_params);
+}
+
+/**
+ * i915_gem_context_remove_lut - remove the lookup of a handle
+ * @ctx: the context
+ * @lut: the lookup to remove
+ */
+void i915_gem_context_remove_lut(struct i915_gem_context *ctx,
+				 struct i915_lut_handle *lut)
+{
+	lockdep_assert_held(&ctx->i915->drm.struct_mutex);
+
+	rhashtable_remove_fast(&ctx->handles_vma, &lut->hash, lut_params);
+}
+
 static void lut_close(struct i915_gem_context *ctx)
 {
 	struct i915_lut_handle *lut, *ln;
-	struct radix_tree_iter iter;
-	void __rcu **slot;
 
 	list_for_each_entry_safe(lut, ln, &ctx->handles_list, ctx_link) {
+		i915_gem_context_remove_lut(ctx, lut);
 		list_del(&lut->obj_link);
+		__i915_gem_object_release_unless_active(lut->vma->obj);
 		kmem_cache_free(ctx->i915->luts, lut);
 	}
-
-	rcu_read_lock();
-	radix_tree_for_each_slot(slot, &ctx->handles_vma, &iter, 0) {
-		struct i915_vma *vma = rcu_dereference_raw(*slot);
-
-		radix_tree_iter_delete(&ctx->handles_vma, &iter, slot);
-		__i915_gem_object_release_unless_active(vma->obj);
-	}
-	rcu_read_unlock();
+	INIT_LIST_HEAD(&ctx->handles_list);
 }
 
 static void i915_gem_context_free(struct i915_gem_context *ctx)
@@ -130,6 +181,10 @@ static void i915_gem_context_free(struct i915_gem_context *ctx)
 			continue;
 
 		WARN_ON(ce->pin_count);
+		/* the engines may be gone already while unloading */
+		if (ce->ring && ctx->i915->engine[i] &&
+		    intel_lr_context_recycle(ctx->i915->engine[i], ce))
+			continue;
 		if (ce->ring)
 			intel_ring_free(ce->ring);
 
@@ -138,6 +193,7 @@ static void i915_gem_context_free(struct i915_gem_context *ctx)
 
 	kfree(ctx->name);
 	put_pid(ctx->pid);
+	rhashtable_destroy(&ctx->handles_vma);
 
 	list_del(&ctx->link);
 
@@ -271,8 +327,15 @@ __create_hw_context(struct drm_i915_private *dev_priv,
 	if (ctx == NULL)
 		return ERR_PTR(-ENOMEM);
 
+	ret = rhashtable_init(&ctx->handles_vma, &lut_params);
+	if (ret) {
+		kfree(ctx);
+		return ERR_PTR(ret);
+	}
+
 	ret = assign_hw_id(dev_priv, &ctx->hw_id);
 	if (ret) {
+		rhashtable_destroy(&ctx->handles_vma);
 		kfree(ctx);
 		return ERR_PTR(ret);
 	}
@@ -282,7 +345,6 @@ __create_hw_context(struct drm_i915_private *dev_priv,
 	ctx->i915 = dev_priv;
 	ctx->priority = I915_PRIORITY_NORMAL;
 
-	INIT_RADIX_TREE(&ctx->handles_vma, GFP_KERNEL);
 	INIT_LIST_HEAD(&ctx->handles_list);
 
 	/* Default context will never have a file_priv */
@@ -28,6 +28,7 @@
 #include <linux/bitops.h>
 #include <linux/list.h>
 #include <linux/radix-tree.h>
+#include <linux/rhashtable.h>
 
 #include "i915_gem.h"
 
@@ -39,6 +40,7 @@ struct drm_file;
 struct drm_i915_private;
 struct drm_i915_file_private;
 struct i915_hw_ppgtt;
+struct i915_lut_handle;
 struct i915_request;
 struct i915_vma;
 struct intel_ring;
@@ -183,14 +185,15 @@ struct i915_gem_context {
 	/** remap_slice: Bitmask of cache lines that need remapping */
 	u8 remap_slice;
 
-	/** handles_vma: rbtree to look up our context specific obj/vma for
-	 * the user handle. (user handles are per fd, but the binding is
-	 * per vm, which may be one per context or shared with the global GTT)
+	/** handles_vma: hashtable of i915_lut_handle to look up our context
+	 * specific obj/vma for the user handle. (user handles are per fd, but
+	 * the binding is per vm, which may be one per context or shared with
+	 * the global GTT) It is resized as handles are added and removed.
 	 */
-	struct radix_tree_root handles_vma;
+	struct rhashtable handles_vma;
 
-	/** handles_list: reverse list of all the rbtree entries in use for
-	 * this context, which allows us to free all the allocations on
+	/** handles_list: reverse list of all the hashtable entries in use
+	 * for this context, which allows us to free all the allocations on
 	 * context close.
 	 */
 	struct list_head handles_list;
@@ -283,6 +286,13 @@ void i915_gem_context_release(struct kref *ctx_ref);
 struct i915_gem_context *
 i915_gem_context_create_gvt(struct drm_device *dev);
 
+struct i915_vma *
+i915_gem_context_lookup_vma(struct i915_gem_context *ctx, u32 handle);
+int i915_gem_context_add_lut(struct i915_gem_context *ctx,
+			     struct i915_lut_handle *lut);
+void i915_gem_context_remove_lut(struct i915_gem_context *ctx,
+				 struct i915_lut_handle *lut);
+
 int i915_gem_context_create_ioctl(struct drm_device *dev, void *data,
 				  struct drm_file *file);
 int i915_gem_context_destroy_ioctl(struct drm_device *dev, void *data,
@@ -36,24 +36,98 @@ static struct drm_i915_gem_object *dma_buf_to_obj(struct dma_buf *buf)
 	return to_intel_bo(buf->priv);
 }
 
+/*
+ * Importers such as a display encoder tend to import the same dma-buf again
+ * and again, each time attaching, mapping, unmapping and detaching it. For
+ * objects whose backend asks for it with I915_GEM_OBJECT_CACHE_DMABUF_MAPS,
+ * the DMA mapping of an unmapped attachment is kept on the object, and
+ * reused when the same device maps the dma-buf again in the same
+ * direction. Only a few are kept per object as they pin its pages; they
+ * are all released with the dma-buf. Ownership still moves between the
+ * CPU and the device on every map and unmap.
+ */
+#define I915_DMABUF_MAPS_MAX 4
+
+struct i915_dmabuf_map {
+	struct list_head link;
+	struct device *dev;
+	enum dma_data_direction dir;
+	struct sg_table st;
+};
+
+static void dmabuf_map_free(struct drm_i915_gem_object *obj,
+			    struct i915_dmabuf_map *map)
+{
+	dma_unmap_sg(map->dev, map->st.sgl, map->st.nents, map->dir);
+	sg_free_table(&map->st);
+	put_device(map->dev);
+	kfree(map);
+
+	i915_gem_object_unpin_pages(obj);
+}
+
+static struct i915_dmabuf_map *
+dmabuf_map_lookup(struct drm_i915_gem_object *obj, struct device *dev,
+		  enum dma_data_direction dir)
+{
+	struct i915_dmabuf_map *map;
+
+	spin_lock(&obj->dmabuf_maps.lock);
+	list_for_each_entry(map, &obj->dmabuf_maps.list, link) {
+		if (map->dev == dev && map->dir == dir) {
+			list_del(&map->link);
+			obj->dmabuf_maps.count--;
+			spin_unlock(&obj->dmabuf_maps.lock);
+			return map;
+		}
+	}
+	spin_unlock(&obj->dmabuf_maps.lock);
+
+	return NULL;
+}
+
+static void dmabuf_maps_release(struct drm_i915_gem_object *obj)
+{
+	struct i915_dmabuf_map *map, *mn;
+	LIST_HEAD(list);
+
+	spin_lock(&obj->dmabuf_maps.lock);
+	list_splice_init(&obj->dmabuf_maps.list, &list);
+	obj->dmabuf_maps.count = 0;
+	spin_unlock(&obj->dmabuf_maps.lock);
+
+	list_for_each_entry_safe(map, mn, &list, link)
+		dmabuf_map_free(obj, map);
+}
+
 static struct sg_table *i915_gem_map_dma_buf(struct dma_buf_attachment *attachment,
 					     enum dma_data_direction dir)
 {
 	struct drm_i915_gem_object *obj = dma_buf_to_obj(attachment->dmabuf);
+	struct i915_dmabuf_map *map;
 	struct sg_table *st;
 	struct scatterlist *src, *dst;
 	int ret, i;
 
+	/* the cached mapping holds its own pin on the pages */
+	map = dmabuf_map_lookup(obj, attachment->dev, dir);
+	if (map) {
+		dma_sync_sg_for_device(map->dev, map->st.sgl, map->st.nents,
+				       dir);
+		return &map->st;
+	}
+
 	ret = i915_gem_object_pin_pages(obj);
 	if (ret)
 		goto err;
 
 	/* Copy sg so that we make an independent mapping */
-	st = kmalloc(sizeof(struct sg_table), GFP_KERNEL);
-	if (st == NULL) {
+	map = kmalloc(sizeof(*map), GFP_KERNEL);
+	if (map == NULL) {
 		ret = -ENOMEM;
 		goto err_unpin_pages;
 	}
+	st = &map->st;
 
 	ret = sg_alloc_table(st, obj->mm.pages->nents, GFP_KERNEL);
 	if (ret)
@@ -72,12 +146,14 @@ static struct sg_table *i915_gem_map_dma_buf(struct dma_buf_attachment *attachme
 		goto err_free_sg;
 	}
 
+	map->dev = get_device(attachment->dev);
+	map->dir = dir;
 	return st;
 
 err_free_sg:
 	sg_free_table(st);
 err_free:
-	kfree(st);
+	kfree(map);
 err_unpin_pages:
 	i915_gem_object_unpin_pages(obj);
 err:
@@ -89,12 +165,35 @@ static void i915_gem_unmap_dma_buf(struct dma_buf_attachment *attachment,
 				   enum dma_data_direction dir)
 {
 	struct drm_i915_gem_object *obj = dma_buf_to_obj(attachment->dmabuf);
+	struct i915_dmabuf_map *map = container_of(sg, typeof(*map), st);
+	struct i915_dmabuf_map *evict = NULL;
 
-	dma_unmap_sg(attachment->dev, sg->sgl, sg->nents, dir);
-	sg_free_table(sg);
-	kfree(sg);
+	if (!i915_gem_object_caches_dmabuf_maps(obj)) {
+		dmabuf_map_free(obj, map);
+		return;
+	}
 
-	i915_gem_object_unpin_pages(obj);
+	dma_sync_sg_for_cpu(map->dev, sg->sgl, sg->nents, dir);
+
+	/* keep the mapping for the next import, drop the oldest one */
+	spin_lock(&obj->dmabuf_maps.lock);
+	list_add(&map->link, &obj->dmabuf_maps.list);
+	if (++obj->dmabuf_maps.count > I915_DMABUF_MAPS_MAX) {
+		evict = list_last_entry(&obj->dmabuf_maps.list,
+					typeof(*evict), link);
+		list_del(&evict->link);
+		obj->dmabuf_maps.count--;
+	}
+	spin_unlock(&obj->dmabuf_maps.lock);
+
+	if (evict)
+		dmabuf_map_free(obj, evict);
+}
+
+static void i915_gem_dmabuf_release(struct dma_buf *dma_buf)
+{
+	dmabuf_maps_release(dma_buf_to_obj(dma_buf));
+	drm_gem_dmabuf_release(dma_buf);
 }
 
 static void *i915_gem_dmabuf_vmap(struct dma_buf *dma_buf)
@@ -223,7 +322,7 @@ static int i915_gem_end_cpu_access(struct dma_buf *dma_buf, enum dma_data_direct
 static const struct dma_buf_ops i915_dmabuf_ops =  {
 	.map_dma_buf = i915_gem_map_dma_buf,
 	.unmap_dma_buf = i915_gem_unmap_dma_buf,
-	.release = drm_gem_dmabuf_release,
+	.release = i915_gem_dmabuf_release,
 	.map = i915_gem_dmabuf_kmap,
 	.map_atomic = i915_gem_dmabuf_kmap_atomic,
 	.unmap = i915_gem_dmabuf_kunmap,
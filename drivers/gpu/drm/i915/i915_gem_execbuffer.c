@@ -240,12 +240,11 @@ struct i915_execbuffer {
 	u32 batch_flags; /** Flags composed for emit_bb_start() */
 
 	/**
-	 * Indicate either the size of the hastable used to resolve
-	 * relocation handles, or if negative that we are using a direct
-	 * index into the execobj[].
+	 * If negative, the relocation handles are a direct index into the
+	 * execobj[]. Otherwise they are resolved through the handle lookup
+	 * of the context.
 	 */
 	int lut_size;
-	struct hlist_head *buckets; /** ht for relocation handles */
 };
 
 #define exec_entry(EB, VMA) (&(EB)->exec[(VMA)->exec_flags - (EB)->flags])
@@ -276,46 +275,17 @@ static inline bool eb_use_cmdparser(const struct i915_execbuffer *eb)
 
 static int eb_create(struct i915_execbuffer *eb)
 {
-	if (!(eb->args->flags & I915_EXEC_HANDLE_LUT)) {
-		unsigned int size = 1 + ilog2(eb->buffer_count);
-
-		/*
-		 * Without a 1:1 association between relocation handles and
-		 * the execobject[] index, we instead create a hashtable.
-		 * We size it dynamically based on available memory, starting
-		 * first with 1:1 assocative hash and scaling back until
-		 * the allocation succeeds.
-		 *
-		 * Later on we use a positive lut_size to indicate we are
-		 * using this hashtable, and a negative value to indicate a
-		 * direct lookup.
-		 */
-		do {
-			gfp_t flags;
-
-			/* While we can still reduce the allocation size, don't
-			 * raise a warning and allow the allocation to fail.
-			 * On the last pass though, we want to try as hard
-			 * as possible to perform the allocation and warn
-			 * if it fails.
-			 */
-			flags = GFP_KERNEL;
-			if (size > 1)
-				flags |= __GFP_NORETRY | __GFP_NOWARN;
-
-			eb->buckets = kzalloc(sizeof(struct hlist_head) << size,
-					      flags);
-			if (eb->buckets)
-				break;
-		} while (--size);
-
-		if (unlikely(!size))
-			return -ENOMEM;
-
-		eb->lut_size = size;
-	} else {
+	/*
+	 * Without a 1:1 association between relocation handles and the
+	 * execobject[] index, the handles are looked up in the hashtable
+	 * of the context, which holds all the handles of the execbuf once
+	 * they have been looked up. A negative lut_size indicates a direct
+	 * lookup.
+	 */
+	if (eb->args->flags & I915_EXEC_HANDLE_LUT)
 		eb->lut_size = -eb->buffer_count;
-	}
+	else
+		eb->lut_size = 0;
 
 	return 0;
 }
@@ -473,13 +443,6 @@ eb_add_vma(struct i915_execbuffer *eb, unsigned int i, struct i915_vma *vma)
 			return err;
 	}
 
-	if (eb->lut_size > 0) {
-		vma->exec_handle = entry->handle;
-		hlist_add_head(&vma->exec_node,
-			       &eb->buckets[hash_32(entry->handle,
-						    eb->lut_size)]);
-	}
-
 	if (entry->relocation_count)
 		list_add_tail(&vma->reloc_link, &eb->relocs);
 
@@ -685,7 +648,6 @@ static int eb_select_context(struct i915_execbuffer *eb)
 
 static int eb_lookup_vmas(struct i915_execbuffer *eb)
 {
-	struct radix_tree_root *handles_vma = &eb->ctx->handles_vma;
 	struct drm_i915_gem_object *obj;
 	unsigned int i;
 	int err;
@@ -704,7 +666,7 @@ static int eb_lookup_vmas(struct i915_execbuffer *eb)
 		struct i915_lut_handle *lut;
 		struct i915_vma *vma;
 
-		vma = radix_tree_lookup(handles_vma, handle);
+		vma = i915_gem_context_lookup_vma(eb->ctx, handle);
 		if (likely(vma))
 			goto add_vma;
 
@@ -726,9 +688,12 @@ static int eb_lookup_vmas(struct i915_execbuffer *eb)
 			goto err_obj;
 		}
 
-		err = radix_tree_insert(handles_vma, handle, vma);
+		lut->ctx = eb->ctx;
+		lut->vma = vma;
+		lut->handle = handle;
+		err = i915_gem_context_add_lut(eb->ctx, lut);
 		if (unlikely(err)) {
-			kfree(lut);
+			kmem_cache_free(eb->i915->luts, lut);
 			goto err_obj;
 		}
 
@@ -736,8 +701,6 @@ static int eb_lookup_vmas(struct i915_execbuffer *eb)
 		vma->open_count++;
 		list_add(&lut->obj_link, &obj->lut_list);
 		list_add(&lut->ctx_link, &eb->ctx->handles_list);
-		lut->ctx = eb->ctx;
-		lut->handle = handle;
 
 add_vma:
 		err = eb_add_vma(eb, i, vma);
@@ -785,15 +748,16 @@ eb_get_vma(const struct i915_execbuffer *eb, unsigned long handle)
 			return NULL;
 		return eb->vma[handle];
 	} else {
-		struct hlist_head *head;
 		struct i915_vma *vma;
 
-		head = &eb->buckets[hash_32(handle, eb->lut_size)];
-		hlist_for_each_entry(vma, head, exec_node) {
-			if (vma->exec_handle == handle)
-				return vma;
-		}
-		return NULL;
+		if (upper_32_bits(handle))
+			return NULL;
+
+		/* only the vma in this execbuf have their exec_flags set */
+		vma = i915_gem_context_lookup_vma(eb->ctx, handle);
+		if (!vma || !vma->exec_flags)
+			return NULL;
+		return vma;
 	}
 }
 
@@ -824,17 +788,11 @@ static void eb_release_vmas(const struct i915_execbuffer *eb)
 static void eb_reset_vmas(const struct i915_execbuffer *eb)
 {
 	eb_release_vmas(eb);
-	if (eb->lut_size > 0)
-		memset(eb->buckets, 0,
-		       sizeof(struct hlist_head) << eb->lut_size);
 }
 
 static void eb_destroy(const struct i915_execbuffer *eb)
 {
 	GEM_BUG_ON(eb->reloc_cache.rq);
-
-	if (eb->lut_size > 0)
-		kfree(eb->buckets);
 }
 
 static inline u64
@@ -2263,8 +2221,6 @@ i915_gem_do_execbuffer(struct drm_device *dev,
 	if (err)
 		goto err_out_fence;
 
-	GEM_BUG_ON(!eb.lut_size);
-
 	err = eb_select_context(&eb);
 	if (unlikely(err))
 		goto err_destroy;
@@ -522,6 +522,20 @@ static void cleanup_page_dma(struct i915_address_space *vm,
 #define fill_px(ppgtt, px, v) fill_page_dma((vm), px_base(px), (v))
 #define fill32_px(ppgtt, px, v) fill_page_dma_32((vm), px_base(px), (v))
 
+/* Tell GVT-g which entries of a page table were written, see i915_vgpu.c */
+static inline void update_page_dma(struct i915_address_space *vm,
+				   struct i915_page_dma *p,
+				   unsigned int first, unsigned int count)
+{
+	if (unlikely(intel_vgpu_has_pv_ppgtt(vm->i915)))
+		intel_vgt_pv_ppgtt_update(vm->i915,
+					  p->daddr + first * sizeof(u64),
+					  count);
+}
+
+#define update_px(vm, px, first, count) \
+	update_page_dma((vm), px_base(px), (first), (count))
+
 static void fill_page_dma(struct i915_address_space *vm,
 			  struct i915_page_dma *p,
 			  const u64 val)
@@ -531,6 +545,7 @@ static void fill_page_dma(struct i915_address_space *vm,
 	memset64(vaddr, val, PAGE_SIZE / sizeof(val));
 
 	kunmap_atomic(vaddr);
+	update_page_dma(vm, p, 0, PAGE_SIZE / sizeof(val));
 }
 
 static void fill_page_dma_32(struct i915_address_space *vm,
@@ -845,6 +860,7 @@ static bool gen8_ppgtt_clear_pt(struct i915_address_space *vm,
 	while (pte < pte_end)
 		vaddr[pte++] = scratch_pte;
 	kunmap_atomic(vaddr);
+	update_px(vm, pt, gen8_pte_index(start), num_entries);
 
 	return false;
 }
@@ -861,6 +877,7 @@ static void gen8_ppgtt_set_pde(struct i915_address_space *vm,
 	vaddr = kmap_atomic_px(pd);
 	vaddr[pde] = gen8_pde_encode(px_dma(pt), I915_CACHE_LLC);
 	kunmap_atomic(vaddr);
+	update_px(vm, pd, pde, 1);
 }
 
 static bool gen8_ppgtt_clear_pd(struct i915_address_space *vm,
@@ -900,6 +917,7 @@ static void gen8_ppgtt_set_pdpe(struct i915_address_space *vm,
 	vaddr = kmap_atomic_px(pdp);
 	vaddr[pdpe] = gen8_pdpe_encode(px_dma(pd), I915_CACHE_LLC);
 	kunmap_atomic(vaddr);
+	update_px(vm, pdp, pdpe, 1);
 }
 
 /* Removes entries from a single page dir pointer, releasing it if it's empty.
@@ -934,7 +952,8 @@ static void gen8_ppgtt_clear_3lvl(struct i915_address_space *vm,
 	gen8_ppgtt_clear_pdp(vm, &i915_vm_to_ppgtt(vm)->pdp, start, length);
 }
 
-static void gen8_ppgtt_set_pml4e(struct i915_pml4 *pml4,
+static void gen8_ppgtt_set_pml4e(struct i915_address_space *vm,
+				 struct i915_pml4 *pml4,
 				 struct i915_page_directory_pointer *pdp,
 				 unsigned int pml4e)
 {
@@ -945,6 +964,7 @@ static void gen8_ppgtt_set_pml4e(struct i915_pml4 *pml4,
 	vaddr = kmap_atomic_px(pml4);
 	vaddr[pml4e] = gen8_pml4e_encode(px_dma(pdp), I915_CACHE_LLC);
 	kunmap_atomic(vaddr);
+	update_px(vm, pml4, pml4e, 1);
 }
 
 /* Removes entries from a single pml4.
@@ -967,7 +987,7 @@ static void gen8_ppgtt_clear_4lvl(struct i915_address_space *vm,
 		if (!gen8_ppgtt_clear_pdp(vm, pdp, start, length))
 			continue;
 
-		gen8_ppgtt_set_pml4e(pml4, vm->scratch_pdp, pml4e);
+		gen8_ppgtt_set_pml4e(vm, pml4, vm->scratch_pdp, pml4e);
 
 		free_pdp(vm, pdp);
 	}
@@ -1008,12 +1028,15 @@ gen8_ppgtt_insert_pte_entries(struct i915_hw_ppgtt *ppgtt,
 {
 	struct i915_page_directory *pd;
 	const gen8_pte_t pte_encode = gen8_pte_encode(0, cache_level);
+	struct i915_page_table *pt;
+	unsigned int first = idx->pte;
 	gen8_pte_t *vaddr;
 	bool ret;
 
 	GEM_BUG_ON(idx->pdpe >= i915_pdpes_per_pdp(&ppgtt->base));
 	pd = pdp->page_directory[idx->pdpe];
-	vaddr = kmap_atomic_px(pd->page_table[idx->pde]);
+	pt = pd->page_table[idx->pde];
+	vaddr = kmap_atomic_px(pt);
 	do {
 		vaddr[idx->pte] = pte_encode | iter->dma;
 
@@ -1021,6 +1044,8 @@ gen8_ppgtt_insert_pte_entries(struct i915_hw_ppgtt *ppgtt,
 		if (iter->dma >= iter->max) {
 			iter->sg = __sg_next(iter->sg);
 			if (!iter->sg) {
+				update_px(&ppgtt->base, pt, first,
+					  idx->pte + 1 - first);
 				ret = false;
 				break;
 			}
@@ -1030,7 +1055,9 @@ gen8_ppgtt_insert_pte_entries(struct i915_hw_ppgtt *ppgtt,
 		}
 
 		if (++idx->pte == GEN8_PTES) {
+			update_px(&ppgtt->base, pt, first, GEN8_PTES - first);
 			idx->pte = 0;
+			first = 0;
 
 			if (++idx->pde == I915_PDES) {
 				idx->pde = 0;
@@ -1047,7 +1074,8 @@ gen8_ppgtt_insert_pte_entries(struct i915_hw_ppgtt *ppgtt,
 			}
 
 			kunmap_atomic(vaddr);
-			vaddr = kmap_atomic_px(pd->page_table[idx->pde]);
+			pt = pd->page_table[idx->pde];
+			vaddr = kmap_atomic_px(pt);
 		}
 	} while (1);
 	kunmap_atomic(vaddr);
@@ -1086,8 +1114,9 @@ static void gen8_ppgtt_insert_huge_entries(struct i915_vma *vma,
 		unsigned int page_size;
 		bool maybe_64K = false;
 		gen8_pte_t encode = pte_encode;
+		struct i915_page_dma *p;
 		gen8_pte_t *vaddr;
-		u16 index, max;
+		u16 index, first, max;
 
 		if (vma->page_sizes.sg & I915_GTT_PAGE_SIZE_2M &&
 		    IS_ALIGNED(iter->dma, I915_GTT_PAGE_SIZE_2M) &&
@@ -1098,7 +1127,7 @@ static void gen8_ppgtt_insert_huge_entries(struct i915_vma *vma,
 
 			encode |= GEN8_PDE_PS_2M;
 
-			vaddr = kmap_atomic_px(pd);
+			p = px_base(pd);
 		} else {
 			struct i915_page_table *pt = pd->page_table[idx.pde];
 
@@ -1113,9 +1142,11 @@ static void gen8_ppgtt_insert_huge_entries(struct i915_vma *vma,
 			     rem >= (max - index) << PAGE_SHIFT))
 				maybe_64K = true;
 
-			vaddr = kmap_atomic_px(pt);
+			p = px_base(pt);
 		}
 
+		first = index;
+		vaddr = kmap_atomic(p->page);
 		do {
 			GEM_BUG_ON(iter->sg->length < page_size);
 			vaddr[index++] = encode | iter->dma;
@@ -1144,6 +1175,7 @@ static void gen8_ppgtt_insert_huge_entries(struct i915_vma *vma,
 		} while (rem >= page_size && index < max);
 
 		kunmap_atomic(vaddr);
+		update_page_dma(vma->vm, p, first, index - first);
 
 		/*
 		 * Is it safe to mark the 2M block as 64K? -- Either we have
@@ -1160,6 +1192,7 @@ static void gen8_ppgtt_insert_huge_entries(struct i915_vma *vma,
 			vaddr = kmap_atomic_px(pd);
 			vaddr[idx.pde] |= GEN8_PDE_IPS_64K;
 			kunmap_atomic(vaddr);
+			update_px(vma->vm, pd, idx.pde, 1);
 			page_size = I915_GTT_PAGE_SIZE_64K;
 		}
 
@@ -1252,30 +1285,32 @@ static int gen8_ppgtt_notify_vgt(struct i915_hw_ppgtt *ppgtt, bool create)
 {
 	struct i915_address_space *vm = &ppgtt->base;
 	struct drm_i915_private *dev_priv = vm->i915;
+	u64 pdps[GEN8_3LVL_PDPES];
 	enum vgt_g2v_type msg;
+	unsigned int count;
 	int i;
 
 	if (use_4lvl(vm)) {
-		const u64 daddr = px_dma(&ppgtt->pml4);
-
-		I915_WRITE(vgtif_reg(pdp[0].lo), lower_32_bits(daddr));
-		I915_WRITE(vgtif_reg(pdp[0].hi), upper_32_bits(daddr));
+		pdps[0] = px_dma(&ppgtt->pml4);
+		count = 1;
 
 		msg = (create ? VGT_G2V_PPGTT_L4_PAGE_TABLE_CREATE :
 				VGT_G2V_PPGTT_L4_PAGE_TABLE_DESTROY);
 	} else {
-		for (i = 0; i < GEN8_3LVL_PDPES; i++) {
-			const u64 daddr = i915_page_dir_dma_addr(ppgtt, i);
-
-			I915_WRITE(vgtif_reg(pdp[i].lo), lower_32_bits(daddr));
-			I915_WRITE(vgtif_reg(pdp[i].hi), upper_32_bits(daddr));
-		}
+		for (i = 0; i < GEN8_3LVL_PDPES; i++)
+			pdps[i] = i915_page_dir_dma_addr(ppgtt, i);
+		count = GEN8_3LVL_PDPES;
 
 		msg = (create ? VGT_G2V_PPGTT_L3_PAGE_TABLE_CREATE :
 				VGT_G2V_PPGTT_L3_PAGE_TABLE_DESTROY);
 	}
 
-	I915_WRITE(vgtif_reg(g2v_notify), msg);
+	/*
+	 * GVT-g only needs to know of a new PPGTT before it is submitted, but
+	 * it must have dropped the write protection of a destroyed one before
+	 * its pages are freed and reused.
+	 */
+	intel_vgt_g2v_notify(dev_priv, msg, pdps, count, !create);
 
 	return 0;
 }
@@ -1441,7 +1476,7 @@ static int gen8_ppgtt_alloc_4lvl(struct i915_address_space *vm,
 				goto unwind;
 
 			gen8_initialize_pdp(vm, pdp);
-			gen8_ppgtt_set_pml4e(pml4, pdp, pml4e);
+			gen8_ppgtt_set_pml4e(vm, pml4, pdp, pml4e);
 		}
 
 		ret = gen8_ppgtt_alloc_pdp(vm, pdp, start, length);
@@ -1453,7 +1488,7 @@ static int gen8_ppgtt_alloc_4lvl(struct i915_address_space *vm,
 
 unwind_pdp:
 	if (!pdp->used_pdpes) {
-		gen8_ppgtt_set_pml4e(pml4, vm->scratch_pdp, pml4e);
+		gen8_ppgtt_set_pml4e(vm, pml4, vm->scratch_pdp, pml4e);
 		free_pdp(vm, pdp);
 	}
 unwind:
@@ -2193,6 +2228,67 @@ int i915_ppgtt_init_hw(struct drm_i915_private *dev_priv)
 	return 0;
 }
 
+/*
+ * Setting up a full PPGTT allocates and maps its scratch page and page
+ * tables and its top level directory, which contexts created and destroyed
+ * at a high rate pay every time. When released, all the VMA of a PPGTT are
+ * gone and its page tables are back to scratch, so a few of them are kept
+ * as they are for the next contexts. Not in a guest, where the host shadows
+ * every PPGTT until it is released.
+ */
+#define I915_PPGTT_CACHE_MAX 16
+
+static bool ppgtt_cache_enabled(struct drm_i915_private *dev_priv)
+{
+	return HAS_LOGICAL_RING_CONTEXTS(dev_priv) &&
+	       !intel_vgpu_active(dev_priv);
+}
+
+static struct i915_hw_ppgtt *ppgtt_cache_get(struct drm_i915_private *dev_priv)
+{
+	struct i915_hw_ppgtt *ppgtt;
+
+	lockdep_assert_held(&dev_priv->drm.struct_mutex);
+
+	ppgtt = list_first_entry_or_null(&dev_priv->mm.ppgtt_cache,
+					 typeof(*ppgtt), base.global_link);
+	if (ppgtt) {
+		list_del(&ppgtt->base.global_link);
+		dev_priv->mm.ppgtt_cache_count--;
+		ppgtt->base.closed = false;
+	}
+	return ppgtt;
+}
+
+static bool ppgtt_cache_put(struct i915_hw_ppgtt *ppgtt)
+{
+	struct drm_i915_private *dev_priv = ppgtt->base.i915;
+
+	lockdep_assert_held(&dev_priv->drm.struct_mutex);
+
+	if (!ppgtt_cache_enabled(dev_priv) ||
+	    dev_priv->mm.ppgtt_cache_count >= I915_PPGTT_CACHE_MAX)
+		return false;
+
+	/* keep the page tables, i915_ppgtt_create() inits the rest again */
+	i915_address_space_fini(&ppgtt->base);
+	list_add(&ppgtt->base.global_link, &dev_priv->mm.ppgtt_cache);
+	dev_priv->mm.ppgtt_cache_count++;
+	return true;
+}
+
+static void ppgtt_cache_fini(struct drm_i915_private *dev_priv)
+{
+	struct i915_hw_ppgtt *ppgtt;
+
+	while ((ppgtt = ppgtt_cache_get(dev_priv))) {
+		ppgtt->base.cleanup(&ppgtt->base);
+		if (pagevec_count(&ppgtt->base.free_pages))
+			vm_free_pages_release(&ppgtt->base, true);
+		kfree(ppgtt);
+	}
+}
+
 struct i915_hw_ppgtt *
 i915_ppgtt_create(struct drm_i915_private *dev_priv,
 		  struct drm_i915_file_private *fpriv,
@@ -2201,6 +2297,10 @@ i915_ppgtt_create(struct drm_i915_private *dev_priv,
 	struct i915_hw_ppgtt *ppgtt;
 	int ret;
 
+	ppgtt = ppgtt_cache_get(dev_priv);
+	if (ppgtt)
+		goto init;
+
 	ppgtt = kzalloc(sizeof(*ppgtt), GFP_KERNEL);
 	if (!ppgtt)
 		return ERR_PTR(-ENOMEM);
@@ -2211,6 +2311,7 @@ i915_ppgtt_create(struct drm_i915_private *dev_priv,
 		return ERR_PTR(ret);
 	}
 
+init:
 	kref_init(&ppgtt->ref);
 	i915_address_space_init(&ppgtt->base, dev_priv, name);
 	ppgtt->base.file = fpriv;
@@ -2253,6 +2354,9 @@ void i915_ppgtt_release(struct kref *kref)
 	GEM_BUG_ON(!list_empty(&ppgtt->base.inactive_list));
 	GEM_BUG_ON(!list_empty(&ppgtt->base.unbound_list));
 
+	if (ppgtt_cache_put(ppgtt))
+		return;
+
 	ppgtt->base.cleanup(&ppgtt->base);
 	i915_address_space_fini(&ppgtt->base);
 	kfree(ppgtt);
@@ -2862,6 +2966,12 @@ int i915_gem_init_ggtt(struct drm_i915_private *dev_priv)
 	if (ret)
 		return ret;
 
+	intel_vgt_init_pv_mailbox(dev_priv);
+	intel_vgt_init_pv_ppgtt(dev_priv);
+	intel_vgt_init_pv_submission(dev_priv);
+	intel_vgt_init_pv_timestamp(dev_priv);
+	intel_vgt_init_balloon_resize(dev_priv);
+
 	/* Reserve a mappable slot for our lockless error capture */
 	ret = drm_mm_insert_node_in_range(&ggtt->base.mm, &ggtt->error_capture,
 					  PAGE_SIZE, 0, I915_COLOR_UNEVICTABLE,
@@ -2905,6 +3015,8 @@ void i915_ggtt_cleanup_hw(struct drm_i915_private *dev_priv)
 	struct i915_vma *vma, *vn;
 	struct pagevec *pvec;
 
+	intel_vgt_fini_balloon_resize(dev_priv);
+
 	ggtt->base.closed = true;
 
 	mutex_lock(&dev_priv->drm.struct_mutex);
@@ -2917,11 +3029,16 @@ void i915_ggtt_cleanup_hw(struct drm_i915_private *dev_priv)
 
 	mutex_lock(&dev_priv->drm.struct_mutex);
 	i915_gem_fini_aliasing_ppgtt(dev_priv);
+	ppgtt_cache_fini(dev_priv);
 
 	if (drm_mm_node_allocated(&ggtt->error_capture))
 		drm_mm_remove_node(&ggtt->error_capture);
 
 	if (drm_mm_initialized(&ggtt->base.mm)) {
+		intel_vgt_fini_pv_timestamp(dev_priv);
+		intel_vgt_fini_pv_submission(dev_priv);
+		intel_vgt_fini_pv_ppgtt(dev_priv);
+		intel_vgt_fini_pv_mailbox(dev_priv);
 		intel_vgt_deballoon(dev_priv);
 		i915_address_space_fini(&ggtt->base);
 	}
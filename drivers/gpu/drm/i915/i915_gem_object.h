@@ -26,6 +26,7 @@
 #define __I915_GEM_OBJECT_H__
 
 #include <linux/reservation.h>
+#include <linux/rhashtable.h>
 
 #include <drm/drm_vma_manager.h>
 #include <drm/drm_gem.h>
@@ -40,14 +41,16 @@ struct drm_i915_gem_object;
 
 /*
  * struct i915_lut_handle tracks the fast lookups from handle to vma used
- * for execbuf. Although we use a radixtree for that mapping, in order to
- * remove them as the object or context is closed, we need a secondary list
- * and a translation entry (i915_lut_handle).
+ * for execbuf. It is the entry of the per-context hashtable keyed by the
+ * handle, and is also kept on a list of the object and of the context so
+ * that the lookups can be removed as either is closed.
  */
 struct i915_lut_handle {
+	struct rhash_head hash;
 	struct list_head obj_link;
 	struct list_head ctx_link;
 	struct i915_gem_context *ctx;
+	struct i915_vma *vma;
 	u32 handle;
 };
 
@@ -56,6 +59,7 @@ struct drm_i915_gem_object_ops {
 #define I915_GEM_OBJECT_HAS_STRUCT_PAGE	BIT(0)
 #define I915_GEM_OBJECT_IS_SHRINKABLE	BIT(1)
 #define I915_GEM_OBJECT_IS_PROXY	BIT(2)
+#define I915_GEM_OBJECT_CACHE_DMABUF_MAPS	BIT(3)
 
 	/* Interface between the GEM object and its backing storage.
 	 * get_pages() is called once prior to the use of the associated set
@@ -103,6 +107,14 @@ struct drm_i915_gem_object {
 	 * They are also added to @vma_list for easy iteration.
 	 */
 	struct rb_root vma_tree;
+	/**
+	 * @vma_hint: The VMA last returned by i915_vma_instance()
+	 *
+	 * Objects bound into many address spaces, such as the GVT shadow
+	 * objects, have a deep @vma_tree; the same VMA is usually looked up
+	 * again straight away, so check it before walking the tree.
+	 */
+	struct i915_vma *vma_hint;
 
 	/**
 	 * @lut_list: List of vma lookup entries in use for this object.
@@ -113,6 +125,18 @@ struct drm_i915_gem_object {
 	 */
 	struct list_head lut_list;
 
+	/**
+	 * @dmabuf_maps: DMA mappings of the exported object which importers
+	 * have unmapped, most recent first. They keep the pages pinned so
+	 * that a device importing the dma-buf again reuses its mapping.
+	 * Only used with I915_GEM_OBJECT_CACHE_DMABUF_MAPS.
+	 */
+	struct {
+		spinlock_t lock;
+		struct list_head list;
+		unsigned int count;
+	} dmabuf_maps;
+
 	/** Stolen memory for this object, instead of being backed by shmem. */
 	struct drm_mm_node *stolen;
 	union {
@@ -385,6 +409,12 @@ i915_gem_object_is_proxy(const struct drm_i915_gem_object *obj)
 	return obj->ops->flags & I915_GEM_OBJECT_IS_PROXY;
 }
 
+static inline bool
+i915_gem_object_caches_dmabuf_maps(const struct drm_i915_gem_object *obj)
+{
+	return obj->ops->flags & I915_GEM_OBJECT_CACHE_DMABUF_MAPS;
+}
+
 static inline bool
 i915_gem_object_is_active(const struct drm_i915_gem_object *obj)
 {
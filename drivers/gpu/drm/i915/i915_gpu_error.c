@@ -291,38 +291,6 @@ static void err_compression_marker(struct drm_i915_error_state_buf *m)
 
 #else
 
-struct compress {
-};
-
-static bool compress_init(struct compress *c)
-{
-	return true;
-}
-
-static int compress_page(struct compress *c,
-			 void *src,
-			 struct drm_i915_error_object *dst)
-{
-	unsigned long page;
-	void *ptr;
-
-	page = __get_free_page(GFP_ATOMIC | __GFP_NOWARN);
-	if (!page)
-		return -ENOMEM;
-
-	ptr = (void *)page;
-	if (!i915_memcpy_from_wc(ptr, src, PAGE_SIZE))
-		memcpy(ptr, src, PAGE_SIZE);
-	dst->pages[dst->page_count++] = ptr;
-
-	return 0;
-}
-
-static void compress_fini(struct compress *c,
-			  struct drm_i915_error_object *dst)
-{
-}
-
 static void err_compression_marker(struct drm_i915_error_state_buf *m)
 {
 	err_puts(m, "~");
@@ -927,6 +895,27 @@ void __i915_gpu_state_free(struct kref *error_ref)
 	kfree(error);
 }
 
+static int copy_error_page(void *src, struct drm_i915_error_object *dst)
+{
+	unsigned long page;
+	void *ptr;
+
+	page = __get_free_page(GFP_ATOMIC | __GFP_NOWARN);
+	if (!page)
+		return -ENOMEM;
+
+	ptr = (void *)page;
+	if (!i915_memcpy_from_wc(ptr, src, PAGE_SIZE))
+		memcpy(ptr, src, PAGE_SIZE);
+	dst->pages[dst->page_count++] = ptr;
+
+	return 0;
+}
+
+/*
+ * The objects are only copied while the machine is stopped, compressing
+ * them is left to i915_compress_error_objects() once it runs again.
+ */
 static struct drm_i915_error_object *
 i915_error_object_create(struct drm_i915_private *i915,
 			 struct i915_vma *vma)
@@ -934,7 +923,6 @@ i915_error_object_create(struct drm_i915_private *i915,
 	struct i915_ggtt *ggtt = &i915->ggtt;
 	const u64 slot = ggtt->error_capture.start;
 	struct drm_i915_error_object *dst;
-	struct compress compress;
 	unsigned long num_pages;
 	struct sgt_iter iter;
 	dma_addr_t dma;
@@ -943,7 +931,6 @@ i915_error_object_create(struct drm_i915_private *i915,
 		return NULL;
 
 	num_pages = min_t(u64, vma->size, vma->obj->base.size) >> PAGE_SHIFT;
-	num_pages = DIV_ROUND_UP(10 * num_pages, 8); /* worstcase zlib growth */
 	dst = kmalloc(sizeof(*dst) + num_pages * sizeof(u32 *),
 		      GFP_ATOMIC | __GFP_NOWARN);
 	if (!dst)
@@ -954,20 +941,18 @@ i915_error_object_create(struct drm_i915_private *i915,
 	dst->page_count = 0;
 	dst->unused = 0;
 
-	if (!compress_init(&compress)) {
-		kfree(dst);
-		return NULL;
-	}
-
 	for_each_sgt_dma(dma, iter, vma->pages) {
 		void __iomem *s;
 		int ret;
 
+		if (dst->page_count == num_pages)
+			break;
+
 		ggtt->base.insert_page(&ggtt->base, dma, slot,
 				       I915_CACHE_NONE, 0);
 
 		s = io_mapping_map_atomic_wc(&ggtt->iomap, slot);
-		ret = compress_page(&compress, (void  __force *)s, dst);
+		ret = copy_error_page((void __force *)s, dst);
 		io_mapping_unmap_atomic(s);
 
 		if (ret)
@@ -982,11 +967,86 @@ i915_error_object_create(struct drm_i915_private *i915,
 	dst = NULL;
 
 out:
-	compress_fini(&compress, dst);
 	ggtt->base.clear_range(&ggtt->base, slot, PAGE_SIZE);
 	return dst;
 }
 
+#ifdef CONFIG_DRM_I915_COMPRESS_ERROR
+/* Replace the plain copy @src of an object by its compressed version. */
+static struct drm_i915_error_object *
+compress_error_object(struct drm_i915_error_object *src)
+{
+	struct drm_i915_error_object *dst;
+	struct compress compress;
+	unsigned long num_pages;
+	int page;
+
+	if (!src)
+		return NULL;
+
+	num_pages = DIV_ROUND_UP(10 * src->page_count, 8); /* zlib growth */
+	dst = kmalloc(sizeof(*dst) + num_pages * sizeof(u32 *),
+		      GFP_KERNEL | __GFP_NOWARN);
+	if (!dst)
+		goto out;
+
+	dst->gtt_offset = src->gtt_offset;
+	dst->gtt_size = src->gtt_size;
+	dst->page_count = 0;
+	dst->unused = 0;
+
+	if (!compress_init(&compress)) {
+		kfree(dst);
+		dst = NULL;
+		goto out;
+	}
+
+	for (page = 0; page < src->page_count; page++) {
+		if (compress_page(&compress, src->pages[page], dst))
+			goto unwind;
+	}
+	goto fini;
+
+unwind:
+	while (dst->page_count--)
+		free_page((unsigned long)dst->pages[dst->page_count]);
+	kfree(dst);
+	dst = NULL;
+
+fini:
+	compress_fini(&compress, dst);
+out:
+	i915_error_object_free(src);
+	return dst;
+}
+
+static void i915_compress_error_objects(struct i915_gpu_state *error)
+{
+	long i, j;
+
+	for (i = 0; i < ARRAY_SIZE(error->engine); i++) {
+		struct drm_i915_error_engine *ee = &error->engine[i];
+
+		for (j = 0; j < ee->user_bo_count; j++)
+			ee->user_bo[j] = compress_error_object(ee->user_bo[j]);
+
+		ee->batchbuffer = compress_error_object(ee->batchbuffer);
+		ee->wa_batchbuffer = compress_error_object(ee->wa_batchbuffer);
+		ee->ringbuffer = compress_error_object(ee->ringbuffer);
+		ee->hws_page = compress_error_object(ee->hws_page);
+		ee->ctx = compress_error_object(ee->ctx);
+		ee->wa_ctx = compress_error_object(ee->wa_ctx);
+		ee->default_state = compress_error_object(ee->default_state);
+	}
+
+	error->uc.guc_log = compress_error_object(error->uc.guc_log);
+}
+#else
+static void i915_compress_error_objects(struct i915_gpu_state *error)
+{
+}
+#endif
+
 /* The error capture is special as tries to run underneath the normal
  * locking rules - so we use the raw version of the i915_gem_active lookup.
  */
@@ -1775,6 +1835,9 @@ i915_capture_gpu_state(struct drm_i915_private *i915)
 
 	stop_machine(capture, error, NULL);
 
+	/* compressing takes much longer than the copy, don't stop for it */
+	i915_compress_error_objects(error);
+
 	return error;
 }
 
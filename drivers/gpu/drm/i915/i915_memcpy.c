@@ -28,6 +28,7 @@
 #include "i915_drv.h"
 
 static DEFINE_STATIC_KEY_FALSE(has_movntdqa);
+static DEFINE_STATIC_KEY_FALSE(has_avx2);
 
 #ifdef CONFIG_AS_MOVNTDQA
 static void __memcpy_ntdqa(void *dst, const void *src, unsigned long len)
@@ -59,6 +60,108 @@ static void __memcpy_ntdqa(void *dst, const void *src, unsigned long len)
 
 	kernel_fpu_end();
 }
+
+static void __memcpy_ntdqu(void *dst, const void *src, unsigned long len)
+{
+	kernel_fpu_begin();
+
+	len >>= 4;
+	while (len >= 4) {
+		asm("movntdqa   (%0), %%xmm0\n"
+		    "movntdqa 16(%0), %%xmm1\n"
+		    "movntdqa 32(%0), %%xmm2\n"
+		    "movntdqa 48(%0), %%xmm3\n"
+		    "movups %%xmm0,   (%1)\n"
+		    "movups %%xmm1, 16(%1)\n"
+		    "movups %%xmm2, 32(%1)\n"
+		    "movups %%xmm3, 48(%1)\n"
+		    :: "r" (src), "r" (dst) : "memory");
+		src += 64;
+		dst += 64;
+		len -= 4;
+	}
+	while (len--) {
+		asm("movntdqa (%0), %%xmm0\n"
+		    "movups %%xmm0, (%1)\n"
+		    :: "r" (src), "r" (dst) : "memory");
+		src += 16;
+		dst += 16;
+	}
+
+	kernel_fpu_end();
+}
+#endif
+
+#if defined(CONFIG_AS_MOVNTDQA) && defined(CONFIG_AS_AVX2)
+/*
+ * The 256-bit vmovntdqa needs a 32 byte aligned source, a source which is
+ * only 16 byte aligned starts with a 128-bit load. The destination may be
+ * unaligned.
+ */
+static void __memcpy_ntdqa_avx2(void *dst, const void *src, unsigned long len)
+{
+	kernel_fpu_begin();
+
+	len >>= 4;
+	if ((unsigned long)src & 16) {
+		asm("vmovntdqa (%0), %%xmm0\n"
+		    "vmovdqu %%xmm0, (%1)\n"
+		    :: "r" (src), "r" (dst) : "memory");
+		src += 16;
+		dst += 16;
+		len--;
+	}
+	while (len >= 8) {
+		asm("vmovntdqa   (%0), %%ymm0\n"
+		    "vmovntdqa 32(%0), %%ymm1\n"
+		    "vmovntdqa 64(%0), %%ymm2\n"
+		    "vmovntdqa 96(%0), %%ymm3\n"
+		    "vmovdqu %%ymm0,   (%1)\n"
+		    "vmovdqu %%ymm1, 32(%1)\n"
+		    "vmovdqu %%ymm2, 64(%1)\n"
+		    "vmovdqu %%ymm3, 96(%1)\n"
+		    :: "r" (src), "r" (dst) : "memory");
+		src += 128;
+		dst += 128;
+		len -= 8;
+	}
+	while (len >= 2) {
+		asm("vmovntdqa (%0), %%ymm0\n"
+		    "vmovdqu %%ymm0, (%1)\n"
+		    :: "r" (src), "r" (dst) : "memory");
+		src += 32;
+		dst += 32;
+		len -= 2;
+	}
+	if (len) {
+		asm("vmovntdqa (%0), %%xmm0\n"
+		    "vmovdqu %%xmm0, (%1)\n"
+		    :: "r" (src), "r" (dst) : "memory");
+	}
+
+	kernel_fpu_end();
+}
+#endif
+
+/* Copies below this size don't make up for the wider registers. */
+#define AVX2_MIN_BYTES	256
+
+#ifdef CONFIG_AS_MOVNTDQA
+/* @src must be 16 byte aligned, @len a multiple of 16 */
+static void memcpy_ntdqa(void *dst, const void *src, unsigned long len)
+{
+#ifdef CONFIG_AS_AVX2
+	if (static_branch_likely(&has_avx2) && len >= AVX2_MIN_BYTES) {
+		__memcpy_ntdqa_avx2(dst, src, len);
+		return;
+	}
+#endif
+
+	if (IS_ALIGNED((unsigned long)dst, 16))
+		__memcpy_ntdqa(dst, src, len);
+	else
+		__memcpy_ntdqu(dst, src, len);
+}
 #endif
 
 /**
@@ -86,7 +189,7 @@ bool i915_memcpy_from_wc(void *dst, const void *src, unsigned long len)
 #ifdef CONFIG_AS_MOVNTDQA
 	if (static_branch_likely(&has_movntdqa)) {
 		if (likely(len))
-			__memcpy_ntdqa(dst, src, len);
+			memcpy_ntdqa(dst, src, len);
 		return true;
 	}
 #endif
@@ -94,6 +197,48 @@ bool i915_memcpy_from_wc(void *dst, const void *src, unsigned long len)
 	return false;
 }
 
+/**
+ * i915_unaligned_memcpy_from_wc: perform an accelerated read from WC
+ * @dst: destination pointer
+ * @src: source pointer
+ * @len: how many bytes to copy
+ *
+ * Like i915_memcpy_from_wc(), but without any alignment requirement. The
+ * unaligned head and tail of @src, less than 16 bytes each, are copied with
+ * plain loads, the rest with non-temporal ones.
+ *
+ * Returns true if the copy was done, false if accelerated reads from WC
+ * are not supported, in which case nothing was copied.
+ */
+bool i915_unaligned_memcpy_from_wc(void *dst, const void *src,
+				   unsigned long len)
+{
+#ifdef CONFIG_AS_MOVNTDQA
+	unsigned long head, body;
+
+	if (!static_branch_likely(&has_movntdqa))
+		return false;
+
+	head = min(ALIGN((unsigned long)src, 16) - (unsigned long)src, len);
+	if (head) {
+		memcpy(dst, src, head);
+		dst += head;
+		src += head;
+		len -= head;
+	}
+
+	body = round_down(len, 16);
+	if (body)
+		memcpy_ntdqa(dst, src, body);
+
+	if (len > body)
+		memcpy(dst + body, src + body, len - body);
+	return true;
+#else
+	return false;
+#endif
+}
+
 void i915_memcpy_init_early(struct drm_i915_private *dev_priv)
 {
 	/*
@@ -101,6 +246,9 @@ void i915_memcpy_init_early(struct drm_i915_private *dev_priv)
 	 * emulation. So don't enable movntdqa in hypervisor guest.
 	 */
 	if (static_cpu_has(X86_FEATURE_XMM4_1) &&
-	    !boot_cpu_has(X86_FEATURE_HYPERVISOR))
+	    !boot_cpu_has(X86_FEATURE_HYPERVISOR)) {
 		static_branch_enable(&has_movntdqa);
+		if (static_cpu_has(X86_FEATURE_AVX2))
+			static_branch_enable(&has_avx2);
+	}
 }
@@ -178,6 +178,63 @@ i915_param_named(enable_dpcd_backlight, bool, 0600,
 i915_param_named(enable_gvt, bool, 0400,
 	"Enable support for Intel GVT-g graphics virtualization host support(default:false)");
 
+i915_param_named(enable_gvt_prefetch, bool, 0600,
+	"Scan the next vGPU workload of a ring from the vGPU's scan worker while the current one runs on GVT-g (default:false)");
+
+i915_param_named(enable_gvt_ctx_diff, bool, 0600,
+	"Only write back the guest context pages changed by the GPU on GVT-g (default:false)");
+
+i915_param_named(enable_gvt_lazy_ppgtt, bool, 0600,
+	"Shadow a vGPU PPGTT on its first use instead of at creation on GVT-g (default:false)");
+
+i915_param_named(enable_gvt_oos, bool, 0400,
+	"Let frequently written guest page tables go out of sync instead of trapping every write on GVT-g (default:false)");
+
+i915_param_named(enable_gvt_bb_scan_cache, bool, 0600,
+	"Reuse the scanned shadow copy of unchanged guest batch buffers on GVT-g (default:true)");
+
+i915_param_named(gvt_oos_page_quota, int, 0600,
+	"Max number of out-of-sync page table pages a vGPU can use on GVT-g (0=unlimited, default:1024)");
+
+i915_param_named(gvt_oos_hot_writes, int, 0600,
+	"Trapped writes after which a page table goes out of sync, and fewer changed entries per submission after which it is write protected again, with enable_gvt_oos on GVT-g (default:2)");
+
+i915_param_named(gvt_sched_policy, int, 0400,
+	"vGPU scheduling policy on GVT-g (0=time based, 1=time based with interactive vGPUs first, 2=earliest deadline first for vGPUs with a reservation, default:0)");
+
+i915_param_named(gvt_thread_sched, int, 0400,
+	"Scheduling class of the GVT-g workload and service threads (0=normal, 1=SCHED_FIFO, 2=SCHED_DEADLINE, default:0)");
+
+i915_param_named(gvt_thread_sched_rings, int, 0400,
+	"Mask of the rings whose GVT-g workload threads use gvt_thread_sched (default:-1=all)");
+
+i915_param_named(gvt_thread_dl_runtime_us, int, 0400,
+	"SCHED_DEADLINE runtime of each GVT-g thread in us (default:500)");
+
+i915_param_named(gvt_thread_dl_period_us, int, 0400,
+	"SCHED_DEADLINE period and deadline of each GVT-g thread in us (default:1000)");
+
+i915_param_named_unsafe(gvt_thread_cpus, charp, 0400,
+	"CPU list the GVT-g threads run on, e.g. host CPUs not used by vCPUs (default: the CPUs of the GPU's node)");
+
+i915_param_named(enable_gvt_engine_sched, bool, 0400,
+	"Schedule vGPUs on each engine independently instead of switching the whole GPU on GVT-g (default:false)");
+
+i915_param_named(enable_gvt_preemption, bool, 0400,
+	"Preempt a vGPU workload at the end of its time slice on GVT-g (default:false)");
+
+i915_param_named(enable_gvt_private_scratch, bool, 0600,
+	"Give every new vGPU its own PPGTT scratch page tree on GVT-g (default:false)");
+
+i915_param_named(gvt_scan_on_vcpu_node, bool, 0600,
+	"Scan vGPU workloads on the NUMA node of the submitting vCPU instead of the GPU's on GVT-g (default:false)");
+
+i915_param_named(enable_gvt_bb_dedup, bool, 0600,
+	"Share the scanned shadow copy of byte-identical batch buffers between vGPUs on GVT-g (default:false)");
+
+i915_param_named(enable_gvt_waitboost, bool, 0600,
+	"Boost the GPU frequency for the workloads of interactive or backlogged vGPUs on GVT-g (default:false)");
+
 static __always_inline void _print_param(struct drm_printer *p,
 					 const char *name,
 					 const char *type,
@@ -69,7 +69,26 @@ struct drm_printer;
 	param(bool, nuclear_pageflip, false) \
 	param(bool, enable_dp_mst, true) \
 	param(bool, enable_dpcd_backlight, false) \
-	param(bool, enable_gvt, false)
+	param(bool, enable_gvt, false) \
+	param(bool, enable_gvt_prefetch, false) \
+	param(bool, enable_gvt_ctx_diff, false) \
+	param(bool, enable_gvt_lazy_ppgtt, false) \
+	param(bool, enable_gvt_bb_scan_cache, true) \
+	param(bool, enable_gvt_oos, false) \
+	param(int, gvt_oos_page_quota, 1024) \
+	param(int, gvt_oos_hot_writes, 2) \
+	param(int, gvt_sched_policy, 0) \
+	param(int, gvt_thread_sched, 0) \
+	param(int, gvt_thread_sched_rings, -1) \
+	param(int, gvt_thread_dl_runtime_us, 500) \
+	param(int, gvt_thread_dl_period_us, 1000) \
+	param(char *, gvt_thread_cpus, NULL) \
+	param(bool, enable_gvt_engine_sched, false) \
+	param(bool, enable_gvt_preemption, false) \
+	param(bool, enable_gvt_private_scratch, false) \
+	param(bool, gvt_scan_on_vcpu_node, false) \
+	param(bool, enable_gvt_bb_dedup, false) \
+	param(bool, enable_gvt_waitboost, false)
 
 #define MEMBER(T, member, ...) T member;
 struct i915_params {
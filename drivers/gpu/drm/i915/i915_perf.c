@@ -339,6 +339,8 @@ static struct i915_oa_format gen8_plus_oa_formats[I915_OA_FORMAT_MAX] = {
  * @sample_flags: `DRM_I915_PERF_PROP_SAMPLE_*` properties are tracked as flags
  * @single_context: Whether a single or all gpu contexts should be monitored
  * @ctx_handle: A gem ctx handle for use with @single_context
+ * @vgpu_context: Whether only the gpu contexts of a GVT vGPU should be monitored
+ * @vgpu_id: The ID of the vGPU for use with @vgpu_context
  * @metrics_set: An ID for an OA unit metric set advertised via sysfs
  * @oa_format: An OA unit HW report format
  * @oa_periodic: Whether to enable periodic OA unit sampling
@@ -354,6 +356,9 @@ struct perf_open_properties {
 	u64 single_context:1;
 	u64 ctx_handle;
 
+	u64 vgpu_context:1;
+	u32 vgpu_id;
+
 	/* OA sampling state */
 	int metrics_set;
 	int oa_format;
@@ -2589,6 +2594,16 @@ i915_perf_open_ioctl_locked(struct drm_i915_private *dev_priv,
 			ret = -ENOENT;
 			goto err;
 		}
+	} else if (props->vgpu_context) {
+		specific_ctx = intel_gvt_get_vgpu_context(dev_priv,
+							  props->vgpu_id);
+		if (IS_ERR(specific_ctx)) {
+			DRM_DEBUG("Failed to look up vGPU with ID %u for opening perf stream\n",
+				  props->vgpu_id);
+			ret = PTR_ERR(specific_ctx);
+			specific_ctx = NULL;
+			goto err;
+		}
 	}
 
 	/*
@@ -2604,8 +2619,11 @@ i915_perf_open_ioctl_locked(struct drm_i915_private *dev_priv,
 	 * clients from seeing the raw / global counter values via
 	 * MI_REPORT_PERF_COUNT commands and so consider it a privileged op to
 	 * enable the OA unit by default.
+	 *
+	 * A vGPU context belongs to a guest rather than to the client, so
+	 * monitoring it is always a privileged op.
 	 */
-	if (IS_HASWELL(dev_priv) && specific_ctx)
+	if (IS_HASWELL(dev_priv) && specific_ctx && !props->vgpu_context)
 		privileged_op = false;
 
 	/* Similar to perf's kernel.perf_paranoid_cpu sysctl option
@@ -2741,6 +2759,10 @@ static int read_properties_unlocked(struct drm_i915_private *dev_priv,
 
 		switch ((enum drm_i915_perf_property_id)id) {
 		case DRM_I915_PERF_PROP_CTX_HANDLE:
+			if (props->vgpu_context) {
+				DRM_DEBUG("A context handle stream can't also be opened for a vGPU\n");
+				return -EINVAL;
+			}
 			props->single_context = 1;
 			props->ctx_handle = value;
 			break;
@@ -2806,6 +2828,14 @@ static int read_properties_unlocked(struct drm_i915_private *dev_priv,
 			props->oa_periodic = true;
 			props->oa_period_exponent = value;
 			break;
+		case DRM_I915_PERF_PROP_GVT_VGPU_ID:
+			if (props->single_context) {
+				DRM_DEBUG("A vGPU stream can't also be opened for a context handle\n");
+				return -EINVAL;
+			}
+			props->vgpu_context = 1;
+			props->vgpu_id = value;
+			break;
 		case DRM_I915_PERF_PROP_MAX:
 			MISSING_CASE(id);
 			return -EINVAL;
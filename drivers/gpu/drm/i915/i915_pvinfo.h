@@ -46,6 +46,14 @@ enum vgt_g2v_type {
 	VGT_G2V_PPGTT_L4_PAGE_TABLE_DESTROY,
 	VGT_G2V_EXECLIST_CONTEXT_CREATE,
 	VGT_G2V_EXECLIST_CONTEXT_DESTROY,
+	VGT_G2V_PPGTT_PV_RING_REGISTER,
+	VGT_G2V_PPGTT_PV_RING_FLUSH,
+	VGT_G2V_PV_SUBMISSION_REGISTER,
+	VGT_G2V_PV_SUBMISSION_DOORBELL,
+	VGT_G2V_PV_TIMESTAMP_REGISTER,
+	VGT_G2V_GGTT_BALLOON_ACK,
+	VGT_G2V_PV_MAILBOX_REGISTER,
+	VGT_G2V_PV_MAILBOX_DOORBELL,
 	VGT_G2V_MAX,
 };
 
@@ -54,6 +62,116 @@ enum vgt_g2v_type {
  */
 #define VGT_CAPS_FULL_48BIT_PPGTT	BIT(2)
 #define VGT_CAPS_HWSP_EMULATION		BIT(3)
+#define VGT_CAPS_HUGE_GTT		BIT(4)
+#define VGT_CAPS_PV_PPGTT		BIT(5)
+
+/*
+ * PPGTT update ring shared by a guest with VGT_CAPS_PV_PPGTT, registered
+ * by passing its address in pdp[0] with VGT_G2V_PPGTT_PV_RING_REGISTER.
+ * The guest logs each run of page table entries it writes at @tail, the
+ * host consumes them up to @tail at submission and moves @head along.
+ * When the ring is full the guest sends VGT_G2V_PPGTT_PV_RING_FLUSH.
+ * Page tables are no longer write protected once the ring is registered.
+ */
+#define VGT_PV_PPGTT_RING_ENTRIES	255
+
+struct vgt_pv_ppgtt_update {
+	u64 gpa;		/* address of the first entry written */
+	u32 count;		/* number of entries written */
+	u32 rsv;
+} __packed;
+
+struct vgt_pv_ppgtt_ring {
+	u32 head;		/* written by the host */
+	u32 tail;		/* written by the guest */
+	u32 rsv[2];
+	struct vgt_pv_ppgtt_update entry[VGT_PV_PPGTT_RING_ENTRIES];
+} __packed;
+
+#define VGT_CAPS_PV_SUBMISSION		BIT(6)
+
+/*
+ * Submission page shared by a guest with VGT_CAPS_PV_SUBMISSION,
+ * registered by passing its address in pdp[0] with
+ * VGT_G2V_PV_SUBMISSION_REGISTER. Instead of writing the ELSP, the guest
+ * fills the slot of the engine, bumps @submitted and sends
+ * VGT_G2V_PV_SUBMISSION_DOORBELL, which submits the pending slots of all
+ * the engines. The host sets @consumed to the @submitted it took. Context
+ * switches are still reported through the HWSP, which this requires, see
+ * VGT_CAPS_HWSP_EMULATION.
+ */
+#define VGT_PV_SUBMISSION_ENGINES	8
+
+struct vgt_pv_submission_slot {
+	u64 desc[2];		/* descriptors of ELSP port 0 and 1 */
+	u32 submitted;		/* written by the guest */
+	u32 consumed;		/* written by the host */
+	u32 rsv[2];
+} __packed;
+
+struct vgt_pv_submission {
+	struct vgt_pv_submission_slot engine[VGT_PV_SUBMISSION_ENGINES];
+} __packed;
+
+#define VGT_CAPS_PV_TIMESTAMP		BIT(7)
+
+/*
+ * Timestamp page shared by a guest with VGT_CAPS_PV_TIMESTAMP, registered
+ * by passing its address in pdp[0] with VGT_G2V_PV_TIMESTAMP_REGISTER.
+ * RING_TIMESTAMP runs freely at @freq_khz, so once the guest has read it,
+ * it can extrapolate it from its own clock instead of trapping on every
+ * read. The host bumps @generation whenever the timestamp may have jumped,
+ * e.g. across a GPU reset, and the guest then reads it again.
+ */
+struct vgt_pv_timestamp {
+	u32 freq_khz;		/* written by the host */
+	u32 generation;		/* written by the host */
+	u32 rsv[2];
+} __packed;
+
+#define VGT_CAPS_GGTT_BALLOON		BIT(8)
+
+/*
+ * With VGT_CAPS_GGTT_BALLOON, the host may ask a running guest to resize
+ * its non-mappable GM in place, keeping the base. It writes the new size
+ * to avail_rs.nonmappable_request and bumps avail_rs.balloon_seqno; a
+ * larger range is already reserved for the guest at that point. The guest
+ * polls the seqno, rebalances its balloon and answers with
+ * VGT_G2V_GGTT_BALLOON_ACK, passing the size it now uses in pdp[0].lo and
+ * the seqno it answers in pdp[0].hi. That is either the requested or the
+ * previous size, when it couldn't release the range. The host then
+ * updates avail_rs.nonmappable_gmadr.size. A range given up must be
+ * released before answering. A larger range may only be used once
+ * avail_rs.nonmappable_gmadr.size shows it, which the host updates while
+ * handling the answer if the request still stands.
+ */
+
+#define VGT_CAPS_PV_MAILBOX		BIT(9)
+
+/*
+ * Mailbox page shared by a guest with VGT_CAPS_PV_MAILBOX, registered by
+ * passing its address in pdp[0] with VGT_G2V_PV_MAILBOX_REGISTER. Instead
+ * of writing pdp[] and g2v_notify, the guest posts a notification with
+ * its pdp[] payload in @data at @tail. The host handles the posted
+ * notifications in order before any submission and on
+ * VGT_G2V_PV_MAILBOX_DOORBELL, moving @head along, so only notifications
+ * that must be handled right away cost a trapped write. The mailbox
+ * notifications and VGT_G2V_PV_SUBMISSION_DOORBELL can't be posted.
+ */
+#define VGT_PV_MAILBOX_ENTRIES		64	/* a power of two */
+
+struct vgt_pv_mailbox_msg {
+	u32 notification;	/* enum vgt_g2v_type */
+	u32 rsv;
+	u64 data[4];		/* as in pdp[] */
+} __packed;
+
+struct vgt_pv_mailbox {
+	u32 head;		/* written by the host */
+	u32 tail;		/* written by the guest */
+	u32 rsv[2];
+	struct vgt_pv_mailbox_msg msg[VGT_PV_MAILBOX_ENTRIES];
+} __packed;
 
 struct vgt_if {
 	u64 magic;		/* VGT_MAGIC */
@@ -81,7 +199,10 @@ struct vgt_if {
 		} nonmappable_gmadr;	/* non aperture */
 		/* allowed fence registers */
 		u32 fence_num;
-		u32 rsv2[3];
+		/* see VGT_CAPS_GGTT_BALLOON */
+		u32 nonmappable_request;
+		u32 balloon_seqno;
+		u32 rsv2;
 	} avail_rs;		/* available/assigned resource */
 	u32 rsv3[0x200 - 24];	/* pad to half page */
 	/*
@@ -69,6 +69,57 @@ static signed long i915_fence_wait(struct dma_fence *fence,
 	return i915_request_wait(to_request(fence), interruptible, timeout);
 }
 
+/*
+ * Enough requests to cover what is usually in flight on an engine, e.g. the
+ * workloads of a handful of vGPUs, without pinning much memory when idle.
+ */
+#define I915_REQUEST_CACHE_MAX 64
+
+static void request_cache_put(struct i915_request *rq)
+{
+	struct intel_engine_cs *engine = rq->engine;
+
+	if (atomic_inc_return(&engine->request_cache_count) >
+	    I915_REQUEST_CACHE_MAX) {
+		atomic_dec(&engine->request_cache_count);
+		kmem_cache_free(rq->i915->requests, rq);
+		return;
+	}
+
+	llist_add(&rq->free_link, &engine->request_cache);
+}
+
+static struct i915_request *
+request_cache_get(struct intel_engine_cs *engine)
+{
+	struct llist_node *node;
+
+	/* llist_del_first() needs its callers serialised, see alloc */
+	lockdep_assert_held(&engine->i915->drm.struct_mutex);
+
+	node = llist_del_first(&engine->request_cache);
+	if (!node)
+		return NULL;
+
+	atomic_dec(&engine->request_cache_count);
+	return llist_entry(node, struct i915_request, free_link);
+}
+
+/**
+ * i915_request_cache_fini - release the cached requests of an engine
+ * @engine: the engine
+ */
+void i915_request_cache_fini(struct intel_engine_cs *engine)
+{
+	struct i915_request *rq, *next;
+
+	llist_for_each_entry_safe(rq, next,
+				  llist_del_all(&engine->request_cache),
+				  free_link)
+		kmem_cache_free(engine->i915->requests, rq);
+	atomic_set(&engine->request_cache_count, 0);
+}
+
 static void i915_fence_release(struct dma_fence *fence)
 {
 	struct i915_request *rq = to_request(fence);
@@ -82,7 +133,7 @@ static void i915_fence_release(struct dma_fence *fence)
 	 */
 	i915_sw_fence_fini(&rq->submit);
 
-	kmem_cache_free(rq->i915->requests, rq);
+	request_cache_put(rq);
 }
 
 const struct dma_fence_ops i915_fence_ops = {
@@ -702,9 +753,16 @@ i915_request_alloc(struct intel_engine_cs *engine, struct i915_gem_context *ctx)
 	 * active request - which it won't be and restart the lookup.
 	 *
 	 * Do not use kmem_cache_zalloc() here!
+	 *
+	 * The same holds for the requests recycled from the engine cache,
+	 * they never left the TYPESAFE_BY_RCU slab.
 	 */
-	rq = kmem_cache_alloc(i915->requests,
-			      GFP_KERNEL | __GFP_RETRY_MAYFAIL | __GFP_NOWARN);
+	rq = request_cache_get(engine);
+	if (!rq)
+		rq = kmem_cache_alloc(i915->requests,
+				      GFP_KERNEL |
+				      __GFP_RETRY_MAYFAIL |
+				      __GFP_NOWARN);
 	if (unlikely(!rq)) {
 		/* Ratelimit ourselves to prevent oom from malicious clients */
 		ret = i915_gem_wait_for_idle(i915,
@@ -800,7 +858,8 @@ i915_request_alloc(struct intel_engine_cs *engine, struct i915_gem_context *ctx)
 	GEM_BUG_ON(!list_empty(&rq->priotree.signalers_list));
 	GEM_BUG_ON(!list_empty(&rq->priotree.waiters_list));
 
-	kmem_cache_free(i915->requests, rq);
+	i915_sw_fence_fini(&rq->submit);
+	request_cache_put(rq);
 err_unreserve:
 	unreserve_engine(engine);
 err_unpin:
@@ -26,6 +26,7 @@
 #define I915_REQUEST_H
 
 #include <linux/dma-fence.h>
+#include <linux/llist.h>
 
 #include "i915_gem.h"
 #include "i915_sw_fence.h"
@@ -157,6 +158,9 @@ struct i915_request {
 	struct i915_priotree priotree;
 	struct i915_dependency dep;
 
+	/** link in the engine's cache of free requests */
+	struct llist_node free_link;
+
 	/**
 	 * GEM sequence number associated with this request on the
 	 * global execution timeline. It is zero when the request is not
@@ -226,6 +230,7 @@ struct i915_request * __must_check
 i915_request_alloc(struct intel_engine_cs *engine,
 		   struct i915_gem_context *ctx);
 void i915_request_retire_upto(struct i915_request *rq);
+void i915_request_cache_fini(struct intel_engine_cs *engine);
 
 static inline struct i915_request *
 to_request(struct dma_fence *fence)
@@ -86,6 +86,364 @@ bool intel_vgpu_has_full_48bit_ppgtt(struct drm_i915_private *dev_priv)
 	return dev_priv->vgpu.caps & VGT_CAPS_FULL_48BIT_PPGTT;
 }
 
+static void vgt_register_pv_page(struct drm_i915_private *dev_priv,
+				 int notification, u64 gpa)
+{
+	__raw_i915_write32(dev_priv, vgtif_reg(pdp[0].lo), lower_32_bits(gpa));
+	__raw_i915_write32(dev_priv, vgtif_reg(pdp[0].hi), upper_32_bits(gpa));
+	__raw_i915_write32(dev_priv, vgtif_reg(g2v_notify), notification);
+}
+
+/**
+ * intel_vgt_init_pv_mailbox - post notifications to GVT-g
+ * @dev_priv: i915 device private
+ *
+ * If the host supports it, share a page with it where the notifications
+ * are posted, so that those the host can handle later don't trap. This
+ * must be done before any other PV page is registered.
+ */
+void intel_vgt_init_pv_mailbox(struct drm_i915_private *dev_priv)
+{
+	struct vgt_pv_mailbox *mailbox;
+
+	BUILD_BUG_ON(sizeof(struct vgt_pv_mailbox) > PAGE_SIZE);
+	BUILD_BUG_ON(!is_power_of_2(VGT_PV_MAILBOX_ENTRIES));
+
+	if (!intel_vgpu_active(dev_priv) ||
+	    !(dev_priv->vgpu.caps & VGT_CAPS_PV_MAILBOX))
+		return;
+
+	mailbox = (void *)get_zeroed_page(GFP_KERNEL);
+	if (!mailbox)
+		return;
+
+	spin_lock_init(&dev_priv->vgpu.pv_mailbox_lock);
+	dev_priv->vgpu.pv_mailbox = mailbox;
+	vgt_register_pv_page(dev_priv, VGT_G2V_PV_MAILBOX_REGISTER,
+			     virt_to_phys(mailbox));
+	DRM_INFO("Posting notifications to GVT-g through a mailbox.\n");
+}
+
+/**
+ * intel_vgt_fini_pv_mailbox - go back to trapping on every notification
+ * @dev_priv: i915 device private
+ */
+void intel_vgt_fini_pv_mailbox(struct drm_i915_private *dev_priv)
+{
+	if (!dev_priv->vgpu.pv_mailbox)
+		return;
+
+	/* The host handles what is still posted before dropping the page. */
+	vgt_register_pv_page(dev_priv, VGT_G2V_PV_MAILBOX_REGISTER, 0);
+	free_page((unsigned long)dev_priv->vgpu.pv_mailbox);
+	dev_priv->vgpu.pv_mailbox = NULL;
+}
+
+/**
+ * intel_vgt_g2v_notify - send a notification to GVT-g
+ * @dev_priv: i915 device private
+ * @notification: one of enum vgt_g2v_type
+ * @data: payload of the notification, as in pdp[]
+ * @count: number of entries in @data
+ * @doorbell: whether the host must have handled it when this returns
+ *
+ * With the mailbox, a notification without @doorbell is only posted, the
+ * host handles it before the next submission at the latest. Notifications
+ * are always handled in the order they are sent.
+ */
+void intel_vgt_g2v_notify(struct drm_i915_private *dev_priv,
+			  enum vgt_g2v_type notification,
+			  const u64 *data, unsigned int count, bool doorbell)
+{
+	struct vgt_pv_mailbox *mailbox = dev_priv->vgpu.pv_mailbox;
+	struct vgt_pv_mailbox_msg *msg;
+	unsigned long flags;
+	unsigned int i;
+
+	GEM_BUG_ON(count > ARRAY_SIZE(msg->data));
+
+	if (!mailbox) {
+		for (i = 0; i < count; i++) {
+			__raw_i915_write32(dev_priv, vgtif_reg(pdp[i].lo),
+					   lower_32_bits(data[i]));
+			__raw_i915_write32(dev_priv, vgtif_reg(pdp[i].hi),
+					   upper_32_bits(data[i]));
+		}
+		__raw_i915_write32(dev_priv, vgtif_reg(g2v_notify),
+				   notification);
+		return;
+	}
+
+	spin_lock_irqsave(&dev_priv->vgpu.pv_mailbox_lock, flags);
+
+	/* The host empties the mailbox before the write returns. */
+	if (mailbox->tail - READ_ONCE(mailbox->head) == VGT_PV_MAILBOX_ENTRIES)
+		__raw_i915_write32(dev_priv, vgtif_reg(g2v_notify),
+				   VGT_G2V_PV_MAILBOX_DOORBELL);
+
+	msg = &mailbox->msg[mailbox->tail % VGT_PV_MAILBOX_ENTRIES];
+	msg->notification = notification;
+	memset(msg->data, 0, sizeof(msg->data));
+	memcpy(msg->data, data, count * sizeof(*data));
+	smp_wmb();
+	WRITE_ONCE(mailbox->tail, mailbox->tail + 1);
+
+	if (doorbell)
+		__raw_i915_write32(dev_priv, vgtif_reg(g2v_notify),
+				   VGT_G2V_PV_MAILBOX_DOORBELL);
+
+	spin_unlock_irqrestore(&dev_priv->vgpu.pv_mailbox_lock, flags);
+}
+
+/**
+ * intel_vgt_init_pv_ppgtt - report PPGTT updates to GVT-g
+ * @dev_priv: i915 device private
+ *
+ * If the host supports it, share a ring with it where the PPGTT entries
+ * written by the driver are logged, so that the host doesn't need to
+ * write protect the page tables. This must be done before any PPGTT is
+ * created.
+ */
+void intel_vgt_init_pv_ppgtt(struct drm_i915_private *dev_priv)
+{
+	struct vgt_pv_ppgtt_ring *ring;
+
+	BUILD_BUG_ON(sizeof(struct vgt_pv_ppgtt_ring) > PAGE_SIZE);
+
+	if (!intel_vgpu_active(dev_priv) ||
+	    !(dev_priv->vgpu.caps & VGT_CAPS_PV_PPGTT))
+		return;
+
+	ring = (void *)get_zeroed_page(GFP_KERNEL);
+	if (!ring)
+		return;
+
+	spin_lock_init(&dev_priv->vgpu.pv_ppgtt_lock);
+	dev_priv->vgpu.pv_ppgtt = ring;
+	vgt_register_pv_page(dev_priv, VGT_G2V_PPGTT_PV_RING_REGISTER,
+			     virt_to_phys(ring));
+	DRM_INFO("Reporting PPGTT updates to GVT-g.\n");
+}
+
+/**
+ * intel_vgt_fini_pv_ppgtt - stop reporting PPGTT updates to GVT-g
+ * @dev_priv: i915 device private
+ */
+void intel_vgt_fini_pv_ppgtt(struct drm_i915_private *dev_priv)
+{
+	if (!dev_priv->vgpu.pv_ppgtt)
+		return;
+
+	vgt_register_pv_page(dev_priv, VGT_G2V_PPGTT_PV_RING_REGISTER, 0);
+	free_page((unsigned long)dev_priv->vgpu.pv_ppgtt);
+	dev_priv->vgpu.pv_ppgtt = NULL;
+}
+
+/**
+ * intel_vgt_pv_ppgtt_update - log a PPGTT update for GVT-g
+ * @dev_priv: i915 device private
+ * @addr: DMA address of the first PPGTT entry written
+ * @count: number of consecutive entries written
+ *
+ * The host picks up the update at the next submission at the latest.
+ */
+void intel_vgt_pv_ppgtt_update(struct drm_i915_private *dev_priv,
+			       dma_addr_t addr, unsigned int count)
+{
+	struct vgt_pv_ppgtt_ring *ring = dev_priv->vgpu.pv_ppgtt;
+	struct vgt_pv_ppgtt_update *update;
+	unsigned long flags;
+
+	if (!count)
+		return;
+
+	spin_lock_irqsave(&dev_priv->vgpu.pv_ppgtt_lock, flags);
+
+	/* The host consumes the whole ring before the write returns. */
+	if (ring->tail - READ_ONCE(ring->head) == VGT_PV_PPGTT_RING_ENTRIES)
+		__raw_i915_write32(dev_priv, vgtif_reg(g2v_notify),
+				   VGT_G2V_PPGTT_PV_RING_FLUSH);
+
+	update = &ring->entry[ring->tail % VGT_PV_PPGTT_RING_ENTRIES];
+	update->gpa = addr;
+	update->count = count;
+	smp_wmb();
+	WRITE_ONCE(ring->tail, ring->tail + 1);
+
+	spin_unlock_irqrestore(&dev_priv->vgpu.pv_ppgtt_lock, flags);
+}
+
+/**
+ * intel_vgt_init_pv_submission - submit to GVT-g through a doorbell
+ * @dev_priv: i915 device private
+ *
+ * If the host supports it, share a page with it where the execlist
+ * submissions are written, so that a submission costs a single trapped
+ * write instead of one per ELSP dword.
+ */
+void intel_vgt_init_pv_submission(struct drm_i915_private *dev_priv)
+{
+	struct vgt_pv_submission *page;
+
+	BUILD_BUG_ON(sizeof(struct vgt_pv_submission) > PAGE_SIZE);
+	BUILD_BUG_ON(I915_NUM_ENGINES > VGT_PV_SUBMISSION_ENGINES);
+
+	if (!intel_vgpu_active(dev_priv) ||
+	    !(dev_priv->vgpu.caps & VGT_CAPS_PV_SUBMISSION) ||
+	    !intel_vgpu_has_hwsp_emulation(dev_priv))
+		return;
+
+	page = (void *)get_zeroed_page(GFP_KERNEL);
+	if (!page)
+		return;
+
+	dev_priv->vgpu.pv_submission = page;
+	vgt_register_pv_page(dev_priv, VGT_G2V_PV_SUBMISSION_REGISTER,
+			     virt_to_phys(page));
+	DRM_INFO("Submitting to GVT-g through a doorbell.\n");
+}
+
+/**
+ * intel_vgt_fini_pv_submission - go back to ELSP submission
+ * @dev_priv: i915 device private
+ */
+void intel_vgt_fini_pv_submission(struct drm_i915_private *dev_priv)
+{
+	if (!dev_priv->vgpu.pv_submission)
+		return;
+
+	vgt_register_pv_page(dev_priv, VGT_G2V_PV_SUBMISSION_REGISTER, 0);
+	free_page((unsigned long)dev_priv->vgpu.pv_submission);
+	dev_priv->vgpu.pv_submission = NULL;
+}
+
+/**
+ * intel_vgt_pv_submit - submit an execlist to GVT-g
+ * @dev_priv: i915 device private
+ * @engine: engine id
+ * @desc: context descriptors of port 0 and 1
+ *
+ * Called from the execlists submission path in place of the ELSP writes,
+ * so with the engine's timeline lock held.
+ */
+void intel_vgt_pv_submit(struct drm_i915_private *dev_priv,
+			 unsigned int engine, const u64 *desc)
+{
+	struct vgt_pv_submission_slot *slot =
+		&dev_priv->vgpu.pv_submission->engine[engine];
+
+	slot->desc[0] = desc[0];
+	slot->desc[1] = desc[1];
+	wmb();
+	WRITE_ONCE(slot->submitted, slot->submitted + 1);
+
+	__raw_i915_write32(dev_priv, vgtif_reg(g2v_notify),
+			   VGT_G2V_PV_SUBMISSION_DOORBELL);
+}
+
+/**
+ * intel_vgt_init_pv_timestamp - extrapolate the render timestamp
+ * @dev_priv: i915 device private
+ *
+ * If the host supports it, share a page with it that tells when the
+ * render ring timestamp can be extrapolated from the CPU clock, so that
+ * timestamp queries don't trap on each read.
+ */
+void intel_vgt_init_pv_timestamp(struct drm_i915_private *dev_priv)
+{
+	struct vgt_pv_timestamp *page;
+
+	BUILD_BUG_ON(sizeof(struct vgt_pv_timestamp) > PAGE_SIZE);
+
+	if (!intel_vgpu_active(dev_priv) ||
+	    !(dev_priv->vgpu.caps & VGT_CAPS_PV_TIMESTAMP))
+		return;
+
+	page = (void *)get_zeroed_page(GFP_KERNEL);
+	if (!page)
+		return;
+
+	spin_lock_init(&dev_priv->vgpu.pv_timestamp_lock);
+	dev_priv->vgpu.pv_timestamp = page;
+	vgt_register_pv_page(dev_priv, VGT_G2V_PV_TIMESTAMP_REGISTER,
+			     virt_to_phys(page));
+	DRM_INFO("Extrapolating the GPU timestamp for GVT-g.\n");
+}
+
+/**
+ * intel_vgt_fini_pv_timestamp - go back to reading the render timestamp
+ * @dev_priv: i915 device private
+ */
+void intel_vgt_fini_pv_timestamp(struct drm_i915_private *dev_priv)
+{
+	if (!dev_priv->vgpu.pv_timestamp)
+		return;
+
+	vgt_register_pv_page(dev_priv, VGT_G2V_PV_TIMESTAMP_REGISTER, 0);
+	free_page((unsigned long)dev_priv->vgpu.pv_timestamp);
+	dev_priv->vgpu.pv_timestamp = NULL;
+}
+
+/* Bounds the drift between the CPU and the GPU clock. */
+#define VGT_PV_TIMESTAMP_RECALIBRATE_NS (100 * NSEC_PER_MSEC)
+/* RING_TIMESTAMP is 36 bits wide and wraps. */
+#define VGT_PV_TIMESTAMP_MASK GENMASK_ULL(35, 0)
+
+/**
+ * intel_vgt_pv_timestamp - read the render timestamp without trapping
+ * @dev_priv: i915 device private
+ *
+ * The timestamp is only read from the register when the host has bumped
+ * the generation, or when the last read is too old to extrapolate from.
+ * Within a generation, steps back of up to a recalibration period are
+ * clamped away, as a new read of the register may be behind what was
+ * extrapolated by that much. The counter is compared modulo its 36 bits,
+ * so that it keeps counting across a wrap. The caller holds a runtime pm
+ * reference.
+ *
+ * Returns:
+ * The render ring timestamp.
+ */
+u64 intel_vgt_pv_timestamp(struct drm_i915_private *dev_priv)
+{
+	struct i915_virtual_gpu *vgpu = &dev_priv->vgpu;
+	u32 freq = READ_ONCE(vgpu->pv_timestamp->freq_khz);
+	u32 generation = READ_ONCE(vgpu->pv_timestamp->generation);
+	unsigned long flags;
+	u64 now, ts, back;
+	bool restart;
+
+	spin_lock_irqsave(&vgpu->pv_timestamp_lock, flags);
+	now = ktime_get_raw_ns();
+	/* a reset may make the timestamp jump, start over */
+	restart = generation != vgpu->pv_timestamp_generation ||
+		  !vgpu->pv_timestamp_base_ns;
+	if (!freq || restart ||
+	    now - vgpu->pv_timestamp_base_ns > VGT_PV_TIMESTAMP_RECALIBRATE_NS) {
+		vgpu->pv_timestamp_base =
+			I915_READ64_2x32(RING_TIMESTAMP(RENDER_RING_BASE),
+					 RING_TIMESTAMP_UDW(RENDER_RING_BASE)) &
+			VGT_PV_TIMESTAMP_MASK;
+		vgpu->pv_timestamp_base_ns = ktime_get_raw_ns();
+		vgpu->pv_timestamp_generation = generation;
+		ts = vgpu->pv_timestamp_base;
+	} else {
+		ts = (vgpu->pv_timestamp_base +
+		      div_u64((now - vgpu->pv_timestamp_base_ns) * freq,
+			      USEC_PER_SEC)) & VGT_PV_TIMESTAMP_MASK;
+	}
+	if (!restart) {
+		back = (vgpu->pv_timestamp_last - ts) & VGT_PV_TIMESTAMP_MASK;
+		if (back < (u64)freq * (VGT_PV_TIMESTAMP_RECALIBRATE_NS /
+					NSEC_PER_MSEC))
+			ts = vgpu->pv_timestamp_last;
+	}
+	vgpu->pv_timestamp_last = ts;
+	spin_unlock_irqrestore(&vgpu->pv_timestamp_lock, flags);
+
+	return ts;
+}
+
 struct _balloon_info_ {
 	/*
 	 * There are up to 2 regions per mappable/unmappable graphic
@@ -93,6 +451,9 @@ struct _balloon_info_ {
 	 * graphic memory, 2/3 for unmappable graphic memory.
 	 */
 	struct drm_mm_node space[4];
+	/* the unmappable range of the guest, resizable at runtime */
+	unsigned long unmappable_base;
+	unsigned long unmappable_end;
 };
 
 static struct _balloon_info_ bl_info;
@@ -213,6 +574,8 @@ int intel_vgt_balloon(struct drm_i915_private *dev_priv)
 
 	mappable_end = mappable_base + mappable_size;
 	unmappable_end = unmappable_base + unmappable_size;
+	bl_info.unmappable_base = unmappable_base;
+	bl_info.unmappable_end = unmappable_end;
 
 	DRM_INFO("VGT ballooning configuration:\n");
 	DRM_INFO("Mappable graphic memory: base 0x%lx size %ldKiB\n",
@@ -273,3 +636,133 @@ int intel_vgt_balloon(struct drm_i915_private *dev_priv)
 	DRM_ERROR("VGT balloon fail\n");
 	return ret;
 }
+
+/* Each poll is a trapped read, keep it rare. */
+#define VGT_BALLOON_POLL_MS 1000
+
+/*
+ * Move the end of the unmappable balloon to give the guest @size bytes of
+ * unmappable GM, evicting what is bound in the range given up. Returns
+ * the size now in use, the previous one if the range couldn't be freed.
+ */
+static unsigned long vgt_balloon_resize(struct drm_i915_private *dev_priv,
+					unsigned long size)
+{
+	struct i915_ggtt *ggtt = &dev_priv->ggtt;
+	struct drm_mm_node *node = &bl_info.space[3];
+	unsigned long ggtt_end = ggtt->base.total;
+	unsigned long old_end = bl_info.unmappable_end;
+	unsigned long end = bl_info.unmappable_base + size;
+	int ret = 0;
+
+	lockdep_assert_held(&dev_priv->drm.struct_mutex);
+
+	if (!size || !IS_ALIGNED(size, I915_GTT_PAGE_SIZE) || end > ggtt_end) {
+		DRM_ERROR("Invalid balloon resize to %luKiB\n", size / 1024);
+		return old_end - bl_info.unmappable_base;
+	}
+
+	if (end == old_end)
+		return size;
+
+	if (drm_mm_node_allocated(node))
+		vgt_deballoon_space(ggtt, node);
+	if (end < ggtt_end)
+		ret = vgt_balloon_space(ggtt, node, end, ggtt_end);
+	if (ret) {
+		/* nothing else could take the range under struct_mutex */
+		if (old_end < ggtt_end)
+			WARN_ON(vgt_balloon_space(ggtt, node,
+						  old_end, ggtt_end));
+		DRM_INFO("VGT balloon resize to %luKiB failed: %d\n",
+			 size / 1024, ret);
+		return old_end - bl_info.unmappable_base;
+	}
+
+	bl_info.unmappable_end = end;
+	return size;
+}
+
+static void vgt_balloon_work(struct work_struct *work)
+{
+	struct drm_i915_private *dev_priv =
+		container_of(work, typeof(*dev_priv), vgpu.balloon_work.work);
+	unsigned long cur = bl_info.unmappable_end - bl_info.unmappable_base;
+	u32 seqno, request;
+	unsigned long size;
+	u64 ack;
+
+	seqno = __raw_i915_read32(dev_priv, vgtif_reg(avail_rs.balloon_seqno));
+	if (seqno != dev_priv->vgpu.balloon_seqno) {
+		request = __raw_i915_read32(dev_priv,
+				vgtif_reg(avail_rs.nonmappable_request));
+
+		/*
+		 * A range given up is evicted before the host is told. A larger
+		 * one is only valid once the host has committed it while
+		 * handling the answer, so it is used from then on only.
+		 */
+		if (request > cur && IS_ALIGNED(request, I915_GTT_PAGE_SIZE) &&
+		    bl_info.unmappable_base + request <=
+		    dev_priv->ggtt.base.total) {
+			size = request;
+		} else {
+			mutex_lock(&dev_priv->drm.struct_mutex);
+			size = vgt_balloon_resize(dev_priv, request);
+			mutex_unlock(&dev_priv->drm.struct_mutex);
+		}
+
+		dev_priv->vgpu.balloon_seqno = seqno;
+		ack = (u64)seqno << 32 | size;
+		intel_vgt_g2v_notify(dev_priv, VGT_G2V_GGTT_BALLOON_ACK,
+				     &ack, 1, true);
+
+		if (size > cur &&
+		    __raw_i915_read32(dev_priv,
+			vgtif_reg(avail_rs.nonmappable_gmadr.size)) == size) {
+			mutex_lock(&dev_priv->drm.struct_mutex);
+			vgt_balloon_resize(dev_priv, size);
+			mutex_unlock(&dev_priv->drm.struct_mutex);
+		}
+	}
+
+	schedule_delayed_work(&dev_priv->vgpu.balloon_work,
+			      msecs_to_jiffies(VGT_BALLOON_POLL_MS));
+}
+
+/**
+ * intel_vgt_init_balloon_resize - let GVT-g resize the GGTT balloon
+ * @dev_priv: i915 device private
+ *
+ * If the host supports it, poll for requests to resize the unmappable GM
+ * of the guest, so that GM can be moved from idle VMs to busy ones. Only
+ * the unmappable part is resized, the aperture is mapped into the guest
+ * by the VMM and stays as it is.
+ */
+void intel_vgt_init_balloon_resize(struct drm_i915_private *dev_priv)
+{
+	if (!intel_vgpu_active(dev_priv) ||
+	    !(dev_priv->vgpu.caps & VGT_CAPS_GGTT_BALLOON))
+		return;
+
+	/* the first poll always answers, telling the host we take requests */
+	dev_priv->vgpu.balloon_seqno = ~0u;
+	INIT_DELAYED_WORK(&dev_priv->vgpu.balloon_work, vgt_balloon_work);
+	dev_priv->vgpu.balloon_polling = true;
+	schedule_delayed_work(&dev_priv->vgpu.balloon_work, 0);
+}
+
+/**
+ * intel_vgt_fini_balloon_resize - stop polling for GGTT balloon resizes
+ * @dev_priv: i915 device private
+ *
+ * Must be called without struct_mutex held.
+ */
+void intel_vgt_fini_balloon_resize(struct drm_i915_private *dev_priv)
+{
+	if (!dev_priv->vgpu.balloon_polling)
+		return;
+
+	cancel_delayed_work_sync(&dev_priv->vgpu.balloon_work);
+	dev_priv->vgpu.balloon_polling = false;
+}
@@ -36,7 +36,53 @@ intel_vgpu_has_hwsp_emulation(struct drm_i915_private *dev_priv)
 	return dev_priv->vgpu.caps & VGT_CAPS_HWSP_EMULATION;
 }
 
+static inline bool
+intel_vgpu_has_huge_gtt(struct drm_i915_private *dev_priv)
+{
+	return dev_priv->vgpu.caps & VGT_CAPS_HUGE_GTT;
+}
+
+static inline bool
+intel_vgpu_has_pv_ppgtt(struct drm_i915_private *dev_priv)
+{
+	return dev_priv->vgpu.pv_ppgtt;
+}
+
 int intel_vgt_balloon(struct drm_i915_private *dev_priv);
 void intel_vgt_deballoon(struct drm_i915_private *dev_priv);
+void intel_vgt_init_balloon_resize(struct drm_i915_private *dev_priv);
+void intel_vgt_fini_balloon_resize(struct drm_i915_private *dev_priv);
+
+void intel_vgt_init_pv_mailbox(struct drm_i915_private *dev_priv);
+void intel_vgt_fini_pv_mailbox(struct drm_i915_private *dev_priv);
+void intel_vgt_g2v_notify(struct drm_i915_private *dev_priv,
+			  enum vgt_g2v_type notification,
+			  const u64 *data, unsigned int count, bool doorbell);
+
+void intel_vgt_init_pv_ppgtt(struct drm_i915_private *dev_priv);
+void intel_vgt_fini_pv_ppgtt(struct drm_i915_private *dev_priv);
+void intel_vgt_pv_ppgtt_update(struct drm_i915_private *dev_priv,
+			       dma_addr_t addr, unsigned int count);
+
+static inline bool
+intel_vgpu_has_pv_submission(struct drm_i915_private *dev_priv)
+{
+	return dev_priv->vgpu.pv_submission;
+}
+
+void intel_vgt_init_pv_submission(struct drm_i915_private *dev_priv);
+void intel_vgt_fini_pv_submission(struct drm_i915_private *dev_priv);
+void intel_vgt_pv_submit(struct drm_i915_private *dev_priv,
+			 unsigned int engine, const u64 *desc);
+
+static inline bool
+intel_vgpu_has_pv_timestamp(struct drm_i915_private *dev_priv)
+{
+	return dev_priv->vgpu.pv_timestamp;
+}
+
+void intel_vgt_init_pv_timestamp(struct drm_i915_private *dev_priv);
+void intel_vgt_fini_pv_timestamp(struct drm_i915_private *dev_priv);
+u64 intel_vgt_pv_timestamp(struct drm_i915_private *dev_priv);
 
 #endif /* _I915_VGPU_H_ */
@@ -182,8 +182,12 @@ vma_lookup(struct drm_i915_gem_object *obj,
 	   struct i915_address_space *vm,
 	   const struct i915_ggtt_view *view)
 {
+	struct i915_vma *hint = obj->vma_hint;
 	struct rb_node *rb;
 
+	if (hint && !i915_vma_compare(hint, vm, view))
+		return hint;
+
 	rb = obj->vma_tree.rb_node;
 	while (rb) {
 		struct i915_vma *vma = rb_entry(rb, struct i915_vma, obj_node);
@@ -231,6 +235,8 @@ i915_vma_instance(struct drm_i915_gem_object *obj,
 	vma = vma_lookup(obj, vm, view);
 	if (!vma)
 		vma = vma_create(obj, vm, view);
+	if (!IS_ERR(vma))
+		obj->vma_hint = vma;
 
 	GEM_BUG_ON(!IS_ERR(vma) && i915_vma_is_closed(vma));
 	GEM_BUG_ON(!IS_ERR(vma) && i915_vma_compare(vma, vm, view));
@@ -712,6 +718,8 @@ void i915_vma_close(struct i915_vma *vma)
 	vma->flags |= I915_VMA_CLOSED;
 
 	rb_erase(&vma->obj_node, &vma->obj->vma_tree);
+	if (vma->obj->vma_hint == vma)
+		vma->obj->vma_hint = NULL;
 
 	if (!i915_vma_is_active(vma) && !i915_vma_is_pinned(vma))
 		WARN_ON(i915_vma_unbind(vma));
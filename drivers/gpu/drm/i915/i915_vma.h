@@ -123,8 +123,6 @@ struct i915_vma {
 	 * Used for performing relocations during execbuffer insertion.
 	 */
 	unsigned int *exec_flags;
-	struct hlist_node exec_node;
-	u32 exec_handle;
 };
 
 struct i915_vma *
@@ -746,6 +746,7 @@ void intel_engine_cleanup_common(struct intel_engine_cs *engine)
 	intel_engine_fini_breadcrumbs(engine);
 	intel_engine_cleanup_cmd_parser(engine);
 	i915_gem_batch_pool_fini(&engine->batch_pool);
+	i915_request_cache_fini(engine);
 
 	if (engine->default_state)
 		i915_gem_object_put(engine->default_state);
@@ -28,10 +28,23 @@ enum { CTB_SEND = 0, CTB_RECV = 1 };
 
 enum { CTB_OWNER_HOST = 0 };
 
+/* A non-blocking request waiting for the GuC to move past its fence. */
+struct ct_request {
+	struct list_head link;
+	u32 fence;
+	intel_guc_ct_callback_t callback;
+	void *data;
+};
+
+static void ct_worker_func(struct work_struct *w);
+
 void intel_guc_ct_init_early(struct intel_guc_ct *ct)
 {
 	/* we're using static channel owners */
 	ct->host_channel.owner = CTB_OWNER_HOST;
+
+	INIT_LIST_HEAD(&ct->pending);
+	INIT_WORK(&ct->worker, ct_worker_func);
 }
 
 static inline const char *guc_ct_buffer_type_to_str(u32 type)
@@ -256,6 +269,14 @@ static void ctch_close(struct intel_guc *guc,
 					ctch->owner,
 					INTEL_GUC_CT_BUFFER_TYPE_RECV);
 	ctch_fini(guc, ctch);
+
+	/*
+	 * Nothing written so far will be notified anymore. A batch started
+	 * after the worker was flushed fails its requests from the worker.
+	 */
+	mutex_lock(&guc->send_mutex);
+	guc->ct.unnotified = false;
+	mutex_unlock(&guc->send_mutex);
 }
 
 static u32 ctch_get_next_fence(struct intel_guc_ct_channel *ctch)
@@ -415,6 +436,135 @@ static int intel_guc_send_ct(struct intel_guc *guc, const u32 *action, u32 len)
 	return err;
 }
 
+/*
+ * Non-blocking requests are written to the send buffer right away, but the
+ * GuC is only notified of them from a worker, once for all the requests
+ * written in the meantime. The worker then waits for the fence of the
+ * latest one: the GuC handles the requests in order, so that completes the
+ * whole batch. The GuC only reports the status of the latest request in the
+ * descriptor, so a failure of an earlier one of the batch can't be told
+ * apart, callers that care about the status of every request need to use
+ * intel_guc_send().
+ */
+static void ct_worker_func(struct work_struct *w)
+{
+	struct intel_guc_ct *ct = container_of(w, struct intel_guc_ct, worker);
+	struct intel_guc *guc = container_of(ct, struct intel_guc, ct);
+	struct intel_guc_ct_channel *ctch = &ct->host_channel;
+	struct ct_request *req, *next;
+	LIST_HEAD(done);
+	u32 status = ~0; /* undefined */
+	u32 fence = 0;
+	int err = -ENODEV;
+
+	mutex_lock(&guc->send_mutex);
+
+	if (ctch_is_open(ctch)) {
+		if (ct->unnotified)
+			intel_guc_notify(guc);
+
+		fence = ctch->next_fence;
+		err = wait_for_response(ctch->ctbs[CTB_SEND].desc, fence,
+					&status);
+	}
+	/* also when the channel was closed under us, see ctch_close() */
+	ct->unnotified = false;
+	list_splice_init(&ct->pending, &done);
+
+	mutex_unlock(&guc->send_mutex);
+
+	list_for_each_entry_safe(req, next, &done, link) {
+		int ret = err;
+
+		if (!ret && req->fence == fence &&
+		    status != INTEL_GUC_STATUS_SUCCESS)
+			ret = -EIO;
+
+		req->callback(guc, req->data, ret);
+		kfree(req);
+	}
+}
+
+/**
+ * intel_guc_send_nb() - send an action to the GuC without waiting for it
+ * @guc:	the guc
+ * @action:	action data
+ * @len:	action length in dwords
+ * @callback:	called once the GuC completed the action, may be NULL
+ * @data:	private data for @callback
+ *
+ * The GuC is notified of the action along with the other ones sent in a
+ * burst, @callback is called from a worker. Without buffer based command
+ * transport, the action is sent synchronously and @callback is called
+ * before returning.
+ *
+ * Return: 0 if the action was sent, negative error code otherwise, in
+ * which case @callback won't be called.
+ */
+int intel_guc_send_nb(struct intel_guc *guc, const u32 *action, u32 len,
+		      intel_guc_ct_callback_t callback, void *data)
+{
+	struct intel_guc_ct *ct = &guc->ct;
+	struct intel_guc_ct_channel *ctch = &ct->host_channel;
+	struct intel_guc_ct_buffer *ctb = &ctch->ctbs[CTB_SEND];
+	struct ct_request *req = NULL;
+	u32 status;
+	int err;
+
+	GEM_BUG_ON(!len);
+	GEM_BUG_ON(len & ~GUC_CT_MSG_LEN_MASK);
+
+	if (guc->send != intel_guc_send_ct) {
+		err = intel_guc_send(guc, action, len);
+		if (!callback)
+			return err;
+		callback(guc, data, err);
+		return 0;
+	}
+
+	if (callback) {
+		req = kmalloc(sizeof(*req), GFP_KERNEL);
+		if (!req)
+			return -ENOMEM;
+		req->callback = callback;
+		req->data = data;
+	}
+
+	mutex_lock(&guc->send_mutex);
+
+	err = ctb_write(ctb, action, len, ctch->next_fence + 1);
+	if (err == -ENOSPC) {
+		/* let the GuC catch up with the batch so far */
+		intel_guc_notify(guc);
+		ct->unnotified = false;
+		err = wait_for_response(ctb->desc, ctch->next_fence, &status);
+		if (!err)
+			err = ctb_write(ctb, action, len,
+					ctch->next_fence + 1);
+	}
+	if (unlikely(err)) {
+		mutex_unlock(&guc->send_mutex);
+		DRM_ERROR("CT: send action %#X failed; err=%d\n",
+			  action[0], err);
+		kfree(req);
+		return err;
+	}
+
+	ctch_get_next_fence(ctch);
+	if (req) {
+		req->fence = ctch->next_fence;
+		list_add_tail(&req->link, &ct->pending);
+	}
+
+	if (!ct->unnotified) {
+		ct->unnotified = true;
+		schedule_work(&ct->worker);
+	}
+
+	mutex_unlock(&guc->send_mutex);
+	return 0;
+}
+
 /**
  * Enable buffer based command transport
  * Shall only be called for platforms with HAS_GUC_CT.
@@ -455,6 +605,9 @@ void intel_guc_disable_ct(struct intel_guc *guc)
 	if (!ctch_is_open(ctch))
 		return;
 
+	/* complete the requests still in flight */
+	flush_work(&guc->ct.worker);
+
 	ctch_close(guc, ctch);
 
 	/* Disable send */
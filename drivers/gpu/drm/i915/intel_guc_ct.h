@@ -27,6 +27,8 @@
 struct intel_guc;
 struct i915_vma;
 
+#include <linux/workqueue.h>
+
 #include "intel_guc_fwif.h"
 
 /**
@@ -71,13 +73,30 @@ struct intel_guc_ct_channel {
 /** Holds all command transport channels.
  *
  * @host_channel: main channel used by the host
+ * @pending: requests sent with intel_guc_send_nb() waiting for completion
+ * @worker: notifies the GuC of a batch of requests and completes them
+ * @unnotified: requests were written that the GuC wasn't notified of
  */
 struct intel_guc_ct {
 	struct intel_guc_ct_channel host_channel;
 	/* other channels are tbd */
+	struct list_head pending;
+	struct work_struct worker;
+	bool unnotified;
 };
 
+/**
+ * intel_guc_ct_callback_t - completion of a non-blocking request
+ * @guc: the guc
+ * @data: private data given to intel_guc_send_nb()
+ * @err: 0 if the GuC completed the request, negative error code otherwise
+ */
+typedef void (*intel_guc_ct_callback_t)(struct intel_guc *guc, void *data,
+					int err);
+
 void intel_guc_ct_init_early(struct intel_guc_ct *ct);
+int intel_guc_send_nb(struct intel_guc *guc, const u32 *action, u32 len,
+		      intel_guc_ct_callback_t callback, void *data);
 
 /* XXX: move to intel_uc.h ? don't fit there either */
 int intel_guc_enable_ct(struct intel_guc *guc);
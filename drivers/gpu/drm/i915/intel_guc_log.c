@@ -45,7 +45,8 @@ static int guc_log_flush_complete(struct intel_guc *guc)
 		INTEL_GUC_ACTION_LOG_BUFFER_FILE_FLUSH_COMPLETE
 	};
 
-	return intel_guc_send(guc, action, ARRAY_SIZE(action));
+	/* nothing waits for the GuC to pick up the acknowledgment */
+	return intel_guc_send_nb(guc, action, ARRAY_SIZE(action), NULL, NULL);
 }
 
 static int guc_log_flush(struct intel_guc *guc)
@@ -275,11 +276,36 @@ static unsigned int guc_get_log_buffer_size(enum guc_log_buffer_type type)
 	return 0;
 }
 
+static bool guc_log_sample_state(struct intel_guc *guc,
+				 struct guc_log_buffer_state *log_buf_state,
+				 struct guc_log_buffer_state *local)
+{
+	enum guc_log_buffer_type type;
+	bool has_data = false;
+
+	for (type = GUC_ISR_LOG_BUFFER; type < GUC_MAX_LOG_BUFFER; type++) {
+		/*
+		 * Make a copy of the state structure, inside GuC log buffer
+		 * (which is uncached mapped), on the stack to avoid reading
+		 * from it multiple times.
+		 */
+		memcpy(&local[type], &log_buf_state[type],
+		       sizeof(struct guc_log_buffer_state));
+
+		if (local[type].read_ptr != local[type].sampled_write_ptr ||
+		    local[type].buffer_full_cnt !=
+		    guc->log.prev_overflow_count[type])
+			has_data = true;
+	}
+
+	return has_data;
+}
+
 static void guc_read_update_log_buffer(struct intel_guc *guc)
 {
 	unsigned int buffer_size, read_offset, write_offset, bytes_to_copy, full_cnt;
+	struct guc_log_buffer_state log_buf_state_local[GUC_MAX_LOG_BUFFER];
 	struct guc_log_buffer_state *log_buf_state, *log_buf_snapshot_state;
-	struct guc_log_buffer_state log_buf_state_local;
 	enum guc_log_buffer_type type;
 	void *src_data, *dst_data;
 	bool new_overflow;
@@ -292,6 +318,23 @@ static void guc_read_update_log_buffer(struct intel_guc *guc)
 
 	mutex_lock(&guc->log.runtime.relay_lock);
 
+	/*
+	 * If the GuC has not written anything since the last capture, there
+	 * is no point in consuming (and copying into) a whole relay sub
+	 * buffer, just acknowledge the flush request.
+	 */
+	if (!guc_log_sample_state(guc, log_buf_state, log_buf_state_local)) {
+		for (type = GUC_ISR_LOG_BUFFER; type < GUC_MAX_LOG_BUFFER;
+		     type++) {
+			guc->log.flush_count[type] +=
+				log_buf_state_local[type].flush_to_file;
+			log_buf_state[type].flush_to_file = 0;
+		}
+		mutex_unlock(&guc->log.runtime.relay_lock);
+
+		return;
+	}
+
 	/* Get the pointer to local buffer to store the logs */
 	log_buf_snapshot_state = dst_data = guc_get_write_buffer(guc);
 
@@ -312,20 +355,14 @@ static void guc_read_update_log_buffer(struct intel_guc *guc)
 	dst_data += PAGE_SIZE;
 
 	for (type = GUC_ISR_LOG_BUFFER; type < GUC_MAX_LOG_BUFFER; type++) {
-		/*
-		 * Make a copy of the state structure, inside GuC log buffer
-		 * (which is uncached mapped), on the stack to avoid reading
-		 * from it multiple times.
-		 */
-		memcpy(&log_buf_state_local, log_buf_state,
-		       sizeof(struct guc_log_buffer_state));
 		buffer_size = guc_get_log_buffer_size(type);
-		read_offset = log_buf_state_local.read_ptr;
-		write_offset = log_buf_state_local.sampled_write_ptr;
-		full_cnt = log_buf_state_local.buffer_full_cnt;
+		read_offset = log_buf_state_local[type].read_ptr;
+		write_offset = log_buf_state_local[type].sampled_write_ptr;
+		full_cnt = log_buf_state_local[type].buffer_full_cnt;
 
 		/* Bookkeeping stuff */
-		guc->log.flush_count[type] += log_buf_state_local.flush_to_file;
+		guc->log.flush_count[type] +=
+			log_buf_state_local[type].flush_to_file;
 		new_overflow = guc_check_log_buf_overflow(guc, type, full_cnt);
 
 		/* Update the state of shared log buffer */
@@ -334,7 +371,7 @@ static void guc_read_update_log_buffer(struct intel_guc *guc)
 		log_buf_state++;
 
 		/* First copy the state structure in snapshot buffer */
-		memcpy(log_buf_snapshot_state, &log_buf_state_local,
+		memcpy(log_buf_snapshot_state, &log_buf_state_local[type],
 		       sizeof(struct guc_log_buffer_state));
 
 		/*
@@ -25,6 +25,7 @@
 #define _INTEL_GVT_H_
 
 struct intel_gvt;
+struct i915_gem_context;
 
 #ifdef CONFIG_DRM_I915_GVT
 int intel_gvt_init(struct drm_i915_private *dev_priv);
@@ -33,6 +34,8 @@ int intel_gvt_init_device(struct drm_i915_private *dev_priv);
 void intel_gvt_clean_device(struct drm_i915_private *dev_priv);
 int intel_gvt_init_host(void);
 void intel_gvt_sanitize_options(struct drm_i915_private *dev_priv);
+struct i915_gem_context *
+intel_gvt_get_vgpu_context(struct drm_i915_private *dev_priv, unsigned int id);
 #else
 static inline int intel_gvt_init(struct drm_i915_private *dev_priv)
 {
@@ -45,6 +48,12 @@ static inline void intel_gvt_cleanup(struct drm_i915_private *dev_priv)
 static inline void intel_gvt_sanitize_options(struct drm_i915_private *dev_priv)
 {
 }
+
+static inline struct i915_gem_context *
+intel_gvt_get_vgpu_context(struct drm_i915_private *dev_priv, unsigned int id)
+{
+	return ERR_PTR(-ENODEV);
+}
 #endif
 
 #endif /* _INTEL_GVT_H_ */
@@ -371,12 +371,42 @@ static void hangcheck_accumulate_sample(struct intel_engine_cs *engine,
 				 engine->hangcheck.action_timestamp + timeout);
 }
 
+/*
+ * Copy the context name of the oldest incomplete request on the engine, e.g.
+ * the vGPU of a GVT shadow context. A retired request is taken off the
+ * engine timeline, under its lock, before it lets go of its context, so the
+ * name is only stable while that lock is held.
+ */
+static bool hangcheck_active_ctx_name(struct intel_engine_cs *engine,
+				      char *name, size_t len)
+{
+	struct i915_request *rq;
+	unsigned long flags;
+	bool found = false;
+
+	spin_lock_irqsave(&engine->timeline->lock, flags);
+	list_for_each_entry(rq, &engine->timeline->requests, link) {
+		if (__i915_request_completed(rq, rq->global_seqno))
+			continue;
+
+		if (rq->ctx->name) {
+			strlcpy(name, rq->ctx->name, len);
+			found = true;
+		}
+		break;
+	}
+	spin_unlock_irqrestore(&engine->timeline->lock, flags);
+
+	return found;
+}
+
 static void hangcheck_declare_hang(struct drm_i915_private *i915,
 				   unsigned int hung,
 				   unsigned int stuck)
 {
 	struct intel_engine_cs *engine;
-	char msg[80];
+	char msg[128];
+	char name[32];
 	unsigned int tmp;
 	int len;
 
@@ -387,9 +417,14 @@ static void hangcheck_declare_hang(struct drm_i915_private *i915,
 		hung &= ~stuck;
 	len = scnprintf(msg, sizeof(msg),
 			"%s on ", stuck == hung ? "No progress" : "Hang");
-	for_each_engine_masked(engine, i915, hung, tmp)
-		len += scnprintf(msg + len, sizeof(msg) - len,
-				 "%s, ", engine->name);
+	for_each_engine_masked(engine, i915, hung, tmp) {
+		if (hangcheck_active_ctx_name(engine, name, sizeof(name)))
+			len += scnprintf(msg + len, sizeof(msg) - len,
+					 "%s (%s), ", engine->name, name);
+		else
+			len += scnprintf(msg + len, sizeof(msg) - len,
+					 "%s, ", engine->name);
+	}
 	msg[len-2] = '\0';
 
 	return i915_handle_error(i915, hung, "%s", msg);
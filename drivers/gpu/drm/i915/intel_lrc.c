@@ -136,6 +136,7 @@
 #include <drm/drmP.h>
 #include <drm/i915_drm.h>
 #include "i915_drv.h"
+#include "i915_vgpu.h"
 #include "i915_gem_render_state.h"
 #include "intel_lrc_reg.h"
 #include "intel_mocs.h"
@@ -432,6 +433,8 @@ static void execlists_submit_ports(struct intel_engine_cs *engine)
 {
 	struct intel_engine_execlists *execlists = &engine->execlists;
 	struct execlist_port *port = execlists->port;
+	bool pv = intel_vgpu_has_pv_submission(engine->i915);
+	u64 pv_desc[EXECLIST_MAX_PORTS] = {};
 	unsigned int n;
 
 	/*
@@ -464,9 +467,15 @@ static void execlists_submit_ports(struct intel_engine_cs *engine)
 			desc = 0;
 		}
 
-		write_desc(execlists, desc, n);
+		if (pv)
+			pv_desc[n] = desc;
+		else
+			write_desc(execlists, desc, n);
 	}
 
+	if (pv)
+		intel_vgt_pv_submit(engine->i915, engine->id, pv_desc);
+
 	/* we need to manually load the submit queue */
 	if (execlists->ctrl_reg)
 		writel(EL_CTRL_LOAD, execlists->ctrl_reg);
@@ -522,10 +531,16 @@ static void inject_preempt_context(struct intel_engine_cs *engine)
 	 * the state of the GPU is known (idle).
 	 */
 	GEM_TRACE("%s\n", engine->name);
-	for (n = execlists_num_ports(execlists); --n; )
-		write_desc(execlists, 0, n);
+	if (intel_vgpu_has_pv_submission(engine->i915)) {
+		u64 pv_desc[EXECLIST_MAX_PORTS] = { ce->lrc_desc };
+
+		intel_vgt_pv_submit(engine->i915, engine->id, pv_desc);
+	} else {
+		for (n = execlists_num_ports(execlists); --n; )
+			write_desc(execlists, 0, n);
 
-	write_desc(execlists, ce->lrc_desc, n);
+		write_desc(execlists, ce->lrc_desc, n);
+	}
 
 	/* we need to manually load the submit queue */
 	if (execlists->ctrl_reg)
@@ -2030,6 +2045,16 @@ static int gen8_init_rcs_context(struct i915_request *rq)
 	return i915_gem_render_state_emit(rq);
 }
 
+static void lrc_cache_fini(struct intel_engine_cs *engine)
+{
+	while (engine->lrc_cache_count) {
+		unsigned int i = --engine->lrc_cache_count;
+
+		intel_ring_free(engine->lrc_cache[i].ring);
+		__i915_gem_object_release_unless_active(engine->lrc_cache[i].state->obj);
+	}
+}
+
 /**
  * intel_logical_ring_cleanup() - deallocate the Engine Command Streamer
  * @engine: Engine Command Streamer.
@@ -2055,6 +2080,7 @@ void intel_logical_ring_cleanup(struct intel_engine_cs *engine)
 	if (engine->cleanup)
 		engine->cleanup(engine);
 
+	lrc_cache_fini(engine);
 	intel_engine_cleanup_common(engine);
 
 	lrc_destroy_wa_ctx(engine);
@@ -2412,7 +2438,8 @@ static int
 populate_lr_context(struct i915_gem_context *ctx,
 		    struct drm_i915_gem_object *ctx_obj,
 		    struct intel_engine_cs *engine,
-		    struct intel_ring *ring)
+		    struct intel_ring *ring,
+		    bool recycled)
 {
 	void *vaddr;
 	u32 *regs;
@@ -2432,6 +2459,11 @@ populate_lr_context(struct i915_gem_context *ctx,
 	}
 	ctx_obj->mm.dirty = true;
 
+	/* the image of a freed context, clear what the template won't cover */
+	if (recycled)
+		memset(vaddr, 0, engine->default_state ?
+		       LRC_HEADER_PAGES * PAGE_SIZE : ctx_obj->base.size);
+
 	if (engine->default_state) {
 		/*
 		 * We only want to copy over the template context state;
@@ -2467,6 +2499,73 @@ populate_lr_context(struct i915_gem_context *ctx,
 	return 0;
 }
 
+/**
+ * intel_lr_context_recycle() - keep the image of a freed context
+ * @engine: the engine of the image
+ * @ce: the freed context state on @engine
+ *
+ * Creating a context allocates an image and a ring for each engine it is
+ * used on, which clients creating and destroying contexts at a high rate
+ * (and GVT, for each vGPU) pay again and again. Idle images of freed
+ * contexts are kept here, and handed to the next contexts which only have
+ * to populate them again.
+ *
+ * Returns true if the engine took over @ce->state and @ce->ring.
+ */
+bool intel_lr_context_recycle(struct intel_engine_cs *engine,
+			      struct intel_context *ce)
+{
+	lockdep_assert_held(&engine->i915->drm.struct_mutex);
+
+	if (engine->lrc_cache_count == ARRAY_SIZE(engine->lrc_cache))
+		return false;
+
+	if (i915_vma_is_active(ce->state) || i915_vma_is_active(ce->ring->vma) ||
+	    !list_empty(&ce->ring->request_list))
+		return false;
+
+	engine->lrc_cache[engine->lrc_cache_count].state = ce->state;
+	engine->lrc_cache[engine->lrc_cache_count].ring = ce->ring;
+	engine->lrc_cache_count++;
+	return true;
+}
+
+static int lrc_cache_get(struct i915_gem_context *ctx,
+			 struct intel_engine_cs *engine)
+{
+	struct intel_context *ce = &ctx->engine[engine->id];
+	struct i915_vma *vma;
+	struct intel_ring *ring;
+	unsigned int i;
+	int ret;
+
+	if (!engine->lrc_cache_count)
+		return -ENOENT;
+
+	i = engine->lrc_cache_count - 1;
+	vma = engine->lrc_cache[i].state;
+	ring = engine->lrc_cache[i].ring;
+	if (ring->size != ctx->ring_size)
+		return -ENOENT;
+
+	engine->lrc_cache_count--;
+	intel_ring_reset(ring, 0);
+
+	ret = populate_lr_context(ctx, vma->obj, engine, ring, true);
+	if (ret == 0)
+		/* the vma may still be bound, so the first pin won't flush */
+		ret = i915_gem_object_set_to_gtt_domain(vma->obj, true);
+	if (ret) {
+		intel_ring_free(ring);
+		__i915_gem_object_release_unless_active(vma->obj);
+		return ret;
+	}
+
+	ce->ring = ring;
+	ce->state = vma;
+	return 0;
+}
+
 static int execlists_context_deferred_alloc(struct i915_gem_context *ctx,
 					    struct intel_engine_cs *engine)
 {
@@ -2480,6 +2579,10 @@ static int execlists_context_deferred_alloc(struct i915_gem_context *ctx,
 	if (ce->state)
 		return 0;
 
+	ret = lrc_cache_get(ctx, engine);
+	if (ret != -ENOENT)
+		return ret;
+
 	context_size = round_up(engine->context_size, I915_GTT_PAGE_SIZE);
 
 	/*
@@ -2506,7 +2609,7 @@ static int execlists_context_deferred_alloc(struct i915_gem_context *ctx,
 		goto error_deref_obj;
 	}
 
-	ret = populate_lr_context(ctx, ctx_obj, engine, ring);
+	ret = populate_lr_context(ctx, ctx_obj, engine, ring, false);
 	if (ret) {
 		DRM_DEBUG_DRIVER("Failed to populate LRC: %d\n", ret);
 		goto error_ring_free;
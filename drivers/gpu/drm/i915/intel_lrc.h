@@ -101,8 +101,11 @@ int logical_xcs_ring_init(struct intel_engine_cs *engine);
 
 struct drm_i915_private;
 struct i915_gem_context;
+struct intel_context;
 
 void intel_lr_context_resume(struct drm_i915_private *dev_priv);
+bool intel_lr_context_recycle(struct intel_engine_cs *engine,
+			      struct intel_context *ce);
 
 static inline uint64_t
 intel_lr_context_descriptor(struct i915_gem_context *ctx,
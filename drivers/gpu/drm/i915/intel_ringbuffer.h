@@ -337,6 +337,24 @@ struct intel_engine_cs {
 
 	struct drm_i915_gem_object *default_state;
 
+	/*
+	 * Idle context images and rings of freed contexts, handed to the
+	 * next new contexts. See intel_lr_context_recycle().
+	 */
+	struct {
+		struct i915_vma *state;
+		struct intel_ring *ring;
+	} lrc_cache[8];
+	unsigned int lrc_cache_count;
+
+	/*
+	 * Freed requests of this engine, reused by i915_request_alloc()
+	 * before going to the slab. Released from any context, only taken
+	 * under struct_mutex.
+	 */
+	struct llist_head request_cache;
+	atomic_t request_cache_count;
+
 	atomic_t irq_count;
 	unsigned long irq_posted;
 #define ENGINE_IRQ_BREADCRUMB 0
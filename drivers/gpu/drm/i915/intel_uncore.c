@@ -1621,7 +1621,11 @@ int i915_reg_read_ioctl(struct drm_device *dev,
 	flags = reg->offset & (entry->size - 1);
 
 	intel_runtime_pm_get(dev_priv);
-	if (entry->size == 8 && flags == I915_REG_READ_8B_WA)
+	if (entry->size == 8 && intel_vgpu_has_pv_timestamp(dev_priv) &&
+	    i915_mmio_reg_equal(entry->offset_ldw,
+				RING_TIMESTAMP(RENDER_RING_BASE)))
+		reg->val = intel_vgt_pv_timestamp(dev_priv);
+	else if (entry->size == 8 && flags == I915_REG_READ_8B_WA)
 		reg->val = I915_READ64_2x32(entry->offset_ldw,
 					    entry->offset_udw);
 	else if (entry->size == 8 && flags == 0)
@@ -21,3 +21,6 @@ selftest(hugepages, i915_gem_huge_page_live_selftests)
 selftest(contexts, i915_gem_context_live_selftests)
 selftest(hangcheck, intel_hangcheck_live_selftests)
 selftest(guc, intel_guc_live_selftest)
+#if IS_ENABLED(CONFIG_DRM_I915_GVT)
+selftest(gvt, intel_gvt_live_selftests)
+#endif
@@ -22,6 +22,8 @@
  *
  */
 
+#include <linux/hash.h>
+
 #include "../i915_selftest.h"
 #include "i915_random.h"
 
@@ -600,6 +602,89 @@ static int igt_syncmap_random(void *arg)
 	return dump_syncmap(sync, err);
 }
 
+static u64 bench_syncmap_id(unsigned int stride, unsigned long idx)
+{
+	u64 mask;
+
+	if (!stride)
+		return idx;
+
+	if (stride >= 64)
+		return hash_64(idx, 64);
+
+	mask = BIT_ULL(stride) - 1;
+	return (hash_64(idx >> stride, 64) & ~mask) | (idx & mask);
+}
+
+static int bench_syncmap_lookup(void *arg)
+{
+	static const struct {
+		const char *name;
+		unsigned int stride;
+	} phases[] = {
+		{ "dense", 0 },
+		{ "per-client", 3 },
+		{ "sparse", 64 },
+	};
+	unsigned int n;
+
+	/*
+	 * Measure the cost of i915_syncmap_is_later() where the lookup cannot
+	 * be satisfied by the cached leaf. The contexts are either allocated
+	 * densely, in small groups (one per client, with a handful of engines
+	 * each) scattered across the id space, or entirely at random. Each
+	 * pass repeats the same walk so that we report the cost of traversing
+	 * the tree and not of growing it.
+	 */
+
+	for (n = 0; n < ARRAY_SIZE(phases); n++) {
+		struct i915_syncmap *sync;
+		unsigned long count, i, passes;
+		unsigned long end_time;
+		ktime_t kt;
+		int err;
+
+		i915_syncmap_init(&sync);
+
+		for (count = 0; count < 4096; count++) {
+			u64 context = bench_syncmap_id(phases[n].stride, count);
+
+			err = i915_syncmap_set(&sync, context, 0);
+			if (err) {
+				i915_syncmap_free(&sync);
+				return err;
+			}
+		}
+
+		passes = 0;
+		kt = ktime_get();
+		end_time = jiffies + HZ/10;
+		do {
+			for (i = 0; i < count; i++) {
+				u64 context = bench_syncmap_id(phases[n].stride,
+							       i);
+
+				if (!i915_syncmap_is_later(&sync, context, 0)) {
+					pr_err("%s: lookup of context=%llx failed\n",
+					       phases[n].name, context);
+					return dump_syncmap(sync, -EINVAL);
+				}
+			}
+
+			passes++;
+		} while (!time_after(jiffies, end_time));
+		kt = ktime_sub(ktime_get(), kt);
+
+		pr_info("%s: %s, %lu lookups, %lluns/lookup\n",
+			__func__, phases[n].name, passes * count,
+			(long long)div64_ul(ktime_to_ns(kt), passes * count));
+
+		i915_syncmap_free(&sync);
+	}
+
+	return 0;
+}
+
 int i915_syncmap_mock_selftests(void)
 {
 	static const struct i915_subtest tests[] = {
@@ -610,6 +695,7 @@ int i915_syncmap_mock_selftests(void)
 		SUBTEST(igt_syncmap_neighbours),
 		SUBTEST(igt_syncmap_compact),
 		SUBTEST(igt_syncmap_random),
+		SUBTEST(bench_syncmap_lookup),
 	};
 
 	return i915_subtests(tests, NULL);
@@ -0,0 +1,207 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include "../i915_selftest.h"
+
+/*
+ * Microbenchmarks of the GVT hot paths. They report their rates through
+ * pr_info() so that the numbers can be compared between kernels, and only
+ * fail if the path under test reports an error.
+ */
+
+#define GVT_BENCH_LOOPS 10000
+
+static struct intel_vgpu *bench_create_vgpu(struct intel_gvt *gvt)
+{
+	return intel_gvt_create_vgpu(gvt, &gvt->types[0]);
+}
+
+static int igt_gvt_vgpu_create(void *arg)
+{
+	struct drm_i915_private *i915 = arg;
+	struct intel_gvt *gvt = to_gvt(i915);
+	struct intel_vgpu *vgpu;
+	ktime_t create = 0, destroy = 0, t;
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		t = ktime_get_raw();
+		vgpu = bench_create_vgpu(gvt);
+		create = ktime_add(create, ktime_sub(ktime_get_raw(), t));
+		if (IS_ERR(vgpu)) {
+			pr_err("Failed to create vGPU, err=%ld\n",
+			       PTR_ERR(vgpu));
+			return PTR_ERR(vgpu);
+		}
+
+		t = ktime_get_raw();
+		intel_gvt_destroy_vgpu(vgpu);
+		destroy = ktime_add(destroy, ktime_sub(ktime_get_raw(), t));
+	}
+
+	pr_info("vGPU create = %lluns, destroy = %lluns\n",
+		div64_u64(ktime_to_ns(create), i),
+		div64_u64(ktime_to_ns(destroy), i));
+	return 0;
+}
+
+static int igt_gvt_mmio_read(void *arg)
+{
+	struct drm_i915_private *i915 = arg;
+	static const i915_reg_t regs[] = {
+		RING_HEAD(RENDER_RING_BASE),
+		RING_TAIL(RENDER_RING_BASE),
+		RING_CTL(RENDER_RING_BASE),
+		RING_START(RENDER_RING_BASE),
+	};
+	struct intel_vgpu *vgpu;
+	ktime_t t;
+	u64 bar;
+	u32 val;
+	int i, err = 0;
+
+	vgpu = bench_create_vgpu(to_gvt(i915));
+	if (IS_ERR(vgpu))
+		return PTR_ERR(vgpu);
+
+	bar = intel_vgpu_get_bar_gpa(vgpu, PCI_BASE_ADDRESS_0);
+
+	t = ktime_get_raw();
+	for (i = 0; i < GVT_BENCH_LOOPS; i++) {
+		err = intel_vgpu_emulate_mmio_read(vgpu, bar +
+				i915_mmio_reg_offset(regs[i % ARRAY_SIZE(regs)]),
+				&val, 4);
+		if (err) {
+			pr_err("MMIO read emulation failed, err=%d\n", err);
+			goto out;
+		}
+	}
+	t = ktime_sub(ktime_get_raw(), t);
+
+	pr_info("MMIO read emulation = %lluns per access\n",
+		div64_u64(ktime_to_ns(t), GVT_BENCH_LOOPS));
+out:
+	intel_gvt_destroy_vgpu(vgpu);
+	return err;
+}
+
+static int igt_gvt_cmd_lookup(void *arg)
+{
+	struct drm_i915_private *i915 = arg;
+	struct intel_gvt *gvt = to_gvt(i915);
+	static const u32 stream[] = {
+		MI_NOOP,
+		MI_ARB_CHECK,
+		MI_LOAD_REGISTER_IMM(1),
+		MI_STORE_DWORD_IMM_GEN4,
+		GFX_OP_PIPE_CONTROL(6),
+		MI_BATCH_BUFFER_END,
+	};
+	struct cmd_info *info;
+	unsigned long dwords = 0;
+	ktime_t t;
+	int i;
+
+	t = ktime_get_raw();
+	for (i = 0; i < GVT_BENCH_LOOPS * ARRAY_SIZE(stream); i++) {
+		u32 cmd = stream[i % ARRAY_SIZE(stream)];
+
+		info = get_cmd_info(gvt, cmd, RCS);
+		if (!info) {
+			pr_err("No command entry for 0x%08x\n", cmd);
+			return -EINVAL;
+		}
+		dwords += get_cmd_length(info, cmd);
+	}
+	t = ktime_sub(ktime_get_raw(), t);
+
+	pr_info("Command decode = %lluns per command, %lu dwords\n",
+		div64_u64(ktime_to_ns(t), i), dwords);
+	return 0;
+}
+
+static int igt_gvt_switch_mmio(void *arg)
+{
+	struct drm_i915_private *i915 = arg;
+	struct intel_gvt *gvt = to_gvt(i915);
+	struct intel_gvt_workload_scheduler *scheduler = &gvt->scheduler;
+	struct intel_vgpu *vgpu;
+	unsigned long flags;
+	ktime_t t;
+	int i, err;
+
+	vgpu = bench_create_vgpu(gvt);
+	if (IS_ERR(vgpu))
+		return PTR_ERR(vgpu);
+
+	/* the engine must be idle and still owned by the host */
+	mutex_lock(&i915->drm.struct_mutex);
+	err = i915_gem_wait_for_idle(i915, I915_WAIT_LOCKED);
+	if (err)
+		goto out_unlock;
+
+	t = ktime_get_raw();
+	for (i = 0; i < GVT_BENCH_LOOPS / 10; i++) {
+		spin_lock_irqsave(&scheduler->mmio_context_lock, flags);
+		if (scheduler->engine_owner[RCS]) {
+			spin_unlock_irqrestore(&scheduler->mmio_context_lock,
+					       flags);
+			pr_err("Render engine still owned by a vGPU\n");
+			err = -EBUSY;
+			goto out_unlock;
+		}
+		intel_gvt_switch_mmio(NULL, vgpu, RCS);
+		intel_gvt_switch_mmio(vgpu, NULL, RCS);
+		spin_unlock_irqrestore(&scheduler->mmio_context_lock, flags);
+	}
+	t = ktime_sub(ktime_get_raw(), t);
+
+	pr_info("Render MMIO switch = %lluns per host/vGPU round trip\n",
+		div64_u64(ktime_to_ns(t), i));
+out_unlock:
+	mutex_unlock(&i915->drm.struct_mutex);
+	intel_gvt_destroy_vgpu(vgpu);
+	return err;
+}
+
+int intel_gvt_live_selftests(struct drm_i915_private *i915)
+{
+	static const struct i915_subtest tests[] = {
+		SUBTEST(igt_gvt_vgpu_create),
+		SUBTEST(igt_gvt_mmio_read),
+		SUBTEST(igt_gvt_cmd_lookup),
+		SUBTEST(igt_gvt_switch_mmio),
+	};
+	struct intel_gvt *gvt = to_gvt(i915);
+	int err;
+
+	if (!intel_gvt_active(i915) || !gvt->num_types)
+		return 0;
+
+	intel_runtime_pm_get(i915);
+	err = i915_subtests(tests, i915);
+	intel_runtime_pm_put(i915);
+
+	return err;
+}
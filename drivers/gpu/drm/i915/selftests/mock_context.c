@@ -40,8 +40,9 @@ mock_context(struct drm_i915_private *i915,
 	INIT_LIST_HEAD(&ctx->link);
 	ctx->i915 = i915;
 
-	INIT_RADIX_TREE(&ctx->handles_vma, GFP_KERNEL);
 	INIT_LIST_HEAD(&ctx->handles_list);
+	if (rhashtable_init(&ctx->handles_vma, &lut_params))
+		goto err_free;
 
 	ret = ida_simple_get(&i915->contexts.hw_ida,
 			     0, MAX_CONTEXT_HW_ID, GFP_KERNEL);
@@ -62,6 +63,8 @@ mock_context(struct drm_i915_private *i915,
 	return ctx;
 
 err_handles:
+	rhashtable_destroy(&ctx->handles_vma);
+err_free:
 	kfree(ctx);
 	return NULL;
 
@@ -220,6 +220,7 @@ void mock_engine_free(struct intel_engine_cs *engine)
 		engine->context_unpin(engine, engine->last_retired_context);
 
 	intel_engine_fini_breadcrumbs(engine);
+	i915_request_cache_fini(engine);
 
 	kfree(engine->buffer);
 	kfree(engine);
@@ -858,6 +858,8 @@ static void init_iova_rcaches(struct iova_domain *iovad)
 		rcache = &iovad->rcaches[i];
 		spin_lock_init(&rcache->lock);
 		rcache->depot_size = 0;
+		rcache->depot_max = INIT_GLOBAL_MAGS;
+		rcache->depot_starved = false;
 		rcache->cpu_rcaches = __alloc_percpu(sizeof(*cpu_rcache), cache_line_size());
 		if (WARN_ON(!rcache->cpu_rcaches))
 			continue;
@@ -898,7 +900,23 @@ static bool __iova_rcache_insert(struct iova_domain *iovad,
 
 		if (new_mag) {
 			spin_lock(&rcache->lock);
-			if (rcache->depot_size < MAX_GLOBAL_MAGS) {
+			/*
+			 * If the depot has run dry since it last overflowed,
+			 * pfns are being freed on some CPUs as fast as they
+			 * are allocated on others, and every miss and every
+			 * overflow is a trip to the rbtree. Let the depot
+			 * grow to absorb that churn instead.
+			 */
+			if (rcache->depot_size == rcache->depot_max &&
+			    rcache->depot_starved &&
+			    rcache->depot_max < MAX_GLOBAL_MAGS) {
+				rcache->depot_max = min_t(unsigned long,
+							  2 * rcache->depot_max,
+							  MAX_GLOBAL_MAGS);
+				rcache->depot_starved = false;
+			}
+
+			if (rcache->depot_size < rcache->depot_max) {
 				rcache->depot[rcache->depot_size++] =
 						cpu_rcache->loaded;
 			} else {
@@ -962,6 +980,8 @@ static unsigned long __iova_rcache_get(struct iova_rcache *rcache,
 			iova_magazine_free(cpu_rcache->loaded);
 			cpu_rcache->loaded = rcache->depot[--rcache->depot_size];
 			has_pfn = true;
+		} else {
+			rcache->depot_starved = true;
 		}
 		spin_unlock(&rcache->lock);
 	}
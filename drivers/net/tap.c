@@ -20,6 +20,7 @@
 #include <net/net_namespace.h>
 #include <net/rtnetlink.h>
 #include <net/sock.h>
+#include <net/busy_poll.h>
 #include <linux/virtio_net.h>
 #include <linux/skb_array.h>
 
@@ -332,6 +333,11 @@ rx_handler_result_t tap_handle_frame(struct sk_buff **pskb)
 
 	skb_push(skb, ETH_HLEN);
 
+	/* Let a reader such as vhost-net busy poll the NIC queue this
+	 * traffic arrives on.
+	 */
+	sk_mark_napi_id(&q->sk, skb);
+
 	/* Apply the forward feature mask so that we perform segmentation
 	 * according to users wishes.  This only works if VNET_HDR is
 	 * enabled.
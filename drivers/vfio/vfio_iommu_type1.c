@@ -93,12 +93,15 @@ struct vfio_group {
 };
 
 /*
- * Guest RAM pinning working set or DMA target
+ * Guest RAM pinning working set or DMA target. Pages pinned together that
+ * are contiguous both in iova and host pfn share one extent, the extent is
+ * only released once all of its pages are unpinned.
  */
 struct vfio_pfn {
 	struct rb_node		node;
 	dma_addr_t		iova;		/* Device address */
 	unsigned long		pfn;		/* Host pfn */
+	long			npage;		/* Pages in the extent */
 	atomic_t		ref_count;
 };
 
@@ -106,6 +109,7 @@ struct vfio_pfn {
 					(!list_empty(&iommu->domain_list))
 
 static int put_pfn(unsigned long pfn, int prot);
+static bool is_invalid_reserved_pfn(unsigned long pfn);
 
 /*
  * This code handles mapping and unmapping of user data buffers
@@ -168,7 +172,7 @@ static struct vfio_pfn *vfio_find_vpfn(struct vfio_dma *dma, dma_addr_t iova)
 
 		if (iova < vpfn->iova)
 			node = node->rb_left;
-		else if (iova > vpfn->iova)
+		else if (iova >= vpfn->iova + (vpfn->npage << PAGE_SHIFT))
 			node = node->rb_right;
 		else
 			return vpfn;
@@ -176,6 +180,21 @@ static struct vfio_pfn *vfio_find_vpfn(struct vfio_dma *dma, dma_addr_t iova)
 	return NULL;
 }
 
+static unsigned long vfio_vpfn_to_pfn(struct vfio_pfn *vpfn, dma_addr_t iova)
+{
+	return vpfn->pfn + ((iova - vpfn->iova) >> PAGE_SHIFT);
+}
+
+/* Whether the page at iova backed by pfn directly follows the extent. */
+static bool vfio_vpfn_can_extend(struct vfio_pfn *vpfn, dma_addr_t iova,
+				 unsigned long pfn)
+{
+	return iova == vpfn->iova + (vpfn->npage << PAGE_SHIFT) &&
+	       pfn == vpfn->pfn + vpfn->npage &&
+	       is_invalid_reserved_pfn(pfn) ==
+	       is_invalid_reserved_pfn(vpfn->pfn);
+}
+
 static void vfio_link_pfn(struct vfio_dma *dma,
 			  struct vfio_pfn *new)
 {
@@ -202,20 +221,22 @@ static void vfio_unlink_pfn(struct vfio_dma *dma, struct vfio_pfn *old)
 	rb_erase(&old->node, &dma->pfn_list);
 }
 
-static int vfio_add_to_pfn_list(struct vfio_dma *dma, dma_addr_t iova,
-				unsigned long pfn)
+static struct vfio_pfn *vfio_add_to_pfn_list(struct vfio_dma *dma,
+					     dma_addr_t iova,
+					     unsigned long pfn)
 {
 	struct vfio_pfn *vpfn;
 
 	vpfn = kzalloc(sizeof(*vpfn), GFP_KERNEL);
 	if (!vpfn)
-		return -ENOMEM;
+		return NULL;
 
 	vpfn->iova = iova;
 	vpfn->pfn = pfn;
+	vpfn->npage = 1;
 	atomic_set(&vpfn->ref_count, 1);
 	vfio_link_pfn(dma, vpfn);
-	return 0;
+	return vpfn;
 }
 
 static void vfio_remove_from_pfn_list(struct vfio_dma *dma,
@@ -238,9 +259,11 @@ static struct vfio_pfn *vfio_iova_get_vfio_pfn(struct vfio_dma *dma,
 static int vfio_iova_put_vfio_pfn(struct vfio_dma *dma, struct vfio_pfn *vpfn)
 {
 	int ret = 0;
+	long i;
 
 	if (atomic_dec_and_test(&vpfn->ref_count)) {
-		ret = put_pfn(vpfn->pfn, dma->prot);
+		for (i = 0; i < vpfn->npage; i++)
+			ret += put_pfn(vpfn->pfn + i, dma->prot);
 		vfio_remove_from_pfn_list(dma, vpfn);
 	}
 	return ret;
@@ -386,6 +409,32 @@ static int vaddr_get_pfn(struct mm_struct *mm, unsigned long vaddr,
 	return ret;
 }
 
+/* Pages pinned per get_user_pages() call, one page worth of page pointers */
+#define VFIO_PIN_BATCH_MAX	(PAGE_SIZE / sizeof(struct page *))
+
+/*
+ * Pin up to @npage pages from @vaddr into @pages with a single GUP call, so
+ * that a backing huge page is pinned as one chunk rather than a page at a
+ * time.  Returns the number of pages pinned, which may be short, or a
+ * negative error.  Only used for the current mm with normal, refcounted
+ * pages; PFNMAP ranges go through vaddr_get_pfn().
+ */
+static long vaddr_get_pfns(unsigned long vaddr, long npage, int prot,
+			   struct page **pages)
+{
+	unsigned int flags = 0;
+	long ret;
+
+	if (prot & IOMMU_WRITE)
+		flags |= FOLL_WRITE;
+
+	down_read(&current->mm->mmap_sem);
+	ret = get_user_pages_longterm(vaddr, npage, flags, pages, NULL);
+	up_read(&current->mm->mmap_sem);
+
+	return ret;
+}
+
 /*
  * Attempt to pin pages.  We really don't want to track all the pfns and
  * the iommu can only map chunks of consecutive pfns anyway, so get the
@@ -397,6 +446,8 @@ static long vfio_pin_pages_remote(struct vfio_dma *dma, unsigned long vaddr,
 {
 	unsigned long pfn = 0;
 	long ret, pinned = 0, lock_acct = 0;
+	struct page **batch = NULL;
+	long batch_idx = 0, batch_nr = 0;
 	bool rsvd;
 	dma_addr_t iova = vaddr - dma->vaddr + dma->iova;
 
@@ -428,12 +479,37 @@ static long vfio_pin_pages_remote(struct vfio_dma *dma, unsigned long vaddr,
 	if (unlikely(disable_hugepages))
 		goto out;
 
+	/*
+	 * Normal pages are pinned in batches, so a huge page backing the
+	 * range is pinned and accounted with one GUP call instead of one
+	 * per base page.  Fall back to single pages if the batch array
+	 * can't be allocated.
+	 */
+	if (!rsvd && npage > 1)
+		batch = (struct page **)__get_free_page(GFP_KERNEL);
+
 	/* Lock all the consecutive pages from pfn_base */
 	for (vaddr += PAGE_SIZE, iova += PAGE_SIZE; pinned < npage;
 	     pinned++, vaddr += PAGE_SIZE, iova += PAGE_SIZE) {
-		ret = vaddr_get_pfn(current->mm, vaddr, dma->prot, &pfn);
-		if (ret)
-			break;
+		if (batch) {
+			if (batch_idx == batch_nr) {
+				ret = vaddr_get_pfns(vaddr,
+						     min_t(long, npage - pinned,
+							   VFIO_PIN_BATCH_MAX),
+						     dma->prot, batch);
+				if (ret <= 0)
+					break;
+				batch_nr = ret;
+				batch_idx = 0;
+			}
+			pfn = page_to_pfn(batch[batch_idx++]);
+			ret = 0;
+		} else {
+			ret = vaddr_get_pfn(current->mm, vaddr, dma->prot,
+					    &pfn);
+			if (ret)
+				break;
+		}
 
 		if (pfn != *pfn_base + pinned ||
 		    rsvd != is_invalid_reserved_pfn(pfn)) {
@@ -458,6 +534,12 @@ static long vfio_pin_pages_remote(struct vfio_dma *dma, unsigned long vaddr,
 	ret = vfio_lock_acct(current, lock_acct, &lock_cap);
 
 unpin_out:
+	/* Drop batch pins beyond the end of the contiguous run */
+	while (batch_idx < batch_nr)
+		put_page(batch[batch_idx++]);
+	if (batch)
+		free_page((unsigned long)batch);
+
 	if (ret) {
 		if (!rsvd) {
 			for (pfn = *pfn_base ; pinned ; pfn++, pinned--)
@@ -492,7 +574,7 @@ static long vfio_unpin_pages_remote(struct vfio_dma *dma, dma_addr_t iova,
 }
 
 static int vfio_pin_page_external(struct vfio_dma *dma, unsigned long vaddr,
-				  unsigned long *pfn_base, bool do_accounting)
+				  unsigned long *pfn_base)
 {
 	struct mm_struct *mm;
 	int ret;
@@ -502,22 +584,27 @@ static int vfio_pin_page_external(struct vfio_dma *dma, unsigned long vaddr,
 		return -ENODEV;
 
 	ret = vaddr_get_pfn(mm, vaddr, dma->prot, pfn_base);
-	if (!ret && do_accounting && !is_invalid_reserved_pfn(*pfn_base)) {
-		ret = vfio_lock_acct(dma->task, 1, NULL);
-		if (ret) {
-			put_pfn(*pfn_base, dma->prot);
-			if (ret == -ENOMEM)
-				pr_warn("%s: Task %s (%d) RLIMIT_MEMLOCK "
-					"(%ld) exceeded\n", __func__,
-					dma->task->comm, task_pid_nr(dma->task),
-					task_rlimit(dma->task, RLIMIT_MEMLOCK));
-		}
-	}
 
 	mmput(mm);
 	return ret;
 }
 
+/* Account the pages of a new extent, once it can't grow any further. */
+static int vfio_lock_acct_vpfn(struct vfio_dma *dma, struct vfio_pfn *vpfn)
+{
+	int ret;
+
+	if (is_invalid_reserved_pfn(vpfn->pfn))
+		return 0;
+
+	ret = vfio_lock_acct(dma->task, vpfn->npage, NULL);
+	if (ret == -ENOMEM)
+		pr_warn("%s: Task %s (%d) RLIMIT_MEMLOCK (%ld) exceeded\n",
+			__func__, dma->task->comm, task_pid_nr(dma->task),
+			task_rlimit(dma->task, RLIMIT_MEMLOCK));
+	return ret;
+}
+
 static int vfio_unpin_page_external(struct vfio_dma *dma, dma_addr_t iova,
 				    bool do_accounting)
 {
@@ -543,7 +630,8 @@ static int vfio_iommu_type1_pin_pages(void *iommu_data,
 	struct vfio_iommu *iommu = iommu_data;
 	int i, j, ret;
 	unsigned long remote_vaddr;
-	struct vfio_dma *dma;
+	struct vfio_dma *dma = NULL, *last_dma = NULL;
+	struct vfio_pfn *last = NULL;
 	bool do_accounting;
 
 	if (!iommu || !user_pfn || !phys_pfn)
@@ -573,7 +661,10 @@ static int vfio_iommu_type1_pin_pages(void *iommu_data,
 		struct vfio_pfn *vpfn;
 
 		iova = user_pfn[i] << PAGE_SHIFT;
-		dma = vfio_find_dma(iommu, iova, PAGE_SIZE);
+		/* Batched pfns mostly fall into the same dma range. */
+		if (!dma || iova < dma->iova ||
+		    iova + PAGE_SIZE > dma->iova + dma->size)
+			dma = vfio_find_dma(iommu, iova, PAGE_SIZE);
 		if (!dma) {
 			ret = -EINVAL;
 			goto pin_unwind;
@@ -586,34 +677,66 @@ static int vfio_iommu_type1_pin_pages(void *iommu_data,
 
 		vpfn = vfio_iova_get_vfio_pfn(dma, iova);
 		if (vpfn) {
-			phys_pfn[i] = vpfn->pfn;
+			phys_pfn[i] = vfio_vpfn_to_pfn(vpfn, iova);
 			continue;
 		}
 
 		remote_vaddr = dma->vaddr + iova - dma->iova;
-		ret = vfio_pin_page_external(dma, remote_vaddr, &phys_pfn[i],
-					     do_accounting);
+		ret = vfio_pin_page_external(dma, remote_vaddr, &phys_pfn[i]);
 		if (ret)
 			goto pin_unwind;
 
-		ret = vfio_add_to_pfn_list(dma, iova, phys_pfn[i]);
-		if (ret) {
-			vfio_unpin_page_external(dma, iova, do_accounting);
+		/*
+		 * Grow the last extent pinned by this call while the pages
+		 * stay contiguous, e.g. for a hugetlbfs backed guest, so that
+		 * they take one record and one accounting update.
+		 */
+		if (last && last_dma == dma &&
+		    vfio_vpfn_can_extend(last, iova, phys_pfn[i])) {
+			last->npage++;
+			atomic_inc(&last->ref_count);
+			continue;
+		}
+
+		if (last && do_accounting) {
+			ret = vfio_lock_acct_vpfn(last_dma, last);
+			if (ret) {
+				put_pfn(phys_pfn[i], dma->prot);
+				goto pin_unwind;
+			}
+		}
+
+		last = vfio_add_to_pfn_list(dma, iova, phys_pfn[i]);
+		last_dma = dma;
+		if (!last) {
+			put_pfn(phys_pfn[i], dma->prot);
+			ret = -ENOMEM;
 			goto pin_unwind;
 		}
 	}
 
+	if (last && do_accounting) {
+		ret = vfio_lock_acct_vpfn(last_dma, last);
+		if (ret)
+			goto pin_unwind;
+	}
+
 	ret = i;
 	goto pin_done;
 
 pin_unwind:
-	phys_pfn[i] = 0;
+	if (i < npage)
+		phys_pfn[i] = 0;
 	for (j = 0; j < i; j++) {
 		dma_addr_t iova;
+		struct vfio_pfn *vpfn;
 
 		iova = user_pfn[j] << PAGE_SHIFT;
 		dma = vfio_find_dma(iommu, iova, PAGE_SIZE);
-		vfio_unpin_page_external(dma, iova, do_accounting);
+		vpfn = vfio_find_vpfn(dma, iova);
+		/* The last extent hasn't been accounted yet. */
+		vfio_unpin_page_external(dma, iova,
+					 do_accounting && vpfn != last);
 		phys_pfn[j] = 0;
 	}
 pin_done:
@@ -1381,7 +1504,7 @@ static void vfio_iommu_unmap_unpin_reaccount(struct vfio_iommu *iommu)
 							 node);
 
 			if (!is_invalid_reserved_pfn(vpfn->pfn))
-				locked++;
+				locked += vpfn->npage;
 		}
 		vfio_lock_acct(dma->task, locked - unlocked, NULL);
 	}
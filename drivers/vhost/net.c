@@ -32,6 +32,7 @@
 #include <linux/skbuff.h>
 
 #include <net/sock.h>
+#include <net/busy_poll.h>
 
 #include "vhost.h"
 
@@ -44,6 +45,9 @@ MODULE_PARM_DESC(experimental_zcopytx, "Enable Zero Copy TX;"
  * Using this limit prevents one virtqueue from starving others. */
 #define VHOST_NET_WEIGHT 0x80000
 
+/* MAX number of TX used buffers published to the guest at once for datacopy */
+#define VHOST_NET_BATCH 64
+
 /* MAX number of TX used buffers for outstanding zerocopy */
 #define VHOST_MAX_PEND 128
 #define VHOST_GOODCOPY_LEN 256
@@ -101,7 +105,9 @@ struct vhost_net_virtqueue {
 	/* vhost zerocopy support fields below: */
 	/* last used idx for outstanding DMA zerocopy buffers */
 	int upend_idx;
-	/* first used idx for DMA done zerocopy buffers */
+	/* For zerocopy TX, first used idx for DMA done zerocopy buffers
+	 * For datacopy TX, number of used buffers pending in heads
+	 */
 	int done_idx;
 	/* an array of userspace buffers info */
 	struct ubuf_info *ubuf_info;
@@ -323,6 +329,19 @@ static bool vhost_sock_zcopy(struct socket *sock)
 		sock_flag(sock->sk, SOCK_ZEROCOPY);
 }
 
+/* Publish the used buffers of datacopy TX with a single used idx update
+ * and notification check. */
+static void vhost_net_signal_used(struct vhost_net_virtqueue *nvq)
+{
+	struct vhost_virtqueue *vq = &nvq->vq;
+
+	if (!nvq->done_idx)
+		return;
+
+	vhost_add_used_and_signal_n(vq->dev, vq, vq->heads, nvq->done_idx);
+	nvq->done_idx = 0;
+}
+
 /* In case of DMA done not in order in lower device driver for some reason.
  * upend_idx is used to track end of used idx, done_idx is used to track head
  * of used idx. Once lower device DMA done contiguously, we will signal KVM
@@ -575,16 +594,25 @@ static void handle_tx(struct vhost_net *net)
 		if (err != len)
 			pr_debug("Truncated TX packet: "
 				 " len %d != %zd\n", err, len);
-		if (!zcopy_used)
-			vhost_add_used_and_signal(&net->dev, vq, head, 0);
-		else
+		if (zcopy_used) {
 			vhost_zerocopy_signal_used(net, vq);
+		} else if (zcopy) {
+			vhost_add_used_and_signal(&net->dev, vq, head, 0);
+		} else {
+			/* heads is only used by zerocopy, batch into it. */
+			vq->heads[nvq->done_idx].id = cpu_to_vhost32(vq, head);
+			vq->heads[nvq->done_idx].len = 0;
+			if (++nvq->done_idx >= VHOST_NET_BATCH)
+				vhost_net_signal_used(nvq);
+		}
 		vhost_net_tx_packet(net);
 		if (unlikely(total_len >= VHOST_NET_WEIGHT)) {
 			vhost_poll_queue(&vq->poll);
 			break;
 		}
 	}
+	if (!zcopy)
+		vhost_net_signal_used(nvq);
 out:
 	mutex_unlock(&vq->mutex);
 }
@@ -620,6 +648,17 @@ static int sk_has_rx_data(struct sock *sk)
 	return skb_queue_empty(&sk->sk_receive_queue);
 }
 
+/* One step of the rx busy loop. Poll the NAPI context of the NIC queue
+ * that last fed the socket, so its packets reach the socket without
+ * waiting for the interrupt. The poll is bounded by BUSY_POLL_BUDGET and
+ * the whole loop by the vq busyloop_timeout.
+ */
+static void vhost_net_busy_poll_rx(struct sock *sk)
+{
+	sk_busy_loop(sk, 1);
+	cpu_relax();
+}
+
 static int vhost_net_rx_peek_head_len(struct vhost_net *net, struct sock *sk)
 {
 	struct vhost_net_virtqueue *rvq = &net->vqs[VHOST_NET_VQ_RX];
@@ -639,7 +678,7 @@ static int vhost_net_rx_peek_head_len(struct vhost_net *net, struct sock *sk)
 		while (vhost_can_busy_poll(&net->dev, endtime) &&
 		       !sk_has_rx_data(sk) &&
 		       vhost_vq_avail_empty(&net->dev, vq))
-			cpu_relax();
+			vhost_net_busy_poll_rx(sk);
 
 		preempt_enable();
 
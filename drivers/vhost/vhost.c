@@ -289,6 +289,7 @@ static void __vhost_vq_meta_reset(struct vhost_virtqueue *vq)
 
 	for (j = 0; j < VHOST_NUM_ADDRS; j++)
 		vq->meta_iotlb[j] = NULL;
+	vq->desc_node = NULL;
 }
 
 static void vhost_vq_meta_reset(struct vhost_dev *d)
@@ -1324,6 +1325,7 @@ static long vhost_set_memory(struct vhost_dev *d, struct vhost_memory __user *m)
 	for (i = 0; i < d->nvqs; ++i) {
 		mutex_lock(&d->vqs[i]->mutex);
 		d->vqs[i]->umem = newumem;
+		__vhost_vq_meta_reset(d->vqs[i]);
 		mutex_unlock(&d->vqs[i]->mutex);
 	}
 
@@ -1556,6 +1558,7 @@ int vhost_init_device_iotlb(struct vhost_dev *d, bool enabled)
 	for (i = 0; i < d->nvqs; ++i) {
 		mutex_lock(&d->vqs[i]->mutex);
 		d->vqs[i]->iotlb = niotlb;
+		__vhost_vq_meta_reset(d->vqs[i]);
 		mutex_unlock(&d->vqs[i]->mutex);
 	}
 
@@ -1804,16 +1807,26 @@ static int translate_desc(struct vhost_virtqueue *vq, u64 addr, u32 len,
 			break;
 		}
 
-		node = vhost_umem_interval_tree_iter_first(&umem->umem_tree,
-							addr, addr + len - 1);
-		if (node == NULL || node->start > addr) {
-			if (umem != dev->iotlb) {
-				ret = -EFAULT;
+		/*
+		 * Descriptors tend to point into the same few regions, try
+		 * the one used last before walking the interval tree.
+		 */
+		node = vq->desc_node;
+		if (!node || addr < node->start || addr > node->last) {
+			node = vhost_umem_interval_tree_iter_first(
+					&umem->umem_tree, addr, addr + len - 1);
+			if (node == NULL || node->start > addr) {
+				if (umem != dev->iotlb) {
+					ret = -EFAULT;
+					break;
+				}
+				ret = -EAGAIN;
 				break;
 			}
-			ret = -EAGAIN;
-			break;
-		} else if (!(node->perm & access)) {
+			vq->desc_node = node;
+		}
+
+		if (!(node->perm & access)) {
 			ret = -EPERM;
 			break;
 		}
@@ -28,11 +28,14 @@ struct iova_magazine;
 struct iova_cpu_rcache;
 
 #define IOVA_RANGE_CACHE_MAX_SIZE 6	/* log of max cached IOVA range size (in pages) */
-#define MAX_GLOBAL_MAGS 32	/* magazines per bin */
+#define INIT_GLOBAL_MAGS 32	/* magazines per bin, initially */
+#define MAX_GLOBAL_MAGS 64	/* magazines per bin, after growing */
 
 struct iova_rcache {
 	spinlock_t lock;
 	unsigned long depot_size;
+	unsigned long depot_max;
+	bool depot_starved;
 	struct iova_magazine *depot[MAX_GLOBAL_MAGS];
 	struct iova_cpu_rcache __percpu *cpu_rcaches;
 };
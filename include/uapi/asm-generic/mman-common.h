@@ -63,6 +63,8 @@
 #define MADV_WIPEONFORK 18		/* Zero memory on fork, child only */
 #define MADV_KEEPONFORK 19		/* Undo MADV_WIPEONFORK */
 
+#define MADV_COLLAPSE	25		/* Collapse into THPs as soon as possible */
+
 /* compatibility flags */
 #define MAP_FILE	0
 
@@ -1510,6 +1510,14 @@ enum drm_i915_perf_property_id {
 	 */
 	DRM_I915_PERF_PROP_OA_EXPONENT,
 
+	/**
+	 * Open the stream for the shadow context of the GVT vGPU with the
+	 * given ID, so only the OA reports of that vGPU are forwarded. This
+	 * requires root privileges and can't be combined with
+	 * DRM_I915_PERF_PROP_CTX_HANDLE.
+	 */
+	DRM_I915_PERF_PROP_GVT_VGPU_ID,
+
 	DRM_I915_PERF_PROP_MAX /* non-ABI */
 };
 
@@ -301,6 +301,77 @@ struct vfio_region_info_cap_type {
 #define VFIO_REGION_SUBTYPE_INTEL_IGD_HOST_CFG	(2)
 #define VFIO_REGION_SUBTYPE_INTEL_IGD_LPC_CFG	(3)
 
+/*
+ * Pages of guest memory written by a mediated Intel GPU, for live
+ * migration. The region starts with struct vfio_igd_dirty_bitmap_ctl,
+ * writing 1 to @logging starts logging and 0 stops it. The bitmap starts
+ * at @bitmap_offset, bit n standing for guest page frame n. Reading a part
+ * of the bitmap returns the pages written since that part was last read,
+ * and clears them.
+ */
+#define VFIO_REGION_SUBTYPE_INTEL_IGD_DIRTY_BITMAP	(4)
+
+struct vfio_igd_dirty_bitmap_ctl {
+	__u64 logging;
+	__u64 nr_pages;		/* read-only, pages covered by the bitmap */
+	__u64 bitmap_offset;	/* read-only */
+};
+
+/*
+ * Device state of a mediated Intel GPU, for live migration. The region
+ * starts with struct vfio_igd_device_state_ctl, the state is read from or
+ * written to the data area at @data_offset.
+ *
+ * Writing PRECOPY to @action saves the state that changed since the last
+ * save, while the VM keeps running, SAVE saves the rest once it stopped.
+ * Both set @data_size to the size of the saved state. To load it on the
+ * other side, write @data_size, then the state, then LOAD to @action,
+ * once for each saved state in order.
+ */
+#define VFIO_REGION_SUBTYPE_INTEL_IGD_DEVICE_STATE	(5)
+
+#define VFIO_IGD_DEVICE_STATE_PRECOPY	1
+#define VFIO_IGD_DEVICE_STATE_SAVE	2
+#define VFIO_IGD_DEVICE_STATE_LOAD	3
+#define VFIO_IGD_DEVICE_STATE_CANCEL	4
+
+struct vfio_igd_device_state_ctl {
+	__u32 action;		/* write-only */
+	__u32 reserved;
+	__u64 data_size;
+	__u64 data_offset;	/* read-only */
+};
+
+/*
+ * Cursor of a mediated Intel GPU, for remote display clients to follow the
+ * cursor without querying planes. The region is a read-only page holding
+ * struct vfio_igd_cursor, it can be mmapped. The fields are updated by the
+ * vblanks that change the cursor and are consistent if @seq was even and
+ * unchanged before and after reading them. Each update is signalled on the
+ * display irq of the device.
+ *
+ * @dmabuf_id is the dmabuf of the cursor shape, once the client exported
+ * one with VFIO_DEVICE_QUERY_GFX_PLANE, or 0 if the cursor plane needs to
+ * be queried. @shape_seq changes with the shape and @plane_seq with the
+ * other planes, the primary plane needs no query while it stays the same.
+ */
+#define VFIO_REGION_SUBTYPE_INTEL_IGD_CURSOR	(6)
+
+#define VFIO_IGD_CURSOR_VISIBLE		(1 << 0)
+
+struct vfio_igd_cursor {
+	__u32 seq;
+	__u32 flags;
+	__s32 x_pos;
+	__s32 y_pos;
+	__u32 width;
+	__u32 height;
+	__u32 dmabuf_id;
+	__u32 shape_seq;
+	__u32 plane_seq;
+	__u32 reserved;
+};
+
 /*
  * The MSIX mappable capability informs that MSIX data of a BAR can be mmapped
  * which allows direct access to non-MSIX registers which happened to be within
@@ -561,6 +632,16 @@ struct vfio_device_gfx_plane_info {
 		__u32 region_index;	/* region index */
 		__u32 dmabuf_id;	/* dma-buf id */
 	};
+	/*
+	 * out, only filled in when argsz covers them: bounding box of the
+	 * plane area which may have changed since the previous query, zero
+	 * sized if nothing changed. Callers should preset it to the whole
+	 * plane for devices which don't report damage.
+	 */
+	__u32 damage_x;
+	__u32 damage_y;
+	__u32 damage_width;
+	__u32 damage_height;
 };
 
 #define VFIO_DEVICE_QUERY_GFX_PLANE _IO(VFIO_TYPE, VFIO_BASE + 14)
@@ -50,6 +50,7 @@ struct htab_elem {
 			union {
 				struct bpf_htab *htab;
 				struct pcpu_freelist_node fnode;
+				struct htab_elem *batch_flink;
 			};
 		};
 	};
@@ -1152,11 +1153,176 @@ static void htab_map_free(struct bpf_map *map)
 	kfree(htab);
 }
 
+/* Called from syscall. The batch cursor handed to and from userspace is
+ * a bucket index, and buckets are always copied whole: a bucket that
+ * doesn't fit in what is left of @count ends the batch, or fails it
+ * with -ENOSPC if nothing has been copied yet. -ENOENT is returned
+ * together with the last elements once the end of the table is reached.
+ */
+static int
+__htab_map_lookup_and_delete_batch(struct bpf_map *map,
+				   const union bpf_attr *attr,
+				   union bpf_attr __user *uattr,
+				   bool do_delete)
+{
+	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
+	void __user *ubatch = u64_to_user_ptr(attr->batch.in_batch);
+	void __user *ukeys = u64_to_user_ptr(attr->batch.keys);
+	void __user *uvalues = u64_to_user_ptr(attr->batch.values);
+	u32 batch = 0, max_count, total = 0, bucket_cnt;
+	u32 key_size = map->key_size, value_size, size;
+	struct htab_elem *node_to_free = NULL;
+	void *keys, *values, *dst_key, *dst_val;
+	bool is_percpu = htab_is_percpu(htab);
+	bool is_lru = htab_is_lru(htab);
+	struct hlist_nulls_node *n;
+	unsigned long flags;
+	struct htab_elem *l;
+	struct bucket *b;
+	int ret = 0;
+
+	max_count = attr->batch.count;
+	if (!max_count)
+		return 0;
+
+	if (ubatch && copy_from_user(&batch, ubatch, sizeof(batch)))
+		return -EFAULT;
+
+	if (batch >= htab->n_buckets)
+		return -ENOENT;
+
+	/* the map never holds much more than max_entries elements */
+	max_count = min(max_count, map->max_entries);
+
+	size = round_up(map->value_size, 8);
+	value_size = is_percpu ? size * num_possible_cpus() : map->value_size;
+
+	keys = kvmalloc_array(max_count, key_size, GFP_USER | __GFP_NOWARN);
+	values = kvmalloc_array(max_count, value_size, GFP_USER | __GFP_NOWARN);
+	if (!keys || !values) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	dst_key = keys;
+	dst_val = values;
+
+	for (; batch < htab->n_buckets; batch++) {
+		b = &htab->buckets[batch];
+
+		preempt_disable();
+		__this_cpu_inc(bpf_prog_active);
+		rcu_read_lock();
+		raw_spin_lock_irqsave(&b->lock, flags);
+
+		bucket_cnt = 0;
+		hlist_nulls_for_each_entry_rcu(l, n, &b->head, hash_node)
+			bucket_cnt++;
+
+		if (bucket_cnt > max_count - total) {
+			raw_spin_unlock_irqrestore(&b->lock, flags);
+			rcu_read_unlock();
+			__this_cpu_dec(bpf_prog_active);
+			preempt_enable();
+			if (!total)
+				ret = -ENOSPC;
+			break;
+		}
+
+		hlist_nulls_for_each_entry_safe(l, n, &b->head, hash_node) {
+			memcpy(dst_key, l->key, key_size);
+
+			if (is_percpu) {
+				void __percpu *pptr;
+				int off = 0, cpu;
+
+				pptr = htab_elem_get_ptr(l, key_size);
+				for_each_possible_cpu(cpu) {
+					bpf_long_memcpy(dst_val + off,
+							per_cpu_ptr(pptr, cpu),
+							size);
+					off += size;
+				}
+			} else {
+				memcpy(dst_val, l->key + round_up(key_size, 8),
+				       value_size);
+			}
+
+			if (do_delete) {
+				hlist_nulls_del_rcu(&l->hash_node);
+
+				/* LRU nodes go back to the LRU after the
+				 * bucket lock is dropped, as in
+				 * htab_lru_map_delete_elem().
+				 */
+				if (is_lru) {
+					l->batch_flink = node_to_free;
+					node_to_free = l;
+				} else {
+					free_htab_elem(htab, l);
+				}
+			}
+
+			dst_key += key_size;
+			dst_val += value_size;
+		}
+
+		raw_spin_unlock_irqrestore(&b->lock, flags);
+
+		while (node_to_free) {
+			l = node_to_free;
+			node_to_free = node_to_free->batch_flink;
+			bpf_lru_push_free(&htab->lru, &l->lru_node);
+		}
+
+		rcu_read_unlock();
+		__this_cpu_dec(bpf_prog_active);
+		preempt_enable();
+
+		total += bucket_cnt;
+		cond_resched();
+	}
+
+	if (ret)
+		goto out;
+
+	if (batch >= htab->n_buckets)
+		ret = -ENOENT;
+
+	if (copy_to_user(ukeys, keys, total * key_size) ||
+	    copy_to_user(uvalues, values, total * value_size) ||
+	    put_user(total, &uattr->batch.count) ||
+	    copy_to_user(u64_to_user_ptr(attr->batch.out_batch), &batch,
+			 sizeof(batch)))
+		ret = -EFAULT;
+
+out:
+	kvfree(keys);
+	kvfree(values);
+	return ret;
+}
+
+static int htab_map_lookup_batch(struct bpf_map *map,
+				 const union bpf_attr *attr,
+				 union bpf_attr __user *uattr)
+{
+	return __htab_map_lookup_and_delete_batch(map, attr, uattr, false);
+}
+
+static int htab_map_lookup_and_delete_batch(struct bpf_map *map,
+					    const union bpf_attr *attr,
+					    union bpf_attr __user *uattr)
+{
+	return __htab_map_lookup_and_delete_batch(map, attr, uattr, true);
+}
+
 const struct bpf_map_ops htab_map_ops = {
 	.map_alloc_check = htab_map_alloc_check,
 	.map_alloc = htab_map_alloc,
 	.map_free = htab_map_free,
 	.map_get_next_key = htab_map_get_next_key,
+	.map_lookup_batch = htab_map_lookup_batch,
+	.map_lookup_and_delete_batch = htab_map_lookup_and_delete_batch,
 	.map_lookup_elem = htab_map_lookup_elem,
 	.map_update_elem = htab_map_update_elem,
 	.map_delete_elem = htab_map_delete_elem,
@@ -1168,6 +1334,8 @@ const struct bpf_map_ops htab_lru_map_ops = {
 	.map_alloc = htab_map_alloc,
 	.map_free = htab_map_free,
 	.map_get_next_key = htab_map_get_next_key,
+	.map_lookup_batch = htab_map_lookup_batch,
+	.map_lookup_and_delete_batch = htab_map_lookup_and_delete_batch,
 	.map_lookup_elem = htab_lru_map_lookup_elem,
 	.map_update_elem = htab_lru_map_update_elem,
 	.map_delete_elem = htab_lru_map_delete_elem,
@@ -1252,6 +1420,8 @@ const struct bpf_map_ops htab_percpu_map_ops = {
 	.map_alloc = htab_map_alloc,
 	.map_free = htab_map_free,
 	.map_get_next_key = htab_map_get_next_key,
+	.map_lookup_batch = htab_map_lookup_batch,
+	.map_lookup_and_delete_batch = htab_map_lookup_and_delete_batch,
 	.map_lookup_elem = htab_percpu_map_lookup_elem,
 	.map_update_elem = htab_percpu_map_update_elem,
 	.map_delete_elem = htab_map_delete_elem,
@@ -1262,6 +1432,8 @@ const struct bpf_map_ops htab_lru_percpu_map_ops = {
 	.map_alloc = htab_map_alloc,
 	.map_free = htab_map_free,
 	.map_get_next_key = htab_map_get_next_key,
+	.map_lookup_batch = htab_map_lookup_batch,
+	.map_lookup_and_delete_batch = htab_map_lookup_and_delete_batch,
 	.map_lookup_elem = htab_lru_percpu_map_lookup_elem,
 	.map_update_elem = htab_lru_percpu_map_update_elem,
 	.map_delete_elem = htab_lru_map_delete_elem,
@@ -858,6 +858,49 @@ static int map_get_next_key(union bpf_attr *attr)
 	return err;
 }
 
+#define BPF_MAP_BATCH_LAST_FIELD batch.flags
+
+static int bpf_map_do_batch(const union bpf_attr *attr,
+			    union bpf_attr __user *uattr, int cmd)
+{
+	bool do_delete = cmd == BPF_MAP_LOOKUP_AND_DELETE_BATCH;
+	struct bpf_map *map;
+	struct fd f;
+	int err;
+
+	if (CHECK_ATTR(BPF_MAP_BATCH))
+		return -EINVAL;
+
+	if (attr->batch.flags)
+		return -EINVAL;
+
+	f = fdget(attr->batch.map_fd);
+	map = __bpf_map_get(f);
+	if (IS_ERR(map))
+		return PTR_ERR(map);
+
+	if (!(f.file->f_mode & FMODE_CAN_READ) ||
+	    (do_delete && !(f.file->f_mode & FMODE_CAN_WRITE))) {
+		err = -EPERM;
+		goto err_put;
+	}
+
+	if (bpf_map_is_dev_bound(map)) {
+		err = -ENOTSUPP;
+		goto err_put;
+	}
+
+	if (do_delete && map->ops->map_lookup_and_delete_batch)
+		err = map->ops->map_lookup_and_delete_batch(map, attr, uattr);
+	else if (!do_delete && map->ops->map_lookup_batch)
+		err = map->ops->map_lookup_batch(map, attr, uattr);
+	else
+		err = -ENOTSUPP;
+err_put:
+	fdput(f);
+	return err;
+}
+
 static const struct bpf_prog_ops * const bpf_prog_types[] = {
 #define BPF_PROG_TYPE(_id, _name) \
 	[_id] = & _name ## _prog_ops,
@@ -1917,6 +1960,10 @@ SYSCALL_DEFINE3(bpf, int, cmd, union bpf_attr __user *, uattr, unsigned int, siz
 	case BPF_OBJ_GET_INFO_BY_FD:
 		err = bpf_obj_get_info_by_fd(&attr, uattr);
 		break;
+	case BPF_MAP_LOOKUP_BATCH:
+	case BPF_MAP_LOOKUP_AND_DELETE_BATCH:
+		err = bpf_map_do_batch(&attr, uattr, cmd);
+		break;
 	default:
 		err = -EINVAL;
 		break;
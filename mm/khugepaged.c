@@ -86,6 +86,8 @@ struct mm_slot {
 	struct hlist_node hash;
 	struct list_head mm_node;
 	struct mm_struct *mm;
+	/* queued collapse requests, protected by khugepaged_mm_lock */
+	unsigned int nr_collapse_requests;
 };
 
 /**
@@ -106,6 +108,33 @@ static struct khugepaged_scan khugepaged_scan = {
 	.mm_head = LIST_HEAD_INIT(khugepaged_scan.mm_head),
 };
 
+/**
+ * struct collapse_request - a range to collapse ahead of the scan
+ * @list: entry in khugepaged_collapse_requests
+ * @mm: the mm of the range, grabbed
+ * @address: the next address to collapse
+ * @end: the end of the range
+ *
+ * Queued by MADV_COLLAPSE and served by khugepaged before it goes on
+ * scanning the registered mms, e.g. for a VMM to get the memory of a
+ * guest backed by THPs right after boot or migration instead of after
+ * many rounds of the scan.
+ */
+struct collapse_request {
+	struct list_head list;
+	struct mm_struct *mm;
+	unsigned long address;
+	unsigned long end;
+};
+
+/* collapse requests an mm may have queued at a time */
+#define KHUGEPAGED_MAX_COLLAPSE_REQUESTS	16
+
+/* protected by khugepaged_mm_lock */
+static LIST_HEAD(khugepaged_collapse_requests);
+/* a request came in, cut the sleep between two scans short */
+static bool khugepaged_collapse_kick;
+
 #ifdef CONFIG_SYSFS
 static ssize_t scan_sleep_millisecs_show(struct kobject *kobj,
 					 struct kobj_attribute *attr,
@@ -453,6 +482,7 @@ int khugepaged_enter_vma_merge(struct vm_area_struct *vma,
 void __khugepaged_exit(struct mm_struct *mm)
 {
 	struct mm_slot *mm_slot;
+	bool barrier = false;
 	int free = 0;
 
 	spin_lock(&khugepaged_mm_lock);
@@ -462,13 +492,17 @@ void __khugepaged_exit(struct mm_struct *mm)
 		list_del(&mm_slot->mm_node);
 		free = 1;
 	}
+	/* khugepaged serves collapse requests outside of the scan */
+	if (mm_slot)
+		barrier = !free || mm_slot->nr_collapse_requests;
 	spin_unlock(&khugepaged_mm_lock);
 
 	if (free) {
 		clear_bit(MMF_VM_HUGEPAGE, &mm->flags);
 		free_mm_slot(mm_slot);
 		mmdrop(mm);
-	} else if (mm_slot) {
+	}
+	if (barrier) {
 		/*
 		 * This is required to serialize against
 		 * khugepaged_test_exit() (which is guaranteed to run
@@ -1775,15 +1809,138 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 	return progress;
 }
 
+/**
+ * khugepaged_request_collapse - have khugepaged collapse a range first
+ * @vma: the vma of the range
+ * @start: start of the range
+ * @end: end of the range
+ *
+ * Called for MADV_COLLAPSE with mmap_sem held. Only the huge page aligned
+ * part of the range is collapsed, asynchronously.
+ *
+ * Returns:
+ * Zero on success, -EINVAL if the vma doesn't qualify for THPs, -EAGAIN
+ * if the mm has too many requests queued already.
+ */
+int khugepaged_request_collapse(struct vm_area_struct *vma,
+				unsigned long start, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct collapse_request *req;
+	struct mm_slot *mm_slot;
+
+	if (!khugepaged_enabled() || !hugepage_vma_check(vma) ||
+	    shmem_file(vma->vm_file))
+		return -EINVAL;
+
+	start = round_up(start, HPAGE_PMD_SIZE);
+	end = round_down(end, HPAGE_PMD_SIZE);
+	if (start >= end)
+		return 0;
+
+	if (khugepaged_enter(vma, vma->vm_flags))
+		return -ENOMEM;
+
+	req = kmalloc(sizeof(*req), GFP_KERNEL_ACCOUNT);
+	if (!req)
+		return -ENOMEM;
+
+	req->mm = mm;
+	req->address = start;
+	req->end = end;
+
+	spin_lock(&khugepaged_mm_lock);
+	mm_slot = get_mm_slot(mm);
+	if (!mm_slot ||
+	    mm_slot->nr_collapse_requests >= KHUGEPAGED_MAX_COLLAPSE_REQUESTS) {
+		spin_unlock(&khugepaged_mm_lock);
+		kfree(req);
+		return -EAGAIN;
+	}
+	mm_slot->nr_collapse_requests++;
+	mmgrab(mm);
+	list_add_tail(&req->list, &khugepaged_collapse_requests);
+	WRITE_ONCE(khugepaged_collapse_kick, true);
+	spin_unlock(&khugepaged_mm_lock);
+
+	wake_up_interruptible(&khugepaged_wait);
+	return 0;
+}
+
+/*
+ * Collapse the next huge page of the oldest request. Returns the progress,
+ * counted like khugepaged_scan_mm_slot() does.
+ */
+static unsigned int khugepaged_do_collapse_request(struct page **hpage)
+	__releases(&khugepaged_mm_lock)
+	__acquires(&khugepaged_mm_lock)
+{
+	struct collapse_request *req;
+	struct vm_area_struct *vma;
+	struct mm_slot *mm_slot;
+	struct mm_struct *mm;
+	unsigned long address;
+	bool done = true;
+
+	req = list_first_entry(&khugepaged_collapse_requests,
+			       struct collapse_request, list);
+	mm = req->mm;
+	address = req->address;
+	spin_unlock(&khugepaged_mm_lock);
+
+	if (khugepaged_test_exit(mm))
+		goto out;
+
+	/* come back to it on the next round if the mm is busy */
+	done = false;
+	if (!down_read_trylock(&mm->mmap_sem))
+		goto out;
+
+	/* __khugepaged_exit() waits for mmap_sem while requests are queued */
+	if (unlikely(khugepaged_test_exit(mm))) {
+		up_read(&mm->mmap_sem);
+		done = true;
+		goto out;
+	}
+
+	vma = find_vma(mm, address);
+	if (vma && vma->vm_start <= address &&
+	    address + HPAGE_PMD_SIZE <= vma->vm_end &&
+	    hugepage_vma_check(vma) && !shmem_file(vma->vm_file)) {
+		/* a collapse drops mmap_sem */
+		if (!khugepaged_scan_pmd(mm, vma, address, hpage))
+			up_read(&mm->mmap_sem);
+	} else {
+		up_read(&mm->mmap_sem);
+	}
+
+	address += HPAGE_PMD_SIZE;
+	done = address >= req->end;
+out:
+	spin_lock(&khugepaged_mm_lock);
+	req->address = address;
+	if (done) {
+		list_del(&req->list);
+		mm_slot = get_mm_slot(mm);
+		if (mm_slot)
+			mm_slot->nr_collapse_requests--;
+		mmdrop(mm);
+		kfree(req);
+	}
+	return HPAGE_PMD_NR;
+}
+
 static int khugepaged_has_work(void)
 {
-	return !list_empty(&khugepaged_scan.mm_head) &&
+	return (!list_empty(&khugepaged_scan.mm_head) ||
+		!list_empty(&khugepaged_collapse_requests)) &&
 		khugepaged_enabled();
 }
 
 static int khugepaged_wait_event(void)
 {
 	return !list_empty(&khugepaged_scan.mm_head) ||
+		!list_empty(&khugepaged_collapse_requests) ||
 		kthread_should_stop();
 }
 
@@ -1795,6 +1952,7 @@ static void khugepaged_do_scan(void)
 	bool wait = true;
 
 	barrier(); /* write khugepaged_pages_to_scan to local stack */
+	WRITE_ONCE(khugepaged_collapse_kick, false);
 
 	while (progress < pages) {
 		if (!khugepaged_prealloc_page(&hpage, &wait))
@@ -1806,6 +1964,11 @@ static void khugepaged_do_scan(void)
 			break;
 
 		spin_lock(&khugepaged_mm_lock);
+		if (!list_empty(&khugepaged_collapse_requests)) {
+			progress += khugepaged_do_collapse_request(&hpage);
+			spin_unlock(&khugepaged_mm_lock);
+			continue;
+		}
 		if (!khugepaged_scan.mm_slot)
 			pass_through_head++;
 		if (khugepaged_has_work() &&
@@ -1824,6 +1987,7 @@ static void khugepaged_do_scan(void)
 static bool khugepaged_should_wakeup(void)
 {
 	return kthread_should_stop() ||
+	       READ_ONCE(khugepaged_collapse_kick) ||
 	       time_after_eq(jiffies, khugepaged_sleep_expire);
 }
 
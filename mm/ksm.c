@@ -25,7 +25,6 @@
 #include <linux/pagemap.h>
 #include <linux/rmap.h>
 #include <linux/spinlock.h>
-#include <linux/jhash.h>
 #include <linux/delay.h>
 #include <linux/kthread.h>
 #include <linux/wait.h>
@@ -34,6 +33,7 @@
 #include <linux/memory.h>
 #include <linux/mmu_notifier.h>
 #include <linux/swap.h>
+#include <linux/xxhash.h>
 #include <linux/ksm.h>
 #include <linux/hashtable.h>
 #include <linux/freezer.h>
@@ -975,11 +975,22 @@ static int unmerge_and_remove_all_rmap_items(void)
 }
 #endif /* CONFIG_SYSFS */
 
+/*
+ * The checksum tells whether a page has stayed unchanged between two scans,
+ * and whether it could be the zero page, contents are always compared in
+ * full before merging so any fast hash will do. It is computed for every
+ * page scanned, and the xxhash variant matching the word size runs several
+ * times faster than jhash2() over a page.
+ */
 static u32 calc_checksum(struct page *page)
 {
 	u32 checksum;
 	void *addr = kmap_atomic(page);
-	checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+#if BITS_PER_LONG == 64
+	checksum = xxh64(addr, PAGE_SIZE, 0);
+#else
+	checksum = xxh32(addr, PAGE_SIZE, 0);
+#endif
 	kunmap_atomic(addr);
 	return checksum;
 }
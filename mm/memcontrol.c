@@ -678,10 +678,37 @@ struct mem_cgroup *mem_cgroup_from_task(struct task_struct *p)
 }
 EXPORT_SYMBOL(mem_cgroup_from_task);
 
-static struct mem_cgroup *get_mem_cgroup_from_mm(struct mm_struct *mm)
+/*
+ * Obtain a reference on the memcg set by memalloc_use_memcg(), if any. The
+ * task which set it holds a reference, it can only have gone offline.
+ */
+static struct mem_cgroup *get_active_memcg(void)
+{
+	struct mem_cgroup *memcg = current->active_memcg;
+
+	if (memcg && !css_tryget_online(&memcg->css))
+		memcg = NULL;
+	return memcg;
+}
+
+/**
+ * get_mem_cgroup_from_mm: Obtain a reference on given mm_struct's memcg.
+ * @mm: mm from which memcg should be extracted. It can be NULL.
+ *
+ * Obtain a reference on mm->memcg and returns it if successful. If @mm is
+ * NULL, the active memcg of the current task or root_mem_cgroup is
+ * returned.
+ */
+struct mem_cgroup *get_mem_cgroup_from_mm(struct mm_struct *mm)
 {
 	struct mem_cgroup *memcg = NULL;
 
+	if (unlikely(!mm)) {
+		memcg = get_active_memcg();
+		if (memcg)
+			return memcg;
+	}
+
 	rcu_read_lock();
 	do {
 		/*
@@ -700,6 +727,18 @@ static struct mem_cgroup *get_mem_cgroup_from_mm(struct mm_struct *mm)
 	rcu_read_unlock();
 	return memcg;
 }
+EXPORT_SYMBOL(get_mem_cgroup_from_mm);
+
+/*
+ * Obtain a reference on the memcg to charge kmem to: the active memcg of
+ * the current task if it has set one, the memcg of its mm otherwise.
+ */
+static struct mem_cgroup *get_mem_cgroup_from_current(void)
+{
+	struct mem_cgroup *memcg = get_active_memcg();
+
+	return memcg ?: get_mem_cgroup_from_mm(current->mm);
+}
 
 /**
  * mem_cgroup_iter - iterate over memory cgroup hierarchy
@@ -2226,7 +2265,10 @@ static void memcg_schedule_kmem_cache_create(struct mem_cgroup *memcg,
 
 static inline bool memcg_kmem_bypass(void)
 {
-	if (in_interrupt() || !current->mm || (current->flags & PF_KTHREAD))
+	if (in_interrupt())
+		return true;
+	if ((!current->mm || (current->flags & PF_KTHREAD)) &&
+	    !current->active_memcg)
 		return true;
 	return false;
 }
@@ -2261,7 +2303,7 @@ struct kmem_cache *memcg_kmem_get_cache(struct kmem_cache *cachep)
 	if (current->memcg_kmem_skip_account)
 		return cachep;
 
-	memcg = get_mem_cgroup_from_mm(current->mm);
+	memcg = get_mem_cgroup_from_current();
 	kmemcg_id = READ_ONCE(memcg->kmemcg_id);
 	if (kmemcg_id < 0)
 		goto out;
@@ -2345,7 +2387,7 @@ int memcg_kmem_charge(struct page *page, gfp_t gfp, int order)
 	if (memcg_kmem_bypass())
 		return 0;
 
-	memcg = get_mem_cgroup_from_mm(current->mm);
+	memcg = get_mem_cgroup_from_current();
 	if (!mem_cgroup_is_root(memcg)) {
 		ret = memcg_kmem_charge_memcg(page, gfp, order, memcg);
 		if (!ret)
@@ -35,6 +35,8 @@
 #include <linux/memblock.h>
 #include <linux/bootmem.h>
 #include <linux/compaction.h>
+#include <linux/sizes.h>
+#include <linux/workqueue.h>
 
 #include <asm/tlbflush.h>
 
@@ -795,11 +797,97 @@ static void __meminit resize_pgdat_range(struct pglist_data *pgdat, unsigned lon
 	pgdat->node_spanned_pages = max(start_pfn + nr_pages, old_end_pfn) - pgdat->node_start_pfn;
 }
 
+/*
+ * Initializing the struct pages of a big range takes a while, spread it
+ * over the CPUs of the node like deferred_init_memmap() does at boot.
+ * A chunk is at least this many pages and a multiple of a pageblock.
+ */
+#define MEMMAP_INIT_CHUNK_MIN	(SZ_64M >> PAGE_SHIFT)
+
+struct memmap_init_work {
+	struct work_struct work;
+	struct zone *zone;
+	unsigned long start_pfn;
+	unsigned long nr_pages;
+	struct vmem_altmap *altmap;
+};
+
+static void __meminit memmap_init_work_fn(struct work_struct *work)
+{
+	struct memmap_init_work *w =
+		container_of(work, struct memmap_init_work, work);
+
+	memmap_init_zone(w->nr_pages, zone_to_nid(w->zone), zone_idx(w->zone),
+			 w->start_pfn, MEMMAP_HOTPLUG, w->altmap);
+}
+
+static void __meminit memmap_init_range(struct zone *zone,
+		unsigned long start_pfn, unsigned long nr_pages,
+		struct vmem_altmap *altmap)
+{
+	const struct cpumask *mask = cpumask_of_node(zone_to_nid(zone));
+	unsigned long chunk, pfn, end_pfn = start_pfn + nr_pages;
+	struct memmap_init_work *works;
+	unsigned int nr_works, nr_cpus, i;
+	int cpu;
+
+	nr_cpus = cpumask_weight(mask);
+	if (!nr_cpus) {
+		/* a node with memory only, use the CPUs of the others */
+		mask = cpu_online_mask;
+		nr_cpus = num_online_cpus();
+	}
+
+	chunk = max_t(unsigned long, DIV_ROUND_UP(nr_pages, nr_cpus),
+		      MEMMAP_INIT_CHUNK_MIN);
+	chunk = ALIGN(chunk, pageblock_nr_pages);
+	nr_works = DIV_ROUND_UP(nr_pages, chunk);
+
+	works = nr_works > 1 ?
+		kcalloc(nr_works - 1, sizeof(*works), GFP_KERNEL) : NULL;
+	if (!works) {
+		memmap_init_zone(nr_pages, zone_to_nid(zone), zone_idx(zone),
+				 start_pfn, MEMMAP_HOTPLUG, altmap);
+		return;
+	}
+
+	/*
+	 * The last chunk is done here first, so that highest_memmap_pfn is
+	 * already up to date when the others are done in parallel. Only
+	 * the first chunk starts at the altmap base and skips its reserve.
+	 */
+	pfn = start_pfn + (nr_works - 1) * chunk;
+	memmap_init_zone(end_pfn - pfn, zone_to_nid(zone), zone_idx(zone),
+			 pfn, MEMMAP_HOTPLUG, altmap);
+
+	cpu = cpumask_first_and(mask, cpu_online_mask);
+	for (i = 0; i < nr_works - 1; i++) {
+		struct memmap_init_work *w = &works[i];
+
+		INIT_WORK(&w->work, memmap_init_work_fn);
+		w->zone = zone;
+		w->start_pfn = start_pfn + i * chunk;
+		w->nr_pages = chunk;
+		w->altmap = altmap;
+
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first_and(mask, cpu_online_mask);
+		if (cpu < nr_cpu_ids)
+			queue_work_on(cpu, system_unbound_wq, &w->work);
+		else
+			queue_work(system_unbound_wq, &w->work);
+		cpu = cpumask_next_and(cpu, mask, cpu_online_mask);
+	}
+
+	for (i = 0; i < nr_works - 1; i++)
+		flush_work(&works[i].work);
+	kfree(works);
+}
+
 void __ref move_pfn_range_to_zone(struct zone *zone, unsigned long start_pfn,
 		unsigned long nr_pages, struct vmem_altmap *altmap)
 {
 	struct pglist_data *pgdat = zone->zone_pgdat;
-	int nid = pgdat->node_id;
 	unsigned long flags;
 
 	if (zone_is_empty(zone))
@@ -821,8 +909,7 @@ void __ref move_pfn_range_to_zone(struct zone *zone, unsigned long start_pfn,
 	 * expects the zone spans the pfn range. All the pages in the range
 	 * are reserved so nobody should be touching them so we should be safe
 	 */
-	memmap_init_zone(nr_pages, nid, zone_idx(zone), start_pfn,
-			MEMMAP_HOTPLUG, altmap);
+	memmap_init_range(zone, start_pfn, nr_pages, altmap);
 
 	set_zone_contiguous(zone);
 }
@@ -41,6 +41,8 @@
 #include <linux/swapops.h>
 #include <linux/writeback.h>
 #include <linux/pagemap.h>
+#include <linux/blkdev.h>
+#include <linux/workqueue.h>
 
 /*********************************
 * statistics
@@ -118,6 +120,11 @@ module_param_cb(zpool, &zswap_zpool_param_ops, &zswap_zpool_type, 0644);
 static unsigned int zswap_max_pool_percent = 20;
 module_param_named(max_pool_percent, zswap_max_pool_percent, uint, 0644);
 
+/* The threshold for accepting new pages after the max_pool_percent was hit */
+static unsigned int zswap_accept_thr_percent = 90; /* of max pool size */
+module_param_named(accept_threshold_percent, zswap_accept_thr_percent,
+		   uint, 0644);
+
 /* Enable/disable handling same-value filled pages (enabled by default) */
 static bool zswap_same_filled_pages_enabled = true;
 module_param_named(same_filled_pages_enabled, zswap_same_filled_pages_enabled,
@@ -133,6 +140,7 @@ struct zswap_pool {
 	struct kref kref;
 	struct list_head list;
 	struct work_struct work;
+	struct work_struct shrink_work;
 	struct hlist_node node;
 	char tfm_name[CRYPTO_MAX_ALG_NAME];
 };
@@ -198,6 +206,12 @@ static bool zswap_init_started;
 /* fatal error during init */
 static bool zswap_init_failed;
 
+/* the pool limit was hit, and the pool has not shrunk enough since */
+static bool zswap_pool_reached_full;
+
+static struct workqueue_struct *shrink_wq;
+static void shrink_worker(struct work_struct *w);
+
 /* init completed, but couldn't create the initial pool */
 static bool zswap_has_pool;
 
@@ -223,6 +237,13 @@ static bool zswap_is_full(void)
 		DIV_ROUND_UP(zswap_pool_total_size, PAGE_SIZE);
 }
 
+static bool zswap_can_accept(void)
+{
+	return totalram_pages * zswap_accept_thr_percent / 100 *
+				zswap_max_pool_percent / 100 >
+			DIV_ROUND_UP(zswap_pool_total_size, PAGE_SIZE);
+}
+
 static void zswap_update_total_size(void)
 {
 	struct zswap_pool *pool;
@@ -560,6 +581,7 @@ static struct zswap_pool *zswap_pool_create(char *type, char *compressor)
 	 */
 	kref_init(&pool->kref);
 	INIT_LIST_HEAD(&pool->list);
+	INIT_WORK(&pool->shrink_work, shrink_worker);
 
 	zswap_pool_debug("created", pool);
 
@@ -952,20 +974,29 @@ static int zswap_writeback_entry(struct zpool *pool, unsigned long handle)
 	return ret;
 }
 
-static int zswap_shrink(void)
+/*
+ * Once the pool limit is hit, write back from the oldest pool until it is
+ * below the accept threshold again, rather than one page on every store
+ * in the reclaim path. The writes are plugged so that they reach the swap
+ * device as large batches. The work holds a reference to the pool.
+ */
+static void shrink_worker(struct work_struct *w)
 {
-	struct zswap_pool *pool;
-	int ret;
+	struct zswap_pool *pool = container_of(w, typeof(*pool),
+					       shrink_work);
+	struct blk_plug plug;
 
-	pool = zswap_pool_last_get();
-	if (!pool)
-		return -ENOENT;
-
-	ret = zpool_shrink(pool->zpool, 1, NULL);
+	blk_start_plug(&plug);
+	while (!zswap_can_accept()) {
+		if (zpool_shrink(pool->zpool, 1, NULL)) {
+			zswap_reject_reclaim_fail++;
+			break;
+		}
+		cond_resched();
+	}
+	blk_finish_plug(&plug);
 
 	zswap_pool_put(pool);
-
-	return ret;
 }
 
 static int zswap_is_page_same_filled(void *ptr, unsigned long *value)
@@ -999,6 +1030,7 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 {
 	struct zswap_tree *tree = zswap_trees[type];
 	struct zswap_entry *entry, *dupentry;
+	struct zswap_pool *pool;
 	struct crypto_comp *tfm;
 	int ret;
 	unsigned int hlen, dlen = PAGE_SIZE;
@@ -1018,14 +1050,21 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 		goto reject;
 	}
 
-	/* reclaim space if needed */
+	/*
+	 * Reclaim space if needed. New pages go straight to swap until the
+	 * pool has been written back below the accept threshold, so that the
+	 * limit is not hit again on the very next store.
+	 */
 	if (zswap_is_full()) {
 		zswap_pool_limit_hit++;
-		if (zswap_shrink()) {
-			zswap_reject_reclaim_fail++;
-			ret = -ENOMEM;
-			goto reject;
-		}
+		zswap_pool_reached_full = true;
+		goto shrink;
+	}
+
+	if (zswap_pool_reached_full) {
+		if (!zswap_can_accept())
+			goto shrink;
+		zswap_pool_reached_full = false;
 	}
 
 	/* allocate entry */
@@ -1119,6 +1158,13 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 	zswap_entry_cache_free(entry);
 reject:
 	return ret;
+
+shrink:
+	pool = zswap_pool_last_get();
+	if (pool && !queue_work(shrink_wq, &pool->shrink_work))
+		zswap_pool_put(pool);
+	ret = -ENOMEM;
+	goto reject;
 }
 
 /*
@@ -1308,6 +1354,13 @@ static int __init init_zswap(void)
 		goto cache_fail;
 	}
 
+	shrink_wq = alloc_workqueue("zswap-shrink",
+				    WQ_UNBOUND | WQ_MEM_RECLAIM, 1);
+	if (!shrink_wq) {
+		pr_err("shrink workqueue creation failed\n");
+		goto shrink_wq_fail;
+	}
+
 	ret = cpuhp_setup_state(CPUHP_MM_ZSWP_MEM_PREPARE, "mm/zswap:prepare",
 				zswap_dstmem_prepare, zswap_dstmem_dead);
 	if (ret) {
@@ -1341,6 +1394,8 @@ static int __init init_zswap(void)
 hp_fail:
 	cpuhp_remove_state(CPUHP_MM_ZSWP_MEM_PREPARE);
 dstmem_fail:
+	destroy_workqueue(shrink_wq);
+shrink_wq_fail:
 	zswap_entry_cache_destroy();
 cache_fail:
 	/* if built-in, we aren't unloaded on failure; don't allow use */
@@ -1,6 +1,8 @@
 // SPDX-License-Identifier: GPL-2.0
 #include <errno.h>
+#include <string.h>
 #include "../../util/kvm-stat.h"
+#include "../../util/parse-events.h"
 #include <asm/svm.h>
 #include <asm/vmx.h>
 #include <asm/kvm.h>
@@ -131,11 +133,53 @@ static struct kvm_events_ops ioport_events = {
 	.name = "IO Port Access"
 };
 
+/*
+ * For the gvt events, we treat the time of a guest access to the MMIO BAR
+ * of an Intel GVT-g vGPU as kvm_exit -> gvt:vgpu_mmio, which includes the
+ * round trip through the VMM, and key it by the vGPU register.
+ */
+static const char *gvt_mmio_trace = "gvt:vgpu_mmio";
+
+static bool gvt_event_begin(struct perf_evsel *evsel,
+			    struct perf_sample *sample __maybe_unused,
+			    struct event_key *key __maybe_unused)
+{
+	return kvm_exit_event(evsel);
+}
+
+static bool gvt_event_end(struct perf_evsel *evsel, struct perf_sample *sample,
+			  struct event_key *key)
+{
+	if (!strcmp(evsel->name, gvt_mmio_trace)) {
+		key->key  = perf_evsel__intval(evsel, sample, "offset");
+		key->info = perf_evsel__intval(evsel, sample, "write");
+		return true;
+	}
+
+	return false;
+}
+
+static void gvt_event_decode_key(struct perf_kvm_stat *kvm __maybe_unused,
+				 struct event_key *key,
+				 char *decode)
+{
+	scnprintf(decode, decode_str_len, "%#lx:%s",
+		  (unsigned long)key->key, key->info ? "W" : "R");
+}
+
+static struct kvm_events_ops gvt_events = {
+	.is_begin_event = gvt_event_begin,
+	.is_end_event = gvt_event_end,
+	.decode_key = gvt_event_decode_key,
+	.name = "GVT MMIO Access"
+};
+
 const char *kvm_events_tp[] = {
 	"kvm:kvm_entry",
 	"kvm:kvm_exit",
 	"kvm:kvm_mmio",
 	"kvm:kvm_pio",
+	NULL, /* gvt:vgpu_mmio, see setup_kvm_events_tp() */
 	NULL,
 };
 
@@ -143,9 +187,25 @@ struct kvm_reg_events_ops kvm_reg_events_ops[] = {
 	{ .name = "vmexit", .ops = &exit_events },
 	{ .name = "mmio", .ops = &mmio_events },
 	{ .name = "ioport", .ops = &ioport_events },
+	{ .name = "gvt", .ops = &gvt_events },
 	{ NULL, NULL },
 };
 
+/* Only record the GVT tracepoint on hosts that have it. */
+int setup_kvm_events_tp(struct perf_kvm_stat *kvm __maybe_unused)
+{
+	const char **tp;
+
+	for (tp = kvm_events_tp; *tp; tp++) {
+		if (!strcmp(*tp, gvt_mmio_trace))
+			return 0;
+	}
+
+	if (is_valid_tracepoint(gvt_mmio_trace))
+		*tp = gvt_mmio_trace;
+	return 0;
+}
+
 const char * const kvm_skip_events[] = {
 	"HLT",
 	NULL,
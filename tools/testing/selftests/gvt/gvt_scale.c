@@ -0,0 +1,825 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/*
+ * gvt_scale.c - GVT-g vGPU scaling benchmark
+ *
+ * This test should be run as root and should not be included in the
+ * Kselftest run. It needs a GVT-g capable host with kvmgt loaded.
+ *
+ * The test creates busy and idle vGPUs through the mdev sysfs interface
+ * and opens each of them through VFIO, attached to a KVM VM of its own
+ * that has memory but no vCPU. A thread per busy vGPU then drives
+ * synthetic load through the BAR0 region of its vGPU:
+ *
+ *	mmio	reads and writes of the PV info page
+ *	ggtt	updates of GGTT entries
+ *	submit	render workloads of MI_NOOPs submitted through the ELSP
+ *
+ * Every access is a trap into GVT, so its latency is the latency of the
+ * emulation path. At the end the test reports the latency percentiles of
+ * each access type, the fairness of engine time and completed workloads
+ * between the busy vGPUs, and the host CPU spent per vGPU.
+ *
+ * Usage:
+ *	sudo ./gvt_scale -p 0000:00:02.0 -t i915-GVTg_V5_8 -b 4 -i 4 -d 10
+ *
+ *	gvt_scale.sh runs it for a growing number of vGPUs.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <linux/kvm.h>
+#include <linux/vfio.h>
+
+#define PAGE_SIZE		4096UL
+
+/* PV info page, see i915_pvinfo.h */
+#define VGT_PVINFO_PAGE		0x78000
+#define VGT_MAGIC		0x4776544776544776ULL
+#define PVINFO_MAGIC		(VGT_PVINFO_PAGE + 0x0)
+#define PVINFO_HIDDEN_BASE	(VGT_PVINFO_PAGE + 0x48)
+#define PVINFO_HIDDEN_SIZE	(VGT_PVINFO_PAGE + 0x4c)
+#define PVINFO_CTX_DESC_LO	(VGT_PVINFO_PAGE + 0x858)
+
+/* render engine */
+#define RING_HWS_PGA		0x2080
+#define RING_ELSP		0x2230
+#define RING_MODE		0x229c
+#define GFX_RUN_LIST_ENABLE	(1 << 15)
+#define MASKED_BIT_ENABLE(a)	(((a) << 16) | (a))
+
+/* the GGTT is in the upper half of the 16MB of BAR0 */
+#define GGTT_OFFSET		(8UL << 20)
+#define GGTT_PAGE_PRESENT	(1 << 0)
+
+/* context descriptor */
+#define CTX_DESC_VALID		(1 << 0)
+#define CTX_DESC_ADDRESSING_64B	(3 << 3)
+#define CTX_DESC_LLC		(1 << 5)
+#define CTX_DESC_PRIVILEGE	(1 << 8)
+
+/* value dwords of the ring context, which is the page after the LRCA */
+#define CTX_RING_HEAD		0x05
+#define CTX_RING_TAIL		0x07
+#define CTX_RB_START		0x09
+#define CTX_RB_CTRL		0x0b
+#define CTX_PDP0_UDW		0x31
+#define CTX_PDP0_LDW		0x33
+#define RING_VALID		(1 << 0)
+
+/*
+ * Guest memory layout, in pages. The first MAPPED_PAGES pages are mapped
+ * 1:1 at the start of the hidden GM of the vGPU, the GGTT load rewrites
+ * the CHURN_PAGES entries after them.
+ */
+#define GUEST_MEM_SIZE		(4UL << 20)
+#define PML4_PAGE		1
+#define HWSP_PAGE		2
+#define RING_PAGE		4
+#define RING_PAGES		4
+#define CTX_PAGE		8
+#define CTX_PAGES		32
+#define MAPPED_PAGES		64
+#define CHURN_PAGES		256
+
+#define SUBMIT_TIMEOUT_NS	1000000000ULL
+#define MAX_SAMPLES		(1 << 20)
+
+enum load {
+	LOAD_MMIO_READ,
+	LOAD_MMIO_WRITE,
+	LOAD_GGTT,
+	LOAD_SUBMIT,
+	LOAD_MAX,
+};
+
+static const char * const load_names[LOAD_MAX] = {
+	[LOAD_MMIO_READ] = "mmio_read",
+	[LOAD_MMIO_WRITE] = "mmio_write",
+	[LOAD_GGTT] = "ggtt_write",
+	[LOAD_SUBMIT] = "workload",
+};
+
+/* latency samples, reservoir sampled once there are MAX_SAMPLES */
+struct samples {
+	uint32_t *ns;
+	uint64_t count;
+	unsigned int n;
+};
+
+struct vgpu {
+	int index;
+	bool busy;
+	char uuid[37];
+
+	int container;
+	int group;
+	int device;
+	int kvm;
+	int vm;
+	int kvm_vfio;
+	off_t bar0;
+	uint8_t *mem;
+	uint32_t hidden_base;
+	uint32_t ring_tail;
+
+	pthread_t thread;
+	unsigned int seed;
+	struct samples lat[LOAD_MAX];
+	uint64_t hangs;
+	struct timeval utime;
+	struct timeval stime;
+	uint64_t busy_ns[2];
+};
+
+static const char *parent;
+static const char *type;
+static unsigned int nr_busy = 1, nr_idle;
+static unsigned int duration = 10;
+static unsigned int loads = (1 << LOAD_MMIO_READ) | (1 << LOAD_MMIO_WRITE) |
+			    (1 << LOAD_GGTT) | (1 << LOAD_SUBMIT);
+static unsigned int workload_dwords = 64;
+static volatile sig_atomic_t stop;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sample(struct vgpu *v, enum load load, uint64_t ns)
+{
+	struct samples *s = &v->lat[load];
+	uint64_t i = s->count++;
+
+	if (ns > UINT32_MAX)
+		ns = UINT32_MAX;
+
+	if (s->n < MAX_SAMPLES) {
+		s->ns[s->n++] = ns;
+		return;
+	}
+
+	i = ((uint64_t)rand_r(&v->seed) << 31 | rand_r(&v->seed)) % (i + 1);
+	if (i < MAX_SAMPLES)
+		s->ns[i] = ns;
+}
+
+static int write_file(const char *path, const char *buf)
+{
+	int fd, ret;
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -errno;
+	ret = write(fd, buf, strlen(buf)) < 0 ? -errno : 0;
+	close(fd);
+	return ret;
+}
+
+static int read_file(const char *path, char *buf, size_t size)
+{
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len < 0)
+		return -errno;
+	buf[len] = '\0';
+	return 0;
+}
+
+static uint32_t mmio_read32(struct vgpu *v, uint32_t offset)
+{
+	uint32_t val = 0;
+
+	if (pread(v->device, &val, 4, v->bar0 + offset) != 4)
+		v->hangs++;
+	return val;
+}
+
+static void mmio_write32(struct vgpu *v, uint32_t offset, uint32_t val)
+{
+	if (pwrite(v->device, &val, 4, v->bar0 + offset) != 4)
+		v->hangs++;
+}
+
+static void ggtt_write(struct vgpu *v, uint32_t gm, uint64_t gpa)
+{
+	uint64_t pte = gpa | GGTT_PAGE_PRESENT;
+
+	if (pwrite(v->device, &pte, 8,
+		   v->bar0 + GGTT_OFFSET + gm / PAGE_SIZE * 8) != 8)
+		v->hangs++;
+}
+
+static uint32_t *guest_page(struct vgpu *v, unsigned int page)
+{
+	return (uint32_t *)(v->mem + page * PAGE_SIZE);
+}
+
+static uint32_t gm_addr(struct vgpu *v, unsigned int page)
+{
+	return v->hidden_base + page * PAGE_SIZE;
+}
+
+/* Sum of the busy time of all the engines of the vGPU. */
+static uint64_t vgpu_busy_ns(struct vgpu *v)
+{
+	char path[PATH_MAX], buf[1024], *p;
+	uint64_t sum = 0;
+
+	snprintf(path, sizeof(path),
+		 "/sys/bus/mdev/devices/%s/intel_vgpu/engine_busy_ns", v->uuid);
+	if (read_file(path, buf, sizeof(buf)))
+		return 0;
+
+	for (p = strtok(buf, "\n"); p; p = strtok(NULL, "\n")) {
+		char *ns = strrchr(p, ' ');
+
+		if (ns)
+			sum += strtoull(ns + 1, NULL, 10);
+	}
+	return sum;
+}
+
+/* Busy and total jiffies of all the host CPUs. */
+static void host_cpu(uint64_t *busy, uint64_t *total)
+{
+	unsigned long long val[8] = { 0 };
+	char buf[512];
+	int i;
+
+	*busy = *total = 0;
+	if (read_file("/proc/stat", buf, sizeof(buf)))
+		return;
+
+	sscanf(buf, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+	       &val[0], &val[1], &val[2], &val[3], &val[4], &val[5],
+	       &val[6], &val[7]);
+	for (i = 0; i < 8; i++)
+		*total += val[i];
+	/* idle and iowait */
+	*busy = *total - val[3] - val[4];
+}
+
+static int vgpu_create(struct vgpu *v)
+{
+	char path[PATH_MAX];
+	int ret;
+
+	ret = read_file("/proc/sys/kernel/random/uuid", v->uuid,
+			sizeof(v->uuid));
+	if (ret)
+		return ret;
+
+	snprintf(path, sizeof(path),
+		 "/sys/bus/pci/devices/%s/mdev_supported_types/%s/create",
+		 parent, type);
+	return write_file(path, v->uuid);
+}
+
+static void vgpu_remove(struct vgpu *v)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "/sys/bus/mdev/devices/%s/remove",
+		 v->uuid);
+	if (write_file(path, "1"))
+		printf("failed to remove vgpu %s\n", v->uuid);
+}
+
+/*
+ * Open the vGPU through VFIO. kvmgt refuses the open unless the VFIO group
+ * is attached to a KVM, and pins guest pages through the IOMMU container,
+ * so both get the same guest memory at gpa 0.
+ */
+static int vgpu_open(struct vgpu *v)
+{
+	struct kvm_userspace_memory_region slot = {
+		.guest_phys_addr = 0,
+		.memory_size = GUEST_MEM_SIZE,
+	};
+	struct vfio_iommu_type1_dma_map dma_map = {
+		.argsz = sizeof(dma_map),
+		.flags = VFIO_DMA_MAP_FLAG_READ | VFIO_DMA_MAP_FLAG_WRITE,
+		.iova = 0,
+		.size = GUEST_MEM_SIZE,
+	};
+	struct vfio_group_status status = { .argsz = sizeof(status) };
+	struct vfio_region_info bar0 = {
+		.argsz = sizeof(bar0),
+		.index = VFIO_PCI_BAR0_REGION_INDEX,
+	};
+	struct kvm_create_device dev = { .type = KVM_DEV_TYPE_VFIO };
+	struct kvm_device_attr attr = {
+		.group = KVM_DEV_VFIO_GROUP,
+		.attr = KVM_DEV_VFIO_GROUP_ADD,
+	};
+	char path[PATH_MAX], link[PATH_MAX], *grp;
+	ssize_t len;
+
+	snprintf(path, sizeof(path), "/sys/bus/mdev/devices/%s/iommu_group",
+		 v->uuid);
+	len = readlink(path, link, sizeof(link) - 1);
+	if (len < 0)
+		return -errno;
+	link[len] = '\0';
+	grp = strrchr(link, '/');
+	snprintf(path, sizeof(path), "/dev/vfio/%.16s", grp ? grp + 1 : link);
+
+	v->container = open("/dev/vfio/vfio", O_RDWR);
+	v->group = open(path, O_RDWR);
+	if (v->container < 0 || v->group < 0)
+		return -errno;
+
+	if (ioctl(v->group, VFIO_GROUP_GET_STATUS, &status) ||
+	    !(status.flags & VFIO_GROUP_FLAGS_VIABLE))
+		return -EINVAL;
+	if (ioctl(v->group, VFIO_GROUP_SET_CONTAINER, &v->container) ||
+	    ioctl(v->container, VFIO_SET_IOMMU, VFIO_TYPE1_IOMMU))
+		return -errno;
+
+	v->mem = mmap(NULL, GUEST_MEM_SIZE, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (v->mem == MAP_FAILED) {
+		v->mem = NULL;
+		return -ENOMEM;
+	}
+
+	dma_map.vaddr = (uintptr_t)v->mem;
+	if (ioctl(v->container, VFIO_IOMMU_MAP_DMA, &dma_map))
+		return -errno;
+
+	v->kvm = open("/dev/kvm", O_RDWR);
+	if (v->kvm < 0)
+		return -errno;
+	v->vm = ioctl(v->kvm, KVM_CREATE_VM, 0);
+	if (v->vm < 0)
+		return -errno;
+
+	slot.userspace_addr = (uintptr_t)v->mem;
+	if (ioctl(v->vm, KVM_SET_USER_MEMORY_REGION, &slot))
+		return -errno;
+
+	if (ioctl(v->vm, KVM_CREATE_DEVICE, &dev))
+		return -errno;
+	v->kvm_vfio = dev.fd;
+	attr.addr = (uintptr_t)&v->group;
+	if (ioctl(v->kvm_vfio, KVM_SET_DEVICE_ATTR, &attr))
+		return -errno;
+
+	v->device = ioctl(v->group, VFIO_GROUP_GET_DEVICE_FD, v->uuid);
+	if (v->device < 0)
+		return -errno;
+	if (ioctl(v->device, VFIO_DEVICE_GET_REGION_INFO, &bar0))
+		return -errno;
+	v->bar0 = bar0.offset;
+	return 0;
+}
+
+static void vgpu_close(struct vgpu *v)
+{
+	if (v->device > 0)
+		close(v->device);
+	if (v->kvm_vfio > 0)
+		close(v->kvm_vfio);
+	if (v->vm > 0)
+		close(v->vm);
+	if (v->kvm > 0)
+		close(v->kvm);
+	if (v->group > 0)
+		close(v->group);
+	if (v->container > 0)
+		close(v->container);
+	if (v->mem)
+		munmap(v->mem, GUEST_MEM_SIZE);
+}
+
+/*
+ * Set the vGPU up the way a guest driver would before it can submit:
+ * read the PV info, map its memory into the hidden GM, build a render
+ * context around an empty ring and switch the render engine to execlists.
+ */
+static int vgpu_init_guest(struct vgpu *v)
+{
+	uint32_t *ctx = guest_page(v, CTX_PAGE + 1);
+	uint64_t magic;
+	unsigned int i;
+
+	magic = mmio_read32(v, PVINFO_MAGIC) |
+		(uint64_t)mmio_read32(v, PVINFO_MAGIC + 4) << 32;
+	if (magic != VGT_MAGIC) {
+		printf("vgpu %s: bad PV info magic %#llx\n", v->uuid,
+		       (unsigned long long)magic);
+		return -ENODEV;
+	}
+
+	v->hidden_base = mmio_read32(v, PVINFO_HIDDEN_BASE);
+	if (mmio_read32(v, PVINFO_HIDDEN_SIZE) <
+	    (MAPPED_PAGES + CHURN_PAGES) * PAGE_SIZE) {
+		printf("vgpu %s: hidden GM too small\n", v->uuid);
+		return -ENOSPC;
+	}
+
+	for (i = 0; i < MAPPED_PAGES; i++)
+		ggtt_write(v, gm_addr(v, i), i * PAGE_SIZE);
+
+	/* GVT only needs a present PML4 root for an empty ring */
+	guest_page(v, PML4_PAGE)[0] = 0;
+	ctx[CTX_RING_HEAD] = 0;
+	ctx[CTX_RING_TAIL] = 0;
+	ctx[CTX_RB_START] = gm_addr(v, RING_PAGE);
+	ctx[CTX_RB_CTRL] = ((RING_PAGES - 1) << 12) | RING_VALID;
+	ctx[CTX_PDP0_UDW] = 0;
+	ctx[CTX_PDP0_LDW] = PML4_PAGE * PAGE_SIZE;
+	v->ring_tail = 0;
+
+	mmio_write32(v, RING_HWS_PGA, gm_addr(v, HWSP_PAGE));
+	mmio_write32(v, RING_MODE, MASKED_BIT_ENABLE(GFX_RUN_LIST_ENABLE));
+	return v->hangs ? -EIO : 0;
+}
+
+/* Submit a workload of workload_dwords MI_NOOPs to the render engine. */
+static void submit(struct vgpu *v)
+{
+	uint32_t *ctx = guest_page(v, CTX_PAGE + 1);
+	uint32_t desc = gm_addr(v, CTX_PAGE) | CTX_DESC_PRIVILEGE |
+			CTX_DESC_LLC | CTX_DESC_ADDRESSING_64B | CTX_DESC_VALID;
+
+	/* the ring is zeroed, which is all MI_NOOPs */
+	v->ring_tail = (v->ring_tail + workload_dwords * 4) %
+		       (RING_PAGES * PAGE_SIZE);
+	ctx[CTX_RING_TAIL] = v->ring_tail;
+	__sync_synchronize();
+
+	/* element 1 first, the write of element 0 low submits */
+	mmio_write32(v, RING_ELSP, 0);
+	mmio_write32(v, RING_ELSP, 0);
+	mmio_write32(v, RING_ELSP, v->index + 1);
+	mmio_write32(v, RING_ELSP, desc);
+}
+
+/* GVT writes the tail of a completed workload back to the ring head */
+static bool submit_done(struct vgpu *v)
+{
+	volatile uint32_t *ctx = guest_page(v, CTX_PAGE + 1);
+
+	return ctx[CTX_RING_HEAD] == v->ring_tail;
+}
+
+static void *load_thread(void *arg)
+{
+	struct vgpu *v = arg;
+	uint64_t t, submitted = 0;
+	unsigned int churn = 0;
+	bool inflight = false;
+	struct rusage ru;
+
+	while (!stop) {
+		if (loads & (1 << LOAD_MMIO_READ)) {
+			t = now_ns();
+			mmio_read32(v, PVINFO_MAGIC);
+			sample(v, LOAD_MMIO_READ, now_ns() - t);
+		}
+
+		if (loads & (1 << LOAD_MMIO_WRITE)) {
+			t = now_ns();
+			mmio_write32(v, PVINFO_CTX_DESC_LO, churn);
+			sample(v, LOAD_MMIO_WRITE, now_ns() - t);
+		}
+
+		if (loads & (1 << LOAD_GGTT)) {
+			t = now_ns();
+			ggtt_write(v, gm_addr(v, MAPPED_PAGES + churn),
+				   (churn % MAPPED_PAGES) * PAGE_SIZE);
+			sample(v, LOAD_GGTT, now_ns() - t);
+			churn = (churn + 1) % CHURN_PAGES;
+		}
+
+		if (loads & (1 << LOAD_SUBMIT)) {
+			t = now_ns();
+			if (!inflight) {
+				submit(v);
+				submitted = t;
+				inflight = true;
+			} else if (submit_done(v)) {
+				sample(v, LOAD_SUBMIT, t - submitted);
+				inflight = false;
+			} else if (t - submitted > SUBMIT_TIMEOUT_NS) {
+				printf("vgpu %s: workload timed out\n",
+				       v->uuid);
+				v->hangs++;
+				break;
+			}
+		}
+	}
+
+	getrusage(RUSAGE_THREAD, &ru);
+	v->utime = ru.ru_utime;
+	v->stime = ru.ru_stime;
+	return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(const uint32_t *ns, unsigned int n, double p)
+{
+	unsigned int i = p * (n - 1) / 100;
+
+	return ns[i] / 1000.0;
+}
+
+/* Jain's fairness index, 1.0 when all the values are equal */
+static double fairness(const double *x, unsigned int n)
+{
+	double sum = 0, sq = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		sum += x[i];
+		sq += x[i] * x[i];
+	}
+	return sq ? sum * sum / (n * sq) : 1.0;
+}
+
+static double tv_ms(struct timeval tv)
+{
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void report(struct vgpu *vgpus, unsigned int nr, double secs,
+		   uint64_t cpu_busy, uint64_t cpu_total)
+{
+	double engine[nr_busy ?: 1], done[nr_busy ?: 1];
+	double user_ms = 0, sys_ms = 0;
+	unsigned int i, j, n;
+	uint32_t *all;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	printf("\n%u busy, %u idle vGPUs, %.1fs\n\n", nr_busy, nr_idle, secs);
+	printf("%-12s %10s %9s %9s %9s %9s %9s  (us)\n", "load", "ops/s",
+	       "p50", "p90", "p99", "p99.9", "max");
+
+	all = malloc(sizeof(*all) * MAX_SAMPLES * (nr_busy ?: 1));
+	if (!all)
+		return;
+
+	for (j = 0; j < LOAD_MAX; j++) {
+		uint64_t count = 0;
+
+		if (!(loads & (1 << j)))
+			continue;
+
+		n = 0;
+		for (i = 0; i < nr_busy; i++) {
+			memcpy(all + n, vgpus[i].lat[j].ns,
+			       vgpus[i].lat[j].n * sizeof(*all));
+			n += vgpus[i].lat[j].n;
+			count += vgpus[i].lat[j].count;
+		}
+		if (!n)
+			continue;
+
+		qsort(all, n, sizeof(*all), cmp_u32);
+		printf("%-12s %10.0f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+		       load_names[j], count / secs, percentile(all, n, 50),
+		       percentile(all, n, 90), percentile(all, n, 99),
+		       percentile(all, n, 99.9), all[n - 1] / 1000.0);
+	}
+	free(all);
+
+	printf("\n%-36s %5s %12s %12s %10s %10s\n", "vgpu", "busy",
+	       "engine_ms", "workloads", "user_ms", "sys_ms");
+	for (i = 0, n = 0; i < nr; i++) {
+		struct vgpu *v = &vgpus[i];
+		double busy_ms = (v->busy_ns[1] - v->busy_ns[0]) / 1e6;
+
+		printf("%-36s %5s %12.1f %12llu %10.1f %10.1f\n", v->uuid,
+		       v->busy ? "yes" : "no", busy_ms,
+		       (unsigned long long)v->lat[LOAD_SUBMIT].count,
+		       tv_ms(v->utime), tv_ms(v->stime));
+		if (!v->busy)
+			continue;
+
+		engine[n] = busy_ms;
+		done[n] = v->lat[LOAD_SUBMIT].count;
+		user_ms += tv_ms(v->utime);
+		sys_ms += tv_ms(v->stime);
+		n++;
+	}
+
+	if (n) {
+		printf("\nfairness (Jain's index, 1.0 is fair): engine time %.3f, workloads %.3f\n",
+		       fairness(engine, n), fairness(done, n));
+		printf("load threads: %.1f ms/s user, %.1f ms/s system per busy vGPU\n",
+		       user_ms / secs / n, sys_ms / secs / n);
+	}
+
+	if (cpu_total)
+		printf("host CPU: %.2f of %ld CPUs busy, %.3f per vGPU\n",
+		       (double)cpu_busy / cpu_total * ncpus, ncpus,
+		       (double)cpu_busy / cpu_total * ncpus / nr);
+}
+
+static unsigned int parse_loads(char *arg)
+{
+	unsigned int mask = 0;
+	char *p;
+
+	for (p = strtok(arg, ","); p; p = strtok(NULL, ",")) {
+		if (!strcmp(p, "mmio"))
+			mask |= (1 << LOAD_MMIO_READ) | (1 << LOAD_MMIO_WRITE);
+		else if (!strcmp(p, "ggtt"))
+			mask |= 1 << LOAD_GGTT;
+		else if (!strcmp(p, "submit"))
+			mask |= 1 << LOAD_SUBMIT;
+		else
+			return 0;
+	}
+	return mask;
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s -p <parent> -t <type> [-b busy] [-i idle] [-d seconds]\n"
+	       "\t[-m mmio,ggtt,submit] [-w workload dwords]\n"
+	       "\t-p\tPCI address of the GVT-g device, e.g. 0000:00:02.0\n"
+	       "\t-t\tmdev type of the vGPUs, e.g. i915-GVTg_V5_8\n",
+	       prog);
+}
+
+static void handle_signal(int sig __attribute__((unused)))
+{
+	stop = 1;
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t cpu_busy[2], cpu_total[2], start;
+	struct vgpu *vgpus;
+	unsigned int i, j, nr, created = 0;
+	int opt, ret = 1;
+
+	while ((opt = getopt(argc, argv, "p:t:b:i:d:m:w:h")) != -1) {
+		switch (opt) {
+		case 'p':
+			parent = optarg;
+			break;
+		case 't':
+			type = optarg;
+			break;
+		case 'b':
+			nr_busy = atoi(optarg);
+			break;
+		case 'i':
+			nr_idle = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'm':
+			loads = parse_loads(optarg);
+			break;
+		case 'w':
+			workload_dwords = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			exit(-1);
+		}
+	}
+
+	nr = nr_busy + nr_idle;
+	if (!parent || !type || !nr || !loads || !duration ||
+	    !workload_dwords || workload_dwords % 2 ||
+	    workload_dwords * 4 >= RING_PAGES * PAGE_SIZE) {
+		usage(argv[0]);
+		exit(-1);
+	}
+
+	if (geteuid() != 0) {
+		printf("Please run the test as root - Exiting.\n");
+		exit(-1);
+	}
+
+	vgpus = calloc(nr, sizeof(*vgpus));
+	if (!vgpus)
+		exit(-1);
+
+	for (i = 0; i < nr; i++) {
+		struct vgpu *v = &vgpus[i];
+
+		v->index = i;
+		v->busy = i < nr_busy;
+		v->seed = i;
+
+		if (v->busy) {
+			for (j = 0; j < LOAD_MAX; j++) {
+				v->lat[j].ns = malloc(sizeof(uint32_t) *
+						      MAX_SAMPLES);
+				if (!v->lat[j].ns) {
+					ret = 1;
+					goto out;
+				}
+			}
+		}
+
+		ret = vgpu_create(v);
+		if (ret) {
+			printf("failed to create vgpu %u: %s\n", i,
+			       strerror(-ret));
+			goto out;
+		}
+		created++;
+
+		ret = vgpu_open(v);
+		if (ret) {
+			printf("failed to open vgpu %s: %s\n", v->uuid,
+			       strerror(-ret));
+			goto out;
+		}
+
+		if (v->busy) {
+			ret = vgpu_init_guest(v);
+			if (ret)
+				goto out;
+		}
+	}
+
+	signal(SIGINT, handle_signal);
+
+	for (i = 0; i < nr; i++)
+		vgpus[i].busy_ns[0] = vgpu_busy_ns(&vgpus[i]);
+	host_cpu(&cpu_busy[0], &cpu_total[0]);
+	start = now_ns();
+
+	for (i = 0; i < nr_busy; i++) {
+		if (pthread_create(&vgpus[i].thread, NULL, load_thread,
+				   &vgpus[i])) {
+			stop = 1;
+			nr_busy = i;
+			break;
+		}
+	}
+
+	for (i = 0; i < duration && !stop; i++)
+		sleep(1);
+	stop = 1;
+
+	for (i = 0; i < nr_busy; i++)
+		pthread_join(vgpus[i].thread, NULL);
+
+	host_cpu(&cpu_busy[1], &cpu_total[1]);
+	for (i = 0; i < nr; i++)
+		vgpus[i].busy_ns[1] = vgpu_busy_ns(&vgpus[i]);
+
+	report(vgpus, nr, (now_ns() - start) / 1e9,
+	       cpu_busy[1] - cpu_busy[0], cpu_total[1] - cpu_total[0]);
+
+	ret = 0;
+	for (i = 0; i < nr_busy; i++) {
+		if (vgpus[i].hangs) {
+			printf("vgpu %s: %llu failed accesses or hangs\n",
+			       vgpus[i].uuid,
+			       (unsigned long long)vgpus[i].hangs);
+			ret = 1;
+		}
+	}
+
+out:
+	for (i = 0; i < nr; i++) {
+		vgpu_close(&vgpus[i]);
+		if (i < created)
+			vgpu_remove(&vgpus[i]);
+		for (j = 0; j < LOAD_MAX; j++)
+			free(vgpus[i].lat[j].ns);
+	}
+	free(vgpus);
+	return ret;
+}
@@ -0,0 +1,39 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Run gvt_scale for a growing number of vGPUs, half of them busy, to show
+# how the emulation latency, fairness and host CPU cost scale.
+#
+# Usage: sudo ./gvt_scale.sh <parent> <type> [counts] [seconds]
+#	sudo ./gvt_scale.sh 0000:00:02.0 i915-GVTg_V5_8 "1 2 4 8" 10
+
+parent=$1
+type=$2
+counts=${3:-"1 2 4 8"}
+secs=${4:-10}
+
+if [ -z "$parent" ] || [ -z "$type" ]; then
+	echo "Usage: $0 <parent> <type> [counts] [seconds]"
+	exit 1
+fi
+
+avail=/sys/bus/pci/devices/$parent/mdev_supported_types/$type/available_instances
+if [ ! -r "$avail" ]; then
+	echo "$parent has no mdev type $type"
+	exit 1
+fi
+
+ret=0
+for n in $counts; do
+	busy=$(( (n + 1) / 2 ))
+	idle=$(( n - busy ))
+
+	if [ "$n" -gt "$(cat "$avail")" ]; then
+		echo "skipping $n vGPUs, only $(cat "$avail") available"
+		continue
+	fi
+
+	echo "=== $n vGPUs ==="
+	./gvt_scale -p "$parent" -t "$type" -b $busy -i $idle -d "$secs" || ret=1
+done
+exit $ret
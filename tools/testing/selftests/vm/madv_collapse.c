@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Test MADV_COLLAPSE: a range faulted in with small pages gets collapsed
+ * into THPs by khugepaged, and ranges that don't qualify are refused.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifndef MADV_COLLAPSE
+#define MADV_COLLAPSE	25
+#endif
+
+#define KSFT_SKIP	4
+
+#define HPAGE_SIZE	(2UL << 20)
+#define NR_HPAGES	4
+#define TIMEOUT_SECS	30
+
+static int thp_enabled(void)
+{
+	char buf[128];
+	FILE *f;
+	int ret;
+
+	f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+	if (!f)
+		return 0;
+	ret = fgets(buf, sizeof(buf), f) && !strstr(buf, "[never]");
+	fclose(f);
+	return ret;
+}
+
+/* AnonHugePages of the mapping at @addr, in kB */
+static long anon_huge_kb(void *addr)
+{
+	unsigned long start, end;
+	char line[256];
+	int found = 0;
+	long kb = -1;
+	FILE *f;
+
+	f = fopen("/proc/self/smaps", "r");
+	if (!f)
+		return -1;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+			found = start <= (unsigned long)addr &&
+				(unsigned long)addr < end;
+			continue;
+		}
+		if (found && sscanf(line, "AnonHugePages: %ld kB", &kb) == 1)
+			break;
+	}
+	fclose(f);
+	return kb;
+}
+
+int main(int argc, char **argv)
+{
+	size_t len = NR_HPAGES * HPAGE_SIZE;
+	long page_size = sysconf(_SC_PAGESIZE);
+	char *map, *p;
+	int i;
+
+	if (!thp_enabled()) {
+		printf("THP is disabled, skipping\n");
+		return KSFT_SKIP;
+	}
+
+	/* over-allocate to get a huge page aligned range */
+	map = mmap(NULL, len + HPAGE_SIZE, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	p = (char *)(((unsigned long)map + HPAGE_SIZE - 1) & ~(HPAGE_SIZE - 1));
+
+	/* fault the range in with small pages */
+	if (madvise(p, len, MADV_NOHUGEPAGE)) {
+		perror("MADV_NOHUGEPAGE");
+		return 1;
+	}
+	for (i = 0; i < len; i += page_size)
+		p[i] = 1;
+
+	/* a range that doesn't qualify for THPs is refused */
+	if (!madvise(p, len, MADV_COLLAPSE)) {
+		printf("MADV_COLLAPSE of a MADV_NOHUGEPAGE range succeeded\n");
+		return 1;
+	}
+
+	if (madvise(p, len, MADV_HUGEPAGE)) {
+		perror("MADV_HUGEPAGE");
+		return 1;
+	}
+	if (madvise(p, len, MADV_COLLAPSE)) {
+		if (errno == EINVAL) {
+			printf("MADV_COLLAPSE isn't supported, skipping\n");
+			return KSFT_SKIP;
+		}
+		perror("MADV_COLLAPSE");
+		return 1;
+	}
+
+	for (i = 0; i < TIMEOUT_SECS * 10; i++) {
+		if (anon_huge_kb(p) >= (long)(len >> 10)) {
+			printf("collapsed %zu kB in %d ms\n", len >> 10, i * 100);
+			return 0;
+		}
+		usleep(100000);
+	}
+
+	printf("range not collapsed after %d s, AnonHugePages: %ld kB\n",
+	       TIMEOUT_SECS, anon_huge_kb(p));
+	return 1;
+}
@@ -52,7 +52,9 @@ static int coalesced_mmio_has_room(struct kvm_coalesced_mmio_dev *dev)
 	 * there is always one unused entry in the buffer
 	 */
 	ring = dev->kvm->coalesced_mmio_ring;
-	avail = (ring->first - ring->last - 1) % KVM_COALESCED_MMIO_MAX;
+	/* first is advanced by userspace as it consumes the entries */
+	avail = (READ_ONCE(ring->first) - READ_ONCE(ring->last) - 1) %
+		KVM_COALESCED_MMIO_MAX;
 	if (avail == 0) {
 		/* full */
 		return 0;
@@ -71,6 +73,15 @@ static int coalesced_mmio_write(struct kvm_vcpu *vcpu,
 	if (!coalesced_mmio_in_range(dev, addr, len))
 		return -EOPNOTSUPP;
 
+	/*
+	 * Once the ring is full, every vCPU writing to a coalesced zone has
+	 * to exit anyway, don't make them queue up on the lock first just to
+	 * find that out. The check is repeated under the lock, this one can
+	 * at worst send a write out that would have just fit.
+	 */
+	if (!coalesced_mmio_has_room(dev))
+		return -EOPNOTSUPP;
+
 	spin_lock(&dev->kvm->ring_lock);
 
 	if (!coalesced_mmio_has_room(dev)) {
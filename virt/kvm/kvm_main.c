@@ -1127,6 +1127,10 @@ EXPORT_SYMBOL_GPL(kvm_get_dirty_log);
  * the snapshot taken before and step 4 ensures that writes done after
  * exiting to userspace will be logged for the next call.
  *
+ * The snapshot itself is taken with atomic exchanges, so mmu_lock is only
+ * needed for the write protection and is not taken at all while scanning
+ * a slot that has not been dirtied.
+ *
  */
 int kvm_get_dirty_log_protect(struct kvm *kvm,
 			struct kvm_dirty_log *log, bool *is_dirty)
@@ -1137,6 +1141,7 @@ int kvm_get_dirty_log_protect(struct kvm *kvm,
 	unsigned long n;
 	unsigned long *dirty_bitmap;
 	unsigned long *dirty_bitmap_buffer;
+	bool locked = false;
 
 	as_id = log->slot >> 16;
 	id = (u16)log->slot;
@@ -1153,16 +1158,16 @@ int kvm_get_dirty_log_protect(struct kvm *kvm,
 	n = kvm_dirty_bitmap_bytes(memslot);
 
 	dirty_bitmap_buffer = dirty_bitmap + n / sizeof(long);
-	memset(dirty_bitmap_buffer, 0, n);
 
-	spin_lock(&kvm->mmu_lock);
 	*is_dirty = false;
 	for (i = 0; i < n / sizeof(long); i++) {
 		unsigned long mask;
 		gfn_t offset;
 
-		if (!dirty_bitmap[i])
+		if (!dirty_bitmap[i]) {
+			dirty_bitmap_buffer[i] = 0;
 			continue;
+		}
 
 		*is_dirty = true;
 
@@ -1170,13 +1175,19 @@ int kvm_get_dirty_log_protect(struct kvm *kvm,
 		dirty_bitmap_buffer[i] = mask;
 
 		if (mask) {
+			if (!locked) {
+				spin_lock(&kvm->mmu_lock);
+				locked = true;
+			}
+
 			offset = i * BITS_PER_LONG;
 			kvm_arch_mmu_enable_log_dirty_pt_masked(kvm, memslot,
 								offset, mask);
 		}
 	}
 
-	spin_unlock(&kvm->mmu_lock);
+	if (locked)
+		spin_unlock(&kvm->mmu_lock);
 	if (copy_to_user(log->dirty_bitmap, dirty_bitmap_buffer, n))
 		return -EFAULT;
 	return 0;
@@ -3576,6 +3587,7 @@ int kvm_io_bus_register_dev(struct kvm *kvm, enum kvm_bus bus_idx, gpa_t addr,
 
 	return 0;
 }
+EXPORT_SYMBOL_GPL(kvm_io_bus_register_dev);
 
 /* Caller must hold slots_lock. */
 void kvm_io_bus_unregister_dev(struct kvm *kvm, enum kvm_bus bus_idx,
@@ -3614,6 +3626,7 @@ void kvm_io_bus_unregister_dev(struct kvm *kvm, enum kvm_bus bus_idx,
 	kfree(bus);
 	return;
 }
+EXPORT_SYMBOL_GPL(kvm_io_bus_unregister_dev);
 
 struct kvm_io_device *kvm_io_bus_get_dev(struct kvm *kvm, enum kvm_bus bus_idx,
 					 gpa_t addr)